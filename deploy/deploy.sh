@@ -51,8 +51,8 @@ stage() {
         cp "$HRM_BIN" build/
     fi
 
-    # Render service templates
-    for tmpl in deploy/*.service.in; do
+    # Render service and socket templates
+    for tmpl in deploy/*.service.in deploy/*.socket.in; do
         name=$(basename "$tmpl" .in)
         render_service "$tmpl" > "build/services/$name"
     done
@@ -25,12 +25,13 @@ fi
 sudo systemctl disable --now treadmill_io 2>/dev/null || true
 sudo rm -f /etc/systemd/system/treadmill_io.service
 
-# Install services
-for svc in services/*.service; do
+# Install services (and the socket unit that owns treadmill_io's socket)
+for svc in services/*.service services/*.socket; do
     sudo cp "$svc" /etc/systemd/system/
 done
 sudo systemctl daemon-reload
 sudo systemctl enable treadmill-io treadmill-server
+sudo systemctl enable --now treadmill-io.socket
 
 # FTMS only if binary was deployed
 if [ -f ftms-daemon ]; then
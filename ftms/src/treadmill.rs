@@ -37,6 +37,22 @@ impl TreadmillState {
         let incline_tenths = (self.incline_half_pct as i16) * 5;
         crate::protocol::encode_treadmill_data(speed_kmh, incline_tenths, self.distance_meters, self.elapsed_secs)
     }
+
+    /// Take an `ftms` event from treadmill_io. Its fields are already in FTMS
+    /// units (0.01 km/h, 0.1 %), with distance and elapsed time from the
+    /// bus-rate odometer; speed and incline are kept in native units, rounded
+    /// so that encode_ftms_data() gives the same values back. They are the
+    /// motor's reports in every mode: while emulating they trail the
+    /// commanded emu_speed/emu_incline through a ramp, where the status path
+    /// showed the command.
+    pub fn apply_ftms_event(&mut self, msg: &serde_json::Value) {
+        let field = |name: &str| msg.get(name).and_then(|v| v.as_u64()).unwrap_or(0);
+        let speed_kmh = field("speed").min(u16::MAX as u64);
+        self.speed_tenths_mph = ((speed_kmh * 100 + 804) / 1609) as u16;
+        self.incline_half_pct = ((field("incline") + 2) / 5).min(u16::MAX as u64) as u16;
+        self.distance_meters = field("distance_m").min(u32::MAX as u64) as u32;
+        self.elapsed_secs = field("elapsed_s").min(u16::MAX as u64) as u16;
+    }
 }
 
 /// Run the treadmill socket client. Connects, reads state, auto-reconnects.
@@ -95,7 +111,14 @@ async fn connect_and_run(
     let (reader, mut writer) = stream.into_split();
     let mut lines = BufReader::new(reader).lines();
 
-    // Request initial status dump
+    // Only ftms events are used: pushed on each motor report that changes
+    // them, odometry included. Older treadmill_io builds reject the unknown
+    // type and keep sending everything, so status events are the fallback.
+    writer
+        .write_all(b"{\"cmd\":\"subscribe\",\"types\":[\"ftms\"]}\n")
+        .await?;
+
+    // Request the current state (an ftms event, or status from older builds)
     writer
         .write_all(b"{\"cmd\":\"status\"}\n")
         .await?;
@@ -128,6 +151,17 @@ async fn connect_and_run(
                             let msg_type = msg.get("type").and_then(|v| v.as_str()).unwrap_or("");
 
                             match msg_type {
+                                "ftms" => {
+                                    let mut s = state.lock().await;
+                                    s.apply_ftms_event(&msg);
+                                    debug!(
+                                        "FTMS: speed={:.1} mph, incline={:.1}%, {} m, {} s",
+                                        s.speed_tenths_mph as f64 / 10.0,
+                                        s.incline_half_pct as f64 / 2.0,
+                                        s.distance_meters,
+                                        s.elapsed_secs
+                                    );
+                                }
                                 "status" => {
                                     let emu_speed = msg.get("emu_speed")
                                         .and_then(|v| v.as_u64())
@@ -267,3 +301,24 @@ async fn send_oneshot(
     stream.shutdown().await?;
     Ok(())
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_ftms_event_round_trips_through_encode() {
+        let msg = serde_json::json!({
+            "type": "ftms", "ts": 1.5, "speed": 563, "incline": 50,
+            "distance_m": 1609, "elapsed_s": 600
+        });
+        let mut s = TreadmillState::default();
+        s.apply_ftms_event(&msg);
+        assert_eq!(s.speed_tenths_mph, 35);
+        assert_eq!(s.incline_half_pct, 10);
+        assert_eq!(s.distance_meters, 1609);
+        assert_eq!(s.elapsed_secs, 600);
+        // Same bytes as building the characteristic from the event directly
+        assert_eq!(s.encode_ftms_data(), crate::protocol::encode_treadmill_data(563, 50, 1609, 600));
+    }
+}
@@ -81,6 +81,18 @@ async def lifespan(application):
                 elif source in ("console", "emulate"):
                     latest["last_console"][key] = value
                 _enqueue(msg)
+            elif msg_type == "snapshot":
+                # Every key's latest value, on connect or after a gap
+                latest["last_motor"].update(msg.get("motor", {}))
+                # The console stream is the console's or ours, whichever drives the belt
+                order = ("console", "emulate") if state["emulate"] else ("emulate", "console")
+                for source in order:
+                    latest["last_console"].update(msg.get(source, {}))
+            elif msg_type == "gap":
+                # We fell behind treadmill_io's ring; what we missed is
+                # lost, so take a fresh snapshot
+                log.warning("treadmill_io dropped %s events for us", msg.get("dropped"))
+                client.request_snapshot()
             elif msg_type == "status":
                 was_emulating = state["emulate"]
                 state["proxy"] = msg.get("proxy", False)
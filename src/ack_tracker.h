@@ -0,0 +1,153 @@
+/*
+ * ack_tracker.h — AckTracker: command seq numbers through to the motor
+ *
+ * A speed/incline command carrying a client "seq" is acknowledged twice:
+ * once when handle_command() has applied it, and once more when the
+ * value has reached the motor. That second ack is built here, in three
+ * steps per quantity:
+ *
+ *   expect()   IPC thread: the command set the hmph/inc target
+ *   sent()     emulate thread: a frame carrying the target went to the
+ *              motor writer
+ *   echoed()   motor reader: the motor reported the target after that
+ *
+ * Times are µs after the command arrived, so one ack gives the
+ * wait for the next emulate burst and then the motor's round trip.
+ * A newer command for the same key supersedes an outstanding ack, and
+ * check() times out any still open after ACK_TIMEOUT_MS.
+ *
+ * The emulate and motor threads look at one relaxed atomic per frame.
+ * They take the lock only while an ack for that key is outstanding.
+ * sent() also notes every hmph/inc frame. The emulate thread can send a
+ * new target before expect() runs, and expect() counts that frame.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include "kv_protocol.h"
+
+constexpr uint64_t ACK_TIMEOUT_MS = 5000;
+
+enum class AckStage : uint8_t { Motor, Superseded, Timeout };
+
+// One motor-side ack. Times are 0 for superseded/timeout.
+struct AckReport {
+    uint32_t seq;
+    KvKey key;          // Hmph or Inc
+    AckStage stage;
+    int value;          // target: tenths of mph / half-pct, as in status
+    uint64_t sent_us;   // command -> frame handed to the motor writer
+    uint64_t echo_us;   // command -> motor reported the value
+};
+
+class AckTracker {
+public:
+    // Command `seq` set `id`'s target to `value` at `now_us` (mono_us).
+    // True (with *superseded filled) if it replaced an outstanding ack.
+    bool expect(KvKey id, uint32_t seq, int value, uint64_t now_us, AckReport* superseded) {
+        auto* k = slot(id);
+        if (!k) return false;
+        std::lock_guard<std::mutex> lk(mu_);
+        bool replaced = k->stage.load(std::memory_order_relaxed) != Wait::None;
+        if (replaced) *superseded = {k->seq, id, AckStage::Superseded, k->value, 0, 0};
+        k->seq = seq;
+        k->value = value;
+        k->cmd_us = now_us;
+        k->sent_us = 0;
+        k->stage.store(Wait::Frame);  // seq_cst, against sent()'s last_* stores
+        // The emulate thread may have sent the new target already
+        if (k->last_value.load() == value) {
+            uint64_t last_us = k->last_us.load();
+            if (last_us >= now_us) {
+                k->sent_us = last_us;
+                k->stage.store(Wait::Echo, std::memory_order_relaxed);
+            }
+        }
+        return replaced;
+    }
+
+    // Emulate thread: a frame for `id` with hex `value` went out at `now_us`
+    void sent(KvKey id, std::string_view value, uint64_t now_us) {
+        auto* k = slot(id);
+        if (!k) return;
+        int decoded = id == KvKey::Hmph ? decode_speed_hex(value) : decode_incline_hex(value);
+        k->last_us.store(now_us);
+        k->last_value.store(decoded);
+        if (k->stage.load() != Wait::Frame) return;
+        std::lock_guard<std::mutex> lk(mu_);
+        if (k->stage.load(std::memory_order_relaxed) != Wait::Frame || decoded != k->value) return;
+        k->sent_us = now_us;
+        k->stage.store(Wait::Echo, std::memory_order_relaxed);
+    }
+
+    // Motor thread: the motor reported `value` (decoded) for `id`. True
+    // (with *out filled) if that completes an ack.
+    bool echoed(KvKey id, int value, uint64_t now_us, AckReport* out) {
+        auto* k = slot(id);
+        if (!k || k->stage.load(std::memory_order_relaxed) != Wait::Echo) return false;
+        std::lock_guard<std::mutex> lk(mu_);
+        if (k->stage.load(std::memory_order_relaxed) != Wait::Echo || value != k->value) return false;
+        *out = {k->seq, id, AckStage::Motor, k->value, k->sent_us - k->cmd_us, now_us - k->cmd_us};
+        k->stage.store(Wait::None, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Time out acks open longer than ACK_TIMEOUT_MS. Returns the count
+    // written to `out`.
+    size_t check(uint64_t now_us, std::span<AckReport> out) {
+        size_t n = 0;
+        std::lock_guard<std::mutex> lk(mu_);
+        for (auto& k : keys_) {
+            if (n == out.size()) break;
+            if (k.stage.load(std::memory_order_relaxed) == Wait::None) continue;
+            if (now_us < k.cmd_us || now_us - k.cmd_us < ACK_TIMEOUT_MS * 1000) continue;
+            out[n++] = {k.seq, k.id, AckStage::Timeout, k.value, 0, 0};
+            k.stage.store(Wait::None, std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    // Keys sent() and echoed() follow
+    static bool tracks(KvKey id) { return index(id) < 2; }
+
+    bool outstanding(KvKey id) const {
+        size_t i = index(id);
+        return i < keys_.size() && keys_.at(i).stage.load(std::memory_order_relaxed) != Wait::None;
+    }
+
+private:
+    enum class Wait : uint8_t { None, Frame, Echo };
+
+    struct KeyState {
+        KvKey id;
+        std::atomic<Wait> stage{Wait::None};  // written under mu_
+        uint32_t seq = 0;                     // the rest guarded by mu_
+        int value = 0;
+        uint64_t cmd_us = 0;
+        uint64_t sent_us = 0;
+        std::atomic<int> last_value{-1};      // emulate thread: last frame sent, any ack or none
+        std::atomic<uint64_t> last_us{0};
+    };
+
+    static size_t index(KvKey id) {
+        switch (id) {
+            case KvKey::Hmph: return 0;
+            case KvKey::Inc:  return 1;
+            default:          return 2;
+        }
+    }
+
+    KeyState* slot(KvKey id) {
+        size_t i = index(id);
+        return i < keys_.size() ? &keys_.at(i) : nullptr;
+    }
+
+    std::mutex mu_;
+    std::array<KeyState, 2> keys_{KeyState{KvKey::Hmph}, KeyState{KvKey::Inc}};
+};
@@ -0,0 +1,178 @@
+/*
+ * bus_analyzer.h — BusAnalyzer: line use and the console's cycle timing
+ *
+ * Two views of the bus, for tuning the emulate schedule (emu_cycle.h)
+ * against real consoles:
+ *
+ *   Line use per direction: bytes/s and idle % of the console -> motor
+ *   and motor -> console lines, from the readers' byte counts. A byte
+ *   holds the line for 10 bit times (8N1), so at 9600 baud idle % is
+ *   the headroom left for sending setpoints more often.
+ *
+ *   Console cycle timing, from proxied console frames: each burst in
+ *   BURSTS starts with its first key, so the time from one burst start
+ *   to the next gives the console's real gap before each burst, and
+ *   burst 0 to burst 0 its cycle period. A start out of order (a lost
+ *   frame) or after more than BUS_GAP_MAX_US restarts the sequence.
+ *
+ * take() closes the window opened by begin() or the previous take()
+ * (IPC timer). The console thread locks only at burst starts, five
+ * times a cycle.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <mutex>
+#include "emu_cycle.h"
+#include "kv_protocol.h"
+
+constexpr int BUS_STATS_MS = 5000;             // default publish period
+constexpr uint64_t BUS_GAP_MAX_US = 2000000;   // longer = not one cycle
+constexpr int BUS_BITS_PER_BYTE = 10;          // start + 8 data + stop
+
+// Burst that `id` starts (BURSTS[b][0]), or -1
+static constexpr auto BUS_BURST_OF_KEY = [] {
+    std::array<int8_t, KV_KEY_NAMES.size()> out{};
+    for (size_t i = 0; i < out.size(); i++) {
+        out.at(i) = -1;
+        for (int b = 0; b < EMU_BURSTS; b++) {
+            if (i > 0 && kv_cycle_index(KV_KEY_NAMES.at(i)) == BURSTS[b][0]) out.at(i) = static_cast<int8_t>(b);
+        }
+    }
+    return out;
+}();
+
+static_assert(BUS_BURST_OF_KEY.at(static_cast<size_t>(KvKey::Inc)) == 0);
+static_assert(BUS_BURST_OF_KEY.at(static_cast<size_t>(KvKey::Hmph)) == -1);
+static_assert(BUS_BURST_OF_KEY.at(static_cast<size_t>(KvKey::Diag)) == 4);
+
+constexpr int bus_burst_started_by(KvKey id) {
+    return BUS_BURST_OF_KEY.at(static_cast<size_t>(id));
+}
+
+// The keys that start a burst, as a KvStreamParser::set_keys() set
+static constexpr uint32_t BUS_BURST_START_KEYS = [] {
+    uint32_t keys = 0;
+    for (size_t i = 0; i < BUS_BURST_OF_KEY.size(); i++) {
+        if (BUS_BURST_OF_KEY.at(i) >= 0) keys |= kv_key_bit(static_cast<KvKey>(i));
+    }
+    return keys;
+}();
+
+struct BusLineUsage {
+    double bytes_per_sec;
+    double idle_pct;  // 0-100, to 0.1
+};
+
+// Intervals seen in the window; all 0 if none
+struct BusInterval {
+    uint32_t count;
+    uint64_t mean_us;
+    uint64_t min_us;
+    uint64_t max_us;
+};
+
+struct BusUsage {
+    uint64_t window_ms;
+    BusLineUsage console;  // console -> motor
+    BusLineUsage motor;    // motor -> console
+    BusInterval cycle;     // burst 0 start to the next
+    std::array<BusInterval, EMU_BURSTS> gaps;  // previous burst start -> burst b's
+};
+
+class BusAnalyzer {
+public:
+    explicit BusAnalyzer(int baud) : baud_(baud) {}
+
+    // Open the first window: `now_us` (mono_us) and the readers' byte counts
+    void begin(uint64_t now_us, uint32_t console_bytes, uint32_t motor_bytes) {
+        std::lock_guard<std::mutex> lk(mu_);
+        window_us_ = now_us;
+        console_bytes_ = console_bytes;
+        motor_bytes_ = motor_bytes;
+    }
+
+    // Console thread: a proxied console frame for `id` at `now_us`
+    void console_frame(KvKey id, uint64_t now_us) {
+        int b = bus_burst_started_by(id);
+        if (b < 0) return;
+        std::lock_guard<std::mutex> lk(mu_);
+        bool in_order = last_burst_ >= 0 && b == (last_burst_ + 1) % EMU_BURSTS &&
+                        now_us > last_start_us_ && now_us - last_start_us_ <= BUS_GAP_MAX_US;
+        if (in_order) {
+            add(gaps_.at(static_cast<size_t>(b)), now_us - last_start_us_);
+            run_++;
+        } else {
+            run_ = 1;
+        }
+        if (b == 0) {
+            // Six starts in order: 0, 1, 2, 3, 4 and this 0
+            if (run_ > EMU_BURSTS) add(cycle_, now_us - cycle_start_us_);
+            cycle_start_us_ = now_us;
+        }
+        last_burst_ = b;
+        last_start_us_ = now_us;
+    }
+
+    // The window since begin() or the last take(), and open the next
+    BusUsage take(uint64_t now_us, uint32_t console_bytes, uint32_t motor_bytes) {
+        std::lock_guard<std::mutex> lk(mu_);
+        uint64_t window = now_us > window_us_ ? now_us - window_us_ : 0;
+        BusUsage out{};
+        out.window_ms = window / 1000;
+        out.console = line(console_bytes - console_bytes_, window);  // counters wrap
+        out.motor = line(motor_bytes - motor_bytes_, window);
+        out.cycle = summary(cycle_);
+        for (size_t b = 0; b < gaps_.size(); b++) out.gaps.at(b) = summary(gaps_.at(b));
+
+        window_us_ = now_us;
+        console_bytes_ = console_bytes;
+        motor_bytes_ = motor_bytes;
+        cycle_ = {};
+        gaps_ = {};
+        return out;
+    }
+
+private:
+    struct Acc {
+        uint32_t count = 0;
+        uint64_t sum_us = 0;
+        uint64_t min_us = 0;
+        uint64_t max_us = 0;
+    };
+
+    static void add(Acc& a, uint64_t us) {
+        a.min_us = a.count == 0 ? us : std::min(a.min_us, us);
+        a.max_us = std::max(a.max_us, us);
+        a.sum_us += us;
+        a.count++;
+    }
+
+    static BusInterval summary(const Acc& a) {
+        return {a.count, a.count ? a.sum_us / a.count : 0, a.min_us, a.max_us};
+    }
+
+    BusLineUsage line(uint32_t bytes, uint64_t window_us) const {
+        if (window_us == 0) return {0, 100};
+        double sec = static_cast<double>(window_us) / 1e6;
+        double busy_sec = static_cast<double>(bytes) * BUS_BITS_PER_BYTE / baud_;
+        double idle = std::max(0.0, 100.0 * (1.0 - busy_sec / sec));
+        return {std::round(static_cast<double>(bytes) / sec * 10) / 10, std::round(idle * 10) / 10};
+    }
+
+    int baud_;
+    std::mutex mu_;
+    uint64_t window_us_ = 0;
+    uint32_t console_bytes_ = 0;
+    uint32_t motor_bytes_ = 0;
+    int last_burst_ = -1;
+    uint64_t last_start_us_ = 0;
+    uint64_t cycle_start_us_ = 0;
+    int run_ = 0;  // burst starts in order, including the last
+    Acc cycle_;
+    std::array<Acc, EMU_BURSTS> gaps_{};
+};
@@ -0,0 +1,246 @@
+/*
+ * bus_host.h — BusHost: several treadmill buses in one process
+ *
+ * One TreadmillController per bus (gpio.json "buses", see config.h),
+ * all on one Port (one pigpio session). The host owns what the buses
+ * share:
+ *
+ *   ring + IPC server   one socket and one IPC thread for every bus;
+ *                       commands are routed by their "bus" field, events
+ *                       carry the bus they came from (ipc_protocol.h).
+ *                       With bus 0's "tap" the ring is in shared
+ *                       memory for read-only tappers (event_tap.h)
+ *   WaveEngine          pigpio transmits one DMA wave at a time, so the
+ *                       motor writers take turns (serial_io.h)
+ *   telemetry           one UDP publisher for every bus, configured by
+ *                       bus 0's "telemetry" section (telemetry.h)
+ *
+ * Each bus keeps its own readers, writer, emulate thread, mode, journal
+ * and status page. In reactor mode (bus 0's "realtime" "reactor") the
+ * IPC thread also polls every bus's readers and runs its emulate
+ * schedule between waits (TreadmillController::reactor_pass()). A
+ * client disconnect watchdog resets every bus; `quit` on any bus stops
+ * the host. With a single bus the socket output is byte-identical to a
+ * standalone TreadmillController.
+ *
+ * Restarts (handoff.h): start() can take a systemd-passed listening
+ * socket plus a predecessor's clients and bus state; stop_detached()
+ * hands the same over to a successor.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <climits>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <span>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+
+#include <unistd.h>
+
+#include "treadmill_io.h"
+#include "event_tap.h"
+
+template <typename Port>
+class BusHost {
+public:
+    BusHost(Port& port, std::span<const GpioConfig> buses)
+        : tap_(!buses.empty() && buses.front().event_tap ? EVENT_TAP_NAME : nullptr,
+               !buses.empty() && buses.front().event_tap_group)
+        , ring_(tap_.ring())
+        , ipc_(ring_)
+    {
+        // Process-wide settings come from bus 0: IPC thread scheduling, telemetry
+        if (!buses.empty()) shared_ = buses.front();
+        for (size_t i = 0; i < buses.size(); i++) {
+            GpioConfig cfg = buses[i];
+            cfg.reactor = shared_.reactor;  // every bus runs on the IPC thread, or none
+            buses_.push_back(std::make_unique<TreadmillController<Port>>(
+                port, cfg, ring_, ipc_, engine_, static_cast<int>(i)));
+        }
+    }
+
+    ~BusHost() { stop(); }
+    BusHost(const BusHost&) = delete;
+    BusHost& operator=(const BusHost&) = delete;
+
+    // Create the socket (or take `from`'s), start every bus, then the
+    // shared IPC thread. Buses and clients in `from` pick up where the
+    // predecessor left off.
+    bool start(const Inherited& from = {}) {
+        if (buses_.empty()) return false;
+
+        ipc_.on_command([this](const IpcCommand& cmd) { route_command(cmd); });
+        ipc_.enable_mailboxes(shared_.mailbox);
+        ipc_.on_client_connect([this](int) {
+            for (auto& b : buses_) b->client_connected();
+        });
+        ipc_.on_snapshot([this](const IpcServer::SnapshotEmit& emit) {
+            for (auto& b : buses_) b->emit_snapshot(emit);
+        });
+        ipc_.on_history([this](const IpcCommand& cmd, const IpcServer::SnapshotEmit& emit) {
+            if (static_cast<size_t>(cmd.bus) >= buses_.size()) {
+                emit(build_error_event("unknown bus " + std::to_string(cmd.bus)));
+                return;
+            }
+            buses_.at(static_cast<size_t>(cmd.bus))->emit_history(cmd, emit);
+        });
+        ipc_.on_client_disconnect([this](int remaining) {
+            if (remaining != 0) return;
+            for (auto& b : buses_) b->clients_gone();
+        });
+        ipc_.on_subscriptions([this] {
+            for (auto& b : buses_) b->subscriptions_changed();
+        });
+
+        if (!ipc_.create(from.listen_fd)) {
+            std::fprintf(stderr, "Failed to create server socket\n");
+            return false;
+        }
+        started_ = true;
+        std::fprintf(stderr, "[ipc] %s %s (%zu buses)\n", from.listen_fd >= 0 ? "inherited" : "listening on",
+                     SOCK_PATH, buses_.size());
+        if (shared_.event_tap && !tap_.shared()) {
+            std::fprintf(stderr, "[tap] cannot create /dev/shm%s\n", EVENT_TAP_NAME);
+        }
+        if (tap_.shared()) {
+            // Frees the slots of tap readers that died blocked
+            int reap = ipc_.add_timer([this]() { tap_.reap_waiters(mono_us()); });
+            ipc_.arm_timer(reap, EVENT_TAP_REAP_MS, EVENT_TAP_REAP_MS);
+        }
+
+        telemetry_ = start_telemetry(shared_, ring_, ipc_);
+
+        // Clients first, so they see each bus's first status
+        if (from.state) resume(*from.state, from.clients);
+
+        for (auto& b : buses_) {
+            if (!b->start()) {
+                std::fprintf(stderr, "[bus %d] failed to start\n", b->bus());
+                stop();
+                return false;
+            }
+        }
+
+        running_.store(true, std::memory_order_relaxed);
+        ipc_thread_ = std::thread(&BusHost::ipc_loop, this);
+        if (shared_.ipc_sched.active()) {
+            apply_thread_sched(ipc_thread_.native_handle(), shared_.ipc_sched, "ipc");
+        }
+        return true;
+    }
+
+    void stop() {
+        if (!started_) return;
+        started_ = false;
+        running_.store(false, std::memory_order_relaxed);
+        ipc_.wake();
+        if (ipc_thread_.joinable()) ipc_thread_.join();
+        for (auto& b : buses_) b->stop();
+        ipc_.shutdown();
+        telemetry_.reset();
+    }
+
+    // Stop for a successor: connected clients are detached instead of
+    // closed (their fds go to `clients`, now the caller's) and each bus's
+    // state is captured once commands have stopped.
+    HandoffState stop_detached(std::vector<int>* clients) {
+        HandoffState st{};
+        if (!started_) return st;
+        running_.store(false, std::memory_order_relaxed);
+        ipc_.wake();
+        if (ipc_thread_.joinable()) ipc_thread_.join();
+
+        st.buses = static_cast<int>(buses_.size());
+        for (size_t i = 0; i < buses_.size(); i++) st.bus.at(i) = buses_[i]->handoff_state();
+
+        std::array<IpcServer::ClientHandoff, MAX_CLIENTS> released;
+        int n = ipc_.release_clients(released);
+        for (int i = 0; i < n; i++) {
+            const auto& c = released.at(static_cast<size_t>(i));
+            auto entry = handoff_client(c);
+            if (!entry) {
+                close(c.fd);
+                continue;
+            }
+            st.client.at(static_cast<size_t>(st.clients++)) = *entry;
+            clients->push_back(c.fd);
+        }
+        st.saved_us = mono_us();
+        stop();
+        return st;
+    }
+
+    // False once any bus got `quit`
+    bool is_running() const {
+        if (!running_.load(std::memory_order_relaxed)) return false;
+        for (const auto& b : buses_) {
+            if (!b->is_running()) return false;
+        }
+        return true;
+    }
+
+    size_t size() const { return buses_.size(); }
+    TreadmillController<Port>& bus(size_t i) { return *buses_.at(i); }
+    EventRing& ring() { return ring_; }
+    WaveEngine& wave_engine() { return engine_; }  // for writers outside the buses
+
+private:
+    void route_command(const IpcCommand& cmd) {
+        if (cmd.type == CmdType::Subscribe || cmd.type == CmdType::Hello || cmd.type == CmdType::Snapshot ||
+            cmd.type == CmdType::History || cmd.type == CmdType::Mailbox) {
+            return;  // per-client
+        }
+        if (cmd.bus < 0 || static_cast<size_t>(cmd.bus) >= buses_.size()) {
+            ipc_.push_to_ring(build_error_event("unknown bus " + std::to_string(cmd.bus)));
+            return;
+        }
+        buses_.at(static_cast<size_t>(cmd.bus))->handle_command(cmd);
+        if (cmd.type == CmdType::Quit) ipc_.wake();
+    }
+
+    // Before the IPC thread: schedule each bus's resume and adopt the
+    // clients found in the predecessor's state (others are closed)
+    void resume(const HandoffState& st, std::span<const int> clients) {
+        for (size_t i = 0; i < buses_.size() && static_cast<int>(i) < st.buses; i++) {
+            buses_[i]->resume_from(st.bus.at(i));
+        }
+        for (int fd : clients) {
+            int idx = find_handoff_client(st, fd);
+            if (idx < 0 || !ipc_.adopt_client({fd, st.client.at(static_cast<size_t>(idx)).sub,
+                                               st.client.at(static_cast<size_t>(idx)).binary})) {
+                close(fd);
+            }
+        }
+    }
+
+    void ipc_loop() {
+        trace_thread(shared_.reactor ? "reactor" : "ipc");
+        while (is_running()) {
+            // Sleeps until a client, ring push, timer or stop(); reactor: or the buses' next pass
+            ipc_.poll(shared_.reactor ? reactor_pass() : -1);
+        }
+    }
+
+    int reactor_pass() {
+        int wait_ms = INT_MAX;
+        for (auto& b : buses_) wait_ms = std::min(wait_ms, b->reactor_pass());
+        return wait_ms;
+    }
+
+    WaveEngine engine_;
+    EventTap tap_;
+    EventRing& ring_;
+    IpcServer ipc_;
+    GpioConfig shared_{};
+    std::unique_ptr<TelemetryPublisher> telemetry_;
+    std::vector<std::unique_ptr<TreadmillController<Port>>> buses_;
+    bool started_ = false;
+    std::atomic<bool> running_{false};
+    std::thread ipc_thread_;
+};
@@ -0,0 +1,261 @@
+/*
+ * byte_ring.h — Lock-free multi-producer ring of variable-length messages
+ *
+ * The event ring between the GPIO/emulate threads (producers) and the IPC
+ * and telemetry consumers. Same contract as RingBuffer (ring_buffer.h):
+ * messages are numbered by a ticket taken with one fetch_add, readers
+ * copy a message out by sequence number and are told when it was
+ * overwritten instead of getting it torn, and producers never block.
+ *
+ * Storage is split in two. The bytes of each message sit back to back in
+ * one byte arena, so capacity is counted in bytes: a 25-byte kv record
+ * costs 25 bytes, not a 256-byte slot. A small index, one seqlock entry
+ * per sequence number, says where each message's bytes start and how
+ * long they are. History is bounded by whichever runs out first: Index
+ * messages or Bytes of them.
+ *
+ * reserve() claims up to `max_len` bytes at the arena's end with a
+ * fetch_add; commit() hands back the unused tail with a CAS when no other
+ * producer has claimed past it (the usual case), otherwise the tail is
+ * left as padding. A claim that would straddle the end of the arena is
+ * left as padding too, so every message is contiguous. Readers check,
+ * after copying, both the index stamp and that no claim has since reached
+ * the bytes they copied.
+ *
+ * Consumer wakeup works as in RingBuffer: enable_wakeup(), arm_wakeup(),
+ * and the next commit() signals the eventfd once.
+ *
+ * A ring placed in shared memory (event_tap.h) can also wake readers in
+ * other processes: after enable_futex_wakeup(), every commit() bumps the
+ * 32-bit published() word and, while the given waiter count is non-zero,
+ * FUTEX_WAKEs whoever waits on it. Readers only load the ring, so its
+ * mapping can be read-only; the count lives elsewhere.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <span>
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <climits>
+#include "ring_buffer.h"
+
+template <size_t Bytes = 512 * 1024, int Index = 8192, int MaxMsg = 1024>
+class ByteRing {
+    static_assert((Bytes & (Bytes - 1)) == 0, "arena size must be a power of 2");
+    static_assert(Index > 0 && MaxMsg > 0 && MaxMsg <= 0xFFFF && static_cast<size_t>(MaxMsg) * 4 <= Bytes);
+    static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                  "ring sequence stamps must be lock-free on the target");
+
+public:
+    ByteRing() = default;
+    ~ByteRing() {
+        if (wake_fd_ >= 0) ::close(wake_fd_);
+    }
+    ByteRing(const ByteRing&) = delete;
+    ByteRing& operator=(const ByteRing&) = delete;
+
+    // Zero-copy producer API: reserve() claims the next sequence number and
+    // up to `max_len` bytes of arena; format the message directly into
+    // `buf`, then commit() the length actually used. Every reserve() must be
+    // followed by exactly one commit(). Lock-free, safe from any thread.
+    struct Reservation {
+        uint64_t seq;
+        uint64_t pos;          // arena offset, counted from the first byte ever claimed
+        std::span<char> buf;   // min(max_len, MaxMsg) bytes
+    };
+
+    Reservation reserve(size_t max_len = MaxMsg) {
+        max_len = std::min(max_len, static_cast<size_t>(MaxMsg));
+        uint64_t seq = next_.fetch_add(1, std::memory_order_relaxed);
+        auto& e = index_.at(seq % Index);
+        e.stamp.store(0, std::memory_order_relaxed);  // 0 = write in progress
+
+        uint64_t pos = claim(max_len);
+        // The stamp and the claim are visible before any byte is written
+        std::atomic_thread_fence(std::memory_order_release);
+        return { seq, pos, std::span<char>(arena_.data() + pos % Bytes, max_len) };
+    }
+
+    void commit(const Reservation& r, size_t len) {
+        len = std::min(len, r.buf.size());
+        uint64_t end = r.pos + r.buf.size();
+        claimed_.compare_exchange_strong(end, r.pos + len, std::memory_order_relaxed);
+
+        auto& e = index_.at(r.seq % Index);
+        e.loc.store(r.pos << 16 | len, std::memory_order_relaxed);
+        e.stamp.store(r.seq + 1, std::memory_order_release);
+
+        // Pairs with the fence in arm_wakeup(): either the consumer sees
+        // this commit before sleeping, or we see it armed and wake it.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (armed_.load(std::memory_order_relaxed) &&
+            armed_.exchange(false, std::memory_order_acq_rel)) {
+            notify();
+        }
+        if (futex_waiters_) {
+            // seq_cst pairs with the reader's count-then-load: either it
+            // sees this bump before sleeping, or we see it counted
+            published_.fetch_add(1, std::memory_order_seq_cst);
+            if (futex_waiters_->load(std::memory_order_seq_cst) != 0) {
+                // reinterpret_cast: atomic<uint32_t> -> uint32_t aliasing (standard-allowed)
+                syscall(SYS_futex, reinterpret_cast<uint32_t*>(&published_), FUTEX_WAKE, INT_MAX,
+                        nullptr, nullptr, 0);
+            }
+        }
+    }
+
+    // Push a copy of a message. Messages longer than MaxMsg bytes are
+    // truncated.
+    void push(std::string_view msg) {
+        auto r = reserve(msg.size());
+        msg.copy(r.buf.data(), r.buf.size());
+        commit(r, r.buf.size());
+    }
+
+    // Snapshot of ring state for drain operations. `count` is the total
+    // number of messages ever claimed; sequence numbers run [0, count).
+    struct Snapshot {
+        int head;
+        uint64_t count;
+    };
+
+    Snapshot snapshot() const {
+        uint64_t count = next_.load(std::memory_order_acquire);
+        return { static_cast<int>(count % Index), count };
+    }
+
+    // Copy message `seq` into `out` (truncated to out.size()). Never returns
+    // a partially written or partially overwritten message.
+    RingReadResult read(uint64_t seq, std::span<char> out) const {
+        const auto& e = index_.at(seq % Index);
+
+        uint64_t before = e.stamp.load(std::memory_order_acquire);
+        if (before > seq + 1) return { RingRead::Overwritten, 0 };
+        if (before != seq + 1) {
+            return { lapped(seq) ? RingRead::Overwritten : RingRead::NotReady, 0 };
+        }
+
+        uint64_t loc = e.loc.load(std::memory_order_relaxed);
+        uint64_t pos = loc >> 16;
+        size_t len = std::min(static_cast<size_t>(loc & 0xFFFF), out.size());
+        std::copy_n(arena_.data() + pos % Bytes, len, out.data());
+
+        // A claim reaching pos + Bytes or beyond may have rewritten what we copied
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (e.stamp.load(std::memory_order_relaxed) != before ||
+            claimed_.load(std::memory_order_relaxed) - pos > Bytes) {
+            return { RingRead::Overwritten, 0 };
+        }
+        return { RingRead::Ok, len };
+    }
+
+    // True once message `seq` is committed (or already overwritten), i.e.
+    // read(seq) would not return NotReady.
+    bool ready(uint64_t seq) const {
+        return index_.at(seq % Index).stamp.load(std::memory_order_acquire) >= seq + 1 ||
+               lapped(seq);
+    }
+
+    // --- Consumer wakeup ---
+
+    // Create the wakeup eventfd (idempotent). Returns the fd, or -1.
+    // Call before producers start; the fd lives as long as the ring.
+    int enable_wakeup() {
+        if (wake_fd_ < 0) wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        return wake_fd_;
+    }
+
+    int wakeup_fd() const { return wake_fd_; }
+
+    // Request a signal on the next commit. Call before blocking, then check
+    // ready() on the next unread sequence to close the race.
+    void arm_wakeup() {
+        armed_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    // Signal the wakeup fd unconditionally (e.g. to interrupt for shutdown)
+    void notify() const {
+        if (wake_fd_ < 0) return;
+        uint64_t one = 1;
+        ssize_t n = ::write(wake_fd_, &one, sizeof(one));
+        (void)n;  // EAGAIN means a wakeup is already pending
+    }
+
+    // Clear pending wakeups (consumer side, after waking)
+    void drain_wakeup() const {
+        if (wake_fd_ < 0) return;
+        uint64_t val;
+        ssize_t n = ::read(wake_fd_, &val, sizeof(val));
+        (void)n;
+    }
+
+    // Shared-futex wakeup on commits while `waiters` (readers blocked on
+    // published(), counted by themselves) is non-zero; a ring in shared
+    // memory. Call before producers start.
+    void enable_futex_wakeup(const std::atomic<uint32_t>& waiters) { futex_waiters_ = &waiters; }
+
+    // Bumped by each commit once enabled; readers FUTEX_WAIT on its value
+    const std::atomic<uint32_t>& published() const { return published_; }
+
+    // Byte offsets of the ring's state, for readers in other languages
+    struct Layout {
+        size_t index;      // Index x { u64 stamp, u64 loc }
+        size_t arena;      // Bytes
+        size_t next;       // u64
+        size_t claimed;    // u64
+        size_t published;  // u32
+    };
+
+    static constexpr Layout layout() {
+        return { offsetof(ByteRing, index_), offsetof(ByteRing, arena_), offsetof(ByteRing, next_),
+                 offsetof(ByteRing, claimed_), offsetof(ByteRing, published_) };
+    }
+
+    // Most messages the index can hold (fewer if they outgrow the arena)
+    static constexpr int size() { return Index; }
+    // Longest message, and the buffer a consumer needs for any read()
+    static constexpr int msg_size() { return MaxMsg; }
+    static constexpr size_t bytes() { return Bytes; }
+
+private:
+    bool lapped(uint64_t seq) const {
+        return next_.load(std::memory_order_acquire) - seq > static_cast<uint64_t>(Index);
+    }
+
+    // n contiguous arena bytes; a claim straddling the end is skipped
+    uint64_t claim(size_t n) {
+        while (true) {
+            uint64_t pos = claimed_.fetch_add(n, std::memory_order_relaxed);
+            if (pos % Bytes + n <= Bytes) return pos;
+        }
+    }
+
+    struct Entry {
+        std::atomic<uint64_t> stamp{0};   // seq + 1 once committed, 0 while writing
+        std::atomic<uint64_t> loc{0};     // arena offset << 16 | length
+    };
+
+    std::array<Entry, Index> index_{};
+    std::array<char, Bytes> arena_{};
+    alignas(64) std::atomic<uint64_t> next_{0};
+    alignas(64) std::atomic<uint64_t> claimed_{0};
+    alignas(64) std::atomic<bool> armed_{false};
+    int wake_fd_ = -1;
+    const std::atomic<uint32_t>* futex_waiters_ = nullptr;
+    alignas(64) std::atomic<uint32_t> published_{0};
+};
+
+// The controller's event ring: 640 KB holding up to 8192 messages, where
+// the fixed-slot RingBuffer<2048, 256> took 560 KB for 2048 of at most
+// 255 bytes
+using EventRing = ByteRing<>;
@@ -0,0 +1,120 @@
+/*
+ * capture_decode.cpp — Decode a logic-analyzer capture to kv events
+ *
+ *   capture_decode [--baud N] [--log out.tmb] capture.csv > frames.jsonl
+ *
+ * Prints one kv event per console and motor frame, the same JSON lines
+ * treadmill_io sends its clients, with ts = seconds into the capture.
+ * --log also writes every decoded byte as a byte log for ReplayPort
+ * (load_byte_log() in gpio_replay.h). A summary goes to stderr.
+ */
+
+#include "capture_decode.h"
+#include "ipc_protocol.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <array>
+#include <string_view>
+
+namespace {
+
+struct Channel {
+    int ch;
+    std::string_view source;
+    CaptureFramer framer;
+    uint64_t bytes = 0;
+};
+
+int usage() {
+    std::fprintf(stderr, "usage: capture_decode [--baud N] [--log out.tmb] capture.csv\n");
+    return 2;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    int baud = 9600;
+    const char* log_path = nullptr;
+    const char* csv_path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--baud" && i + 1 < argc) {
+            baud = std::atoi(argv[++i]);
+        } else if (arg == "--log" && i + 1 < argc) {
+            log_path = argv[++i];
+        } else if (!arg.starts_with("--") && !csv_path) {
+            csv_path = argv[i];
+        } else {
+            return usage();
+        }
+    }
+    if (!csv_path || baud <= 0) return usage();
+
+    MappedFile csv;
+    if (!csv.open(csv_path)) {
+        std::fprintf(stderr, "Error: can't read %s\n", csv_path);
+        return 1;
+    }
+    FILE* log = nullptr;
+    if (log_path) {
+        log = std::fopen(log_path, "wb");
+        if (!log) {
+            std::fprintf(stderr, "Error: can't write %s\n", log_path);
+            return 1;
+        }
+        std::fwrite(CAPTURE_LOG_MAGIC.data(), 1, CAPTURE_LOG_MAGIC.size(), log);
+    }
+
+    static std::array<char, 1 << 16> out_buf;
+    std::setvbuf(stdout, out_buf.data(), _IOFBF, out_buf.size());
+
+    std::array<Channel, 2> channels = {{
+        {CAPTURE_CH_CONSOLE, "console", {}},
+        {CAPTURE_CH_MOTOR, "motor", {}},
+    }};
+    uint8_t mask = 0;
+    for (const auto& c : channels) mask |= static_cast<uint8_t>(1u << c.ch);
+
+    uint64_t frames = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t rows = decode_capture(csv.view(), mask, baud, [&](int ch, int64_t t_ns, uint8_t b) {
+        if (log) {
+            std::array<uint8_t, CAPTURE_LOG_RECORD_SIZE> rec;
+            capture_log_record(rec, t_ns, ch, b);
+            std::fwrite(rec.data(), 1, rec.size(), log);
+        }
+        Channel& c = channels.at(ch == CAPTURE_CH_CONSOLE ? 0 : 1);
+        c.bytes++;
+        c.framer.feed(t_ns, b, [&](int64_t frame_ns, const KvPair& kv) {
+            std::array<char, 256> line;
+            KvEvent ev{c.source, kv.key_view(), kv.value_view(),
+                       static_cast<double>(frame_ns) / CAPTURE_NS_PER_SEC};
+            size_t n = format_kv_event(line, ev);
+            if (n > 0) std::fwrite(line.data(), 1, n, stdout);
+            frames++;
+        });
+    });
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::fflush(stdout);
+    bool log_ok = !log || (std::fflush(log) == 0 && std::fclose(log) == 0);
+
+    std::fprintf(stderr, "%llu rows, %.1f MB in %.2f s (%.0f MB/s)\n",
+                 static_cast<unsigned long long>(rows), static_cast<double>(csv.view().size()) / 1e6,
+                 secs, secs > 0 ? static_cast<double>(csv.view().size()) / 1e6 / secs : 0.0);
+    for (const auto& c : channels) {
+        const auto& st = c.framer.stats();
+        std::fprintf(stderr, "  %-8.*s %llu bytes, %llu frames, %llu rejected, %llu stray bytes\n",
+                     static_cast<int>(c.source.size()), c.source.data(), static_cast<unsigned long long>(c.bytes),
+                     static_cast<unsigned long long>(st.frames),
+                     static_cast<unsigned long long>(st.nonprintable + st.bad_length),
+                     static_cast<unsigned long long>(st.stray_bytes));
+    }
+    std::fprintf(stderr, "  %llu kv events\n", static_cast<unsigned long long>(frames));
+    if (!log_ok) {
+        std::fprintf(stderr, "Error: writing %s failed\n", log_path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,318 @@
+/*
+ * capture_decode.h — fast decoder for logic-analyzer capture CSVs
+ *
+ * A capture (captures/README.md) is one row per level change of any
+ * channel: "seconds, ch0, ch1, ..., ch7". decode_capture() walks a whole
+ * file in memory, mapped with MappedFile, in one pass:
+ *
+ *   Rows are split with memchr. The time field becomes integer
+ *   nanoseconds: eight fraction digits at a time are checked and
+ *   converted as one 64-bit word (SWAR), so no strtod per row.
+ *
+ *   Each selected channel feeds a CaptureUart, a streaming form of the
+ *   inverted RS-485 decode in captures/decode_inverted.py: idle low,
+ *   start bit rising, data bits inverted, sampled mid-bit at 9600 8N1.
+ *   Samples are settled as later edges arrive, so nothing per edge is
+ *   stored and a multi-gigabyte capture decodes in constant memory.
+ *
+ * CaptureFramer runs a channel's bytes through kv_parse() and stamps each
+ * pair with the time of its '['. The capture_decode tool prints those as
+ * kv events and can write the bytes as a byte log (.tmb) that
+ * load_byte_log() in gpio_replay.h hands to ReplayPort.
+ *
+ * Byte log: "TMB1", then CAPTURE_LOG_RECORD_SIZE-byte records
+ *   u64 t_ns (little-endian), u8 channel, u8 byte
+ *
+ * Tools and tests only (file I/O); decoding itself does not allocate.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <span>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "kv_protocol.h"
+
+static_assert(std::endian::native == std::endian::little, "SWAR digit scan assumes little-endian");
+
+constexpr int CAPTURE_CHANNELS = 8;
+constexpr int CAPTURE_CH_MOTOR = 2;    // Pin 3, motor -> console
+constexpr int CAPTURE_CH_CONSOLE = 5;  // Pin 6, console -> motor
+constexpr int64_t CAPTURE_NS_PER_SEC = 1000000000;
+constexpr std::string_view CAPTURE_LOG_MAGIC = "TMB1";
+constexpr size_t CAPTURE_LOG_RECORD_SIZE = 10;
+
+// Eight ASCII digits in `w` (first digit in the low byte) as a number,
+// or -1 if any of them isn't a digit
+constexpr int64_t capture_eight_digits(uint64_t w) {
+    // Every byte 0x30-0x39: high nibble 3, and adding 6 doesn't carry out
+    if ((w & 0xF0F0F0F0F0F0F0F0u) != 0x3030303030303030u ||
+        ((w + 0x0606060606060606u) & 0xF0F0F0F0F0F0F0F0u) != 0x3030303030303030u) {
+        return -1;
+    }
+    w -= 0x3030303030303030u;
+    w = w * 10 + (w >> 8);  // digit pairs
+    w = ((w & 0x000000FF000000FFu) * (100 + (1000000ull << 32)) +
+         ((w >> 16) & 0x000000FF000000FFu) * (1 + (10000ull << 32))) >> 32;
+    return static_cast<int64_t>(w & 0xFFFFFFFFu);
+}
+
+static_assert(capture_eight_digits(0x3837363534333231u) == 12345678);  // "12345678"
+static_assert(capture_eight_digits(0x3030303030303030u) == 0);
+static_assert(capture_eight_digits(0x3030303030302C30u) == -1);        // "0,000000"
+
+// Parse "S[.FFF...]" at p as nanoseconds (digits past the ninth are
+// dropped) and move p past it. False if there is no leading digit.
+inline bool capture_parse_time(const char*& p, const char* end, int64_t& ns) {
+    if (p == end || *p < '0' || *p > '9') return false;
+    int64_t sec = 0;
+    while (p < end && *p >= '0' && *p <= '9') sec = sec * 10 + (*p++ - '0');
+    int64_t frac = 0;
+    int digits = 0;
+    if (p < end && *p == '.') {
+        p++;
+        if (end - p >= 8) {
+            uint64_t w;
+            std::memcpy(&w, p, sizeof(w));
+            int64_t v = capture_eight_digits(w);
+            if (v >= 0) {
+                frac = v;
+                digits = 8;
+                p += 8;
+            }
+        }
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (digits < 9) {
+                frac = frac * 10 + (*p - '0');
+                digits++;
+            }
+        }
+    }
+    for (; digits < 9; digits++) frac *= 10;
+    ns = sec * CAPTURE_NS_PER_SEC + frac;
+    return true;
+}
+
+// One channel's inverted UART, fed the line level at each row
+class CaptureUart {
+public:
+    explicit CaptureUart(int baud = 9600) {
+        double bit_ns = 1e9 / baud;
+        // Start-bit check at half a bit, data bit b at b + 1.5. An edge at
+        // or before a sample time sets its level, hence floor.
+        for (size_t k = 0; k < offset_.size(); k++) {
+            offset_.at(k) = static_cast<int64_t>(std::floor((static_cast<double>(k) + 0.5) * bit_ns));
+        }
+        frame_ns_ = static_cast<int64_t>(std::ceil(9.9 * bit_ns));
+    }
+
+    // The level at t_ns (rows in time order). `emit(start_ns, byte)` gets
+    // each byte once its last data bit is settled.
+    template <typename Emit>
+    void sample(int64_t t_ns, bool level, Emit&& emit) {
+        if (!seen_) {
+            seen_ = true;
+            level_ = level;
+            return;
+        }
+        if (level == level_) return;
+        settle(t_ns, emit);
+        level_ = level;
+        // A rising edge starts a byte unless it falls inside the last one
+        if (level && !active_ && t_ns - start_ >= busy_ns_) {
+            active_ = true;
+            start_ = t_ns;
+            busy_ns_ = frame_ns_;
+            next_ = 0;
+            byte_ = 0;
+        }
+    }
+
+    // End of the capture: the line holds its last level
+    template <typename Emit>
+    void finish(Emit&& emit) {
+        settle(INT64_MAX, emit);
+    }
+
+private:
+    // Samples due before `t_ns` read the current level
+    template <typename Emit>
+    void settle(int64_t t_ns, Emit& emit) {
+        while (active_ && start_ + offset_.at(next_) < t_ns) {
+            if (next_ == 0) {
+                if (!level_) {  // glitch, not a start bit
+                    active_ = false;
+                    busy_ns_ = 0;
+                    return;
+                }
+            } else if (!level_) {
+                byte_ |= static_cast<uint8_t>(1u << (next_ - 1));
+            }
+            if (++next_ == offset_.size()) {
+                active_ = false;
+                emit(start_, byte_);
+            }
+        }
+    }
+
+    std::array<int64_t, 9> offset_{};  // start check, then 8 data bits
+    int64_t frame_ns_ = 0;             // edges this soon after a start are inside it
+    bool seen_ = false;
+    bool level_ = false;
+    bool active_ = false;
+    int64_t start_ = 0;
+    int64_t busy_ns_ = 0;              // frame_ns_ after a decoded start, else 0
+    size_t next_ = 0;
+    uint8_t byte_ = 0;
+};
+
+/*
+ * Decode the channels in `channel_mask` (bit c = channel c) of a whole
+ * capture CSV, header line included. `emit(channel, start_ns, byte)` gets
+ * each channel's bytes in order. Returns the number of rows read.
+ */
+template <typename Emit>
+uint64_t decode_capture(std::string_view csv, uint8_t channel_mask, int baud, Emit&& emit) {
+    std::array<CaptureUart, CAPTURE_CHANNELS> uarts;
+    uarts.fill(CaptureUart(baud));
+    const char* p = csv.data();
+    const char* end = p + csv.size();
+    auto line_end = [&](const char* from) {
+        const void* nl = std::memchr(from, '\n', static_cast<size_t>(end - from));
+        return nl ? static_cast<const char*>(nl) : end;
+    };
+    if (p == end) return 0;
+    p = line_end(p);  // header
+
+    uint64_t rows = 0;
+    while (p < end) {
+        const char* q = p + 1;
+        const char* eol = line_end(q);
+        p = eol;
+        int64_t t_ns = 0;
+        if (!capture_parse_time(q, eol, t_ns)) continue;
+
+        // ", L" per channel; levels are single digits
+        unsigned levels = 0;
+        int fields = 0;
+        while (fields < CAPTURE_CHANNELS && q < eol && *q == ',') {
+            q++;
+            while (q < eol && *q == ' ') q++;
+            if (q == eol || *q < '0' || *q > '9') break;
+            if (*q != '0') levels |= 1u << fields;
+            q++;
+            fields++;
+        }
+        rows++;
+        for (int c = 0; c < fields; c++) {
+            if (!(channel_mask & (1u << c))) continue;
+            uarts.at(static_cast<size_t>(c)).sample(t_ns, (levels >> c) & 1u,
+                [&](int64_t start, uint8_t b) { emit(c, start, b); });
+        }
+    }
+    for (int c = 0; c < CAPTURE_CHANNELS; c++) {
+        uarts.at(static_cast<size_t>(c)).finish([&](int64_t start, uint8_t b) { emit(c, start, b); });
+    }
+    return rows;
+}
+
+// One channel's bytes to timestamped pairs, through kv_parse()
+class CaptureFramer {
+public:
+    // `emit(t_ns, const KvPair&)` gets each pair with the time of its '['
+    template <typename Emit>
+    void feed(int64_t t_ns, uint8_t byte, Emit&& emit) {
+        if (byte == '[') frame_ns_ = t_ns;
+        if (len_ == buf_.size()) {  // no ']' in a whole buffer: drop it
+            stats_.overflow_bytes += len_;
+            len_ = 0;
+        }
+        buf_.at(len_++) = byte;
+        if (byte != ']') return;
+
+        std::array<KvPair, 4> pairs;
+        int consumed = 0;
+        int n = kv_parse({buf_.data(), len_}, pairs.data(), static_cast<int>(pairs.size()),
+                         &consumed, &stats_);
+        for (int i = 0; i < n; i++) emit(frame_ns_, pairs.at(static_cast<size_t>(i)));
+        len_ -= static_cast<size_t>(consumed);
+        std::memmove(buf_.data(), buf_.data() + consumed, len_);
+    }
+
+    const KvParseStats& stats() const { return stats_; }
+
+private:
+    std::array<uint8_t, 256> buf_{};
+    size_t len_ = 0;
+    int64_t frame_ns_ = 0;
+    KvParseStats stats_{};
+};
+
+constexpr void capture_log_record(std::span<uint8_t, CAPTURE_LOG_RECORD_SIZE> out,
+                                  int64_t t_ns, int channel, uint8_t byte) {
+    auto t = static_cast<uint64_t>(t_ns);
+    for (size_t i = 0; i < 8; i++) out[i] = static_cast<uint8_t>(t >> (8 * i));
+    out[8] = static_cast<uint8_t>(channel);
+    out[9] = byte;
+}
+
+constexpr int64_t capture_log_time(std::span<const uint8_t, CAPTURE_LOG_RECORD_SIZE> rec) {
+    uint64_t t = 0;
+    for (size_t i = 0; i < 8; i++) t |= static_cast<uint64_t>(rec[i]) << (8 * i);
+    return static_cast<int64_t>(t);
+}
+
+// A file mapped read-only for one sequential pass
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // False if the file can't be opened or mapped. An empty file maps
+    // as an empty view.
+    bool open(const char* path) {
+        close();
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st {};
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void* m = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m == MAP_FAILED) {
+                ::close(fd);
+                size_ = 0;
+                return false;
+            }
+            ::madvise(m, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(m);
+        }
+        ::close(fd);
+        return true;
+    }
+
+    void close() {
+        if (data_) ::munmap(const_cast<char*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    std::string_view view() const { return {data_ ? data_ : "", size_}; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
@@ -0,0 +1,77 @@
+/*
+ * clock.h — Clock policies: CLOCK_MONOTONIC, or virtual time for tests
+ *
+ * EmulationEngine and TreadmillController take a Clock template
+ * parameter (default MonoClock) for every deadline they keep: burst
+ * pacing, program steps, the 3-hour safety timeout, the heartbeat
+ * watchdog and event timestamps. VirtualClock is time a test moves by
+ * hand, so those paths run in milliseconds: advance() three hours and
+ * the safety timeout fires.
+ *
+ * A Clock provides:
+ *   now_ns()                      current time, ns
+ *   wait_change(mode, seen, dl)   sleep until `dl` on this clock, a mode
+ *                                 change or a notify_waiters()
+ *                                 (ModeStateMachine::wait_change);
+ *                                 may return early, callers re-check
+ *   timer_ms(ms)                  real timerfd delay for a check due
+ *                                 `ms` from now on this clock
+ *
+ * Clocks are small handles, copied into each user; copies of a
+ * VirtualClock share one time. Serial bit timing (serial_io.h) and the
+ * motor query/odometer bookkeeping stay on real time: they model the
+ * wire, not the session. So do console and motor kv event timestamps:
+ * they date each frame's arrival on the wire clock (wire_clock.h),
+ * counted from the session start.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include "mode_state.h"
+
+struct MonoClock {
+    int64_t now_ns() const {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    }
+
+    bool wait_change(const ModeStateMachine& mode, uint32_t seen, int64_t deadline_ns) const {
+        return mode.wait_change(seen, deadline_ns);
+    }
+
+    int timer_ms(int ms) const { return ms; }
+};
+
+// Real time between checks of a virtual deadline
+constexpr int VIRTUAL_POLL_MS = 2;
+
+class VirtualClock {
+public:
+    explicit VirtualClock(int64_t start_ns = 1000000000LL)
+        : now_(std::make_shared<std::atomic<int64_t>>(start_ns)) {}
+
+    int64_t now_ns() const { return now_->load(std::memory_order_acquire); }
+
+    void advance(std::chrono::nanoseconds d) {
+        now_->fetch_add(d.count(), std::memory_order_acq_rel);
+    }
+
+    // Waits at most VIRTUAL_POLL_MS of real time, so a waiter sees
+    // advance() promptly and loops until its deadline has passed
+    bool wait_change(const ModeStateMachine& mode, uint32_t seen, int64_t deadline_ns) const {
+        if (now_ns() >= deadline_ns) return false;
+        return mode.wait_change(seen, MonoClock{}.now_ns() + VIRTUAL_POLL_MS * 1000000LL);
+    }
+
+    // Virtual deadlines are polled: the check re-arms itself until due
+    int timer_ms(int /*ms*/) const { return VIRTUAL_POLL_MS; }
+
+private:
+    std::shared_ptr<std::atomic<int64_t>> now_;
+};
@@ -0,0 +1,195 @@
+/*
+ * cmd_mailbox.cpp — CommandMailbox memfd ring and MailboxWriter
+ */
+
+#include "cmd_mailbox.h"
+#include "metrics.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <string_view>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+namespace {
+
+constexpr std::array<char, 4> CMD_MAILBOX_MAGIC = { 'T', 'M', 'C', '1' };
+constexpr int MAILBOX_FDS = 2;  // memfd, doorbell
+
+std::atomic_ref<uint64_t> shared_u64(void* map, size_t offset) {
+    // reinterpret_cast: mapped bytes -> the u64 at a fixed, aligned offset of the layout
+    return std::atomic_ref<uint64_t>(*reinterpret_cast<uint64_t*>(static_cast<char*>(map) + offset));
+}
+
+MailboxSlot* slot_at(void* map, uint64_t n) {
+    // reinterpret_cast: mapped bytes -> the slot array at CMD_MAILBOX_SLOTS_OFFSET
+    return reinterpret_cast<MailboxSlot*>(static_cast<char*>(map) + CMD_MAILBOX_SLOTS_OFFSET) +
+           n % CMD_MAILBOX_SLOTS;
+}
+
+}  // namespace
+
+std::optional<IpcCommand> mailbox_command(const MailboxSlot& slot) {
+    if (slot.bus >= MAX_BUSES) return std::nullopt;
+    IpcCommand out{};
+    out.bus = slot.bus;
+    out.bool_value = (slot.flags & MAILBOX_FLAG_ON) != 0;
+    if (slot.flags & MAILBOX_FLAG_SEQ) {
+        out.seq = slot.seq;
+        out.has_seq = true;
+    }
+    switch (static_cast<MailboxOp>(slot.op)) {
+        case MailboxOp::Speed:
+            if (!std::isfinite(slot.float_value)) return std::nullopt;
+            out.type = CmdType::Speed;
+            out.float_value = slot.float_value;
+            return out;
+        case MailboxOp::Incline:
+            out.type = CmdType::Incline;
+            out.int_value = slot.int_value;
+            return out;
+        case MailboxOp::Emulate: out.type = CmdType::Emulate; return out;
+        case MailboxOp::Proxy: out.type = CmdType::Proxy; return out;
+        case MailboxOp::Overlay: out.type = CmdType::Overlay; return out;
+        case MailboxOp::Heartbeat: out.type = CmdType::Heartbeat; return out;
+        case MailboxOp::Status: out.type = CmdType::Status; return out;
+        case MailboxOp::Hr:
+            if (slot.int_value < HR_BPM_MIN || slot.int_value > HR_BPM_MAX) return std::nullopt;
+            out.type = CmdType::Hr;
+            out.int_value = slot.int_value;
+            return out;
+    }
+    return std::nullopt;
+}
+
+CommandMailbox::CommandMailbox() {
+    memfd_ = memfd_create("treadmill_io.mailbox", MFD_CLOEXEC);
+    doorbell_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (memfd_ < 0 || doorbell_ < 0 || ftruncate(memfd_, CMD_MAILBOX_SIZE) != 0) return;
+    void* m = mmap(nullptr, CMD_MAILBOX_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, memfd_, 0);
+    if (m == MAP_FAILED) return;
+    map_ = m;
+
+    // A new memfd reads as zeros: head and tail start at 0
+    auto* h = new (m) CmdMailboxHeader{};
+    h->version = CMD_MAILBOX_VERSION;
+    h->pid = static_cast<uint32_t>(getpid());
+    h->slots = CMD_MAILBOX_SLOTS;
+    h->slot_size = sizeof(MailboxSlot);
+    h->magic = CMD_MAILBOX_MAGIC;
+}
+
+CommandMailbox::~CommandMailbox() {
+    if (map_) munmap(map_, CMD_MAILBOX_SIZE);
+    if (memfd_ >= 0) ::close(memfd_);
+    if (doorbell_ >= 0) ::close(doorbell_);
+}
+
+void CommandMailbox::drain_doorbell() {
+    uint64_t rings;
+    ssize_t n = read(doorbell_, &rings, sizeof(rings));
+    (void)n;  // EAGAIN: already clear
+}
+
+CommandMailbox::Take CommandMailbox::take(IpcCommand& out) {
+    if (!map_) return Take::Empty;
+    auto tail_ref = shared_u64(map_, CMD_MAILBOX_TAIL_OFFSET);
+    uint64_t head = shared_u64(map_, CMD_MAILBOX_HEAD_OFFSET).load(std::memory_order_acquire);
+    uint64_t tail = tail_ref.load(std::memory_order_relaxed);
+    if (head == tail) return Take::Empty;
+    if (head - tail > CMD_MAILBOX_SLOTS) {  // not a head the writer could have published
+        tail_ref.store(head, std::memory_order_release);
+        return Take::Bad;
+    }
+    // Copy out before handing the slot back: the writer may refill it at once
+    MailboxSlot slot;
+    std::memcpy(&slot, slot_at(map_, tail), sizeof(slot));
+    tail_ref.store(tail + 1, std::memory_order_release);
+    auto cmd = mailbox_command(slot);
+    if (!cmd) return Take::Bad;
+    out = *cmd;
+    return Take::Command;
+}
+
+bool MailboxWriter::open(int sock, int timeout_ms) {
+    close();
+    std::string_view req = "{\"cmd\":\"mailbox\"}\n";
+    if (write(sock, req.data(), req.size()) != static_cast<ssize_t>(req.size())) return false;
+
+    // The fds come with the reply's first bytes; an error about the
+    // mailbox comes without them
+    std::array<int, MAILBOX_FDS> fds = { -1, -1 };
+    uint64_t deadline_us = mono_us() + static_cast<uint64_t>(timeout_ms) * 1000;
+    while (fds.at(0) < 0) {
+        uint64_t now = mono_us();
+        if (now >= deadline_us) return false;
+        struct pollfd pfd{sock, POLLIN, 0};
+        if (::poll(&pfd, 1, static_cast<int>((deadline_us - now + 999) / 1000)) <= 0) continue;
+
+        std::array<char, 4096> buf;
+        struct iovec iov{buf.data(), buf.size()};
+        alignas(struct cmsghdr) std::array<char, CMSG_SPACE(sizeof(int) * MAILBOX_FDS)> ctl;
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctl.data();
+        msg.msg_controllen = ctl.size();
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n <= 0) return false;
+        for (auto* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+            size_t count = std::min((c->cmsg_len - CMSG_LEN(0)) / sizeof(int), fds.size());
+            std::array<int, MAILBOX_FDS> got = { -1, -1 };
+            std::memcpy(got.data(), CMSG_DATA(c), count * sizeof(int));
+            if (count == fds.size()) {
+                fds = got;
+                continue;
+            }
+            for (size_t i = 0; i < count; i++) ::close(got.at(i));
+        }
+        std::string_view text(buf.data(), static_cast<size_t>(n));
+        if (fds.at(0) < 0 && text.find("{\"type\":\"error\",\"msg\":\"mailbox") != std::string_view::npos) {
+            return false;
+        }
+    }
+
+    void* m = mmap(nullptr, CMD_MAILBOX_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fds.at(0), 0);
+    ::close(fds.at(0));
+    if (m == MAP_FAILED) {
+        ::close(fds.at(1));
+        return false;
+    }
+    const auto* h = static_cast<const CmdMailboxHeader*>(m);
+    if (h->magic != CMD_MAILBOX_MAGIC || h->version != CMD_MAILBOX_VERSION || h->slots != CMD_MAILBOX_SLOTS ||
+        h->slot_size != sizeof(MailboxSlot)) {
+        munmap(m, CMD_MAILBOX_SIZE);
+        ::close(fds.at(1));
+        return false;
+    }
+    map_ = m;
+    doorbell_ = fds.at(1);
+    head_ = shared_u64(map_, CMD_MAILBOX_HEAD_OFFSET).load(std::memory_order_relaxed);
+    return true;
+}
+
+void MailboxWriter::close() {
+    if (map_) munmap(map_, CMD_MAILBOX_SIZE);
+    if (doorbell_ >= 0) ::close(doorbell_);
+    map_ = nullptr;
+    doorbell_ = -1;
+}
+
+bool MailboxWriter::send(const MailboxSlot& slot) {
+    if (!map_) return false;
+    uint64_t tail = shared_u64(map_, CMD_MAILBOX_TAIL_OFFSET).load(std::memory_order_acquire);
+    if (head_ - tail >= CMD_MAILBOX_SLOTS) return false;
+    std::memcpy(slot_at(map_, head_), &slot, sizeof(slot));
+    shared_u64(map_, CMD_MAILBOX_HEAD_OFFSET).store(++head_, std::memory_order_release);
+    uint64_t one = 1;
+    return write(doorbell_, &one, sizeof(one)) == sizeof(one);
+}
@@ -0,0 +1,147 @@
+/*
+ * cmd_mailbox.h — Per-client command mailbox in shared memory
+ *
+ * A socket command is JSON text: formatted by the client, written, woken
+ * for by epoll, copied into the client's line buffer and parsed. For
+ * closed-loop control that is most of the round trip. A client sending
+ * {"cmd":"mailbox"} gets a CommandMailbox of its own instead: a
+ * single-producer single-consumer ring of fixed-layout MailboxSlots in a
+ * memfd, plus an eventfd doorbell, both passed back with the reply
+ * (SCM_RIGHTS). The client fills a slot, publishes `head` and rings the
+ * doorbell; the IPC thread, woken by epoll, takes the slots as
+ * IpcCommands and dispatches them as if they had come over the socket:
+ * the same handle_command(), each an implicit heartbeat, acked by "seq"
+ * the same way. Replies and events still come on the socket (or the
+ * event tap). The mailbox lives as long as its client: it closes with
+ * the socket, and the disconnect watchdog applies as before.
+ *
+ * Only the commands that fit a slot: speed, incline, emulate, proxy,
+ * overlay, heartbeat, status, hr. The memory is the client's to write,
+ * so every slot is checked; one that isn't a valid command is skipped
+ * with an error event to that client.
+ *
+ * Layout (little-endian; writers in other languages use the offsets):
+ *
+ *   0  char[4] magic "TMC1"     16 u32 slots (power of 2)
+ *   4  u32     version (1)      20 u32 slot_size (32)
+ *   8  u32     daemon pid       64 u64 head: slots ever written (client)
+ *  12  u32     reserved        128 u64 tail: slots ever taken (daemon)
+ *                              192 MailboxSlot[slots], slot n at n % slots
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <optional>
+#include "ipc_protocol.h"
+
+constexpr uint32_t CMD_MAILBOX_VERSION = 1;
+constexpr uint32_t CMD_MAILBOX_SLOTS = 256;
+constexpr size_t CMD_MAILBOX_HEAD_OFFSET = 64;    // own cache lines: one writer each
+constexpr size_t CMD_MAILBOX_TAIL_OFFSET = 128;
+constexpr size_t CMD_MAILBOX_SLOTS_OFFSET = 192;
+
+// Stable on the wire, unlike CmdType
+enum class MailboxOp : uint8_t {
+    Speed = 1,      // float_value: mph
+    Incline = 2,    // int_value: half-pct units
+    Emulate = 3,    // MAILBOX_FLAG_ON: enabled
+    Proxy = 4,
+    Overlay = 5,
+    Heartbeat = 6,
+    Status = 7,
+    Hr = 8,         // int_value: bpm, HR_BPM_MIN to HR_BPM_MAX
+};
+
+constexpr uint8_t MAILBOX_FLAG_ON = 1;   // emulate/proxy/overlay enabled
+constexpr uint8_t MAILBOX_FLAG_SEQ = 2;  // `seq` is set: acked as a socket "seq"
+
+struct MailboxSlot {
+    uint8_t op;          // MailboxOp
+    uint8_t bus;
+    uint8_t flags;       // MAILBOX_FLAG_*
+    uint8_t reserved0;
+    int32_t int_value;
+    uint32_t seq;
+    uint32_t reserved1;
+    double float_value;
+    uint64_t reserved2;
+};
+static_assert(sizeof(MailboxSlot) == 32);
+static_assert(offsetof(MailboxSlot, int_value) == 4);
+static_assert(offsetof(MailboxSlot, seq) == 8);
+static_assert(offsetof(MailboxSlot, float_value) == 16);
+
+struct CmdMailboxHeader {
+    std::array<char, 4> magic;
+    uint32_t version;
+    uint32_t pid;
+    uint32_t reserved;
+    uint32_t slots;
+    uint32_t slot_size;
+};
+static_assert(offsetof(CmdMailboxHeader, slots) == 16);
+static_assert(sizeof(CmdMailboxHeader) <= CMD_MAILBOX_HEAD_OFFSET);
+
+constexpr size_t CMD_MAILBOX_SIZE = CMD_MAILBOX_SLOTS_OFFSET + CMD_MAILBOX_SLOTS * sizeof(MailboxSlot);
+static_assert((CMD_MAILBOX_SLOTS & (CMD_MAILBOX_SLOTS - 1)) == 0);
+
+// The command a slot carries; nullopt if it isn't a valid one
+std::optional<IpcCommand> mailbox_command(const MailboxSlot& slot);
+
+// Daemon side: one client's mailbox (IPC thread only)
+class CommandMailbox {
+public:
+    // A fresh memfd ring and doorbell; ok() is false if either failed
+    CommandMailbox();
+    ~CommandMailbox();
+    CommandMailbox(const CommandMailbox&) = delete;
+    CommandMailbox& operator=(const CommandMailbox&) = delete;
+
+    bool ok() const { return map_ != nullptr; }
+    int memfd() const { return memfd_; }
+    int doorbell_fd() const { return doorbell_; }
+
+    // Readable doorbell: clear it before taking the slots
+    void drain_doorbell();
+
+    enum class Take : uint8_t { Empty, Command, Bad };
+
+    // The oldest slot not yet taken, as a command in `out`. Bad for a
+    // slot that isn't a valid command, and once for a head past the ring
+    // (the ring is then emptied).
+    Take take(IpcCommand& out);
+
+private:
+    void* map_ = nullptr;
+    int memfd_ = -1;
+    int doorbell_ = -1;
+};
+
+// Client side: ask for a mailbox on a connected JSON-lines socket, then
+// send commands through it
+class MailboxWriter {
+public:
+    MailboxWriter() = default;
+    ~MailboxWriter() { close(); }
+    MailboxWriter(const MailboxWriter&) = delete;
+    MailboxWriter& operator=(const MailboxWriter&) = delete;
+
+    // Send `mailbox` on `sock` and map the reply's mailbox. Reads (and
+    // drops) whatever arrives ahead of the reply, so call it before
+    // reading events. False if refused, or nothing within timeout_ms.
+    bool open(int sock, int timeout_ms = 1000);
+    void close();
+    bool is_open() const { return map_ != nullptr; }
+
+    // Publish one command and ring the doorbell. False if the ring is
+    // full (the IPC thread is behind) or the mailbox isn't open.
+    bool send(const MailboxSlot& slot);
+
+private:
+    void* map_ = nullptr;
+    int doorbell_ = -1;
+    uint64_t head_ = 0;   // ours alone: the shared copy is only published
+};
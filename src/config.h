@@ -3,23 +3,125 @@
  *
  * Reads gpio.json into a typed GpioConfig struct.
  * Validates all required fields. Testable in isolation.
+ * "backend": "uart" moves serial I/O from pigpio to kernel UARTs, each
+ * pin naming its device with "uart" (gpio_uart.h).
+ * An optional "baud" sets the line rate for bench rigs (default 9600).
+ * An optional "emulate" section tunes the emulate cycle timing and
+ * per-key rates, or paces bursts by the motor's answers.
+ * An optional "journal" section enables the bus flight recorder.
+ * An optional "events" section enables change-only KV events and sets
+ * the status heartbeat and the bus and motor stats periods.
+ * An optional "realtime" section sets thread scheduling and mlockall, or
+ * runs each bus on one thread (reactor mode).
+ * An optional "telemetry" section enables the UDP multicast publisher.
+ * An optional "trace" section starts the timeline recorder and sets
+ * where dumps go.
+ * An optional "standby" section sets the idle time before standby and
+ * pigpio's sample period (standby.h).
+ * An optional "mailbox" section lets clients open shared-memory command
+ * mailboxes (cmd_mailbox.h).
+ * An optional "tap" section puts the event ring in shared memory for
+ * local tappers (event_tap.h).
+ * A "buses" array describes several buses hosted by one process.
  */
 
 #pragma once
 
+#include <cstdint>
 #include <cstdio>
 #include <string>
 #include <string_view>
+#include <vector>
+#include <arpa/inet.h>
 
 // Suppress RapidJSON internal asserts (we check errors after parse)
 #define RAPIDJSON_ASSERT(x) ((void)(x))
 #define RAPIDJSON_HAS_CXX11_NOEXCEPT 1
 #include <rapidjson/document.h>
+#include "thread_sched.h"
+#include "ipc_protocol.h"
+#include "emu_cycle.h"
+#include "bus_analyzer.h"
+#include "motor_stats.h"
+#include "trace.h"
+#include "standby.h"
+
+// Serial I/O: pigpio bit-banged reads and DMA wave writes, or kernel UARTs
+enum class PortBackend : uint8_t { Pigpio, Uart };
 
 struct GpioConfig {
     int console_read = -1;
     int motor_write  = -1;
     int motor_read   = -1;
+
+    // Line rate of all three pins (serial_io.h); 9600 on the treadmill
+    int baud = 9600;
+
+    // UART devices per pin ("uart" backend only)
+    PortBackend backend = PortBackend::Pigpio;
+    std::string console_uart{};
+    std::string motor_write_uart{};
+    std::string motor_read_uart{};
+
+    // Emulate cycle pacing (see EmuTiming)
+    int emu_cycle_ms     = 500;
+    int emu_burst_gap_ms = 100;
+    EmuRates emu_rates   = EMU_DEFAULT_RATES;  // see emu_cycle.h
+    bool emu_paced       = false;  // next burst once the motor answers (EmuTiming::paced)
+    int emu_min_gap_ms   = 20;
+
+    // Bus journal (see journal.h); empty dir = disabled
+    std::string journal_dir{};
+    int journal_segment_kb = 4096;
+    int journal_segments   = 8;
+
+    // Change-only KV events (see KvChangeFilter)
+    bool kv_changes_only = false;
+    int kv_keyframe_ms   = 5000;
+    // A cycle event per bus cycle and source, besides the kv events (see kv_cycle_buffer.h)
+    bool cycle_events = false;
+    // Parse only the console frames some client needs (see TreadmillController::console_parse_keys)
+    bool lazy_console = false;
+    // Status events go out on change; at least this often otherwise (0 = only on change)
+    int status_interval_ms = 1000;
+    // Bus analyzer events (see bus_analyzer.h), this often (0 = off)
+    int bus_stats_ms = BUS_STATS_MS;
+    // Rolling motor amps/vbus/belt stats events (see motor_stats.h), this often (0 = off)
+    int motor_stats_ms = MOTOR_STATS_MS;
+
+    // Real-time scheduling (see thread_sched.h); defaults change nothing
+    bool mlockall = false;
+    ThreadSched console_sched{};
+    ThreadSched motor_sched{};     // motor reader
+    ThreadSched writer_sched{};    // MotorWriter
+    ThreadSched ipc_sched{};
+    ThreadSched emulate_sched{};
+    // One thread polls the readers, runs emulate and serves IPC (the IPC
+    // thread, with ipc_sched); only the motor writer keeps its own. Process-wide
+    bool reactor = false;
+
+    // UDP telemetry publisher (see telemetry.h); empty address = disabled
+    std::string telemetry_address{};
+    int telemetry_port    = 5005;
+    int telemetry_rate_hz = 10;
+    int telemetry_ttl     = 1;
+
+    // Thread timeline recorder (see trace.h); dumps go to trace_path
+    bool trace = false;
+    std::string trace_path = TRACE_PATH;
+
+    // Standby after this long without a bus byte (see standby.h; 0 = never)
+    int standby_idle_s = STANDBY_IDLE_S;
+    // pigpio sample period in us (gpioCfgClock), process-wide; pigpio backend only
+    int sample_us = 5;
+
+    // Per-client shared-memory command mailboxes (see cmd_mailbox.h), process-wide
+    bool mailbox = false;
+
+    // Event ring in /dev/shm for tappers (see event_tap.h), process-wide;
+    // group: the daemon's group may read it too
+    bool event_tap = false;
+    bool event_tap_group = false;
 };
 
 struct ConfigResult {
@@ -28,32 +130,92 @@ struct ConfigResult {
 };
 
 static constexpr size_t MAX_CONFIG_SIZE = 4096;
+static constexpr int MIN_BAUD = 1200;
+static constexpr int MAX_BAUD = 115200;
+static constexpr size_t MAX_BUS_CONFIG_SIZE = MAX_CONFIG_SIZE * MAX_BUSES;
 
-// Parse a gpio config from a JSON string.
-// Pure function — no I/O, fully testable.
-inline ConfigResult parse_gpio_config(std::string_view json, GpioConfig* cfg) {
+// One thread's entry in "realtime": {"policy": "fifo", "priority": 80, "cpus": [3]}
+inline bool parse_thread_sched(const rapidjson::Value& v, const char* name, ThreadSched* out,
+                               ConfigResult& result) {
+    auto fail = [&](const char* what) {
+        result.error = std::string(what) + " in \"realtime\".\"" + name + "\"";
+        return false;
+    };
+    if (!v.IsObject()) return fail("invalid section");
+
+    auto pol_it = v.FindMember("policy");
+    if (pol_it != v.MemberEnd()) {
+        if (!pol_it->value.IsString()) return fail("\"policy\" must be other, fifo or rr");
+        std::string_view pol(pol_it->value.GetString(), pol_it->value.GetStringLength());
+        if (pol == "other") out->policy = SchedPolicy::Other;
+        else if (pol == "fifo") out->policy = SchedPolicy::Fifo;
+        else if (pol == "rr") out->policy = SchedPolicy::RoundRobin;
+        else return fail("\"policy\" must be other, fifo or rr");
+    }
+    bool realtime = out->policy == SchedPolicy::Fifo || out->policy == SchedPolicy::RoundRobin;
+    auto prio_it = v.FindMember("priority");
+    if (prio_it != v.MemberEnd()) {
+        if (!realtime) return fail("\"priority\" needs policy fifo or rr");
+        if (!prio_it->value.IsInt() || prio_it->value.GetInt() < 1 || prio_it->value.GetInt() > 99) {
+            return fail("\"priority\" must be an integer in [1-99]");
+        }
+        out->priority = prio_it->value.GetInt();
+    } else if (realtime) {
+        return fail("missing \"priority\"");
+    }
+
+    auto cpus_it = v.FindMember("cpus");
+    if (cpus_it != v.MemberEnd()) {
+        if (!cpus_it->value.IsArray() || cpus_it->value.Empty()) return fail("\"cpus\" must be a non-empty list");
+        for (const auto& c : cpus_it->value.GetArray()) {
+            if (!c.IsInt() || c.GetInt() < 0 || c.GetInt() >= SCHED_MAX_CPUS) {
+                return fail("\"cpus\" entries must be integers in [0-63]");
+            }
+            out->cpus |= uint64_t{1} << c.GetInt();
+        }
+    }
+    return true;
+}
+
+// One bus's settings from a parsed JSON object (the whole file, or one
+// entry of "buses")
+inline ConfigResult parse_gpio_object(const rapidjson::Value& doc, GpioConfig* cfg) {
     ConfigResult result;
     *cfg = GpioConfig{};
 
-    if (json.size() > MAX_CONFIG_SIZE) {
-        result.error = "config exceeds maximum size";
-        return result;
+    // Optional: "backend": "pigpio" (default) or "uart"
+    auto be_it = doc.FindMember("backend");
+    if (be_it != doc.MemberEnd()) {
+        std::string_view be = be_it->value.IsString()
+            ? std::string_view(be_it->value.GetString(), be_it->value.GetStringLength()) : "";
+        if (be == "uart") cfg->backend = PortBackend::Uart;
+        else if (be != "pigpio") {
+            result.error = "\"backend\" must be pigpio or uart";
+            return result;
+        }
     }
 
-    // RapidJSON needs null-terminated mutable buffer
-    std::string buf(json);
-
-    rapidjson::Document doc;
-    doc.Parse(buf.c_str());
-    if (doc.HasParseError() || !doc.IsObject()) {
-        result.error = "invalid JSON";
-        return result;
+    // Optional: "baud": 9600. The uart backend takes only the standard rates.
+    auto baud_it = doc.FindMember("baud");
+    if (baud_it != doc.MemberEnd()) {
+        int baud = baud_it->value.IsInt() ? baud_it->value.GetInt() : 0;
+        if (baud < MIN_BAUD || baud > MAX_BAUD) {
+            result.error = "\"baud\" must be an integer in [" + std::to_string(MIN_BAUD) + "-" +
+                           std::to_string(MAX_BAUD) + "]";
+            return result;
+        }
+        if (cfg->backend == PortBackend::Uart && baud != 9600 && baud != 19200 && baud != 38400 &&
+            baud != 57600 && baud != 115200) {
+            result.error = "\"baud\" for the uart backend must be 9600, 19200, 38400, 57600 or 115200";
+            return result;
+        }
+        cfg->baud = baud;
     }
 
-    struct { const char* name; int* dest; } pins[] = {
-        {"console_read", &cfg->console_read},
-        {"motor_write",  &cfg->motor_write},
-        {"motor_read",   &cfg->motor_read},
+    struct { const char* name; int* dest; std::string* uart; } pins[] = {
+        {"console_read", &cfg->console_read, &cfg->console_uart},
+        {"motor_write",  &cfg->motor_write,  &cfg->motor_write_uart},
+        {"motor_read",   &cfg->motor_read,   &cfg->motor_read_uart},
     };
 
     for (auto& pin : pins) {
@@ -74,22 +236,493 @@ inline ConfigResult parse_gpio_config(std::string_view json, GpioConfig* cfg) {
             return result;
         }
         *pin.dest = val;
+
+        // "uart": "/dev/ttyAMA2", required by the uart backend
+        auto uart_it = it->value.FindMember("uart");
+        if (uart_it != it->value.MemberEnd()) {
+            if (!uart_it->value.IsString() || uart_it->value.GetStringLength() == 0) {
+                result.error = std::string("invalid \"uart\" in \"") + pin.name + "\"";
+                return result;
+            }
+            *pin.uart = uart_it->value.GetString();
+        } else if (cfg->backend == PortBackend::Uart) {
+            result.error = std::string("missing \"uart\" device in \"") + pin.name + "\"";
+            return result;
+        }
+    }
+    // Two lines can't share one UART receiver
+    if (cfg->backend == PortBackend::Uart && cfg->console_uart == cfg->motor_read_uart) {
+        result.error = "console_read and motor_read need different UARTs";
+        return result;
+    }
+
+    // Optional: "emulate": {"cycle_ms": 500, "burst_gap_ms": 100, "paced": false, "min_gap_ms": 20}
+    auto emu_it = doc.FindMember("emulate");
+    if (emu_it != doc.MemberEnd()) {
+        if (!emu_it->value.IsObject()) {
+            result.error = "invalid \"emulate\" section";
+            return result;
+        }
+        struct { const char* name; int* dest; int min; int max; } timing[] = {
+            {"cycle_ms",     &cfg->emu_cycle_ms,     100, 5000},
+            {"burst_gap_ms", &cfg->emu_burst_gap_ms, 0,   1000},
+            {"min_gap_ms",   &cfg->emu_min_gap_ms,   0,   1000},
+        };
+        for (auto& t : timing) {
+            auto it = emu_it->value.FindMember(t.name);
+            if (it == emu_it->value.MemberEnd()) continue;
+            if (!it->value.IsInt() || it->value.GetInt() < t.min || it->value.GetInt() > t.max) {
+                result.error = std::string("\"") + t.name + "\" must be an integer in [" +
+                               std::to_string(t.min) + "-" + std::to_string(t.max) + "]";
+                return result;
+            }
+            *t.dest = it->value.GetInt();
+        }
+
+        // Paced: burst_gap_ms is the wait for answers, min_gap_ms the least
+        // spacing, and there is no cycle to fit the bursts into
+        auto paced_it = emu_it->value.FindMember("paced");
+        if (paced_it != emu_it->value.MemberEnd()) {
+            if (!paced_it->value.IsBool()) {
+                result.error = "\"paced\" must be a boolean";
+                return result;
+            }
+            cfg->emu_paced = paced_it->value.GetBool();
+        }
+        if (cfg->emu_paced && cfg->emu_min_gap_ms > cfg->emu_burst_gap_ms) {
+            result.error = "\"min_gap_ms\" must not exceed \"burst_gap_ms\"";
+            return result;
+        }
+        // Otherwise all 5 bursts must start inside one cycle
+        if (!cfg->emu_paced && cfg->emu_burst_gap_ms * 4 >= cfg->emu_cycle_ms) {
+            result.error = "\"burst_gap_ms\" too large for \"cycle_ms\" (need 4 * gap < cycle)";
+            return result;
+        }
+
+        // "rates": {"inc": "burst", "hmph": "burst", "ver": 10, ...}: each
+        // key every N cycles (1-100) or "burst"; setpoints at least every cycle
+        auto rates_it = emu_it->value.FindMember("rates");
+        if (rates_it != emu_it->value.MemberEnd()) {
+            if (!rates_it->value.IsObject()) {
+                result.error = "invalid \"rates\" in \"emulate\"";
+                return result;
+            }
+            for (auto m = rates_it->value.MemberBegin(); m != rates_it->value.MemberEnd(); ++m) {
+                std::string_view key(m->name.GetString(), m->name.GetStringLength());
+                int idx = kv_cycle_index(key);
+                if (idx < 0) {
+                    result.error = "unknown emulate key \"" + std::string(key) + "\" in \"rates\"";
+                    return result;
+                }
+                auto& rate = cfg->emu_rates.at(static_cast<size_t>(idx));
+                if (m->value.IsString() && std::string_view(m->value.GetString()) == "burst") {
+                    rate = EMU_EVERY_BURST;
+                } else if (m->value.IsInt() && m->value.GetInt() >= 1 && m->value.GetInt() <= EMU_MAX_EVERY &&
+                           (idx > 1 || m->value.GetInt() == 1)) {
+                    rate = static_cast<uint8_t>(m->value.GetInt());
+                } else {
+                    result.error = "\"rates\".\"" + std::string(key) + "\" must be \"burst\" or " +
+                                   (idx > 1 ? "an integer in [1-" + std::to_string(EMU_MAX_EVERY) + "]"
+                                            : std::string("1 (setpoints go out every cycle)"));
+                    return result;
+                }
+            }
+        }
+    }
+
+    // Optional: "journal": {"dir": "/var/log/treadmill", "segment_kb": 4096, "segments": 8}
+    auto jrn_it = doc.FindMember("journal");
+    if (jrn_it != doc.MemberEnd()) {
+        if (!jrn_it->value.IsObject()) {
+            result.error = "invalid \"journal\" section";
+            return result;
+        }
+        auto dir_it = jrn_it->value.FindMember("dir");
+        if (dir_it == jrn_it->value.MemberEnd() || !dir_it->value.IsString() ||
+            dir_it->value.GetStringLength() == 0) {
+            result.error = "missing or invalid \"dir\" in \"journal\"";
+            return result;
+        }
+        cfg->journal_dir = dir_it->value.GetString();
+        struct { const char* name; int* dest; int min; int max; } sizing[] = {
+            {"segment_kb", &cfg->journal_segment_kb, 4, 262144},
+            {"segments",   &cfg->journal_segments,   1, 64},
+        };
+        for (auto& t : sizing) {
+            auto it = jrn_it->value.FindMember(t.name);
+            if (it == jrn_it->value.MemberEnd()) continue;
+            if (!it->value.IsInt() || it->value.GetInt() < t.min || it->value.GetInt() > t.max) {
+                result.error = std::string("\"") + t.name + "\" must be an integer in [" +
+                               std::to_string(t.min) + "-" + std::to_string(t.max) + "]";
+                return result;
+            }
+            *t.dest = it->value.GetInt();
+        }
+    }
+
+    // Optional: "events": {"changes_only": true, "keyframe_ms": 5000, "status_interval_ms": 1000,
+    //                      "bus_stats_ms": 5000, "motor_stats_ms": 1000, "cycles": false,
+    //                      "lazy_console": false}
+    auto ev_it = doc.FindMember("events");
+    if (ev_it != doc.MemberEnd()) {
+        if (!ev_it->value.IsObject()) {
+            result.error = "invalid \"events\" section";
+            return result;
+        }
+        auto co_it = ev_it->value.FindMember("changes_only");
+        if (co_it != ev_it->value.MemberEnd()) {
+            if (!co_it->value.IsBool()) {
+                result.error = "\"changes_only\" must be a boolean";
+                return result;
+            }
+            cfg->kv_changes_only = co_it->value.GetBool();
+        }
+        auto kf_it = ev_it->value.FindMember("keyframe_ms");
+        if (kf_it != ev_it->value.MemberEnd()) {
+            if (!kf_it->value.IsInt() || kf_it->value.GetInt() < 500 || kf_it->value.GetInt() > 60000) {
+                result.error = "\"keyframe_ms\" must be an integer in [500-60000]";
+                return result;
+            }
+            cfg->kv_keyframe_ms = kf_it->value.GetInt();
+        }
+        auto si_it = ev_it->value.FindMember("status_interval_ms");
+        if (si_it != ev_it->value.MemberEnd()) {
+            if (!si_it->value.IsInt() || (si_it->value.GetInt() != 0 &&
+                                          (si_it->value.GetInt() < 100 || si_it->value.GetInt() > 60000))) {
+                result.error = "\"status_interval_ms\" must be 0 or an integer in [100-60000]";
+                return result;
+            }
+            cfg->status_interval_ms = si_it->value.GetInt();
+        }
+        auto bs_it = ev_it->value.FindMember("bus_stats_ms");
+        if (bs_it != ev_it->value.MemberEnd()) {
+            if (!bs_it->value.IsInt() || (bs_it->value.GetInt() != 0 &&
+                                          (bs_it->value.GetInt() < 1000 || bs_it->value.GetInt() > 60000))) {
+                result.error = "\"bus_stats_ms\" must be 0 or an integer in [1000-60000]";
+                return result;
+            }
+            cfg->bus_stats_ms = bs_it->value.GetInt();
+        }
+        auto ms_it = ev_it->value.FindMember("motor_stats_ms");
+        if (ms_it != ev_it->value.MemberEnd()) {
+            if (!ms_it->value.IsInt() || (ms_it->value.GetInt() != 0 &&
+                                          (ms_it->value.GetInt() < 1000 || ms_it->value.GetInt() > 60000))) {
+                result.error = "\"motor_stats_ms\" must be 0 or an integer in [1000-60000]";
+                return result;
+            }
+            cfg->motor_stats_ms = ms_it->value.GetInt();
+        }
+        auto cy_it = ev_it->value.FindMember("cycles");
+        if (cy_it != ev_it->value.MemberEnd()) {
+            if (!cy_it->value.IsBool()) {
+                result.error = "\"cycles\" must be a boolean";
+                return result;
+            }
+            cfg->cycle_events = cy_it->value.GetBool();
+        }
+        auto lc_it = ev_it->value.FindMember("lazy_console");
+        if (lc_it != ev_it->value.MemberEnd()) {
+            if (!lc_it->value.IsBool()) {
+                result.error = "\"lazy_console\" must be a boolean";
+                return result;
+            }
+            cfg->lazy_console = lc_it->value.GetBool();
+        }
+    }
+
+    // Optional: "realtime": {"mlockall": true, "reactor": false, "console": {"policy": "fifo", "priority": 80,
+    //                        "cpus": [3]}, "motor": ..., "motor_write": ..., "ipc": ..., "emulate": ...}
+    auto rt_it = doc.FindMember("realtime");
+    if (rt_it != doc.MemberEnd()) {
+        if (!rt_it->value.IsObject()) {
+            result.error = "invalid \"realtime\" section";
+            return result;
+        }
+        auto ml_it = rt_it->value.FindMember("mlockall");
+        if (ml_it != rt_it->value.MemberEnd()) {
+            if (!ml_it->value.IsBool()) {
+                result.error = "\"mlockall\" must be a boolean";
+                return result;
+            }
+            cfg->mlockall = ml_it->value.GetBool();
+        }
+        auto re_it = rt_it->value.FindMember("reactor");
+        if (re_it != rt_it->value.MemberEnd()) {
+            if (!re_it->value.IsBool()) {
+                result.error = "\"reactor\" must be a boolean";
+                return result;
+            }
+            cfg->reactor = re_it->value.GetBool();
+        }
+        struct { const char* name; ThreadSched* dest; } threads[] = {
+            {"console",     &cfg->console_sched},
+            {"motor",       &cfg->motor_sched},
+            {"motor_write", &cfg->writer_sched},
+            {"ipc",         &cfg->ipc_sched},
+            {"emulate",     &cfg->emulate_sched},
+        };
+        for (auto& t : threads) {
+            auto it = rt_it->value.FindMember(t.name);
+            if (it != rt_it->value.MemberEnd() && !parse_thread_sched(it->value, t.name, t.dest, result)) {
+                return result;
+            }
+        }
+    }
+
+    // Optional: "telemetry": {"address": "239.77.0.1", "port": 5005, "rate_hz": 10, "ttl": 1}
+    auto tel_it = doc.FindMember("telemetry");
+    if (tel_it != doc.MemberEnd()) {
+        if (!tel_it->value.IsObject()) {
+            result.error = "invalid \"telemetry\" section";
+            return result;
+        }
+        auto addr_it = tel_it->value.FindMember("address");
+        in_addr parsed{};
+        if (addr_it == tel_it->value.MemberEnd() || !addr_it->value.IsString() ||
+            inet_pton(AF_INET, addr_it->value.GetString(), &parsed) != 1) {
+            result.error = "missing or invalid IPv4 \"address\" in \"telemetry\"";
+            return result;
+        }
+        cfg->telemetry_address = addr_it->value.GetString();
+        struct { const char* name; int* dest; int min; int max; } opts[] = {
+            {"port",    &cfg->telemetry_port,    1, 65535},
+            {"rate_hz", &cfg->telemetry_rate_hz, 1, 100},
+            {"ttl",     &cfg->telemetry_ttl,     0, 255},
+        };
+        for (auto& t : opts) {
+            auto it = tel_it->value.FindMember(t.name);
+            if (it == tel_it->value.MemberEnd()) continue;
+            if (!it->value.IsInt() || it->value.GetInt() < t.min || it->value.GetInt() > t.max) {
+                result.error = std::string("\"") + t.name + "\" must be an integer in [" +
+                               std::to_string(t.min) + "-" + std::to_string(t.max) + "]";
+                return result;
+            }
+            *t.dest = it->value.GetInt();
+        }
+    }
+
+    // Optional: "trace": {"enabled": true, "path": "/tmp/treadmill_io.trace.json"}
+    auto tr_it = doc.FindMember("trace");
+    if (tr_it != doc.MemberEnd()) {
+        if (!tr_it->value.IsObject()) {
+            result.error = "invalid \"trace\" section";
+            return result;
+        }
+        auto en_it = tr_it->value.FindMember("enabled");
+        if (en_it != tr_it->value.MemberEnd()) {
+            if (!en_it->value.IsBool()) {
+                result.error = "\"enabled\" must be a boolean";
+                return result;
+            }
+            cfg->trace = en_it->value.GetBool();
+        }
+        auto path_it = tr_it->value.FindMember("path");
+        if (path_it != tr_it->value.MemberEnd()) {
+            if (!path_it->value.IsString() || path_it->value.GetStringLength() == 0) {
+                result.error = "\"path\" in \"trace\" must be a non-empty string";
+                return result;
+            }
+            cfg->trace_path = path_it->value.GetString();
+        }
+    }
+
+    // Optional: "standby": {"idle_s": 60, "sample_us": 5}
+    auto sb_it = doc.FindMember("standby");
+    if (sb_it != doc.MemberEnd()) {
+        if (!sb_it->value.IsObject()) {
+            result.error = "invalid \"standby\" section";
+            return result;
+        }
+        auto idle_it = sb_it->value.FindMember("idle_s");
+        if (idle_it != sb_it->value.MemberEnd()) {
+            if (!idle_it->value.IsInt() || (idle_it->value.GetInt() != 0 &&
+                                            (idle_it->value.GetInt() < 10 || idle_it->value.GetInt() > 86400))) {
+                result.error = "\"idle_s\" must be 0 or an integer in [10-86400]";
+                return result;
+            }
+            cfg->standby_idle_s = idle_it->value.GetInt();
+        }
+        auto su_it = sb_it->value.FindMember("sample_us");
+        if (su_it != sb_it->value.MemberEnd()) {
+            int us = su_it->value.IsInt() ? su_it->value.GetInt() : 0;
+            if (us != 1 && us != 2 && us != 4 && us != 5 && us != 8 && us != 10) {
+                result.error = "\"sample_us\" must be 1, 2, 4, 5, 8 or 10";
+                return result;
+            }
+            if (cfg->backend == PortBackend::Uart) {
+                result.error = "\"sample_us\" needs the pigpio backend";
+                return result;
+            }
+            if (us * cfg->baud > 250000) {  // pigpio's bit-banged reads want 4+ samples per bit
+                result.error = "\"sample_us\" is too long for the baud rate";
+                return result;
+            }
+            cfg->sample_us = us;
+        }
+    }
+
+    // Optional: "mailbox": {"enabled": true}
+    auto mb_it = doc.FindMember("mailbox");
+    if (mb_it != doc.MemberEnd()) {
+        if (!mb_it->value.IsObject()) {
+            result.error = "invalid \"mailbox\" section";
+            return result;
+        }
+        auto en_it = mb_it->value.FindMember("enabled");
+        if (en_it != mb_it->value.MemberEnd()) {
+            if (!en_it->value.IsBool()) {
+                result.error = "\"enabled\" must be a boolean";
+                return result;
+            }
+            cfg->mailbox = en_it->value.GetBool();
+        }
+    }
+
+    // Optional: "tap": {"enabled": true, "group": false}
+    auto tap_it = doc.FindMember("tap");
+    if (tap_it != doc.MemberEnd()) {
+        if (!tap_it->value.IsObject()) {
+            result.error = "invalid \"tap\" section";
+            return result;
+        }
+        struct { const char* name; bool* dest; } opts[] = {
+            {"enabled", &cfg->event_tap},
+            {"group",   &cfg->event_tap_group},
+        };
+        for (auto& t : opts) {
+            auto it = tap_it->value.FindMember(t.name);
+            if (it == tap_it->value.MemberEnd()) continue;
+            if (!it->value.IsBool()) {
+                result.error = std::string("\"") + t.name + "\" must be a boolean";
+                return result;
+            }
+            *t.dest = it->value.GetBool();
+        }
     }
 
     result.ok = true;
     return result;
 }
 
-// Load gpio config from a file path. Thin I/O wrapper around parse_gpio_config.
-inline ConfigResult load_gpio_config(std::string_view path, GpioConfig* cfg) {
+// Parse a gpio config from a JSON string.
+// Pure function — no I/O, fully testable.
+inline ConfigResult parse_gpio_config(std::string_view json, GpioConfig* cfg) {
+    *cfg = GpioConfig{};
+
+    if (json.size() > MAX_CONFIG_SIZE) {
+        return {false, "config exceeds maximum size"};
+    }
+
+    // RapidJSON needs null-terminated mutable buffer
+    std::string buf(json);
+
+    rapidjson::Document doc;
+    doc.Parse(buf.c_str());
+    if (doc.HasParseError() || !doc.IsObject()) {
+        return {false, "invalid JSON"};
+    }
+    return parse_gpio_object(doc, cfg);
+}
+
+// Gpio config for one or more buses hosted by one process: either the
+// single-bus object above, or {"buses": [{...}, {...}]} with one such
+// object per bus (bus id = index). Buses may not share a GPIO pin or a
+// journal directory.
+inline ConfigResult parse_bus_configs(std::string_view json, std::vector<GpioConfig>* buses) {
+    buses->clear();
+
+    if (json.size() > MAX_BUS_CONFIG_SIZE) {
+        return {false, "config exceeds maximum size"};
+    }
+
+    std::string buf(json);
+    rapidjson::Document doc;
+    doc.Parse(buf.c_str());
+    if (doc.HasParseError() || !doc.IsObject()) {
+        return {false, "invalid JSON"};
+    }
+
+    auto bus_it = doc.FindMember("buses");
+    if (bus_it == doc.MemberEnd()) {
+        if (json.size() > MAX_CONFIG_SIZE) return {false, "config exceeds maximum size"};
+        GpioConfig cfg;
+        auto result = parse_gpio_object(doc, &cfg);
+        if (result.ok) buses->push_back(cfg);
+        return result;
+    }
+
+    const auto& list = bus_it->value;
+    if (!list.IsArray() || list.Empty() || list.Size() > static_cast<rapidjson::SizeType>(MAX_BUSES)) {
+        return {false, "\"buses\" must be an array of 1-" + std::to_string(MAX_BUSES) + " objects"};
+    }
+
+    uint64_t used_pins = 0;
+    for (rapidjson::SizeType i = 0; i < list.Size(); i++) {
+        std::string where = "bus " + std::to_string(i) + ": ";
+        if (!list[i].IsObject()) return {false, where + "invalid entry"};
+        GpioConfig cfg;
+        auto result = parse_gpio_object(list[i], &cfg);
+        if (!result.ok) return {false, where + result.error};
+
+        for (int pin : { cfg.console_read, cfg.motor_write, cfg.motor_read }) {
+            if (used_pins & (uint64_t{1} << pin)) {
+                return {false, where + "gpio " + std::to_string(pin) + " already used by another bus"};
+            }
+            used_pins |= uint64_t{1} << pin;
+        }
+        for (const auto& other : *buses) {
+            if (!cfg.journal_dir.empty() && cfg.journal_dir == other.journal_dir) {
+                return {false, where + "journal dir " + cfg.journal_dir + " already used by another bus"};
+            }
+            if (cfg.backend != other.backend) {
+                return {false, where + "every bus needs the same \"backend\""};
+            }
+            if (cfg.sample_us != other.sample_us) {
+                return {false, where + "every bus needs the same \"sample_us\""};
+            }
+            if (cfg.backend == PortBackend::Uart && cfg.baud != other.baud) {
+                return {false, where + "every uart bus needs the same \"baud\""};
+            }
+            if (cfg.backend == PortBackend::Uart) {
+                for (const auto* dev : { &cfg.console_uart, &cfg.motor_write_uart, &cfg.motor_read_uart }) {
+                    if (*dev == other.console_uart || *dev == other.motor_write_uart ||
+                        *dev == other.motor_read_uart) {
+                        return {false, where + "uart " + *dev + " already used by another bus"};
+                    }
+                }
+            }
+        }
+        buses->push_back(cfg);
+    }
+    return {true, {}};
+}
+
+// Read a config file (at most `max` bytes) into `out`
+inline ConfigResult read_config_file(std::string_view path, size_t max, std::string* out) {
     std::string path_str(path);  // fopen needs null-terminated
     FILE* f = std::fopen(path_str.c_str(), "r");
     if (!f) {
         return {false, std::string("cannot open ") + path_str};
     }
-    char buf[MAX_CONFIG_SIZE];
-    size_t n = std::fread(buf, 1, sizeof(buf) - 1, f);
+    out->resize(max);
+    size_t n = std::fread(out->data(), 1, max, f);
     std::fclose(f);
-    buf[n] = '\0';
-    return parse_gpio_config(std::string_view(buf, n), cfg);
+    out->resize(n);
+    return {true, {}};
+}
+
+// Load gpio config from a file path. Thin I/O wrapper around parse_gpio_config.
+inline ConfigResult load_gpio_config(std::string_view path, GpioConfig* cfg) {
+    std::string text;
+    auto result = read_config_file(path, MAX_CONFIG_SIZE - 1, &text);
+    if (!result.ok) return result;
+    return parse_gpio_config(text, cfg);
+}
+
+// Load every bus's config from a file path (see parse_bus_configs)
+inline ConfigResult load_bus_configs(std::string_view path, std::vector<GpioConfig>* buses) {
+    std::string text;
+    auto result = read_config_file(path, MAX_BUS_CONFIG_SIZE, &text);
+    if (!result.ok) return result;
+    return parse_bus_configs(text, buses);
 }
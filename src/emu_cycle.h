@@ -0,0 +1,125 @@
+/*
+ * emu_cycle.h — The emulate cycle as data: keys, bursts, per-key rates
+ *
+ * KV_CYCLE lists the 14 keys the real console sends and BURSTS groups
+ * them into its 5 bursts per cycle. EmuRates says how often each key
+ * actually goes out: in its home burst every N cycles, or in every burst
+ * (EMU_EVERY_BURST). The defaults reproduce the console exactly. On a
+ * 9600 baud bus, sending inc/hmph every burst cuts setpoint latency from
+ * a cycle to a burst gap, and sending identity keys (part, ver, type)
+ * every 10th cycle pays for it. Set from gpio.json "emulate" "rates"
+ * (config.h).
+ *
+ * Also the compile-time wire frames for every key and value the cycle
+ * can send, so the emulate loop only indexes tables.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <string_view>
+#include "kv_protocol.h"
+#include "mode_state.h"
+
+// 14-key cycle entry
+struct KvCycleEntry {
+    const char* key;
+    bool has_value;  // true = valued [key:value], false = bare [key] command
+    const char* fixed = "";  // constant value; "" for bare keys and inc/hmph
+};
+
+constexpr size_t KV_CYCLE_SIZE = 14;
+
+static constexpr KvCycleEntry KV_CYCLE[KV_CYCLE_SIZE] = {
+    { "inc",  true  },   //  0: incline (half-pct, uppercase hex)
+    { "hmph", true  },   //  1: speed (mph*100, uppercase hex)
+    { "amps", false },   //  2
+    { "err",  false },   //  3
+    { "belt", false },   //  4
+    { "vbus", false },   //  5
+    { "lift", false },   //  6
+    { "lfts", false },   //  7
+    { "lftg", false },   //  8
+    { "part", true, "6" },     //  9
+    { "ver",  false },   // 10
+    { "type", false },   // 11
+    { "diag", true, "0" },     // 12
+    { "loop", true, "5550" },  // 13
+};
+
+constexpr int EMU_BURSTS = 5;
+
+// Which KV_CYCLE indices belong to each burst (-1 = end)
+static constexpr int BURSTS[EMU_BURSTS][4] = {
+    { 0, 1, -1, -1 },       // inc, hmph
+    { 2, 3, 4, -1 },        // amps, err, belt
+    { 5, 6, 7, 8 },         // vbus, lift, lfts, lftg
+    { 9, 10, 11, -1 },      // part, ver, type
+    { 12, 13, -1, -1 },     // diag, loop
+};
+
+// Per-key rate, by KV_CYCLE index: cycles between sends (1 = every
+// cycle), or EMU_EVERY_BURST. inc and hmph go out at least every cycle.
+constexpr uint8_t EMU_EVERY_BURST = 0;
+constexpr int EMU_MAX_EVERY = 100;
+using EmuRates = std::array<uint8_t, KV_CYCLE_SIZE>;
+static constexpr EmuRates EMU_DEFAULT_RATES = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+
+// KV_CYCLE index of `key`, or -1
+constexpr int kv_cycle_index(std::string_view key) {
+    for (size_t i = 0; i < KV_CYCLE_SIZE; i++) {
+        if (key == KV_CYCLE[i].key) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+// Home burst of a KV_CYCLE index
+constexpr int kv_cycle_burst(int idx) {
+    for (int b = 0; b < EMU_BURSTS; b++) {
+        for (int idx_in : BURSTS[b]) {
+            if (idx_in == idx) return b;
+        }
+    }
+    return -1;
+}
+
+// Whether KV_CYCLE entry `idx` goes out in `burst` of cycle number `cycle`
+constexpr bool emu_sends(const EmuRates& rates, int idx, int burst, uint64_t cycle) {
+    uint8_t every = rates.at(static_cast<size_t>(idx));
+    if (every == EMU_EVERY_BURST) return true;
+    return kv_cycle_burst(idx) == burst && cycle % every == 0;
+}
+
+// By KV_CYCLE index, the key the motor answers the frame with, as a
+// kv_key_bit(), or 0: bare queries get their value, inc and hmph the
+// motor's own reading. Response pacing waits for these.
+static constexpr auto EMU_REPLY_BITS = [] {
+    std::array<uint32_t, KV_CYCLE_SIZE> bits{};
+    for (size_t i = 0; i < KV_CYCLE_SIZE; i++) {
+        if (i <= 1 || !KV_CYCLE[i].has_value) bits.at(i) = kv_key_bit(kv_key_lookup(KV_CYCLE[i].key));
+    }
+    return bits;
+}();
+
+static_assert(kv_cycle_index("part") == 9);
+static_assert(EMU_REPLY_BITS.at(10) == kv_key_bit(KvKey::Ver) && EMU_REPLY_BITS.at(13) == 0);
+static_assert(kv_cycle_burst(13) == 4);
+
+// Every wire frame the cycle can send, generated at compile time:
+// inc/hmph for each value the mode state machine allows, plus the
+// constant KV_CYCLE entries. The emulate loop only indexes these.
+static constexpr auto INC_FRAMES  = make_kv_frame_table<MAX_INCLINE>("inc", encode_incline_hex);
+static constexpr auto HMPH_FRAMES = make_kv_frame_table<MAX_SPEED_TENTHS>("hmph", encode_speed_hex);
+
+static constexpr std::array<KvWireFrame, KV_CYCLE_SIZE> FIXED_FRAMES = [] {
+    std::array<KvWireFrame, KV_CYCLE_SIZE> frames{};
+    for (size_t i = 2; i < frames.size(); i++) {
+        frames.at(i) = make_kv_frame(KV_CYCLE[i].key, KV_CYCLE[i].fixed);
+    }
+    return frames;
+}();
+
+static_assert(INC_FRAMES.back().wire() == "[inc:C6]\xff");
+static_assert(HMPH_FRAMES.back().wire() == "[hmph:4B0]\xff");
+static_assert(FIXED_FRAMES.at(13).wire() == "[loop:5550]\xff");
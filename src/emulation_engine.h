@@ -1,65 +1,97 @@
 /*
- * emulation_engine.h — EmulationEngine: 14-key cycle, safety timeout
+ * emulation_engine.h — EmulationEngine: scheduled key cycle, safety timeout
  *
  * Replaces the console by sending a synthesized KV command cycle
- * to the motor. Owns the emulate thread lifecycle (RAII: destructor
- * joins). Reads params from ModeStateMachine::snapshot().
+ * to the motor, one chained DMA transmission per burst. Writer is a
+ * SerialWriter, or a MotorWriter queue in front of one; with a writer
+ * that has a priority lane, the 3-hour safety reset also sends an
+ * immediate [hmph:0] ahead of queued bursts. Owns the
+ * emulate thread lifecycle (RAII: destructor joins). Reads params from
+ * ModeStateMachine::snapshot().
+ *
+ * Bursts are paced by absolute deadlines on Clock (clock.h), so write time
+ * and scheduler noise don't accumulate into the cycle period. Between
+ * bursts the thread waits on ModeStateMachine's change notification: a
+ * new speed or incline goes out at once as an extra inc/hmph burst, and
+ * the regular cycle carries on unchanged around it. Which keys each
+ * burst carries follows EmuTiming::rates (emu_cycle.h). Period
+ * statistics (mean/p99/max, overruns) are kept for the IPC stats command.
+ *
+ * EmuTiming::paced drops the fixed grid: the next burst goes out as soon
+ * as the motor has answered everything the last one asked
+ * (EMU_REPLY_BITS, reported through motor_reported()), but no sooner
+ * than min_gap_ms after it, and burst_gap_ms after it at the latest. A
+ * motor answering in 25 ms then gets inc/hmph several times as often.
+ * The last awaited answer wakes the emulate thread through the mode's
+ * notify_waiters(); there is no fixed cycle, so stats() has no target.
+ *
+ * With set_external() there is no emulate thread: the owner's event loop
+ * calls run_due(), which does what the thread would have done by now and
+ * says when to call again (the controller's reactor mode).
  */
 
 #pragma once
 
 #include <cstdio>
-#include <ctime>
 #include <string>
 #include <string_view>
+#include <array>
+#include <span>
 #include <thread>
 #include <atomic>
 #include <functional>
+#include <mutex>
+#include <algorithm>
 #include "kv_protocol.h"
 #include "mode_state.h"
+#include "emu_cycle.h"
+#include "clock.h"
 #include "serial_io.h"
+#include "thread_sched.h"
 
 constexpr int EMU_TIMEOUT_SEC = 3 * 3600;  // 3 hours
 
-// 14-key cycle entry
-struct KvCycleEntry {
-    const char* key;
-    bool has_value;  // true = dynamic value, false = bare [key] command
-};
+// A burst starting later than this past its deadline counts as an overrun
+constexpr int EMU_OVERRUN_US = 2000;
+// Cycle periods kept for the p99 estimate
+constexpr int EMU_STATS_WINDOW = 256;
 
-static constexpr KvCycleEntry KV_CYCLE[14] = {
-    { "inc",  true  },   //  0: incline (half-pct, uppercase hex)
-    { "hmph", true  },   //  1: speed (mph*100, uppercase hex)
-    { "amps", false },   //  2
-    { "err",  false },   //  3
-    { "belt", false },   //  4
-    { "vbus", false },   //  5
-    { "lift", false },   //  6
-    { "lfts", false },   //  7
-    { "lftg", false },   //  8
-    { "part", true  },   //  9: always "6"
-    { "ver",  false },   // 10
-    { "type", false },   // 11
-    { "diag", true  },   // 12: always "0"
-    { "loop", true  },   // 13: always "5550"
+// Cycle pacing. Burst k of each cycle starts burst_gap_ms * k after the
+// cycle's deadline; cycles start every cycle_ms. Defaults match the
+// real console (5 bursts ~100 ms apart, every key once per cycle).
+// Paced, each burst follows the last once the motor has answered it,
+// min_gap_ms to burst_gap_ms after it, and cycle_ms goes unused.
+struct EmuTiming {
+    int cycle_ms = 500;
+    int burst_gap_ms = 100;
+    EmuRates rates = EMU_DEFAULT_RATES;
+    bool paced = false;
+    int min_gap_ms = 20;
 };
 
-// Which KV_CYCLE indices belong to each burst (-1 = end)
-static constexpr int BURSTS[5][4] = {
-    { 0, 1, -1, -1 },       // inc, hmph
-    { 2, 3, 4, -1 },        // amps, err, belt
-    { 5, 6, 7, 8 },         // vbus, lift, lfts, lftg
-    { 9, 10, 11, -1 },      // part, ver, type
-    { 12, 13, -1, -1 },     // diag, loop
+// Cycle-period statistics since the engine last started (microseconds).
+// p99 covers the most recent EMU_STATS_WINDOW cycles.
+struct EmuCycleStats {
+    uint64_t cycles = 0;
+    uint64_t overruns = 0;
+    int target_us = 0;      // cycle_ms; 0 when paced
+    double mean_us = 0;
+    int p99_us = 0;
+    int max_us = 0;
+    uint64_t injected = 0;  // out-of-cycle inc/hmph bursts
+    uint64_t timeouts = 0;  // paced: bursts sent with answers to the last still missing
 };
 
-template <typename Port>
+template <typename Port, typename Writer = SerialWriter<Port>, typename Clock = MonoClock>
 class EmulationEngine {
 public:
     using KvEventCallback = std::function<void(std::string_view key, std::string_view value)>;
+    using BurstHook = std::function<void(int64_t now_ns)>;
+    using CycleHook = std::function<void()>;
 
-    EmulationEngine(SerialWriter<Port>& writer, ModeStateMachine& mode)
-        : writer_(writer), mode_(mode) {}
+    EmulationEngine(Writer& writer, ModeStateMachine& mode,
+                    EmuTiming timing = {}, Clock clock = {})
+        : writer_(writer), mode_(mode), timing_(timing), clock_(std::move(clock)) {}
 
     ~EmulationEngine() {
         stop();
@@ -68,15 +100,65 @@ public:
     // Set callback for emitted KV events (pushed to ring buffer)
     void on_kv_event(KvEventCallback cb) { kv_cb_ = std::move(cb); }
 
-    // Start the emulate thread
+    // Called on the emulate thread right before each burst (e.g. to step a
+    // program). Speed/incline it sets go out ahead of that burst.
+    void on_burst(BurstHook cb) { burst_cb_ = std::move(cb); }
+
+    // Called on the emulate thread after each cycle's last burst, and once
+    // when the thread stops, so the kv events since the last call are one
+    // whole cycle (or what there was of it)
+    void on_cycle_end(CycleHook cb) { cycle_cb_ = std::move(cb); }
+
+    // Start the emulate thread (external: start the schedule run_due() follows)
     void start() {
         stop();  // join any existing thread first
         running_.store(true, std::memory_order_relaxed);
+        if (external_) {
+            begin_run();
+            return;
+        }
         thread_ = std::thread(&EmulationEngine::thread_fn, this);
+        if (sched_.active()) apply_thread_sched(thread_.native_handle(), sched_, "emulate");
+    }
+
+    // Driven by the owner's loop instead of a thread of its own: start()
+    // and stop() spawn and join nothing, and the hooks run on the thread
+    // calling run_due(), start() and stop(). Set before the first start().
+    void set_external(bool on) { external_ = on; }
+
+    // The motor reported `id`: an answer a paced burst may be waiting for.
+    // The last one wakes the emulate thread. Motor reader thread (or the
+    // owner's, external: its loop polls the readers before run_due()).
+    void motor_reported(KvKey id) {
+        uint32_t bit = kv_key_bit(id);
+        if (!(awaiting_.load(std::memory_order_relaxed) & bit)) return;
+        if (awaiting_.fetch_and(~bit, std::memory_order_acq_rel) == bit) {
+            replied_ns_.store(now_ns(), std::memory_order_release);
+            if (!external_) mode_.notify_waiters();
+        }
+    }
+
+    // External only: send whatever is due by now (a changed speed or
+    // incline, the next burst). Returns when the next burst is due on
+    // Clock, or -1 once the engine has stopped. The owner's thread only.
+    int64_t run_due() {
+        if (!running_.load(std::memory_order_relaxed)) return -1;
+        if (!mode_.is_emulating()) {
+            end_run();
+            return -1;
+        }
+        return step();
     }
 
+    // Scheduling for the emulate thread; takes effect on the next start()
+    void set_sched(const ThreadSched& s) { sched_ = s; }
+
     // Stop the emulate thread and wait for it to exit
     void stop() {
+        if (external_) {
+            if (running_.load(std::memory_order_relaxed)) end_run();
+            return;
+        }
         running_.store(false, std::memory_order_relaxed);
         if (thread_.joinable()) {
             thread_.join();
@@ -85,82 +167,296 @@ public:
 
     bool is_running() const { return running_.load(std::memory_order_relaxed); }
 
+    // Change pacing; takes effect on the next start()
+    void set_timing(EmuTiming timing) {
+        std::lock_guard<std::mutex> lk(stats_mu_);
+        timing_ = timing;
+    }
+
+    EmuTiming timing() const {
+        std::lock_guard<std::mutex> lk(stats_mu_);
+        return timing_;
+    }
+
+    // Snapshot of cycle timing (safe from any thread)
+    EmuCycleStats stats() const {
+        std::lock_guard<std::mutex> lk(stats_mu_);
+        EmuCycleStats out;
+        out.cycles = cycles_;
+        out.overruns = overruns_;
+        out.injected = injected_;
+        out.timeouts = timeouts_;
+        out.target_us = timing_.paced ? 0 : timing_.cycle_ms * 1000;
+        out.max_us = static_cast<int>(max_ns_ / 1000);
+        uint64_t n = periods_;
+        if (n == 0) return out;
+        out.mean_us = static_cast<double>(sum_ns_) / static_cast<double>(n) / 1000.0;
+
+        size_t w = static_cast<size_t>(std::min<uint64_t>(n, EMU_STATS_WINDOW));
+        std::array<int64_t, EMU_STATS_WINDOW> sorted;
+        std::copy_n(window_.begin(), w, sorted.begin());
+        size_t rank = (w * 99 + 99) / 100 - 1;  // nearest-rank p99
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.begin() + w);
+        out.p99_us = static_cast<int>(sorted.at(rank) / 1000);
+        return out;
+    }
+
 private:
-    static void sleep_ms(int ms) {
-        struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
-        nanosleep(&ts, nullptr);
+    int64_t now_ns() const { return clock_.now_ns(); }
+
+    // Send inc/hmph right away if they differ from what the motor last got
+    void inject_changes(const StateSnapshot& snap) {
+        if (!snap.emulate_enabled) return;
+        std::array<const KvWireFrame*, 2> frames{};
+        std::array<std::string_view, 2> wires;
+        size_t n = 0;
+        if (snap.incline != sent_incline_) frames.at(n++) = &frame_for(0, snap);
+        if (snap.speed_tenths != sent_speed_) frames.at(n++) = &frame_for(1, snap);
+        if (n == 0) return;
+        TraceSpan span("emu_inject");
+        for (size_t i = 0; i < n; i++) wires.at(i) = frames.at(i)->wire();
+        writer_.write_burst(std::span<const std::string_view>(wires.data(), n));
+        sent_incline_ = snap.incline;
+        sent_speed_ = snap.speed_tenths;
+        {
+            std::lock_guard<std::mutex> lk(stats_mu_);
+            injected_++;
+        }
+        if (kv_cb_) {
+            for (size_t i = 0; i < n; i++) kv_cb_(frames.at(i)->key(), frames.at(i)->value());
+        }
+    }
+
+    void reset_stats() {
+        std::lock_guard<std::mutex> lk(stats_mu_);
+        cycles_ = overruns_ = periods_ = injected_ = timeouts_ = 0;
+        sum_ns_ = max_ns_ = 0;
+    }
+
+    // Called at the start of each cycle's first burst
+    void record_cycle(int64_t start_ns, int64_t prev_start_ns) {
+        std::lock_guard<std::mutex> lk(stats_mu_);
+        cycles_++;
+        if (prev_start_ns < 0) return;
+        int64_t period = start_ns - prev_start_ns;
+        window_.at(periods_ % EMU_STATS_WINDOW) = period;
+        periods_++;
+        sum_ns_ += period;
+        max_ns_ = std::max(max_ns_, period);
+    }
+
+    void record_overrun() {
+        std::lock_guard<std::mutex> lk(stats_mu_);
+        overruns_++;
     }
 
-    std::string value_for(int idx, const StateSnapshot& snap) {
+    static const KvWireFrame& frame_for(int idx, const StateSnapshot& snap) {
         switch (idx) {
-            case 0:  return encode_incline_hex(snap.incline);   // inc
-            case 1:  return encode_speed_hex(snap.speed_tenths); // hmph
-            case 9:  return "6";     // part
-            case 12: return "0";     // diag
-            case 13: return "5550";  // loop
-            default: return {};
+            case 0:  return INC_FRAMES.at(std::clamp(snap.incline, 0, MAX_INCLINE));
+            case 1:  return HMPH_FRAMES.at(std::clamp(snap.speed_tenths, 0, MAX_SPEED_TENTHS));
+            default: return FIXED_FRAMES.at(idx);
         }
     }
 
-    void thread_fn() {
-        struct timespec last_activity_ts;
-        clock_gettime(CLOCK_MONOTONIC, &last_activity_ts);
-        int prev_speed = -1, prev_incline = -1;
+    // A fresh cycle grid from now, with the timing and values in force
+    void begin_run() {
+        run_timing_ = timing();
+        cycle_ns_ = static_cast<int64_t>(run_timing_.cycle_ms) * 1000000LL;
+        gap_ns_ = static_cast<int64_t>(run_timing_.burst_gap_ms) * 1000000LL;
+        min_gap_ns_ = static_cast<int64_t>(run_timing_.min_gap_ms) * 1000000LL;
+        reset_stats();
+        {
+            // Values in force at start go out with the first burst as usual
+            auto first = mode_.snapshot();
+            sent_speed_ = first.speed_tenths;
+            sent_incline_ = first.incline;
+        }
+        last_activity_ = now_ns();
+        prev_speed_ = prev_incline_ = -1;
+        cycle_deadline_ = now_ns();
+        prev_start_ = -1;
+        last_burst_ns_ = -1;
+        awaiting_.store(0, std::memory_order_relaxed);
+        cycle_ = 0;
+        burst_ = 0;
+        check_safety();
+    }
 
-        while (running_.load(std::memory_order_relaxed) && mode_.is_emulating()) {
-            // Reset 3-hour timer whenever speed or incline changes
-            auto snap_check = mode_.snapshot();
-            if (snap_check.speed_tenths != prev_speed || snap_check.incline != prev_incline) {
-                clock_gettime(CLOCK_MONOTONIC, &last_activity_ts);
-                prev_speed = snap_check.speed_tenths;
-                prev_incline = snap_check.incline;
-            }
+    void end_run() {
+        if (cycle_cb_) cycle_cb_();
+        running_.store(false, std::memory_order_relaxed);
+    }
 
-            // Safety timeout: reset speed/incline to 0 after 3 hours of no changes
-            struct timespec now;
-            clock_gettime(CLOCK_MONOTONIC, &now);
-            double elapsed = (now.tv_sec - last_activity_ts.tv_sec) +
-                             (now.tv_nsec - last_activity_ts.tv_nsec) / 1e9;
-
-            if (elapsed >= EMU_TIMEOUT_SEC) {
-                if (snap_check.speed_tenths != 0 || snap_check.incline != 0) {
-                    mode_.safety_timeout_reset();
-                    std::fprintf(stderr, "[emulate] 3-hour safety timeout — speed/incline reset to 0\n");
-                }
+    // At the top of each cycle: reset speed/incline to 0 after 3 hours
+    // with no change to either
+    void check_safety() {
+        auto snap = mode_.snapshot();
+        if (snap.speed_tenths != prev_speed_ || snap.incline != prev_incline_) {
+            last_activity_ = now_ns();
+            prev_speed_ = snap.speed_tenths;
+            prev_incline_ = snap.incline;
+        }
+        if (now_ns() - last_activity_ < EMU_TIMEOUT_SEC * 1000000000LL) return;
+        if (snap.speed_tenths != 0 || snap.incline != 0) {
+            mode_.safety_timeout_reset();
+            if constexpr (requires { writer_.write_priority(std::string_view{}); }) {
+                writer_.write_priority(HMPH_FRAMES.at(0).wire());
             }
+            std::fprintf(stderr, "[emulate] 3-hour safety timeout — speed/incline reset to 0\n");
+        }
+    }
 
-            StateSnapshot snap = mode_.snapshot();
+    // When burst_ is due: on the cycle grid, or paced, once the last
+    // burst is answered (or timed out)
+    int64_t next_due() const {
+        if (!run_timing_.paced || last_burst_ns_ < 0) return cycle_deadline_ + gap_ns_ * burst_;
+        if (awaiting_.load(std::memory_order_acquire) != 0) return last_burst_ns_ + gap_ns_;
+        return std::max(last_burst_ns_ + min_gap_ns_, replied_ns_.load(std::memory_order_acquire));
+    }
 
-            for (int burst = 0; burst < 5; burst++) {
-                if (!running_.load(std::memory_order_relaxed) || !mode_.is_emulating()) goto done;
+    // Inject any speed/incline change, then send the next burst if it's
+    // due. Returns when to look again: the next burst's deadline (paced
+    // and awaiting answers: the latest it may be, the answers wake us).
+    int64_t step() {
+        inject_changes(mode_.snapshot());
+        int64_t deadline = next_due();
+        if (now_ns() >= deadline) {
+            send_burst(deadline);
+            if (++burst_ == EMU_BURSTS) {
+                if (cycle_cb_) cycle_cb_();
+                // Next cycle on the fixed grid. If we fell more than a whole
+                // cycle behind (e.g. a long stall), restart the grid rather
+                // than firing catch-up cycles back to back.
+                cycle_deadline_ += cycle_ns_;
+                if (now_ns() - cycle_deadline_ > cycle_ns_) cycle_deadline_ = now_ns();
+                cycle_++;
+                burst_ = 0;
+                check_safety();
+            }
+            deadline = next_due();
+        }
+        return deadline;
+    }
 
-                for (int slot = 0; slot < 4; slot++) {
-                    int idx = BURSTS[burst][slot];
-                    if (idx < 0) break;
-                    if (!running_.load(std::memory_order_relaxed) || !mode_.is_emulating()) goto done;
+    void send_burst(int64_t deadline) {
+        const EmuRates& rates = run_timing_.rates;
+        bool sends_inc = emu_sends(rates, 0, burst_, cycle_);
+        bool sends_hmph = emu_sends(rates, 1, burst_, cycle_);
+        if (burst_cb_) {
+            burst_cb_(now_ns());
+            if (!sends_inc || !sends_hmph) inject_changes(mode_.snapshot());  // else this burst carries them
+        }
 
-                    std::string_view key(KV_CYCLE[idx].key);
-                    std::string value;
-                    if (KV_CYCLE[idx].has_value) {
-                        value = value_for(idx, snap);
-                    }
+        // Fresh per burst, so a scheduled inc/hmph never sends a
+        // value older than one already injected
+        StateSnapshot snap = mode_.snapshot();
 
-                    writer_.write_kv(key, value);
+        int64_t start = now_ns();
+        if (start - deadline > EMU_OVERRUN_US * 1000LL) record_overrun();
+        if (burst_ == 0) {
+            record_cycle(start, prev_start_);
+            prev_start_ = start;
+        }
+        if (sends_inc) sent_incline_ = snap.incline;
+        if (sends_hmph) sent_speed_ = snap.speed_tenths;
+        if (run_timing_.paced && awaiting_.exchange(0, std::memory_order_acq_rel) != 0) {
+            std::lock_guard<std::mutex> lk(stats_mu_);
+            timeouts_++;
+        }
 
-                    if (kv_cb_) {
-                        kv_cb_(key, value);
-                    }
-                }
-                sleep_ms(100);  // ~100ms gap between bursts
+        // Send the whole burst as one chained transmission:
+        // every-burst keys from other bursts first, then this
+        // burst's own keys that are due. Frames come from the
+        // compile-time tables: no allocation.
+        std::array<const KvWireFrame*, KV_CYCLE_SIZE> frames{};
+        std::array<std::string_view, KV_CYCLE_SIZE> wires;
+        size_t n = 0;
+        uint32_t replies = 0;
+        auto add = [&](int idx) {
+            frames.at(n) = &frame_for(idx, snap);
+            wires.at(n) = frames.at(n)->wire();
+            replies |= EMU_REPLY_BITS.at(static_cast<size_t>(idx));
+            n++;
+        };
+        for (int idx = 0; idx < static_cast<int>(KV_CYCLE_SIZE); idx++) {
+            if (rates.at(static_cast<size_t>(idx)) == EMU_EVERY_BURST && kv_cycle_burst(idx) != burst_) {
+                add(idx);
             }
         }
-    done:
-        running_.store(false, std::memory_order_relaxed);
+        for (int idx : BURSTS[burst_]) {
+            if (idx >= 0 && emu_sends(rates, idx, burst_, cycle_)) add(idx);
+        }
+        if (n == 0) return;
+        if (run_timing_.paced) {
+            // Before the write: no answer can come ahead of it
+            last_burst_ns_ = start;
+            replied_ns_.store(start, std::memory_order_relaxed);
+            awaiting_.store(replies, std::memory_order_release);
+        }
+
+        TraceSpan span("emu_burst");
+        writer_.write_burst(std::span<const std::string_view>(wires.data(), n));
+
+        if (kv_cb_) {
+            for (size_t i = 0; i < n; i++) kv_cb_(frames.at(i)->key(), frames.at(i)->value());
+        }
     }
 
-    SerialWriter<Port>& writer_;
+    // Between bursts, wait on the mode's change notification (a new speed
+    // or incline goes out at once; paced, the motor's last answer), waking
+    // at least every 100 ms to honour stop()
+    void thread_fn() {
+        trace_thread("emulate");
+        constexpr int64_t SLICE_NS = 100000000LL;
+        begin_run();
+        while (running_.load(std::memory_order_relaxed) && mode_.is_emulating()) {
+            uint32_t gen = mode_.wake_seq();  // before the step: no lost wakeups
+            int64_t due = step();
+            int64_t now = now_ns();
+            if (due > now) clock_.wait_change(mode_, gen, std::min(due, now + SLICE_NS));
+        }
+        end_run();
+    }
+
+    Writer& writer_;
     ModeStateMachine& mode_;
+    EmuTiming timing_;   // guarded by stats_mu_
+    Clock clock_;
     std::atomic<bool> running_{false};
     std::thread thread_;
+    bool external_ = false;
+    ThreadSched sched_{};
     KvEventCallback kv_cb_;
+    BurstHook burst_cb_;
+    CycleHook cycle_cb_;
+    int sent_speed_ = 0;     // last inc/hmph values written (emulate thread)
+    int sent_incline_ = 0;
+
+    // The run in progress (emulate thread): its timing, the cycle grid and
+    // the next burst, and the safety timeout's last change
+    EmuTiming run_timing_{};
+    int64_t cycle_ns_ = 0;
+    int64_t gap_ns_ = 0;
+    int64_t min_gap_ns_ = 0;
+    int64_t cycle_deadline_ = 0;
+    int64_t prev_start_ = -1;
+    int64_t last_burst_ns_ = -1;  // paced: the last burst sent
+    std::atomic<uint32_t> awaiting_{0};  // paced: answers to it still missing (kv_key_bit)
+    std::atomic<int64_t> replied_ns_{0};  // paced: when the last of them came
+    uint64_t cycle_ = 0;
+    int burst_ = 0;
+    int64_t last_activity_ = 0;
+    int prev_speed_ = -1;
+    int prev_incline_ = -1;
+
+    // Cycle statistics, written by the emulate thread
+    mutable std::mutex stats_mu_;
+    uint64_t cycles_ = 0;
+    uint64_t overruns_ = 0;
+    uint64_t injected_ = 0;
+    uint64_t timeouts_ = 0;
+    uint64_t periods_ = 0;   // cycle-to-cycle intervals recorded
+    int64_t sum_ns_ = 0;
+    int64_t max_ns_ = 0;
+    std::array<int64_t, EMU_STATS_WINDOW> window_{};
 };
@@ -0,0 +1,254 @@
+/*
+ * event_tap.cpp — EventTap shared-memory ring and EventTapReader
+ */
+
+#include "event_tap.h"
+#include "metrics.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace {
+
+constexpr std::array<char, 4> EVENT_TAP_MAGIC = { 'T', 'M', 'E', '1' };
+constexpr size_t EVENT_TAP_SIZE = EVENT_TAP_RING_OFFSET + sizeof(EventRing);
+static_assert(alignof(EventRing) <= EVENT_TAP_HEADER_SIZE);
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "the waiter count is shared between processes");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the waiter leases are shared between processes");
+
+// reinterpret_cast: atomic<uint32_t> -> uint32_t aliasing (standard-allowed)
+const uint32_t* futex_word(const std::atomic<uint32_t>& a) { return reinterpret_cast<const uint32_t*>(&a); }
+
+void futex_wake_all(const std::atomic<uint32_t>& a) {
+    syscall(SYS_futex, futex_word(a), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+uint64_t lease_end() { return mono_us() + static_cast<uint64_t>(EVENT_TAP_LEASE_MS) * 1000; }
+
+// A blocked reader's slot and its place in the count. Whoever takes a
+// lease to 0 (the reader, or the owner's reap) uncounts it, once
+class WaiterLease {
+public:
+    explicit WaiterLease(EventTapWaiters& w) : w_(w) { claim(); }
+    ~WaiterLease() {
+        if (slot_ && slot_->compare_exchange_strong(lease_, 0, std::memory_order_seq_cst)) {
+            w_.count.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+    WaiterLease(const WaiterLease&) = delete;
+    WaiterLease& operator=(const WaiterLease&) = delete;
+
+    bool held() const { return slot_ != nullptr; }
+
+    // Before each sleep: extend the lease, or claim again if it was reaped
+    void renew() {
+        uint64_t next = lease_end();
+        if (slot_ && slot_->compare_exchange_strong(lease_, next, std::memory_order_seq_cst)) {
+            lease_ = next;
+            return;
+        }
+        slot_ = nullptr;
+        claim();
+    }
+
+private:
+    // Counted before the caller loads the word: a commit either comes after
+    // the load (and sees us counted, so it wakes) or is already in the word
+    void claim() {
+        uint64_t next = lease_end();
+        for (auto& s : w_.lease_us) {
+            uint64_t none = 0;
+            if (s.compare_exchange_strong(none, next, std::memory_order_seq_cst)) {
+                slot_ = &s;
+                lease_ = next;
+                w_.count.fetch_add(1, std::memory_order_seq_cst);
+                return;
+            }
+        }
+    }
+
+    EventTapWaiters& w_;
+    std::atomic<uint64_t>* slot_ = nullptr;
+    uint64_t lease_ = 0;
+};
+
+}  // namespace
+
+EventTap::EventTap(const char* name, bool group) {
+    if (!name || !map(name, group)) {
+        heap_ = std::make_unique<EventRing>();
+        ring_ = heap_.get();
+    }
+}
+
+bool EventTap::map(const char* name, bool group) {
+    // A predecessor's object keeps its mapping; ours is a new one
+    shm_unlink(name);
+    mode_t mode = group ? 0660 : 0600;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode);
+    if (fd < 0) return false;
+    struct stat st{};
+    // fchmod: the umask must not take the group's bits away
+    if (fchmod(fd, mode) != 0 || ftruncate(fd, EVENT_TAP_SIZE) != 0 || fstat(fd, &st) != 0) {
+        ::close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    void* m = mmap(nullptr, EVENT_TAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        shm_unlink(name);
+        return false;
+    }
+    map_ = m;
+    dev_ = st.st_dev;
+    ino_ = st.st_ino;
+    std::strncpy(name_.data(), name, name_.size() - 1);
+
+    char* base = static_cast<char*>(m);
+    waiters_ = new (base + EVENT_TAP_WAITERS_OFFSET) EventTapWaiters{};
+    ring_ = new (base + EVENT_TAP_RING_OFFSET) EventRing();
+    ring_->enable_futex_wakeup(waiters_->count);
+
+    auto* h = new (base) EventTapHeader{};
+    constexpr auto l = EventRing::layout();
+    h->version = EVENT_TAP_VERSION;
+    h->pid = static_cast<uint32_t>(getpid());
+    h->ring_offset = EVENT_TAP_RING_OFFSET;
+    h->ring_size = sizeof(EventRing);
+    h->bytes = EventRing::bytes();
+    h->index = static_cast<uint64_t>(EventRing::size());
+    h->max_msg = static_cast<uint64_t>(EventRing::msg_size());
+    h->index_offset = l.index;
+    h->arena_offset = l.arena;
+    h->next_offset = l.next;
+    h->claimed_offset = l.claimed;
+    h->published_offset = l.published;
+    h->waiters_offset = EVENT_TAP_WAITERS_OFFSET;
+    h->waiter_slots = EVENT_TAP_WAITER_SLOTS;
+    // Magic last: a reader that sees it sees the rest
+    std::atomic_thread_fence(std::memory_order_release);
+    h->magic = EVENT_TAP_MAGIC;
+    return true;
+}
+
+int EventTap::reap_waiters(uint64_t now_us) {
+    if (!waiters_) return 0;
+    int reaped = 0;
+    for (auto& s : waiters_->lease_us) {
+        uint64_t lease = s.load(std::memory_order_relaxed);
+        if (lease == 0 || lease >= now_us) continue;
+        // Fails if the reader renewed or left meanwhile
+        if (s.compare_exchange_strong(lease, 0, std::memory_order_seq_cst)) {
+            waiters_->count.fetch_sub(1, std::memory_order_relaxed);
+            ++reaped;
+        }
+    }
+    return reaped;
+}
+
+EventTap::~EventTap() {
+    if (!map_) return;
+    auto* h = static_cast<EventTapHeader*>(map_);
+    std::atomic_ref<uint32_t>(h->closed).store(1, std::memory_order_release);
+    futex_wake_all(ring_->published());  // waiting readers see `closed`
+    ring_->~EventRing();
+
+    // Unlink only our own object, not a successor's under the same name
+    int fd = shm_open(name_.data(), O_RDONLY, 0);
+    if (fd >= 0) {
+        struct stat st{};
+        bool ours = fstat(fd, &st) == 0 && st.st_dev == dev_ && st.st_ino == ino_;
+        ::close(fd);
+        if (ours) shm_unlink(name_.data());
+    }
+    munmap(map_, EVENT_TAP_SIZE);
+}
+
+bool EventTapReader::open(const char* name) {
+    close();
+    // Read-write only for the waiter page; the rest is mapped read-only
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return false;
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < EVENT_TAP_SIZE) {
+        ::close(fd);
+        return false;
+    }
+    void* m = mmap(nullptr, EVENT_TAP_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    void* w = mmap(nullptr, EVENT_TAP_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                   EVENT_TAP_WAITERS_OFFSET);
+    ::close(fd);
+    if (m == MAP_FAILED || w == MAP_FAILED) {
+        if (m != MAP_FAILED) munmap(m, EVENT_TAP_SIZE);
+        if (w != MAP_FAILED) munmap(w, EVENT_TAP_HEADER_SIZE);
+        return false;
+    }
+    header_ = static_cast<const EventTapHeader*>(m);
+    // reinterpret_cast: mapped bytes -> the waiter page the writer constructed there
+    waiters_ = reinterpret_cast<EventTapWaiters*>(w);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    constexpr auto l = EventRing::layout();
+    if (header_->magic != EVENT_TAP_MAGIC || header_->version != EVENT_TAP_VERSION ||
+        header_->ring_offset != EVENT_TAP_RING_OFFSET || header_->ring_size != sizeof(EventRing) ||
+        header_->bytes != EventRing::bytes() || header_->index != static_cast<uint64_t>(EventRing::size()) ||
+        header_->published_offset != l.published || header_->waiters_offset != EVENT_TAP_WAITERS_OFFSET ||
+        header_->waiter_slots != EVENT_TAP_WAITER_SLOTS) {
+        close();
+        return false;
+    }
+    // reinterpret_cast: mapped bytes -> the EventRing the writer constructed there
+    ring_ = reinterpret_cast<const EventRing*>(static_cast<const char*>(m) + EVENT_TAP_RING_OFFSET);
+    return true;
+}
+
+void EventTapReader::close() {
+    if (header_) munmap(const_cast<EventTapHeader*>(header_), EVENT_TAP_SIZE);
+    if (waiters_) munmap(waiters_, EVENT_TAP_HEADER_SIZE);
+    header_ = nullptr;
+    ring_ = nullptr;
+    waiters_ = nullptr;
+}
+
+bool EventTapReader::closed() const {
+    if (!header_) return true;
+    // atomic_ref needs a non-const object; the load itself never writes
+    return std::atomic_ref<uint32_t>(const_cast<EventTapHeader*>(header_)->closed)
+               .load(std::memory_order_acquire) != 0;
+}
+
+bool EventTapReader::wait(uint64_t seq, int timeout_ms) const {
+    if (!header_) return false;
+    if (ring_->ready(seq)) return true;
+    uint64_t deadline_us = timeout_ms < 0 ? 0 : mono_us() + static_cast<uint64_t>(timeout_ms) * 1000;
+    WaiterLease lease(*waiters_);
+    while (true) {
+        lease.renew();
+        // Load the word first: a commit after the ready() check changes it,
+        // and FUTEX_WAIT then returns at once
+        uint32_t seen = ring_->published().load(std::memory_order_seq_cst);
+        if (ring_->ready(seq)) return true;
+        if (closed()) return false;
+
+        // Never past the lease: a slice at most, or a poll without a slot
+        uint64_t left = static_cast<uint64_t>(lease.held() ? EVENT_TAP_SLICE_MS : EVENT_TAP_POLL_MS) * 1000;
+        if (timeout_ms >= 0) {
+            uint64_t now = mono_us();
+            if (now >= deadline_us) return ring_->ready(seq);
+            left = std::min(left, deadline_us - now);
+        }
+        struct timespec ts{};
+        ts.tv_sec = static_cast<time_t>(left / 1000000);
+        ts.tv_nsec = static_cast<long>(left % 1000000) * 1000;
+        syscall(SYS_futex, futex_word(ring_->published()), FUTEX_WAIT, seen, &ts, nullptr, 0);
+    }
+}
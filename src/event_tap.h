@@ -0,0 +1,165 @@
+/*
+ * event_tap.h — The event ring in shared memory, for read-only tappers
+ *
+ * With gpio.json's "tap" section enabled, BusHost places its EventRing in
+ * a POSIX shared-memory object (/dev/shm/treadmill_io.events) instead of
+ * the heap. Any number of local processes can map it and tail every event
+ * the socket clients get (kv and status records, JSON text;
+ * ipc_protocol.h) with the same seqlock reads the IPC thread uses: no
+ * client slot, no socket write per message, nothing done on the daemon
+ * side per reader. Socket clients stay for control.
+ *
+ * The object is the daemon user's alone (mode 0600), or its group's too
+ * with "group": true (0660): a tap sees all bus traffic.
+ *
+ * Readers block on the ring's published() word with FUTEX_WAIT (shared,
+ * works on the read-only mapping of the ring). A blocked reader claims one
+ * of the lease slots on a page of its own that readers map writable, and
+ * counts itself in that page's `count`; a commit costs the producer one
+ * FUTEX_WAKE only while the count is non-zero, however many readers there
+ * are. A lease runs EVENT_TAP_LEASE_MS and the reader renews it every
+ * EVENT_TAP_SLICE_MS it sleeps. A reader killed while blocked cannot give
+ * its slot back, so the owner reaps expired leases (BusHost, every
+ * EVENT_TAP_REAP_MS) and the count heals; a live reader whose lease was
+ * reaped (stopped past it) claims again at its next slice. With every
+ * slot taken, readers poll every EVENT_TAP_POLL_MS uncounted.
+ *
+ * A restart (handoff.h) creates a fresh object under the same name while
+ * the predecessor still runs; the old one sets `closed` when it stops, so
+ * readers know to reopen. Only the owner of the name unlinks it.
+ *
+ * Layout (little-endian; readers in other languages use the offsets):
+ *
+ *   0  char[4] magic "TME1"     24 u64 ring_size (sizeof(EventRing))
+ *   4  u32     version (2)      32 u64 bytes (arena)
+ *   8  u32     writer pid       40 u64 index (entries)
+ *  12  u32     closed           48 u64 max_msg
+ *  16  u64     ring_offset      56 u64 index_offset ... 88 u64 published_offset
+ *                               96 u64 waiters_offset
+ *                              104 u64 waiter_slots
+ *
+ * waiters_offset is from the start of the object; the ring starts at
+ * ring_offset and the other offsets are relative to it
+ * (ByteRing::layout()). Entry i of the index is { u64 stamp, u64 loc }.
+ * The waiter page holds u32 count at 0 and waiter_slots u64 leases from
+ * 64, each a CLOCK_MONOTONIC expiry in microseconds (0: free).
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <sys/types.h>
+#include "byte_ring.h"
+
+constexpr const char* EVENT_TAP_NAME = "/treadmill_io.events";  // shm_open name
+constexpr uint32_t EVENT_TAP_VERSION = 2;
+constexpr size_t EVENT_TAP_HEADER_SIZE = 4096;   // then the waiter page
+constexpr size_t EVENT_TAP_WAITERS_OFFSET = EVENT_TAP_HEADER_SIZE;
+constexpr size_t EVENT_TAP_RING_OFFSET = 2 * EVENT_TAP_HEADER_SIZE;
+constexpr size_t EVENT_TAP_WAITER_SLOTS = 64;
+constexpr int EVENT_TAP_SLICE_MS = 1000;   // longest sleep between lease renewals
+constexpr int EVENT_TAP_LEASE_MS = 3000;
+constexpr int EVENT_TAP_REAP_MS = 1000;
+constexpr int EVENT_TAP_POLL_MS = 10;      // a reader without a slot
+static_assert(EVENT_TAP_LEASE_MS > 2 * EVENT_TAP_SLICE_MS);
+
+// The waiter page, shared writable with readers
+struct EventTapWaiters {
+    std::atomic<uint32_t> count;
+    alignas(64) std::array<std::atomic<uint64_t>, EVENT_TAP_WAITER_SLOTS> lease_us;
+};
+static_assert(offsetof(EventTapWaiters, lease_us) == 64);
+static_assert(sizeof(EventTapWaiters) <= EVENT_TAP_HEADER_SIZE);
+
+struct EventTapHeader {
+    std::array<char, 4> magic;
+    uint32_t version;
+    uint32_t pid;
+    uint32_t closed;
+    uint64_t ring_offset;
+    uint64_t ring_size;
+    uint64_t bytes;
+    uint64_t index;
+    uint64_t max_msg;
+    uint64_t index_offset;
+    uint64_t arena_offset;
+    uint64_t next_offset;
+    uint64_t claimed_offset;
+    uint64_t published_offset;
+    uint64_t waiters_offset;
+    uint64_t waiter_slots;
+};
+static_assert(offsetof(EventTapHeader, closed) == 12);
+static_assert(offsetof(EventTapHeader, ring_offset) == 16);
+static_assert(offsetof(EventTapHeader, index_offset) == 56);
+static_assert(offsetof(EventTapHeader, published_offset) == 88);
+static_assert(offsetof(EventTapHeader, waiters_offset) == 96);
+static_assert(offsetof(EventTapHeader, waiter_slots) == 104);
+static_assert(sizeof(EventTapHeader) <= EVENT_TAP_HEADER_SIZE);
+
+// Owner side: the ring itself, in shared memory when it can be
+class EventTap {
+public:
+    // A fresh shm object `name` holding the ring, readable and writable by
+    // the owner (and by its group if `group`); a heap ring if `name` is
+    // null or /dev/shm is unavailable (shared() is then false)
+    explicit EventTap(const char* name = EVENT_TAP_NAME, bool group = false);
+    // Marks the object closed, then unlinks it unless a successor owns the name
+    ~EventTap();
+    EventTap(const EventTap&) = delete;
+    EventTap& operator=(const EventTap&) = delete;
+
+    EventRing& ring() { return *ring_; }
+    bool shared() const { return map_ != nullptr; }
+    // Readers blocked in wait() right now, plus dead ones not yet reaped
+    uint32_t waiters() const { return waiters_ ? waiters_->count.load(std::memory_order_relaxed) : 0; }
+    // Frees the slots whose lease expired before `now_us` (mono_us());
+    // how many
+    int reap_waiters(uint64_t now_us);
+
+private:
+    bool map(const char* name, bool group);
+
+    void* map_ = nullptr;
+    EventRing* ring_ = nullptr;
+    EventTapWaiters* waiters_ = nullptr;
+    std::unique_ptr<EventRing> heap_;
+    std::array<char, 64> name_{};
+    dev_t dev_ = 0;
+    ino_t ino_ = 0;
+};
+
+// Read side: map a tap read-only and follow it
+class EventTapReader {
+public:
+    EventTapReader() = default;
+    ~EventTapReader() { close(); }
+    EventTapReader(const EventTapReader&) = delete;
+    EventTapReader& operator=(const EventTapReader&) = delete;
+
+    // False if there is no tap, it was written by an incompatible build,
+    // or this user may not open it for writing (the waiter page)
+    bool open(const char* name = EVENT_TAP_NAME);
+    void close();
+    bool is_open() const { return header_ != nullptr; }
+
+    // Valid while open
+    const EventRing& ring() const { return *ring_; }
+    uint32_t pid() const { return header_->pid; }
+
+    // The writer stopped (or was restarted under the same name): reopen
+    bool closed() const;
+
+    // Until message `seq` is ready (true), the writer closes, or
+    // `timeout_ms` passes (-1: no limit)
+    bool wait(uint64_t seq, int timeout_ms) const;
+
+private:
+    const EventTapHeader* header_ = nullptr;
+    const EventRing* ring_ = nullptr;
+    EventTapWaiters* waiters_ = nullptr;
+};
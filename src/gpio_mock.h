@@ -12,10 +12,15 @@
 #include <string_view>
 #include <vector>
 #include <deque>
+#include <map>
 #include <mutex>
 #include <algorithm>
 #include <string>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include "gpio_port.h"
+#include "wire_clock.h"
 
 // Pulse structure matching pigpio's gpioPulse_t
 #ifndef GPIO_MOCK_PULSE_DEFINED
@@ -47,8 +52,11 @@ struct MockGpioPort {
 
     // Legacy: inject data that any serial_read call can consume
     void inject_serial_data(std::span<const uint8_t> data) {
-        std::lock_guard<std::mutex> lk(inject_mu);
-        inject_data.emplace_back(data.begin(), data.end());
+        {
+            std::lock_guard<std::mutex> lk(inject_mu);
+            inject_data.emplace_back(data.begin(), data.end());
+        }
+        for (auto& e : edge_signals) e.signal();
     }
 
     void inject_serial_data(std::string_view str) {
@@ -59,9 +67,13 @@ struct MockGpioPort {
 
     // Per-pin: inject data only readable by serial_read(pin, ...)
     void inject_serial_data_pin(int pin, std::span<const uint8_t> data) {
-        std::lock_guard<std::mutex> lk(inject_mu);
-        if (pin >= 0 && pin < 64)
+        if (pin < 0 || pin >= 64) return;
+        {
+            std::lock_guard<std::mutex> lk(inject_mu);
             pin_inject_data[pin].emplace_back(data.begin(), data.end());
+        }
+        edge_times.at(pin).store(wire_now_ns(), std::memory_order_relaxed);
+        edge_signals.at(pin).signal();
     }
 
     void inject_serial_data_pin(int pin, std::string_view str) {
@@ -70,17 +82,52 @@ struct MockGpioPort {
             reinterpret_cast<const uint8_t*>(str.data()), str.size()));
     }
 
+    // --- Edge wakeups (optional GpioPort capability) ---
+    // Every inject counts as an edge on the pin(s) it can be read from;
+    // a per-pin inject also dates the pin's last edge (last_edge_ns()).
+    // Set edge_alerts = false to exercise the polling fallback.
+    bool edge_alerts = true;
+    std::array<EdgeSignal, 64> edge_signals;
+    std::array<std::atomic<int64_t>, 64> edge_times{};
+
     // --- Wave write recording ---
+    // Created waves are kept by id (like pigpio's DMA wave table) so
+    // cached waves can be re-sent and chained. One WaveRecord per
+    // wave_tx_send() or wave_chain() call.
     std::mutex wave_mu;
     struct WaveRecord {
         int gpio;
         std::vector<uint8_t> bytes;  // decoded from pulses
     };
+    struct StoredWave {
+        int gpio;
+        std::vector<gpioPulse_t> pulses;
+    };
     std::vector<WaveRecord> wave_writes;
     std::vector<gpioPulse_t> pending_pulses;
-    int next_wave_id = 0;
+    std::map<int, StoredWave> waves;
+    int max_waves = 250;      // lower to simulate DMA resource exhaustion
+    int waves_created = 0;
+    int chain_sends = 0;
     int last_wave_gpio = -1;
 
+    // Set tx_timing = true to make wave_tx_busy() report a transmission
+    // in progress for the waves' pulse time after each send (default:
+    // sends complete instantly). tx_busy_calls counts the polls.
+    bool tx_timing = false;
+    std::atomic<uint64_t> tx_end_us{0};
+    std::atomic<int> tx_busy_calls{0};
+
+    // --- Edge log (optional GpioPort capability) ---
+    // Waves sent on loopback_write come back on every open edge log as the
+    // level changes they'd make on a wire, at their pulse times (wire_now_ns()
+    // at the send, plus the delays), each off by up to +-loopback_jitter_ns.
+    // A wave on a pin in `wires` reaches the input it's wired to instead:
+    // its edges on that pin's log, its bytes as serial data to read there.
+    int loopback_write = -1;
+    int64_t loopback_jitter_ns = 0;
+    std::map<int, int> wires;  // output pin -> input pin
+
     // --- GpioPort interface ---
     int initialise() { initialised = true; return 0; }
     void terminate() { initialised = false; }
@@ -106,7 +153,8 @@ struct MockGpioPort {
         if (pin >= 0 && pin < 64) pins[pin].serial_invert = invert;
     }
 
-    // serial_read: pigpio C API boundary — takes void*, returns data
+    // serial_read: pigpio C API boundary — takes void*, returns data.
+    // Like pigpio, bytes beyond bufsize stay queued for the next read.
     int serial_read(int pin, void* buf, int bufsize) {
         std::lock_guard<std::mutex> lk(inject_mu);
         auto* dst = static_cast<uint8_t*>(buf);
@@ -116,7 +164,7 @@ struct MockGpioPort {
             int n = static_cast<int>(front.size());
             if (n > bufsize) n = bufsize;
             std::copy_n(front.data(), n, dst);
-            pin_inject_data[pin].pop_front();
+            consume_front(pin_inject_data[pin], n);
             return n;
         }
         // Fall back to legacy any-pin queue
@@ -125,7 +173,7 @@ struct MockGpioPort {
         int n = static_cast<int>(front.size());
         if (n > bufsize) n = bufsize;
         std::copy_n(front.data(), n, dst);
-        inject_data.pop_front();
+        consume_front(inject_data, n);
         return n;
     }
 
@@ -133,8 +181,31 @@ struct MockGpioPort {
         if (pin >= 0 && pin < 64) pins[pin].serial_open = false;
     }
 
-    int wave_tx_busy() { return 0; }
-    void wave_clear() { pending_pulses.clear(); }
+    int wait_edge(int pin, int timeout_ms) {
+        if (!edge_alerts || pin < 0 || pin >= 64) return -1;
+        return edge_signals.at(pin).wait(timeout_ms);
+    }
+
+    void wake_edge(int pin) {
+        if (pin >= 0 && pin < 64) edge_signals.at(pin).wake();
+    }
+
+    int64_t last_edge_ns(int pin) {
+        if (!edge_alerts || pin < 0 || pin >= 64) return 0;
+        return edge_times.at(pin).load(std::memory_order_relaxed);
+    }
+
+    int wave_tx_busy() {
+        tx_busy_calls.fetch_add(1, std::memory_order_relaxed);
+        return tx_timing && now_us() < tx_end_us.load(std::memory_order_relaxed) ? 1 : 0;
+    }
+
+    void wave_clear() {
+        pending_pulses.clear();
+        waves.clear();
+    }
+
+    void wave_add_new() { pending_pulses.clear(); }
 
     void wave_add_generic(int num_pulses, gpioPulse_t* pulses) {
         for (int i = 0; i < num_pulses; i++) {
@@ -153,34 +224,157 @@ struct MockGpioPort {
         }
     }
 
-    int wave_create() { return next_wave_id++; }
+    // Lowest free id, as pigpio allocates them
+    int wave_create() {
+        if (static_cast<int>(waves.size()) >= max_waves) return -1;
+        int wid = 0;
+        while (waves.count(wid)) wid++;
+        waves[wid] = StoredWave{ last_wave_gpio, std::move(pending_pulses) };
+        pending_pulses.clear();
+        waves_created++;
+        return wid;
+    }
+
+    void wave_tx_send(int wid, int /*mode*/) {
+        auto it = waves.find(wid);
+        if (it == waves.end() || it->second.pulses.empty()) return;
+        int64_t t = wire_now_ns();
+        loop_back(it->second, t);
+        WaveRecord rec{ it->second.gpio, {} };
+        decode_pulses(it->second.pulses, rec.bytes);
+        deliver(rec.gpio, rec.bytes);
+        start_tx(pulse_time_us(it->second.pulses));
+
+        std::lock_guard<std::mutex> lk(wave_mu);
+        wave_writes.push_back(std::move(rec));
+    }
+
+    int wave_chain(char* buf, int len) {
+        WaveRecord rec{ -1, {} };
+        uint64_t us = 0;
+        for (int i = 0; i < len; i++) {
+            if (waves.find(static_cast<uint8_t>(buf[i])) == waves.end()) return -1;  // pigpio: PI_BAD_CHAIN_CMD
+        }
+        int64_t t = wire_now_ns();
+        for (int i = 0; i < len; i++) {
+            auto it = waves.find(static_cast<uint8_t>(buf[i]));
+            loop_back(it->second, t);
+            rec.gpio = it->second.gpio;
+            decode_pulses(it->second.pulses, rec.bytes);
+            us += pulse_time_us(it->second.pulses);
+        }
+        deliver(rec.gpio, rec.bytes);
+        start_tx(us);
+
+        std::lock_guard<std::mutex> lk(wave_mu);
+        wave_writes.push_back(std::move(rec));
+        chain_sends++;
+        return 0;
+    }
 
-    void wave_tx_send(int /*wid*/, int /*mode*/) {
-        // Decode inverted RS-485 pulses back to bytes
-        if (pending_pulses.empty()) return;
-        WaveRecord rec;
-        rec.gpio = last_wave_gpio;
+    void wave_delete(int wid) { waves.erase(wid); }
 
+    bool edge_log_open(int pin) {
+        std::lock_guard<std::mutex> lk(log_mu_);
+        if (pin < 0 || pin >= 64 || logs_.count(pin) || logs_.size() >= PORT_EDGE_LOGS) return false;
+        logs_[pin].clear();
+        return true;
+    }
+
+    int edge_log_read(int pin, std::span<PortEdge> out) {
+        std::lock_guard<std::mutex> lk(log_mu_);
+        auto it = logs_.find(pin);
+        if (it == logs_.end()) return 0;
+        auto& log = it->second;
+        size_t n = std::min(out.size(), log.size());
+        std::copy_n(log.begin(), n, out.begin());
+        log.erase(log.begin(), log.begin() + static_cast<std::ptrdiff_t>(n));
+        return static_cast<int>(n);
+    }
+
+    void edge_log_close(int pin) {
+        std::lock_guard<std::mutex> lk(log_mu_);
+        logs_.erase(pin);
+    }
+
+    // Drop the first n bytes of a queued inject, popping it once empty
+    static void consume_front(std::deque<std::vector<uint8_t>>& q, int n) {
+        auto& front = q.front();
+        if (static_cast<size_t>(n) >= front.size()) {
+            q.pop_front();
+        } else {
+            front.erase(front.begin(), front.begin() + n);
+        }
+    }
+
+    static uint64_t now_us() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    static uint64_t pulse_time_us(const std::vector<gpioPulse_t>& pulses) {
+        uint64_t us = 0;
+        for (const auto& p : pulses) us += p.usDelay;
+        return us;
+    }
+
+    // Log a looped-back or wired wave's level changes starting at `t_ns`;
+    // advances it to the wave's end
+    void loop_back(const StoredWave& w, int64_t& t_ns) {
+        auto wired = wires.find(w.gpio);
+        bool loop = w.gpio == loopback_write && loopback_write >= 0;
+        if (!loop && wired == wires.end()) return;
+        std::lock_guard<std::mutex> lk(log_mu_);
+        int& line = line_level_[w.gpio];  // idle LOW, as the inverted line rests
+        for (const auto& p : w.pulses) {
+            int level = p.gpioOn ? 1 : p.gpioOff ? 0 : line;
+            if (level != line) {
+                PortEdge e{ t_ns + jitter_ns(), level };
+                if (loop) {
+                    for (auto& [pin, log] : logs_) log.push_back(e);
+                } else if (auto log = logs_.find(wired->second); log != logs_.end()) {
+                    log->second.push_back(e);
+                }
+            }
+            line = level;
+            t_ns += static_cast<int64_t>(p.usDelay) * 1000;
+        }
+    }
+
+    // A wired wave's bytes, to be read on the input it's wired to
+    void deliver(int gpio, const std::vector<uint8_t>& bytes) {
+        auto wired = wires.find(gpio);
+        if (wired != wires.end() && !bytes.empty()) inject_serial_data_pin(wired->second, bytes);
+    }
+
+    int64_t jitter_ns() {
+        if (loopback_jitter_ns <= 0) return 0;
+        jitter_state_ = jitter_state_ * 6364136223846793005ull + 1442695040888963407ull;  // LCG
+        return static_cast<int64_t>((jitter_state_ >> 33) % static_cast<uint64_t>(2 * loopback_jitter_ns + 1)) -
+               loopback_jitter_ns;
+    }
+
+    void start_tx(uint64_t us) {
+        if (tx_timing) tx_end_us.store(now_us() + us, std::memory_order_relaxed);
+    }
+
+    // Decode inverted RS-485 pulses back to bytes
+    static void decode_pulses(const std::vector<gpioPulse_t>& pulses, std::vector<uint8_t>& out) {
         // 10 pulses per byte: start + 8 data + stop
-        int npulses = static_cast<int>(pending_pulses.size());
+        int npulses = static_cast<int>(pulses.size());
         for (int i = 0; i + 9 < npulses; i += 10) {
             // Skip start bit (pulse i), decode 8 data bits (i+1..i+8)
             uint8_t byte_val = 0;
             for (int bit = 0; bit < 8; bit++) {
-                auto& p = pending_pulses.at(static_cast<size_t>(i + 1 + bit));
+                auto& p = pulses.at(static_cast<size_t>(i + 1 + bit));
                 // Inverted: gpioOff means "1" (LOW = 1)
                 if (p.gpioOff) byte_val |= (1u << bit);
             }
-            rec.bytes.push_back(byte_val);
+            out.push_back(byte_val);
             // pulse i+9 is stop bit
         }
-
-        std::lock_guard<std::mutex> lk(wave_mu);
-        wave_writes.push_back(std::move(rec));
     }
 
-    void wave_delete(int /*wid*/) {}
-
     // --- Test helpers ---
     std::vector<uint8_t> get_all_written_bytes() {
         std::lock_guard<std::mutex> lk(wave_mu);
@@ -196,8 +390,19 @@ struct MockGpioPort {
         return std::string(bytes.begin(), bytes.end());
     }
 
+    size_t wave_write_count() {
+        std::lock_guard<std::mutex> lk(wave_mu);
+        return wave_writes.size();
+    }
+
     void clear_writes() {
         std::lock_guard<std::mutex> lk(wave_mu);
         wave_writes.clear();
     }
+
+private:
+    std::mutex log_mu_;
+    std::map<int, std::deque<PortEdge>> logs_;  // open edge logs by pin
+    std::map<int, int> line_level_;             // looped-back and wired lines
+    uint64_t jitter_state_ = 1;
 };
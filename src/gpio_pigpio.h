@@ -3,15 +3,38 @@
  *
  * Zero overhead — every method is a direct call to the pigpio C API.
  * Only included in the production binary (links libpigpio).
+ *
+ * Edge wakeups: serial_read_open() also registers a pigpio alert on the
+ * pin (alerts coexist with bit-bang serial reads), so wait_edge() lets
+ * the reader sleep until a start bit arrives instead of polling. The
+ * alert's tick also dates the pin's latest edge: last_edge_ns() turns
+ * it into wire time by its age on pigpio's microsecond tick, so read
+ * batches are stamped with when the bytes arrived, not when they were
+ * read.
+ *
+ * Edge logs (tx_selftest.h, proxy_selftest.h): edge_log_open() puts an
+ * alert on an input and keeps each edge's tick, up to PORT_EDGE_LOGS
+ * pins on one time base. pigpio samples GPIOs every sample_us (5 us by
+ * default; gpioCfgClock), which bounds the timing resolution.
  */
 
 #pragma once
 
 #include <pigpio.h>
+#include <array>
+#include <atomic>
+#include <span>
 #include "gpio_port.h"
+#include "wire_clock.h"
 
 struct PigpioPort {
-    int initialise() { return gpioInitialise() < 0 ? -1 : 0; }
+    // The sample period ("standby"."sample_us"): fixed once pigpio starts
+    int sample_us = 5;
+
+    int initialise() {
+        if (gpioCfgClock(static_cast<unsigned>(sample_us), PI_CLOCK_PCM, 0) < 0) return -1;
+        return gpioInitialise() < 0 ? -1 : 0;
+    }
     void terminate() { gpioTerminate(); }
 
     void set_mode(int pin, int mode) {
@@ -21,7 +44,11 @@ struct PigpioPort {
     void write(int pin, int level) { gpioWrite(pin, level); }
 
     int serial_read_open(int pin, int baud, int bits) {
-        return gpioSerialReadOpen(pin, baud, bits);
+        int rc = gpioSerialReadOpen(pin, baud, bits);
+        if (rc >= 0 && valid_pin(pin)) {
+            alerts_.at(pin) = gpioSetAlertFuncEx(pin, &PigpioPort::on_alert, this) == 0;
+        }
+        return rc;
     }
 
     void serial_read_invert(int pin, int invert) {
@@ -33,11 +60,31 @@ struct PigpioPort {
     }
 
     void serial_read_close(int pin) {
+        if (valid_pin(pin) && alerts_.at(pin)) {
+            gpioSetAlertFuncEx(pin, nullptr, nullptr);
+            alerts_.at(pin) = false;
+        }
         gpioSerialReadClose(pin);
     }
 
+    int wait_edge(int pin, int timeout_ms) {
+        if (!valid_pin(pin) || !alerts_.at(pin)) return -1;
+        return edges_.at(pin).wait(timeout_ms);
+    }
+
+    void wake_edge(int pin) {
+        if (valid_pin(pin)) edges_.at(pin).wake();
+    }
+
+    int64_t last_edge_ns(int pin) {
+        if (!valid_pin(pin) || !alerts_.at(pin) || !edge_seen_.at(pin).load(std::memory_order_acquire)) return 0;
+        uint32_t age_us = gpioTick() - edge_tick_.at(pin).load(std::memory_order_relaxed);  // wraps every 72 min
+        return wire_now_ns() - static_cast<int64_t>(age_us) * 1000;
+    }
+
     int wave_tx_busy() { return gpioWaveTxBusy(); }
     void wave_clear() { gpioWaveClear(); }
+    void wave_add_new() { gpioWaveAddNew(); }
 
     void wave_add_generic(int num_pulses, gpioPulse_t* pulses) {
         gpioWaveAddGeneric(num_pulses, pulses);
@@ -50,5 +97,101 @@ struct PigpioPort {
                             ? PI_WAVE_MODE_ONE_SHOT : PI_WAVE_MODE_ONE_SHOT);
     }
 
+    int wave_chain(char* buf, int len) {
+        return gpioWaveChain(buf, static_cast<unsigned>(len));
+    }
+
     void wave_delete(int wid) { gpioWaveDelete(wid); }
+
+    bool edge_log_open(int pin) {
+        if (!valid_pin(pin) || find_log(pin)) return false;
+        EdgeLog* log = find_log(-1);
+        if (!log) return false;
+        gpioSetMode(pin, PI_INPUT);
+        log->head.store(0, std::memory_order_relaxed);
+        log->tail = 0;
+        if (!find_open_log()) log_ticks_ = -1;  // the first open log starts the time base
+        log->pin.store(pin, std::memory_order_release);
+        if (gpioSetAlertFuncEx(pin, &PigpioPort::on_alert, this) != 0) {
+            log->pin.store(-1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    int edge_log_read(int pin, std::span<PortEdge> out) {
+        EdgeLog* log = valid_pin(pin) ? find_log(pin) : nullptr;
+        if (!log) return 0;
+        uint64_t head = log->head.load(std::memory_order_acquire);
+        if (head - log->tail > EDGE_LOG_SIZE) log->tail = head - EDGE_LOG_SIZE;  // overrun: oldest lost
+        size_t n = 0;
+        while (log->tail < head && n < out.size()) out[n++] = log->edges.at(log->tail++ % EDGE_LOG_SIZE);
+        return static_cast<int>(n);
+    }
+
+    void edge_log_close(int pin) {
+        EdgeLog* log = valid_pin(pin) ? find_log(pin) : nullptr;
+        if (!log) return;
+        if (!alerts_.at(pin)) gpioSetAlertFuncEx(pin, nullptr, nullptr);
+        log->pin.store(-1, std::memory_order_release);
+    }
+
+private:
+    static constexpr int NUM_GPIO = 32;  // user-accessible BCM gpios
+
+    static bool valid_pin(int pin) { return pin >= 0 && pin < NUM_GPIO; }
+
+    // pigpio alert thread: level 0/1 = edge, 2 = watchdog timeout
+    static void on_alert(int gpio, int level, uint32_t tick, void* self) {
+        if (level == 2 || !valid_pin(gpio)) return;
+        auto* port = static_cast<PigpioPort*>(self);
+        port->log_edge(gpio, level, tick);
+        port->edge_tick_.at(gpio).store(tick, std::memory_order_relaxed);
+        port->edge_seen_.at(gpio).store(true, std::memory_order_release);
+        port->edges_.at(gpio).signal();
+    }
+
+    static constexpr size_t EDGE_LOG_SIZE = 8192;
+
+    struct EdgeLog {
+        std::atomic<int> pin{-1};
+        std::array<PortEdge, EDGE_LOG_SIZE> edges{};
+        std::atomic<uint64_t> head{0};
+        uint64_t tail = 0;  // reader
+    };
+
+    EdgeLog* find_log(int pin) {
+        for (auto& log : logs_) {
+            if (log.pin.load(std::memory_order_acquire) == pin) return &log;
+        }
+        return nullptr;
+    }
+
+    bool find_open_log() const {
+        for (const auto& log : logs_) {
+            if (log.pin.load(std::memory_order_relaxed) >= 0) return true;
+        }
+        return false;
+    }
+
+    // Alert thread only. Ticks wrap every 72 min; counting deltas keeps
+    // the logs' shared time base monotonic.
+    void log_edge(int gpio, int level, uint32_t tick) {
+        EdgeLog* log = find_log(gpio);
+        if (!log) return;
+        log_ticks_ = log_ticks_ < 0 ? 0 : log_ticks_ + (tick - log_last_tick_);
+        log_last_tick_ = tick;
+        uint64_t head = log->head.load(std::memory_order_relaxed);
+        log->edges.at(head % EDGE_LOG_SIZE) = { log_ticks_ * 1000, level };
+        log->head.store(head + 1, std::memory_order_release);
+    }
+
+    std::array<EdgeSignal, NUM_GPIO> edges_;
+    std::array<std::atomic<uint32_t>, NUM_GPIO> edge_tick_{};
+    std::array<std::atomic<bool>, NUM_GPIO> edge_seen_{};
+    std::array<bool, NUM_GPIO> alerts_{};
+
+    std::array<EdgeLog, PORT_EDGE_LOGS> logs_{};
+    int64_t log_ticks_ = -1;      // alert thread: microseconds since the first logged edge
+    uint32_t log_last_tick_ = 0;
 };
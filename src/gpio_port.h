@@ -16,12 +16,42 @@
  *   int  serial_read(int pin, void* buf, int bufsize);
  *   void serial_read_close(int pin);
  *   int  wave_tx_busy();
- *   void wave_clear();
+ *   void wave_clear();                    // delete ALL waves + pending pulses
+ *   void wave_add_new();                  // discard pending pulses only
  *   void wave_add_generic(int num_pulses, gpioPulse_t* pulses);
  *   int  wave_create();
  *   void wave_tx_send(int wid, int mode);
+ *   int  wave_chain(char* buf, int len);  // send waves back to back: one
+ *                                         // wave id per byte (ids < 250)
  *   void wave_delete(int wid);
  *
+ * Optional capability — edge wakeups (detected with PortHasEdgeWait):
+ *
+ *   int  wait_edge(int pin, int timeout_ms);  // 1 = edge since last call,
+ *                                             // 0 = timeout or wake_edge(),
+ *                                             // -1 = not available on pin
+ *   void wake_edge(int pin);                  // unblock a wait_edge() now
+ *
+ * Ports without it are polled by SerialReader with an adaptive sleep.
+ *
+ * Optional capability — edge times (detected with PortHasEdgeTime):
+ *
+ *   int64_t last_edge_ns(int pin);  // wire_now_ns() time of the pin's
+ *                                   // latest edge, 0 = none/unknown
+ *
+ * SerialReader stamps a read with it; without it, with the read time.
+ *
+ * Optional capability — edge logs (detected with PortHasEdgeLog):
+ *
+ *   bool edge_log_open(int pin);   // record every edge on an input pin
+ *   int  edge_log_read(int pin, std::span<PortEdge> out);  // drain, oldest
+ *                                  // first; returns the count
+ *   void edge_log_close(int pin);
+ *
+ * For the self-tests (tx_selftest.h, proxy_selftest.h), which read our
+ * own output back on spare GPIOs. Up to PORT_EDGE_LOGS pins at once, all
+ * on one time base.
+ *
  * gpioPulse_t struct (from pigpio.h or defined by mock):
  *   uint32_t gpioOn;
  *   uint32_t gpioOff;
@@ -30,9 +60,78 @@
 
 #pragma once
 
+#include <cstdint>
+#include <concepts>
+#include <span>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
 // Mode constants (match pigpio)
 constexpr int PORT_INPUT  = 0;
 constexpr int PORT_OUTPUT = 1;
 
 // Wave mode constants
 constexpr int PORT_WAVE_MODE_ONE_SHOT = 0;
+
+// Largest wave id usable in a wave_chain() buffer (250+ are chain commands)
+constexpr int PORT_WAVE_CHAIN_MAX_ID = 249;
+
+template <typename Port>
+concept PortHasEdgeWait = requires(Port& p, int pin, int timeout_ms) {
+    { p.wait_edge(pin, timeout_ms) } -> std::same_as<int>;
+    p.wake_edge(pin);
+};
+
+template <typename Port>
+concept PortHasEdgeTime = requires(Port& p, int pin) {
+    { p.last_edge_ns(pin) } -> std::same_as<int64_t>;
+};
+
+constexpr int PORT_EDGE_LOGS = 2;  // edge logs open at once
+
+// One logged edge: when (wire_now_ns() clock, or the port's own
+// monotonic time base) and the level it went to
+struct PortEdge {
+    int64_t t_ns;
+    int level;
+};
+
+template <typename Port>
+concept PortHasEdgeLog = requires(Port& p, int pin, std::span<PortEdge> out) {
+    { p.edge_log_open(pin) } -> std::same_as<bool>;
+    { p.edge_log_read(pin, out) } -> std::same_as<int>;
+    p.edge_log_close(pin);
+};
+
+// Edge counter + condition variable backing wait_edge()/wake_edge().
+// signal() is called from the edge source (pigpio alert thread, mock
+// inject); wait() from the single reader thread for that pin.
+struct EdgeSignal {
+    void signal() {
+        { std::lock_guard<std::mutex> lk(mu_); edges_++; }
+        cv_.notify_all();
+    }
+
+    void wake() {
+        { std::lock_guard<std::mutex> lk(mu_); woken_ = true; }
+        cv_.notify_all();
+    }
+
+    int wait(int timeout_ms) {
+        std::unique_lock<std::mutex> lk(mu_);
+        cv_.wait_for(lk, std::chrono::milliseconds(timeout_ms),
+                     [this] { return edges_ != seen_ || woken_; });
+        bool edge = edges_ != seen_;
+        seen_ = edges_;
+        woken_ = false;
+        return edge ? 1 : 0;
+    }
+
+private:
+    std::mutex mu_;
+    std::condition_variable cv_;
+    uint64_t edges_ = 0;
+    uint64_t seen_ = 0;
+    bool woken_ = false;
+};
@@ -0,0 +1,176 @@
+/*
+ * gpio_replay.h — ReplayPort: plays recorded bus traffic into serial_read()
+ *
+ * A MockGpioPort whose serial reads come from timestamped byte logs
+ * instead of inject calls. Each log is bound to a read pin; a byte
+ * becomes readable once the replay clock passes its timestamp. The
+ * clock runs `speed` times faster than real time (1 = original timing,
+ * 100 = a 25 s capture in 0.25 s). wait_edge() sleeps until the next
+ * byte is due, so readers see the original inter-frame gaps, scaled.
+ *
+ * Wave writes are recorded by MockGpioPort as usual, for comparing the
+ * controller's output against the recording.
+ *
+ * load_capture_channel() turns a logic-analyzer CSV from captures/
+ * (inverted RS-485, 9600 8N1) into a byte log, decoding the same way
+ * as captures/decode_inverted.py (capture_decode.h). load_byte_log()
+ * reads the byte logs the capture_decode tool writes.
+ *
+ * Test/bench only: STL containers and file I/O.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include "capture_decode.h"
+#include "gpio_mock.h"
+
+struct TimedByte {
+    double t;      // seconds since the start of the recording
+    uint8_t byte;
+};
+
+using ByteLog = std::vector<TimedByte>;
+
+// Decode one channel of a capture CSV. Empty if the file can't be read.
+inline ByteLog load_capture_channel(const char* path, int channel, int baud = 9600) {
+    ByteLog log;
+    MappedFile csv;
+    if (channel < 0 || channel >= CAPTURE_CHANNELS || !csv.open(path)) return log;
+    decode_capture(csv.view(), static_cast<uint8_t>(1u << channel), baud, [&](int, int64_t t_ns, uint8_t b) {
+        log.push_back({ static_cast<double>(t_ns) / CAPTURE_NS_PER_SEC, b });
+    });
+    return log;
+}
+
+// One channel of a byte log written by capture_decode --log. Empty if the
+// file can't be read or isn't a byte log.
+inline ByteLog load_byte_log(const char* path, int channel) {
+    ByteLog log;
+    MappedFile file;
+    if (!file.open(path)) return log;
+    auto data = file.view();
+    if (!data.starts_with(CAPTURE_LOG_MAGIC)) return log;
+    // reinterpret_cast: char -> uint8_t aliasing (standard-allowed)
+    std::span<const uint8_t> recs(reinterpret_cast<const uint8_t*>(data.data()) + CAPTURE_LOG_MAGIC.size(),
+                                  data.size() - CAPTURE_LOG_MAGIC.size());
+    for (size_t i = 0; i + CAPTURE_LOG_RECORD_SIZE <= recs.size(); i += CAPTURE_LOG_RECORD_SIZE) {
+        auto rec = recs.subspan(i).first<CAPTURE_LOG_RECORD_SIZE>();
+        if (rec[8] != channel) continue;
+        log.push_back({ static_cast<double>(capture_log_time(rec)) / CAPTURE_NS_PER_SEC, rec[9] });
+    }
+    return log;
+}
+
+inline std::string log_bytes(const ByteLog& log) {
+    std::string out;
+    out.reserve(log.size());
+    for (const auto& b : log) out.push_back(static_cast<char>(b.byte));
+    return out;
+}
+
+struct ReplayPort : MockGpioPort {
+    explicit ReplayPort(double speed = 1.0) : speed_(speed > 0 ? speed : 1.0) {}
+
+    // Bind a log to a read pin. Call before start_replay().
+    void add_stream(int pin, ByteLog log) {
+        if (pin < 0 || pin >= 64) return;
+        double offset = log.empty() ? 0.0 : log.front().t;
+        for (auto& b : log) b.t -= offset;  // first byte is due at once
+        streams_.at(pin) = std::make_unique<Stream>();
+        streams_.at(pin)->log = std::move(log);
+    }
+
+    // Start the replay clock. Until then replayed pins read nothing.
+    void start_replay() {
+        t0_ = std::chrono::steady_clock::now();
+        started_.store(true, std::memory_order_release);
+    }
+
+    // Every bound log has been read to the end
+    bool replay_done() const {
+        for (const auto& s : streams_) {
+            if (s && s->next.load(std::memory_order_acquire) < s->log.size()) return false;
+        }
+        return true;
+    }
+
+    // Recording length at replay speed, in seconds
+    double replay_duration() const {
+        double end = 0;
+        for (const auto& s : streams_) {
+            if (s && !s->log.empty()) end = std::max(end, s->log.back().t);
+        }
+        return end / speed_;
+    }
+
+    // --- GpioPort interface (replayed pins; others fall back to the mock) ---
+
+    int serial_read(int pin, void* buf, int bufsize) {
+        Stream* s = stream(pin);
+        if (!s) return MockGpioPort::serial_read(pin, buf, bufsize);
+
+        double now = replay_now();
+        auto* dst = static_cast<uint8_t*>(buf);
+        size_t i = s->next.load(std::memory_order_relaxed);
+        int n = 0;
+        while (n < bufsize && i < s->log.size() && s->log.at(i).t <= now) {
+            dst[n++] = s->log.at(i++).byte;
+        }
+        s->next.store(i, std::memory_order_release);
+        return n;
+    }
+
+    // Sleep until the pin's next byte is due (or timeout / wake_edge())
+    int wait_edge(int pin, int timeout_ms) {
+        Stream* s = stream(pin);
+        if (!s) return MockGpioPort::wait_edge(pin, timeout_ms);
+
+        int wait_ms = timeout_ms;
+        size_t i = s->next.load(std::memory_order_relaxed);
+        if (started_.load(std::memory_order_acquire) && i < s->log.size()) {
+            double due_ms = (s->log.at(i).t - replay_now()) / speed_ * 1000.0;
+            if (due_ms <= 0) return 1;
+            wait_ms = std::min(timeout_ms, static_cast<int>(due_ms) + 1);
+        }
+        edge_signals.at(pin).wait(wait_ms);  // returns early on wake_edge()
+        return byte_due(*s) ? 1 : 0;
+    }
+
+private:
+    struct Stream {
+        ByteLog log;
+        std::atomic<size_t> next{0};  // next unread byte (reader thread advances it)
+    };
+
+    Stream* stream(int pin) const {
+        return pin >= 0 && pin < 64 ? streams_.at(pin).get() : nullptr;
+    }
+
+    // Replay clock in recording seconds; negative before start_replay()
+    double replay_now() const {
+        if (!started_.load(std::memory_order_acquire)) return -1.0;
+        std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0_;
+        return dt.count() * speed_;
+    }
+
+    bool byte_due(const Stream& s) const {
+        size_t i = s.next.load(std::memory_order_relaxed);
+        return i < s.log.size() && s.log.at(i).t <= replay_now();
+    }
+
+    double speed_;
+    std::array<std::unique_ptr<Stream>, 64> streams_{};
+    std::chrono::steady_clock::time_point t0_{};
+    std::atomic<bool> started_{false};
+};
@@ -0,0 +1,311 @@
+/*
+ * gpio_sim.h — SimMotorPort: a motor controller answering on the mock bus
+ *
+ * A MockGpioPort with a simulated motor controller on the far end of the
+ * motor line. Frames the controller writes to motor_write are decoded
+ * from their wave pulses and answered on motor_read the way the motor
+ * board answers them in the captures: the same key, no \xff, one reply
+ * per frame, sent reply_us after the frame's ']' at 9600 baud.
+ *
+ * SimMotor is the model behind it. hmph and inc set targets; the belt
+ * and the lift move toward them at fixed rates (accel_mph_s / decel_mph_s,
+ * lift_pct_s), and the replies report where they are, so a commanded
+ * change shows up on the bus as a ramp and then settles:
+ *
+ *   hmph, inc   current speed (mph * 100) / incline (half-pct)
+ *   belt        speed * 100 / 7 while moving, 0 stopped
+ *   lift        0x28 + incline * 16 / 3 (lift sensor counts)
+ *   lfts        1 at the target incline, 0 while the lift moves
+ *   amps        modelled current, tenths of an amp (see sim_amps)
+ *   ver 19A, type 20, loop 4C57, lftg 0, part echoed, err empty
+ *   vbus, diag  no reply, as captured
+ *
+ * Time is explicit (now_us) in SimMotor so it is testable on its own;
+ * SimMotorPort drives it from the steady clock. Test/bench only.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <vector>
+#include "gpio_mock.h"
+#include "kv_protocol.h"
+
+struct SimMotorConfig {
+    int motor_write = 22;        // frames from the controller arrive here
+    int motor_read = 17;         // replies are read here
+    int baud = 9600;
+    double accel_mph_s = 1.0;    // belt speed-up rate
+    double decel_mph_s = 1.5;    // belt slow-down rate
+    double lift_pct_s = 0.5;     // lift rate, up or down
+    int reply_us = 2000;         // from a frame's ']' to its reply's first byte
+    bool record_writes = true;   // keep wave_writes (off for long runs)
+};
+
+class SimMotor {
+public:
+    struct State {
+        double speed;       // mph * 100
+        double incline;     // half-pct
+        int target_speed;   // mph * 100
+        int target_incline; // half-pct
+    };
+
+    explicit SimMotor(const SimMotorConfig& cfg) : cfg_(cfg) {}
+
+    // Apply one frame received at `now_us` (monotonic across calls) and
+    // write the reply frame into `out`. Returns its length; 0 = no reply.
+    size_t frame(std::string_view key, std::string_view value, uint64_t now_us, std::span<char> out) {
+        advance(now_us);
+        int v = parse_hex(value);
+        if (key == "hmph" && v >= 0) target_speed_ = v;
+        else if (key == "inc" && v >= 0) target_incline_ = v;
+
+        std::array<char, 12> val{};
+        size_t n = 0;
+        if (key == "hmph") n = encode_hex_upper(val, wire(speed_));
+        else if (key == "inc") n = encode_hex_upper(val, wire(incline_));
+        else if (key == "belt") n = encode_hex_upper(val, wire(speed_) / 7);
+        else if (key == "lift") n = encode_hex_upper(val, 0x28 + wire(incline_ * 16.0 / 3.0));
+        else if (key == "lfts") n = encode_hex_upper(val, lift_settled() ? 1 : 0);
+        else if (key == "amps") n = encode_hex_upper(val, sim_amps());
+        else if (key == "lftg") n = encode_hex_upper(val, 0);
+        else if (key == "part") n = copy(val, value);
+        else if (key == "ver") n = copy(val, "19A");
+        else if (key == "type") n = copy(val, "20");
+        else if (key == "loop") n = copy(val, "4C57");
+        else if (key != "err") return 0;  // vbus, diag and unknown keys go unanswered
+        return build(out, key, std::string_view(val.data(), n));
+    }
+
+    State state(uint64_t now_us) {
+        advance(now_us);
+        return { speed_, incline_, target_speed_, target_incline_ };
+    }
+
+    // Both the belt and the lift are at their targets
+    bool settled() const { return speed_ == target_speed_ && lift_settled(); }
+
+    // Tenths of an amp: 0.8 A idle, 0.6 A per mph on the belt, 4 A more
+    // while accelerating. A model, not a calibration: the captured board
+    // answers FF.
+    int sim_amps() const {
+        int base = 8 + wire(speed_ * 0.06);
+        return speed_ < target_speed_ ? base + 40 : base;
+    }
+
+private:
+    void advance(uint64_t now_us) {
+        if (now_us <= last_us_) return;  // a frame dated ahead of a state() read
+        double dt = last_us_ == 0 ? 0.0 : static_cast<double>(now_us - last_us_) / 1e6;
+        last_us_ = now_us;
+        double rate = speed_ < target_speed_ ? cfg_.accel_mph_s : cfg_.decel_mph_s;
+        speed_ = approach(speed_, target_speed_, dt * 100.0 * rate);
+        incline_ = approach(incline_, target_incline_, dt * 2.0 * cfg_.lift_pct_s);
+    }
+
+    bool lift_settled() const { return incline_ == target_incline_; }
+
+    static double approach(double from, int to, double step) {
+        double t = static_cast<double>(to);
+        if (std::abs(t - from) <= step) return t;
+        return from < t ? from + step : from - step;
+    }
+
+    static int wire(double v) { return static_cast<int>(std::lround(v)); }
+
+    static int parse_hex(std::string_view hex) {
+        int v = 0;
+        auto [ptr, ec] = std::from_chars(hex.data(), hex.data() + hex.size(), v, 16);
+        return hex.empty() || ec != std::errc{} || ptr != hex.data() + hex.size() ? -1 : v;
+    }
+
+    static size_t copy(std::span<char> out, std::string_view s) {
+        size_t n = std::min(s.size(), out.size());
+        std::copy_n(s.data(), n, out.data());
+        return n;
+    }
+
+    // [key:value] or [key], without the console's \xff
+    static size_t build(std::span<char> out, std::string_view key, std::string_view value) {
+        size_t n = kv_build(out, key, value);
+        return n > 0 ? n - 1 : 0;
+    }
+
+    SimMotorConfig cfg_;
+    uint64_t last_us_ = 0;
+    double speed_ = 0;
+    double incline_ = 0;
+    int target_speed_ = 0;
+    int target_incline_ = 0;
+};
+
+struct SimMotorPort : MockGpioPort {
+    explicit SimMotorPort(SimMotorConfig cfg = {}) : cfg_(cfg), motor_(cfg_) {
+        tx_timing = true;  // the writer waits out each frame, as on the wire
+    }
+
+    SimMotor::State motor_state() {
+        std::lock_guard<std::mutex> lk(sim_mu_);
+        return motor_.state(now_us());
+    }
+
+    bool motor_settled() {
+        std::lock_guard<std::mutex> lk(sim_mu_);
+        motor_.state(now_us());
+        return motor_.settled();
+    }
+
+    uint64_t frames_received() {
+        std::lock_guard<std::mutex> lk(sim_mu_);
+        return frames_;
+    }
+
+    uint64_t frames_answered() {
+        std::lock_guard<std::mutex> lk(sim_mu_);
+        return replies_;
+    }
+
+    // --- GpioPort interface (motor pins; others fall back to the mock) ---
+
+    void wave_tx_send(int wid, int mode) {
+        auto it = waves.find(wid);
+        if (it != waves.end() && it->second.gpio == cfg_.motor_write) {
+            std::vector<uint8_t> bytes;
+            decode_pulses(it->second.pulses, bytes);
+            receive(bytes);
+        }
+        MockGpioPort::wave_tx_send(wid, mode);
+        trim_writes();
+    }
+
+    int wave_chain(char* buf, int len) {
+        std::vector<uint8_t> bytes;
+        for (int i = 0; i < len; i++) {
+            auto it = waves.find(static_cast<uint8_t>(buf[i]));
+            if (it != waves.end() && it->second.gpio == cfg_.motor_write) decode_pulses(it->second.pulses, bytes);
+        }
+        int rc = MockGpioPort::wave_chain(buf, len);
+        if (rc == 0) receive(bytes);
+        trim_writes();
+        return rc;
+    }
+
+    int serial_read(int pin, void* buf, int bufsize) {
+        if (pin != cfg_.motor_read) return MockGpioPort::serial_read(pin, buf, bufsize);
+        uint64_t now = now_us();
+        auto* dst = static_cast<uint8_t*>(buf);
+        int n = 0;
+        std::lock_guard<std::mutex> lk(sim_mu_);
+        while (n < bufsize && !out_.empty() && out_.front().due_us <= now) {
+            dst[n++] = out_.front().byte;
+            last_due_us_ = out_.front().due_us;
+            out_.pop_front();
+        }
+        if (n > 0) {
+            edge_times.at(pin).store(wire_now_ns() - static_cast<int64_t>(now - last_due_us_) * 1000,
+                                     std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    // Sleep until the next reply byte is due (or timeout / wake_edge())
+    int wait_edge(int pin, int timeout_ms) {
+        if (pin != cfg_.motor_read) return MockGpioPort::wait_edge(pin, timeout_ms);
+        int wait_ms = timeout_ms;
+        {
+            std::lock_guard<std::mutex> lk(sim_mu_);
+            if (!out_.empty()) {
+                uint64_t now = now_us();
+                if (out_.front().due_us <= now) return 1;
+                wait_ms = std::min(timeout_ms, static_cast<int>((out_.front().due_us - now) / 1000) + 1);
+            }
+        }
+        edge_signals.at(pin).wait(wait_ms);  // a new reply or wake_edge() ends it early
+        std::lock_guard<std::mutex> lk(sim_mu_);
+        return !out_.empty() && out_.front().due_us <= now_us() ? 1 : 0;
+    }
+
+    int64_t last_edge_ns(int pin) {
+        if (pin != cfg_.motor_read) return MockGpioPort::last_edge_ns(pin);
+        return edge_times.at(pin).load(std::memory_order_relaxed);
+    }
+
+private:
+    struct DueByte {
+        uint64_t due_us;
+        uint8_t byte;
+    };
+
+    uint64_t byte_us() const { return static_cast<uint64_t>(10'000'000 / std::max(cfg_.baud, 1)); }
+
+    // A frame's bytes leave now and arrive one byte time apart; each
+    // complete frame is answered reply_us after its ']'
+    void receive(const std::vector<uint8_t>& bytes) {
+        if (bytes.empty()) return;
+        uint64_t start = now_us();
+        uint64_t end = start + bytes.size() * byte_us();
+        bool queued = false;
+        {
+            std::lock_guard<std::mutex> lk(sim_mu_);
+            size_t done = 0;
+            while (done < bytes.size()) {
+                auto space = parser_.write_space();
+                size_t n = std::min(space.size(), bytes.size() - done);
+                if (n == 0) break;
+                std::copy_n(bytes.begin() + static_cast<std::ptrdiff_t>(done), n, space.begin());
+                parser_.commit(n);
+                done += n;
+            }
+            parser_.stamp(static_cast<int64_t>(end) * 1000, static_cast<int64_t>(byte_us()) * 1000);
+
+            std::array<KvPair, 16> pairs;
+            std::array<char, KV_WIRE_FRAME_MAX> reply;
+            int got;
+            do {
+                got = parser_.parse(pairs);
+                for (int i = 0; i < got; i++) {
+                    const KvPair& kv = pairs.at(static_cast<size_t>(i));
+                    uint64_t t = static_cast<uint64_t>(kv.t_ns / 1000);
+                    frames_++;
+                    size_t len = motor_.frame(kv.key_view(), kv.value_view(), t, reply);
+                    if (len == 0) continue;
+                    replies_++;
+                    uint64_t due = std::max(t + static_cast<uint64_t>(cfg_.reply_us), line_free_us_);
+                    for (size_t b = 0; b < len; b++) {
+                        due += byte_us();
+                        out_.push_back({ due, static_cast<uint8_t>(reply.at(b)) });
+                    }
+                    line_free_us_ = due;
+                    queued = true;
+                }
+            } while (got == static_cast<int>(pairs.size()));
+        }
+        if (queued) edge_signals.at(cfg_.motor_read).signal();
+    }
+
+    void trim_writes() {
+        if (cfg_.record_writes) return;
+        std::lock_guard<std::mutex> lk(wave_mu);
+        wave_writes.clear();
+    }
+
+    SimMotorConfig cfg_;
+    std::mutex sim_mu_;
+    SimMotor motor_;
+    KvStreamParser parser_;
+    std::deque<DueByte> out_;
+    uint64_t line_free_us_ = 0;   // the reply line is busy until then
+    uint64_t last_due_us_ = 0;
+    uint64_t frames_ = 0;
+    uint64_t replies_ = 0;
+};
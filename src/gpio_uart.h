@@ -0,0 +1,326 @@
+/*
+ * gpio_uart.h — UartPort: the Port interface on kernel UARTs (termios)
+ *
+ * Each pin is routed to a serial device (/dev/ttyAMA*, /dev/ttyS*) named
+ * in gpio.json; a bus's motor_write and motor_read usually share one
+ * UART (its TX and RX). No pigpio: nothing samples pins in software, the
+ * receiver has the UART's FIFO, and pigpiod may keep running.
+ *
+ * SerialWriter and SerialReader are unchanged. Their wave calls are
+ * served here: wave_add_generic() decodes the inverted 8N1 pulse train
+ * SerialWriter builds back into bytes, wave_create() stores them under
+ * a wave id, and wave_tx_send()/wave_chain() write them to the pin's
+ * device. wave_tx_busy() reports bytes still in the UART's queue.
+ *
+ * The UART speaks normal polarity; the bus idles LOW, so each line needs
+ * an external inverter (e.g. a 74HC14 stage or an RS-485 transceiver's
+ * inverting output). serial_read_invert() is a no-op, and
+ * set_mode()/write() are too: the UART owns its pins.
+ *
+ * Edge wakeups: wait_edge() polls the device for input (plus an eventfd
+ * for wake_edge()), so the reader sleeps until the FIFO has bytes.
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include "gpio_port.h"
+
+class UartPort {
+public:
+    explicit UartPort(int baud = 9600) : baud_(baud), bit_us_(1000000 / baud) {
+        pin_dev_.fill(-1);
+        pending_.reserve(CHAIN_BYTES_MAX);
+    }
+
+    ~UartPort() { terminate(); }
+    UartPort(const UartPort&) = delete;
+    UartPort& operator=(const UartPort&) = delete;
+
+    // Route `pin` to `device` (before initialise()). Pins naming the same
+    // device share it. False if the pin is out of range or too many
+    // devices are named.
+    bool assign(int pin, std::string_view device) {
+        if (!valid_pin(pin) || device.empty()) return false;
+        int idx = -1;
+        for (int i = 0; i < dev_count_; i++) {
+            if (devs_.at(static_cast<size_t>(i)).path == device) idx = i;
+        }
+        if (idx < 0) {
+            if (dev_count_ == MAX_DEVICES) return false;
+            idx = dev_count_++;
+            devs_.at(static_cast<size_t>(idx)).path = std::string(device);
+        }
+        pin_dev_.at(static_cast<size_t>(pin)) = static_cast<int8_t>(idx);
+        return true;
+    }
+
+    // Open and configure every assigned device: raw 8N1 at the baud rate,
+    // non-blocking. Returns 0, or -1 (with the failing device logged).
+    int initialise() {
+        speed_t speed = baud_speed(baud_);
+        if (speed == 0) return -1;
+        for (int i = 0; i < dev_count_; i++) {
+            auto& d = devs_.at(static_cast<size_t>(i));
+            if (d.fd >= 0) continue;
+            d.fd = ::open(d.path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+            if (d.fd < 0 || !configure(d.fd, speed)) {
+                std::fprintf(stderr, "[uart] cannot open %s: %s\n", d.path.c_str(), std::strerror(errno));
+                terminate();
+                return -1;
+            }
+            d.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        }
+        return 0;
+    }
+
+    void terminate() {
+        for (auto& d : devs_) {
+            if (d.fd >= 0) ::close(d.fd);
+            if (d.wake_fd >= 0) ::close(d.wake_fd);
+            d.fd = d.wake_fd = -1;
+        }
+    }
+
+    void set_mode(int /*pin*/, int /*mode*/) {}
+    void write(int /*pin*/, int /*level*/) {}
+
+    int serial_read_open(int pin, int baud, int bits) {
+        if (baud != baud_ || bits != 8) return -1;
+        return fd_of(pin) >= 0 ? 0 : -1;
+    }
+
+    void serial_read_invert(int /*pin*/, int /*invert*/) {}
+
+    // Non-blocking: 0 when nothing is waiting
+    int serial_read(int pin, void* buf, int bufsize) {
+        int fd = fd_of(pin);
+        if (fd < 0 || bufsize <= 0) return -1;
+        ssize_t n = ::read(fd, buf, static_cast<size_t>(bufsize));
+        return n > 0 ? static_cast<int>(n) : 0;
+    }
+
+    void serial_read_close(int pin) {
+        int fd = fd_of(pin);
+        if (fd >= 0) tcflush(fd, TCIFLUSH);
+    }
+
+    int wait_edge(int pin, int timeout_ms) {
+        const Device* d = dev_of(pin);
+        if (!d || d->fd < 0 || d->wake_fd < 0) return -1;
+        std::array<pollfd, 2> fds = {{{d->fd, POLLIN, 0}, {d->wake_fd, POLLIN, 0}}};
+        int rc = ::poll(fds.data(), fds.size(), timeout_ms);
+        if (rc > 0 && (fds[1].revents & POLLIN)) {
+            uint64_t val;
+            ssize_t n = ::read(d->wake_fd, &val, sizeof(val));
+            (void)n;
+        }
+        return rc > 0 && (fds[0].revents & POLLIN) ? 1 : 0;
+    }
+
+    void wake_edge(int pin) {
+        const Device* d = dev_of(pin);
+        if (!d || d->wake_fd < 0) return;
+        uint64_t one = 1;
+        ssize_t n = ::write(d->wake_fd, &one, sizeof(one));
+        (void)n;
+    }
+
+    // Bytes still queued on any device
+    int wave_tx_busy() {
+        for (int i = 0; i < dev_count_; i++) {
+            int fd = devs_.at(static_cast<size_t>(i)).fd;
+            int queued = 0;
+            if (fd >= 0 && ioctl(fd, TIOCOUTQ, &queued) == 0 && queued > 0) return 1;
+        }
+        return 0;
+    }
+
+    void wave_clear() {
+        for (auto& w : waves_) w.dev = -1;
+        wave_add_new();
+    }
+
+    void wave_add_new() {
+        pending_.clear();
+        pending_dev_ = -1;
+    }
+
+    // Decode an inverted 8N1 pulse train (SerialWriter::create_wave) into
+    // bytes. Any pulse struct with gpioOn/gpioOff/usDelay will do.
+    template <typename Pulse>
+    void wave_add_generic(int num_pulses, Pulse* pulses) {
+        bool high = false;  // inverted idle: LOW
+        int bit = -1;       // -1 = waiting for a start bit, 0-7 = data, 8 = stop
+        uint8_t byte_val = 0;
+        for (int i = 0; i < num_pulses; i++) {
+            const Pulse& p = pulses[i];
+            uint32_t mask = p.gpioOn | p.gpioOff;
+            if (pending_dev_ < 0 && mask != 0) pending_dev_ = dev_for_mask(mask);
+            if (p.gpioOn) high = true;
+            else if (p.gpioOff) high = false;
+
+            int bits = static_cast<int>((p.usDelay + static_cast<uint32_t>(bit_us_ / 2)) /
+                                        static_cast<uint32_t>(bit_us_));
+            for (int b = 0; b < bits; b++) {
+                if (bit < 0) {
+                    if (high) bit = 0;  // start bit
+                } else if (bit < 8) {
+                    if (!high) byte_val = static_cast<uint8_t>(byte_val | (1u << bit));  // LOW = 1
+                    bit++;
+                } else {
+                    pending_.push_back(byte_val);  // stop bit
+                    byte_val = 0;
+                    bit = -1;
+                }
+            }
+        }
+    }
+
+    int wave_create() {
+        if (pending_dev_ < 0) return -1;
+        for (size_t wid = 0; wid < waves_.size(); wid++) {
+            auto& w = waves_.at(wid);
+            if (w.dev >= 0) continue;
+            w.dev = pending_dev_;
+            w.bytes.assign(pending_.begin(), pending_.end());
+            wave_add_new();
+            return static_cast<int>(wid);
+        }
+        return -1;
+    }
+
+    void wave_tx_send(int wid, int /*mode*/) {
+        const Wave* w = wave(wid);
+        if (w) write_all(w->dev, w->bytes.data(), w->bytes.size());
+    }
+
+    // Back to back on the first wave's device, in one write
+    int wave_chain(char* buf, int len) {
+        std::array<uint8_t, CHAIN_BYTES_MAX> out;
+        size_t n = 0;
+        int dev = -1;
+        for (int i = 0; i < len; i++) {
+            const Wave* w = wave(static_cast<uint8_t>(buf[i]));
+            if (!w || (dev >= 0 && w->dev != dev) || n + w->bytes.size() > out.size()) return -1;
+            dev = w->dev;
+            std::copy(w->bytes.begin(), w->bytes.end(), out.begin() + static_cast<std::ptrdiff_t>(n));
+            n += w->bytes.size();
+        }
+        if (dev >= 0) write_all(dev, out.data(), n);
+        return 0;
+    }
+
+    void wave_delete(int wid) {
+        if (wid >= 0 && static_cast<size_t>(wid) < waves_.size()) waves_.at(static_cast<size_t>(wid)).dev = -1;
+    }
+
+private:
+    static constexpr int NUM_GPIO = 54;
+    static constexpr int MAX_DEVICES = 8;
+    static constexpr size_t MAX_WAVES = PORT_WAVE_CHAIN_MAX_ID + 1;
+    static constexpr size_t CHAIN_BYTES_MAX = 4096;
+    static constexpr int WRITE_WAIT_MS = 100;  // per stalled write(); a UART drains 4 KB in ~4 s
+
+    struct Device {
+        std::string path;
+        int fd = -1;
+        int wake_fd = -1;
+    };
+
+    struct Wave {
+        int dev = -1;  // -1 = free
+        std::vector<uint8_t> bytes;  // keeps its capacity across reuse
+    };
+
+    static bool valid_pin(int pin) { return pin >= 0 && pin < NUM_GPIO; }
+
+    static speed_t baud_speed(int baud) {
+        switch (baud) {
+            case 9600:   return B9600;
+            case 19200:  return B19200;
+            case 38400:  return B38400;
+            case 57600:  return B57600;
+            case 115200: return B115200;
+            default:     return 0;
+        }
+    }
+
+    static bool configure(int fd, speed_t speed) {
+        termios tio{};
+        if (tcgetattr(fd, &tio) != 0) return false;
+        cfmakeraw(&tio);
+        tio.c_cflag &= ~static_cast<tcflag_t>(CSTOPB | PARENB | CRTSCTS | CSIZE);
+        tio.c_cflag |= CS8 | CLOCAL | CREAD;
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 0;
+        if (cfsetispeed(&tio, speed) != 0 || cfsetospeed(&tio, speed) != 0) return false;
+        if (tcsetattr(fd, TCSANOW, &tio) != 0) return false;
+        tcflush(fd, TCIOFLUSH);
+        return true;
+    }
+
+    const Device* dev_of(int pin) const {
+        if (!valid_pin(pin)) return nullptr;
+        int idx = pin_dev_.at(static_cast<size_t>(pin));
+        return idx >= 0 ? &devs_.at(static_cast<size_t>(idx)) : nullptr;
+    }
+
+    int fd_of(int pin) const {
+        const Device* d = dev_of(pin);
+        return d ? d->fd : -1;
+    }
+
+    // Device of the lowest pin in a pulse's gpio mask
+    int dev_for_mask(uint32_t mask) const {
+        for (int pin = 0; pin < 32; pin++) {
+            if (mask & (1u << pin)) return pin_dev_.at(static_cast<size_t>(pin));
+        }
+        return -1;
+    }
+
+    const Wave* wave(int wid) const {
+        if (wid < 0 || static_cast<size_t>(wid) >= waves_.size()) return nullptr;
+        const Wave& w = waves_.at(static_cast<size_t>(wid));
+        return w.dev >= 0 ? &w : nullptr;
+    }
+
+    // The device's kernel buffer may be briefly full; wait for room
+    void write_all(int dev, const uint8_t* data, size_t len) {
+        int fd = devs_.at(static_cast<size_t>(dev)).fd;
+        while (fd >= 0 && len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            if (n > 0) {
+                data += n;
+                len -= static_cast<size_t>(n);
+                continue;
+            }
+            if (n < 0 && errno != EAGAIN && errno != EINTR) return;
+            pollfd pfd{fd, POLLOUT, 0};
+            if (::poll(&pfd, 1, WRITE_WAIT_MS) <= 0) return;
+        }
+    }
+
+    int baud_;
+    int bit_us_;
+    std::array<Device, MAX_DEVICES> devs_{};
+    int dev_count_ = 0;
+    std::array<int8_t, NUM_GPIO> pin_dev_{};
+    std::array<Wave, MAX_WAVES> waves_{};
+    std::vector<uint8_t> pending_;
+    int pending_dev_ = -1;
+};
@@ -0,0 +1,226 @@
+/*
+ * handoff.cpp — sd_listen_fds, FDSTORE notify messages and the state blob
+ */
+
+#include "handoff.h"
+#include <cstdlib>
+#include <cstring>
+#include <charconv>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace {
+
+struct BlobHeader {
+    std::array<char, 4> magic;
+    uint32_t version;
+    uint32_t size;  // sizeof(HandoffState) of the writer
+    uint32_t reserved;
+};
+
+constexpr size_t BLOB_SIZE = sizeof(BlobHeader) + sizeof(HandoffState);
+
+std::optional<long> parse_long(const char* s) {
+    if (!s) return std::nullopt;
+    std::string_view v(s);
+    long out = 0;
+    auto [end, ec] = std::from_chars(v.data(), v.data() + v.size(), out);
+    if (ec != std::errc{} || end != v.data() + v.size()) return std::nullopt;
+    return out;
+}
+
+// One sd_notify datagram, optionally carrying fds
+bool notify(std::string_view msg, std::span<const int> fds) {
+    const char* path = std::getenv("NOTIFY_SOCKET");
+    if (!path || (path[0] != '/' && path[0] != '@')) return false;
+    std::string_view p(path);
+
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (p.size() >= sizeof(addr.sun_path)) return false;
+    p.copy(addr.sun_path, p.size());
+    if (addr.sun_path[0] == '@') addr.sun_path[0] = '\0';  // abstract namespace
+    socklen_t addr_len = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + p.size());
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+
+    struct iovec iov{};
+    iov.iov_base = const_cast<char*>(msg.data());  // sendmsg doesn't write it
+    iov.iov_len = msg.size();
+    struct msghdr mh{};
+    mh.msg_name = &addr;
+    mh.msg_namelen = addr_len;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+
+    std::array<char, CMSG_SPACE(sizeof(int) * (MAX_CLIENTS + 1))> control{};
+    if (!fds.empty()) {
+        if (fds.size() > MAX_CLIENTS + 1) {
+            ::close(fd);
+            return false;
+        }
+        mh.msg_control = control.data();
+        mh.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        std::memcpy(CMSG_DATA(cm), fds.data(), sizeof(int) * fds.size());
+    }
+
+    bool ok = sendmsg(fd, &mh, MSG_NOSIGNAL) == static_cast<ssize_t>(msg.size());
+    ::close(fd);
+    return ok;
+}
+
+// The store keeps what it was given until told otherwise (client sockets
+// also leave on hangup): drop what the successor has taken over
+void remove_stored(std::string_view name) {
+    notify("FDSTOREREMOVE=1\nFDNAME=" + std::string(name), {});
+}
+
+}  // namespace
+
+std::vector<InheritedFd> parse_listen_fds(const char* listen_pid, const char* listen_fds,
+                                          const char* listen_fdnames, pid_t self) {
+    std::vector<InheritedFd> out;
+    auto pid = parse_long(listen_pid);
+    auto count = parse_long(listen_fds);
+    if (!pid || *pid != self || !count || *count <= 0 || *count > 64) return out;
+
+    std::string_view names = listen_fdnames ? listen_fdnames : "";
+    for (int i = 0; i < *count; i++) {
+        std::string_view name = "unknown";
+        if (listen_fdnames) {
+            size_t colon = names.find(':');
+            name = names.substr(0, colon);
+            names = colon == std::string_view::npos ? std::string_view{} : names.substr(colon + 1);
+        }
+        out.push_back({SD_LISTEN_FDS_START + i, std::string(name)});
+    }
+    return out;
+}
+
+std::vector<InheritedFd> take_listen_fds() {
+    auto fds = parse_listen_fds(std::getenv("LISTEN_PID"), std::getenv("LISTEN_FDS"),
+                                std::getenv("LISTEN_FDNAMES"), getpid());
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    for (const auto& f : fds) fcntl(f.fd, F_SETFD, FD_CLOEXEC);
+    return fds;
+}
+
+size_t encode_handoff(std::span<char> out, const HandoffState& st) {
+    if (out.size() < BLOB_SIZE) return 0;
+    BlobHeader h{};
+    std::memcpy(h.magic.data(), HANDOFF_MAGIC, h.magic.size());
+    h.version = HANDOFF_VERSION;
+    h.size = sizeof(HandoffState);
+    std::memcpy(out.data(), &h, sizeof(h));
+    std::memcpy(out.data() + sizeof(h), &st, sizeof(st));
+    return BLOB_SIZE;
+}
+
+std::optional<HandoffState> decode_handoff(std::span<const char> blob, uint64_t now_us) {
+    if (blob.size() != BLOB_SIZE) return std::nullopt;
+    BlobHeader h;
+    std::memcpy(&h, blob.data(), sizeof(h));
+    if (std::memcmp(h.magic.data(), HANDOFF_MAGIC, h.magic.size()) != 0 || h.version != HANDOFF_VERSION ||
+        h.size != sizeof(HandoffState)) {
+        return std::nullopt;
+    }
+    HandoffState st;
+    std::memcpy(&st, blob.data() + sizeof(h), sizeof(st));
+    if (st.saved_us > now_us || now_us - st.saved_us > HANDOFF_MAX_AGE_MS * 1000) return std::nullopt;
+    if (st.buses < 0 || st.buses > MAX_BUSES || st.clients < 0 || st.clients > MAX_CLIENTS) return std::nullopt;
+    return st;
+}
+
+std::optional<HandoffClient> handoff_client(const IpcServer::ClientHandoff& c) {
+    struct stat sb{};
+    if (fstat(c.fd, &sb) != 0) return std::nullopt;
+    return HandoffClient{static_cast<uint64_t>(sb.st_dev), static_cast<uint64_t>(sb.st_ino), c.sub, c.binary};
+}
+
+int find_handoff_client(const HandoffState& st, int fd) {
+    struct stat sb{};
+    if (fstat(fd, &sb) != 0) return -1;
+    for (int i = 0; i < st.clients; i++) {
+        const auto& c = st.client.at(i);
+        if (c.dev == static_cast<uint64_t>(sb.st_dev) && c.ino == static_cast<uint64_t>(sb.st_ino)) return i;
+    }
+    return -1;
+}
+
+bool store_fds(std::span<const int> fds, std::string_view name) {
+    if (fds.empty()) return true;
+    return notify("FDSTORE=1\nFDNAME=" + std::string(name), fds);
+}
+
+int handoff_memfd(const HandoffState& st) {
+    std::array<char, BLOB_SIZE> blob{};
+    size_t len = encode_handoff(blob, st);
+    int fd = memfd_create("treadmill_io.handoff", MFD_CLOEXEC);
+    if (fd < 0) return -1;
+    if (write(fd, blob.data(), len) != static_cast<ssize_t>(len) || lseek(fd, 0, SEEK_SET) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+std::optional<HandoffState> read_handoff_fd(int fd, uint64_t now_us) {
+    std::array<char, BLOB_SIZE + 1> blob{};  // +1: a longer file is malformed
+    ssize_t n = pread(fd, blob.data(), blob.size(), 0);
+    if (n < 0) return std::nullopt;
+    return decode_handoff(std::span<const char>(blob.data(), static_cast<size_t>(n)), now_us);
+}
+
+bool has_service_manager() {
+    return std::getenv("NOTIFY_SOCKET") != nullptr;
+}
+
+// Clients before the blob: a successor that finds clients but no blob
+// closes them, never the other way round
+bool park_for_successor(const HandoffState& st, std::span<const int> clients) {
+    int fd = handoff_memfd(st);
+    if (fd < 0) return false;
+    bool ok = store_fds(clients, "client") && store_fds(std::span<const int>(&fd, 1), "handoff");
+    ::close(fd);
+    return ok;
+}
+
+Inherited collect_inherited(std::span<const InheritedFd> fds, uint64_t now_us) {
+    Inherited in;
+    bool stored = false;
+    for (const auto& f : fds) {
+        if (in.listen_fd < 0 && (f.name == "ipc" || f.name == "unknown")) {
+            in.listen_fd = f.fd;
+        } else if (f.name == "client") {
+            in.clients.push_back(f.fd);
+            stored = true;
+        } else if (f.name == "handoff") {
+            auto st = read_handoff_fd(f.fd, now_us);
+            if (st && (!in.state || st->saved_us > in.state->saved_us)) in.state = st;  // newest wins
+            ::close(f.fd);
+            stored = true;
+        } else {
+            ::close(f.fd);
+        }
+    }
+    if (!in.state) {
+        for (int fd : in.clients) ::close(fd);
+        in.clients.clear();
+    }
+    if (stored) {
+        remove_stored("handoff");
+        remove_stored("client");
+    }
+    return in;
+}
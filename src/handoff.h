@@ -0,0 +1,128 @@
+/*
+ * handoff.h — systemd socket activation and restart state handoff
+ *
+ * treadmill-io.socket (deploy/) owns /tmp/treadmill_io.sock, so the
+ * listening socket outlives any one process: clients that connect during
+ * a restart wait in the backlog instead of failing. systemd passes it in
+ * as an inherited fd (sd_listen_fds protocol: LISTEN_PID, LISTEN_FDS,
+ * LISTEN_FDNAMES, fds from 3).
+ *
+ * On a restart the old process also parks its connected client sockets
+ * and a state blob (each bus's mode, speed, incline and odometer totals;
+ * each client's subscription and framing) in the service's file
+ * descriptor store (sd_notify "FDSTORE=1"). systemd hands them to the
+ * successor along with the listening socket; the successor re-adopts the
+ * clients and resumes every bus where it left off, so clients see a
+ * pause in events rather than a disconnect.
+ *
+ * Inherited fd names: "ipc" (the listener, FileDescriptorName= in the
+ * socket unit), "handoff" (a memfd holding the blob), "client". Clients
+ * are matched to their blob entries by socket inode, since the store
+ * doesn't keep fd order. A blob older than HANDOFF_MAX_AGE_MS is ignored
+ * and its clients closed (they reconnect, as without a handoff).
+ *
+ * The blob is the raw HandoffState behind a magic/version/size header:
+ * written and read by the same binary on the same host.
+ *
+ * Talks to systemd over its documented wire protocols; no libsystemd.
+ * Outside systemd nothing is inherited and nothing is stored.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/types.h>
+#include "ipc_protocol.h"
+#include "ipc_server.h"
+
+constexpr int SD_LISTEN_FDS_START = 3;
+constexpr uint64_t HANDOFF_MAX_AGE_MS = 5000;
+constexpr const char* HANDOFF_MAGIC = "TMH1";
+constexpr uint32_t HANDOFF_VERSION = 2;  // 2: HandoffBus::overlay
+
+struct InheritedFd {
+    int fd;
+    std::string name;  // "unknown" if LISTEN_FDNAMES is unset
+};
+
+// The fds systemd passed, from the environment values (nullptr = unset).
+// Pure; empty unless listen_pid names `self`.
+std::vector<InheritedFd> parse_listen_fds(const char* listen_pid, const char* listen_fds,
+                                          const char* listen_fdnames, pid_t self);
+
+// parse_listen_fds() on this process's environment, which is then
+// unset so children don't inherit it. Marks the fds close-on-exec.
+std::vector<InheritedFd> take_listen_fds();
+
+struct HandoffBus {
+    bool proxy;
+    bool emulate;
+    int speed_tenths;
+    int incline;
+    uint64_t distance;    // Odometer::Totals
+    uint64_t vertical;
+    uint64_t belt_on_us;
+    bool overlay = false;
+};
+
+struct HandoffClient {
+    uint64_t dev;  // socket identity (fstat)
+    uint64_t ino;
+    IpcSubscription sub;
+    bool binary;
+};
+
+struct HandoffState {
+    uint64_t saved_us;  // mono_us() when written
+    int buses;
+    std::array<HandoffBus, MAX_BUSES> bus;
+    int clients;
+    std::array<HandoffClient, MAX_CLIENTS> client;
+};
+
+// Blob bytes for `st`. 0 if `out` is too small.
+size_t encode_handoff(std::span<char> out, const HandoffState& st);
+
+// Parse a blob; nullopt if malformed, another version, or saved more
+// than HANDOFF_MAX_AGE_MS before `now_us`.
+std::optional<HandoffState> decode_handoff(std::span<const char> blob, uint64_t now_us);
+
+// HandoffClient entry for a client socket, by fstat identity
+std::optional<HandoffClient> handoff_client(const IpcServer::ClientHandoff& c);
+
+// Index of the entry for socket `fd` in `st`, or -1
+int find_handoff_client(const HandoffState& st, int fd);
+
+// Send `fds` to the service manager's fd store under `name`
+// ($NOTIFY_SOCKET). False if there is no manager or the send failed;
+// the caller still owns the fds either way.
+bool store_fds(std::span<const int> fds, std::string_view name);
+
+// Write the blob into a new memfd (offset 0). -1 on failure.
+int handoff_memfd(const HandoffState& st);
+
+// Read a blob written by handoff_memfd()
+std::optional<HandoffState> read_handoff_fd(int fd, uint64_t now_us);
+
+// True if a service manager is listening ($NOTIFY_SOCKET)
+bool has_service_manager();
+
+// Park `clients` and a memfd of `st` in the fd store for the next start.
+// The caller still owns (and should close) `clients`.
+bool park_for_successor(const HandoffState& st, std::span<const int> clients);
+
+// What a successor got from systemd, grouped by name
+struct Inherited {
+    int listen_fd = -1;
+    std::optional<HandoffState> state;
+    std::vector<int> clients;  // closed and dropped if `state` is missing
+};
+
+// Group take_listen_fds() entries; fds that go unused are closed
+Inherited collect_inherited(std::span<const InheritedFd> fds, uint64_t now_us);
@@ -0,0 +1,173 @@
+/*
+ * history.h — BusHistory: downsampled speed/incline/amps history in memory
+ *
+ * A UI reconnecting mid-workout couldn't redraw its chart: the ring holds
+ * only the last few thousand raw events. BusHistory keeps the bus values
+ * a chart draws in two preallocated columnar tiers:
+ *
+ *   fine    one sample a second (HISTORY_SAMPLE_MS), 3 hours
+ *   coarse  one-minute means of the fine samples, 24 hours
+ *
+ * Each tier is a ring of parallel columns (time, speed, incline, amps),
+ * allocated once at construction. query() answers a time range at a
+ * requested step from the fine tier while it still reaches back to the
+ * range's start, else from the coarse one, averaging the samples in each
+ * step. A step too fine for the range is widened so the answer stays
+ * within HISTORY_MAX_POINTS.
+ *
+ * Times are whole seconds since the controller started, the clock of the
+ * events' "ts". Values are -1 where unknown. IPC thread only (the
+ * sampling timer and the history command): no locking.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <span>
+#include <vector>
+#include "ipc_protocol.h"
+
+constexpr int HISTORY_SAMPLE_MS = 1000;
+constexpr uint32_t HISTORY_COARSE_S = 60;
+constexpr size_t HISTORY_FINE_POINTS = 3 * 3600;   // 3 h of 1 s samples
+constexpr size_t HISTORY_COARSE_POINTS = 24 * 60;  // 24 h of 1 min means
+
+// One sample: tenths of mph, half-pct, amps in wire units; -1 = unknown
+struct HistorySample {
+    int16_t speed;
+    int16_t incline;
+    int16_t amps;
+};
+
+// What query() filled: bucket i covers [from + i * step, from + (i + 1) * step)
+struct HistoryRange {
+    uint32_t from;
+    uint32_t step;
+    size_t count;
+};
+
+class BusHistory {
+public:
+    BusHistory() : fine_(HISTORY_FINE_POINTS), coarse_(HISTORY_COARSE_POINTS) {}
+
+    // A sample at `t_s`, later than the previous one
+    void sample(uint32_t t_s, HistorySample s) {
+        if (fine_.size > 0 && t_s <= fine_.newest()) return;
+        fine_.push(t_s, s);
+        uint32_t minute = t_s / HISTORY_COARSE_S;
+        if (minute_.n > 0 && minute != minute_start_ / HISTORY_COARSE_S) {
+            coarse_.push(minute_start_, minute_.mean());
+            minute_ = {};
+        }
+        if (minute_.n == 0) minute_start_ = minute * HISTORY_COARSE_S;
+        minute_.add(s);
+    }
+
+    // [from, to) in buckets of `step` seconds into the output columns
+    // (HISTORY_MAX_POINTS each). The step is widened to the tier's
+    // resolution and to fit; the range is cut at the output size.
+    HistoryRange query(uint32_t from, uint32_t to, uint32_t step, std::span<int16_t> speed,
+                       std::span<int16_t> incline, std::span<int16_t> amps) const {
+        const Tier& tier = fine_.covers(from) || coarse_.size == 0 ? fine_ : coarse_;
+        uint32_t res = &tier == &fine_ ? 1 : HISTORY_COARSE_S;
+        step = std::max({step, res, 1u});
+        size_t cap = std::min({speed.size(), incline.size(), amps.size(), HISTORY_MAX_POINTS});
+        if (to <= from || cap == 0) return {from, step, 0};
+        uint64_t span = to - from;
+        if ((span + step - 1) / step > cap) step = static_cast<uint32_t>((span + cap - 1) / cap);
+        size_t count = static_cast<size_t>((span + step - 1) / step);
+
+        std::array<Mean, HISTORY_MAX_POINTS> acc{};
+        for (size_t i = tier.lower_bound(from); i < tier.size; i++) {
+            size_t at = tier.index(i);
+            uint32_t t = tier.t.at(at);
+            if (t >= to) break;
+            acc.at((t - from) / step).add(tier.get(at));
+        }
+        for (size_t b = 0; b < count; b++) {
+            auto m = acc.at(b).mean();
+            speed[b] = m.speed;
+            incline[b] = m.incline;
+            amps[b] = m.amps;
+        }
+        return {from, step, count};
+    }
+
+    size_t fine_count() const { return fine_.size; }
+    size_t coarse_count() const { return coarse_.size; }
+
+private:
+    // Columns of one tier, as a ring: the oldest sample at `start`
+    struct Tier {
+        explicit Tier(size_t cap) : t(cap), speed(cap), incline(cap), amps(cap) {}
+
+        std::vector<uint32_t> t;
+        std::vector<int16_t> speed;
+        std::vector<int16_t> incline;
+        std::vector<int16_t> amps;
+        size_t start = 0;
+        size_t size = 0;
+
+        size_t cap() const { return t.size(); }
+        size_t index(size_t i) const { return (start + i) % cap(); }
+        uint32_t newest() const { return t.at(index(size - 1)); }
+        HistorySample get(size_t at) const { return {speed.at(at), incline.at(at), amps.at(at)}; }
+
+        void push(uint32_t ts, HistorySample s) {
+            size_t at = index(size);
+            if (size == cap()) start = (start + 1) % cap();
+            else size++;
+            t.at(at) = ts;
+            speed.at(at) = s.speed;
+            incline.at(at) = s.incline;
+            amps.at(at) = s.amps;
+        }
+
+        // Holds everything since `ts`: nothing older has been overwritten
+        bool covers(uint32_t ts) const {
+            return size < cap() || (size > 0 && t.at(start) <= ts);
+        }
+
+        // First logical index with t >= ts (times increase)
+        size_t lower_bound(uint32_t ts) const {
+            size_t lo = 0, hi = size;
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (t.at(index(mid)) < ts) lo = mid + 1;
+                else hi = mid;
+            }
+            return lo;
+        }
+    };
+
+    // Running means of the known (non-negative) values
+    struct Mean {
+        std::array<int32_t, 3> sum{};
+        std::array<uint16_t, 3> count{};
+        uint16_t n = 0;  // samples, known or not
+
+        void add(HistorySample s) {
+            put(0, s.speed);
+            put(1, s.incline);
+            put(2, s.amps);
+            n++;
+        }
+        void put(size_t i, int16_t v) {
+            if (v < 0) return;
+            sum.at(i) += v;
+            count.at(i)++;
+        }
+        int16_t value(size_t i) const {
+            if (count.at(i) == 0) return -1;
+            return static_cast<int16_t>((sum.at(i) + count.at(i) / 2) / count.at(i));
+        }
+        HistorySample mean() const { return {value(0), value(1), value(2)}; }
+    };
+
+    Tier fine_;
+    Tier coarse_;
+    Mean minute_;               // fine samples of the minute in progress
+    uint32_t minute_start_ = 0;
+};
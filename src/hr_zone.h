@@ -0,0 +1,169 @@
+/*
+ * hr_zone.h — HrZoneController: closed-loop heart-rate zone control
+ *
+ * The `hr_zone` IPC command sets a target band (bpm) and puts either the
+ * speed or the incline under control, between the client's bounds; `hr`
+ * commands feed it samples (hrm-daemon). The emulate thread calls tick()
+ * ahead of every burst, like ProgramRunner, so a step lands at bus
+ * cadence with no Python timer in the loop.
+ *
+ * The controller is deliberately slow and bounded: one `step` per
+ * `interval` at most (heart rate lags a workload change by tens of
+ * seconds), toward the band only, never outside [min, max]. Above hr_max
+ * the target drops to min at once. With no sample for HR_STALE_MS it
+ * holds the current target until samples return. Steps are relative to
+ * the target in force, so a manual speed or incline command just moves
+ * the starting point; ModeStateMachine's clamps and the watchdogs apply
+ * as to any other target.
+ *
+ * Pure timing logic: the caller passes CLOCK_MONOTONIC times and applies
+ * the targets. Thread-safe (IPC thread loads/stops/samples, emulate
+ * thread ticks).
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <mutex>
+#include <algorithm>
+#include "ipc_protocol.h"
+
+// A sample older than this no longer drives the target
+constexpr int64_t HR_STALE_MS = 5000;
+// Progress events while running: at most this often, plus every change
+constexpr int64_t HR_ZONE_PROGRESS_MS = 1000;
+
+enum class HrZoneState : uint8_t { Idle, Running, NoHr, Limit, Stopped };
+
+constexpr std::string_view hr_zone_state_name(HrZoneState s) {
+    switch (s) {
+        case HrZoneState::Idle:    return "idle";
+        case HrZoneState::Running: return "running";
+        case HrZoneState::NoHr:    return "no_hr";
+        case HrZoneState::Limit:   return "limit";
+        case HrZoneState::Stopped: return "stopped";
+    }
+    return "idle";
+}
+
+struct HrZoneTick {
+    bool apply;     // set `target` on the controlled axis
+    bool report;    // progress event due (step, state change, 1 s tick)
+    int target;     // tenths mph or half-pct
+};
+
+class HrZoneController {
+public:
+    // Start `spec` at `now_ns`. Replaces any zone in progress; heart-rate
+    // samples already received still count.
+    void load(const HrZoneSpec& spec, int64_t now_ns) {
+        std::lock_guard<std::mutex> lk(mu_);
+        spec_ = spec;
+        state_ = HrZoneState::Running;
+        reported_ = HrZoneState::Idle;  // first tick reports
+        last_step_ns_ = now_ns - static_cast<int64_t>(spec_.interval_ms) * 1000000;
+        next_report_ns_ = 0;
+        steps_ = 0;
+        target_ = -1;
+    }
+
+    // Abort. True if a zone was running.
+    bool stop() {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (!active_locked()) return false;
+        state_ = HrZoneState::Stopped;
+        return true;
+    }
+
+    bool active() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return active_locked();
+    }
+
+    void sample(int bpm, int64_t now_ns) {
+        std::lock_guard<std::mutex> lk(mu_);
+        hr_ = bpm;
+        hr_ns_ = now_ns;
+    }
+
+    // Advance to `now_ns` with `current` the controlled axis's target in
+    // force. The caller applies `target` when `apply` is set and confirms
+    // with applied(); a failed apply is retried next tick.
+    HrZoneTick tick(int64_t now_ns, int current) {
+        std::lock_guard<std::mutex> lk(mu_);
+        HrZoneTick out{ false, false, current };
+        if (!active_locked()) return out;
+
+        int next = current;
+        bool fresh = hr_ > 0 && now_ns - hr_ns_ <= HR_STALE_MS * 1000000;
+        if (!fresh) {
+            state_ = HrZoneState::NoHr;
+        } else if (spec_.hr_max > 0 && hr_ >= spec_.hr_max) {
+            state_ = HrZoneState::Limit;
+            next = spec_.min;
+        } else {
+            state_ = HrZoneState::Running;
+            if (now_ns - last_step_ns_ >= static_cast<int64_t>(spec_.interval_ms) * 1000000) {
+                if (hr_ > spec_.high) next = current - spec_.step;
+                else if (hr_ < spec_.low) next = current + spec_.step;
+            }
+        }
+        // Inside the bounds whatever the state, from the first tick
+        next = std::clamp(next, spec_.min, spec_.max);
+        if (next != current) {
+            out.apply = true;
+            out.target = next;
+        }
+        out.report = state_ != reported_ || now_ns >= next_report_ns_;
+        if (out.report) {
+            reported_ = state_;
+            next_report_ns_ = now_ns + HR_ZONE_PROGRESS_MS * 1000000;
+        }
+        target_ = current;
+        return out;
+    }
+
+    void applied(const HrZoneTick& t, int64_t now_ns) {
+        std::lock_guard<std::mutex> lk(mu_);
+        target_ = t.target;
+        last_step_ns_ = now_ns;
+        steps_++;
+    }
+
+    HrControl control() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return spec_.control;
+    }
+
+    // Snapshot for a progress event (as of the last tick / transition)
+    HrZoneEvent progress() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        HrZoneEvent ev{};
+        ev.state = hr_zone_state_name(state_);
+        ev.control = spec_.control == HrControl::Speed ? "speed" : "incline";
+        ev.hr = hr_;
+        ev.low = spec_.low;
+        ev.high = spec_.high;
+        ev.target = std::max(target_, 0);
+        ev.steps = steps_;
+        return ev;
+    }
+
+private:
+    bool active_locked() const {
+        return state_ == HrZoneState::Running || state_ == HrZoneState::NoHr ||
+               state_ == HrZoneState::Limit;
+    }
+
+    mutable std::mutex mu_;
+    HrZoneSpec spec_{};
+    HrZoneState state_ = HrZoneState::Idle;
+    HrZoneState reported_ = HrZoneState::Idle;
+    int hr_ = 0;
+    int64_t hr_ns_ = 0;
+    int64_t last_step_ns_ = 0;
+    int64_t next_report_ns_ = 0;
+    uint32_t steps_ = 0;
+    int target_ = -1;
+};
@@ -3,6 +3,9 @@
  */
 
 #include "ipc_protocol.h"
+#include "kv_protocol.h"
+#include "mode_state.h"
+#include <cmath>
 
 // RapidJSON config: no exceptions, assert is a no-op (we check errors after parse)
 #define RAPIDJSON_ASSERT(x) ((void)(x))
@@ -11,29 +14,156 @@
 #include <rapidjson/document.h>
 #include <rapidjson/writer.h>
 #include <rapidjson/stringbuffer.h>
+#include <rapidjson/internal/dtoa.h>
 
-std::optional<IpcCommand> parse_command(std::string_view json) {
-    if (json.empty() || json.size() > MAX_IPC_COMMAND_LEN) return std::nullopt;
+#include <array>
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstring>
 
-    // RapidJSON in-situ needs a mutable, null-terminated buffer
-    std::string buf(json);
+// Optional array of names -> bitmask (bit i = names[i]). Missing = leave
+// `mask` as is; false on a non-array or a name not in names[first..].
+template <size_t N>
+static bool parse_name_mask(const rapidjson::Value& doc, const char* field,
+                            const std::array<std::string_view, N>& names, size_t first,
+                            uint32_t& mask) {
+    auto it = doc.FindMember(field);
+    if (it == doc.MemberEnd()) return true;
+    if (!it->value.IsArray()) return false;
+    mask = 0;
+    for (const auto& v : it->value.GetArray()) {
+        if (!v.IsString()) return false;
+        std::string_view name(v.GetString(), v.GetStringLength());
+        auto found = std::find(names.begin() + first, names.end(), name);
+        if (found == names.end()) return false;
+        mask |= 1u << (found - names.begin());
+    }
+    return true;
+}
 
-    rapidjson::Document doc;
-    doc.ParseInsitu(buf.data());
-    if (doc.HasParseError() || !doc.IsObject()) return std::nullopt;
+// Optional "buses": [0, 2] -> bitmask
+static bool parse_bus_mask(const rapidjson::Value& doc, uint32_t& mask) {
+    auto it = doc.FindMember("buses");
+    if (it == doc.MemberEnd()) return true;
+    if (!it->value.IsArray()) return false;
+    mask = 0;
+    for (const auto& v : it->value.GetArray()) {
+        if (!v.IsInt() || v.GetInt() < 0 || v.GetInt() >= MAX_BUSES) return false;
+        mask |= 1u << v.GetInt();
+    }
+    return true;
+}
 
-    // Extract "cmd" field
-    auto cmd_it = doc.FindMember("cmd");
-    if (cmd_it == doc.MemberEnd() || !cmd_it->value.IsString()) return std::nullopt;
+// One [seconds, mph, incline %, ramp?] program segment
+static bool parse_segment(const rapidjson::Value& v, ProgramSegment& out) {
+    if (!v.IsArray() || v.Size() < 3 || v.Size() > 4) return false;
+    for (const auto& n : v.GetArray()) {
+        if (!n.IsNumber() && !n.IsBool()) return false;
+    }
+    if (!v[0].IsNumber() || !v[1].IsNumber() || !v[2].IsNumber()) return false;
+    double secs = v[0].GetDouble();
+    double mph = v[1].GetDouble();
+    double pct = v[2].GetDouble();
+    if (!(secs > 0) || secs * 1000.0 > PROGRAM_MAX_SEGMENT_MS) return false;
+    if (!(mph >= 0) || mph * 10.0 > MAX_SPEED_TENTHS + 0.5) return false;
+    if (!(pct >= 0) || pct * 2.0 > MAX_INCLINE + 0.5) return false;
+    out.duration_ms = static_cast<uint32_t>(std::lround(secs * 1000.0));
+    out.speed_tenths = static_cast<int16_t>(std::lround(mph * 10.0));
+    out.incline = static_cast<int16_t>(std::lround(pct * 2.0));
+    out.ramp = false;
+    if (v.Size() == 4) out.ramp = v[3].IsBool() ? v[3].GetBool() : v[3].GetDouble() != 0;
+    return out.duration_ms > 0;
+}
 
-    std::string_view cmd(cmd_it->value.GetString(), cmd_it->value.GetStringLength());
+static bool parse_program(const rapidjson::Value& doc, ProgramSpec& out) {
+    auto act_it = doc.FindMember("action");
+    if (act_it != doc.MemberEnd()) {
+        if (!act_it->value.IsString()) return false;
+        std::string_view act(act_it->value.GetString(), act_it->value.GetStringLength());
+        if (act == "stop") out.action = ProgramAction::Stop;
+        else if (act == "pause") out.action = ProgramAction::Pause;
+        else if (act == "resume") out.action = ProgramAction::Resume;
+        else if (act != "start") return false;
+        if (out.action != ProgramAction::Start) return true;
+    }
+    auto seg_it = doc.FindMember("segments");
+    if (seg_it == doc.MemberEnd() || !seg_it->value.IsArray()) return false;
+    const auto& segs = seg_it->value;
+    if (segs.Empty() || segs.Size() > static_cast<rapidjson::SizeType>(PROGRAM_MAX_SEGMENTS)) return false;
+    for (rapidjson::SizeType i = 0; i < segs.Size(); i++) {
+        if (!parse_segment(segs[i], out.segments.at(i))) return false;
+    }
+    out.count = static_cast<uint8_t>(segs.Size());
+    return true;
+}
 
-    IpcCommand out{};
+// Optional number member `name` into `out`; false if present but not a number
+static bool number_member(const rapidjson::Value& doc, const char* name, double& out) {
+    auto it = doc.FindMember(name);
+    if (it == doc.MemberEnd()) return true;
+    if (!it->value.IsNumber()) return false;
+    out = it->value.GetDouble();
+    return true;
+}
+
+static bool parse_hr_zone(const rapidjson::Value& doc, HrZoneSpec& out) {
+    auto act_it = doc.FindMember("action");
+    if (act_it != doc.MemberEnd()) {
+        if (!act_it->value.IsString()) return false;
+        std::string_view act(act_it->value.GetString(), act_it->value.GetStringLength());
+        if (act == "stop") {
+            out.stop = true;
+            return true;
+        }
+        if (act != "start") return false;
+    }
+    auto ctl_it = doc.FindMember("control");
+    if (ctl_it != doc.MemberEnd()) {
+        if (!ctl_it->value.IsString()) return false;
+        std::string_view ctl(ctl_it->value.GetString(), ctl_it->value.GetStringLength());
+        if (ctl == "incline") out.control = HrControl::Incline;
+        else if (ctl != "speed") return false;
+    }
+    bool speed = out.control == HrControl::Speed;
+    double low = -1, high = -1, hr_max = 0, interval = HR_ZONE_INTERVAL_MS / 1000.0;
+    double min = 0, max = speed ? MAX_SPEED_TENTHS / 10.0 : MAX_INCLINE / 2.0, step = speed ? 0.1 : 0.5;
+    if (!number_member(doc, "low", low) || !number_member(doc, "high", high) ||
+        !number_member(doc, "min", min) || !number_member(doc, "max", max) ||
+        !number_member(doc, "step", step) || !number_member(doc, "interval", interval) ||
+        !number_member(doc, "hr_max", hr_max)) {
+        return false;
+    }
+    if (!(low >= HR_BPM_MIN) || !(high <= HR_BPM_MAX) || !(low < high)) return false;
+    if (hr_max != 0 && !(hr_max > high && hr_max <= HR_BPM_MAX)) return false;
+    if (!(interval * 1000.0 >= HR_ZONE_INTERVAL_MIN_MS && interval * 1000.0 <= HR_ZONE_INTERVAL_MAX_MS)) {
+        return false;
+    }
+    // Bounds in wire units, inside the mode state machine's own limits
+    double scale = speed ? 10.0 : 2.0;
+    int limit = speed ? MAX_SPEED_TENTHS : MAX_INCLINE;
+    out.low = static_cast<int>(std::lround(low));
+    out.high = static_cast<int>(std::lround(high));
+    out.min = static_cast<int>(std::lround(min * scale));
+    out.max = static_cast<int>(std::lround(max * scale));
+    out.step = static_cast<int>(std::lround(step * scale));
+    out.interval_ms = static_cast<uint32_t>(std::lround(interval * 1000.0));
+    out.hr_max = static_cast<int>(std::lround(hr_max));
+    return out.min >= 0 && out.min <= out.max && out.max <= limit && out.step >= 1;
+}
+
+// Percent (float) to half-pct units: round(pct * 2), half away from zero
+static int incline_pct_to_half(double pct) {
+    return static_cast<int>(pct * 2.0 + (pct >= 0 ? 0.5 : -0.5));
+}
 
+// speed, incline, emulate or proxy from `obj` into `out`; false if `cmd`
+// is none of them
+static bool parse_mode_command(std::string_view cmd, const rapidjson::Value& obj, IpcCommand& out) {
     if (cmd == "speed") {
         out.type = CmdType::Speed;
-        auto val_it = doc.FindMember("value");
-        if (val_it != doc.MemberEnd()) {
+        auto val_it = obj.FindMember("value");
+        if (val_it != obj.MemberEnd()) {
             if (val_it->value.IsDouble())
                 out.float_value = val_it->value.GetDouble();
             else if (val_it->value.IsInt())
@@ -41,12 +171,12 @@ std::optional<IpcCommand> parse_command(std::string_view json) {
             else if (val_it->value.IsUint())
                 out.float_value = static_cast<double>(val_it->value.GetUint());
         }
-        return out;
+        return true;
     }
     else if (cmd == "incline") {
         out.type = CmdType::Incline;
-        auto val_it = doc.FindMember("value");
-        if (val_it != doc.MemberEnd()) {
+        auto val_it = obj.FindMember("value");
+        if (val_it != obj.MemberEnd()) {
             // Accept float percent, convert to half-pct units: half_pct = round(pct * 2)
             double pct = 0.0;
             if (val_it->value.IsDouble())
@@ -55,22 +185,199 @@ std::optional<IpcCommand> parse_command(std::string_view json) {
                 pct = static_cast<double>(val_it->value.GetInt());
             else if (val_it->value.IsUint())
                 pct = static_cast<double>(val_it->value.GetUint());
-            out.int_value = static_cast<int>(pct * 2.0 + (pct >= 0 ? 0.5 : -0.5));
+            out.int_value = incline_pct_to_half(pct);
         }
-        return out;
+        return true;
     }
     else if (cmd == "emulate") {
         out.type = CmdType::Emulate;
-        auto val_it = doc.FindMember("enabled");
-        if (val_it != doc.MemberEnd() && val_it->value.IsBool())
+        auto val_it = obj.FindMember("enabled");
+        if (val_it != obj.MemberEnd() && val_it->value.IsBool())
             out.bool_value = val_it->value.GetBool();
-        return out;
+        return true;
     }
     else if (cmd == "proxy") {
         out.type = CmdType::Proxy;
-        auto val_it = doc.FindMember("enabled");
-        if (val_it != doc.MemberEnd() && val_it->value.IsBool())
+        auto val_it = obj.FindMember("enabled");
+        if (val_it != obj.MemberEnd() && val_it->value.IsBool())
+            out.bool_value = val_it->value.GetBool();
+        return true;
+    }
+    else if (cmd == "overlay") {
+        out.type = CmdType::Overlay;
+        auto val_it = obj.FindMember("enabled");
+        if (val_it != obj.MemberEnd() && val_it->value.IsBool())
             out.bool_value = val_it->value.GetBool();
+        return true;
+    }
+    return false;
+}
+
+// "commands": 1 to IPC_BATCH_MAX mode commands -> out.batch
+static bool parse_batch(const rapidjson::Value& doc, IpcCommand& out) {
+    auto it = doc.FindMember("commands");
+    if (it == doc.MemberEnd() || !it->value.IsArray()) return false;
+    const auto& cmds = it->value;
+    if (cmds.Empty() || cmds.Size() > static_cast<rapidjson::SizeType>(IPC_BATCH_MAX)) return false;
+    for (rapidjson::SizeType i = 0; i < cmds.Size(); i++) {
+        const auto& v = cmds[i];
+        if (!v.IsObject() || v.HasMember("bus") || v.HasMember("seq")) return false;
+        auto cmd_it = v.FindMember("cmd");
+        if (cmd_it == v.MemberEnd() || !cmd_it->value.IsString()) return false;
+        std::string_view cmd(cmd_it->value.GetString(), cmd_it->value.GetStringLength());
+        IpcCommand one{};
+        if (!parse_mode_command(cmd, v, one)) return false;
+        ModeStep& step = out.batch.at(i);
+        switch (one.type) {
+            case CmdType::Speed:   step = {ModeStep::Kind::Speed, speed_mph_to_tenths(one.float_value)}; break;
+            case CmdType::Incline: step = {ModeStep::Kind::Incline, one.int_value}; break;
+            case CmdType::Emulate: step = {ModeStep::Kind::Emulate, one.bool_value}; break;
+            case CmdType::Overlay: step = {ModeStep::Kind::Overlay, one.bool_value}; break;
+            default:               step = {ModeStep::Kind::Proxy, one.bool_value}; break;
+        }
+    }
+    out.batch_count = static_cast<uint8_t>(cmds.Size());
+    return true;
+}
+
+// Compact-form scanner for the fast path
+namespace {
+
+struct FastScan {
+    std::string_view s;
+
+    bool lit(std::string_view t) {
+        if (!s.starts_with(t)) return false;
+        s.remove_prefix(t.size());
+        return true;
+    }
+
+    // A JSON number (RFC 8259 grammar), as RapidJSON would read it
+    bool number(double& out) {
+        size_t i = 0, n = std::min<size_t>(s.size(), 24);
+        auto digits = [&] {
+            size_t from = i;
+            while (i < n && s[i] >= '0' && s[i] <= '9') i++;
+            return i > from;
+        };
+        if (i < n && s[i] == '-') i++;
+        if (i < n && s[i] == '0') i++;
+        else if (!digits()) return false;
+        if (i < n && s[i] == '.') {
+            i++;
+            if (!digits()) return false;
+        }
+        if (i < n && (s[i] == 'e' || s[i] == 'E')) {
+            i++;
+            if (i < n && (s[i] == '+' || s[i] == '-')) i++;
+            if (!digits()) return false;
+        }
+        if (i == n) return false;  // longer than we handle; or no closing brace
+        auto [end, ec] = std::from_chars(s.data(), s.data() + i, out);
+        if (ec != std::errc{} || end != s.data() + i) return false;
+        s.remove_prefix(i);
+        return true;
+    }
+
+    // Optional ,"seq":N and ,"bus":B, then the closing brace and nothing after
+    bool end(IpcCommand& out) {
+        if (lit(",\"seq\":")) {
+            auto [p, ec] = std::from_chars(s.data(), s.data() + s.size(), out.seq);
+            if (ec != std::errc{} || p == s.data() || (s[0] == '0' && p - s.data() > 1)) return false;
+            s.remove_prefix(static_cast<size_t>(p - s.data()));
+            out.has_seq = true;
+        }
+        if (lit(",\"bus\":")) {
+            if (s.empty() || s[0] < '0' || s[0] >= '0' + MAX_BUSES) return false;
+            out.bus = s[0] - '0';
+            s.remove_prefix(1);
+        }
+        return s == "}";
+    }
+};
+
+}  // namespace
+
+// The compact forms treadmill_client.py sends most: {"cmd":"heartbeat"},
+// {"cmd":"speed","value":N} and {"cmd":"incline","value":N}, each with an
+// optional trailing "seq" and "bus". Same result as the full parse; nullopt for
+// anything else, which then takes the full parse.
+static std::optional<IpcCommand> parse_fast(std::string_view json) {
+    FastScan sc{json};
+    if (!sc.lit("{\"cmd\":\"")) return std::nullopt;
+    IpcCommand out{};
+    if (sc.lit("heartbeat\"")) {
+        out.type = CmdType::Heartbeat;
+        if (!sc.end(out)) return std::nullopt;
+        return out;
+    }
+    double v = 0;
+    if (sc.lit("speed\",\"value\":")) {
+        out.type = CmdType::Speed;
+        if (!sc.number(v) || !sc.end(out)) return std::nullopt;
+        out.float_value = v;
+        return out;
+    }
+    if (sc.lit("incline\",\"value\":")) {
+        out.type = CmdType::Incline;
+        if (!sc.number(v) || !sc.end(out)) return std::nullopt;
+        out.int_value = incline_pct_to_half(v);
+        return out;
+    }
+    return std::nullopt;
+}
+
+// The full parse runs on a DOM whose nodes and parse stack live in these
+// stack buffers (a full program upload fits), so a command costs no heap
+// allocation. Anything larger spills to the heap rather than failing.
+constexpr size_t PARSE_POOL_BYTES = 32768;
+constexpr size_t PARSE_STACK_BYTES = 4096;
+using PoolAllocator = rapidjson::MemoryPoolAllocator<>;
+using PoolDocument = rapidjson::GenericDocument<rapidjson::UTF8<>, PoolAllocator, PoolAllocator>;
+
+// Full parse of `buf`: the command, then one spare byte for the terminator
+static std::optional<IpcCommand> parse_full(std::span<char> buf) {
+    // RapidJSON in-situ needs a mutable, null-terminated buffer
+    buf.back() = '\0';
+
+    alignas(8) std::array<char, PARSE_POOL_BYTES> pool;
+    alignas(8) std::array<char, PARSE_STACK_BYTES> stack;
+    PoolAllocator pool_alloc(pool.data(), pool.size());
+    PoolAllocator stack_alloc(stack.data(), stack.size());
+    PoolDocument doc(&pool_alloc, stack.size() / 2, &stack_alloc);
+    doc.ParseInsitu(buf.data());
+    if (doc.HasParseError() || !doc.IsObject()) return std::nullopt;
+
+    // Extract "cmd" field
+    auto cmd_it = doc.FindMember("cmd");
+    if (cmd_it == doc.MemberEnd() || !cmd_it->value.IsString()) return std::nullopt;
+
+    std::string_view cmd(cmd_it->value.GetString(), cmd_it->value.GetStringLength());
+
+    IpcCommand out{};
+
+    auto bus_it = doc.FindMember("bus");
+    if (bus_it != doc.MemberEnd()) {
+        if (!bus_it->value.IsInt() || bus_it->value.GetInt() < 0 ||
+            bus_it->value.GetInt() >= MAX_BUSES) {
+            return std::nullopt;
+        }
+        out.bus = bus_it->value.GetInt();
+    }
+
+    auto seq_it = doc.FindMember("seq");
+    if (seq_it != doc.MemberEnd()) {
+        if (!seq_it->value.IsUint()) return std::nullopt;
+        out.seq = seq_it->value.GetUint();
+        out.has_seq = true;
+    }
+
+    if (parse_mode_command(cmd, doc, out)) {
+        return out;
+    }
+    else if (cmd == "batch") {
+        out.type = CmdType::Batch;
+        if (!parse_batch(doc, out)) return std::nullopt;
         return out;
     }
     else if (cmd == "status") {
@@ -81,52 +388,824 @@ std::optional<IpcCommand> parse_command(std::string_view json) {
         out.type = CmdType::Heartbeat;
         return out;
     }
+    else if (cmd == "stats") {
+        out.type = CmdType::Stats;
+        return out;
+    }
+    else if (cmd == "metrics") {
+        out.type = CmdType::Metrics;
+        return out;
+    }
+    else if (cmd == "snapshot") {
+        out.type = CmdType::Snapshot;
+        return out;
+    }
+    else if (cmd == "mailbox") {
+        out.type = CmdType::Mailbox;
+        return out;
+    }
+    else if (cmd == "history") {
+        out.type = CmdType::History;
+        struct { const char* name; uint32_t* dest; uint32_t min; } fields[] = {
+            { "from", &out.history.from, 0 },
+            { "to", &out.history.to, 0 },
+            { "step", &out.history.step, 1 },
+        };
+        for (const auto& f : fields) {
+            auto it = doc.FindMember(f.name);
+            if (it == doc.MemberEnd()) continue;
+            if (!it->value.IsUint() || it->value.GetUint() < f.min) return std::nullopt;
+            *f.dest = it->value.GetUint();
+        }
+        return out;
+    }
+    else if (cmd == "subscribe") {
+        out.type = CmdType::Subscribe;
+        if (!parse_name_mask(doc, "types", SUB_TYPE_NAMES, 0, out.sub.types) ||
+            !parse_name_mask(doc, "sources", SUB_SOURCE_NAMES, 0, out.sub.sources) ||
+            !parse_name_mask(doc, "keys", KV_KEY_NAMES, 1, out.sub.keys) ||
+            !parse_bus_mask(doc, out.sub.buses)) {
+            return std::nullopt;
+        }
+        auto rate_it = doc.FindMember("kv_rate");
+        if (rate_it != doc.MemberEnd()) {
+            if (!rate_it->value.IsUint() || rate_it->value.GetUint() < 1 ||
+                rate_it->value.GetUint() > SUB_KV_RATE_MAX) {
+                return std::nullopt;
+            }
+            out.sub.kv_rate = rate_it->value.GetUint();
+        }
+        return out;
+    }
+    else if (cmd == "hello") {
+        out.type = CmdType::Hello;
+        auto fmt_it = doc.FindMember("format");
+        if (fmt_it != doc.MemberEnd()) {
+            if (!fmt_it->value.IsString()) return std::nullopt;
+            std::string_view fmt(fmt_it->value.GetString(), fmt_it->value.GetStringLength());
+            if (fmt != "binary" && fmt != "json") return std::nullopt;
+            out.bool_value = fmt == "binary";
+        }
+        return out;
+    }
+    else if (cmd == "program") {
+        out.type = CmdType::Program;
+        if (!parse_program(doc, out.program)) return std::nullopt;
+        return out;
+    }
+    else if (cmd == "trace") {
+        out.type = CmdType::Trace;
+        auto act_it = doc.FindMember("action");
+        if (act_it == doc.MemberEnd() || !act_it->value.IsString()) return std::nullopt;
+        std::string_view act(act_it->value.GetString(), act_it->value.GetStringLength());
+        if (act == "start") out.trace = TraceAction::Start;
+        else if (act == "stop") out.trace = TraceAction::Stop;
+        else if (act != "dump") return std::nullopt;
+        return out;
+    }
     else if (cmd == "quit") {
         out.type = CmdType::Quit;
         return out;
     }
+    else if (cmd == "hr") {
+        out.type = CmdType::Hr;
+        auto bpm_it = doc.FindMember("bpm");
+        if (bpm_it == doc.MemberEnd() || !bpm_it->value.IsNumber()) return std::nullopt;
+        double bpm = bpm_it->value.GetDouble();
+        if (!(bpm >= HR_BPM_MIN && bpm <= HR_BPM_MAX)) return std::nullopt;
+        out.int_value = static_cast<int>(std::lround(bpm));
+        return out;
+    }
+    else if (cmd == "hr_zone") {
+        out.type = CmdType::HrZone;
+        if (!parse_hr_zone(doc, out.hr_zone)) return std::nullopt;
+        return out;
+    }
 
     return std::nullopt;
 }
 
+std::optional<IpcCommand> parse_command(std::string_view json) {
+    if (json.empty() || json.size() > MAX_IPC_COMMAND_LEN) return std::nullopt;
+    if (auto fast = parse_fast(json)) return fast;
+
+    std::array<char, MAX_IPC_COMMAND_LEN + 1> copy;
+    json.copy(copy.data(), json.size());
+    return parse_full(std::span<char>(copy.data(), json.size() + 1));
+}
+
+std::optional<IpcCommand> parse_command_insitu(std::span<char> buf) {
+    if (buf.size() < 2 || buf.size() - 1 > MAX_IPC_COMMAND_LEN) return std::nullopt;
+    if (auto fast = parse_fast(std::string_view(buf.data(), buf.size() - 1))) return fast;
+    return parse_full(buf);
+}
+
+// Quoted string value following `tag` (e.g. `,"key":"`), searched from
+// `from`. Empty if absent.
+static std::string_view event_field(std::string_view msg, std::string_view tag, size_t from,
+                                    size_t* end_pos) {
+    size_t pos = msg.find(tag, from);
+    if (pos == std::string_view::npos) return {};
+    size_t start = pos + tag.size();
+    size_t end = msg.find('"', start);
+    if (end == std::string_view::npos) return {};
+    *end_pos = end;
+    return msg.substr(start, end - start);
+}
+
+template <size_t N>
+static int name_index(const std::array<std::string_view, N>& names, std::string_view name) {
+    auto it = std::find(names.begin(), names.end(), name);
+    return it == names.end() ? -1 : static_cast<int>(it - names.begin());
+}
+
+static bool bus_matches(const IpcSubscription& sub, unsigned bus) {
+    return bus < 32 && (sub.buses & (1u << bus));
+}
+
+// Bus of a JSON event: the "bus" field right after the type, else 0
+static unsigned event_bus(std::string_view msg, size_t type_end) {
+    static constexpr std::string_view tag = ",\"bus\":";
+    if (msg.substr(type_end + 1, tag.size()) != tag) return 0;
+    unsigned bus = 0;
+    auto digits = msg.substr(type_end + 1 + tag.size());
+    std::from_chars(digits.data(), digits.data() + digits.size(), bus);
+    return bus;
+}
+
+// By name, so reordering SUB_TYPE_NAMES leaves the fast paths right
+constexpr uint32_t SUB_KV_BIT = sub_type_bit("kv");
+constexpr uint32_t SUB_STATUS_BIT = sub_type_bit("status");
+constexpr uint32_t SUB_FTMS_BIT = sub_type_bit("ftms");
+constexpr uint32_t SUB_CYCLE_BIT = sub_type_bit("cycle");
+static_assert(SUB_KV_BIT && SUB_STATUS_BIT && SUB_FTMS_BIT && SUB_CYCLE_BIT);
+
+bool subscription_matches(const IpcSubscription& sub, std::string_view msg) {
+    // ftms is opt-in: a types list has to name it
+    if (msg.size() >= 2 && msg.front() == static_cast<char>(EventRecord::Ftms)) {
+        return sub.types != SUB_ALL && (sub.types & SUB_FTMS_BIT) && bus_matches(sub, static_cast<uint8_t>(msg[1]));
+    }
+    if (sub.all()) return true;
+
+    // Records carry the fields at fixed offsets
+    if (msg.size() >= 4 && msg.front() == static_cast<char>(EventRecord::Status)) {
+        return (sub.types & SUB_STATUS_BIT) && bus_matches(sub, static_cast<uint8_t>(msg[3]));
+    }
+    if (msg.size() >= KV_RECORD_HEADER_SIZE && msg.front() == static_cast<char>(EventRecord::Kv)) {
+        auto source = static_cast<uint8_t>(msg[1]);
+        auto key = static_cast<uint8_t>(msg[2]);
+        return (sub.types & SUB_KV_BIT) && source < 32 && (sub.sources & (1u << source)) &&
+               key < 32 && (sub.keys & (1u << key)) && bus_matches(sub, static_cast<uint8_t>(msg[5]));
+    }
+
+    size_t pos = 0;
+    int type = name_index(SUB_TYPE_NAMES, event_field(msg, "{\"type\":\"", 0, &pos));
+    if (type < 0) return true;  // error and unfiltered types
+    uint32_t bit = 1u << type;
+    if (!(sub.types & bit)) return false;
+    if (sub.buses != SUB_ALL && !bus_matches(sub, event_bus(msg, pos))) return false;
+    bool cycle = bit == SUB_CYCLE_BIT;  // by source only
+    if ((bit != SUB_KV_BIT && !cycle) || (sub.sources == SUB_ALL && sub.keys == SUB_ALL)) return true;
+
+    int source = name_index(SUB_SOURCE_NAMES, event_field(msg, ",\"source\":\"", pos, &pos));
+    if (source < 0 || !(sub.sources & (1u << source))) return false;
+    if (cycle) return true;
+    auto key = kv_key_lookup(event_field(msg, ",\"key\":\"", pos, &pos));
+    return sub.keys & (1u << static_cast<unsigned>(key));
+}
+
 static std::string rj_to_string(rapidjson::StringBuffer& sb) {
     std::string result(sb.GetString(), sb.GetSize());
     result += '\n';
     return result;
 }
 
-std::string build_kv_event(const KvEvent& ev) {
-    rapidjson::StringBuffer sb;
-    rapidjson::Writer<rapidjson::StringBuffer> w(sb);
+namespace {
 
-    w.StartObject();
-    w.Key("type"); w.String("kv");
-    w.Key("ts"); w.Double(ev.ts);
-    w.Key("source"); w.String(ev.source.data(), static_cast<unsigned>(ev.source.size()));
-    w.Key("key"); w.String(ev.key.data(), static_cast<unsigned>(ev.key.size()));
-    w.Key("value"); w.String(ev.value.data(), static_cast<unsigned>(ev.value.size()));
-    w.EndObject();
+// Minimal JSON object writer over a fixed buffer. Produces the same bytes
+// as rapidjson::Writer (string escaping, Grisu dtoa) without allocating.
+// Overflow is sticky: finish() returns 0 if anything did not fit.
+class EventWriter {
+public:
+    explicit EventWriter(std::span<char> out) : out_(out) {}
 
-    return rj_to_string(sb);
+    void begin() { put('{'); }
+
+    // A nested object field, closed by end()
+    void object(std::string_view name) {
+        key(name);
+        put('{');
+        first_ = true;
+    }
+
+    void end() {
+        put('}');
+        first_ = false;
+    }
+
+    size_t finish() {
+        put('}');
+        put('\n');
+        return overflow_ ? 0 : pos_;
+    }
+
+    void field(std::string_view name, std::string_view val) { key(name); quoted(val); }
+    void field(std::string_view name, bool val) { key(name); raw(val ? "true" : "false"); }
+    void field(std::string_view name, int val) { key(name); integer(val); }
+    void field(std::string_view name, uint32_t val) { key(name); integer(val); }
+    void field(std::string_view name, uint64_t val) { key(name); integer(val); }
+    void field(std::string_view name, int64_t val) { key(name); integer(val); }
+    void field(std::string_view name, const char* val) = delete;  // would bind to bool
+
+    template <typename T>
+    void field(std::string_view name, std::span<const T> vals) {
+        key(name);
+        put('[');
+        for (size_t i = 0; i < vals.size(); i++) {
+            if (i) put(',');
+            integer(vals[i]);
+        }
+        put(']');
+    }
+
+    void field(std::string_view name, std::span<const std::string_view> vals) {
+        key(name);
+        put('[');
+        for (size_t i = 0; i < vals.size(); i++) {
+            if (i) put(',');
+            quoted(vals[i]);
+        }
+        put(']');
+    }
+
+    void field(std::string_view name, double val) {
+        key(name);
+        if (rapidjson::internal::Double(val).IsNanOrInf()) {
+            raw("null");
+            return;
+        }
+        std::array<char, 32> buf;
+        char* end = rapidjson::internal::dtoa(val, buf.data());
+        raw(std::string_view(buf.data(), static_cast<size_t>(end - buf.data())));
+    }
+
+private:
+    void put(char c) {
+        if (pos_ < out_.size()) out_[pos_++] = c;
+        else overflow_ = true;
+    }
+
+    void raw(std::string_view s) {
+        if (s.size() > out_.size() - pos_) { overflow_ = true; return; }
+        s.copy(out_.data() + pos_, s.size());
+        pos_ += s.size();
+    }
+
+    template <typename T>
+    void integer(T val) {
+        std::array<char, 24> buf;
+        auto [ptr, ec] = std::to_chars(buf.data(), buf.data() + buf.size(), val);
+        raw(std::string_view(buf.data(), static_cast<size_t>(ptr - buf.data())));
+    }
+
+    void key(std::string_view name) {
+        if (!first_) put(',');
+        first_ = false;
+        quoted(name);
+        put(':');
+    }
+
+    void quoted(std::string_view s) {
+        static constexpr char hex[] = "0123456789ABCDEF";
+        put('"');
+        for (char ch : s) {
+            auto c = static_cast<unsigned char>(ch);
+            if (c == '"' || c == '\\') { put('\\'); put(ch); }
+            else if (c == '\b') { put('\\'); put('b'); }
+            else if (c == '\f') { put('\\'); put('f'); }
+            else if (c == '\n') { put('\\'); put('n'); }
+            else if (c == '\r') { put('\\'); put('r'); }
+            else if (c == '\t') { put('\\'); put('t'); }
+            else if (c < 0x20) {
+                raw("\\u00");
+                put(hex[c >> 4]);
+                put(hex[c & 0xF]);
+            }
+            else put(ch);
+        }
+        put('"');
+    }
+
+    std::span<char> out_;
+    size_t pos_ = 0;
+    bool first_ = true;
+    bool overflow_ = false;
+};
+
+// Large enough for any KvEvent (fields are at most KV_FIELD_SIZE, fully escaped)
+constexpr size_t EVENT_BUF_SIZE = 1024;
+
+}  // namespace
+
+size_t format_kv_event(std::span<char> out, const KvEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("kv"));
+    if (ev.bus != 0) w.field("bus", static_cast<int>(ev.bus));
+    w.field("ts", ev.ts);
+    w.field("source", ev.source);
+    w.field("key", ev.key);
+    w.field("value", ev.value);
+    return w.finish();
+}
+
+size_t format_status_event(std::span<char> out, const StatusEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("status"));
+    if (ev.bus != 0) w.field("bus", static_cast<int>(ev.bus));
+    w.field("proxy", ev.proxy);
+    w.field("emulate", ev.emulate);
+    if (ev.overlay) w.field("overlay", true);
+    w.field("emu_speed", ev.emu_speed);
+    w.field("emu_incline", ev.emu_incline);
+    w.field("bus_speed", ev.bus_speed);
+    w.field("bus_incline", ev.bus_incline);
+    w.field("console_bytes", ev.console_bytes);
+    w.field("motor_bytes", ev.motor_bytes);
+    w.field("console_dropped", ev.console_dropped);
+    w.field("motor_dropped", ev.motor_dropped);
+    w.field("distance_mi", ev.distance_mi);
+    w.field("vert_ft", ev.vert_ft);
+    w.field("belt_on_ms", ev.belt_on_ms);
+    w.field("generation", ev.generation);
+    return w.finish();
+}
+
+FtmsEvent make_ftms_event(int speed_tenths, int incline_half_pct, double distance_mi, uint64_t belt_on_ms) {
+    constexpr double KMH_PER_MPH = 1.609344;
+    constexpr double METERS_PER_MILE = 1609.344;
+    FtmsEvent ev{};
+    // tenths mph -> hundredths km/h; half-pct -> tenths of a percent
+    double kmh = std::round(std::max(speed_tenths, 0) * KMH_PER_MPH * 10.0);
+    ev.speed = static_cast<uint16_t>(std::min(kmh, static_cast<double>(UINT16_MAX)));
+    ev.incline = static_cast<int16_t>(std::clamp(incline_half_pct, 0, INT16_MAX / 5) * 5);
+    ev.distance_m = static_cast<uint32_t>(std::clamp(distance_mi * METERS_PER_MILE, 0.0,
+                                                     static_cast<double>(UINT32_MAX)));
+    ev.elapsed_s = static_cast<uint16_t>(std::min<uint64_t>(belt_on_ms / 1000, UINT16_MAX));
+    return ev;
+}
+
+size_t format_ftms_event(std::span<char> out, const FtmsEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("ftms"));
+    if (ev.bus != 0) w.field("bus", static_cast<int>(ev.bus));
+    w.field("ts", ev.ts);
+    w.field("speed", static_cast<int>(ev.speed));
+    w.field("incline", static_cast<int>(ev.incline));
+    w.field("distance_m", ev.distance_m);
+    w.field("elapsed_s", static_cast<int>(ev.elapsed_s));
+    return w.finish();
+}
+
+size_t format_emu_stats_event(std::span<char> out, const EmuStatsEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("emu_stats"));
+    w.field("cycles", ev.cycles);
+    w.field("overruns", ev.overruns);
+    w.field("target_us", ev.target_us);
+    w.field("mean_us", ev.mean_us);
+    w.field("p99_us", ev.p99_us);
+    w.field("max_us", ev.max_us);
+    w.field("injected", ev.injected);
+    w.field("timeouts", ev.timeouts);
+    return w.finish();
+}
+
+size_t format_program_event(std::span<char> out, const ProgramEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("program"));
+    w.field("state", ev.state);
+    w.field("segment", ev.segment);
+    w.field("segments", ev.segments);
+    w.field("elapsed_ms", ev.elapsed_ms);
+    w.field("segment_remaining_ms", ev.segment_remaining_ms);
+    w.field("total_ms", ev.total_ms);
+    w.field("speed", ev.speed);
+    w.field("incline", ev.incline);
+    return w.finish();
+}
+
+size_t format_hr_zone_event(std::span<char> out, const HrZoneEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("hr_zone"));
+    w.field("state", ev.state);
+    w.field("control", ev.control);
+    w.field("hr", ev.hr);
+    w.field("low", ev.low);
+    w.field("high", ev.high);
+    w.field("target", ev.target);
+    w.field("steps", ev.steps);
+    return w.finish();
+}
+
+size_t format_histogram_event(std::span<char> out, const HistogramEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("metrics"));
+    w.field("name", ev.name);
+    w.field("count", ev.count);
+    w.field("mean_us", ev.mean_us);
+    w.field("p50_us", ev.p50_us);
+    w.field("p99_us", ev.p99_us);
+    w.field("max_us", ev.max_us);
+    return w.finish();
+}
+
+size_t format_client_lag_event(std::span<char> out, const ClientLagEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("metrics"));
+    w.field("name", std::string_view("client"));
+    w.field("fd", ev.fd);
+    w.field("lag_msgs", ev.lag_msgs);
+    w.field("max_lag_msgs", ev.max_lag_msgs);
+    w.field("queued_bytes", ev.queued_bytes);
+    w.field("lost_msgs", ev.lost_msgs);
+    w.field("gaps", ev.gaps);
+    w.field("sent_bytes", ev.sent_bytes);
+    return w.finish();
+}
+
+size_t format_query_metrics_event(std::span<char> out, const QueryMetricsEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("metrics"));
+    w.field("name", std::string_view("query"));
+    w.field("key", ev.key);
+    w.field("count", ev.count);
+    w.field("mean_us", ev.mean_us);
+    w.field("p50_us", ev.p50_us);
+    w.field("p99_us", ev.p99_us);
+    w.field("max_us", ev.max_us);
+    w.field("sent", ev.sent);
+    w.field("missing", ev.missing);
+    w.field("stalls", ev.stalls);
+    return w.finish();
+}
+
+size_t format_bus_metrics_event(std::span<char> out, const BusMetricsEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("metrics"));
+    w.field("name", std::string_view("bus"));
+    w.field("source", ev.source);
+    w.field("bytes", ev.bytes);
+    w.field("frames", ev.frames);
+    w.field("nonprintable", ev.nonprintable);
+    w.field("bad_length", ev.bad_length);
+    w.field("stray_bytes", ev.stray_bytes);
+    w.field("overflow_bytes", ev.overflow_bytes);
+    w.field("skipped", ev.skipped);
+    return w.finish();
+}
+
+size_t format_bus_stats_event(std::span<char> out, const BusStatsEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("bus_stats"));
+    w.field("window_ms", ev.window_ms);
+    w.field("console_bps", ev.console_bps);
+    w.field("console_idle_pct", ev.console_idle_pct);
+    w.field("motor_bps", ev.motor_bps);
+    w.field("motor_idle_pct", ev.motor_idle_pct);
+    w.field("cycles", ev.cycles);
+    w.field("cycle_us", ev.cycle_us);
+    w.field("cycle_min_us", ev.cycle_min_us);
+    w.field("cycle_max_us", ev.cycle_max_us);
+    w.field("gap_us", ev.gap_us);
+    w.field("gap_max_us", ev.gap_max_us);
+    return w.finish();
+}
+
+// Flat fields per window: "count_1s", "min_1s", "max_1s", "mean_1s", ...
+size_t format_stats_event(std::span<char> out, const StatsEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("stats"));
+    w.field("key", ev.key);
+    for (const auto& win : ev.windows) {
+        std::array<char, 24> name;
+        auto named = [&](std::string_view prefix) {
+            prefix.copy(name.data(), prefix.size());
+            auto [end, ec] = std::to_chars(name.data() + prefix.size(), name.data() + name.size() - 1, win.seconds);
+            (void)ec;  // a u32 always fits
+            *end++ = 's';
+            return std::string_view(name.data(), static_cast<size_t>(end - name.data()));
+        };
+        w.field(named("count_"), win.count);
+        w.field(named("min_"), win.min);
+        w.field(named("max_"), win.max);
+        w.field(named("mean_"), win.mean);
+    }
+    return w.finish();
+}
+
+size_t format_cycle_event(std::span<char> out, const CycleEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("cycle"));
+    w.field("ts", ev.ts);
+    w.field("source", ev.source);
+    w.field("count", static_cast<uint64_t>(ev.keys.size()));
+    w.field("keys", ev.keys);
+    w.field("values", ev.values);
+    w.field("dt_us", ev.dt_us);
+    return w.finish();
+}
+
+size_t format_query_stall_event(std::span<char> out, const QueryStallEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("stall"));
+    w.field("key", ev.key);
+    w.field("stalled", ev.stalled);
+    w.field("waited_ms", ev.waited_ms);
+    w.field("missing", ev.missing);
+    return w.finish();
+}
+
+size_t tag_event_bus(std::span<char> out, size_t len, int bus) {
+    if (bus == 0) return len;
+    std::string_view msg(out.data(), len);
+    static constexpr std::string_view type_tag = "{\"type\":\"";
+    if (!msg.starts_with(type_tag)) return 0;
+    size_t at = msg.find('"', type_tag.size());
+    if (at == std::string_view::npos) return 0;
+    at++;
+
+    std::array<char, 24> tag;
+    static constexpr std::string_view bus_tag = ",\"bus\":";
+    bus_tag.copy(tag.data(), bus_tag.size());
+    auto [end, ec] = std::to_chars(tag.data() + bus_tag.size(), tag.data() + tag.size(), bus);
+    size_t n = static_cast<size_t>(end - tag.data());
+    if (ec != std::errc{} || len + n > out.size()) return 0;
+    std::memmove(out.data() + at + n, out.data() + at, len - at);
+    std::memcpy(out.data() + at, tag.data(), n);
+    return len + n;
+}
+
+std::string build_kv_event(const KvEvent& ev) {
+    std::array<char, EVENT_BUF_SIZE> buf;
+    return std::string(buf.data(), format_kv_event(buf, ev));
 }
 
 std::string build_status_event(const StatusEvent& ev) {
-    rapidjson::StringBuffer sb;
-    rapidjson::Writer<rapidjson::StringBuffer> w(sb);
+    std::array<char, EVENT_BUF_SIZE> buf;
+    return std::string(buf.data(), format_status_event(buf, ev));
+}
 
-    w.StartObject();
-    w.Key("type"); w.String("status");
-    w.Key("proxy"); w.Bool(ev.proxy);
-    w.Key("emulate"); w.Bool(ev.emulate);
-    w.Key("emu_speed"); w.Int(ev.emu_speed);
-    w.Key("emu_incline"); w.Int(ev.emu_incline);
-    w.Key("bus_speed"); w.Int(ev.bus_speed);
-    w.Key("bus_incline"); w.Int(ev.bus_incline);
-    w.Key("console_bytes"); w.Uint(ev.console_bytes);
-    w.Key("motor_bytes"); w.Uint(ev.motor_bytes);
-    w.EndObject();
+size_t format_hello_event(std::span<char> out, bool binary) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("hello"));
+    w.field("format", std::string_view(binary ? "binary" : "json"));
+    w.field("version", BINARY_FRAMING_VERSION);
+    return w.finish();
+}
 
-    return rj_to_string(sb);
+size_t format_mailbox_event(std::span<char> out, uint32_t slots) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("mailbox"));
+    w.field("slots", slots);
+    return w.finish();
+}
+
+size_t format_trace_event(std::span<char> out, const TraceEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("trace"));
+    w.field("recording", ev.recording);
+    if (ev.dumped) {
+        w.field("spans", ev.spans);
+        w.field("path", ev.path);
+    }
+    return w.finish();
+}
+
+size_t format_ack_event(std::span<char> out, const AckEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("ack"));
+    w.field("seq", ev.seq);
+    w.field("stage", ev.stage);
+    if (!ev.key.empty()) {
+        w.field("key", ev.key);
+        w.field("value", ev.value);
+    }
+    if (ev.stage == "motor") {
+        w.field("sent_us", ev.sent_us);
+        w.field("echo_us", ev.echo_us);
+    }
+    return w.finish();
+}
+
+size_t format_gap_event(std::span<char> out, uint64_t dropped) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("gap"));
+    w.field("dropped", dropped);
+    return w.finish();
+}
+
+size_t format_snapshot_event(std::span<char> out, const SnapshotEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("snapshot"));
+    if (ev.bus != 0) w.field("bus", static_cast<int>(ev.bus));
+    w.field("ts", ev.ts);
+    for (size_t s = 0; s < SUB_SOURCE_NAMES.size(); s++) {
+        w.object(SUB_SOURCE_NAMES.at(s));
+        for (size_t k = 1; k < KV_KEY_NAMES.size(); k++) {
+            auto value = ev.values.at(s).at(k);
+            if (!value.empty()) w.field(KV_KEY_NAMES.at(k), value);
+        }
+        w.end();
+    }
+    return w.finish();
+}
+
+size_t format_history_event(std::span<char> out, const HistoryEvent& ev) {
+    EventWriter w(out);
+    w.begin();
+    w.field("type", std::string_view("history"));
+    if (ev.bus != 0) w.field("bus", static_cast<int>(ev.bus));
+    w.field("from", ev.from);
+    w.field("step", ev.step);
+    w.field("count", static_cast<uint64_t>(ev.speed.size()));
+    w.field("speed", ev.speed);
+    w.field("incline", ev.incline);
+    w.field("amps", ev.amps);
+    return w.finish();
+}
+
+// --- Binary records ---
+
+static_assert(std::endian::native == std::endian::little,
+              "binary records are copied with memcpy: little-endian hosts only");
+
+namespace {
+
+// Fixed-offset field access over a byte span
+template <typename T>
+void put_at(std::span<char> out, size_t off, T val) {
+    std::memcpy(out.data() + off, &val, sizeof(T));
+}
+
+template <typename T>
+T get_at(std::string_view rec, size_t off) {
+    T val;
+    std::memcpy(&val, rec.data() + off, sizeof(T));
+    return val;
+}
+
+}  // namespace
+
+size_t format_kv_record(std::span<char> out, const KvEvent& ev) {
+    auto src = std::find(SUB_SOURCE_NAMES.begin(), SUB_SOURCE_NAMES.end(), ev.source);
+    if (src == SUB_SOURCE_NAMES.end()) return 0;
+    KvKey id = kv_key_lookup(ev.key);
+    std::string_view key = id == KvKey::Unknown ? ev.key : std::string_view{};
+    if (key.size() > 255 || ev.value.size() > 255) return 0;
+    size_t len = KV_RECORD_HEADER_SIZE + key.size() + ev.value.size();
+    if (len > out.size()) return 0;
+
+    std::fill_n(out.data(), KV_RECORD_HEADER_SIZE, 0);
+    out[0] = static_cast<char>(EventRecord::Kv);
+    out[1] = static_cast<char>(src - SUB_SOURCE_NAMES.begin());
+    out[2] = static_cast<char>(id);
+    out[3] = static_cast<char>(key.size());
+    out[4] = static_cast<char>(ev.value.size());
+    out[5] = static_cast<char>(ev.bus);
+    put_at(out, 8, ev.ts);
+    key.copy(out.data() + KV_RECORD_HEADER_SIZE, key.size());
+    ev.value.copy(out.data() + KV_RECORD_HEADER_SIZE + key.size(), ev.value.size());
+    return len;
+}
+
+size_t format_status_record(std::span<char> out, const StatusEvent& ev) {
+    if (out.size() < STATUS_RECORD_SIZE) return 0;
+    out[0] = static_cast<char>(EventRecord::Status);
+    out[1] = static_cast<char>(ev.proxy);
+    out[2] = static_cast<char>(ev.emulate);
+    out[3] = static_cast<char>(ev.bus);
+    put_at<int32_t>(out, 4, ev.emu_speed);
+    put_at<int32_t>(out, 8, ev.emu_incline);
+    put_at<int32_t>(out, 12, ev.bus_speed);
+    put_at<int32_t>(out, 16, ev.bus_incline);
+    put_at<uint32_t>(out, 20, ev.console_bytes);
+    put_at<uint32_t>(out, 24, ev.motor_bytes);
+    put_at<uint64_t>(out, 28, ev.console_dropped);
+    put_at<uint64_t>(out, 36, ev.motor_dropped);
+    put_at<double>(out, 44, ev.distance_mi);
+    put_at<double>(out, 52, ev.vert_ft);
+    put_at<uint64_t>(out, 60, ev.belt_on_ms);
+    out[68] = static_cast<char>(ev.overlay);
+    put_at<uint32_t>(out, 69, ev.generation);
+    return STATUS_RECORD_SIZE;
+}
+
+size_t format_ftms_record(std::span<char> out, const FtmsEvent& ev) {
+    if (out.size() < FTMS_RECORD_SIZE) return 0;
+    out[0] = static_cast<char>(EventRecord::Ftms);
+    out[1] = static_cast<char>(ev.bus);
+    put_at<uint16_t>(out, 2, ev.speed);
+    put_at<int16_t>(out, 4, ev.incline);
+    put_at<uint16_t>(out, 6, ev.elapsed_s);
+    put_at<uint32_t>(out, 8, ev.distance_m);
+    put_at<double>(out, 12, ev.ts);
+    return FTMS_RECORD_SIZE;
+}
+
+std::optional<KvEvent> parse_kv_record(std::string_view rec) {
+    if (rec.size() < KV_RECORD_HEADER_SIZE || rec[0] != static_cast<char>(EventRecord::Kv)) {
+        return std::nullopt;
+    }
+    auto source = static_cast<uint8_t>(rec[1]);
+    auto id = static_cast<uint8_t>(rec[2]);
+    size_t key_len = static_cast<uint8_t>(rec[3]);
+    size_t value_len = static_cast<uint8_t>(rec[4]);
+    if (source >= SUB_SOURCE_NAMES.size() || id >= KV_KEY_NAMES.size() ||
+        rec.size() != KV_RECORD_HEADER_SIZE + key_len + value_len) {
+        return std::nullopt;
+    }
+    std::string_view key = id ? kv_key_name(static_cast<KvKey>(id))
+                              : rec.substr(KV_RECORD_HEADER_SIZE, key_len);
+    return KvEvent{ SUB_SOURCE_NAMES.at(source), key,
+                    rec.substr(KV_RECORD_HEADER_SIZE + key_len, value_len), get_at<double>(rec, 8),
+                    static_cast<uint8_t>(rec[5]) };
+}
+
+std::optional<StatusEvent> parse_status_record(std::string_view rec) {
+    if (rec.size() != STATUS_RECORD_SIZE || rec[0] != static_cast<char>(EventRecord::Status)) {
+        return std::nullopt;
+    }
+    return StatusEvent{ rec[1] != 0, rec[2] != 0,
+                        get_at<int32_t>(rec, 4), get_at<int32_t>(rec, 8),
+                        get_at<int32_t>(rec, 12), get_at<int32_t>(rec, 16),
+                        get_at<uint32_t>(rec, 20), get_at<uint32_t>(rec, 24),
+                        get_at<uint64_t>(rec, 28), get_at<uint64_t>(rec, 36),
+                        get_at<double>(rec, 44), get_at<double>(rec, 52), get_at<uint64_t>(rec, 60),
+                        static_cast<uint8_t>(rec[3]), rec[68] != 0, get_at<uint32_t>(rec, 69) };
+}
+
+std::optional<FtmsEvent> parse_ftms_record(std::string_view rec) {
+    if (rec.size() != FTMS_RECORD_SIZE || rec[0] != static_cast<char>(EventRecord::Ftms)) {
+        return std::nullopt;
+    }
+    return FtmsEvent{ get_at<uint16_t>(rec, 2), get_at<int16_t>(rec, 4), get_at<uint32_t>(rec, 8),
+                      get_at<uint16_t>(rec, 6), static_cast<uint8_t>(rec[1]), get_at<double>(rec, 12) };
+}
+
+size_t ring_message_to_json(std::span<char> out, std::string_view msg) {
+    if (msg.empty()) return 0;
+    switch (static_cast<EventRecord>(msg.front())) {
+        case EventRecord::Kv:
+            if (auto ev = parse_kv_record(msg)) return format_kv_event(out, *ev);
+            return 0;
+        case EventRecord::Status:
+            if (auto ev = parse_status_record(msg)) return format_status_event(out, *ev);
+            return 0;
+        case EventRecord::Ftms:
+            if (auto ev = parse_ftms_record(msg)) return format_ftms_event(out, *ev);
+            return 0;
+        case EventRecord::Json:
+            break;
+    }
+    // JSON text (already newline-terminated)
+    if (msg.size() > out.size()) return 0;
+    msg.copy(out.data(), msg.size());
+    return msg.size();
+}
+
+size_t ring_message_to_frame(std::span<char> out, std::string_view msg) {
+    if (msg.empty()) return 0;
+    auto tag = static_cast<EventRecord>(msg.front());
+    bool record = tag == EventRecord::Kv || tag == EventRecord::Status || tag == EventRecord::Ftms;
+    if (!record && msg.back() == '\n') msg.remove_suffix(1);
+    size_t len = (record ? 0 : 1) + msg.size();
+    if (BINARY_FRAME_HEADER_SIZE + len > out.size() || len > UINT16_MAX) return 0;
+
+    put_at<uint16_t>(out, 0, static_cast<uint16_t>(len));
+    size_t pos = BINARY_FRAME_HEADER_SIZE;
+    if (!record) out[pos++] = static_cast<char>(EventRecord::Json);
+    msg.copy(out.data() + pos, msg.size());
+    return BINARY_FRAME_HEADER_SIZE + len;
 }
 
 std::string build_error_event(std::string_view msg) {
@@ -10,8 +10,12 @@
 
 #include <cstdint>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
+#include <array>
+#include "mode_state.h"
+#include "kv_protocol.h"
 
 // --- Inbound commands (Python -> C++) ---
 
@@ -20,27 +24,175 @@ enum class CmdType : uint8_t {
     Incline,
     Emulate,
     Proxy,
+    Overlay,
     Status,
     Heartbeat,
+    Stats,
+    Metrics,
+    Subscribe,
+    Hello,
+    Program,
     Quit,
+    Batch,
+    Trace,
+    Hr,
+    HrZone,
+    Snapshot,
+    History,
+    Mailbox,
     Unknown
 };
 
+// {"cmd":"trace","action":"start"|"stop"|"dump"}: the thread timeline
+// recorder (trace.h). dump writes the file named in gpio.json.
+enum class TraceAction : uint8_t { Start, Stop, Dump };
+
+// Buses one process can host (see bus_host.h). Commands name theirs with
+// a "bus" field (default 0); events from bus N > 0 carry "bus":N right
+// after "type", so single-bus output is unchanged.
+constexpr int MAX_BUSES = 4;
+
+// Per-client event filter from the `subscribe` command. One bit per name
+// in the matching table; an omitted list means everything. Filters on
+// source and key apply to kv events only (source to cycle events too).
+// Error events, and any type not in SUB_TYPE_NAMES, are always delivered.
+// "ftms" is the exception the other way: only a types list naming it gets
+// ftms events.
+static constexpr std::array<std::string_view, 11> SUB_TYPE_NAMES = { "kv", "status", "emu_stats", "metrics",
+                                                                     "program", "stall", "bus_stats", "ftms",
+                                                                     "hr_zone", "stats", "cycle" };
+static constexpr std::array<std::string_view, 3> SUB_SOURCE_NAMES = { "console", "motor", "emulate" };
+static constexpr uint32_t SUB_ALL = ~0u;
+
+// IpcSubscription::types bit of a SUB_TYPE_NAMES entry, or 0
+constexpr uint32_t sub_type_bit(std::string_view name) {
+    for (size_t i = 0; i < SUB_TYPE_NAMES.size(); i++) {
+        if (SUB_TYPE_NAMES.at(i) == name) return 1u << i;
+    }
+    return 0;
+}
+constexpr uint32_t SUB_KV_RATE_MAX = 100;  // "kv_rate" limit, updates/s
+
+struct IpcSubscription {
+    uint32_t types = SUB_ALL;    // bit i = SUB_TYPE_NAMES[i]
+    uint32_t sources = SUB_ALL;  // bit i = SUB_SOURCE_NAMES[i]
+    uint32_t keys = SUB_ALL;     // bit i = KvKey(i); bit 0 = keys outside KV_KEY_NAMES
+    uint32_t buses = SUB_ALL;    // bit i = bus i; applies to every filtered type
+    // kv events per second per (bus, source, key), later values replacing
+    // ones not yet sent; 0 = every event (ipc_server.h)
+    uint32_t kv_rate = 0;
+
+    bool all() const {
+        return types == SUB_ALL && sources == SUB_ALL && keys == SUB_ALL && buses == SUB_ALL;
+    }
+};
+
+// Program upload from the `program` command:
+//   {"cmd":"program","segments":[[60,3.0,1],[120,6.5,2.5,1],...]}
+// Each segment is [seconds, mph, incline %, ramp (optional 0/1)].
+// {"cmd":"program","action":"stop"|"pause"|"resume"} controls a running one.
+constexpr int PROGRAM_MAX_SEGMENTS = 128;
+constexpr uint32_t PROGRAM_MAX_SEGMENT_MS = 24 * 3600 * 1000;
+
+struct ProgramSegment {
+    uint32_t duration_ms;
+    int16_t speed_tenths;   // 0-MAX_SPEED_TENTHS
+    int16_t incline;        // half-pct units, 0-MAX_INCLINE
+    bool ramp;              // linear from the previous target over the segment
+};
+
+enum class ProgramAction : uint8_t { Start, Stop, Pause, Resume };
+
+struct ProgramSpec {
+    ProgramAction action = ProgramAction::Start;
+    uint8_t count = 0;
+    std::array<ProgramSegment, PROGRAM_MAX_SEGMENTS> segments{};
+};
+
+// Heart-rate zone control (hr_zone.h):
+//   {"cmd":"hr","bpm":142}   a heart-rate sample, HR_BPM_MIN to HR_BPM_MAX
+//   {"cmd":"hr_zone","low":130,"high":145,"control":"speed","min":2.0,"max":6.0}
+//   {"cmd":"hr_zone","action":"stop"}
+// "control" is "speed" (min/max/"step" in mph, step default 0.1) or
+// "incline" (percent, step default 0.5). Optional "interval" (seconds
+// between steps, default 10) and "hr_max" (bpm at which the belt goes
+// straight to min).
+constexpr int HR_BPM_MIN = 30;
+constexpr int HR_BPM_MAX = 250;
+constexpr uint32_t HR_ZONE_INTERVAL_MS = 10000;
+constexpr uint32_t HR_ZONE_INTERVAL_MIN_MS = 2000;
+constexpr uint32_t HR_ZONE_INTERVAL_MAX_MS = 120000;
+
+enum class HrControl : uint8_t { Speed, Incline };
+
+struct HrZoneSpec {
+    bool stop = false;
+    HrControl control = HrControl::Speed;
+    int low = 0;              // target band, bpm
+    int high = 0;
+    int min = 0;              // bounds and step: tenths mph or half-pct
+    int max = 0;
+    int step = 1;
+    uint32_t interval_ms = HR_ZONE_INTERVAL_MS;
+    int hr_max = 0;           // 0 = no ceiling
+};
+
+// {"cmd":"history","from":0,"to":600,"step":5}: the bus history (history.h)
+// over [from, to) in seconds since start, averaged per step seconds. All
+// optional: from the start, to now, step 1.
+struct HistoryQuery {
+    uint32_t from = 0;
+    uint32_t to = UINT32_MAX;  // now
+    uint32_t step = 1;
+};
+
+// Mode commands sent together, applied atomically (ModeStateMachine::apply)
+// and answered with one status event:
+//   {"cmd":"batch","commands":[{"cmd":"emulate","enabled":true},{"cmd":"speed","value":3.0}]}
+// Entries are emulate, proxy, overlay, speed or incline, without a "bus" of
+// their own (the batch's applies).
+constexpr int IPC_BATCH_MAX = 8;
+
 struct IpcCommand {
     CmdType type = CmdType::Unknown;
     double float_value = 0.0;   // speed in mph
     int int_value = 0;          // incline value
-    bool bool_value = false;    // emulate/proxy enabled
+    bool bool_value = false;    // emulate/proxy/overlay enabled; hello: binary framing
+    IpcSubscription sub;        // subscribe filter
+    ProgramSpec program;        // program upload / control
+    HrZoneSpec hr_zone;         // hr_zone start / stop; hr: int_value = bpm
+    std::array<ModeStep, IPC_BATCH_MAX> batch{};  // batch: steps in order
+    uint8_t batch_count = 0;
+    TraceAction trace = TraceAction::Dump;
+    HistoryQuery history;
+    int bus = 0;                // target bus, 0 to MAX_BUSES - 1
+    uint32_t seq = 0;           // client "seq", acked if has_seq (ack_tracker.h)
+    bool has_seq = false;
 };
 
-static constexpr size_t MAX_IPC_COMMAND_LEN = 1024;
+static constexpr size_t MAX_IPC_COMMAND_LEN = 4096;  // fits a full program upload
 
 /*
  * Parse a JSON command string into a typed IpcCommand.
  * Returns the parsed command, or std::nullopt on failure.
+ *
+ * No heap allocation: heartbeat, speed and incline in the compact form
+ * treadmill_client.py sends are matched directly, and everything else is
+ * parsed on a DOM held in fixed stack buffers.
  */
 std::optional<IpcCommand> parse_command(std::string_view json);
 
+// parse_command() in place: `buf` is the command followed by one spare
+// byte (e.g. its newline), which is overwritten. The command text may be
+// modified. Saves parse_command()'s copy.
+std::optional<IpcCommand> parse_command_insitu(std::span<char> buf);
+
+/*
+ * True if a formatted event line passes the filter. Reads only the type,
+ * source and key fields, which the format_* functions put first.
+ */
+bool subscription_matches(const IpcSubscription& sub, std::string_view msg);
+
 // --- Outbound events (C++ -> Python) ---
 
 struct KvEvent {
@@ -48,6 +200,7 @@ struct KvEvent {
     std::string_view key;
     std::string_view value;
     double ts;
+    uint8_t bus = 0;
 };
 
 struct StatusEvent {
@@ -59,11 +212,336 @@ struct StatusEvent {
     int bus_incline;    // motor incline in half-pct units (1=0.5%), -1 if unknown
     uint32_t console_bytes;
     uint32_t motor_bytes;
+    uint64_t console_dropped;  // bytes lost to parse-buffer overflow
+    uint64_t motor_dropped;
+    double distance_mi;     // bus-rate odometry since start (see odometer.h)
+    double vert_ft;
+    uint64_t belt_on_ms;
+    uint8_t bus = 0;
+    bool overlay = false;   // console stream forwarded with the targets written in
+    uint32_t generation = 0;  // ModeStateMachine::generation(): same = same mode and targets
+};
+
+// Treadmill data in the units of the Bluetooth FTMS characteristic
+// (0x2ACD), from the motor's decoded speed/incline and the odometer, so
+// ftms-daemon copies the fields into its notifications as they are
+struct FtmsEvent {
+    uint16_t speed;       // 0.01 km/h
+    int16_t incline;      // 0.1 %
+    uint32_t distance_m;  // odometer distance
+    uint16_t elapsed_s;   // odometer belt-on time, saturating
+    uint8_t bus = 0;
+    double ts = 0;        // motor report time (seconds since start)
+
+    // Same notification content; ts and bus aside
+    bool same_data(const FtmsEvent& o) const {
+        return speed == o.speed && incline == o.incline && distance_m == o.distance_m &&
+               elapsed_s == o.elapsed_s;
+    }
+};
+
+// Bus speed (tenths mph) and incline (half-pct), -1 if unknown, plus
+// odometer totals as FTMS fields. Unknown reads as stopped / flat.
+FtmsEvent make_ftms_event(int speed_tenths, int incline_half_pct, double distance_mi, uint64_t belt_on_ms);
+
+// Emulate cycle timing (all durations in microseconds)
+struct EmuStatsEvent {
+    uint64_t cycles;
+    uint64_t overruns;   // bursts started more than EMU_OVERRUN_US late
+    int target_us;       // configured cycle period
+    double mean_us;
+    int p99_us;          // over the most recent cycles
+    int max_us;
+    uint64_t injected;   // out-of-cycle inc/hmph bursts after a change
+    uint64_t timeouts;   // paced: bursts sent with the last one's answers missing
+};
+
+// Program progress (speed/incline in the status units: tenths, half-pct)
+struct ProgramEvent {
+    std::string_view state;   // running, paused, finished, stopped
+    int segment;              // current segment index
+    int segments;
+    uint64_t elapsed_ms;      // program time, excluding pauses
+    uint64_t segment_remaining_ms;
+    uint64_t total_ms;
+    int speed;                // current target
+    int incline;
+};
+
+// HR zone controller state: on every step or state change, and once a
+// second while running
+struct HrZoneEvent {
+    std::string_view state;   // running, no_hr, limit, stopped
+    std::string_view control; // speed, incline
+    int hr;                   // last sample, 0 if none yet
+    int low;
+    int high;
+    int target;               // current target, tenths mph or half-pct
+    uint32_t steps;           // adjustments made since start
+};
+
+// One latency histogram from the `metrics` command (microseconds)
+struct HistogramEvent {
+    std::string_view name;  // e.g. "proxy_us"
+    uint64_t count;
+    double mean_us;
+    uint64_t p50_us;
+    uint64_t p99_us;
+    uint64_t max_us;
+};
+
+// One motor query key's round trips from the `metrics` command
+struct QueryMetricsEvent {
+    std::string_view key;   // e.g. "amps"
+    uint64_t count;         // answered queries (histogram samples)
+    double mean_us;
+    uint64_t p50_us;
+    uint64_t p99_us;
+    uint64_t max_us;
+    uint64_t sent;
+    uint64_t missing;       // superseded before an answer arrived
+    uint64_t stalls;
+};
+
+// Line quality of one reader (KvParseStats)
+struct BusMetricsEvent {
+    std::string_view source;  // "console" or "motor"
+    uint64_t bytes;
+    uint64_t frames;
+    uint64_t nonprintable;
+    uint64_t bad_length;
+    uint64_t stray_bytes;
+    uint64_t overflow_bytes;
+    uint64_t skipped;         // frames not parsed: nobody wanted their key
+};
+
+// Periodic bus analysis (bus_analyzer.h): line use per direction over the
+// window, and the console's cycle period and gap before each burst
+// (BURSTS order) from proxied traffic; cycle and gap times are 0 when no
+// full sequence was seen
+struct BusStatsEvent {
+    uint64_t window_ms;
+    double console_bps;
+    double console_idle_pct;
+    double motor_bps;
+    double motor_idle_pct;
+    uint32_t cycles;
+    uint64_t cycle_us;
+    uint64_t cycle_min_us;
+    uint64_t cycle_max_us;
+    std::span<const uint64_t> gap_us;      // mean, one per burst
+    std::span<const uint64_t> gap_max_us;
+};
+
+// Rolling aggregates of one motor report key (motor_stats.h), in wire
+// units, one entry per window (1, 10 and 60 s); count 0 = no reports
+struct StatsWindowEvent {
+    uint32_t seconds;
+    uint32_t count;
+    int64_t min;
+    int64_t max;
+    double mean;
+};
+
+struct StatsEvent {
+    std::string_view key;  // "amps", "vbus" or "belt"
+    std::span<const StatsWindowEvent> windows;
+};
+
+// One bus cycle of one source (kv_cycle_buffer.h), with "events":
+// {"cycles": true}:
+//   {"type":"cycle","ts":T,"source":"console","count":N,"keys":[...],
+//    "values":[...],"dt_us":[...]}
+// Frame i is keys[i]:values[i], seen dt_us[i] microseconds after T (the
+// first frame). Published alongside the kv events, which are unchanged.
+struct CycleEvent {
+    std::string_view source;
+    double ts;
+    std::span<const std::string_view> keys;
+    std::span<const std::string_view> values;
+    std::span<const int32_t> dt_us;
+};
+
+// A motor query key stalling (no answer for QUERY_STALL_MS) or recovering
+struct QueryStallEvent {
+    std::string_view key;
+    bool stalled;
+    uint64_t waited_ms;     // since the oldest unanswered query
+    uint64_t missing;
+};
+
+// One IPC client's backlog from the `metrics` command
+struct ClientLagEvent {
+    int fd;
+    uint64_t lag_msgs;
+    uint64_t max_lag_msgs;
+    uint64_t queued_bytes;
+    uint64_t lost_msgs;
+    uint64_t gaps;
+    uint64_t sent_bytes;
 };
 
+/*
+ * Format JSON events directly into a caller-provided buffer (e.g. a
+ * reserved ring slot). Output is newline-terminated and byte-identical to
+ * the build_* variants. Returns bytes written, or 0 if the event does not
+ * fit. No heap allocation — safe on the serial hot path.
+ */
+size_t format_kv_event(std::span<char> out, const KvEvent& ev);
+size_t format_status_event(std::span<char> out, const StatusEvent& ev);
+size_t format_ftms_event(std::span<char> out, const FtmsEvent& ev);
+size_t format_emu_stats_event(std::span<char> out, const EmuStatsEvent& ev);
+size_t format_program_event(std::span<char> out, const ProgramEvent& ev);
+size_t format_hr_zone_event(std::span<char> out, const HrZoneEvent& ev);
+size_t format_histogram_event(std::span<char> out, const HistogramEvent& ev);
+size_t format_client_lag_event(std::span<char> out, const ClientLagEvent& ev);
+size_t format_query_metrics_event(std::span<char> out, const QueryMetricsEvent& ev);
+size_t format_query_stall_event(std::span<char> out, const QueryStallEvent& ev);
+size_t format_bus_metrics_event(std::span<char> out, const BusMetricsEvent& ev);
+size_t format_bus_stats_event(std::span<char> out, const BusStatsEvent& ev);
+size_t format_stats_event(std::span<char> out, const StatsEvent& ev);
+size_t format_cycle_event(std::span<char> out, const CycleEvent& ev);
+
+/*
+ * Tag a formatted JSON event in out[0, len) with "bus":N after its type
+ * field. Returns the new length (len itself for bus 0), or 0 if the tag
+ * does not fit.
+ */
+size_t tag_event_bus(std::span<char> out, size_t len, int bus);
+
 /*
  * Build JSON event strings into a std::string.
  */
 std::string build_kv_event(const KvEvent& ev);
 std::string build_status_event(const StatusEvent& ev);
 std::string build_error_event(std::string_view msg);
+
+// Reply to `hello`, sent as JSON just before the client's format switches
+size_t format_hello_event(std::span<char> out, bool binary);
+
+// Reply to `trace`: whether recording, and after a dump the spans and
+// instants written to `path`
+struct TraceEvent {
+    bool recording;
+    bool dumped = false;
+    uint64_t spans = 0;
+    std::string_view path;
+};
+
+size_t format_trace_event(std::span<char> out, const TraceEvent& ev);
+
+// Command acknowledgement for a command carrying "seq":
+//   {"type":"ack","seq":N,"stage":"applied"}  handle_command() applied it
+//   {"type":"ack","seq":N,"stage":"motor","key":"hmph","value":V,
+//    "sent_us":S,"echo_us":E}                 frame sent S µs and echoed by
+//                                             the motor E µs after arrival
+//   "superseded" / "timeout" with key and value: no motor ack will follow
+// Not subscribable, like errors: seq values are the client's own.
+struct AckEvent {
+    uint32_t seq;
+    std::string_view stage;
+    std::string_view key;   // empty for "applied"
+    int value = 0;          // tenths of mph / half-pct
+    uint64_t sent_us = 0;   // "motor" only
+    uint64_t echo_us = 0;
+};
+
+size_t format_ack_event(std::span<char> out, const AckEvent& ev);
+
+// Per-client notice that `dropped` ring messages were overwritten before
+// they could be queued for it: {"type":"gap","dropped":N}. Not
+// subscribable, like errors; a client resyncs (e.g. with `status`).
+size_t format_gap_event(std::span<char> out, uint64_t dropped);
+
+// Latest kv values for a client, on connect or {"cmd":"snapshot"}:
+//   {"type":"snapshot","ts":T,"console":{"hmph":"78",...},"motor":{...},
+//    "emulate":{...}}
+// One object per source (SUB_SOURCE_NAMES order), keys in KV_KEY_NAMES
+// order, keys never seen left out (kv_latest.h). Sent to that client
+// only, followed by a status event; not subscribable, like errors.
+struct SnapshotEvent {
+    std::array<std::array<std::string_view, KV_KEY_NAMES.size()>, SUB_SOURCE_NAMES.size()> values{};
+    double ts = 0;
+    uint8_t bus = 0;
+};
+
+constexpr size_t SNAPSHOT_EVENT_MAX = 4096;  // every key from every source, typical values
+
+size_t format_snapshot_event(std::span<char> out, const SnapshotEvent& ev);
+
+// Reply to `history`, to the asking client only (not subscribable):
+//   {"type":"history","from":F,"step":S,"count":N,"speed":[...],
+//    "incline":[...],"amps":[...]}
+// Entry i is the mean over [F + i*S, F + (i+1)*S): tenths of mph,
+// half-pct, amps in wire units; -1 = nothing known. Columns are capped at
+// HISTORY_MAX_POINTS, widening S as needed.
+constexpr size_t HISTORY_MAX_POINTS = 720;
+constexpr size_t HISTORY_EVENT_MAX = 13312;  // 720 five-digit values per column
+
+struct HistoryEvent {
+    uint32_t from;
+    uint32_t step;
+    std::span<const int16_t> speed;
+    std::span<const int16_t> incline;
+    std::span<const int16_t> amps;
+    uint8_t bus = 0;
+};
+
+size_t format_history_event(std::span<char> out, const HistoryEvent& ev);
+
+// Reply to `mailbox`: {"type":"mailbox","slots":N}, sent with the
+// mailbox's memfd and doorbell attached (cmd_mailbox.h)
+size_t format_mailbox_event(std::span<char> out, uint32_t slots);
+
+/*
+ * Binary event records.
+ *
+ * kv, status and ftms events travel through the ring as fixed-layout records,
+ * not JSON: producers only copy fields. The IPC server formats JSON for
+ * JSON clients (once per message, shared between clients) and forwards
+ * records as-is to clients that switched to binary framing with
+ * {"cmd":"hello","format":"binary"}. Little-endian throughout.
+ *
+ *   Kv (16 + key + value bytes)
+ *     0 u8 tag=1   1 u8 source (SUB_SOURCE_NAMES index)
+ *     2 u8 key id (KvKey; 0 = key text follows)   3 u8 key_len
+ *     4 u8 value_len   5 u8 bus   6-7 pad   8 f64 ts   16 key[key_len] value[value_len]
+ *     key_len is 0 unless key id is 0.
+ *   Status (73 bytes)
+ *     0 u8 tag=2   1 u8 proxy   2 u8 emulate   3 u8 bus
+ *     4 i32 emu_speed   8 i32 emu_incline   12 i32 bus_speed
+ *     16 i32 bus_incline   20 u32 console_bytes   24 u32 motor_bytes
+ *     28 u64 console_dropped   36 u64 motor_dropped
+ *     44 f64 distance_mi   52 f64 vert_ft   60 u64 belt_on_ms   68 u8 overlay
+ *     69 u32 generation
+ *   Ftms (20 bytes)
+ *     0 u8 tag=4   1 u8 bus   2 u16 speed   4 i16 incline   6 u16 elapsed_s
+ *     8 u32 distance_m   12 f64 ts
+ *   Json
+ *     0 u8 tag=3, then any other event as JSON text without the newline
+ *
+ * On a binary connection every record is framed as [u16 length][record].
+ */
+enum class EventRecord : uint8_t { Kv = 1, Status = 2, Json = 3, Ftms = 4 };
+
+constexpr size_t KV_RECORD_HEADER_SIZE = 16;
+constexpr size_t STATUS_RECORD_SIZE = 73;
+constexpr size_t FTMS_RECORD_SIZE = 20;
+constexpr size_t RECORD_JSON_MAX = 448;  // longest JSON line a record expands to
+constexpr size_t BINARY_FRAME_HEADER_SIZE = 2;
+constexpr int BINARY_FRAMING_VERSION = 1;
+
+// Returns bytes written, or 0 if it does not fit / the source is unknown
+size_t format_kv_record(std::span<char> out, const KvEvent& ev);
+size_t format_status_record(std::span<char> out, const StatusEvent& ev);
+size_t format_ftms_record(std::span<char> out, const FtmsEvent& ev);
+
+// Decode records (views point into `rec`)
+std::optional<KvEvent> parse_kv_record(std::string_view rec);
+std::optional<StatusEvent> parse_status_record(std::string_view rec);
+std::optional<FtmsEvent> parse_ftms_record(std::string_view rec);
+
+// A ring message (record or JSON text) as a newline-terminated JSON line,
+// or as a [u16 length][record] binary frame. 0 if it does not fit.
+size_t ring_message_to_json(std::span<char> out, std::string_view msg);
+size_t ring_message_to_frame(std::span<char> out, std::string_view msg);
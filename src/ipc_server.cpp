@@ -3,23 +3,62 @@
  */
 
 #include "ipc_server.h"
+#include "trace.h"
+#include "metrics.h"
 #include <cstdio>
 #include <cerrno>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <algorithm>
+#include <cstring>
 
-IpcServer::IpcServer(RingBuffer<>& ring) : ring_(ring) {}
+static constexpr size_t MSG_MAX = EventRing::msg_size();
+static constexpr size_t FRAME_MAX = MSG_MAX + BINARY_FRAME_HEADER_SIZE + 1;
+static constexpr size_t WIRE_MAX = std::max(FRAME_MAX, RECORD_JSON_MAX);  // largest single queue_bytes
+static_assert(WIRE_MAX * 4 <= CLIENT_OUT_BUF_SIZE);
+
+IpcServer::IpcServer(EventRing& ring)
+    : ring_(ring), json_cache_(std::make_unique<std::array<JsonCacheEntry, JSON_CACHE_SIZE>>()) {}
 
 IpcServer::~IpcServer() {
     shutdown();
 }
 
-bool IpcServer::create() {
+bool IpcServer::create(int listen_fd) {
+    if (listen_fd >= 0) {
+        server_fd_ = listen_fd;
+        inherited_listener_ = true;
+    } else if (!bind_socket()) {
+        return false;
+    }
+
+    int flags = fcntl(server_fd_, F_GETFL, 0);
+    fcntl(server_fd_, F_SETFL, flags | O_NONBLOCK);
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        std::perror("epoll_create1");
+        shutdown();
+        return false;
+    }
+
+    int wake_fd = ring_.enable_wakeup();
+    if (wake_fd < 0 || !watch(server_fd_) || !watch(wake_fd)) {
+        std::perror("epoll_ctl");
+        shutdown();
+        return false;
+    }
+
+    return true;
+}
+
+bool IpcServer::bind_socket() {
     unlink(SOCK_PATH);
 
     server_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
@@ -51,18 +90,68 @@ bool IpcServer::create() {
         server_fd_ = -1;
         return false;
     }
+    return true;
+}
+
+bool IpcServer::watch(int fd) {
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+int IpcServer::find_client(int fd) const {
+    for (int i = 0; i < num_clients(); i++) {
+        if (clients_.at(i)->fd == fd) return i;
+    }
+    return -1;
+}
 
-    int flags = fcntl(server_fd_, F_GETFL, 0);
-    fcntl(server_fd_, F_SETFL, flags | O_NONBLOCK);
+// The client whose mailbox doorbell is `fd`
+int IpcServer::find_mailbox(int fd) const {
+    for (int i = 0; i < num_clients(); i++) {
+        const auto& mb = clients_.at(i)->mailbox;
+        if (mb && mb->doorbell_fd() == fd) return i;
+    }
+    return -1;
+}
 
-    return true;
+int IpcServer::add_timer(TimerCallback cb) {
+    if (epoll_fd_ < 0) return -1;
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd < 0) return -1;
+    if (!watch(tfd)) {
+        close(tfd);
+        return -1;
+    }
+    timers_.push_back({tfd, std::move(cb)});
+    return static_cast<int>(timers_.size()) - 1;
+}
+
+void IpcServer::arm_timer(int id, int delay_ms, int interval_ms) {
+    if (id < 0 || id >= static_cast<int>(timers_.size())) return;
+    struct itimerspec its{};
+    if (delay_ms > 0) {
+        its.it_value.tv_sec = delay_ms / 1000;
+        its.it_value.tv_nsec = (delay_ms % 1000) * 1000000L;
+        its.it_interval.tv_sec = interval_ms / 1000;
+        its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    }
+    timerfd_settime(timers_.at(id).fd, 0, &its, nullptr);
+}
+
+void IpcServer::fire_timer(Timer& t) {
+    uint64_t expirations;
+    if (read(t.fd, &expirations, sizeof(expirations)) > 0 && t.cb) {
+        t.cb();
+    }
 }
 
 void IpcServer::accept_client() {
     int cfd = accept(server_fd_, nullptr, nullptr);
     if (cfd < 0) return;
 
-    if (num_clients_ >= MAX_CLIENTS) {
+    if (num_clients() >= MAX_CLIENTS) {
         auto errmsg = build_error_event("too many clients");
         ssize_t wr = write(cfd, errmsg.data(), errmsg.size());
         (void)wr;  // best-effort error message
@@ -70,35 +159,82 @@ void IpcServer::accept_client() {
         return;
     }
 
-    int flags = fcntl(cfd, F_GETFL, 0);
-    fcntl(cfd, F_SETFL, flags | O_NONBLOCK);
+    if (!add_client(cfd)) {
+        close(cfd);
+        return;
+    }
+
+    std::fprintf(stderr, "[ipc] client connected (fd=%d, total=%d)\n", cfd, num_clients());
+    queue_snapshot(*clients_.back());
 
-    auto& c = clients_.at(num_clients_);
-    c.fd = cfd;
+    if (connect_cb_) {
+        connect_cb_(num_clients());
+    }
+    if (subs_cb_) subs_cb_();
+}
+
+// Watch `fd` as a new client, starting at the ring's current end
+bool IpcServer::add_client(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    if (!watch(fd)) return false;
+
+    auto& c = *clients_.emplace_back(std::make_unique<Client>());
+    c.fd = fd;
     c.buf_len = 0;
     auto snap = ring_.snapshot();
     c.ring_cursor = snap.count;
-    num_clients_++;
+    return true;
+}
+
+int IpcServer::release_clients(std::span<ClientHandoff> out) {
+    flush_ring_to_clients();  // queue and send what's already in the ring
+    int n = 0;
+    for (auto& c : clients_) {
+        bool drained = c->out_pending() == 0;
+        close_mailbox(*c);  // a successor starts without it
+        if (epoll_fd_ >= 0) epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, c->fd, nullptr);
+        if (!drained || n >= static_cast<int>(out.size())) {
+            close(c->fd);
+            continue;
+        }
+        out[n++] = ClientHandoff{c->fd, c->sub, c->binary};
+    }
+    clients_.clear();
+    return n;
+}
 
-    std::fprintf(stderr, "[ipc] client connected (fd=%d, total=%d)\n", cfd, num_clients_);
+bool IpcServer::adopt_client(const ClientHandoff& h) {
+    if (num_clients() >= MAX_CLIENTS || !add_client(h.fd)) return false;
+    auto& c = *clients_.back();
+    set_subscription(c, h.sub);
+    c.binary = h.binary;
+
+    std::fprintf(stderr, "[ipc] client adopted (fd=%d, total=%d)\n", h.fd, num_clients());
+
+    if (connect_cb_) {
+        connect_cb_(num_clients());
+    }
+    if (subs_cb_) subs_cb_();
+    return true;
 }
 
 void IpcServer::remove_client(int idx) {
     std::fprintf(stderr, "[ipc] client removed (fd=%d, remaining=%d)\n",
-                 clients_.at(idx).fd, num_clients_ - 1);
-    close(clients_.at(idx).fd);
-    for (int i = idx; i < num_clients_ - 1; i++) {
-        clients_.at(i) = clients_.at(i + 1);
-    }
-    num_clients_--;
+                 clients_.at(idx)->fd, num_clients() - 1);
+    close_mailbox(*clients_.at(idx));
+    close(clients_.at(idx)->fd);  // also removes it from the epoll set
+    clients_.erase(clients_.begin() + idx);
 
     if (disconnect_cb_) {
-        disconnect_cb_(num_clients_);
+        disconnect_cb_(num_clients());
     }
+    if (subs_cb_) subs_cb_();
 }
 
 void IpcServer::read_client(int idx) {
-    auto& c = clients_.at(idx);
+    auto& c = *clients_.at(idx);
     int space = CMD_BUF_SIZE - c.buf_len - 1;
     if (space <= 0) {
         c.buf_len = 0;
@@ -106,6 +242,7 @@ void IpcServer::read_client(int idx) {
     }
 
     ssize_t n = read(c.fd, c.buf.data() + c.buf_len, space);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
     if (n <= 0) {
         std::fprintf(stderr, "[ipc] client disconnected (fd=%d)\n", c.fd);
         remove_client(idx);
@@ -123,13 +260,31 @@ void IpcServer::read_client(int idx) {
         auto nl_pos = buf_view.find('\n', processed);
         if (nl_pos == std::string_view::npos) break;
 
-        auto line = buf_view.substr(processed, nl_pos - processed);
+        size_t start = processed;
         processed = nl_pos + 1;
 
-        if (!line.empty() && cmd_cb_) {
-            if (auto cmd = parse_command(line)) {
-                cmd_cb_(*cmd);
-            }
+        if (nl_pos == start) continue;
+        // The line parses in place, newline included as the terminator slot
+        auto cmd = parse_command_insitu(std::span<char>(c.buf.data() + start, nl_pos - start + 1));
+        if (!cmd) continue;
+        if (cmd->type == CmdType::Subscribe) {
+            set_subscription(c, cmd->sub);  // per-client, never reaches the controller
+            if (subs_cb_) subs_cb_();
+        } else if (cmd->type == CmdType::Hello) {
+            // Ack in the framing the client is reading now, then switch
+            std::array<char, 128> ack;
+            std::array<char, 136> framed;
+            std::string_view wire(ack.data(), format_hello_event(ack, cmd->bool_value));
+            if (c.binary) wire = { framed.data(), ring_message_to_frame(framed, wire) };
+            if (queue_bytes(c, wire)) c.binary = cmd->bool_value;
+        } else if (cmd->type == CmdType::Snapshot) {
+            queue_snapshot(c);
+        } else if (cmd->type == CmdType::History) {
+            queue_history(c, *cmd);
+        } else if (cmd->type == CmdType::Mailbox) {
+            open_mailbox(c);
+        } else if (cmd_cb_) {
+            cmd_cb_(*cmd);
         }
     }
 
@@ -144,77 +299,388 @@ void IpcServer::read_client(int idx) {
 }
 
 void IpcServer::flush_ring_to_clients() {
-    auto snap = ring_.snapshot();
-    int head = snap.head;
-    unsigned int total = snap.count;
-    constexpr int RING_SZ = RingBuffer<>::size();
-
-    for (int ci = 0; ci < num_clients_; ) {
-        auto& c = clients_.at(ci);
-
-        unsigned int pending = total - c.ring_cursor;
-        if (pending == 0) { ci++; continue; }
-        if (pending > static_cast<unsigned>(RING_SZ)) {
-            c.ring_cursor = total - RING_SZ;
-            pending = RING_SZ;
-        }
+    uint64_t total = ring_.snapshot().count;
 
-        int start_idx = (head - static_cast<int>(pending) + RING_SZ) % RING_SZ;
-        bool failed = false;
-
-        for (unsigned int i = 0; i < pending && !failed; i++) {
-            int ri = (start_idx + static_cast<int>(i)) % RING_SZ;
-            auto msg = ring_.at(ri);
-            if (!msg.empty()) {
-                ssize_t w = write(c.fd, msg.data(), msg.size());
-                if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                    break;
-                } else if (w <= 0) {
-                    failed = true;
-                }
-            }
-        }
-
-        if (failed) {
+    for (int ci = 0; ci < num_clients(); ) {
+        auto& c = *clients_.at(ci);
+        fill_from_ring(c, total);
+        if (!send_pending(c)) {
             std::fprintf(stderr, "[ipc] client write error (fd=%d)\n", c.fd);
             remove_client(ci);
         } else {
-            c.ring_cursor = total;
             ci++;
         }
     }
 }
 
-void IpcServer::poll() {
-    if (server_fd_ < 0) return;
+// Copy committed ring messages into the client's outbound queue until it
+// is caught up or the queue can't hold another full-size message.
+void IpcServer::fill_from_ring(Client& c, uint64_t total) {
+    constexpr int RING_SZ = EventRing::size();
 
-    fd_set rfds;
-    FD_ZERO(&rfds);
-    FD_SET(server_fd_, &rfds);
-    int maxfd = server_fd_;
+    if (total - c.ring_cursor > static_cast<uint64_t>(RING_SZ)) {
+        uint64_t skipped = total - RING_SZ - c.ring_cursor;
+        c.lost += skipped;
+        c.gap_pending += skipped;
+        c.ring_cursor = total - RING_SZ;
+    }
+    c.max_lag = std::max(c.max_lag, total - c.ring_cursor);
 
-    for (int i = 0; i < num_clients_; i++) {
-        FD_SET(clients_.at(i).fd, &rfds);
-        if (clients_.at(i).fd > maxfd) maxfd = clients_.at(i).fd;
+    uint64_t now_us = c.conflate ? mono_us() : 0;
+    if (c.conflate) release_held_kv(c, now_us);
+
+    std::array<char, MSG_MAX> msg;
+    while (c.out_space() >= WIRE_MAX) {
+        if (c.gap_pending > 0) {
+            queue_gap(c);  // ahead of whatever comes after the hole
+            continue;
+        }
+        if (c.ring_cursor >= total) break;
+        RingReadResult r = ring_.read(c.ring_cursor, msg);
+        if (r.status == RingRead::NotReady) break;  // producer mid-write; resume next poll
+        if (r.status == RingRead::Overwritten) {
+            c.lost++;
+            c.gap_pending++;
+            c.ring_cursor++;
+            continue;
+        }
+
+        std::string_view m(msg.data(), r.len);
+        if (subscription_matches(c.sub, m) && !(c.conflate && conflate_kv(c, m, now_us))) {
+            queue_message(c, c.ring_cursor, m);
+        }
+        c.ring_cursor++;
     }
+}
 
-    struct timeval tv = { 0, 20000 };  // 20ms poll interval
-    int sel = select(maxfd + 1, &rfds, nullptr, nullptr, &tv);
+// Ring message `seq` in the client's framing
+void IpcServer::queue_message(Client& c, uint64_t seq, std::string_view m) {
+    if (c.binary) {
+        std::array<char, FRAME_MAX> frame;
+        queue_bytes(c, std::string_view(frame.data(), ring_message_to_frame(frame, m)));
+    } else {
+        queue_bytes(c, json_for(seq, m));
+    }
+}
 
-    if (sel > 0) {
-        if (FD_ISSET(server_fd_, &rfds)) {
-            accept_client();
+void IpcServer::set_subscription(Client& c, const IpcSubscription& sub) {
+    c.sub = sub;
+    if (sub.kv_rate == 0) {
+        if (c.conflate) {
+            // Values still held are never sent: report them as lost
+            c.lost += c.conflate->held;
+            c.gap_pending += c.conflate->held;
+            c.conflate.reset();
+        }
+        return;
+    }
+    if (!c.conflate) c.conflate = std::make_unique<KvConflation>();
+    c.conflate->interval_us = 1000000 / sub.kv_rate;
+}
+
+// A kv record (ring message c.ring_cursor) due no sooner than its key's
+// next slot is held instead, replacing any value already held. True if
+// held; the caller queues it otherwise.
+bool IpcServer::conflate_kv(Client& c, std::string_view m, uint64_t now_us) {
+    if (m.size() < KV_RECORD_HEADER_SIZE || m.front() != static_cast<char>(EventRecord::Kv)) return false;
+    auto source = static_cast<uint8_t>(m[1]);
+    auto key = static_cast<uint8_t>(m[2]);
+    auto bus = static_cast<uint8_t>(m[5]);
+    if (key == 0 || bus >= MAX_BUSES || source >= SUB_SOURCE_NAMES.size()) return false;
+
+    auto& k = *c.conflate;
+    auto& s = k.slots.at((bus * SUB_SOURCE_NAMES.size() + source) * KV_KEY_NAMES.size() + key);
+    if (s.held_seq != KvConflation::NONE) {  // still waiting: the newer value replaces it
+        s.held_seq = c.ring_cursor;
+        return true;
+    }
+    if (now_us < s.next_us) {
+        s.held_seq = c.ring_cursor;
+        k.held++;
+        k.next_release_us = std::min(k.next_release_us, s.next_us);
+        return true;
+    }
+    s.next_us = now_us + k.interval_us;
+    return false;
+}
+
+// Queue the held kv values whose interval is up, read back from the ring
+void IpcServer::release_held_kv(Client& c, uint64_t now_us) {
+    auto& k = *c.conflate;
+    if (k.held == 0 || now_us < k.next_release_us) return;
+    std::array<char, MSG_MAX> msg;
+    k.next_release_us = UINT64_MAX;
+    for (auto& s : k.slots) {
+        if (s.held_seq == KvConflation::NONE) continue;
+        if (s.next_us > now_us || c.out_space() < WIRE_MAX) {
+            k.next_release_us = std::min(k.next_release_us, s.next_us);
+            continue;
+        }
+        RingReadResult r = ring_.read(s.held_seq, msg);
+        if (r.status == RingRead::Ok) {
+            queue_message(c, s.held_seq, std::string_view(msg.data(), r.len));
+        } else {  // overwritten while held
+            c.lost++;
+            c.gap_pending++;
+        }
+        s.held_seq = KvConflation::NONE;
+        s.next_us = now_us + k.interval_us;
+        k.held--;
+    }
+}
+
+// Report the client's pending lost messages, in its framing
+void IpcServer::queue_gap(Client& c) {
+    std::array<char, 64> text;
+    std::array<char, 72> framed;
+    std::string_view wire(text.data(), format_gap_event(text, c.gap_pending));
+    if (c.binary) wire = { framed.data(), ring_message_to_frame(framed, wire) };
+    if (queue_bytes(c, wire)) {
+        std::fprintf(stderr, "[ipc] client fell behind (fd=%d, dropped=%llu)\n", c.fd,
+                     static_cast<unsigned long long>(c.gap_pending));
+        c.gap_pending = 0;
+        c.gaps++;
+    }
+}
+
+// JSON line for ring message `seq`: JSON text as-is, records formatted
+// once and reused by every JSON client at the same position
+std::string_view IpcServer::json_for(uint64_t seq, std::string_view msg) {
+    if (msg.empty() || msg.front() == '{') return msg;
+    auto& e = json_cache_->at(seq % JSON_CACHE_SIZE);
+    if (e.seq != seq) {
+        e.len = ring_message_to_json(e.text, msg);
+        e.seq = seq;
+    }
+    return { e.text.data(), e.len };
+}
+
+// The current state, in the framing the client reads. An event that
+// doesn't fit the queue is left out.
+void IpcServer::queue_snapshot(Client& c) {
+    if (!snapshot_cb_) return;
+    std::array<char, SNAPSHOT_EVENT_MAX + BINARY_FRAME_HEADER_SIZE> wire;
+    snapshot_cb_([&](std::string_view msg) {
+        size_t n = c.binary ? ring_message_to_frame(wire, msg) : ring_message_to_json(wire, msg);
+        if (n > 0) queue_bytes(c, { wire.data(), n });
+    });
+}
+
+// The history reply, in the framing the client reads. One that doesn't
+// fit the queue right now becomes an error event, so the client retries
+// rather than waiting.
+void IpcServer::queue_history(Client& c, const IpcCommand& cmd) {
+    if (!history_cb_) return;
+    std::array<char, HISTORY_EVENT_MAX + BINARY_FRAME_HEADER_SIZE + 1> wire;
+    history_cb_(cmd, [&](std::string_view msg) {
+        size_t n = c.binary ? ring_message_to_frame(wire, msg) : ring_message_to_json(wire, msg);
+        if (n > 0 && queue_bytes(c, { wire.data(), n })) return;
+        queue_error(c, "history reply does not fit the client queue");
+    });
+}
+
+// An error event for `c` alone, in its framing
+void IpcServer::queue_error(Client& c, std::string_view msg) {
+    auto err = build_error_event(msg);
+    std::array<char, 256> wire;
+    size_t n = c.binary ? ring_message_to_frame(wire, err) : ring_message_to_json(wire, err);
+    if (n > 0) queue_bytes(c, { wire.data(), n });
+}
+
+// A command mailbox for `c`: the reply is queued, and its memfd and
+// doorbell go out with the reply's first byte (send_pending)
+void IpcServer::open_mailbox(Client& c) {
+    if (!mailboxes_) return queue_error(c, "mailbox not enabled");
+    if (c.mailbox) return queue_error(c, "mailbox already open");
+    auto mb = std::make_unique<CommandMailbox>();
+    if (!mb->ok() || !watch(mb->doorbell_fd())) return queue_error(c, "mailbox unavailable");
+
+    std::array<char, 64> text;
+    std::array<char, 72> framed;
+    std::string_view wire(text.data(), format_mailbox_event(text, CMD_MAILBOX_SLOTS));
+    if (c.binary) wire = { framed.data(), ring_message_to_frame(framed, wire) };
+    size_t at = c.out_tail;
+    if (!queue_bytes(c, wire)) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, mb->doorbell_fd(), nullptr);
+        return queue_error(c, "mailbox reply does not fit the client queue");
+    }
+    c.mailbox = std::move(mb);
+    c.mailbox_fds_at = at;
+    std::fprintf(stderr, "[ipc] mailbox opened (fd=%d)\n", c.fd);
+}
+
+// The doorbell rang: every published slot, in order, to the command callback
+void IpcServer::drain_mailbox(Client& c) {
+    c.mailbox->drain_doorbell();
+    IpcCommand cmd;
+    for (size_t i = 0; i < CMD_MAILBOX_SLOTS; i++) {
+        auto got = c.mailbox->take(cmd);
+        if (got == CommandMailbox::Take::Empty) return;
+        if (got == CommandMailbox::Take::Bad) {
+            queue_error(c, "mailbox slot is not a valid command");
+        } else if (cmd_cb_) {
+            cmd_cb_(cmd);
+        }
+    }
+    // A whole ring taken and the writer still going: ring again, and
+    // come back after the other fds
+    uint64_t one = 1;
+    ssize_t n = write(c.mailbox->doorbell_fd(), &one, sizeof(one));
+    (void)n;
+}
+
+// The doorbell leaves the epoll set explicitly: the client holds a
+// duplicate of it, so closing ours wouldn't
+void IpcServer::close_mailbox(Client& c) {
+    if (!c.mailbox) return;
+    if (epoll_fd_ >= 0) epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, c.mailbox->doorbell_fd(), nullptr);
+    c.mailbox.reset();
+    c.mailbox_fds_at = Client::NO_FDS;
+}
+
+// Append to the outbound queue, splitting across the wrap point.
+// False (nothing queued) if it doesn't fit.
+bool IpcServer::queue_bytes(Client& c, std::string_view bytes) {
+    if (bytes.size() > c.out_space()) return false;
+    size_t tail = c.out_tail % CLIENT_OUT_BUF_SIZE;
+    size_t first = std::min(bytes.size(), CLIENT_OUT_BUF_SIZE - tail);
+    std::copy_n(bytes.data(), first, c.out.data() + tail);
+    std::copy_n(bytes.data() + first, bytes.size() - first, c.out.data());
+    c.out_tail += bytes.size();
+    return true;
+}
+
+bool IpcServer::wants(uint32_t types, uint32_t sources, unsigned bus) const {
+    return std::any_of(clients_.begin(), clients_.end(), [&](const auto& c) {
+        return (c->sub.types & types) && (c->sub.sources & sources) && bus < 32 && (c->sub.buses & (1u << bus));
+    });
+}
+
+int IpcServer::client_metrics(std::span<ClientMetrics> out) const {
+    uint64_t total = ring_.snapshot().count;
+    size_t n = std::min(out.size(), clients_.size());
+    for (size_t i = 0; i < n; i++) {
+        const auto& c = *clients_.at(i);
+        uint64_t lag = total > c.ring_cursor ? total - c.ring_cursor : 0;
+        out[i] = { c.fd, lag, std::max(c.max_lag, lag), c.out_pending(), c.lost, c.gaps, c.sent_bytes };
+    }
+    return static_cast<int>(n);
+}
+
+// Send as much of the outbound queue as the socket accepts, in one writev().
+// Returns false if the client should be dropped.
+bool IpcServer::send_pending(Client& c) {
+    size_t pending = c.out_pending();
+    if (pending == 0) {
+        set_want_write(c, false);
+        return true;
+    }
+
+    // Mailbox fds go with the reply's first byte: stop short of it, then
+    // send from it with the fds attached
+    bool fds_now = c.mailbox_fds_at == c.out_head;
+    if (c.mailbox_fds_at != Client::NO_FDS && !fds_now) pending = std::min(pending, c.mailbox_fds_at - c.out_head);
+
+    size_t head = c.out_head % CLIENT_OUT_BUF_SIZE;
+    size_t first = std::min(pending, CLIENT_OUT_BUF_SIZE - head);
+    std::array<struct iovec, 2> iov{};
+    iov.at(0) = { c.out.data() + head, first };
+    iov.at(1) = { c.out.data(), pending - first };
+    int iovcnt = pending > first ? 2 : 1;
+
+    ssize_t w;
+    if (fds_now) {
+        std::array<int, 2> fds = { c.mailbox->memfd(), c.mailbox->doorbell_fd() };
+        alignas(struct cmsghdr) std::array<char, CMSG_SPACE(sizeof(fds))> ctl{};
+        struct msghdr msg{};
+        msg.msg_iov = iov.data();
+        msg.msg_iovlen = static_cast<size_t>(iovcnt);
+        msg.msg_control = ctl.data();
+        msg.msg_controllen = ctl.size();
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(fds));
+        std::memcpy(CMSG_DATA(cm), fds.data(), sizeof(fds));
+        w = sendmsg(c.fd, &msg, MSG_NOSIGNAL);
+        if (w > 0) c.mailbox_fds_at = Client::NO_FDS;
+    } else {
+        w = writev(c.fd, iov.data(), iovcnt);
+    }
+    if (w < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            set_want_write(c, true);
+            return true;
         }
+        return false;
+    }
 
-        for (int i = 0; i < num_clients_; ) {
-            if (FD_ISSET(clients_.at(i).fd, &rfds)) {
-                int prev = num_clients_;
-                read_client(i);
-                if (num_clients_ < prev) {
-                    continue;  // client removed
-                }
+    c.out_head += static_cast<size_t>(w);
+    c.sent_bytes += static_cast<uint64_t>(w);
+    // Short write: socket buffer is full, wait for EPOLLOUT to resume
+    set_want_write(c, c.out_pending() > 0);
+    return true;
+}
+
+void IpcServer::set_want_write(Client& c, bool want) {
+    if (c.want_write == want) return;
+    struct epoll_event ev{};
+    ev.events = EPOLLIN | (want ? EPOLLOUT : 0u);
+    ev.data.fd = c.fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c.fd, &ev);
+    c.want_write = want;
+}
+
+void IpcServer::poll(int timeout_ms) {
+    if (server_fd_ < 0) return;
+
+    // Ask the ring to wake us on the next push, unless a client already
+    // has committed messages waiting (then don't sleep at all), and not
+    // past the first held kv value's release.
+    // Clients with a full outbound queue are waiting on EPOLLOUT instead.
+    if (!clients_.empty()) {
+        ring_.arm_wakeup();
+        uint64_t total = ring_.snapshot().count;
+        uint64_t release_us = UINT64_MAX;
+        for (auto& c : clients_) {
+            if (c->out_space() < WIRE_MAX) continue;
+            if (c->ring_cursor < total && ring_.ready(c->ring_cursor)) {
+                timeout_ms = 0;
+                break;
+            }
+            if (c->conflate && c->conflate->held > 0) {
+                release_us = std::min(release_us, c->conflate->next_release_us);
+            }
+        }
+        if (release_us != UINT64_MAX && timeout_ms != 0) {
+            uint64_t now = mono_us();
+            int wait_ms = release_us <= now ? 0 : static_cast<int>((release_us - now + 999) / 1000);
+            timeout_ms = timeout_ms < 0 ? wait_ms : std::min(timeout_ms, wait_ms);
+        }
+    }
+
+    std::array<struct epoll_event, 16> events;
+    int n = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), timeout_ms);
+    TraceSpan span("ipc_poll");
+    if (n <= 0 && timeout_ms != 0) span.cancel();  // woke with nothing to do
+
+    for (int e = 0; e < n; e++) {
+        int fd = events.at(e).data.fd;
+        if (fd == server_fd_) {
+            accept_client();
+        } else if (fd == ring_.wakeup_fd()) {
+            ring_.drain_wakeup();
+        } else if (int ci = find_client(fd); ci >= 0) {
+            // EPOLLOUT alone needs no action: the flush below resumes sending
+            if (events.at(e).events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                read_client(ci);
+            }
+        } else if (int mi = find_mailbox(fd); mi >= 0) {
+            drain_mailbox(*clients_.at(mi));
+        } else {
+            for (auto& t : timers_) {
+                if (t.fd == fd) { fire_timer(t); break; }
             }
-            i++;
         }
     }
 
@@ -226,14 +692,24 @@ void IpcServer::push_to_ring(std::string_view msg) {
 }
 
 void IpcServer::shutdown() {
-    for (int i = 0; i < num_clients_; i++) {
-        close(clients_.at(i).fd);
+    for (auto& c : clients_) {
+        close(c->fd);
+    }
+    clients_.clear();
+
+    for (auto& t : timers_) {
+        close(t.fd);
+    }
+    timers_.clear();
+
+    if (epoll_fd_ >= 0) {
+        close(epoll_fd_);
+        epoll_fd_ = -1;
     }
-    num_clients_ = 0;
 
     if (server_fd_ >= 0) {
         close(server_fd_);
-        unlink(SOCK_PATH);
+        if (!inherited_listener_) unlink(SOCK_PATH);
         server_fd_ = -1;
     }
 }
@@ -1,11 +1,51 @@
 /*
  * ipc_server.h — Unix domain socket IPC server
  *
- * Manages up to MAX_CLIENTS connections, reads JSON commands,
- * dispatches to typed handlers, and drains ring buffer to clients.
+ * epoll reactor: waits on the listening socket, client sockets, the ring
+ * buffer's wakeup eventfd, and any registered timerfds. Ring pushes wake
+ * the loop immediately, so events reach clients within microseconds; with
+ * nothing happening the IPC thread sleeps. Reads JSON commands, dispatches
+ * to typed handlers, and drains the ring buffer to clients.
+ *
+ * Each client has an outbound byte queue: pending ring messages are copied
+ * in and sent with one writev() per flush. Partial writes resume at the
+ * exact byte offset (EPOLLOUT wakes us when the socket drains), so a slow
+ * client never sees a truncated line.
+ *
+ * `subscribe` is handled here rather than dispatched: it sets the
+ * client's IpcSubscription, and ring messages it filters out are never
+ * queued for that client. `hello` is handled here too: it switches the
+ * client between JSON lines and binary record frames (see ipc_protocol.h).
+ * A new client, and one sending `snapshot`, gets the on_snapshot() events
+ * queued for it alone, ahead of anything newer from the ring. A `history`
+ * reply (on_history()) goes to the asking client alone the same way.
+ * With enable_mailboxes(), `mailbox` gives the client a shared-memory
+ * command ring of its own (cmd_mailbox.h): its fds go out with the reply,
+ * its doorbell is watched with the sockets, and its commands reach the
+ * command callback like the client's socket commands.
+ * kv/status records are formatted as JSON once per message into a small
+ * cache shared by all JSON clients.
+ *
+ * A subscription with a `kv_rate` conflates kv events: per (bus, source,
+ * key) at most kv_rate go out each second, and a value arriving sooner is
+ * held as its ring position, replaced by any later one, and sent when the
+ * interval is up (poll() wakes for it). So a display client gets the
+ * latest of every key at a bounded rate. Keys outside KV_KEY_NAMES pass
+ * unconflated. A held value the ring overwrites counts as lost (gap).
+ *
+ * A client that falls more than the ring's size behind loses the oldest
+ * messages. It is told so: a `gap` event with the number dropped goes out
+ * ahead of the next message it does get, so it can resync instead of
+ * silently missing changes. Per-client lag, drop and byte counters feed
+ * the `metrics` command.
  * No string parsing lives here — delegates entirely to IpcProtocol.
  *
- * RAII: closes all fds and unlinks socket on destruction.
+ * The listening socket can come from outside (systemd socket activation)
+ * and connected clients can be released to, and adopted from, a
+ * predecessor or successor process (handoff.h).
+ *
+ * RAII: closes all fds and unlinks socket on destruction (unless the
+ * listener was inherited: its owner keeps the path).
  */
 
 #pragma once
@@ -14,58 +54,220 @@
 #include <string>
 #include <string_view>
 #include <array>
+#include <span>
+#include <vector>
+#include <memory>
 #include <functional>
 #include "ipc_protocol.h"
-#include "ring_buffer.h"
+#include "kv_protocol.h"
+#include "byte_ring.h"
+#include "cmd_mailbox.h"
 
-constexpr int MAX_CLIENTS = 4;
-constexpr int CMD_BUF_SIZE = 1024;
+constexpr int MAX_CLIENTS = 16;
+constexpr int CMD_BUF_SIZE = 4096;  // per-client command line buffer (program uploads)
+constexpr size_t CLIENT_OUT_BUF_SIZE = 16384;  // per-client outbound queue (power of 2)
 constexpr const char* SOCK_PATH = "/tmp/treadmill_io.sock";
 
 class IpcServer {
 public:
     using CommandCallback = std::function<void(const IpcCommand&)>;
+    using ConnectCallback = std::function<void(int total_clients)>;
     using DisconnectCallback = std::function<void(int remaining_clients)>;
+    using TimerCallback = std::function<void()>;
+    using SnapshotEmit = std::function<void(std::string_view msg)>;
+    using SnapshotCallback = std::function<void(const SnapshotEmit& emit)>;
+    using HistoryCallback = std::function<void(const IpcCommand& cmd, const SnapshotEmit& emit)>;
+    using SubscriptionCallback = std::function<void()>;
 
-    IpcServer(RingBuffer<>& ring);
+    IpcServer(EventRing& ring);
     ~IpcServer();
 
     // Set handler for parsed commands
     void on_command(CommandCallback cb) { cmd_cb_ = std::move(cb); }
 
+    // Set handler for accepted clients
+    void on_client_connect(ConnectCallback cb) { connect_cb_ = std::move(cb); }
+
     // Set handler for client disconnects
     void on_client_disconnect(DisconnectCallback cb) { disconnect_cb_ = std::move(cb); }
 
-    // Create and bind the server socket. Returns true on success.
-    bool create();
+    // Set the current-state events for one client: the callback passes
+    // each to `emit` as a ring message, record or JSON (IPC thread)
+    void on_snapshot(SnapshotCallback cb) { snapshot_cb_ = std::move(cb); }
+
+    // Set the reply to a `history` command, passed to `emit` as for a
+    // snapshot (IPC thread)
+    void on_history(HistoryCallback cb) { history_cb_ = std::move(cb); }
+
+    // Set handler for any change to what clients subscribe to: a client
+    // connecting, leaving or sending `subscribe` (IPC thread)
+    void on_subscriptions(SubscriptionCallback cb) { subs_cb_ = std::move(cb); }
 
-    // Run one iteration of the event loop (select + read + flush).
+    // Whether some client gets events of any of `types` (bits of
+    // SUB_TYPE_NAMES) from any of `sources` on `bus`. IPC thread only.
+    bool wants(uint32_t types, uint32_t sources, unsigned bus) const;
+
+    // Answer `mailbox` with a command mailbox (off: an error event)
+    void enable_mailboxes(bool on) { mailboxes_ = on; }
+
+    // Create and bind the server socket, or listen on `listen_fd`, an
+    // already-bound listening socket (socket activation). True on success.
+    bool create(int listen_fd = -1);
+
+    // Run one iteration of the event loop (epoll_wait + read + flush).
+    // Blocks up to timeout_ms (-1 = until an fd, timer, ring push or wake()).
     // Call this in a loop from the IPC thread.
-    void poll();
+    void poll(int timeout_ms = 20);
+
+    // Interrupt a blocked poll() from another thread (e.g. for shutdown)
+    void wake() { ring_.notify(); }
+
+    // Register a timerfd-backed callback run from poll(). Returns a timer id,
+    // or -1 on failure. Timers start disarmed. Call after create().
+    int add_timer(TimerCallback cb);
+
+    // Arm a timer to fire after delay_ms, then every interval_ms (0 = one-shot).
+    // delay_ms <= 0 disarms it.
+    void arm_timer(int id, int delay_ms, int interval_ms = 0);
 
     // Push a message into the ring
     void push_to_ring(std::string_view msg);
 
+    int num_clients() const { return static_cast<int>(clients_.size()); }
+
+    // How far behind one client is, for the `metrics` command
+    struct ClientMetrics {
+        int fd;
+        uint64_t lag_msgs;      // committed ring messages not yet queued
+        uint64_t max_lag_msgs;  // worst lag seen at a flush
+        uint64_t queued_bytes;  // queued but not yet accepted by the socket
+        uint64_t lost_msgs;     // overwritten in the ring before being queued
+        uint64_t gaps;          // gap events sent
+        uint64_t sent_bytes;    // accepted by the socket
+    };
+
+    // Fill `out` with up to out.size() clients. Returns the count.
+    // IPC thread only (e.g. from a command callback).
+    int client_metrics(std::span<ClientMetrics> out) const;
+
+    // A connected client as it moves between processes
+    struct ClientHandoff {
+        int fd;
+        IpcSubscription sub;
+        bool binary;
+    };
+
+    // Detach every client for a successor process: queued output gets one
+    // last send; a client it can't finish sending to is closed instead, so
+    // no stream resumes mid-event. Buffered partial commands are dropped.
+    // The returned fds are the caller's. Returns the count.
+    // With the IPC thread stopped.
+    int release_clients(std::span<ClientHandoff> out);
+
+    // Take over a client released by a predecessor. Fires the connect
+    // callback. Before the IPC thread starts.
+    bool adopt_client(const ClientHandoff& c);
+
     // Cleanup
     void shutdown();
 
 private:
+    // Per (bus, source, key): when the next kv event may go out, and the
+    // ring seq of the latest one waiting for that
+    struct KvConflation {
+        static constexpr uint64_t NONE = UINT64_MAX;
+        struct Slot {
+            uint64_t next_us = 0;
+            uint64_t held_seq = NONE;
+        };
+        uint64_t interval_us = 0;
+        size_t held = 0;                      // slots with a held_seq
+        uint64_t next_release_us = UINT64_MAX;  // earliest next_us of those
+        std::array<Slot, MAX_BUSES * SUB_SOURCE_NAMES.size() * KV_KEY_NAMES.size()> slots{};
+    };
+
     struct Client {
         int fd = -1;
         std::array<char, CMD_BUF_SIZE> buf{};
         int buf_len = 0;
-        unsigned int ring_cursor = 0;
+        uint64_t ring_cursor = 0;  // next ring sequence number to queue
+
+        // Outbound byte queue. out_head/out_tail count bytes ever sent/queued;
+        // index with % CLIENT_OUT_BUF_SIZE (unsigned wrap is harmless).
+        std::array<char, CLIENT_OUT_BUF_SIZE> out{};
+        size_t out_head = 0;
+        size_t out_tail = 0;
+        bool want_write = false;   // EPOLLOUT registered (socket was full)
+        uint64_t max_lag = 0;
+        uint64_t lost = 0;
+        uint64_t gap_pending = 0;  // lost messages not yet reported in a gap event
+        uint64_t gaps = 0;
+        uint64_t sent_bytes = 0;
+        IpcSubscription sub;       // events this client receives
+        bool binary = false;       // framed records instead of JSON lines
+        std::unique_ptr<KvConflation> conflate;  // with sub.kv_rate only
+        static constexpr size_t NO_FDS = SIZE_MAX;
+        std::unique_ptr<CommandMailbox> mailbox;  // after `mailbox` only
+        size_t mailbox_fds_at = NO_FDS;  // queue offset (out_tail) the mailbox fds go out at
+
+        size_t out_pending() const { return out_tail - out_head; }
+        size_t out_space() const { return CLIENT_OUT_BUF_SIZE - out_pending(); }
+    };
+    static_assert((CLIENT_OUT_BUF_SIZE & (CLIENT_OUT_BUF_SIZE - 1)) == 0);
+
+    // JSON text of recent ring messages, indexed by seq % JSON_CACHE_SIZE
+    static constexpr size_t JSON_CACHE_SIZE = 64;
+    struct JsonCacheEntry {
+        uint64_t seq = UINT64_MAX;
+        size_t len = 0;
+        std::array<char, RECORD_JSON_MAX> text{};
+    };
+
+    struct Timer {
+        int fd = -1;
+        TimerCallback cb;
     };
 
     void accept_client();
     void read_client(int idx);
     void remove_client(int idx);
     void flush_ring_to_clients();
+    void fill_from_ring(Client& c, uint64_t total);
+    static void set_subscription(Client& c, const IpcSubscription& sub);
+    bool conflate_kv(Client& c, std::string_view m, uint64_t now_us);
+    void release_held_kv(Client& c, uint64_t now_us);
+    void queue_message(Client& c, uint64_t seq, std::string_view m);
+    static void queue_gap(Client& c);
+    void queue_snapshot(Client& c);
+    void queue_history(Client& c, const IpcCommand& cmd);
+    void open_mailbox(Client& c);
+    void drain_mailbox(Client& c);
+    void close_mailbox(Client& c);
+    void queue_error(Client& c, std::string_view msg);
+    std::string_view json_for(uint64_t seq, std::string_view msg);
+    static bool queue_bytes(Client& c, std::string_view bytes);
+    bool send_pending(Client& c);
+    void set_want_write(Client& c, bool want);
+    void fire_timer(Timer& t);
+    int find_client(int fd) const;
+    int find_mailbox(int fd) const;
+    bool watch(int fd);
+
+    bool bind_socket();
+    bool add_client(int fd);
 
-    RingBuffer<>& ring_;
+    EventRing& ring_;
     int server_fd_ = -1;
-    std::array<Client, MAX_CLIENTS> clients_{};
-    int num_clients_ = 0;
+    bool inherited_listener_ = false;
+    int epoll_fd_ = -1;
+    std::vector<std::unique_ptr<Client>> clients_;  // heap: ~17 KB each
+    std::vector<Timer> timers_;
+    std::unique_ptr<std::array<JsonCacheEntry, JSON_CACHE_SIZE>> json_cache_;  // heap: ~17 KB
     CommandCallback cmd_cb_;
+    ConnectCallback connect_cb_;
     DisconnectCallback disconnect_cb_;
+    SnapshotCallback snapshot_cb_;
+    HistoryCallback history_cb_;
+    SubscriptionCallback subs_cb_;
+    bool mailboxes_ = false;
 };
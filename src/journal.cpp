@@ -0,0 +1,305 @@
+/*
+ * journal.cpp — BusJournal writer and JournalReader
+ */
+
+#include "journal.h"
+#include "metrics.h"
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+constexpr std::array<char, 4> JOURNAL_MAGIC = { 'T', 'M', 'J', '1' };
+constexpr size_t JOURNAL_SEGMENT_MIN = 4096;
+constexpr size_t VARINT_MAX = 10;
+
+// Worst-case encoded record: tag, dt, key and value (or raw chunk) with lengths
+constexpr size_t RECORD_MAX =
+    1 + VARINT_MAX + std::max(2 * (VARINT_MAX + KV_FIELD_SIZE), VARINT_MAX + JOURNAL_RAW_MAX);
+
+size_t put_varint(uint8_t* out, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = static_cast<uint8_t>(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(v);
+    return n;
+}
+
+uint64_t realtime_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000u + static_cast<uint64_t>(ts.tv_nsec) / 1000u;
+}
+
+}  // namespace
+
+// --- BusJournal ---
+
+std::string BusJournal::segment_path(std::string_view dir, int slot) {
+    std::array<char, 32> name;
+    int n = std::snprintf(name.data(), name.size(), "/journal-%d.tmj", slot);
+    return std::string(dir) + std::string(name.data(), static_cast<size_t>(n));
+}
+
+bool BusJournal::open() {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (base_ || cfg_.dir.empty()) return base_ != nullptr;
+    cfg_.segment_bytes = std::max(cfg_.segment_bytes, JOURNAL_SEGMENT_MIN);
+    cfg_.segments = std::max(cfg_.segments, 1);
+    ::mkdir(cfg_.dir.c_str(), 0755);  // EEXIST is fine
+
+    // Continue numbering after the newest segment on disk
+    uint64_t next = 0;
+    for (int slot = 0; slot < cfg_.segments; slot++) {
+        JournalReader r;
+        if (r.open(segment_path(cfg_.dir, slot))) next = std::max(next, r.header().seq + 1);
+    }
+    return map_segment(next);
+}
+
+void BusJournal::close() {
+    std::lock_guard<std::mutex> lk(mu_);
+    unmap_segment();
+}
+
+uint64_t BusJournal::segment_seq() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return seq_;
+}
+
+uint64_t BusJournal::records() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return records_;
+}
+
+// Caller holds mu_
+bool BusJournal::map_segment(uint64_t seq) {
+    std::string path = segment_path(cfg_.dir, static_cast<int>(seq % static_cast<uint64_t>(cfg_.segments)));
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::fprintf(stderr, "[journal] cannot open %s: %s\n", path.c_str(), std::strerror(errno));
+        return false;
+    }
+    // Truncate then extend: the new segment reads as zeros (= end of data)
+    bool sized = ::ftruncate(fd, 0) == 0 &&
+                 ::ftruncate(fd, static_cast<off_t>(cfg_.segment_bytes)) == 0;
+    void* p = sized ? mmap(nullptr, cfg_.segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                    : MAP_FAILED;
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        std::fprintf(stderr, "[journal] cannot map %s: %s\n", path.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    base_ = static_cast<uint8_t*>(p);
+    seq_ = seq;
+    pos_ = JOURNAL_HEADER_SIZE;
+    last_us_ = mono_us();
+    last_ = {};
+
+    JournalHeader h{};
+    h.magic = JOURNAL_MAGIC;
+    h.version = JOURNAL_VERSION;
+    h.seq = seq;
+    h.start_mono_us = last_us_;
+    h.start_real_us = realtime_us();
+    h.end = pos_;
+    std::memcpy(base_, &h, sizeof(h));
+    return true;
+}
+
+// Caller holds mu_
+void BusJournal::unmap_segment() {
+    if (!base_) return;
+    munmap(base_, cfg_.segment_bytes);
+    base_ = nullptr;
+}
+
+void BusJournal::put_header_end(uint8_t* base, uint64_t end) {
+    // reinterpret_cast: the header lives at the start of the page-aligned mapping
+    auto* h = reinterpret_cast<JournalHeader*>(base);
+    std::atomic_ref<uint64_t>(h->end).store(end, std::memory_order_release);
+}
+
+void BusJournal::record_kv(JournalSource src, const KvPair& kv, uint64_t t_us) {
+    append(src, kv.id, kv.key_view(), kv.value_view(), t_us);
+}
+
+void BusJournal::record_kv(JournalSource src, std::string_view key, std::string_view value,
+                           uint64_t t_us) {
+    append(src, kv_key_lookup(key), key, value, t_us);
+}
+
+void BusJournal::record_raw(JournalSource src, std::span<const uint8_t> bytes, uint64_t t_us) {
+    while (!bytes.empty()) {
+        size_t n = std::min(bytes.size(), JOURNAL_RAW_MAX);
+        // reinterpret_cast: uint8_t -> char aliasing (standard-allowed)
+        std::string_view chunk(reinterpret_cast<const char*>(bytes.data()), n);
+        append(src, KvKey::Unknown, {}, chunk, t_us);
+        bytes = bytes.subspan(n);
+    }
+}
+
+// key empty = raw chunk in `value`
+void BusJournal::append(JournalSource src, KvKey id, std::string_view key,
+                        std::string_view value, uint64_t t_us) {
+    bool raw = key.empty();
+    if (!raw && (key.size() >= KV_FIELD_SIZE || value.size() >= KV_FIELD_SIZE)) return;
+
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!base_) return;
+    uint64_t now = t_us ? t_us : mono_us();
+
+    std::array<uint8_t, RECORD_MAX> rec;
+    auto* s = static_cast<size_t>(src) < last_.size() ? &last_.at(static_cast<size_t>(src)) : nullptr;
+    if (!s) return;
+
+    // Encode; re-encode once after a rotation resets the time base and repeats
+    for (int attempt = 0; attempt < 2; attempt++) {
+        auto& last = s->at(static_cast<size_t>(id));
+        bool known = !raw && id != KvKey::Unknown;
+        bool repeat = known && last.valid &&
+                      std::string_view(last.bytes.data(), last.len) == value;
+        JournalKind kind = raw ? JournalKind::Raw : repeat ? JournalKind::Repeat : JournalKind::Kv;
+
+        size_t n = 0;
+        static_assert(KV_KEY_NAMES.size() <= 16, "the tag holds the key id in 4 bits");
+        rec.at(n++) = static_cast<uint8_t>(static_cast<unsigned>(src) << 6 |
+                                           static_cast<unsigned>(kind) << 4 |
+                                           (known ? static_cast<unsigned>(id) : 0u));
+        n += put_varint(rec.data() + n, now > last_us_ ? now - last_us_ : 0);
+        if (kind == JournalKind::Kv && !known) {
+            n += put_varint(rec.data() + n, key.size());
+            std::copy_n(key.data(), key.size(), rec.data() + n);
+            n += key.size();
+        }
+        if (kind != JournalKind::Repeat) {
+            n += put_varint(rec.data() + n, value.size());
+            std::copy_n(value.data(), value.size(), rec.data() + n);
+            n += value.size();
+        }
+
+        if (pos_ + n > cfg_.segment_bytes) {
+            if (attempt > 0) return;
+            uint64_t next = seq_ + 1;
+            unmap_segment();
+            if (!map_segment(next)) return;  // journal stays closed
+            continue;
+        }
+
+        std::copy_n(rec.data(), n, base_ + pos_);
+        pos_ += n;
+        put_header_end(base_, pos_);
+        last_us_ = std::max(last_us_, now);
+        records_++;
+        if (kind == JournalKind::Kv && known) {
+            value.copy(last.bytes.data(), value.size());
+            last.len = static_cast<uint8_t>(value.size());
+            last.valid = true;
+        }
+        return;
+    }
+}
+
+// --- JournalReader ---
+
+bool JournalReader::open(std::string_view path) {
+    close();
+    std::string p(path);
+    int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < JOURNAL_HEADER_SIZE) {
+        ::close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* m = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) return false;
+
+    base_ = static_cast<const uint8_t*>(m);
+    size_ = size;
+    std::memcpy(&header_, base_, sizeof(header_));
+    if (header_.magic != JOURNAL_MAGIC || header_.version != JOURNAL_VERSION) {
+        close();
+        return false;
+    }
+    end_ = static_cast<size_t>(std::min<uint64_t>(header_.end, size_));
+    pos_ = JOURNAL_HEADER_SIZE;
+    t_us_ = header_.start_mono_us;
+    last_ = {};
+    return true;
+}
+
+void JournalReader::close() {
+    if (base_) munmap(const_cast<uint8_t*>(base_), size_);
+    base_ = nullptr;
+    size_ = end_ = pos_ = 0;
+}
+
+bool JournalReader::varint(uint64_t& out) {
+    out = 0;
+    for (int shift = 0; shift < 64 && pos_ < end_; shift += 7) {
+        uint8_t b = base_[pos_++];
+        out |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+bool JournalReader::bytes(size_t len, std::string_view& out) {
+    if (len > end_ - pos_) return false;
+    // reinterpret_cast: uint8_t -> char aliasing (standard-allowed)
+    out = std::string_view(reinterpret_cast<const char*>(base_ + pos_), len);
+    pos_ += len;
+    return true;
+}
+
+bool JournalReader::next(JournalRecord& rec) {
+    if (!base_ || pos_ >= end_) return false;
+    uint8_t tag = base_[pos_];
+    unsigned src = tag >> 6;
+    unsigned kind = (tag >> 4) & 3;
+    unsigned key_id = tag & 0xF;
+    if (src == 0 || kind > static_cast<unsigned>(JournalKind::Raw) || key_id >= KV_KEY_NAMES.size()) {
+        return false;
+    }
+    pos_++;
+
+    uint64_t dt = 0, len = 0;
+    if (!varint(dt)) return false;
+    t_us_ += dt;
+    rec = { static_cast<JournalSource>(src), static_cast<JournalKind>(kind), t_us_,
+            static_cast<KvKey>(key_id), {}, {} };
+
+    auto& last = last_.at(src).at(key_id);
+    switch (rec.kind) {
+        case JournalKind::Kv:
+            if (key_id == 0) {
+                if (!varint(len) || !bytes(static_cast<size_t>(len), rec.key)) return false;
+            } else {
+                rec.key = kv_key_name(rec.id);
+            }
+            if (!varint(len) || !bytes(static_cast<size_t>(len), rec.data)) return false;
+            if (key_id != 0) last = rec.data;
+            return true;
+        case JournalKind::Repeat:
+            if (key_id == 0) return false;
+            rec.key = kv_key_name(rec.id);
+            rec.data = last;
+            return true;
+        case JournalKind::Raw:
+            return varint(len) && bytes(static_cast<size_t>(len), rec.data);
+    }
+    return false;
+}
@@ -0,0 +1,149 @@
+/*
+ * journal.h — mmap'd rotating flight recorder for bus traffic
+ *
+ * BusJournal appends every console, motor and emulate frame to a ring of
+ * fixed-size segment files (journal-<slot>.tmj) mapped with MAP_SHARED.
+ * Appending is a memcpy into the mapping under an uncontended mutex — no
+ * syscalls except when a full segment rotates to the next file. The page
+ * cache keeps the data if the process dies.
+ *
+ * Record encoding (all integers LEB128 varints):
+ *
+ *   tag      src << 6 | kind << 4 | key id (KvKey in 4 bits, 0 = key
+ *            text follows)
+ *   dt_us    microseconds since the previous record (segment start for
+ *            the first)
+ *   Kv:      [klen key]  vlen value
+ *   Repeat:  nothing — same value as the last Kv for this src + key
+ *   Raw:     len bytes
+ *
+ * Tag 0 never occurs (src is 1-3), so a zero byte marks the end of data
+ * even after a crash. Each segment is self-contained: the timestamp
+ * base and repeat table restart at its first record.
+ *
+ * JournalReader maps a segment read-only and walks it; record keys and
+ * values are views into the mapping (zero-copy).
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include "kv_protocol.h"
+
+enum class JournalSource : uint8_t { Console = 1, Motor = 2, Emulate = 3 };
+enum class JournalKind : uint8_t { Kv = 0, Repeat = 1, Raw = 2 };
+
+constexpr size_t JOURNAL_HEADER_SIZE = 64;
+constexpr size_t JOURNAL_RAW_MAX = 512;       // longer raw chunks are split
+constexpr uint32_t JOURNAL_VERSION = 1;
+
+// Fixed header at the start of every segment file
+struct JournalHeader {
+    std::array<char, 4> magic;   // "TMJ1"
+    uint32_t version;
+    uint64_t seq;                // segment sequence number, never reused
+    uint64_t start_mono_us;      // CLOCK_MONOTONIC at segment start
+    uint64_t start_real_us;      // CLOCK_REALTIME at segment start
+    uint64_t end;                // bytes of valid data (header included)
+    std::array<uint8_t, 24> reserved;
+};
+static_assert(sizeof(JournalHeader) == JOURNAL_HEADER_SIZE);
+
+struct JournalConfig {
+    std::string dir;                       // empty = journal disabled
+    size_t segment_bytes = 4u << 20;       // per segment file
+    int segments = 8;                      // files in the rotation
+};
+
+class BusJournal {
+public:
+    explicit BusJournal(JournalConfig cfg) : cfg_(std::move(cfg)) {}
+    ~BusJournal() { close(); }
+    BusJournal(const BusJournal&) = delete;
+    BusJournal& operator=(const BusJournal&) = delete;
+
+    // Map a fresh segment, numbered after the newest one already on disk.
+    // Returns false if disabled or the directory isn't writable.
+    bool open();
+    void close();
+    bool is_open() const { return base_ != nullptr; }
+
+    // Append one frame / raw chunk. t_us = 0 stamps with mono_us().
+    // No-ops while closed. Thread-safe.
+    void record_kv(JournalSource src, const KvPair& kv, uint64_t t_us = 0);
+    void record_kv(JournalSource src, std::string_view key, std::string_view value,
+                   uint64_t t_us = 0);
+    void record_raw(JournalSource src, std::span<const uint8_t> bytes, uint64_t t_us = 0);
+
+    uint64_t segment_seq() const;
+    uint64_t records() const;
+
+    static std::string segment_path(std::string_view dir, int slot);
+
+private:
+    struct LastValue {
+        std::array<char, KV_FIELD_SIZE> bytes{};
+        uint8_t len = 0;
+        bool valid = false;
+    };
+
+    void append(JournalSource src, KvKey id, std::string_view key, std::string_view value,
+                uint64_t t_us);
+    bool map_segment(uint64_t seq);
+    void unmap_segment();
+    static void put_header_end(uint8_t* base, uint64_t end);
+
+    JournalConfig cfg_;
+    mutable std::mutex mu_;
+    uint8_t* base_ = nullptr;
+    size_t pos_ = 0;
+    uint64_t seq_ = 0;
+    uint64_t last_us_ = 0;
+    uint64_t records_ = 0;
+    std::array<std::array<LastValue, KV_KEY_NAMES.size()>, 4> last_{};  // [src][key]
+};
+
+struct JournalRecord {
+    JournalSource src;
+    JournalKind kind;
+    uint64_t t_us;          // CLOCK_MONOTONIC microseconds
+    KvKey id;
+    std::string_view key;   // Kv/Repeat
+    std::string_view data;  // value (Kv/Repeat) or raw bytes
+};
+
+class JournalReader {
+public:
+    JournalReader() = default;
+    ~JournalReader() { close(); }
+    JournalReader(const JournalReader&) = delete;
+    JournalReader& operator=(const JournalReader&) = delete;
+
+    // Map a segment file read-only. False if missing or not a journal.
+    bool open(std::string_view path);
+    void close();
+
+    // Decode the next record. False at the end of data (or on a
+    // truncated/corrupt record). Views stay valid until close().
+    bool next(JournalRecord& rec);
+
+    const JournalHeader& header() const { return header_; }
+
+private:
+    bool varint(uint64_t& out);
+    bool bytes(size_t len, std::string_view& out);
+
+    const uint8_t* base_ = nullptr;
+    size_t size_ = 0;
+    size_t end_ = 0;
+    size_t pos_ = 0;
+    uint64_t t_us_ = 0;
+    JournalHeader header_{};
+    std::array<std::array<std::string_view, KV_KEY_NAMES.size()>, 4> last_{};
+};
@@ -0,0 +1,78 @@
+/*
+ * kv_cycle_buffer.h — One source's frames for the bus cycle in progress
+ *
+ * With "events": {"cycles": true} the controller also publishes each bus
+ * cycle of each source as a single `cycle` event (ipc_protocol.h): about
+ * fourteen frames in one ring message and one JSON line, for clients that
+ * want whole cycles rather than a kv event per frame. KvCycleBuffer holds
+ * a cycle's frames until it ends: the key, the value and when it came,
+ * copied into a fixed text arena, so nothing allocates.
+ *
+ * Where a cycle ends is the caller's: the emulate thread knows its own
+ * cycle (EmulationEngine::on_cycle_end); console and motor cycles end
+ * when a frame that starts burst 0 arrives (bus_burst_started_by()), as
+ * the bus analyzer counts them.
+ *
+ * One writer thread per buffer (its reader, or the emulate thread).
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <array>
+#include <algorithm>
+#include <string_view>
+#include "ipc_protocol.h"
+
+constexpr size_t CYCLE_MAX_FRAMES = 24;   // 14 keys, plus every-burst repeats
+constexpr size_t CYCLE_TEXT_BYTES = 384;  // keys and values, typical cycles use ~120
+
+class KvCycleBuffer {
+public:
+    KvCycleBuffer() = default;
+    KvCycleBuffer(const KvCycleBuffer&) = delete;  // views point into text_
+    KvCycleBuffer& operator=(const KvCycleBuffer&) = delete;
+
+    // Add a frame seen at `ts` (seconds, as in kv events). False if it
+    // doesn't fit: publish and clear(), then add it again.
+    bool add(std::string_view key, std::string_view value, double ts) {
+        if (n_ == CYCLE_MAX_FRAMES || key.size() + value.size() > text_.size() - used_) return false;
+        if (n_ == 0) ts_ = ts;
+        keys_.at(n_) = store(key);
+        values_.at(n_) = store(value);
+        double dt = std::round((ts - ts_) * 1e6);
+        dt_us_.at(n_) = static_cast<int32_t>(std::clamp(dt, 0.0, 2e9));
+        n_++;
+        return true;
+    }
+
+    bool empty() const { return n_ == 0; }
+    size_t size() const { return n_; }
+
+    // The cycle so far, viewing this buffer until the next add() or clear()
+    CycleEvent event(std::string_view source) const {
+        return { source, ts_, { keys_.data(), n_ }, { values_.data(), n_ }, { dt_us_.data(), n_ } };
+    }
+
+    void clear() {
+        n_ = 0;
+        used_ = 0;
+    }
+
+private:
+    std::string_view store(std::string_view s) {
+        std::copy(s.begin(), s.end(), text_.begin() + static_cast<std::ptrdiff_t>(used_));
+        std::string_view out(text_.data() + used_, s.size());
+        used_ += s.size();
+        return out;
+    }
+
+    std::array<char, CYCLE_TEXT_BYTES> text_{};
+    size_t used_ = 0;
+    std::array<std::string_view, CYCLE_MAX_FRAMES> keys_{};
+    std::array<std::string_view, CYCLE_MAX_FRAMES> values_{};
+    std::array<int32_t, CYCLE_MAX_FRAMES> dt_us_{};
+    size_t n_ = 0;
+    double ts_ = 0;
+};
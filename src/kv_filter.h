@@ -0,0 +1,59 @@
+/*
+ * kv_filter.h — Change-only filter for KV events
+ *
+ * The motor answers the same status queries about once a second and the
+ * console repeats part/diag/loop every cycle, almost always with the same
+ * values. KvChangeFilter keeps the last value per interned key for one
+ * source and passes a frame only when its value differs.
+ *
+ * resync() makes the next frame of every key pass again (a keyframe),
+ * so a client that joins late sees the full state within one bus cycle.
+ * Unknown keys always pass — they aren't interned.
+ *
+ * One filter per source: should_emit() is called only from that source's
+ * thread; resync() may be called from any thread.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <string_view>
+#include "kv_protocol.h"
+
+class KvChangeFilter {
+public:
+    // True if the frame should be published (first sight, changed value,
+    // or first after a resync). Records the value either way.
+    bool should_emit(KvKey id, std::string_view value) {
+        if (id == KvKey::Unknown) return true;
+        auto& e = last_.at(static_cast<size_t>(id));
+        uint32_t epoch = epoch_.load(std::memory_order_relaxed);
+        if (e.epoch == epoch && std::string_view(e.bytes.data(), e.len) == value) {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        e.len = static_cast<uint8_t>(std::min(value.size(), e.bytes.size()));
+        std::copy_n(value.data(), e.len, e.bytes.data());
+        e.epoch = epoch;
+        return true;
+    }
+
+    void resync() { epoch_.fetch_add(1, std::memory_order_relaxed); }
+
+    // Frames dropped as unchanged since construction
+    uint64_t suppressed() const { return suppressed_.load(std::memory_order_relaxed); }
+
+private:
+    struct Entry {
+        std::array<char, KV_FIELD_SIZE> bytes{};
+        uint8_t len = 0;
+        uint32_t epoch = 0;  // != epoch_ = stale, emit next value
+    };
+
+    std::array<Entry, KV_KEY_NAMES.size()> last_{};
+    std::atomic<uint32_t> epoch_{1};
+    std::atomic<uint64_t> suppressed_{0};
+};
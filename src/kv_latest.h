@@ -0,0 +1,87 @@
+/*
+ * kv_latest.h — Latest value per (source, key), for client snapshots
+ *
+ * KvLatest keeps every interned key's last value from the console, motor
+ * and emulate streams, recorded as each frame arrives whether or not
+ * change-only mode publishes it. A client that connects gets the whole
+ * table as one snapshot event (ipc_protocol.h) instead of waiting a bus
+ * cycle, or until they change, for values like ver, type and belt.
+ *
+ * Bare queries (empty values) carry no state and are not recorded; keys
+ * outside KV_KEY_NAMES aren't interned and aren't kept.
+ *
+ * Each source has one writer thread (its reader, or the emulate thread);
+ * copy() may run on any thread. Entries are seqlocked one by one, so a
+ * write never waits and a copy only retries the entry being written.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <string_view>
+#include "kv_protocol.h"
+#include "ipc_protocol.h"
+
+// Sources in SUB_SOURCE_NAMES order, as in kv records
+constexpr size_t KV_SOURCE_CONSOLE = 0;
+constexpr size_t KV_SOURCE_MOTOR = 1;
+constexpr size_t KV_SOURCE_EMULATE = 2;
+static_assert(SUB_SOURCE_NAMES.at(KV_SOURCE_EMULATE) == "emulate");
+
+class KvLatest {
+public:
+    struct Field {
+        std::array<char, KV_FIELD_SIZE> bytes{};
+        uint8_t len = 0;  // 0: never seen
+
+        std::string_view view() const { return { bytes.data(), len }; }
+    };
+    using Table = std::array<std::array<Field, KV_KEY_NAMES.size()>, SUB_SOURCE_NAMES.size()>;
+
+    // Writer thread of `source` only
+    void record(size_t source, KvKey id, std::string_view value) {
+        if (id == KvKey::Unknown || value.empty() || source >= entries_.size()) return;
+        auto& e = entries_.at(source).at(static_cast<size_t>(id));
+        auto len = static_cast<uint8_t>(std::min(value.size(), e.field.bytes.size()));
+        if (e.field.view() == value.substr(0, len)) return;  // unchanged: no seqlock traffic
+
+        uint32_t s = e.seq.load(std::memory_order_relaxed);
+        e.seq.store(s + 1, std::memory_order_relaxed);  // odd: write in progress
+        std::atomic_thread_fence(std::memory_order_release);
+        std::copy_n(value.data(), len, e.field.bytes.data());
+        e.field.len = len;
+        e.seq.store(s + 2, std::memory_order_release);
+    }
+
+    // Every entry, each as of some moment during the call
+    void copy(Table& out) const {
+        for (size_t s = 0; s < entries_.size(); s++) {
+            for (size_t k = 0; k < KV_KEY_NAMES.size(); k++) read(entries_.at(s).at(k), out.at(s).at(k));
+        }
+    }
+
+private:
+    static constexpr int READ_RETRIES = 64;
+
+    struct Entry {
+        std::atomic<uint32_t> seq{0};
+        Field field;
+    };
+
+    // Left out (len 0) if its writer is mid-write for every retry
+    static void read(const Entry& e, Field& out) {
+        for (int i = 0; i < READ_RETRIES; i++) {
+            uint32_t before = e.seq.load(std::memory_order_acquire);
+            if (before & 1) continue;
+            out = e.field;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (e.seq.load(std::memory_order_relaxed) == before) return;
+        }
+        out.len = 0;
+    }
+
+    std::array<std::array<Entry, KV_KEY_NAMES.size()>, SUB_SOURCE_NAMES.size()> entries_{};
+};
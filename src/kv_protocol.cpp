@@ -4,102 +4,185 @@
 
 #include "kv_protocol.h"
 #include <charconv>
+#include <cstring>
+#include <algorithm>
+
+static bool kv_delimiter(uint8_t b) { return b == 0xFF || b == 0x00; }
+
+// Validate a frame's content (between the brackets) and split it into
+// `pair`, counting the outcome in `stats`. Shared by kv_parse() and
+// KvStreamParser.
+static bool kv_extract(std::string_view content, KvPair& pair, KvParseStats& stats) {
+    if (content.empty() || content.size() >= KV_FIELD_SIZE) {
+        stats.bad_length++;
+        return false;
+    }
+
+    // Validate: all bytes must be printable ASCII
+    for (char ch : content) {
+        auto u = static_cast<uint8_t>(ch);
+        if (u < 0x20 || u > 0x7E) {
+            stats.nonprintable++;
+            return false;
+        }
+    }
+
+    // Stored verbatim; key_len marks the colon (or the end, if bare)
+    auto colon_pos = content.find(':');
+    size_t key_len = colon_pos != std::string_view::npos ? colon_pos : content.size();
+    content.copy(pair.text.data(), content.size());
+    pair.len = static_cast<uint8_t>(content.size());
+    pair.key_len = static_cast<uint8_t>(key_len);
+    pair.id = kv_key_lookup(content.substr(0, key_len));
+    pair.t_ns = 0;
+    stats.frames++;
+    return true;
+}
 
-int kv_parse(std::span<const uint8_t> buf, KvPair* pairs, int max_pairs, int* consumed) {
-    int len = static_cast<int>(buf.size());
-    int i = 0, n = 0;
+int kv_parse(std::span<const uint8_t> buf, KvPair* pairs, int max_pairs, int* consumed,
+             KvParseStats* stats) {
+    KvParseStats local{};
+    KvParseStats& st = stats ? *stats : local;
+    size_t len = buf.size();
+    size_t i = 0;
+    int n = 0;
 
     while (i < len && n < max_pairs) {
-        // Skip delimiters
-        if (buf[i] == 0xFF || buf[i] == 0x00) {
+        if (buf[i] != '[') {
+            // Delimiters (\xff, \x00) and stray bytes
+            if (!kv_delimiter(buf[i])) st.stray_bytes++;
             i++;
             continue;
         }
-        if (buf[i] == '[') {
-            // Find closing bracket
-            int end = -1;
-            for (int j = i + 1; j < len; j++) {
-                if (buf[j] == ']') { end = j; break; }
-            }
-            if (end == -1) break;  // incomplete frame
-
-            int raw_len = end - i - 1;
-            // Validate: all bytes must be printable ASCII
-            bool printable = true;
-            for (int j = i + 1; j < end; j++) {
-                if (buf[j] < 0x20 || buf[j] > 0x7E) {
-                    printable = false;
-                    break;
-                }
-            }
+        // Find closing bracket
+        const void* close = std::memchr(buf.data() + i + 1, ']', len - i - 1);
+        if (close == nullptr) break;  // incomplete frame
+        size_t end = static_cast<size_t>(static_cast<const uint8_t*>(close) - buf.data());
+
+        // reinterpret_cast: uint8_t -> char aliasing (standard-allowed)
+        std::string_view content(reinterpret_cast<const char*>(buf.data() + i + 1), end - i - 1);
+        if (kv_extract(content, pairs[n], st)) n++;
+        i = end + 1;
+    }
 
-            if (printable && raw_len > 0 && raw_len < KV_FIELD_SIZE) {
-                // Extract content between brackets as a string_view
-                // reinterpret_cast: uint8_t -> char aliasing (standard-allowed)
-                std::string_view content(reinterpret_cast<const char*>(buf.data() + i + 1), raw_len);
-
-                auto colon_pos = content.find(':');
-                auto& pair = pairs[n];
-
-                if (colon_pos != std::string_view::npos) {
-                    auto key_part = content.substr(0, colon_pos);
-                    auto val_part = content.substr(colon_pos + 1);
-                    // Safe copy into fixed arrays with bounds check
-                    if (key_part.size() < KV_FIELD_SIZE && val_part.size() < KV_FIELD_SIZE) {
-                        key_part.copy(pair.key.data(), key_part.size());
-                        pair.key.at(key_part.size()) = '\0';
-                        val_part.copy(pair.value.data(), val_part.size());
-                        pair.value.at(val_part.size()) = '\0';
-                        n++;
-                    }
-                } else {
-                    // Bare key with no value
-                    if (content.size() < KV_FIELD_SIZE) {
-                        content.copy(pair.key.data(), content.size());
-                        pair.key.at(content.size()) = '\0';
-                        pair.value.at(0) = '\0';
-                        n++;
-                    }
-                }
-            }
-            i = end + 1;
-        } else {
-            i++;
+    st.bytes += i;
+    *consumed = static_cast<int>(i);
+    return n;
+}
+
+// --- KvStreamParser ---
+
+std::span<uint8_t> KvStreamParser::write_space() {
+    if (pending() == KV_STREAM_BUF_SIZE) {
+        // Only an unterminated frame can fill the ring: drop it
+        stats_.overflow_bytes += pending();
+        head_ = scan_ = tail_;
+        in_frame_ = false;
+    }
+    size_t pos = tail_ & MASK;
+    size_t run = std::min(KV_STREAM_BUF_SIZE - pos, KV_STREAM_BUF_SIZE - pending());
+    return std::span<uint8_t>(buf_.data() + pos, run);
+}
+
+void KvStreamParser::commit(size_t n) {
+    n = std::min(n, KV_STREAM_BUF_SIZE - pending());
+    tail_ += n;
+    stats_.bytes += n;
+}
+
+// Bytes in [from, to) that aren't delimiters; usually none or one
+void KvStreamParser::count_stray(size_t from, size_t to) {
+    for (size_t i = from; i < to; i++) {
+        if (!kv_delimiter(buf_.at(i & MASK))) stats_.stray_bytes++;
+    }
+}
+
+// Position of the first `c` in [from, tail_), or tail_ if none
+size_t KvStreamParser::find(size_t from, uint8_t c) const {
+    while (from < tail_) {
+        size_t pos = from & MASK;
+        size_t run = std::min(KV_STREAM_BUF_SIZE - pos, tail_ - from);
+        const void* hit = std::memchr(buf_.data() + pos, c, run);
+        if (hit != nullptr) {
+            return from + static_cast<size_t>(static_cast<const uint8_t*>(hit) - (buf_.data() + pos));
         }
+        from += run;
+    }
+    return tail_;
+}
+
+// Content in [begin, end) may wrap the ring; copy it out contiguously
+bool KvStreamParser::extract(size_t begin, size_t end, KvPair& pair) {
+    size_t len = end - begin;
+    if (len == 0 || len >= KV_FIELD_SIZE) {
+        stats_.bad_length++;
+        return false;
     }
 
-    *consumed = i;
-    return n;
+    std::array<char, KV_FIELD_SIZE> content;
+    size_t pos = begin & MASK;
+    size_t first = std::min(len, KV_STREAM_BUF_SIZE - pos);
+    std::copy_n(buf_.data() + pos, first, content.data());
+    std::copy_n(buf_.data(), len - first, content.data() + first);
+    return kv_extract(std::string_view(content.data(), len), pair, stats_);
 }
 
-std::string kv_build(std::string_view key, std::string_view value) {
-    std::string result;
-    result.reserve(key.size() + value.size() + 4);
-    result += '[';
-    result += key;
-    if (!value.empty()) {
-        result += ':';
-        result += value;
+// The key of the content in [begin, end) is one set_keys() asked for.
+// Keys are at most 4 bytes: a longer one reads as Unknown.
+bool KvStreamParser::wanted(size_t begin, size_t end) const {
+    std::array<char, 8> key;
+    size_t n = 0;
+    for (size_t i = begin; i < end && n < key.size(); i++) {
+        char c = static_cast<char>(buf_.at(i & MASK));
+        if (c == ':') break;
+        key.at(n++) = c;
     }
-    result += ']';
-    result += static_cast<char>(0xFF);
-    return result;
+    return keys_ & kv_key_bit(kv_key_lookup({ key.data(), n }));
 }
 
-std::string encode_speed_hex(int tenths_mph) {
-    // Speed wire format: mph * 100, in uppercase hex
-    // tenths_mph is in tenths, so multiply by 10 to get hundredths
-    int hundredths = tenths_mph * 10;
-    std::array<char, 16> buf{};
-    auto [ptr, ec] = std::to_chars(buf.data(), buf.data() + buf.size(), hundredths, 16);
-    std::string result(buf.data(), ptr);
-    // Convert to uppercase
-    for (auto& c : result) {
-        if (c >= 'a' && c <= 'f') c -= 32;
+int KvStreamParser::parse(std::span<KvPair> out) {
+    size_t n = 0;
+    while (n < out.size()) {
+        if (!in_frame_) {
+            // Everything before the next '[' is delimiters or noise
+            head_ = find(scan_, '[');
+            count_stray(scan_, head_);
+            scan_ = head_;
+            if (head_ == tail_) break;
+            in_frame_ = true;
+            scan_ = head_ + 1;
+        }
+        size_t close = find(scan_, ']');
+        if (close == tail_) {
+            scan_ = tail_;  // resume here once more bytes arrive
+            break;
+        }
+        if (keys_ != KV_PARSE_ALL && !wanted(head_ + 1, close)) {
+            stats_.skipped++;
+        } else if (extract(head_ + 1, close, out[n])) {
+            if (stamp_ns_ != 0) {
+                size_t later = stamp_pos_ > close ? stamp_pos_ - 1 - close : 0;  // bytes after the ']'
+                out[n].t_ns = stamp_ns_ - static_cast<int64_t>(later) * byte_ns_;
+            }
+            n++;
+        }
+        in_frame_ = false;
+        head_ = scan_ = close + 1;
     }
+    return static_cast<int>(n);
+}
+
+std::string kv_build(std::string_view key, std::string_view value) {
+    std::string result(key.size() + value.size() + 4, '\0');
+    result.resize(kv_build(std::span<char>(result), key, value));
     return result;
 }
 
+std::string encode_speed_hex(int tenths_mph) {
+    std::array<char, 12> buf{};
+    return std::string(buf.data(), encode_speed_hex(buf, tenths_mph));
+}
+
 int decode_speed_hex(std::string_view hex) {
     if (hex.empty() || hex.size() > 10) return -1;
 
@@ -112,16 +195,8 @@ int decode_speed_hex(std::string_view hex) {
 }
 
 std::string encode_incline_hex(int half_pct) {
-    // Incline wire format: half-percent units, uppercase hex
-    // Input is already in half-pct units (1 = 0.5%)
-    std::array<char, 16> buf{};
-    auto [ptr, ec] = std::to_chars(buf.data(), buf.data() + buf.size(), half_pct, 16);
-    std::string result(buf.data(), ptr);
-    // Convert to uppercase
-    for (auto& c : result) {
-        if (c >= 'a' && c <= 'f') c -= 32;
-    }
-    return result;
+    std::array<char, 12> buf{};
+    return std::string(buf.data(), encode_incline_hex(buf, half_pct));
 }
 
 int decode_incline_hex(std::string_view hex) {
@@ -1,8 +1,18 @@
 /*
  * kv_protocol.h — KV parser + builder for the treadmill wire protocol
  *
- * Pure functions, no I/O, no state. The treadmill uses a unique text
- * protocol: [key:value]\xff framing at 9600 baud.
+ * No I/O. The treadmill uses a unique text protocol: [key:value]\xff
+ * framing at 9600 baud.
+ *
+ * kv_parse() is a pure function over a complete buffer. KvStreamParser
+ * is its resumable form for serial streams: bytes are read straight into
+ * its ring buffer and each call resumes the delimiter scan where the last
+ * one stopped, so a long incomplete frame is never rescanned.
+ *
+ * Encoders and builders come in two forms: span-based constexpr
+ * versions that write into a caller buffer (no allocation, usable to
+ * generate tables at compile time), and std::string wrappers for the
+ * cold paths.
  */
 
 #pragma once
@@ -16,12 +26,83 @@
 static constexpr int KV_FIELD_SIZE = 64;
 static constexpr int MAX_KV_CONTENT_LEN = 127;
 
+// Interned protocol keys: the 14 keys of the emulate cycle, which are
+// also the keys the motor answers with. Anything else is Unknown and is
+// only available as text.
+enum class KvKey : uint8_t {
+    Unknown, Inc, Hmph, Amps, Err, Belt, Vbus, Lift, Lfts, Lftg, Part, Ver, Type, Diag, Loop,
+};
+
+static constexpr std::array<std::string_view, 15> KV_KEY_NAMES = {
+    "", "inc", "hmph", "amps", "err", "belt", "vbus", "lift", "lfts", "lftg",
+    "part", "ver", "type", "diag", "loop",
+};
+
+// Perfect hash over KV_KEY_NAMES: first char, last char and length pick
+// one of 32 slots (collision-free, checked below).
+constexpr size_t kv_key_hash(std::string_view key) {
+    return (static_cast<uint8_t>(key.front()) + 11u * static_cast<uint8_t>(key.back()) +
+            key.size()) & 31u;
+}
+
+static constexpr std::array<KvKey, 32> KV_KEY_SLOTS = [] {
+    std::array<KvKey, 32> slots{};
+    for (size_t i = 1; i < KV_KEY_NAMES.size(); i++) {
+        slots.at(kv_key_hash(KV_KEY_NAMES.at(i))) = static_cast<KvKey>(i);
+    }
+    return slots;
+}();
+
+constexpr std::string_view kv_key_name(KvKey id) {
+    return KV_KEY_NAMES.at(static_cast<size_t>(id));
+}
+
+// Key sets for KvStreamParser::set_keys(): bit i = KvKey i
+constexpr uint32_t KV_PARSE_ALL = ~0u;
+constexpr uint32_t kv_key_bit(KvKey id) { return 1u << static_cast<unsigned>(id); }
+
+// Map key text to its KvKey: one hash, one compare.
+constexpr KvKey kv_key_lookup(std::string_view key) {
+    if (key.empty()) return KvKey::Unknown;
+    KvKey id = KV_KEY_SLOTS.at(kv_key_hash(key));
+    return kv_key_name(id) == key ? id : KvKey::Unknown;
+}
+
+static_assert([] {
+    for (size_t i = 1; i < KV_KEY_NAMES.size(); i++) {
+        if (kv_key_lookup(KV_KEY_NAMES.at(i)) != static_cast<KvKey>(i)) return false;
+    }
+    return true;
+}(), "kv_key_hash collides on the protocol key set");
+
+// One parsed frame: the content between the brackets, stored inline,
+// plus the interned key and arrival time. 80 bytes, so a poll's pairs
+// stay in L1.
 struct KvPair {
-    std::array<char, KV_FIELD_SIZE> key{};
-    std::array<char, KV_FIELD_SIZE> value{};
+    KvKey id = KvKey::Unknown;
+    uint8_t key_len = 0;
+    uint8_t len = 0;                              // content bytes: key[:value]
+    std::array<char, KV_FIELD_SIZE - 1> text{};   // not NUL-terminated
+    int64_t t_ns = 0;                             // wire_now_ns() of the ']' (stamped parsers), else 0
+
+    std::string_view key_view() const { return { text.data(), key_len }; }
+    std::string_view value_view() const {
+        if (len <= key_len) return {};
+        return { text.data() + key_len + 1, static_cast<size_t>(len - key_len - 1) };
+    }
+};
 
-    std::string_view key_view() const { return key.data(); }
-    std::string_view value_view() const { return value.data(); }
+// Line quality counters of a parser: what came in and what was thrown
+// away. Bytes outside brackets other than the \xff / \x00 delimiters
+// are stray.
+struct KvParseStats {
+    uint64_t bytes = 0;           // bytes fed to the parser
+    uint64_t frames = 0;          // pairs accepted
+    uint64_t nonprintable = 0;    // frames rejected for a byte outside 0x20-0x7E
+    uint64_t bad_length = 0;      // frames rejected as empty or KV_FIELD_SIZE or longer
+    uint64_t stray_bytes = 0;
+    uint64_t overflow_bytes = 0;  // unterminated frames dropped from a full parse ring
+    uint64_t skipped = 0;         // frames left unparsed: key not in set_keys()
 };
 
 /*
@@ -33,9 +114,83 @@ struct KvPair {
  *
  * Returns the number of pairs found.
  * Sets *consumed to the number of bytes processed (unconsumed bytes
- * should be kept for the next call).
+ * should be kept for the next call). If `stats` is given, the consumed
+ * bytes are added to it.
+ */
+int kv_parse(std::span<const uint8_t> buf, KvPair* pairs, int max_pairs, int* consumed,
+             KvParseStats* stats = nullptr);
+
+static constexpr size_t KV_STREAM_BUF_SIZE = 4096;  // parse ring (power of 2)
+static_assert((KV_STREAM_BUF_SIZE & (KV_STREAM_BUF_SIZE - 1)) == 0);
+
+/*
+ * Incremental kv_parse() over a fixed ring buffer — same framing and
+ * validation rules, no shifting, no rescans.
+ *
+ * Producer side: write_space() returns the contiguous free run at the
+ * write end; read into it and commit() the byte count. At most two
+ * write_space()/commit() rounds fill the ring.
+ *
+ * Consumer side: parse() fills `out` with complete pairs and keeps its
+ * scan position, so bytes are looked at once no matter how a frame is
+ * split across reads. Delimiters are found with memchr.
+ *
+ * stamp() after a commit() dates the pairs: each gets the arrival time
+ * of its ']', counted back from the last committed byte one byte time
+ * per byte.
+ *
+ * set_keys() narrows parse() to some keys: other frames are still found
+ * (and counted as skipped) but never copied out or validated.
+ *
+ * If an unterminated frame fills the whole ring it can never complete;
+ * write_space() discards it and counts the bytes in dropped_bytes().
+ * stats() counts every byte and frame, accepted or not.
+ * Single-threaded: producer and consumer must be the same thread.
  */
-int kv_parse(std::span<const uint8_t> buf, KvPair* pairs, int max_pairs, int* consumed);
+class KvStreamParser {
+public:
+    std::span<uint8_t> write_space();
+    void commit(size_t n);
+
+    // The last committed byte arrived at `last_ns`; bytes are `byte_ns`
+    // apart. Until the first call, pairs have t_ns = 0.
+    void stamp(int64_t last_ns, int64_t byte_ns) {
+        stamp_ns_ = last_ns;
+        stamp_pos_ = tail_;
+        byte_ns_ = byte_ns;
+    }
+
+    // Extract up to out.size() pairs. Returns the number written; call
+    // again if it returned out.size().
+    int parse(std::span<KvPair> out);
+
+    // Keys parse() extracts from here on (KV_PARSE_ALL by default)
+    void set_keys(uint32_t keys) { keys_ = keys; }
+
+    size_t pending() const { return tail_ - head_; }
+    uint64_t dropped_bytes() const { return stats_.overflow_bytes; }
+    const KvParseStats& stats() const { return stats_; }
+
+private:
+    static constexpr size_t MASK = KV_STREAM_BUF_SIZE - 1;
+
+    size_t find(size_t from, uint8_t c) const;
+    bool extract(size_t begin, size_t end, KvPair& pair);
+    bool wanted(size_t begin, size_t end) const;
+    void count_stray(size_t from, size_t to);
+
+    std::array<uint8_t, KV_STREAM_BUF_SIZE> buf_{};
+    // Monotonic byte counts; index with & MASK. head_ <= scan_ <= tail_.
+    size_t head_ = 0;       // oldest unconsumed byte ('[' while in_frame_)
+    size_t scan_ = 0;       // next byte to search
+    size_t tail_ = 0;       // end of committed data
+    bool in_frame_ = false; // saw '[' at head_, searching for ']'
+    int64_t stamp_ns_ = 0;  // arrival of the byte before stamp_pos_
+    size_t stamp_pos_ = 0;
+    int64_t byte_ns_ = 0;
+    uint32_t keys_ = KV_PARSE_ALL;
+    KvParseStats stats_{};
+};
 
 /*
  * Build a KV command in wire format: [key:value]\xff
@@ -43,12 +198,50 @@ int kv_parse(std::span<const uint8_t> buf, KvPair* pairs, int max_pairs, int* co
  */
 std::string kv_build(std::string_view key, std::string_view value = {});
 
+// Span form: writes the frame into `out`. Returns bytes written, or 0 if
+// it does not fit.
+constexpr size_t kv_build(std::span<char> out, std::string_view key, std::string_view value = {}) {
+    size_t need = key.size() + (value.empty() ? 0 : value.size() + 1) + 3;
+    if (need > out.size()) return 0;
+    size_t pos = 0;
+    out[pos++] = '[';
+    for (char c : key) out[pos++] = c;
+    if (!value.empty()) {
+        out[pos++] = ':';
+        for (char c : value) out[pos++] = c;
+    }
+    out[pos++] = ']';
+    out[pos++] = static_cast<char>(0xFF);
+    return pos;
+}
+
+// Uppercase hex of `val` into `out` ("-" prefix if negative). Returns
+// chars written, or 0 if it does not fit.
+constexpr size_t encode_hex_upper(std::span<char> out, int val) {
+    constexpr char digits[] = "0123456789ABCDEF";
+    std::array<char, 9> rev{};  // 32-bit int: at most 8 hex digits
+    unsigned u = val < 0 ? 0u - static_cast<unsigned>(val) : static_cast<unsigned>(val);
+    size_t n = 0;
+    do {
+        rev.at(n++) = digits[u & 0xF];
+        u >>= 4;
+    } while (u != 0);
+    if (val < 0) rev.at(n++) = '-';
+    if (n > out.size()) return 0;
+    for (size_t i = 0; i < n; i++) out[i] = rev.at(n - 1 - i);
+    return n;
+}
+
 /*
  * Encode speed in tenths of mph to uppercase hex string (mph * 100).
  * E.g., 12 (1.2 mph) -> "78", 120 (12.0 mph) -> "4B0"
  */
 std::string encode_speed_hex(int tenths_mph);
 
+constexpr size_t encode_speed_hex(std::span<char> out, int tenths_mph) {
+    return encode_hex_upper(out, tenths_mph * 10);  // wire unit: mph * 100
+}
+
 /*
  * Decode uppercase hex string to speed in tenths of mph.
  * E.g., "78" -> 12 (1.2 mph), "4B0" -> 120 (12.0 mph)
@@ -63,6 +256,10 @@ int decode_speed_hex(std::string_view hex);
  */
 std::string encode_incline_hex(int half_pct);
 
+constexpr size_t encode_incline_hex(std::span<char> out, int half_pct) {
+    return encode_hex_upper(out, half_pct);
+}
+
 /*
  * Decode uppercase hex string to incline half-pct value.
  * Returns the raw hex value as half-percent units (1 = 0.5%).
@@ -70,3 +267,51 @@ std::string encode_incline_hex(int half_pct);
  * Returns -1 on parse error.
  */
 int decode_incline_hex(std::string_view hex);
+
+// --- Precomputed wire frames ---
+
+static constexpr size_t KV_WIRE_FRAME_MAX = 24;
+
+/*
+ * A complete [key:value]\xff frame in fixed storage, with views onto its
+ * key and value. constexpr-buildable, so frames with a small fixed value
+ * range can be generated at compile time.
+ */
+struct KvWireFrame {
+    std::array<char, KV_WIRE_FRAME_MAX> bytes{};
+    uint8_t len = 0;
+    uint8_t key_len = 0;
+    uint8_t value_len = 0;
+
+    constexpr std::string_view wire() const { return { bytes.data(), len }; }
+    constexpr std::string_view key() const { return { bytes.data() + 1, key_len }; }
+    constexpr std::string_view value() const {
+        return value_len ? std::string_view(bytes.data() + 2 + key_len, value_len)
+                         : std::string_view();
+    }
+};
+
+// Empty frame (len == 0) if key + value don't fit in KV_WIRE_FRAME_MAX
+constexpr KvWireFrame make_kv_frame(std::string_view key, std::string_view value = {}) {
+    KvWireFrame f;
+    size_t n = kv_build(std::span<char>(f.bytes), key, value);
+    if (n == 0) return {};
+    f.len = static_cast<uint8_t>(n);
+    f.key_len = static_cast<uint8_t>(key.size());
+    f.value_len = static_cast<uint8_t>(value.size());
+    return f;
+}
+
+// Frames for every value 0..Max of `key`, hex-encoded by `encode`
+// (encode_speed_hex / encode_incline_hex).
+template <int Max>
+constexpr std::array<KvWireFrame, Max + 1> make_kv_frame_table(
+        std::string_view key, size_t (*encode)(std::span<char>, int)) {
+    std::array<KvWireFrame, Max + 1> table{};
+    for (int v = 0; v <= Max; v++) {
+        std::array<char, 12> hex{};
+        size_t n = encode(hex, v);
+        table.at(v) = make_kv_frame(key, std::string_view(hex.data(), n));
+    }
+    return table;
+}
@@ -0,0 +1,94 @@
+/*
+ * metrics.h — Low-overhead latency histograms for hot-path instrumentation
+ *
+ * LatencyHistogram counts microsecond samples in power-of-two buckets
+ * (bucket b holds [2^(b-1), 2^b), bucket 0 holds 0). record() is a few
+ * relaxed atomic adds, so it is safe from any thread and cheap enough for
+ * the proxy path. summary() reads an approximate snapshot: percentiles
+ * are bucket upper bounds, clamped to the largest sample seen.
+ *
+ * Reported by the `metrics` IPC command.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <algorithm>
+#include <ctime>
+
+constexpr int HIST_BUCKETS = 32;  // top bucket holds everything >= 2^30 us
+
+// Monotonic clock in microseconds
+inline uint64_t mono_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000u + static_cast<uint64_t>(ts.tv_nsec) / 1000u;
+}
+
+class LatencyHistogram {
+public:
+    struct Summary {
+        uint64_t count;
+        double mean_us;
+        uint64_t p50_us;
+        uint64_t p99_us;
+        uint64_t max_us;
+    };
+
+    void record(uint64_t us) {
+        buckets_.at(static_cast<size_t>(bucket_for(us))).fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(us, std::memory_order_relaxed);
+        uint64_t prev = max_.load(std::memory_order_relaxed);
+        while (us > prev && !max_.compare_exchange_weak(prev, us, std::memory_order_relaxed)) {}
+    }
+
+    // Record the time since `start_us` (a mono_us() value)
+    void record_since(uint64_t start_us) { record(mono_us() - start_us); }
+
+    Summary summary() const {
+        std::array<uint64_t, HIST_BUCKETS> counts;
+        uint64_t total = 0;
+        for (size_t b = 0; b < counts.size(); b++) {
+            counts.at(b) = buckets_.at(b).load(std::memory_order_relaxed);
+            total += counts.at(b);
+        }
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        if (total == 0) return { 0, 0.0, 0, 0, 0 };
+
+        auto percentile = [&](uint64_t num, uint64_t den) {
+            uint64_t rank = (total * num + den - 1) / den;  // nearest rank, 1-based
+            uint64_t seen = 0;
+            for (size_t b = 0; b < counts.size(); b++) {
+                seen += counts.at(b);
+                if (seen >= rank) return std::min(bucket_upper(static_cast<int>(b)), max);
+            }
+            return max;
+        };
+        double mean = static_cast<double>(sum_.load(std::memory_order_relaxed)) /
+                      static_cast<double>(total);
+        return { total, mean, percentile(50, 100), percentile(99, 100), max };
+    }
+
+    void reset() {
+        for (auto& b : buckets_) b.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    static constexpr int bucket_for(uint64_t us) {
+        return std::min(static_cast<int>(std::bit_width(us)), HIST_BUCKETS - 1);
+    }
+
+    // Largest value that lands in bucket b
+    static constexpr uint64_t bucket_upper(int b) {
+        return b >= HIST_BUCKETS - 1 ? UINT64_MAX : (uint64_t{1} << b) - 1;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, HIST_BUCKETS> buckets_{};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
@@ -3,8 +3,10 @@
  */
 
 #include "mode_state.h"
+#include "trace.h"
 #include <cstring>
 #include <algorithm>
+#include <chrono>
 
 ModeStateMachine::ModeStateMachine() {}
 
@@ -13,18 +15,46 @@ void ModeStateMachine::set_emulate_callback(EmulateCallback cb) {
 }
 
 void ModeStateMachine::update_snap_locked() {
-    snap_.proxy_enabled.store(mode_ == Mode::Proxy, std::memory_order_relaxed);
-    snap_.emulate_enabled.store(mode_ == Mode::Emulating, std::memory_order_relaxed);
-    snap_.speed_tenths.store(speed_tenths_, std::memory_order_relaxed);
-    snap_.speed_raw.store(speed_raw_, std::memory_order_relaxed);
-    snap_.incline.store(incline_, std::memory_order_relaxed);
+    if (mode_ != traced_mode_) {
+        traced_mode_ = mode_;
+        trace_instant(mode_ == Mode::Proxy     ? "mode:proxy"
+                      : mode_ == Mode::Emulating ? "mode:emulate"
+                      : mode_ == Mode::Overlay   ? "mode:overlay"
+                                                 : "mode:idle");
+    }
+    // Writers hold mu_, so a plain store after the load is enough
+    uint32_t gen = static_cast<uint32_t>(word_.load(std::memory_order_relaxed) >> 32) + 1;
+    word_.store(pack(mode_, speed_tenths_, incline_, gen), std::memory_order_release);
+    notify_waiters();
 }
 
-void ModeStateMachine::enter_emulate_locked() {
-    // Safety: always start emulate at 0 speed, 0 incline
+void ModeStateMachine::notify_waiters() {
+    {
+        // Under the lock: a waiter is either asleep or sees the bump
+        std::lock_guard<std::mutex> lk(change_mu_);
+        wake_seq_.fetch_add(1, std::memory_order_release);
+    }
+    change_cv_.notify_all();
+}
+
+bool ModeStateMachine::wait_change(uint32_t seen, int64_t deadline_ns) const {
+    // steady_clock is CLOCK_MONOTONIC on Linux, so the deadlines line up
+    auto deadline = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(deadline_ns));
+    std::unique_lock<std::mutex> lk(change_mu_);
+    return change_cv_.wait_until(lk, deadline, [&] {
+        return wake_seq() != seen;
+    });
+}
+
+void ModeStateMachine::zero_targets_locked() {
     speed_tenths_ = 0;
     speed_raw_ = 0;
     incline_ = 0;
+}
+
+void ModeStateMachine::enter_emulate_locked() {
+    // Safety: always start emulate at 0 speed, 0 incline
+    zero_targets_locked();
     mode_ = Mode::Emulating;
     update_snap_locked();
 }
@@ -94,6 +124,33 @@ TransitionResult ModeStateMachine::request_emulate(bool enabled) {
     return result;
 }
 
+TransitionResult ModeStateMachine::request_overlay(bool enabled) {
+    TransitionResult result{};
+
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (enabled) {
+            if (mode_ == Mode::Overlay) return result;
+            result.emulate_stopped = mode_ == Mode::Emulating;
+            // Safety: overlay starts at 0 speed, 0 incline too
+            zero_targets_locked();
+            mode_ = Mode::Overlay;
+            update_snap_locked();
+            result.changed = true;
+        } else if (mode_ == Mode::Overlay) {
+            mode_ = Mode::Proxy;
+            update_snap_locked();
+            result.changed = true;
+        }
+    }
+
+    if (result.emulate_stopped && emulate_cb_) {
+        emulate_cb_(false);
+    }
+
+    return result;
+}
+
 TransitionResult ModeStateMachine::set_speed(int tenths) {
     TransitionResult result{};
 
@@ -102,7 +159,7 @@ TransitionResult ModeStateMachine::set_speed(int tenths) {
     {
         std::lock_guard<std::mutex> lk(mu_);
         // Auto-enable emulate when speed is set
-        if (mode_ != Mode::Emulating) {
+        if (mode_ != Mode::Emulating && mode_ != Mode::Overlay) {
             mode_ = Mode::Idle;  // clear proxy
             enter_emulate_locked();
             result.emulate_started = true;
@@ -121,8 +178,7 @@ TransitionResult ModeStateMachine::set_speed(int tenths) {
 }
 
 TransitionResult ModeStateMachine::set_speed_mph(double mph) {
-    int tenths = static_cast<int>(mph * 10 + 0.5);
-    return set_speed(tenths);
+    return set_speed(speed_mph_to_tenths(mph));
 }
 
 TransitionResult ModeStateMachine::set_incline(int val) {
@@ -133,7 +189,7 @@ TransitionResult ModeStateMachine::set_incline(int val) {
     {
         std::lock_guard<std::mutex> lk(mu_);
         // Auto-enable emulate when incline is set
-        if (mode_ != Mode::Emulating) {
+        if (mode_ != Mode::Emulating && mode_ != Mode::Overlay) {
             mode_ = Mode::Idle;
             enter_emulate_locked();
             result.emulate_started = true;
@@ -150,6 +206,74 @@ TransitionResult ModeStateMachine::set_incline(int val) {
     return result;
 }
 
+// The single requests' transitions, without update_snap_locked()
+void ModeStateMachine::apply_step_locked(const ModeStep& step) {
+    auto enter = [this](Mode m) {
+        zero_targets_locked();
+        mode_ = m;
+    };
+    bool controlling = mode_ == Mode::Emulating || mode_ == Mode::Overlay;
+    switch (step.kind) {
+        case ModeStep::Kind::Proxy:
+            if (step.value) mode_ = Mode::Proxy;
+            else if (mode_ == Mode::Proxy) mode_ = Mode::Idle;
+            break;
+        case ModeStep::Kind::Emulate:
+            if (step.value && mode_ != Mode::Emulating) enter(Mode::Emulating);
+            else if (!step.value && mode_ == Mode::Emulating) mode_ = Mode::Idle;
+            break;
+        case ModeStep::Kind::Overlay:
+            if (step.value && mode_ != Mode::Overlay) enter(Mode::Overlay);
+            else if (!step.value && mode_ == Mode::Overlay) mode_ = Mode::Proxy;
+            break;
+        case ModeStep::Kind::Speed:
+            if (!controlling) enter(Mode::Emulating);
+            speed_tenths_ = std::max(0, std::min(step.value, MAX_SPEED_TENTHS));
+            speed_raw_ = speed_tenths_ * 10;
+            break;
+        case ModeStep::Kind::Incline:
+            if (!controlling) enter(Mode::Emulating);
+            incline_ = std::max(0, std::min(step.value, MAX_INCLINE));
+            break;
+    }
+}
+
+TransitionResult ModeStateMachine::apply(std::span<const ModeStep> steps) {
+    TransitionResult result{};
+
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        Mode before = mode_;
+        int speed = speed_tenths_, incline = incline_;
+        for (const auto& step : steps) apply_step_locked(step);
+        bool was_emulating = before == Mode::Emulating;
+        bool emulating = mode_ == Mode::Emulating;
+        result.emulate_started = !was_emulating && emulating;
+        result.emulate_stopped = was_emulating && !emulating;
+        result.changed = mode_ != before;
+        if (result.changed || speed_tenths_ != speed || incline_ != incline) update_snap_locked();
+    }
+
+    if (result.emulate_started && emulate_cb_) {
+        emulate_cb_(true);
+    }
+    if (result.emulate_stopped && emulate_cb_) {
+        emulate_cb_(false);
+    }
+
+    return result;
+}
+
+bool ModeStateMachine::try_set_targets(int tenths, int half_pct) {
+    std::unique_lock<std::mutex> lk(mu_, std::try_to_lock);
+    if (!lk.owns_lock() || mode_ != Mode::Emulating) return false;
+    speed_tenths_ = std::max(0, std::min(tenths, MAX_SPEED_TENTHS));
+    speed_raw_ = speed_tenths_ * 10;
+    incline_ = std::max(0, std::min(half_pct, MAX_INCLINE));
+    update_snap_locked();
+    return true;
+}
+
 TransitionResult ModeStateMachine::auto_proxy_on_console_change(
     std::string_view key, std::string_view old_val, std::string_view new_val)
 {
@@ -166,10 +290,10 @@ TransitionResult ModeStateMachine::auto_proxy_on_console_change(
 
     {
         std::lock_guard<std::mutex> lk(mu_);
-        if (mode_ != Mode::Emulating) return result;
+        if (mode_ != Mode::Emulating && mode_ != Mode::Overlay) return result;
 
-        exit_emulate_locked();
-        result.emulate_stopped = true;
+        result.emulate_stopped = mode_ == Mode::Emulating;
+        if (result.emulate_stopped) exit_emulate_locked();
         mode_ = Mode::Proxy;
         update_snap_locked();
         result.changed = true;
@@ -184,17 +308,13 @@ TransitionResult ModeStateMachine::auto_proxy_on_console_change(
 
 void ModeStateMachine::safety_timeout_reset() {
     std::lock_guard<std::mutex> lk(mu_);
-    speed_tenths_ = 0;
-    speed_raw_ = 0;
-    incline_ = 0;
+    zero_targets_locked();
     update_snap_locked();
 }
 
 void ModeStateMachine::watchdog_reset_to_proxy() {
     std::lock_guard<std::mutex> lk(mu_);
-    speed_tenths_ = 0;
-    speed_raw_ = 0;
-    incline_ = 0;
+    zero_targets_locked();
     mode_ = Mode::Proxy;
     update_snap_locked();
     // No emulate callback — emulate thread will see is_emulating()==false
@@ -209,15 +329,3 @@ void ModeStateMachine::add_motor_bytes(uint32_t n) {
     motor_bytes_.fetch_add(n, std::memory_order_relaxed);
 }
 
-StateSnapshot ModeStateMachine::snapshot() const {
-    StateSnapshot s{};
-    s.proxy_enabled = snap_.proxy_enabled.load(std::memory_order_relaxed);
-    s.emulate_enabled = snap_.emulate_enabled.load(std::memory_order_relaxed);
-    s.speed_tenths = snap_.speed_tenths.load(std::memory_order_relaxed);
-    s.speed_raw = snap_.speed_raw.load(std::memory_order_relaxed);
-    s.incline = snap_.incline.load(std::memory_order_relaxed);
-    s.mode = s.emulate_enabled ? Mode::Emulating
-           : s.proxy_enabled   ? Mode::Proxy
-           : Mode::Idle;
-    return s;
-}
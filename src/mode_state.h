@@ -5,24 +5,48 @@
  * that enforces mutual exclusion by construction (Mode enum = one value,
  * not two bools). All safety invariants (zero-on-emulate-start, clamping)
  * live here.
+ *
+ * Overlay is proxy with setpoints: the console's stream still reaches
+ * the motor with its own timing, but the controller rewrites the values
+ * of its inc/hmph frames to this machine's targets (overlay.h). No
+ * emulate thread runs. Speed/incline requests keep overlay rather than
+ * switching to emulate, and overlay starts at zero like emulate.
+ *
+ * Every state change bumps a generation counter and wakes waiters on a
+ * condition variable, so the emulate thread can react to a new speed or
+ * incline immediately instead of at its next scheduled burst.
+ * notify_waiters() wakes them without a state change (the motor answered
+ * a paced burst), leaving the generation alone.
+ *
+ * The data-plane view (mode, speed, incline, generation) is packed into
+ * one 64-bit atomic word, so snapshot() and the is_*() reads never pair
+ * a new speed with an old mode while a transition is being published.
  */
 
 #pragma once
 
 #include <cstdint>
 #include <string_view>
+#include <span>
 #include <mutex>
 #include <atomic>
+#include <condition_variable>
 #include <functional>
 
 // Speed/incline limits (mirrored in treadmill_client.py)
 constexpr int MAX_SPEED_TENTHS = 120;   // 12.0 mph max
 constexpr int MAX_INCLINE      = 198;   // 99% in half-pct units (1 = 0.5%)
 
+// mph as received from IPC, to tenths (before clamping)
+constexpr int speed_mph_to_tenths(double mph) {
+    return static_cast<int>(mph * 10 + 0.5);
+}
+
 enum class Mode : uint8_t {
     Idle,       // Neither proxy nor emulate active
     Proxy,      // Forwarding console commands to motor
-    Emulating   // Sending synthesized cycle to motor
+    Emulating,  // Sending synthesized cycle to motor
+    Overlay     // Forwarding console commands with inc/hmph rewritten
 };
 
 // Lock-free snapshot for data plane reads
@@ -33,6 +57,8 @@ struct StateSnapshot {
     int incline;            // half-pct units: 0-198 (0=0%, 1=0.5%, 10=5%, 30=15%)
     bool proxy_enabled;
     bool emulate_enabled;
+    bool overlay_enabled;
+    uint32_t generation;    // of this mode/speed/incline; equal = same state
 };
 
 // Result of a mode transition request
@@ -42,6 +68,15 @@ struct TransitionResult {
     bool emulate_stopped;   // true if emulate was just stopped
 };
 
+// One step of ModeStateMachine::apply(): what the request of the same
+// name does. value is 0/1 for Proxy/Emulate, tenths for Speed, half-pct
+// for Incline.
+struct ModeStep {
+    enum class Kind : uint8_t { Proxy, Emulate, Speed, Incline, Overlay };
+    Kind kind;
+    int value;
+};
+
 class ModeStateMachine {
 public:
     using EmulateCallback = std::function<void(bool start)>;
@@ -55,18 +90,33 @@ public:
 
     TransitionResult request_proxy(bool enabled);
     TransitionResult request_emulate(bool enabled);
+    // Enter overlay at zero speed/incline (stopping emulate); disabling
+    // it falls back to plain proxy
+    TransitionResult request_overlay(bool enabled);
 
-    // Set speed (auto-enables emulate, clamps 0-MAX_SPEED_TENTHS)
+    // Set speed (auto-enables emulate unless in overlay, clamps 0-MAX_SPEED_TENTHS)
     TransitionResult set_speed(int tenths);
     // Same but from mph float (as received from IPC)
     TransitionResult set_speed_mph(double mph);
 
-    // Set incline in half-pct units (auto-enables emulate, clamps 0-MAX_INCLINE)
+    // Set incline in half-pct units (auto-enables emulate unless in
+    // overlay, clamps 0-MAX_INCLINE)
     // 1 = 0.5%, 10 = 5%, 30 = 15%
     TransitionResult set_incline(int half_pct);
 
+    // Apply `steps` in order under one lock and publish the outcome once:
+    // snapshot() readers and the emulate thread never see part of it, and
+    // the emulate callback fires at most once, for the net transition.
+    TransitionResult apply(std::span<const ModeStep> steps);
+
+    // Set speed and incline together, only while already emulating (never
+    // auto-enables). For the emulate thread's program ticks: gives up
+    // rather than waiting if a transition holds the lock, since that
+    // transition may be joining the emulate thread. True if applied.
+    bool try_set_targets(int tenths, int half_pct);
+
     // Called from console read thread when hmph/inc value changes
-    // while in emulate mode — switches back to proxy
+    // while in emulate or overlay mode — switches back to proxy
     TransitionResult auto_proxy_on_console_change(std::string_view key,
                                                    std::string_view old_val,
                                                    std::string_view new_val);
@@ -84,16 +134,32 @@ public:
     void add_console_bytes(uint32_t n);
     void add_motor_bytes(uint32_t n);
 
-    // --- Data plane reads (lock-free via atomic snapshot) ---
+    // --- Data plane reads (lock-free, one atomic load each) ---
+
+    StateSnapshot snapshot() const { return unpack(word_.load(std::memory_order_acquire)); }
+
+    // Single-field reads for hot paths
+    bool is_proxy() const { return word_mode() == Mode::Proxy; }
+    bool is_emulating() const { return word_mode() == Mode::Emulating; }
+    bool is_overlay() const { return word_mode() == Mode::Overlay; }
+    // A client sets speed/incline: emulate or overlay
+    bool is_controlling() const { return is_emulating() || is_overlay(); }
+    int speed_tenths() const { return snapshot().speed_tenths; }
+    int speed_raw() const { return snapshot().speed_raw; }
+    int incline() const { return snapshot().incline; }
 
-    StateSnapshot snapshot() const;
+    // Bumped on every mode/speed/incline change
+    uint32_t generation() const { return snapshot().generation; }
 
-    // Individual atomic reads for hot paths
-    bool is_proxy() const { return snap_.proxy_enabled; }
-    bool is_emulating() const { return snap_.emulate_enabled; }
-    int speed_tenths() const { return snap_.speed_tenths; }
-    int speed_raw() const { return snap_.speed_raw; }
-    int incline() const { return snap_.incline; }
+    // Bumped on every state change and by notify_waiters()
+    uint32_t wake_seq() const { return wake_seq_.load(std::memory_order_acquire); }
+
+    // Block until wake_seq() != seen or the CLOCK_MONOTONIC deadline (ns)
+    // passes. True if woken.
+    bool wait_change(uint32_t seen, int64_t deadline_ns) const;
+
+    // Wake wait_change() callers; any thread, no lock held
+    void notify_waiters();
 
     uint32_t console_bytes() const { return console_bytes_.load(std::memory_order_relaxed); }
     uint32_t motor_bytes() const { return motor_bytes_.load(std::memory_order_relaxed); }
@@ -101,25 +167,42 @@ public:
 private:
     void enter_emulate_locked();  // zeros speed/incline, sets mode
     void exit_emulate_locked();   // clears mode
+    void zero_targets_locked();
+    void apply_step_locked(const ModeStep& step);  // no publish
 
     mutable std::mutex mu_;
     Mode mode_ = Mode::Proxy;
+    Mode traced_mode_ = Mode::Proxy;  // last mode marked on the trace timeline
     int speed_tenths_ = 0;
     int speed_raw_ = 0;
     int incline_ = 0;
 
-    // Atomic snapshot for lock-free data plane reads
-    // Updated under mu_ after every state change
-    struct alignas(64) AtomicSnap {
-        std::atomic<bool> proxy_enabled{true};
-        std::atomic<bool> emulate_enabled{false};
-        std::atomic<int> speed_tenths{0};
-        std::atomic<int> speed_raw{0};
-        std::atomic<int> incline{0};
-    } snap_;
+    // Packed snapshot for lock-free data plane reads: bits 0-7 mode,
+    // 8-15 speed_tenths, 16-23 incline, 32-63 generation. Stored under mu_
+    // after every state change.
+    static_assert(MAX_SPEED_TENTHS <= 0xFF && MAX_INCLINE <= 0xFF);
+    static constexpr uint64_t pack(Mode m, int tenths, int half_pct, uint32_t gen) {
+        return static_cast<uint64_t>(m) | static_cast<uint64_t>(tenths) << 8 |
+               static_cast<uint64_t>(half_pct) << 16 | static_cast<uint64_t>(gen) << 32;
+    }
+    static constexpr StateSnapshot unpack(uint64_t w) {
+        auto m = static_cast<Mode>(w & 0xFF);
+        int tenths = static_cast<int>(w >> 8 & 0xFF);
+        return {m, tenths, tenths * 10, static_cast<int>(w >> 16 & 0xFF), m == Mode::Proxy,
+                m == Mode::Emulating, m == Mode::Overlay, static_cast<uint32_t>(w >> 32)};
+    }
+    Mode word_mode() const { return static_cast<Mode>(word_.load(std::memory_order_acquire) & 0xFF); }
+
+    alignas(64) std::atomic<uint64_t> word_{pack(Mode::Proxy, 0, 0, 0)};
 
     void update_snap_locked();
 
+    // Own mutex, not mu_: request_proxy() holds mu_ while the emulate
+    // callback joins the thread that may be waiting here
+    mutable std::mutex change_mu_;
+    mutable std::condition_variable change_cv_;
+    std::atomic<uint32_t> wake_seq_{0};  // written under change_mu_
+
     std::atomic<uint32_t> console_bytes_{0};
     std::atomic<uint32_t> motor_bytes_{0};
 
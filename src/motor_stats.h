@@ -0,0 +1,117 @@
+/*
+ * motor_stats.h — MotorStats: rolling min/max/mean of the motor's reports
+ *
+ * The motor answers amps, vbus and belt queries with hex values that
+ * clients only ever saw one at a time. MotorStats keeps, per key, a ring
+ * of MOTOR_STATS_SECONDS one-second buckets (count, sum, min, max), so a
+ * report costs one bucket update and memory is fixed however fast the
+ * motor answers. summary() combines the buckets into the 1, 10 and 60 s
+ * windows of MOTOR_STATS_WINDOWS_S, each the last N whole seconds before
+ * now (the current second is still filling). Values are in wire units:
+ * the decoded hex, unscaled.
+ *
+ * record() runs on the motor thread, summary() on the IPC thread for the
+ * periodic stats event; they share one lock, taken once per report.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <string_view>
+#include "kv_protocol.h"
+
+constexpr int MOTOR_STATS_MS = 1000;  // default publish period
+
+// Keys aggregated, in event order
+static constexpr std::array<KvKey, 3> MOTOR_STATS_KEYS = { KvKey::Amps, KvKey::Vbus, KvKey::Belt };
+static constexpr std::array<uint32_t, 3> MOTOR_STATS_WINDOWS_S = { 1, 10, 60 };
+constexpr uint32_t MOTOR_STATS_SECONDS = MOTOR_STATS_WINDOWS_S.back();  // buckets per key
+
+// One window; all 0 if no reports in it
+struct MotorStatWindow {
+    uint32_t count;
+    int64_t min;
+    int64_t max;
+    double mean;  // to 0.1
+};
+
+using MotorStatWindows = std::array<MotorStatWindow, MOTOR_STATS_WINDOWS_S.size()>;
+
+// Index of `id` in MOTOR_STATS_KEYS, or -1
+constexpr int motor_stats_index(KvKey id) {
+    for (size_t i = 0; i < MOTOR_STATS_KEYS.size(); i++) {
+        if (MOTOR_STATS_KEYS.at(i) == id) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+class MotorStats {
+public:
+    // Motor thread: a report of `id` at `now_us` (mono_us). False for keys
+    // not aggregated and values that aren't hex (an empty [err] answer).
+    bool record(KvKey id, std::string_view value, uint64_t now_us) {
+        int k = motor_stats_index(id);
+        if (k < 0 || value.empty()) return false;
+        int64_t v = 0;
+        auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), v, 16);
+        if (ec != std::errc{} || ptr != value.data() + value.size()) return false;
+
+        uint64_t sec = now_us / 1000000;
+        std::lock_guard<std::mutex> lk(mu_);
+        auto& b = buckets_.at(static_cast<size_t>(k)).at(sec % MOTOR_STATS_SECONDS);
+        if (b.sec != sec) b = { sec, 0, 0, v, v };
+        b.count++;
+        b.sum += v;
+        b.min = std::min(b.min, v);
+        b.max = std::max(b.max, v);
+        return true;
+    }
+
+    // IPC thread: the windows of key `k` (MOTOR_STATS_KEYS index) ending
+    // at the start of now_us's second. False if the longest window is empty.
+    bool summary(size_t k, uint64_t now_us, MotorStatWindows& out) {
+        uint64_t now_sec = now_us / 1000000;
+        std::array<Bucket, MOTOR_STATS_WINDOWS_S.size()> acc{};
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            for (const auto& b : buckets_.at(k)) {
+                if (b.count == 0 || b.sec >= now_sec) continue;
+                uint64_t age = now_sec - b.sec;  // 1 = the last whole second
+                for (size_t w = 0; w < acc.size(); w++) {
+                    if (age <= MOTOR_STATS_WINDOWS_S.at(w)) add(acc.at(w), b);
+                }
+            }
+        }
+        for (size_t w = 0; w < acc.size(); w++) {
+            const auto& a = acc.at(w);
+            double mean = a.count ? static_cast<double>(a.sum) / a.count : 0;
+            out.at(w) = { a.count, a.count ? a.min : 0, a.count ? a.max : 0, std::round(mean * 10) / 10 };
+        }
+        return acc.back().count > 0;
+    }
+
+private:
+    struct Bucket {
+        uint64_t sec = std::numeric_limits<uint64_t>::max();  // never a real second
+        uint32_t count = 0;
+        int64_t sum = 0;
+        int64_t min = 0;
+        int64_t max = 0;
+    };
+
+    static void add(Bucket& a, const Bucket& b) {
+        a.min = a.count == 0 ? b.min : std::min(a.min, b.min);
+        a.max = a.count == 0 ? b.max : std::max(a.max, b.max);
+        a.sum += b.sum;
+        a.count += b.count;
+    }
+
+    std::mutex mu_;
+    std::array<std::array<Bucket, MOTOR_STATS_SECONDS>, MOTOR_STATS_KEYS.size()> buckets_{};
+};
@@ -0,0 +1,273 @@
+/*
+ * motor_writer.h — MotorWriter: one writer thread in front of SerialWriter
+ *
+ * The console reader (proxy bytes), the emulate thread (bursts) and the
+ * controller (safety stops) hand writes to MotorWriter instead of calling
+ * SerialWriter themselves: they never wait for a transmission, and the
+ * writer thread is the only one touching the DMA wave engine.
+ *
+ * Two lanes, both lock-free multi-producer RingBuffers:
+ *   normal   — proxy bytes and emulate bursts, in order
+ *   priority — safety frames (e.g. [hmph:0]); always taken first, and
+ *              normal traffic queued before one is discarded, so a stop
+ *              goes out right after the transmission in progress and is
+ *              never followed by stale commands
+ *
+ * If the writer falls a whole lane behind, the oldest messages are
+ * dropped and counted, like any other ring consumer.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <poll.h>
+#include "ring_buffer.h"
+#include "serial_io.h"
+#include "metrics.h"
+#include "thread_sched.h"
+
+constexpr int MOTOR_LANE_SIZE = 256;       // normal lane messages
+constexpr int MOTOR_PRIORITY_SIZE = 16;    // priority lane messages
+constexpr int MOTOR_LANE_MSG_SIZE = 256;
+constexpr int MOTOR_WRITER_IDLE_MS = 100;  // bound on one idle wait (stop latency)
+
+template <typename Port>
+class MotorWriter {
+public:
+    MotorWriter(Port& port, int gpio_pin, int baud = BAUD)
+        : writer_(port, gpio_pin, baud) {}
+
+    // Another bus on the same port: share its DMA wave engine
+    MotorWriter(Port& port, int gpio_pin, WaveEngine& engine, int baud = BAUD)
+        : writer_(port, gpio_pin, engine, baud) {}
+
+    ~MotorWriter() { stop(); }
+    MotorWriter(const MotorWriter&) = delete;
+    MotorWriter& operator=(const MotorWriter&) = delete;
+
+    // Start the writer thread. Messages queued earlier go out first.
+    bool start() {
+        if (thread_.joinable()) return true;
+        if (normal_.enable_wakeup() < 0 || priority_.enable_wakeup() < 0) return false;
+        running_.store(true, std::memory_order_relaxed);
+        thread_ = std::thread(&MotorWriter::thread_fn, this);
+        if (sched_.active()) apply_thread_sched(thread_.native_handle(), sched_, "motor_write");
+        return true;
+    }
+
+    // Scheduling for the writer thread; takes effect on the next start()
+    void set_sched(const ThreadSched& s) { sched_ = s; }
+
+    // Stop after the transmission in progress; anything still queued is dropped
+    void stop() {
+        running_.store(false, std::memory_order_relaxed);
+        normal_.notify();
+        if (thread_.joinable()) thread_.join();
+    }
+
+    // --- Producer API (lock-free, any thread, never blocks) ---
+
+    // Raw bytes (proxy forwarding), split into lane-sized chunks
+    void write_bytes(std::span<const uint8_t> data) {
+        while (!data.empty()) {
+            auto r = normal_.reserve();
+            size_t n = std::min(data.size(), r.buf.size() - HEADER_SIZE);
+            put_header(r.buf, Kind::Raw);
+            std::copy_n(data.data(), n, r.buf.data() + HEADER_SIZE);
+            normal_.commit(r, HEADER_SIZE + n);
+            data = data.subspan(n);
+        }
+    }
+
+    // Prebuilt wire frames, sent as chained bursts (SerialWriter::write_burst)
+    void write_burst(std::span<const std::string_view> wires) {
+        while (!wires.empty()) {
+            // A frame too long for one lane message goes out as raw bytes
+            if (wires.front().size() + 1 > LANE_PAYLOAD_MAX) {
+                write_bytes(as_bytes(wires.front()));
+                wires = wires.subspan(1);
+                continue;
+            }
+            auto r = normal_.reserve();
+            put_header(r.buf, Kind::Burst);
+            size_t len = HEADER_SIZE;
+            size_t n = 0;
+            for (; n < wires.size() && n < static_cast<size_t>(WAVE_CHAIN_MAX); n++) {
+                auto w = wires[n];
+                if (len + 1 + w.size() > r.buf.size()) break;
+                r.buf[len] = static_cast<char>(w.size());
+                std::copy_n(w.data(), w.size(), r.buf.data() + len + 1);
+                len += 1 + w.size();
+            }
+            normal_.commit(r, len);
+            wires = wires.subspan(n);
+        }
+    }
+
+    // Safety frame on the priority lane: preempts queued normal traffic
+    void write_priority(std::string_view wire) {
+        uint64_t queued = normal_.snapshot().count;
+        uint64_t prev = preempt_before_.load(std::memory_order_relaxed);
+        while (prev < queued &&
+               !preempt_before_.compare_exchange_weak(prev, queued, std::memory_order_relaxed)) {}
+
+        auto r = priority_.reserve();
+        size_t n = std::min(wire.size(), r.buf.size() - HEADER_SIZE);
+        put_header(r.buf, Kind::Frame);
+        std::copy_n(wire.data(), n, r.buf.data() + HEADER_SIZE);
+        priority_.commit(r, HEADER_SIZE + n);
+    }
+
+    // --- Metrics (any thread) ---
+
+    // Raw bytes: queued -> transmission complete
+    const LatencyHistogram& raw_latency() const { return raw_us_; }
+    // Priority frames: queued -> transmission complete
+    const LatencyHistogram& priority_latency() const { return priority_us_; }
+    // Wait for the previous transmission before each send
+    const LatencyHistogram& tx_wait() const { return writer_.tx_wait(); }
+    // Normal-lane messages lost to lane overrun / discarded by a priority frame
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    uint64_t preempted() const { return preempted_.load(std::memory_order_relaxed); }
+
+private:
+    enum class Kind : uint8_t { Raw = 1, Burst = 2, Frame = 3 };
+
+    // Lane message: [u8 kind][u64 queued mono_us][payload]
+    // Burst payload: ([u8 len][wire frame])...
+    static constexpr size_t HEADER_SIZE = 1 + sizeof(uint64_t);
+    static constexpr size_t LANE_PAYLOAD_MAX = MOTOR_LANE_MSG_SIZE - 1 - HEADER_SIZE;
+    using NormalLane = RingBuffer<MOTOR_LANE_SIZE, MOTOR_LANE_MSG_SIZE>;
+    using PriorityLane = RingBuffer<MOTOR_PRIORITY_SIZE, MOTOR_LANE_MSG_SIZE>;
+
+    static void put_header(std::span<char> buf, Kind kind) {
+        buf[0] = static_cast<char>(kind);
+        uint64_t t = mono_us();
+        std::memcpy(buf.data() + 1, &t, sizeof(t));
+    }
+
+    static uint64_t queued_at(std::span<const char> msg) {
+        uint64_t t;
+        std::memcpy(&t, msg.data() + 1, sizeof(t));
+        return t;
+    }
+
+    static std::span<const uint8_t> as_bytes(std::string_view s) {
+        // reinterpret_cast: char -> uint8_t aliasing (standard-allowed wire boundary)
+        return std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+    }
+
+    void thread_fn() {
+        trace_thread("motor_write");
+        std::array<char, MOTOR_LANE_MSG_SIZE> msg;
+        while (running_.load(std::memory_order_relaxed)) {
+            if (take_priority(msg)) continue;
+            if (take_normal(msg)) continue;
+            wait_for_work();
+        }
+    }
+
+    // Send every committed priority frame. True if anything was sent.
+    bool take_priority(std::span<char> msg) {
+        bool sent = false;
+        uint64_t total = priority_.snapshot().count;
+        if (total - priority_cursor_ > static_cast<uint64_t>(PriorityLane::size())) {
+            priority_cursor_ = total - PriorityLane::size();
+        }
+        while (priority_cursor_ < total) {
+            RingReadResult r = priority_.read(priority_cursor_, msg);
+            if (r.status == RingRead::NotReady) break;
+            priority_cursor_++;
+            if (r.status != RingRead::Ok || r.len < HEADER_SIZE) continue;
+            writer_.write_frame(std::string_view(msg.data() + HEADER_SIZE, r.len - HEADER_SIZE));
+            priority_us_.record_since(queued_at(msg));
+            sent = true;
+        }
+        return sent;
+    }
+
+    // Send the next normal-lane message. True if the cursor moved.
+    bool take_normal(std::span<char> msg) {
+        uint64_t total = normal_.snapshot().count;
+        if (normal_cursor_ >= total) return false;
+        if (total - normal_cursor_ > static_cast<uint64_t>(NormalLane::size())) {
+            dropped_.fetch_add(total - NormalLane::size() - normal_cursor_, std::memory_order_relaxed);
+            normal_cursor_ = total - NormalLane::size();
+        }
+        uint64_t preempt = preempt_before_.load(std::memory_order_relaxed);
+        if (normal_cursor_ < preempt) {
+            preempted_.fetch_add(preempt - normal_cursor_, std::memory_order_relaxed);
+            normal_cursor_ = preempt;
+            return true;
+        }
+
+        RingReadResult r = normal_.read(normal_cursor_, msg);
+        if (r.status == RingRead::NotReady) {
+            std::this_thread::yield();  // producer mid-copy
+            return true;
+        }
+        normal_cursor_++;
+        if (r.status == RingRead::Overwritten) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        if (r.len < HEADER_SIZE) return true;
+
+        std::string_view payload(msg.data() + HEADER_SIZE, r.len - HEADER_SIZE);
+        switch (static_cast<Kind>(msg[0])) {
+            case Kind::Raw:
+                writer_.write_bytes(as_bytes(payload));
+                raw_us_.record_since(queued_at(msg));
+                break;
+            case Kind::Burst: {
+                std::array<std::string_view, WAVE_CHAIN_MAX> wires;
+                size_t n = 0;
+                while (!payload.empty() && n < wires.size()) {
+                    auto len = static_cast<uint8_t>(payload.front());
+                    if (1u + len > payload.size()) break;
+                    wires.at(n++) = payload.substr(1, len);
+                    payload.remove_prefix(1u + len);
+                }
+                writer_.write_burst(std::span<const std::string_view>(wires.data(), n));
+                break;
+            }
+            case Kind::Frame:
+                break;
+        }
+        return true;
+    }
+
+    // Block until either lane has a message (or stop())
+    void wait_for_work() {
+        normal_.arm_wakeup();
+        priority_.arm_wakeup();
+        if (normal_.ready(normal_cursor_) || priority_.ready(priority_cursor_)) return;
+
+        std::array<pollfd, 2> fds = {{ { normal_.wakeup_fd(), POLLIN, 0 },
+                                       { priority_.wakeup_fd(), POLLIN, 0 } }};
+        ::poll(fds.data(), fds.size(), MOTOR_WRITER_IDLE_MS);
+        normal_.drain_wakeup();
+        priority_.drain_wakeup();
+    }
+
+    SerialWriter<Port> writer_;
+    NormalLane normal_;
+    PriorityLane priority_;
+    uint64_t normal_cursor_ = 0;     // writer thread only
+    uint64_t priority_cursor_ = 0;
+    std::atomic<uint64_t> preempt_before_{0};  // normal seqs below this are stale
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> preempted_{0};
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+    ThreadSched sched_{};
+    LatencyHistogram raw_us_;
+    LatencyHistogram priority_us_;
+};
@@ -0,0 +1,90 @@
+/*
+ * odometer.h — Odometer: distance, vertical gain and belt time at bus rate
+ *
+ * The motor reader feeds every decoded motor hmph/inc response to
+ * sample() with its CLOCK_MONOTONIC time. The speed and incline in force
+ * since the previous sample are integrated over the interval (held
+ * piecewise constant, as the belt runs between reports), so totals don't
+ * depend on how often anyone asks for them.
+ *
+ * Accumulators are exact integers (tenths mph × us, and × half-pct for
+ * vertical) converted to miles and feet on read. Intervals longer than
+ * ODO_MAX_GAP_MS (bus silent, reader stalled) count only up to the cap.
+ * Totals are cumulative since start (or since the predecessor's start,
+ * after a restart handoff); sessions take differences.
+ *
+ * Single writer (motor thread); relaxed atomic reads from any thread.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <algorithm>
+
+// Longest interval integrated at the last known speed (≈3 emulate cycles)
+constexpr uint64_t ODO_MAX_GAP_MS = 1500;
+
+class Odometer {
+public:
+    // Integrate up to `now_us`, then hold the new speed/incline. Unknown
+    // (negative) values count as stopped / flat. True if anything accumulated.
+    bool sample(uint64_t now_us, int speed_tenths, int incline_half_pct) {
+        bool moved = false;
+        if (last_us_ != 0 && now_us > last_us_ && speed_ > 0) {
+            uint64_t dt = std::min(now_us - last_us_, ODO_MAX_GAP_MS * 1000);
+            uint64_t d = static_cast<uint64_t>(speed_) * dt;
+            distance_.store(distance_.load(std::memory_order_relaxed) + d, std::memory_order_relaxed);
+            vertical_.store(vertical_.load(std::memory_order_relaxed) + d * static_cast<uint64_t>(incline_),
+                            std::memory_order_relaxed);
+            belt_on_us_.store(belt_on_us_.load(std::memory_order_relaxed) + dt, std::memory_order_relaxed);
+            moved = true;
+        }
+        last_us_ = now_us;
+        speed_ = std::max(speed_tenths, 0);
+        incline_ = std::max(incline_half_pct, 0);
+        return moved;
+    }
+
+    double distance_mi() const {
+        return static_cast<double>(distance_.load(std::memory_order_relaxed)) / TENTHS_US_PER_MILE;
+    }
+
+    // 1 half-pct = 0.005 rise per unit distance
+    double vert_ft() const {
+        return static_cast<double>(vertical_.load(std::memory_order_relaxed)) / TENTHS_US_PER_MILE *
+               FEET_PER_MILE / 200.0;
+    }
+
+    uint64_t belt_on_ms() const { return belt_on_us_.load(std::memory_order_relaxed) / 1000; }
+
+    // Raw accumulators, carried across a restart (handoff.h)
+    struct Totals {
+        uint64_t distance;
+        uint64_t vertical;
+        uint64_t belt_on_us;
+    };
+
+    Totals totals() const {
+        return {distance_.load(std::memory_order_relaxed), vertical_.load(std::memory_order_relaxed),
+                belt_on_us_.load(std::memory_order_relaxed)};
+    }
+
+    // Continue from `t`. Before the motor thread starts.
+    void restore(const Totals& t) {
+        distance_.store(t.distance, std::memory_order_relaxed);
+        vertical_.store(t.vertical, std::memory_order_relaxed);
+        belt_on_us_.store(t.belt_on_us, std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr double TENTHS_US_PER_MILE = 10.0 * 3600.0 * 1e6;  // 1 mph for 1 h
+    static constexpr double FEET_PER_MILE = 5280.0;
+
+    uint64_t last_us_ = 0;  // motor thread only
+    int speed_ = 0;
+    int incline_ = 0;
+    std::atomic<uint64_t> distance_{0};   // tenths mph × us
+    std::atomic<uint64_t> vertical_{0};   // tenths mph × half-pct × us
+    std::atomic<uint64_t> belt_on_us_{0};
+};
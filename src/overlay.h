@@ -0,0 +1,135 @@
+/*
+ * overlay.h — OverlayRewriter: the console stream with inc/hmph replaced
+ *
+ * In overlay mode the console reader's raw chunks still go to the motor
+ * writer as they arrive, so the console's own cycle timing and every
+ * diagnostic frame pass through. Only the values of [inc:..] and
+ * [hmph:..] frames are replaced with the current targets.
+ *
+ * The rewriter streams: a byte that can't begin one of those two frames
+ * goes straight out. From '[' it holds bytes only while they could still
+ * spell "[inc:" or "[hmph:", then up to that frame's ']'. So nothing is
+ * delayed by more than one frame, and a chunk boundary anywhere in a
+ * frame is fine. A held frame that turns out to be something else, or
+ * whose value overruns OVERLAY_VALUE_MAX, is released unchanged.
+ *
+ * Console reader thread only. No allocation.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <optional>
+#include <span>
+#include <string_view>
+#include "kv_protocol.h"
+
+constexpr size_t OVERLAY_VALUE_MAX = 8;  // longest console value held
+
+class OverlayRewriter {
+public:
+    // Feed one raw chunk. `emit(std::span<const uint8_t>)` gets the output
+    // in order: runs of the input itself, held bytes, rewritten frames.
+    // Returns the number of frames rewritten.
+    template <typename Emit>
+    int feed(std::span<const uint8_t> in, int speed_tenths, int incline, Emit&& emit) {
+        int rewritten = 0;
+        size_t run = 0;  // start of the pass-through run in `in`
+        for (size_t i = 0; i < in.size(); i++) {
+            char c = static_cast<char>(in[i]);
+            if (held_ == 0) {
+                if (c != '[') continue;
+                if (i > run) emit(in.subspan(run, i - run));
+                hold(c);
+                run = i + 1;
+                continue;
+            }
+            run = i + 1;
+            if (c == '[') {  // a new frame: give up on this one
+                release(emit);
+                hold(c);
+                continue;
+            }
+            hold(c);
+            if (!key_) {
+                key_ = match_key();
+                if (key_ == KvKey::Unknown) release(emit);
+                continue;
+            }
+            if (c == ']') {
+                (*key_ == KvKey::Inc ? inc_rewrites_ : hmph_rewrites_)++;
+                emit_rewritten(speed_tenths, incline, emit);
+                rewritten++;
+            } else if (held_ > key_len() + OVERLAY_VALUE_MAX) {
+                release(emit);
+            }
+        }
+        if (held_ == 0 && run < in.size()) emit(in.subspan(run));
+        return rewritten;
+    }
+
+    // Bytes held back, waiting for the rest of a frame
+    size_t pending() const { return held_; }
+
+    // Frames of `id` (Inc or Hmph) rewritten so far
+    uint64_t rewritten(KvKey id) const { return id == KvKey::Inc ? inc_rewrites_ : hmph_rewrites_; }
+
+    // Release anything held unchanged (overlay ended mid-frame)
+    template <typename Emit>
+    void flush(Emit&& emit) {
+        if (held_ > 0) release(emit);
+    }
+
+    // Drop anything held
+    void reset() {
+        held_ = 0;
+        key_.reset();
+    }
+
+private:
+    static constexpr std::string_view INC_PREFIX = "[inc:";
+    static constexpr std::string_view HMPH_PREFIX = "[hmph:";
+
+    void hold(char c) { buf_.at(held_++) = static_cast<uint8_t>(c); }
+
+    std::string_view held() const {
+        // reinterpret_cast: uint8_t -> char aliasing (standard-allowed)
+        return {reinterpret_cast<const char*>(buf_.data()), held_};
+    }
+
+    size_t key_len() const { return *key_ == KvKey::Inc ? INC_PREFIX.size() : HMPH_PREFIX.size(); }
+
+    // Key of the held prefix once complete; nullopt while it still could
+    // be; Unknown once it can't
+    std::optional<KvKey> match_key() const {
+        auto h = held();
+        if (h == INC_PREFIX) return KvKey::Inc;
+        if (h == HMPH_PREFIX) return KvKey::Hmph;
+        if (INC_PREFIX.starts_with(h) || HMPH_PREFIX.starts_with(h)) return std::nullopt;
+        return KvKey::Unknown;
+    }
+
+    template <typename Emit>
+    void release(Emit& emit) {
+        emit(std::span<const uint8_t>(buf_.data(), held_));
+        reset();
+    }
+
+    template <typename Emit>
+    void emit_rewritten(int speed_tenths, int incline, Emit& emit) {
+        size_t n = key_len();
+        // reinterpret_cast: uint8_t -> char aliasing (standard-allowed)
+        auto value = std::span<char>(reinterpret_cast<char*>(buf_.data()) + n, buf_.size() - n - 1);
+        n += *key_ == KvKey::Inc ? encode_incline_hex(value, incline) : encode_speed_hex(value, speed_tenths);
+        buf_.at(n++) = ']';
+        held_ = n;
+        release(emit);
+    }
+
+    std::array<uint8_t, 6 + OVERLAY_VALUE_MAX + 2> buf_{};
+    size_t held_ = 0;
+    std::optional<KvKey> key_;  // set once the held prefix is "[inc:" or "[hmph:"
+    uint64_t inc_rewrites_ = 0;
+    uint64_t hmph_rewrites_ = 0;
+};
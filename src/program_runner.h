@@ -0,0 +1,204 @@
+/*
+ * program_runner.h — ProgramRunner: on-device interval/ramp programs
+ *
+ * A program is a list of segments (duration, target speed, target
+ * incline, optional linear ramp) uploaded with the `program` IPC command.
+ * The emulate thread calls tick() right before every burst, so segment
+ * changes land on the first burst at or after their boundary, with no
+ * Python timer, GIL or IPC round trip in between.
+ *
+ * A ramped segment moves linearly from the previous segment's target (or
+ * the speed/incline in force when the program started) to its own
+ * target. After the last segment the program finishes at speed 0 /
+ * incline 0, like program_engine.py.
+ *
+ * Pure timing logic: the caller passes CLOCK_MONOTONIC times and applies
+ * the targets. Thread-safe (IPC thread loads/stops, emulate thread ticks).
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <mutex>
+#include <algorithm>
+#include "ipc_protocol.h"
+
+// Progress events while running: at most this often, plus every change
+constexpr int64_t PROGRAM_PROGRESS_MS = 1000;
+
+enum class ProgramState : uint8_t { Idle, Running, Paused, Finished, Stopped };
+
+constexpr std::string_view program_state_name(ProgramState s) {
+    switch (s) {
+        case ProgramState::Idle:     return "idle";
+        case ProgramState::Running:  return "running";
+        case ProgramState::Paused:   return "paused";
+        case ProgramState::Finished: return "finished";
+        case ProgramState::Stopped:  return "stopped";
+    }
+    return "idle";
+}
+
+struct ProgramTick {
+    bool apply;     // targets changed since the last successful apply
+    bool report;    // progress event due (segment change, finish, 1 s tick)
+    int speed_tenths;
+    int incline;    // half-pct units
+};
+
+class ProgramRunner {
+public:
+    // Start `spec` at `now_ns`. start_speed/start_incline seed a ramp in
+    // the first segment. Replaces any program in progress.
+    void load(const ProgramSpec& spec, int64_t now_ns, int start_speed, int start_incline) {
+        std::lock_guard<std::mutex> lk(mu_);
+        spec_ = spec;
+        total_ms_ = 0;
+        for (int i = 0; i < spec_.count; i++) total_ms_ += spec_.segments.at(i).duration_ms;
+        start_speed_ = start_speed;
+        start_incline_ = start_incline;
+        start_ns_ = now_ns;
+        paused_ms_ = 0;
+        state_ = spec_.count > 0 ? ProgramState::Running : ProgramState::Idle;
+        segment_ = -1;       // first tick reports segment 0
+        next_report_ms_ = 0;
+        applied_speed_ = applied_incline_ = -1;
+        elapsed_ms_ = 0;
+        segment_end_ms_ = 0;
+        target_speed_ = target_incline_ = 0;
+    }
+
+    // Abort. True if a program was running or paused.
+    bool stop() {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (!active_locked()) return false;
+        state_ = ProgramState::Stopped;
+        return true;
+    }
+
+    bool pause(int64_t now_ns) {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (state_ != ProgramState::Running) return false;
+        elapsed_ms_ = elapsed_locked(now_ns);
+        pause_ns_ = now_ns;
+        state_ = ProgramState::Paused;
+        return true;
+    }
+
+    bool resume(int64_t now_ns) {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (state_ != ProgramState::Paused) return false;
+        paused_ms_ += (now_ns - pause_ns_) / 1000000;
+        state_ = ProgramState::Running;
+        applied_speed_ = applied_incline_ = -1;  // re-apply the current target
+        return true;
+    }
+
+    bool active() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return active_locked();
+    }
+
+    // Advance to `now_ns`. The caller applies the targets when `apply` is
+    // set and confirms with applied(); a failed apply is retried next tick.
+    ProgramTick tick(int64_t now_ns) {
+        std::lock_guard<std::mutex> lk(mu_);
+        ProgramTick out{ false, false, 0, 0 };
+        if (state_ == ProgramState::Finished) {
+            out.apply = applied_speed_ != 0 || applied_incline_ != 0;  // until the final 0/0 lands
+            return out;
+        }
+        if (state_ != ProgramState::Running) return out;
+
+        elapsed_ms_ = elapsed_locked(now_ns);
+        if (elapsed_ms_ >= total_ms_) {
+            state_ = ProgramState::Finished;
+            segment_ = spec_.count - 1;
+            target_speed_ = target_incline_ = 0;
+            out = { true, true, 0, 0 };
+            return out;
+        }
+
+        // Locate the segment and its start time
+        int seg = 0;
+        int64_t seg_start = 0;
+        while (seg_start + spec_.segments.at(seg).duration_ms <= elapsed_ms_) {
+            seg_start += spec_.segments.at(seg).duration_ms;
+            seg++;
+        }
+        const auto& s = spec_.segments.at(seg);
+        out.speed_tenths = s.speed_tenths;
+        out.incline = s.incline;
+        if (s.ramp) {
+            int from_speed = seg > 0 ? spec_.segments.at(seg - 1).speed_tenths : start_speed_;
+            int from_incline = seg > 0 ? spec_.segments.at(seg - 1).incline : start_incline_;
+            double f = static_cast<double>(elapsed_ms_ - seg_start) / s.duration_ms;
+            out.speed_tenths = lerp(from_speed, s.speed_tenths, f);
+            out.incline = lerp(from_incline, s.incline, f);
+        }
+
+        out.report = seg != segment_ || elapsed_ms_ >= next_report_ms_;
+        if (out.report) next_report_ms_ = (elapsed_ms_ / PROGRAM_PROGRESS_MS + 1) * PROGRAM_PROGRESS_MS;
+        segment_ = seg;
+        segment_end_ms_ = seg_start + s.duration_ms;
+        target_speed_ = out.speed_tenths;
+        target_incline_ = out.incline;
+        out.apply = out.speed_tenths != applied_speed_ || out.incline != applied_incline_;
+        return out;
+    }
+
+    void applied(const ProgramTick& t) {
+        std::lock_guard<std::mutex> lk(mu_);
+        applied_speed_ = t.speed_tenths;
+        applied_incline_ = t.incline;
+    }
+
+    // Snapshot for a progress event (as of the last tick / transition)
+    ProgramEvent progress() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        ProgramEvent ev{};
+        ev.state = program_state_name(state_);
+        ev.segment = std::max(segment_, 0);
+        ev.segments = spec_.count;
+        ev.elapsed_ms = static_cast<uint64_t>(std::min(elapsed_ms_, total_ms_));
+        ev.segment_remaining_ms = state_ == ProgramState::Finished
+            ? 0 : static_cast<uint64_t>(std::max<int64_t>(segment_end_ms_ - elapsed_ms_, 0));
+        ev.total_ms = static_cast<uint64_t>(total_ms_);
+        ev.speed = target_speed_;
+        ev.incline = target_incline_;
+        return ev;
+    }
+
+private:
+    static int lerp(int a, int b, double f) {
+        return a + static_cast<int>((b - a) * f + (b >= a ? 0.5 : -0.5));
+    }
+
+    bool active_locked() const {
+        return state_ == ProgramState::Running || state_ == ProgramState::Paused;
+    }
+
+    int64_t elapsed_locked(int64_t now_ns) const {
+        if (state_ == ProgramState::Paused) return elapsed_ms_;
+        return (now_ns - start_ns_) / 1000000 - paused_ms_;
+    }
+
+    mutable std::mutex mu_;
+    ProgramSpec spec_{};
+    ProgramState state_ = ProgramState::Idle;
+    int64_t total_ms_ = 0;
+    int64_t start_ns_ = 0;
+    int64_t pause_ns_ = 0;
+    int64_t paused_ms_ = 0;
+    int64_t elapsed_ms_ = 0;
+    int64_t segment_end_ms_ = 0;
+    int64_t next_report_ms_ = 0;
+    int segment_ = -1;
+    int start_speed_ = 0;
+    int start_incline_ = 0;
+    int target_speed_ = 0;
+    int target_incline_ = 0;
+    int applied_speed_ = -1;
+    int applied_incline_ = -1;
+};
@@ -0,0 +1,147 @@
+/*
+ * proxy_selftest.h — Proxy forwarding latency self-test over loopback GPIOs
+ *
+ * How long a console byte takes to reach the motor in proxy mode depends
+ * on the board: the bit-bang read's latency, the reader's poll, the
+ * motor writer's wave setup. run_proxy_selftest() measures it end to
+ * end on the wire, with a running controller proxying:
+ *
+ *   drive pin    a spare output, jumpered to the console read pin (the
+ *                console disconnected), sends known frames
+ *   loop pin     a spare input, jumpered to the motor write pin
+ *
+ * Edge logs on the console read pin and the loop pin (one time base, the
+ * port's ticks) date each frame's first start bit going in and coming
+ * out again. A frame whose re-emission doesn't carry its edges (lost,
+ * merged with another, noise) counts as bad and is left out. The drive
+ * writer shares the controller's WaveEngine, so a frame is forwarded
+ * only once it has been sent in full: the latency is a whole frame's
+ * trip through the proxy, at the port's tick resolution. The frames
+ * are bare queries (TX_SELFTEST_FRAMES), which a connected motor answers
+ * but doesn't act on. `treadmill_io --proxy-selftest DRIVE LOOP` runs it
+ * on bus 0.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <span>
+#include <string_view>
+#include "gpio_port.h"
+#include "serial_io.h"
+#include "tx_selftest.h"
+
+constexpr int PROXY_SELFTEST_GAP_MS = 40;       // per frame: sent, forwarded, logged
+constexpr int PROXY_SELFTEST_MAX_FRAMES = 2000;
+
+struct ProxyLatencyReport {
+    int frames = 0;       // timed
+    int bad_frames = 0;
+    double min_us = 0;    // console pin first start bit -> motor pin's
+    double p50_us = 0;
+    double p99_us = 0;
+    double max_us = 0;
+};
+
+class ProxyLatencyAnalyzer {
+public:
+    explicit ProxyLatencyAnalyzer(int baud) : baud_(baud) {}
+
+    // One frame: its bytes, the edges logged going in and coming back out.
+    // False (a bad frame) if either side doesn't carry the frame's edges.
+    bool add_frame(std::span<const uint8_t> bytes, std::span<const PortEdge> in, std::span<const PortEdge> out) {
+        std::array<PortEdge, TX_SELFTEST_MAX_EDGES> ideal;
+        size_t n = tx_ideal_edges(bytes, baud_, ideal);
+        if (n == 0 || in.size() != n || out.size() != n || count_ == latency_ns_.size() ||
+            out.front().t_ns < in.front().t_ns) {
+            bad_++;
+            return false;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (in[i].level != ideal.at(i).level || out[i].level != ideal.at(i).level) {
+                bad_++;
+                return false;
+            }
+        }
+        latency_ns_.at(count_++) = out.front().t_ns - in.front().t_ns;
+        return true;
+    }
+
+    ProxyLatencyReport report() const {
+        ProxyLatencyReport r;
+        r.frames = static_cast<int>(count_);
+        r.bad_frames = bad_;
+        if (count_ == 0) return r;
+        std::array<int64_t, PROXY_SELFTEST_MAX_FRAMES> sorted{};
+        std::copy_n(latency_ns_.begin(), count_, sorted.begin());
+        std::sort(sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t>(count_));
+        // Nearest rank: the smallest value with at least p of the frames at or below it
+        auto rank = [&](double p) {
+            size_t k = static_cast<size_t>(std::ceil(p * static_cast<double>(count_)));
+            return static_cast<double>(sorted.at(std::clamp<size_t>(k, 1, count_) - 1)) / 1000.0;
+        };
+        r.min_us = static_cast<double>(sorted.front()) / 1000.0;
+        r.p50_us = rank(0.50);
+        r.p99_us = rank(0.99);
+        r.max_us = static_cast<double>(sorted.at(count_ - 1)) / 1000.0;
+        return r;
+    }
+
+private:
+    int baud_;
+    std::array<int64_t, PROXY_SELFTEST_MAX_FRAMES> latency_ns_{};
+    size_t count_ = 0;
+    int bad_ = 0;
+};
+
+// Send `frames` frames on `drive` (wired to `console_pin`) while the
+// controller proxies, and time them back on `loop_pin`. nullopt if the
+// port has no edge log or can't log both pins.
+template <typename Port>
+std::optional<ProxyLatencyReport> run_proxy_selftest(Port& port, SerialWriter<Port>& drive, int console_pin,
+                                                     int loop_pin, int frames) {
+    if constexpr (!PortHasEdgeLog<Port>) {
+        return std::nullopt;
+    } else {
+        if (!port.edge_log_open(console_pin)) return std::nullopt;
+        if (!port.edge_log_open(loop_pin)) {
+            port.edge_log_close(console_pin);
+            return std::nullopt;
+        }
+
+        std::array<PortEdge, TX_SELFTEST_MAX_EDGES> in;
+        std::array<PortEdge, TX_SELFTEST_MAX_EDGES> out;
+        auto drain = [&](int pin, std::span<PortEdge> edges) {
+            size_t n = 0;
+            int got;
+            while ((got = port.edge_log_read(pin, edges.subspan(n))) > 0) {
+                n += static_cast<size_t>(got);
+                if (n == edges.size()) break;
+            }
+            return n;
+        };
+
+        ProxyLatencyAnalyzer analyzer(drive.baud());
+        sleep_us(PROXY_SELFTEST_GAP_MS * 1000);
+        drain(console_pin, in);  // whatever the lines did before
+        drain(loop_pin, out);
+        for (int f = 0; f < std::min(frames, PROXY_SELFTEST_MAX_FRAMES); f++) {
+            std::string_view frame = TX_SELFTEST_FRAMES.at(static_cast<size_t>(f) % TX_SELFTEST_FRAMES.size());
+            drive.write_burst(std::span<const std::string_view>(&frame, 1));
+            sleep_us(PROXY_SELFTEST_GAP_MS * 1000);
+            size_t n_in = drain(console_pin, in);
+            size_t n_out = drain(loop_pin, out);
+            // reinterpret_cast: char -> uint8_t aliasing (standard-allowed)
+            analyzer.add_frame(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(frame.data()), frame.size()),
+                               std::span<const PortEdge>(in.data(), n_in),
+                               std::span<const PortEdge>(out.data(), n_out));
+        }
+        port.edge_log_close(loop_pin);
+        port.edge_log_close(console_pin);
+        return analyzer.report();
+    }
+}
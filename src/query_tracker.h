@@ -0,0 +1,131 @@
+/*
+ * query_tracker.h — QueryTracker: motor query round trips and stalls
+ *
+ * The console (in proxy) and the emulate cycle send bare queries such as
+ * [amps] and [belt]; the motor board answers with [amps:..] on the motor
+ * line (captures/RS485_DISCOVERY.md). QueryTracker pairs each answer
+ * with the latest query for its key:
+ *
+ *   sent()      query handed to the motor writer (console or emulate thread)
+ *   answered()  motor reader decoded a frame for the key ([err] has no
+ *               value when there is no error)
+ *   check()     periodic scan (IPC thread) for keys unanswered too long
+ *
+ * A query superseded by the next one for the same key before any answer
+ * counts as missing. A key whose oldest unanswered query is older than
+ * QUERY_STALL_MS is stalled: check() reports it once, and the answer that
+ * ends it is reported as the recovery. A slowing lower board shows up in
+ * the round-trip histograms well before the belt stops.
+ *
+ * Per-key atomics only: lock-free from every thread, no allocation.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <span>
+#include <atomic>
+#include "kv_protocol.h"
+#include "metrics.h"
+
+// Unanswered this long = stalled (the emulate cycle asks every 500 ms)
+constexpr uint64_t QUERY_STALL_MS = 2000;
+constexpr int QUERY_CHECK_MS = 250;  // stall scan period
+
+// Bare query keys whose answers are tracked
+constexpr bool is_query_key(KvKey id) {
+    switch (id) {
+        case KvKey::Amps: case KvKey::Err: case KvKey::Belt: case KvKey::Vbus:
+        case KvKey::Lift: case KvKey::Lfts: case KvKey::Lftg: case KvKey::Ver:
+        case KvKey::Type:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// A stall starting (check) or ending (answered)
+struct QueryStall {
+    KvKey key;
+    bool stalled;
+    uint64_t waited_ms;  // since the oldest unanswered query
+    uint64_t missing;    // total missing responses for the key
+};
+
+class QueryTracker {
+public:
+    struct Counters {
+        uint64_t sent;
+        uint64_t answered;
+        uint64_t missing;
+        uint64_t stalls;
+    };
+
+    // A bare query for `id` went out at `now_us` (mono_us)
+    void sent(KvKey id, uint64_t now_us) {
+        if (!is_query_key(id)) return;
+        auto& k = keys_.at(static_cast<size_t>(id));
+        k.sent.fetch_add(1, std::memory_order_relaxed);
+        if (k.last_sent_us.exchange(now_us, std::memory_order_relaxed) != 0) {
+            k.missing.fetch_add(1, std::memory_order_relaxed);
+        }
+        uint64_t none = 0;
+        k.waiting_since_us.compare_exchange_strong(none, now_us, std::memory_order_relaxed);
+    }
+
+    // Motor answered `id` at `now_us`. Records the round trip; true (with
+    // *out filled) if this answer ends a stall.
+    bool answered(KvKey id, uint64_t now_us, QueryStall* out) {
+        if (!is_query_key(id)) return false;
+        auto& k = keys_.at(static_cast<size_t>(id));
+        uint64_t sent_us = k.last_sent_us.exchange(0, std::memory_order_relaxed);
+        if (sent_us == 0) return false;  // unsolicited or duplicate
+        k.answered.fetch_add(1, std::memory_order_relaxed);
+        k.rtt_us.record(now_us - sent_us);
+        uint64_t since = k.waiting_since_us.exchange(0, std::memory_order_relaxed);
+        if (!k.stalled.exchange(false, std::memory_order_relaxed)) return false;
+        *out = { id, false, (now_us - since) / 1000, k.missing.load(std::memory_order_relaxed) };
+        return true;
+    }
+
+    // Report keys that just crossed QUERY_STALL_MS. Returns the count
+    // written to `out`.
+    size_t check(uint64_t now_us, std::span<QueryStall> out) {
+        size_t n = 0;
+        for (size_t i = 0; i < keys_.size() && n < out.size(); i++) {
+            auto& k = keys_.at(i);
+            uint64_t since = k.waiting_since_us.load(std::memory_order_relaxed);
+            if (since == 0 || now_us < since || now_us - since < QUERY_STALL_MS * 1000) continue;
+            if (k.stalled.exchange(true, std::memory_order_relaxed)) continue;
+            k.stalls.fetch_add(1, std::memory_order_relaxed);
+            out[n++] = { static_cast<KvKey>(i), true, (now_us - since) / 1000,
+                         k.missing.load(std::memory_order_relaxed) };
+        }
+        return n;
+    }
+
+    const LatencyHistogram& round_trip(KvKey id) const {
+        return keys_.at(static_cast<size_t>(id)).rtt_us;
+    }
+
+    Counters counters(KvKey id) const {
+        const auto& k = keys_.at(static_cast<size_t>(id));
+        return { k.sent.load(std::memory_order_relaxed), k.answered.load(std::memory_order_relaxed),
+                 k.missing.load(std::memory_order_relaxed), k.stalls.load(std::memory_order_relaxed) };
+    }
+
+private:
+    struct KeyState {
+        std::atomic<uint64_t> last_sent_us{0};      // latest unanswered query, 0 = none
+        std::atomic<uint64_t> waiting_since_us{0};  // oldest unanswered query, 0 = none
+        std::atomic<bool> stalled{false};
+        std::atomic<uint64_t> sent{0};
+        std::atomic<uint64_t> answered{0};
+        std::atomic<uint64_t> missing{0};
+        std::atomic<uint64_t> stalls{0};
+        LatencyHistogram rtt_us;
+    };
+
+    std::array<KeyState, KV_KEY_NAMES.size()> keys_;
+};
@@ -1,58 +1,196 @@
 /*
- * ring_buffer.h — Thread-safe circular message buffer
+ * ring_buffer.h — Lock-free multi-producer circular message buffer
  *
  * Decouples GPIO read threads (producers) from the IPC thread (consumer).
- * Each entry is a fixed-size char buffer. If a consumer falls behind,
- * oldest messages are silently dropped — producers never block.
+ * Each entry is a fixed-size char buffer stamped with a sequence number.
+ *
+ * Producers claim a ticket with a single fetch_add, so the console reader,
+ * motor reader and emulate thread never wait on each other. Each slot is a
+ * seqlock: the stamp is cleared while the slot is being written and set to
+ * the ticket when the write completes. Readers copy a slot out and re-check
+ * the stamp, so a message overwritten mid-read is reported instead of being
+ * returned torn. If a consumer falls behind, oldest messages are dropped —
+ * producers never block.
+ *
+ * Optional consumer wakeup: enable_wakeup() creates an eventfd that the
+ * consumer can block on. After arm_wakeup(), the next commit() signals it
+ * once, so an idle consumer costs producers nothing and a sleeping one is
+ * woken within microseconds of a push.
  */
 
 #pragma once
 
-#include <string>
+#include <cstdint>
 #include <string_view>
+#include <span>
 #include <array>
-#include <mutex>
+#include <atomic>
 #include <algorithm>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+// Outcome of reading one message by sequence number
+enum class RingRead : uint8_t {
+    Ok,           // message copied out intact
+    NotReady,     // claimed by a producer but not yet committed — retry later
+    Overwritten   // consumer fell more than size() behind; message is gone
+};
+
+struct RingReadResult {
+    RingRead status;
+    size_t len;   // bytes copied into the caller's buffer (Ok only)
+};
 
 template <int Size = 2048, int MsgSize = 256>
 class RingBuffer {
+    static_assert(Size > 0 && MsgSize > 1);
+    static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                  "ring sequence stamps must be lock-free on the target");
+
 public:
     RingBuffer() = default;
+    ~RingBuffer() {
+        if (wake_fd_ >= 0) ::close(wake_fd_);
+    }
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    // Zero-copy producer API: reserve() claims the next slot and hands back
+    // its storage; format the message directly into `buf`, then commit()
+    // the length. Every reserve() must be followed by exactly one commit().
+    // Lock-free, safe from any thread.
+    struct Reservation {
+        uint64_t seq;
+        std::span<char> buf;   // MsgSize - 1 bytes of slot storage
+    };
+
+    Reservation reserve() {
+        uint64_t seq = next_.fetch_add(1, std::memory_order_relaxed);
+        auto& slot = slots_.at(seq % Size);
+
+        slot.stamp.store(0, std::memory_order_relaxed);  // 0 = write in progress
+        std::atomic_thread_fence(std::memory_order_release);
+        return { seq, std::span<char>(slot.data.data(), MsgSize - 1) };
+    }
+
+    void commit(const Reservation& r, size_t len) {
+        auto& slot = slots_.at(r.seq % Size);
+        slot.len.store(static_cast<uint16_t>(std::min(len, r.buf.size())),
+                       std::memory_order_relaxed);
+        slot.stamp.store(r.seq + 1, std::memory_order_release);
 
-    // Push a message into the ring. Thread-safe.
+        // Pairs with the fence in arm_wakeup(): either the consumer sees
+        // this commit before sleeping, or we see it armed and wake it.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (armed_.load(std::memory_order_relaxed) &&
+            armed_.exchange(false, std::memory_order_acq_rel)) {
+            notify();
+        }
+    }
+
+    // Push a copy of a message. Messages longer than MsgSize - 1 bytes
+    // are truncated.
     void push(std::string_view msg) {
-        std::lock_guard<std::mutex> lk(mu_);
-        auto& slot = msgs_.at(head_);
-        auto copy_len = std::min(static_cast<int>(msg.size()), MsgSize - 1);
-        msg.copy(slot.data(), copy_len);
-        slot.at(copy_len) = '\0';
-        head_ = (head_ + 1) % Size;
-        count_++;
+        auto r = reserve();
+        auto copy_len = std::min(msg.size(), r.buf.size());
+        msg.copy(r.buf.data(), copy_len);
+        commit(r, copy_len);
     }
 
-    // Snapshot of ring state for drain operations
+    // Snapshot of ring state for drain operations. `count` is the total
+    // number of messages ever claimed; sequence numbers run [0, count).
     struct Snapshot {
         int head;
-        unsigned int count;
+        uint64_t count;
     };
 
     Snapshot snapshot() const {
-        std::lock_guard<std::mutex> lk(mu_);
-        return { head_, count_ };
+        uint64_t count = next_.load(std::memory_order_acquire);
+        return { static_cast<int>(count % Size), count };
     }
 
-    // Access a message by ring index (caller must hold no lock; message
-    // content may be stale if ring wraps — acceptable for best-effort IPC)
-    std::string_view at(int idx) const {
-        return msgs_.at(idx % Size).data();
+    // Copy message `seq` into `out`. Never returns a partially written or
+    // partially overwritten message: the slot stamp is checked before and
+    // after the copy.
+    RingReadResult read(uint64_t seq, std::span<char> out) const {
+        const auto& slot = slots_.at(seq % Size);
+
+        uint64_t before = slot.stamp.load(std::memory_order_acquire);
+        if (before > seq + 1) return { RingRead::Overwritten, 0 };
+        if (before != seq + 1) {
+            // Older stamp or write in progress: either seq is still being
+            // written, or a producer has already lapped it.
+            return { lapped(seq) ? RingRead::Overwritten : RingRead::NotReady, 0 };
+        }
+
+        size_t len = std::min(static_cast<size_t>(slot.len.load(std::memory_order_relaxed)),
+                              out.size());
+        std::copy_n(slot.data.data(), len, out.data());
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.stamp.load(std::memory_order_relaxed) != before) {
+            return { RingRead::Overwritten, 0 };
+        }
+        return { RingRead::Ok, len };
+    }
+
+    // True once message `seq` is committed (or already overwritten), i.e.
+    // read(seq) would not return NotReady.
+    bool ready(uint64_t seq) const {
+        return slots_.at(seq % Size).stamp.load(std::memory_order_acquire) >= seq + 1 ||
+               lapped(seq);
+    }
+
+    // --- Consumer wakeup ---
+
+    // Create the wakeup eventfd (idempotent). Returns the fd, or -1.
+    // Call before producers start; the fd lives as long as the ring.
+    int enable_wakeup() {
+        if (wake_fd_ < 0) wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        return wake_fd_;
+    }
+
+    int wakeup_fd() const { return wake_fd_; }
+
+    // Request a signal on the next commit. Call before blocking, then check
+    // ready() on the next unread sequence to close the race.
+    void arm_wakeup() {
+        armed_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    // Signal the wakeup fd unconditionally (e.g. to interrupt for shutdown)
+    void notify() const {
+        if (wake_fd_ < 0) return;
+        uint64_t one = 1;
+        ssize_t n = ::write(wake_fd_, &one, sizeof(one));
+        (void)n;  // EAGAIN means a wakeup is already pending
+    }
+
+    // Clear pending wakeups (consumer side, after waking)
+    void drain_wakeup() const {
+        if (wake_fd_ < 0) return;
+        uint64_t val;
+        ssize_t n = ::read(wake_fd_, &val, sizeof(val));
+        (void)n;
     }
 
     static constexpr int size() { return Size; }
     static constexpr int msg_size() { return MsgSize; }
 
 private:
-    std::array<std::array<char, MsgSize>, Size> msgs_{};
-    int head_ = 0;
-    unsigned int count_ = 0;
-    mutable std::mutex mu_;
+    bool lapped(uint64_t seq) const {
+        return next_.load(std::memory_order_acquire) - seq > static_cast<uint64_t>(Size);
+    }
+
+    struct Slot {
+        std::atomic<uint64_t> stamp{0};   // seq + 1 once committed, 0 while writing
+        std::atomic<uint16_t> len{0};
+        std::array<char, MsgSize> data{};
+    };
+
+    std::array<Slot, Size> slots_{};
+    alignas(64) std::atomic<uint64_t> next_{0};
+    alignas(64) std::atomic<bool> armed_{false};
+    int wake_fd_ = -1;
 };
@@ -1,11 +1,31 @@
 /*
  * serial_io.h — SerialReader and SerialWriter templates
  *
- * SerialReader: manages parse buffer, reads raw GPIO serial data,
- * feeds KV pairs to a callback. Exposes raw bytes for proxy forwarding.
+ * SerialReader: reads raw GPIO serial data straight into a
+ * KvStreamParser ring, feeds KV pairs to a callback. Exposes raw bytes for proxy forwarding.
+ * The callbacks are its Sink (SerialSink): by default SerialCallbacks,
+ * two std::functions set with on_kv()/on_raw(). A caller whose wiring is
+ * fixed at compile time passes its own sink type instead, and
+ * parse -> dispatch -> event build inlines into poll() with no indirect
+ * call per pair or chunk (TreadmillController does, for both readers).
+ * wait_for_data() sleeps between polls: on a GPIO edge alert when the
+ * port supports it (PortHasEdgeWait), else with an adaptive backoff.
+ * A caller polling from its own event loop waits idle_wait_us() instead.
+ * Each read is stamped once (wire_clock.h): with the pin's last edge if
+ * the port records edge times (PortHasEdgeTime), else the read time. So
+ * a pair's t_ns is its ']' arriving, not the poll that found it.
  *
- * SerialWriter: inverted RS-485 DMA waveform generation. Internal
- * mutex serializes wave output.
+ * SerialWriter: inverted RS-485 DMA waveform generation. A WaveEngine
+ * mutex serializes wave output (shared by every bus on one port). KV commands are built into DMA waves
+ * once and kept in a small LRU cache keyed by wire bytes; a burst of
+ * commands goes out as one wave_chain() with no inter-command gaps.
+ * After a send it sleeps for the computed transmit time (10 bit times
+ * per byte), then polls wave_tx_busy() once per bit time for the tail.
+ * Pulse lengths follow the exact bit period (104.17 us at 9600 baud):
+ * each bit edge is rounded to pigpio's whole microseconds on its own
+ * (bit_edge_us()), so the rounding never accumulates across a wave.
+ *
+ * Both take the line's baud rate (BAUD unless gpio.json says otherwise).
  *
  * Both are templated on the GpioPort type for compile-time polymorphism.
  */
@@ -19,8 +39,16 @@
 #include <array>
 #include <algorithm>
 #include <mutex>
+#include <atomic>
 #include <functional>
+#include <concepts>
+#include <ctime>
+#include "gpio_port.h"
 #include "kv_protocol.h"
+#include "metrics.h"
+#include "standby.h"
+#include "trace.h"
+#include "wire_clock.h"
 
 // gpioPulse_t: provided by pigpio.h (production) or gpio_mock.h (test).
 // Define a compatible struct only if neither has been included yet.
@@ -32,19 +60,61 @@ struct gpioPulse_t { uint32_t gpioOn; uint32_t gpioOff; uint32_t usDelay; };
 #endif
 
 constexpr int BAUD = 9600;
-constexpr int BIT_US = 1000000 / BAUD;  // ~104 us per bit
+constexpr int BIT_US = 1000000 / BAUD;  // ~104 us per bit, truncated: poll intervals only
+constexpr int BYTE_US = BIT_US * 10;     // start + 8 data + stop
+constexpr int64_t BYTE_NS = 10 * 1000000000LL / BAUD;
 
-template <typename Port>
+constexpr int64_t byte_ns(int baud) { return 10 * 1000000000LL / baud; }
+
+// Bit edge k of a wave in whole microseconds from its start: k bit
+// periods, rounded. Pulse lengths are differences of these, so a wave
+// is never more than half a microsecond off the exact timing.
+constexpr uint32_t bit_edge_us(int64_t k, int baud) {
+    return static_cast<uint32_t>((k * 2000000 / baud + 1) / 2);
+}
+static_assert(bit_edge_us(1, 9600) == 104 && bit_edge_us(10, 9600) == 1042 && bit_edge_us(60, 9600) == 6250);
+
+// SerialReader idle behaviour
+constexpr int EDGE_WAIT_MAX_MS = 100;    // bound on one edge wait (stop latency)
+constexpr int IDLE_POLL_MIN_US = 1000;   // fallback backoff: 1, 2, 4, 8 ms
+constexpr int IDLE_POLL_MAX_US = 8000;
+
+// SerialWriter: poll interval once the computed transmit time has passed
+constexpr int TX_IDLE_POLL_US = BIT_US;
+
+inline void sleep_us(int us) {
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000L };
+    nanosleep(&ts, nullptr);
+}
+
+// Where a SerialReader's bytes go: kv() per parsed pair, raw() per chunk
+// read (before parsing, for proxy forwarding). Reader thread only.
+template <typename S>
+concept SerialSink = requires(S& s, const KvPair& kv, std::span<const uint8_t> raw) {
+    s.kv(kv);
+    s.raw(raw);
+};
+
+// The default sink: callbacks set at run time
+struct SerialCallbacks {
+    std::function<void(const KvPair&)> kv_cb;
+    std::function<void(std::span<const uint8_t>)> raw_cb;
+
+    void kv(const KvPair& kv) { if (kv_cb) kv_cb(kv); }
+    void raw(std::span<const uint8_t> data) { if (raw_cb) raw_cb(data); }
+};
+
+template <typename Port, SerialSink Sink = SerialCallbacks>
 class SerialReader {
 public:
     using KvCallback = std::function<void(const KvPair&)>;
     using RawCallback = std::function<void(std::span<const uint8_t>)>;
 
-    SerialReader(Port& port, int gpio_pin)
-        : port_(port), pin_(gpio_pin), parse_len_(0) {}
+    SerialReader(Port& port, int gpio_pin, int baud = BAUD, Sink sink = {})
+        : port_(port), pin_(gpio_pin), baud_(baud), byte_ns_(byte_ns(baud)), sink_(std::move(sink)) {}
 
     bool open() {
-        int rc = port_.serial_read_open(pin_, BAUD, 8);
+        int rc = port_.serial_read_open(pin_, baud_, 8);
         if (rc < 0) return false;
         port_.serial_read_invert(pin_, 1);  // RS-485 inverted polarity
         return true;
@@ -55,74 +125,382 @@ public:
     }
 
     // Set callback for parsed KV pairs
-    void on_kv(KvCallback cb) { kv_cb_ = std::move(cb); }
+    void on_kv(KvCallback cb) requires std::same_as<Sink, SerialCallbacks> { sink_.kv_cb = std::move(cb); }
 
     // Set callback for raw bytes (called before parsing, for proxy forwarding)
-    void on_raw(RawCallback cb) { raw_cb_ = std::move(cb); }
+    void on_raw(RawCallback cb) requires std::same_as<Sink, SerialCallbacks> { sink_.raw_cb = std::move(cb); }
 
     // Poll for new data. Returns number of raw bytes read.
-    // Calls raw callback first, then parses and calls kv callback.
+    // Bytes are read straight into the parser's ring; the raw callback
+    // sees them there, then complete KV pairs go to the kv callback.
     int poll() {
-        uint8_t rawbuf[512];
-        // port_.serial_read takes void* — pigpio C API boundary
-        int count = port_.serial_read(pin_, rawbuf, sizeof(rawbuf));
-        if (count <= 0) return 0;
-
-        // Fire raw callback before parsing (low-latency proxy path)
-        if (raw_cb_) {
-            raw_cb_(std::span<const uint8_t>(rawbuf, static_cast<size_t>(count)));
-        }
-
-        // Append to parse buffer
-        int space = static_cast<int>(parsebuf_.size()) - parse_len_;
-        if (count > space) count = space;
-        std::copy_n(rawbuf, count, parsebuf_.data() + parse_len_);
-        parse_len_ += count;
-
-        // Parse KV pairs
-        KvPair pairs[32];
-        int consumed = 0;
-        int n = kv_parse(std::span<const uint8_t>(parsebuf_.data(), static_cast<size_t>(parse_len_)),
-                         pairs, 32, &consumed);
-
-        if (kv_cb_) {
-            for (int i = 0; i < n; i++) {
-                kv_cb_(pairs[i]);
-            }
+        TraceSpan span("serial_read");
+        int total = 0;
+        for (int round = 0; round < 2; round++) {  // free space may wrap once
+            auto space = parser_.write_space();
+            // port_.serial_read takes void* — pigpio C API boundary
+            int count = port_.serial_read(pin_, space.data(), static_cast<int>(space.size()));
+            if (count <= 0) break;
+            auto got = space.first(static_cast<size_t>(count));
+
+            // Fire raw callback before parsing (low-latency proxy path)
+            sink_.raw(std::span<const uint8_t>(got));
+            parser_.commit(got.size());
+            parser_.stamp(arrival_ns(), byte_ns_);
+            total += count;
+            if (got.size() < space.size()) break;
+        }
+        if (total == 0) {
+            span.cancel();
+            idle_polls_ = std::min(idle_polls_ + 1, IDLE_POLLS_MAX);
+            return 0;
         }
+        idle_polls_ = 0;
 
-        // Shift unconsumed bytes to front (dst < src, so std::copy is safe)
-        if (consumed > 0 && consumed < parse_len_) {
-            std::copy(parsebuf_.data() + consumed,
-                      parsebuf_.data() + parse_len_,
-                      parsebuf_.data());
+        parser_.set_keys(parse_keys_.load(std::memory_order_relaxed));
+        std::array<KvPair, 32> pairs;
+        int n;
+        do {
+            n = parser_.parse(pairs);
+            for (int i = 0; i < n; i++) sink_.kv(pairs.at(static_cast<size_t>(i)));
+        } while (n == static_cast<int>(pairs.size()));
+
+        stats_.publish(parser_.stats());
+        return total;
+    }
+
+    // Bytes discarded because an unterminated frame overflowed the parse
+    // ring. Safe to read from any thread.
+    uint64_t dropped_bytes() const { return stats_.overflow_bytes.load(std::memory_order_relaxed); }
+
+    // Bytes, accepted frames and everything the parser threw away, as of
+    // the last poll that read data. Safe to read from any thread; fields
+    // are read one by one, so they may be a poll apart.
+    KvParseStats line_stats() const { return stats_.load(); }
+
+    // Sleep until more data is likely, after poll() returned 0.
+    // Right after traffic, waits one character time for the next byte.
+    // Once idle, blocks on a GPIO edge if the port can, else backs off
+    // from IDLE_POLL_MIN_US to IDLE_POLL_MAX_US. Standby stretches both.
+    void wait_for_data() {
+        if (idle_polls_ <= 1) {
+            sleep_us(idle_wait_us());
+            return;
+        }
+        if constexpr (PortHasEdgeWait<Port>) {
+            bool standby = standby_.load(std::memory_order_relaxed);
+            int rc = port_.wait_edge(pin_, standby ? STANDBY_EDGE_WAIT_MS : EDGE_WAIT_MAX_MS);
+            if (rc > 0) idle_polls_ = 0;  // start bit seen; byte lands within a byte time
+            if (rc >= 0) return;
         }
-        parse_len_ -= consumed;
+        sleep_us(idle_wait_us());
+    }
 
-        return count;
+    // How long to wait before the next poll() without an edge wait: one
+    // character time right after traffic, then the backoff (us). For a
+    // caller whose own loop does the waiting.
+    int idle_wait_us() const {
+        if (idle_polls_ <= 1) return static_cast<int>(byte_ns_ / 1000);
+        bool standby = standby_.load(std::memory_order_relaxed);
+        return std::min(IDLE_POLL_MIN_US << (idle_polls_ - 2), standby ? STANDBY_POLL_US : IDLE_POLL_MAX_US);
+    }
+
+    // Keys the next polls parse (KvStreamParser::set_keys()); frames with
+    // other keys reach neither the sink nor the stats' frames. Safe to
+    // call from any thread.
+    void set_parse_keys(uint32_t keys) { parse_keys_.store(keys, std::memory_order_relaxed); }
+
+    // Standby (standby.h): longer edge waits and poll backoff while idle.
+    // Safe to call from any thread.
+    void set_standby(bool on) { standby_.store(on, std::memory_order_relaxed); }
+
+    // Unblock a wait_for_data() in progress (e.g. on shutdown)
+    void interrupt() {
+        if constexpr (PortHasEdgeWait<Port>) port_.wake_edge(pin_);
     }
 
 private:
+    static constexpr int IDLE_POLLS_MAX = 8;
+
+    // When the last byte just read arrived: the pin's latest edge (within
+    // that byte), unless the port can't say or it's from a clock skew
+    int64_t arrival_ns() {
+        int64_t now = wire_now_ns();
+        if constexpr (PortHasEdgeTime<Port>) {
+            int64_t edge = port_.last_edge_ns(pin_);
+            if (edge > 0 && edge <= now) return edge;
+        }
+        return now;
+    }
+
     Port& port_;
     int pin_;
-    std::array<uint8_t, 4096> parsebuf_{};
-    int parse_len_;
-    KvCallback kv_cb_;
-    RawCallback raw_cb_;
+    int baud_;
+    int64_t byte_ns_;
+    int idle_polls_ = 0;  // consecutive empty polls
+    std::atomic<bool> standby_{false};
+    std::atomic<uint32_t> parse_keys_{KV_PARSE_ALL};
+    KvStreamParser parser_;
+
+    // Parser counters mirrored for other threads
+    struct SharedStats {
+        std::atomic<uint64_t> bytes{0}, frames{0}, nonprintable{0}, bad_length{0},
+            stray_bytes{0}, overflow_bytes{0}, skipped{0};
+
+        void publish(const KvParseStats& s) {
+            bytes.store(s.bytes, std::memory_order_relaxed);
+            frames.store(s.frames, std::memory_order_relaxed);
+            nonprintable.store(s.nonprintable, std::memory_order_relaxed);
+            bad_length.store(s.bad_length, std::memory_order_relaxed);
+            stray_bytes.store(s.stray_bytes, std::memory_order_relaxed);
+            overflow_bytes.store(s.overflow_bytes, std::memory_order_relaxed);
+            skipped.store(s.skipped, std::memory_order_relaxed);
+        }
+
+        KvParseStats load() const {
+            return {bytes.load(std::memory_order_relaxed), frames.load(std::memory_order_relaxed),
+                    nonprintable.load(std::memory_order_relaxed), bad_length.load(std::memory_order_relaxed),
+                    stray_bytes.load(std::memory_order_relaxed), overflow_bytes.load(std::memory_order_relaxed),
+                    skipped.load(std::memory_order_relaxed)};
+        }
+    };
+    SharedStats stats_;
+    Sink sink_;
 };
 
 
+// One KV command of a chained burst
+struct KvFrame {
+    std::string_view key;
+    std::string_view value;
+};
+
+// SerialWriter wave cache
+constexpr int WAVE_CACHE_SIZE = 32;     // cached DMA waves (LRU)
+constexpr size_t WAVE_CACHE_KEY_MAX = KV_WIRE_FRAME_MAX;  // longest frame worth caching
+constexpr int WAVE_CHAIN_MAX = 16;      // frames per wave_chain() call
+static_assert(WAVE_CACHE_SIZE > WAVE_CHAIN_MAX,
+              "a chain's own waves must never be the LRU victim");
+
+// pigpio's DMA wave engine is process-wide: one transmission at a time,
+// and wave_clear() deletes every writer's waves. Writers for several
+// buses on one port share a WaveEngine; a lone writer uses its own.
+struct WaveEngine {
+    std::mutex mu;
+    uint64_t clears = 0;     // bumped on every wave_clear()
+    uint64_t tx_end_us = 0;  // mono_us() when the last send should finish
+};
+
 template <typename Port>
 class SerialWriter {
 public:
-    SerialWriter(Port& port, int gpio_pin)
-        : port_(port), pin_(gpio_pin) {}
+    SerialWriter(Port& port, int gpio_pin, int baud = BAUD)
+        : port_(port), pin_(gpio_pin), baud_(baud), engine_(own_engine_) {}
+
+    SerialWriter(Port& port, int gpio_pin, WaveEngine& engine, int baud = BAUD)
+        : port_(port), pin_(gpio_pin), baud_(baud), engine_(engine) {}
 
-    // Write bytes using inverted RS-485 DMA waveforms.
-    // Thread-safe: serialized by internal mutex.
+    int baud() const { return baud_; }
+
+    // Write bytes using inverted RS-485 DMA waveforms. The wave is built,
+    // sent once and deleted — use for arbitrary data (proxy forwarding).
+    // Thread-safe: serialized by the WaveEngine mutex.
     void write_bytes(std::span<const uint8_t> data) {
         if (data.empty()) return;
 
+        TraceSpan span("write_bytes");
+        TraceSpan wait("tx_wait");
+        uint64_t t0 = mono_us();
+        std::lock_guard<std::mutex> lk(engine_.mu);
+        wait_tx_idle();
+        tx_wait_.record_since(t0);
+        wait.end();
+        int wid = create_wave(data);
+        if (wid >= 0) {
+            send_and_wait(wid, data.size());
+            port_.wave_delete(wid);
+        }
+    }
+
+    // Write one KV command from the wave cache (built on first use).
+    // Built on the stack; only an oversized command allocates.
+    void write_kv(std::string_view key, std::string_view value = {}) {
+        std::array<char, KV_WIRE_MAX> buf;
+        size_t n = kv_build(std::span<char>(buf), key, value);
+        if (n == 0) {
+            write_bytes(as_bytes(kv_build(key, value)));
+            return;
+        }
+        write_frame(std::string_view(buf.data(), n));
+    }
+
+    // Write a prebuilt wire frame (e.g. KvWireFrame::wire()) from the cache
+    void write_frame(std::string_view wire) {
+        auto bytes = as_bytes(wire);
+
+        TraceSpan span("write_frame");
+        TraceSpan wait("tx_wait");
+        uint64_t t0 = mono_us();
+        std::lock_guard<std::mutex> lk(engine_.mu);
+        wait_tx_idle();
+        tx_wait_.record_since(t0);
+        wait.end();
+        int wid = cached_wave(bytes);
+        if (wid >= 0) {
+            send_and_wait(wid, bytes.size());
+        } else if ((wid = create_wave(bytes)) >= 0) {
+            send_and_wait(wid, bytes.size());
+            port_.wave_delete(wid);
+        }
+    }
+
+    // Write several prebuilt frames as one chained DMA transmission, with
+    // no gaps between them. Waves come from the cache; frames the cache
+    // can't hold fall back to one write_frame() each.
+    void write_burst(std::span<const std::string_view> wires) {
+        while (!wires.empty()) {
+            size_t n = std::min(wires.size(), static_cast<size_t>(WAVE_CHAIN_MAX));
+            if (!chain_wires(wires.first(n))) {
+                for (auto w : wires.first(n)) write_frame(w);
+            }
+            wires = wires.subspan(n);
+        }
+    }
+
+    // write_burst() for key/value pairs, framed on the stack
+    void write_kv_burst(std::span<const KvFrame> frames) {
+        while (!frames.empty()) {
+            size_t n = std::min(frames.size(), static_cast<size_t>(WAVE_CHAIN_MAX));
+            std::array<KvWireFrame, WAVE_CHAIN_MAX> built;
+            std::array<std::string_view, WAVE_CHAIN_MAX> wires;
+            bool fits = true;
+            for (size_t i = 0; i < n && fits; i++) {
+                built.at(i) = make_kv_frame(frames[i].key, frames[i].value);
+                wires.at(i) = built.at(i).wire();
+                fits = built.at(i).len > 0;
+            }
+            if (fits) {
+                write_burst(std::span<const std::string_view>(wires.data(), n));
+            } else {
+                for (const auto& f : frames.first(n)) write_kv(f.key, f.value);
+            }
+            frames = frames.subspan(n);
+        }
+    }
+
+    // Time each write spent waiting for the writer (mutex + previous
+    // transmission) before its own bytes went out
+    const LatencyHistogram& tx_wait() const { return tx_wait_; }
+
+    // Delete every cached wave (e.g. before handing the DMA engine to
+    // something else). Cached waves are rebuilt on next use.
+    void clear_wave_cache() {
+        std::lock_guard<std::mutex> lk(engine_.mu);
+        wait_tx_idle();
+        flush_cache();
+    }
+
+private:
+    struct CachedWave {
+        std::array<uint8_t, WAVE_CACHE_KEY_MAX> bytes{};
+        size_t len = 0;
+        int wid = -1;          // -1 = empty slot
+        uint64_t last_use = 0;
+    };
+
+    static std::span<const uint8_t> as_bytes(std::string_view s) {
+        // reinterpret_cast: char -> uint8_t aliasing (standard-allowed wire boundary)
+        return std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+    }
+
+    static constexpr size_t KV_WIRE_MAX = MAX_KV_CONTENT_LEN + 3;  // [ content ] \xff
+
+    bool chain_wires(std::span<const std::string_view> wires) {
+        TraceSpan span("write_chain");
+        TraceSpan wait("tx_wait");
+        uint64_t t0 = mono_us();
+        std::lock_guard<std::mutex> lk(engine_.mu);
+        wait_tx_idle();
+        tx_wait_.record_since(t0);
+        wait.end();
+
+        // A cache flush while collecting invalidates ids already taken,
+        // so retry once with the cache rebuilt from scratch.
+        std::array<char, WAVE_CHAIN_MAX> chain{};
+        uint64_t total_us = 0;  // each wave's own rounded length
+        for (auto w : wires) total_us += tx_us(w.size());
+        for (int attempt = 0; attempt < 2; attempt++) {
+            uint64_t gen = cache_gen_;
+            bool ok = true;
+            for (size_t i = 0; i < wires.size() && ok; i++) {
+                int wid = cached_wave(as_bytes(wires[i]));
+                ok = wid >= 0 && wid <= PORT_WAVE_CHAIN_MAX_ID;
+                if (ok) chain.at(i) = static_cast<char>(wid);
+            }
+            if (!ok) return false;
+            if (gen != cache_gen_) continue;
+
+            if (port_.wave_chain(chain.data(), static_cast<int>(wires.size())) < 0) return false;
+            engine_.tx_end_us = mono_us() + total_us;
+            wait_tx_idle();
+            return true;
+        }
+        return false;
+    }
+
+    // Wave id for `data` from the cache, building it (and evicting the
+    // least recently used entry) on a miss. -1 if it can't be cached.
+    // Caller holds engine_.mu with the transmitter idle.
+    int cached_wave(std::span<const uint8_t> data) {
+        if (data.size() > WAVE_CACHE_KEY_MAX) return -1;
+        sync_cache();
+
+        use_clock_++;
+        CachedWave* victim = &cache_.at(0);
+        for (auto& e : cache_) {
+            if (e.wid >= 0 && e.len == data.size() &&
+                std::equal(data.begin(), data.end(), e.bytes.begin())) {
+                e.last_use = use_clock_;
+                return e.wid;
+            }
+            if (victim->wid >= 0 && (e.wid < 0 || e.last_use < victim->last_use)) victim = &e;
+        }
+
+        if (victim->wid >= 0) {
+            port_.wave_delete(victim->wid);
+            victim->wid = -1;
+        }
+        int wid = create_wave(data);
+        if (wid < 0) {
+            // Out of DMA wave resources (deleted waves leave holes pigpio
+            // can't always reuse): start over with an empty table.
+            flush_cache();
+            wid = create_wave(data);
+            if (wid < 0) return -1;
+        }
+
+        std::copy(data.begin(), data.end(), victim->bytes.begin());
+        victim->len = data.size();
+        victim->wid = wid;
+        victim->last_use = use_clock_;
+        return wid;
+    }
+
+    void flush_cache() {
+        port_.wave_clear();
+        engine_.clears++;
+        sync_cache();
+    }
+
+    // Drop entries a wave_clear() (ours or another bus's) took with it
+    void sync_cache() {
+        if (seen_clears_ == engine_.clears) return;
+        for (auto& e : cache_) e.wid = -1;
+        seen_clears_ = engine_.clears;
+        cache_gen_++;
+    }
+
+    int create_wave(std::span<const uint8_t> data) {
         int len = static_cast<int>(data.size());
         uint32_t mask = 1u << pin_;
 
@@ -130,62 +508,55 @@ public:
         gpioPulse_t pulses[len * 10 + 1];
         int np = 0;
 
+        // Inverted: HIGH for a 0 bit, LOW for a 1. Each pulse runs to the
+        // next rounded bit edge.
+        auto bit = [&](bool one) {
+            pulses[np].gpioOn  = one ? 0 : mask;
+            pulses[np].gpioOff = one ? mask : 0;
+            pulses[np].usDelay = bit_edge_us(np + 1, baud_) - bit_edge_us(np, baud_);
+            np++;
+        };
         for (int b = 0; b < len; b++) {
             uint8_t byte_val = data[b];
-            // Start bit: HIGH (inverted)
-            pulses[np].gpioOn  = mask;
-            pulses[np].gpioOff = 0;
-            pulses[np].usDelay = BIT_US;
-            np++;
-            // 8 data bits, LSB first, INVERTED
-            for (int bit = 0; bit < 8; bit++) {
-                if ((byte_val >> bit) & 1) {
-                    pulses[np].gpioOn  = 0;
-                    pulses[np].gpioOff = mask;  // 1 -> LOW
-                } else {
-                    pulses[np].gpioOn  = mask;
-                    pulses[np].gpioOff = 0;     // 0 -> HIGH
-                }
-                pulses[np].usDelay = BIT_US;
-                np++;
-            }
-            // Stop bit: LOW (inverted idle)
-            pulses[np].gpioOn  = 0;
-            pulses[np].gpioOff = mask;
-            pulses[np].usDelay = BIT_US;
-            np++;
+            bit(false);  // start bit: HIGH
+            for (int i = 0; i < 8; i++) bit((byte_val >> i) & 1);  // LSB first
+            bit(true);   // stop bit: LOW (inverted idle)
         }
 
-        std::lock_guard<std::mutex> lk(write_mu_);
-
-        while (port_.wave_tx_busy()) {
-            // Busy-wait with 1ms sleep
-            struct timespec ts = { 0, 1000000L };
-            nanosleep(&ts, nullptr);
-        }
-
-        port_.wave_clear();
+        // wave_add_new, not wave_clear: cached waves must survive
+        port_.wave_add_new();
         port_.wave_add_generic(np, pulses);
-        int wid = port_.wave_create();
-        if (wid >= 0) {
-            port_.wave_tx_send(wid, PORT_WAVE_MODE_ONE_SHOT);
-            while (port_.wave_tx_busy()) {
-                struct timespec ts = { 0, 1000000L };
-                nanosleep(&ts, nullptr);
-            }
-            port_.wave_delete(wid);
-        }
+        return port_.wave_create();
     }
 
-    void write_kv(std::string_view key, std::string_view value = {}) {
-        auto cmd = kv_build(key, value);
-        // reinterpret_cast: char -> uint8_t aliasing (standard-allowed wire boundary)
-        write_bytes(std::span<const uint8_t>(
-            reinterpret_cast<const uint8_t*>(cmd.data()), cmd.size()));
+    void send_and_wait(int wid, size_t bytes) {
+        port_.wave_tx_send(wid, PORT_WAVE_MODE_ONE_SHOT);
+        engine_.tx_end_us = mono_us() + tx_us(bytes);
+        wait_tx_idle();
+    }
+
+    // Transmit time of one wave of `bytes` bytes
+    uint64_t tx_us(size_t bytes) const { return bit_edge_us(static_cast<int64_t>(bytes) * 10, baud_); }
+
+    // Sleep out the computed transmit time in one go, then poll the
+    // (short) remainder instead of waking every millisecond throughout
+    void wait_tx_idle() {
+        if (!port_.wave_tx_busy()) return;
+        uint64_t now = mono_us();
+        if (now < engine_.tx_end_us) sleep_us(static_cast<int>(engine_.tx_end_us - now));
+        while (port_.wave_tx_busy()) {
+            sleep_us(TX_IDLE_POLL_US);
+        }
     }
 
-private:
     Port& port_;
     int pin_;
-    std::mutex write_mu_;
+    int baud_;
+    WaveEngine own_engine_;    // unused when sharing another engine
+    WaveEngine& engine_;
+    std::array<CachedWave, WAVE_CACHE_SIZE> cache_{};
+    uint64_t use_clock_ = 0;
+    uint64_t cache_gen_ = 0;   // bumped whenever the cache is emptied
+    uint64_t seen_clears_ = 0; // engine_.clears as of our last sync
+    LatencyHistogram tx_wait_;
 };
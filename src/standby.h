@@ -0,0 +1,71 @@
+/*
+ * standby.h — StandbyMonitor: idle detection for the low-power standby
+ *
+ * With the console powered off nothing arrives on either bus, yet the
+ * daemon kept its full-rate wakeups: the readers' edge waits, the motor
+ * query scan, the status and bus-analysis timers. After idle_s seconds
+ * without a bus byte (and not controlling the motor) a bus goes into
+ * standby, where
+ *
+ *   readers     wait up to STANDBY_EDGE_WAIT_MS per edge wait (polling
+ *               ports back off to STANDBY_POLL_US)
+ *   IPC timers  the periodic ones run STANDBY_TIMER_STRETCH times slower
+ *
+ * and the first byte either reader gets brings it back at once. The
+ * idle check itself runs on the IPC thread every STANDBY_CHECK_MS;
+ * wake() is called from the reader threads and costs them one relaxed
+ * load per read batch while awake.
+ *
+ * pigpio's sample clock can't change while it runs (gpioCfgClock only
+ * applies before gpioInitialise), so the sampling cost is set once by
+ * "standby": {"sample_us": N} in gpio.json instead.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+
+constexpr int STANDBY_CHECK_MS = 1000;      // idle check period
+constexpr int STANDBY_EDGE_WAIT_MS = 2000;  // reader edge wait bound in standby
+constexpr int STANDBY_POLL_US = 50000;      // reader poll backoff in standby (no edge wait)
+constexpr int STANDBY_TIMER_STRETCH = 8;    // periodic IPC timers, this many times slower
+constexpr int STANDBY_IDLE_S = 60;          // default idle time before standby
+
+class StandbyMonitor {
+public:
+    // idle_s <= 0: never goes into standby
+    explicit StandbyMonitor(int idle_s) : idle_us_(idle_s > 0 ? static_cast<uint64_t>(idle_s) * 1000000 : 0) {}
+
+    // IPC thread, every STANDBY_CHECK_MS: `bytes` read on the bus so far,
+    // `active` if the motor is being driven. True if this call entered
+    // standby.
+    bool check(uint64_t bytes, bool active, uint64_t now_us) {
+        if (bytes != last_bytes_ || active || last_change_us_ == 0) {
+            last_bytes_ = bytes;
+            last_change_us_ = now_us;
+            return false;
+        }
+        if (idle_us_ == 0 || standby_.load(std::memory_order_relaxed)) return false;
+        if (now_us - last_change_us_ < idle_us_) return false;
+        standby_.store(true, std::memory_order_relaxed);
+        entries_++;
+        return true;
+    }
+
+    // True if this call left standby (the first caller after entering)
+    bool wake() {
+        if (!standby_.load(std::memory_order_relaxed)) return false;
+        return standby_.exchange(false, std::memory_order_relaxed);
+    }
+
+    bool standby() const { return standby_.load(std::memory_order_relaxed); }
+    uint64_t entries() const { return entries_; }  // IPC thread
+
+private:
+    uint64_t idle_us_;
+    uint64_t last_bytes_ = 0;
+    uint64_t last_change_us_ = 0;
+    uint64_t entries_ = 0;
+    std::atomic<bool> standby_{false};
+};
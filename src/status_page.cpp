@@ -0,0 +1,140 @@
+/*
+ * status_page.cpp — StatusPage writer and StatusPageReader
+ */
+
+#include "status_page.h"
+#include "metrics.h"
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace {
+
+constexpr std::array<char, 4> STATUS_PAGE_MAGIC = { 'T', 'M', 'S', '1' };
+constexpr int READ_RETRIES = 64;
+
+// Payload: everything after the seq word
+constexpr size_t PAYLOAD_OFFSET = offsetof(StatusPageLayout, updated_us);
+constexpr size_t PAYLOAD_SIZE = STATUS_PAGE_SIZE - PAYLOAD_OFFSET;
+
+}  // namespace
+
+bool StatusPage::open(const char* name) {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (page_) return true;
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+    if (ftruncate(fd, STATUS_PAGE_SIZE) != 0) {
+        ::close(fd);
+        return false;
+    }
+    void* m = mmap(nullptr, STATUS_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) return false;
+
+    page_ = static_cast<StatusPageLayout*>(m);
+    std::strncpy(name_.data(), name, name_.size() - 1);
+
+    // Reinitialize under an odd seq; seq only moves forward across
+    // restarts, so a reader never mistakes a fresh page for an unchanged one
+    auto seq = std::atomic_ref<uint64_t>(page_->seq);
+    uint64_t odd = seq.load(std::memory_order_relaxed) | 1;
+    seq.store(odd, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    // reinterpret_cast: StatusPageLayout -> char aliasing (standard-allowed)
+    std::memset(reinterpret_cast<char*>(page_) + PAYLOAD_OFFSET, 0, PAYLOAD_SIZE);
+    page_->magic = STATUS_PAGE_MAGIC;
+    page_->version = STATUS_PAGE_VERSION;
+    page_->pid = static_cast<uint32_t>(getpid());
+    // updated_us = 0 until the first publish(): readers report "no data"
+    seq.store(odd + 1, std::memory_order_release);
+    return true;
+}
+
+void StatusPage::close() {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!page_) return;
+    munmap(page_, STATUS_PAGE_SIZE);
+    page_ = nullptr;
+    shm_unlink(name_.data());
+}
+
+void StatusPage::publish(const StatusEvent& ev) {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!page_) return;
+    auto seq = std::atomic_ref<uint64_t>(page_->seq);
+    uint64_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);  // odd: write in progress
+    std::atomic_thread_fence(std::memory_order_release);
+
+    page_->updated_us = mono_us();
+    page_->proxy = ev.proxy;
+    page_->emulate = ev.emulate;
+    page_->overlay = ev.overlay;
+    page_->generation = ev.generation;
+    page_->emu_speed = ev.emu_speed;
+    page_->emu_incline = ev.emu_incline;
+    page_->bus_speed = ev.bus_speed;
+    page_->bus_incline = ev.bus_incline;
+    page_->console_bytes = ev.console_bytes;
+    page_->motor_bytes = ev.motor_bytes;
+    page_->console_dropped = ev.console_dropped;
+    page_->motor_dropped = ev.motor_dropped;
+    page_->distance_mi = ev.distance_mi;
+    page_->vert_ft = ev.vert_ft;
+    page_->belt_on_ms = ev.belt_on_ms;
+
+    seq.store(s + 2, std::memory_order_release);
+}
+
+bool StatusPageReader::open(const char* name) {
+    close();
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return false;
+    void* m = mmap(nullptr, STATUS_PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) return false;
+    page_ = static_cast<const StatusPageLayout*>(m);
+    if (page_->magic != STATUS_PAGE_MAGIC || page_->version != STATUS_PAGE_VERSION) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void StatusPageReader::close() {
+    if (page_) munmap(const_cast<StatusPageLayout*>(page_), STATUS_PAGE_SIZE);
+    page_ = nullptr;
+}
+
+std::optional<StatusPageReader::Snapshot> StatusPageReader::read() const {
+    if (!page_) return std::nullopt;
+    // atomic_ref needs a non-const object; the load itself never writes
+    auto seq = std::atomic_ref<uint64_t>(const_cast<StatusPageLayout*>(page_)->seq);
+    for (int i = 0; i < READ_RETRIES; i++) {
+        uint64_t before = seq.load(std::memory_order_acquire);
+        if (before & 1) continue;
+
+        StatusPageLayout copy;
+        std::memcpy(&copy, page_, STATUS_PAGE_SIZE);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq.load(std::memory_order_relaxed) != before) continue;
+        if (copy.updated_us == 0) return std::nullopt;
+
+        Snapshot out{};
+        out.status = { copy.proxy != 0, copy.emulate != 0, copy.emu_speed, copy.emu_incline,
+                       copy.bus_speed, copy.bus_incline, copy.console_bytes, copy.motor_bytes,
+                       copy.console_dropped, copy.motor_dropped,
+                       copy.distance_mi, copy.vert_ft, copy.belt_on_ms, 0, copy.overlay != 0,
+                       copy.generation };
+        out.updated_us = copy.updated_us;
+        out.pid = copy.pid;
+        out.seq = before;
+        return out;
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,126 @@
+/*
+ * status_page.h — Shared-memory status page (seqlock)
+ *
+ * treadmill_io publishes the StatusEvent fields into a 128-byte POSIX
+ * shared-memory object (/dev/shm/treadmill_io.status) whenever it pushes
+ * a status event or decodes a motor speed/incline. Any local process can
+ * map it read-only and take a consistent snapshot without a socket, a
+ * client slot or a syscall.
+ *
+ * Seqlock protocol (same as the RingBuffer slots): the writer makes `seq`
+ * odd, writes the payload, then makes it even again (release). A reader
+ * loads `seq` (acquire), skips odd values, copies the payload, and keeps
+ * the copy only if `seq` is unchanged afterwards.
+ *
+ * Layout (little-endian, fixed; readers in other languages use offsets):
+ *
+ *   0  char[4]  magic "TMS1"        32 int32  emu_speed
+ *   4  uint32   version (1)         36 int32  emu_incline
+ *   8  uint64   seq                 40 int32  bus_speed
+ *  16  uint64   updated_us (MONO)   44 int32  bus_incline
+ *  24  uint32   writer pid          48 uint32 console_bytes
+ *  28  uint8    proxy               52 uint32 motor_bytes
+ *  29  uint8    emulate             56 uint64 console_dropped
+ *  30  uint8    overlay (0 before it existed)
+ *                                   64 uint64 motor_dropped
+ *                                   72 f64    distance_mi   (version 2)
+ *                                   80 f64    vert_ft
+ *                                   88 uint64 belt_on_ms
+ *                                   96 uint32 generation (0 before it existed)
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <mutex>
+#include <optional>
+#include "ipc_protocol.h"
+
+constexpr const char* STATUS_PAGE_NAME = "/treadmill_io.status";  // shm_open name
+constexpr uint32_t STATUS_PAGE_VERSION = 2;
+constexpr size_t STATUS_PAGE_SIZE = 128;
+
+struct StatusPageLayout {
+    std::array<char, 4> magic;
+    uint32_t version;
+    uint64_t seq;
+    // Payload (seqlock-protected)
+    uint64_t updated_us;
+    uint32_t pid;
+    uint8_t proxy;
+    uint8_t emulate;
+    uint8_t overlay;
+    uint8_t pad;
+    int32_t emu_speed;
+    int32_t emu_incline;
+    int32_t bus_speed;
+    int32_t bus_incline;
+    uint32_t console_bytes;
+    uint32_t motor_bytes;
+    uint64_t console_dropped;
+    uint64_t motor_dropped;
+    double distance_mi;
+    double vert_ft;
+    uint64_t belt_on_ms;
+    uint32_t generation;
+    std::array<uint8_t, 28> reserved;
+};
+static_assert(sizeof(StatusPageLayout) == STATUS_PAGE_SIZE);
+static_assert(offsetof(StatusPageLayout, seq) == 8);
+static_assert(offsetof(StatusPageLayout, updated_us) == 16);
+static_assert(offsetof(StatusPageLayout, emu_speed) == 32);
+static_assert(offsetof(StatusPageLayout, console_dropped) == 56);
+static_assert(offsetof(StatusPageLayout, motor_dropped) == 64);
+static_assert(offsetof(StatusPageLayout, belt_on_ms) == 88);
+static_assert(offsetof(StatusPageLayout, generation) == 96);
+
+class StatusPage {
+public:
+    StatusPage() = default;
+    ~StatusPage() { close(); }
+    StatusPage(const StatusPage&) = delete;
+    StatusPage& operator=(const StatusPage&) = delete;
+
+    // Create (or take over) the shm object. False if /dev/shm is unavailable.
+    bool open(const char* name = STATUS_PAGE_NAME);
+    // Unmap and unlink: readers then fail to open, as with a dead socket
+    void close();
+    bool is_open() const { return page_ != nullptr; }
+
+    // Seqlock write. Thread-safe (writers serialize on an uncontended mutex);
+    // no-op while closed.
+    void publish(const StatusEvent& ev);
+
+private:
+    std::mutex mu_;
+    StatusPageLayout* page_ = nullptr;
+    std::array<char, 64> name_{};
+};
+
+// Read side, for C++ consumers and tests
+class StatusPageReader {
+public:
+    StatusPageReader() = default;
+    ~StatusPageReader() { close(); }
+    StatusPageReader(const StatusPageReader&) = delete;
+    StatusPageReader& operator=(const StatusPageReader&) = delete;
+
+    bool open(const char* name = STATUS_PAGE_NAME);
+    void close();
+
+    struct Snapshot {
+        StatusEvent status;
+        uint64_t updated_us;  // CLOCK_MONOTONIC at publish
+        uint32_t pid;
+        uint64_t seq;
+    };
+
+    // Consistent copy, or nullopt if closed / nothing published yet /
+    // the writer kept it busy for every retry.
+    std::optional<Snapshot> read() const;
+
+private:
+    const StatusPageLayout* page_ = nullptr;
+};
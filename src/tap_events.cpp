@@ -0,0 +1,105 @@
+/*
+ * tap_events.cpp — Tail treadmill_io's events from the shared-memory ring
+ *
+ *   tap_events [--all] [--binary] > events.jsonl
+ *
+ * Prints every event the socket clients get, as the same JSON lines, by
+ * reading the ring in /dev/shm (event_tap.h; gpio.json "tap") instead of
+ * connecting: no client slot, no work in treadmill_io, and any number can
+ * run at once.
+ * --all starts from the oldest message still in the ring instead of the
+ * newest; --binary writes [u16 length][record] frames like a binary
+ * socket client. A reader that falls behind gets a gap event. Follows
+ * treadmill_io across restarts; Ctrl-C to stop.
+ */
+
+#include "event_tap.h"
+#include "ipc_protocol.h"
+#include <cstdio>
+#include <array>
+#include <string_view>
+#include <thread>
+#include <chrono>
+
+namespace {
+
+int usage() {
+    std::fprintf(stderr, "usage: tap_events [--all] [--binary]\n");
+    return 2;
+}
+
+// Follow one writer until it closes. False if an output write failed.
+bool follow(const EventTapReader& tap, bool from_oldest, bool binary) {
+    const EventRing& ring = tap.ring();
+    uint64_t total = ring.snapshot().count;
+    uint64_t cursor = total;
+    if (from_oldest) cursor = total > static_cast<uint64_t>(EventRing::size()) ? total - EventRing::size() : 0;
+
+    std::array<char, EventRing::msg_size()> msg;
+    std::array<char, RECORD_JSON_MAX + BINARY_FRAME_HEADER_SIZE> out;
+    uint64_t dropped = 0;
+    auto emit = [&](std::string_view m) {
+        size_t n = binary ? ring_message_to_frame(out, m) : ring_message_to_json(out, m);
+        return n == 0 || std::fwrite(out.data(), 1, n, stdout) == n;
+    };
+    while (true) {
+        if (!tap.wait(cursor, 1000)) {
+            if (tap.closed()) return true;
+            if (std::fflush(stdout) != 0) return false;
+            continue;
+        }
+        uint64_t head = ring.snapshot().count;
+        if (head - cursor > static_cast<uint64_t>(EventRing::size())) {
+            dropped += head - EventRing::size() - cursor;
+            cursor = head - EventRing::size();
+        }
+        RingReadResult r = ring.read(cursor, msg);
+        if (r.status == RingRead::NotReady) continue;
+        cursor++;
+        if (r.status == RingRead::Overwritten) {
+            dropped++;
+            continue;
+        }
+        if (dropped > 0) {
+            std::array<char, 64> gap;
+            size_t n = format_gap_event(gap, dropped);
+            dropped = 0;
+            if (!emit(std::string_view(gap.data(), n))) return false;
+        }
+        if (!emit(std::string_view(msg.data(), r.len))) return false;
+        // Flush once caught up, so a pipe sees each burst promptly
+        if (!ring.ready(cursor) && std::fflush(stdout) != 0) return false;
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool from_oldest = false;
+    bool binary = false;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--all") from_oldest = true;
+        else if (arg == "--binary") binary = true;
+        else return usage();
+    }
+
+    static std::array<char, 1 << 16> out_buf;
+    std::setvbuf(stdout, out_buf.data(), _IOFBF, out_buf.size());
+
+    bool waiting = false;
+    while (true) {
+        EventTapReader tap;
+        if (!tap.open() || tap.closed()) {
+            if (!waiting) std::fprintf(stderr, "[tap] waiting for /dev/shm%s\n", EVENT_TAP_NAME);
+            waiting = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            continue;
+        }
+        std::fprintf(stderr, "[tap] following treadmill_io pid %u\n", tap.pid());
+        if (!follow(tap, from_oldest, binary)) return 1;  // stdout closed
+        // A restarted writer's ring is new: read it from the start
+        from_oldest = true;
+        waiting = false;
+    }
+}
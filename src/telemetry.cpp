@@ -0,0 +1,140 @@
+/*
+ * telemetry.cpp — TelemetryPublisher: coalesce ring records, send UDP
+ */
+
+#include "telemetry.h"
+#include "metrics.h"
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+TelemetryPublisher::TelemetryPublisher(EventRing& ring, const TelemetryConfig& cfg)
+    : ring_(ring), cfg_(cfg) {}
+
+TelemetryPublisher::~TelemetryPublisher() { close(); }
+
+bool TelemetryPublisher::open() {
+    if (fd_ >= 0) return true;
+    dest_ = {};
+    dest_.sin_family = AF_INET;
+    dest_.sin_port = htons(static_cast<uint16_t>(cfg_.port));
+    if (inet_pton(AF_INET, cfg_.address.c_str(), &dest_.sin_addr) != 1) return false;
+
+    fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) return false;
+    if (IN_MULTICAST(ntohl(dest_.sin_addr.s_addr))) {
+        unsigned char ttl = static_cast<unsigned char>(cfg_.ttl);
+        unsigned char loop = 1;  // dashboards on this host too
+        setsockopt(fd_, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        setsockopt(fd_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    }
+    cursor_ = ring_.snapshot().count;
+    return true;
+}
+
+void TelemetryPublisher::close() {
+    if (fd_ < 0) return;
+    ::close(fd_);
+    fd_ = -1;
+}
+
+int TelemetryPublisher::publish() {
+    if (fd_ < 0) return 0;
+    drain();
+
+    sent_ = 0;
+    datagram_len_ = 0;
+    for (auto& s : status_) {
+        if (s.dirty && !append(s)) return sent_;
+    }
+    for (auto& k : kv_) {
+        if (k.dirty && !append(k)) return sent_;
+    }
+    flush();
+    return sent_;
+}
+
+// Read ring messages [cursor_, end) into the latest-value tables
+void TelemetryPublisher::drain() {
+    constexpr int RING_SZ = EventRing::size();
+    uint64_t total = ring_.snapshot().count;
+    if (total - cursor_ > static_cast<uint64_t>(RING_SZ)) {
+        stats_.lost += total - RING_SZ - cursor_;
+        cursor_ = total - RING_SZ;
+    }
+
+    std::array<char, EventRing::msg_size()> msg;
+    while (cursor_ < total) {
+        RingReadResult r = ring_.read(cursor_, msg);
+        if (r.status == RingRead::NotReady) break;  // producer mid-write; next tick
+        cursor_++;
+        if (r.status == RingRead::Overwritten) {
+            stats_.lost++;
+            continue;
+        }
+        take(std::string_view(msg.data(), r.len));
+    }
+}
+
+void TelemetryPublisher::take(std::string_view rec) {
+    if (rec.empty()) return;
+    if (rec.front() == static_cast<char>(EventRecord::Status) && rec.size() == STATUS_RECORD_SIZE) {
+        auto bus = static_cast<uint8_t>(rec[3]);
+        if (bus < MAX_BUSES) keep(status_.at(bus), rec);
+        return;
+    }
+    if (rec.front() == static_cast<char>(EventRecord::Kv) && rec.size() >= KV_RECORD_HEADER_SIZE) {
+        auto source = static_cast<uint8_t>(rec[1]);
+        auto key = static_cast<uint8_t>(rec[2]);
+        auto bus = static_cast<uint8_t>(rec[5]);
+        if (source >= SOURCES || key >= KEYS || bus >= MAX_BUSES) return;
+        keep(kv_.at((bus * SOURCES + source) * KEYS + key), rec);
+    }
+    // JSON events are not published
+}
+
+void TelemetryPublisher::keep(Latest& slot, std::string_view rec) {
+    if (rec.size() > slot.rec.size()) return;
+    if (slot.dirty) stats_.coalesced++;
+    rec.copy(slot.rec.data(), rec.size());
+    slot.len = static_cast<uint16_t>(rec.size());
+    slot.dirty = true;
+}
+
+// Add one framed record, sending the datagram first if it is full.
+// False if a send failed (the rest wait for the next tick).
+bool TelemetryPublisher::append(Latest& slot) {
+    size_t need = BINARY_FRAME_HEADER_SIZE + slot.len;
+    if (datagram_len_ + need > datagram_.size() && !flush()) return false;
+    if (datagram_len_ == 0) datagram_len_ = TELEMETRY_HEADER_SIZE;
+
+    uint16_t len = slot.len;
+    std::memcpy(datagram_.data() + datagram_len_, &len, sizeof(len));
+    std::memcpy(datagram_.data() + datagram_len_ + BINARY_FRAME_HEADER_SIZE, slot.rec.data(), slot.len);
+    datagram_len_ += need;
+    slot.dirty = false;
+    stats_.records++;
+    return true;
+}
+
+bool TelemetryPublisher::flush() {
+    if (datagram_len_ <= TELEMETRY_HEADER_SIZE) return true;
+    std::memcpy(datagram_.data(), TELEMETRY_MAGIC, 4);
+    uint32_t seq = seq_++;
+    uint64_t now = mono_us();
+    std::memcpy(datagram_.data() + 4, &seq, sizeof(seq));
+    std::memcpy(datagram_.data() + 8, &now, sizeof(now));
+
+    // reinterpret_cast: sockaddr_in -> sockaddr aliasing (standard-allowed)
+    ssize_t n = sendto(fd_, datagram_.data(), datagram_len_, MSG_DONTWAIT,
+                       reinterpret_cast<const struct sockaddr*>(&dest_), sizeof(dest_));
+    datagram_len_ = 0;
+    if (n < 0) {
+        stats_.send_errors++;
+        return false;
+    }
+    stats_.datagrams++;
+    sent_++;
+    return true;
+}
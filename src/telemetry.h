@@ -0,0 +1,108 @@
+/*
+ * telemetry.h — UDP telemetry publisher (multicast to LAN dashboards)
+ *
+ * Socket clients are limited to MAX_CLIENTS and each costs the IPC
+ * thread a queue. Dashboards that only watch live data can instead join
+ * a multicast group: at `rate_hz` the publisher reads everything pushed
+ * to the ring since its last tick, keeps only the latest status record
+ * per bus and the latest kv record per (bus, source, key), and sends them
+ * in as few datagrams as fit. Any number of receivers, no per-receiver
+ * state, and a stalled receiver can't slow anything down.
+ *
+ * Records use the binary framing of ipc_protocol.h. Datagram layout
+ * (little-endian):
+ *
+ *   0 char[4] magic "TMT1"   4 u32 datagram seq   8 u64 sent_us (MONO)
+ *  16 records, each [u16 length][record]: status records first, then kv
+ *
+ * Kv records with a key outside KV_KEY_NAMES share one slot per source,
+ * so only the latest of them survives a tick. Other events (metrics,
+ * programs, stalls) are not published. Sends are non-blocking; a
+ * datagram the kernel refuses is counted and dropped.
+ *
+ * Driven by an IPC thread timer (TreadmillController or BusHost).
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <string>
+#include <string_view>
+#include <netinet/in.h>
+#include "ipc_protocol.h"
+#include "kv_protocol.h"
+#include "byte_ring.h"
+
+constexpr size_t TELEMETRY_DATAGRAM_MAX = 1400;  // fits an Ethernet MTU unfragmented
+constexpr size_t TELEMETRY_HEADER_SIZE = 16;
+constexpr const char* TELEMETRY_MAGIC = "TMT1";
+
+struct TelemetryConfig {
+    std::string address;   // IPv4 group (or unicast host); empty = disabled
+    int port = 5005;
+    int rate_hz = 10;
+    int ttl = 1;           // multicast hops; 1 = local subnet only
+};
+
+class TelemetryPublisher {
+public:
+    struct Stats {
+        uint64_t datagrams;
+        uint64_t records;     // records sent
+        uint64_t coalesced;   // ring records superseded before a tick
+        uint64_t send_errors;
+        uint64_t lost;        // ring messages overwritten before we read them
+    };
+
+    TelemetryPublisher(EventRing& ring, const TelemetryConfig& cfg);
+    ~TelemetryPublisher();
+    TelemetryPublisher(const TelemetryPublisher&) = delete;
+    TelemetryPublisher& operator=(const TelemetryPublisher&) = delete;
+
+    // UDP socket for the destination, starting from the ring's current end
+    bool open();
+    void close();
+    bool is_open() const { return fd_ >= 0; }
+
+    // Timer tick: coalesce what was pushed since the last tick and send
+    // it. Returns the number of datagrams sent.
+    int publish();
+
+    Stats stats() const { return stats_; }
+    int interval_ms() const { return 1000 / cfg_.rate_hz; }
+
+private:
+    static constexpr size_t KEYS = KV_KEY_NAMES.size();
+    static constexpr size_t SOURCES = SUB_SOURCE_NAMES.size();
+    // Longest kv record (header plus the longest key:value content) or status record
+    static constexpr size_t RECORD_MAX = KV_RECORD_HEADER_SIZE + MAX_KV_CONTENT_LEN;
+    static_assert(RECORD_MAX >= STATUS_RECORD_SIZE);
+
+    struct Latest {
+        std::array<char, RECORD_MAX> rec{};
+        uint16_t len = 0;
+        bool dirty = false;
+    };
+
+    void drain();
+    void take(std::string_view rec);
+    void keep(Latest& slot, std::string_view rec);
+    bool append(Latest& slot);
+    bool flush();
+
+    EventRing& ring_;
+    TelemetryConfig cfg_;
+    int fd_ = -1;
+    struct sockaddr_in dest_{};
+    uint64_t cursor_ = 0;
+    uint32_t seq_ = 0;
+    Stats stats_{};
+
+    std::array<Latest, MAX_BUSES> status_{};
+    std::array<Latest, MAX_BUSES * SOURCES * KEYS> kv_{};
+
+    std::array<char, TELEMETRY_DATAGRAM_MAX> datagram_{};
+    size_t datagram_len_ = 0;
+    int sent_ = 0;  // datagrams this tick
+};
@@ -0,0 +1,240 @@
+/*
+ * bench_data_plane.cpp — Microbenchmarks for the serial/IPC data plane
+ *
+ * Times kv_parse, KvStreamParser, event formatting, EventRing pushes,
+ * parse_command and SerialWriter pulse synthesis (through MockGpioPort,
+ * so the writer numbers include the mock's wave bookkeeping). The
+ * SerialReader benches run read -> parse -> dispatch -> format_kv_event
+ * with the default std::function callbacks and with a sink type, the
+ * way the controller wires its readers.
+ *
+ * Serial input is real console traffic: a logic-analyzer capture from
+ * captures/, decoded by load_capture_channel() (gpio_replay.h). Without
+ * a capture the benches run on a synthetic 14-key cycle.
+ *
+ * Usage: bench_data_plane [capture.csv] [--json results.jsonl]
+ */
+
+#include "bench_util.h"
+#include "kv_protocol.h"
+#include "ipc_protocol.h"
+#include "byte_ring.h"
+#include "gpio_mock.h"
+#include "gpio_replay.h"
+#include "serial_io.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <array>
+#include <vector>
+#include <memory>
+
+constexpr const char* DEFAULT_CAPTURE = "captures/try6.csv";  // most KV traffic
+// One pass of the emulate cycle's 14 keys, as the console sends them
+static std::string synthetic_traffic() {
+    std::string bytes;
+    for (int rep = 0; rep < 64; rep++) {
+        for (size_t i = 1; i < KV_KEY_NAMES.size(); i++) {
+            auto key = KV_KEY_NAMES.at(i);
+            bool valued = key == "inc" || key == "hmph" || key == "part" ||
+                          key == "diag" || key == "loop";
+            bytes += kv_build(key, valued ? "5" : "");
+        }
+    }
+    return bytes;
+}
+
+static std::span<const uint8_t> as_span(std::string_view s) {
+    // reinterpret_cast: char -> uint8_t aliasing (standard-allowed)
+    return { reinterpret_cast<const uint8_t*>(s.data()), s.size() };
+}
+
+// Serves a byte string 64 bytes per read, as a busy line would: no mock
+// locking or queueing in the way of the reader itself
+struct TrafficPort {
+    std::string_view rest;
+
+    int serial_read(int, void* buf, int bufsize) {
+        size_t n = std::min({ rest.size(), static_cast<size_t>(bufsize), size_t{64} });
+        std::copy_n(rest.data(), n, static_cast<char*>(buf));
+        rest.remove_prefix(n);
+        return static_cast<int>(n);
+    }
+};
+
+// Formats every pair as a console kv event, like the controller
+struct FormatSink {
+    std::array<char, 256> buf{};
+    size_t bytes = 0;
+
+    void kv(const KvPair& kv) {
+        bytes += format_kv_event(buf, KvEvent{ "console", kv.key_view(), kv.value_view(), 12.345 });
+    }
+    void raw(std::span<const uint8_t> data) { bytes += data.size(); }
+};
+
+// Only counts, so the dispatch itself is what's timed
+struct CountSink {
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+
+    void kv(const KvPair& kv) { frames += kv.key_len; }
+    void raw(std::span<const uint8_t> data) { bytes += data.size(); }
+};
+
+int main(int argc, char** argv) {
+    const char* capture = DEFAULT_CAPTURE;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--json") == 0) { i++; continue; }
+        capture = argv[i];
+    }
+
+    std::string traffic = log_bytes(load_capture_channel(capture, CAPTURE_CH_CONSOLE));
+    if (traffic.empty()) {
+        std::printf("capture %s unavailable, using synthetic traffic\n", capture);
+        traffic = synthetic_traffic();
+    }
+
+    // Every frame in the traffic, for the per-event benches
+    std::vector<KvPair> frames(traffic.size() / 3 + 1);
+    int consumed = 0;
+    int nframes = kv_parse(as_span(traffic), frames.data(), static_cast<int>(frames.size()), &consumed);
+    frames.resize(static_cast<size_t>(nframes));
+    std::printf("traffic: %zu bytes, %d frames (%s)\n", traffic.size(), nframes, capture);
+    if (frames.empty()) return 1;
+
+    BenchReport report(argc, argv);
+
+    // --- Parsing: one op = the whole traffic buffer ---
+
+    report.run("kv_parse/traffic", traffic.size(), [&]() {
+        std::array<KvPair, 32> pairs;
+        auto buf = as_span(traffic);
+        while (!buf.empty()) {
+            int used = 0;
+            int n = kv_parse(buf, pairs.data(), static_cast<int>(pairs.size()), &used);
+            bench_keep(pairs.at(0));
+            if (n < static_cast<int>(pairs.size())) break;  // end, or an incomplete tail
+            buf = buf.subspan(static_cast<size_t>(used));
+        }
+    });
+
+    report.run("kv_stream_parser/64B_reads", traffic.size(), [&]() {
+        KvStreamParser parser;
+        std::array<KvPair, 32> pairs;
+        std::string_view rest = traffic;
+        while (!rest.empty()) {
+            auto space = parser.write_space();
+            size_t n = std::min({ rest.size(), space.size(), size_t{64} });
+            std::copy_n(rest.data(), n, space.data());
+            parser.commit(n);
+            rest.remove_prefix(n);
+            while (parser.parse(pairs) == static_cast<int>(pairs.size())) {}
+            bench_keep(pairs.at(0));
+        }
+    });
+
+    // --- SerialReader dispatch: one op = the whole traffic buffer ---
+
+    TrafficPort traffic_port;
+    auto bench_reader = [&]<typename Sink>(const char* callbacks_name, const char* sink_name) {
+        {
+            SerialReader<TrafficPort> reader(traffic_port, 27);
+            Sink out;
+            reader.on_kv([&](const KvPair& kv) { out.kv(kv); });
+            reader.on_raw([&](std::span<const uint8_t> data) { out.raw(data); });
+            report.run(callbacks_name, traffic.size(), [&]() {
+                traffic_port.rest = traffic;
+                while (reader.poll() > 0) {}
+                bench_keep(out);
+            });
+        }
+        SerialReader<TrafficPort, Sink> reader(traffic_port, 27);
+        report.run(sink_name, traffic.size(), [&]() {
+            traffic_port.rest = traffic;
+            while (reader.poll() > 0) {}
+        });
+    };
+    bench_reader.operator()<CountSink>("serial_reader/std_function", "serial_reader/sink");
+    bench_reader.operator()<FormatSink>("serial_reader/std_function+format", "serial_reader/sink+format");
+
+    // --- Event building: one op = one KV event ---
+
+    size_t fi = 0;
+    auto next_event = [&]() {
+        const auto& kv = frames.at(fi);
+        fi = fi + 1 == frames.size() ? 0 : fi + 1;
+        return KvEvent{ "console", kv.key_view(), kv.value_view(), 12.345 };
+    };
+
+    report.run("build_kv_event", 0, [&]() {
+        auto s = build_kv_event(next_event());
+        bench_keep(s);
+    });
+
+    report.run("format_kv_event", 0, [&]() {
+        std::array<char, 256> buf;
+        size_t n = format_kv_event(buf, next_event());
+        bench_keep(n);
+    });
+
+    // --- Ring: one op = one message ---
+
+    auto ring = std::make_unique<EventRing>();
+    std::string line = build_kv_event(next_event());
+
+    report.run("ring_push", line.size(), [&]() {
+        ring->push(line);
+    });
+
+    report.run("ring_reserve_format_commit", 0, [&]() {
+        auto slot = ring->reserve();
+        ring->commit(slot, format_kv_event(slot.buf, next_event()));
+    });
+
+    // --- IPC commands: one op = one parse ---
+
+    static constexpr std::array<std::string_view, 6> COMMANDS = {
+        "{\"cmd\":\"speed\",\"value\":3.5}",
+        "{\"cmd\":\"incline\",\"value\":4.5}",
+        "{\"cmd\":\"emulate\",\"enabled\":true}",
+        "{\"cmd\":\"status\"}",
+        "{\"cmd\":\"heartbeat\"}",
+        "{\"cmd\":\"proxy\",\"enabled\":false}",
+    };
+    size_t ci = 0;
+    report.run("parse_command", 0, [&]() {
+        auto cmd = parse_command(COMMANDS.at(ci));
+        ci = ci + 1 == COMMANDS.size() ? 0 : ci + 1;
+        bench_keep(cmd);
+    });
+
+    // Most inbound traffic: every client's once-a-second heartbeat
+    report.run("parse_command/heartbeat", 0, [&]() {
+        auto cmd = parse_command("{\"cmd\":\"heartbeat\"}");
+        bench_keep(cmd);
+    });
+
+    // --- SerialWriter: one op = one write ---
+
+    MockGpioPort port;
+    SerialWriter<MockGpioPort> writer(port, 22);
+    auto trim_mock = [&]() {
+        if (port.wave_writes.size() >= 1024) port.wave_writes.clear();
+    };
+
+    std::string_view chunk = std::string_view(traffic).substr(0, 16);
+    report.run("serial_writer/write_bytes_16B", chunk.size(), [&]() {
+        writer.write_bytes(as_span(chunk));
+        trim_mock();
+    });
+
+    report.run("serial_writer/write_kv_cached", 0, [&]() {
+        writer.write_kv("hmph", "4B0");
+        trim_mock();
+    });
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * bench_util.h — Shared helpers for the microbenchmarks
+ *
+ * BenchReport runs a callable in doubling batches until a batch takes at
+ * least BENCH_MIN_SEC, then prints ns/op, heap allocations/op and
+ * throughput for that batch. With `--json PATH` on the command line it
+ * also appends one JSON object per benchmark (JSON lines) to PATH.
+ *
+ * Allocations are counted by replacing the global operator new, so
+ * include this header from exactly one translation unit per binary
+ * (every bench is a single .cpp).
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <atomic>
+#include <string_view>
+
+inline std::atomic<uint64_t> g_bench_allocs{0};
+
+void* operator new(size_t size) {
+    g_bench_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+    std::abort();  // built with -fno-exceptions: no std::bad_alloc
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+constexpr double BENCH_MIN_SEC = 0.2;
+
+inline double bench_now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+
+// Keep `val` alive so the optimizer can't drop the work that made it
+template <typename T>
+inline void bench_keep(const T& val) {
+    asm volatile("" : : "r,m"(val) : "memory");
+}
+
+class BenchReport {
+public:
+    // Parses `--json PATH`; other arguments are left to the caller
+    BenchReport(int argc, char** argv) {
+        for (int i = 1; i + 1 < argc; i++) {
+            if (std::strcmp(argv[i], "--json") == 0) json_ = std::fopen(argv[i + 1], "w");
+        }
+    }
+
+    ~BenchReport() {
+        if (json_) std::fclose(json_);
+    }
+
+    BenchReport(const BenchReport&) = delete;
+    BenchReport& operator=(const BenchReport&) = delete;
+
+    // Time `op` (one operation per call). bytes_per_op = 0 skips throughput.
+    template <typename Op>
+    void run(std::string_view name, size_t bytes_per_op, Op&& op) {
+        if (!header_) {
+            std::printf("%-34s %14s %12s %12s\n", "benchmark", "ns/op", "allocs/op", "MB/s");
+            header_ = true;
+        }
+        op();  // warm caches and lazily built state
+        uint64_t batch = 1;
+        double elapsed = 0;
+        uint64_t allocs = 0;
+        while (true) {
+            uint64_t a0 = g_bench_allocs.load(std::memory_order_relaxed);
+            double t0 = bench_now_sec();
+            for (uint64_t i = 0; i < batch; i++) op();
+            elapsed = bench_now_sec() - t0;
+            allocs = g_bench_allocs.load(std::memory_order_relaxed) - a0;
+            if (elapsed >= BENCH_MIN_SEC || batch >= (uint64_t{1} << 40)) break;
+            batch *= 2;
+        }
+
+        double n = static_cast<double>(batch);
+        double ns_per_op = elapsed * 1e9 / n;
+        double allocs_per_op = static_cast<double>(allocs) / n;
+        double mb_per_s = bytes_per_op ? static_cast<double>(bytes_per_op) * n / elapsed / 1e6 : 0.0;
+
+        std::printf("%-34.*s %14.1f %12.2f ", static_cast<int>(name.size()), name.data(),
+                    ns_per_op, allocs_per_op);
+        if (bytes_per_op) std::printf("%12.2f\n", mb_per_s);
+        else std::printf("%12s\n", "-");
+
+        if (json_) {
+            std::fprintf(json_,
+                         "{\"bench\":\"%.*s\",\"ops\":%llu,\"ns_per_op\":%.1f,"
+                         "\"allocs_per_op\":%.3f,\"mb_per_s\":%.3f}\n",
+                         static_cast<int>(name.size()), name.data(),
+                         static_cast<unsigned long long>(batch), ns_per_op, allocs_per_op, mb_per_s);
+        }
+    }
+
+    // Results file for benches with their own row format (nullptr if none)
+    FILE* json() const { return json_; }
+
+private:
+    FILE* json_ = nullptr;
+    bool header_ = false;
+};
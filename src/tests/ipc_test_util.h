@@ -0,0 +1,73 @@
+/*
+ * ipc_test_util.h — Shared helpers for tests that talk to the IPC socket
+ *
+ * A test client on SOCK_PATH: connect, send one command line, and read
+ * what comes back, either everything that arrived within a fixed wait or
+ * until a needle shows up. Blocking and single-threaded, like the tests.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "ipc_server.h"
+
+// A new connection to the IPC socket, or -1
+inline int connect_ipc() {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, SOCK_PATH, sizeof(addr.sun_path) - 1);
+    // reinterpret_cast: sockaddr_un -> sockaddr (POSIX socket API)
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// One command line
+inline void send_json(int fd, const char* json) {
+    std::string line = std::string(json) + "\n";
+    (void)write(fd, line.c_str(), line.size());
+}
+
+// Sleep wait_ms, then everything already received
+inline std::string read_available(int fd, int wait_ms = 150) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
+    char buf[8192];
+    std::string result;
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) break;
+        result.append(buf, static_cast<size_t>(n));
+    }
+    fcntl(fd, F_SETFL, flags);
+    return result;
+}
+
+// Everything received until `needle` appears or timeout_ms passes
+inline std::string read_until(int fd, std::string_view needle, int timeout_ms) {
+    std::string out;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (out.find(needle) == std::string::npos && std::chrono::steady_clock::now() < deadline) {
+        struct pollfd pfd{fd, POLLIN, 0};
+        if (poll(&pfd, 1, 50) <= 0) continue;
+        char buf[4096];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) break;
+        out.append(buf, static_cast<size_t>(n));
+    }
+    return out;
+}
@@ -0,0 +1,290 @@
+/*
+ * sim_treadmill.cpp — treadmill_io on a simulated motor controller
+ *
+ * Runs a BusHost on a SimMotorPort (gpio_sim.h) instead of pigpio: the
+ * same socket, the same events, with a modelled belt and lift answering
+ * the motor line. server.py, ftms and the clients connect to it as to
+ * the daemon, so the whole stack can be exercised and benchmarked with
+ * no treadmill attached. No console is simulated; take control with
+ * emulate commands.
+ *
+ * With --drive N it also drives itself: one client sends N speed and
+ * incline steps alternately, each with a seq, and waits for the motor
+ * ack, i.e. until the simulated motor reports the new target. Printed
+ * per step and summarised at the end: command -> applied ack and
+ * command -> motor ack round trips as seen by the client, and the
+ * daemon's own echo_us.
+ *
+ * Usage: sim_treadmill [--seconds S] [--accel MPH_S] [--decel MPH_S]
+ *                      [--lift PCT_S] [--reply-us US] [--drive N]
+ *                      [--json results.jsonl]
+ *
+ * --seconds 0 (default) runs until Ctrl-C, or until the drive is done.
+ * Uses SOCK_PATH, so the daemon must not be running (make sim stops it).
+ */
+
+#include "gpio_sim.h"
+#include "bus_host.h"
+#include "metrics.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <charconv>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <array>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace {
+
+constexpr int STEP_TIMEOUT_MS = 30000;
+constexpr int HEARTBEAT_MS = 1000;
+
+volatile sig_atomic_t g_running = 1;
+
+void sig_handler(int /*sig*/) { g_running = 0; }
+
+struct Options {
+    double seconds = 0;
+    SimMotorConfig sim{};
+    int drive = 0;
+    const char* json = nullptr;
+};
+
+bool parse_options(int argc, char** argv, Options& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string_view a = argv[i];
+        if (i + 1 >= argc) return false;
+        const char* v = argv[++i];
+        if (a == "--seconds") opt.seconds = std::atof(v);
+        else if (a == "--accel") opt.sim.accel_mph_s = std::atof(v);
+        else if (a == "--decel") opt.sim.decel_mph_s = std::atof(v);
+        else if (a == "--lift") opt.sim.lift_pct_s = std::atof(v);
+        else if (a == "--reply-us") opt.sim.reply_us = std::max(0, std::atoi(v));
+        else if (a == "--drive") opt.drive = std::max(0, std::atoi(v));
+        else if (a == "--json") opt.json = v;
+        else return false;
+    }
+    return opt.seconds >= 0 && opt.sim.accel_mph_s > 0 && opt.sim.decel_mph_s > 0 && opt.sim.lift_pct_s > 0;
+}
+
+int connect_client() {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, SOCK_PATH, sizeof(addr.sun_path) - 1);
+    // reinterpret_cast: sockaddr_un -> sockaddr (POSIX socket API)
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool send_line(int fd, std::string_view line) {
+    std::string out(line);
+    out.push_back('\n');
+    return write(fd, out.data(), out.size()) == static_cast<ssize_t>(out.size());
+}
+
+// Number after `"name":` in a JSON line
+std::optional<uint64_t> field_u64(std::string_view line, std::string_view name) {
+    std::string key = "\"" + std::string(name) + "\":";
+    auto at = line.find(key);
+    if (at == std::string_view::npos) return std::nullopt;
+    auto num = line.substr(at + key.size());
+    uint64_t v = 0;
+    auto [ptr, ec] = std::from_chars(num.data(), num.data() + num.size(), v);
+    if (ec != std::errc{}) return std::nullopt;
+    return v;
+}
+
+struct Drive {
+    LatencyHistogram applied;   // client: command -> applied ack
+    LatencyHistogram converge;  // client: command -> motor ack
+    LatencyHistogram echo;      // daemon's echo_us
+    int steps = 0;
+    int timeouts = 0;
+};
+
+// One client's line reader over a blocking socket with poll() timeouts
+class LineReader {
+public:
+    explicit LineReader(int fd) : fd_(fd) {}
+
+    // Next line, or nullopt at the deadline or on EOF
+    std::optional<std::string> next(uint64_t deadline_us) {
+        while (true) {
+            auto nl = buf_.find('\n');
+            if (nl != std::string::npos) {
+                std::string line = buf_.substr(0, nl);
+                buf_.erase(0, nl + 1);
+                return line;
+            }
+            uint64_t now = mono_us();
+            if (now >= deadline_us) return std::nullopt;
+            struct pollfd p = { fd_, POLLIN, 0 };
+            int timeout = static_cast<int>(std::min<uint64_t>((deadline_us - now) / 1000 + 1, HEARTBEAT_MS));
+            if (poll(&p, 1, timeout) <= 0) continue;
+            std::array<char, 8192> chunk;
+            ssize_t n = read(fd_, chunk.data(), chunk.size());
+            if (n <= 0) {
+                eof_ = true;
+                return std::nullopt;
+            }
+            buf_.append(chunk.data(), static_cast<size_t>(n));
+        }
+    }
+
+    bool eof() const { return eof_; }
+
+private:
+    int fd_;
+    std::string buf_;
+    bool eof_ = false;
+};
+
+// Alternate speed and incline steps to random targets; each waits for its motor ack
+void drive(const Options& opt, Drive& d) {
+    int fd = connect_client();
+    if (fd < 0) {
+        std::fprintf(stderr, "[sim] drive: connect failed\n");
+        return;
+    }
+    LineReader reader(fd);
+    send_line(fd, "{\"cmd\":\"subscribe\",\"types\":[]}");
+    send_line(fd, "{\"cmd\":\"emulate\",\"enabled\":true}");
+
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> speed_tenths(10, 80);
+    std::uniform_int_distribution<int> incline_pct(0, 10);
+    for (int step = 1; step <= opt.drive && g_running; step++) {
+        std::array<char, 96> cmd;
+        bool speed = step % 2 == 1;
+        int n = speed ? std::snprintf(cmd.data(), cmd.size(), "{\"cmd\":\"speed\",\"value\":%.1f,\"seq\":%d}",
+                                      speed_tenths(rng) / 10.0, step)
+                      : std::snprintf(cmd.data(), cmd.size(), "{\"cmd\":\"incline\",\"value\":%d,\"seq\":%d}",
+                                      incline_pct(rng), step);
+        uint64_t t0 = mono_us();
+        if (!send_line(fd, std::string_view(cmd.data(), static_cast<size_t>(n)))) break;
+
+        std::array<char, 32> seq;
+        int sn = std::snprintf(seq.data(), seq.size(), "\"seq\":%d,", step);
+        std::string_view seq_field(seq.data(), static_cast<size_t>(sn));
+        uint64_t deadline = t0 + STEP_TIMEOUT_MS * 1000ull;
+        uint64_t heartbeat = t0 + HEARTBEAT_MS * 1000ull;
+        bool done = false;
+        while (!done && g_running) {
+            if (mono_us() >= heartbeat) {
+                send_line(fd, "{\"cmd\":\"heartbeat\"}");
+                heartbeat += HEARTBEAT_MS * 1000ull;
+            }
+            auto line = reader.next(std::min(deadline, heartbeat));
+            if (!line) {
+                if (reader.eof() || mono_us() >= deadline) break;
+                continue;
+            }
+            if (line->find("\"type\":\"ack\"") == std::string::npos || line->find(seq_field) == std::string::npos) {
+                continue;
+            }
+            uint64_t dt = mono_us() - t0;
+            if (line->find("\"stage\":\"applied\"") != std::string::npos) {
+                d.applied.record(dt);
+            } else if (line->find("\"stage\":\"motor\"") != std::string::npos) {
+                d.converge.record(dt);
+                if (auto e = field_u64(*line, "echo_us")) d.echo.record(*e);
+                std::printf("step %3d  %-7s %-48s %8.3f s\n", step, speed ? "speed" : "incline", cmd.data(),
+                            static_cast<double>(dt) / 1e6);
+                done = true;
+            }
+        }
+        d.steps++;
+        if (!done) d.timeouts++;
+    }
+    close(fd);
+}
+
+void print_latency(const char* name, const LatencyHistogram::Summary& h) {
+    std::printf("  %-22s n %llu, p50 %.1f ms, p99 %.1f ms, max %.1f ms\n", name,
+                static_cast<unsigned long long>(h.count), static_cast<double>(h.p50_us) / 1e3,
+                static_cast<double>(h.p99_us) / 1e3, static_cast<double>(h.max_us) / 1e3);
+}
+
+void print_json(const Options& opt, const Drive& d, uint64_t frames, uint64_t replies) {
+    FILE* f = std::fopen(opt.json, "w");
+    if (!f) return;
+    std::fprintf(f, "{\"name\":\"sim_treadmill\",\"accel_mph_s\":%.2f,\"decel_mph_s\":%.2f,\"lift_pct_s\":%.2f,"
+                    "\"reply_us\":%d,\"steps\":%d,\"timeouts\":%d,\"frames\":%llu,\"replies\":%llu",
+                 opt.sim.accel_mph_s, opt.sim.decel_mph_s, opt.sim.lift_pct_s, opt.sim.reply_us, d.steps, d.timeouts,
+                 static_cast<unsigned long long>(frames), static_cast<unsigned long long>(replies));
+    auto hist = [&](const char* name, const LatencyHistogram& h) {
+        auto s = h.summary();
+        std::fprintf(f, ",\"%s\":{\"count\":%llu,\"p50_us\":%llu,\"p99_us\":%llu,\"max_us\":%llu}", name,
+                     static_cast<unsigned long long>(s.count), static_cast<unsigned long long>(s.p50_us),
+                     static_cast<unsigned long long>(s.p99_us), static_cast<unsigned long long>(s.max_us));
+    };
+    hist("applied", d.applied);
+    hist("converge", d.converge);
+    hist("echo", d.echo);
+    std::fprintf(f, "}\n");
+    std::fclose(f);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        std::fprintf(stderr, "usage: sim_treadmill [--seconds S] [--accel MPH_S] [--decel MPH_S] [--lift PCT_S]\n"
+                             "                     [--reply-us US] [--drive N] [--json results.jsonl]\n");
+        return 2;
+    }
+    opt.sim.record_writes = false;
+    std::signal(SIGINT, sig_handler);
+    std::signal(SIGTERM, sig_handler);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    SimMotorPort port(opt.sim);
+    port.initialise();
+    std::array<GpioConfig, 1> buses{};
+    buses.at(0).console_read = 27;
+    buses.at(0).motor_write = opt.sim.motor_write;
+    buses.at(0).motor_read = opt.sim.motor_read;
+    BusHost<SimMotorPort> host(port, buses);
+    if (!host.start()) return 1;
+    std::printf("sim: accel %.2f mph/s, decel %.2f mph/s, lift %.2f %%/s, reply %d us, on %s\n",
+                opt.sim.accel_mph_s, opt.sim.decel_mph_s, opt.sim.lift_pct_s, opt.sim.reply_us, SOCK_PATH);
+
+    Drive d;
+    uint64_t start_us = mono_us();
+    uint64_t end_us = opt.seconds > 0 ? start_us + static_cast<uint64_t>(opt.seconds * 1e6) : 0;
+    if (opt.drive > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));  // IPC thread up
+        drive(opt, d);
+    }
+    while (g_running && host.is_running() && opt.drive == 0 && (end_us == 0 || mono_us() < end_us)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    host.stop();
+
+    uint64_t frames = port.frames_received();
+    uint64_t replies = port.frames_answered();
+    std::printf("sim: %.1f s, %llu motor frames, %llu answered\n", static_cast<double>(mono_us() - start_us) / 1e6,
+                static_cast<unsigned long long>(frames), static_cast<unsigned long long>(replies));
+    if (d.steps > 0) {
+        std::printf("drive: %d steps, %d timed out\n", d.steps, d.timeouts);
+        print_latency("command -> applied", d.applied.summary());
+        print_latency("command -> motor ack", d.converge.summary());
+        print_latency("daemon echo_us", d.echo.summary());
+    }
+    if (opt.json) print_json(opt, d, frames, replies);
+    return d.timeouts > 0 ? 1 : 0;
+}
@@ -0,0 +1,490 @@
+/*
+ * soak_bus.cpp — Synthetic bus load and IPC client soak
+ *
+ * Finds where the data plane stops keeping up. Two generator threads
+ * inject console and motor frames into a MockGpioPort at a set rate,
+ * with scheduling jitter and noise; two SerialReaders parse them and
+ * push kv records into an EventRing, as the controller does; an
+ * IpcServer serves the ring to N socket clients, each reading at its
+ * own speed.
+ *
+ * Every frame's value is its sequence number, so latency is measured
+ * from injection to the reader's kv callback and to each client's
+ * receipt. A port holds at most --line-buf unread bytes per pin (the
+ * receive buffer a real port has); a burst past that is lost as a line
+ * overrun. A line of stats is printed every --report seconds, and a
+ * summary at the end.
+ *
+ * Noise (--noise P, per frame): a non-printable value byte, a lost ']',
+ * or a stray byte between frames, in turn.
+ *
+ * Usage: soak_bus [--seconds S] [--console-fps F] [--motor-fps F]
+ *                 [--jitter-us J] [--noise P] [--line-buf B]
+ *                 [--clients N] [--client-bps B[,B...]] [--report S]
+ *                 [--json results.jsonl]
+ *
+ * --client-bps is cycled over the clients; 0 reads as fast as possible.
+ * Uses SOCK_PATH, so the daemon must not be running (make soak stops it).
+ */
+
+#include "kv_protocol.h"
+#include "ipc_protocol.h"
+#include "ipc_server.h"
+#include "byte_ring.h"
+#include "gpio_mock.h"
+#include "serial_io.h"
+#include "metrics.h"
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int PIN_CONSOLE = 27;
+constexpr int PIN_MOTOR = 22;
+constexpr size_t INJECT_SLOTS = 1u << 20;  // inject times by seq, must outlive any latency
+constexpr int SEQ_DIGITS = 8;
+
+struct Options {
+    double seconds = 10;
+    double console_fps = 200;
+    double motor_fps = 200;
+    int jitter_us = 0;
+    double noise = 0;
+    uint64_t line_buf = 8192;
+    int clients = 4;
+    std::vector<uint64_t> client_bps{0};
+    double report_sec = 5;
+    const char* json = nullptr;
+};
+
+// One direction: generator -> port pin -> SerialReader -> ring
+struct Line {
+    const char* name = "";
+    int pin = -1;
+    double fps = 0;
+    std::unique_ptr<SerialReader<MockGpioPort>> reader;
+    std::atomic<uint64_t> offered{0};       // frames generated
+    std::atomic<uint64_t> corrupted{0};     // of those, damaged by noise
+    std::atomic<uint64_t> overrun{0};       // frames lost to a full line buffer
+    std::atomic<uint64_t> injected_bytes{0};
+    std::atomic<uint64_t> parsed{0};
+    LatencyHistogram latency;               // inject -> kv callback
+};
+
+struct Client {
+    uint64_t bps = 0;
+    bool connected = false;
+    std::atomic<bool> closed{false};        // by the server, before the end
+    std::atomic<uint64_t> events{0};
+    std::atomic<uint64_t> gaps{0};
+    std::atomic<uint64_t> dropped{0};       // as the gap events report
+    std::atomic<uint64_t> bytes{0};
+    LatencyHistogram latency;               // inject -> line received
+};
+
+struct Soak {
+    Options opt;
+    MockGpioPort port;
+    EventRing ring;
+    std::unique_ptr<std::atomic<uint64_t>[]> inject_us{new std::atomic<uint64_t>[INJECT_SLOTS]()};
+    std::atomic<uint64_t> next_seq{0};
+    std::atomic<bool> stop{false};
+    std::atomic<bool> ipc_stop{false};  // set first: the server view is taken with every client still connected
+    uint64_t start_us = mono_us();
+    std::array<Line, 2> lines;
+    std::vector<std::unique_ptr<Client>> clients;
+
+    std::mutex metrics_mu;
+    std::vector<IpcServer::ClientMetrics> server_view;
+
+    void stamp(uint64_t seq, uint64_t t) { inject_us[seq % INJECT_SLOTS].store(t, std::memory_order_relaxed); }
+    uint64_t stamped(uint64_t seq) const { return inject_us[seq % INJECT_SLOTS].load(std::memory_order_relaxed); }
+};
+
+std::optional<uint64_t> parse_seq(std::string_view v) {
+    uint64_t seq = 0;
+    if (v.size() != SEQ_DIGITS) return std::nullopt;
+    auto r = std::from_chars(v.data(), v.data() + v.size(), seq, 16);
+    if (r.ec != std::errc() || r.ptr != v.data() + v.size()) return std::nullopt;
+    return seq;
+}
+
+// Frames due since the start, built into one chunk per wakeup, so the
+// jitter turns into bursts
+void generate(Soak& s, Line& line, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::uniform_int_distribution<int> jitter(0, s.opt.jitter_us);
+    std::vector<uint8_t> chunk;
+    std::vector<uint64_t> seqs;
+    uint64_t sent = 0;
+    size_t key = 1;
+    int noise_kind = 0;
+    while (!s.stop.load(std::memory_order_relaxed)) {
+        uint64_t now = mono_us();
+        auto due = static_cast<uint64_t>(static_cast<double>(now - s.start_us) * line.fps / 1e6);
+        chunk.clear();
+        seqs.clear();
+        uint64_t damaged = 0;
+        for (; sent < due; sent++) {
+            uint64_t seq = s.next_seq.fetch_add(1, std::memory_order_relaxed);
+            std::array<char, SEQ_DIGITS + 1> value;
+            std::snprintf(value.data(), value.size(), "%08llX",
+                          static_cast<unsigned long long>(seq & 0xFFFFFFFFu));
+            std::array<char, 32> frame;
+            size_t n = kv_build(frame, KV_KEY_NAMES.at(key), {value.data(), SEQ_DIGITS});
+            key = key + 1 == KV_KEY_NAMES.size() ? 1 : key + 1;
+            if (s.opt.noise > 0 && unit(rng) < s.opt.noise) {
+                switch (noise_kind++ % 3) {
+                case 0: frame.at(n - 3) = '\x01'; damaged++; break;                 // a value byte
+                case 1: frame.at(n - 2) = frame.at(n - 1); n--; damaged++; break;  // ']' lost
+                default: chunk.push_back('U'); break;                             // stray byte
+                }
+            }
+            chunk.insert(chunk.end(), frame.begin(), frame.begin() + static_cast<ptrdiff_t>(n));
+            seqs.push_back(seq);
+        }
+        if (!chunk.empty()) {
+            line.offered.fetch_add(seqs.size(), std::memory_order_relaxed);
+            line.corrupted.fetch_add(damaged, std::memory_order_relaxed);
+            uint64_t injected = line.injected_bytes.load(std::memory_order_relaxed);
+            uint64_t unread = injected - std::min(injected, line.reader->line_stats().bytes);
+            if (unread + chunk.size() > s.opt.line_buf) {
+                line.overrun.fetch_add(seqs.size(), std::memory_order_relaxed);
+            } else {
+                for (uint64_t seq : seqs) s.stamp(seq, now);
+                line.injected_bytes.fetch_add(chunk.size(), std::memory_order_relaxed);
+                s.port.inject_serial_data_pin(line.pin, chunk);
+            }
+        }
+        sleep_us(1000 + (s.opt.jitter_us > 0 ? jitter(rng) : 0));
+    }
+}
+
+void read_line(Soak& s, Line& line) {
+    line.reader->on_kv([&](const KvPair& kv) {
+        line.parsed.fetch_add(1, std::memory_order_relaxed);
+        if (auto seq = parse_seq(kv.value_view())) line.latency.record_since(s.stamped(*seq));
+        double ts = static_cast<double>(mono_us() - s.start_us) / 1e6;
+        KvEvent ev{line.name, kv.key_view(), kv.value_view(), ts};
+        auto slot = s.ring.reserve();
+        s.ring.commit(slot, format_kv_record(slot.buf, ev));
+    });
+    while (!s.stop.load(std::memory_order_relaxed)) {
+        if (line.reader->poll() == 0) line.reader->wait_for_data();
+    }
+}
+
+int connect_client() {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, SOCK_PATH, sizeof(addr.sun_path) - 1);
+    // reinterpret_cast: sockaddr_un -> sockaddr (POSIX socket API)
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void client_line(Soak& s, Client& c, std::string_view line) {
+    constexpr std::string_view VALUE = "\"value\":\"";
+    constexpr std::string_view DROPPED = "\"dropped\":";
+    if (line.find("\"type\":\"gap\"") != std::string_view::npos) {
+        c.gaps.fetch_add(1, std::memory_order_relaxed);
+        auto at = line.find(DROPPED);
+        uint64_t n = 0;
+        if (at != std::string_view::npos) {
+            auto num = line.substr(at + DROPPED.size());
+            std::from_chars(num.data(), num.data() + num.size(), n);
+        }
+        c.dropped.fetch_add(n, std::memory_order_relaxed);
+        return;
+    }
+    if (line.find("\"type\":\"kv\"") == std::string_view::npos) return;
+    c.events.fetch_add(1, std::memory_order_relaxed);
+    auto at = line.find(VALUE);
+    if (at == std::string_view::npos) return;
+    if (auto seq = parse_seq(line.substr(at + VALUE.size(), SEQ_DIGITS))) c.latency.record_since(s.stamped(*seq));
+}
+
+// Read at c.bps (token bucket refilled every millisecond), or flat out
+void run_client(Soak& s, Client& c, int fd) {
+    std::vector<char> buf(65536);
+    std::string pending;
+    double budget = 0;
+    uint64_t last_us = mono_us();
+    while (!s.stop.load(std::memory_order_relaxed)) {
+        size_t want = buf.size();
+        if (c.bps > 0) {
+            uint64_t now = mono_us();
+            budget = std::min(budget + static_cast<double>(c.bps) * static_cast<double>(now - last_us) / 1e6,
+                              static_cast<double>(buf.size()));
+            last_us = now;
+            want = static_cast<size_t>(budget);
+            if (want == 0) {
+                sleep_us(1000);
+                continue;
+            }
+        }
+        struct pollfd pfd{fd, POLLIN, 0};
+        if (::poll(&pfd, 1, 20) <= 0) continue;
+        ssize_t n = read(fd, buf.data(), want);
+        if (n <= 0) {
+            c.closed.store(!s.stop.load());
+            break;
+        }
+        budget -= static_cast<double>(n);
+        c.bytes.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+        pending.append(buf.data(), static_cast<size_t>(n));
+        size_t from = 0;
+        for (size_t nl; (nl = pending.find('\n', from)) != std::string::npos; from = nl + 1) {
+            client_line(s, c, std::string_view(pending).substr(from, nl - from));
+        }
+        pending.erase(0, from);
+    }
+    close(fd);
+}
+
+void collect_server_view(Soak& s, const IpcServer& ipc) {
+    std::array<IpcServer::ClientMetrics, MAX_CLIENTS> out;
+    int n = ipc.client_metrics(out);
+    std::lock_guard<std::mutex> lk(s.metrics_mu);
+    s.server_view.assign(out.begin(), out.begin() + n);
+}
+
+std::vector<uint64_t> parse_bps_list(const char* arg) {
+    std::vector<uint64_t> out;
+    std::string_view rest = arg;
+    while (!rest.empty()) {
+        auto comma = rest.find(',');
+        auto item = rest.substr(0, comma);
+        uint64_t v = 0;
+        std::from_chars(item.data(), item.data() + item.size(), v);
+        out.push_back(v);
+        if (comma == std::string_view::npos) break;
+        rest.remove_prefix(comma + 1);
+    }
+    if (out.empty()) out.push_back(0);
+    return out;
+}
+
+bool parse_options(int argc, char** argv, Options& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string_view a = argv[i];
+        if (i + 1 >= argc) return false;
+        const char* v = argv[++i];
+        if (a == "--seconds") opt.seconds = std::atof(v);
+        else if (a == "--console-fps") opt.console_fps = std::atof(v);
+        else if (a == "--motor-fps") opt.motor_fps = std::atof(v);
+        else if (a == "--jitter-us") opt.jitter_us = std::max(0, std::atoi(v));
+        else if (a == "--noise") opt.noise = std::atof(v);
+        else if (a == "--line-buf") opt.line_buf = std::strtoull(v, nullptr, 10);
+        else if (a == "--clients") opt.clients = std::atoi(v);
+        else if (a == "--client-bps") opt.client_bps = parse_bps_list(v);
+        else if (a == "--report") opt.report_sec = std::atof(v);
+        else if (a == "--json") opt.json = v;
+        else return false;
+    }
+    return opt.seconds > 0 && opt.report_sec > 0 && opt.clients >= 0;
+}
+
+void print_latency(const LatencyHistogram::Summary& h) {
+    std::printf("p50 %llu us, p99 %llu us, max %llu us",
+                static_cast<unsigned long long>(h.p50_us), static_cast<unsigned long long>(h.p99_us),
+                static_cast<unsigned long long>(h.max_us));
+}
+
+void print_json_summary(const Soak& s, double secs) {
+    FILE* f = std::fopen(s.opt.json, "w");
+    if (!f) return;
+    std::fprintf(f, "{\"name\":\"soak_bus\",\"seconds\":%.1f", secs);
+    for (const auto& l : s.lines) {
+        auto h = l.latency.summary();
+        auto st = l.reader->line_stats();
+        std::fprintf(f, ",\"%s\":{\"fps\":%.1f,\"offered\":%llu,\"parsed\":%llu,\"corrupted\":%llu,"
+                        "\"overrun\":%llu,\"rejected\":%llu,\"overflow_bytes\":%llu,"
+                        "\"p50_us\":%llu,\"p99_us\":%llu,\"max_us\":%llu}",
+                     l.name, l.fps, static_cast<unsigned long long>(l.offered.load()),
+                     static_cast<unsigned long long>(l.parsed.load()),
+                     static_cast<unsigned long long>(l.corrupted.load()),
+                     static_cast<unsigned long long>(l.overrun.load()),
+                     static_cast<unsigned long long>(st.nonprintable + st.bad_length),
+                     static_cast<unsigned long long>(st.overflow_bytes),
+                     static_cast<unsigned long long>(h.p50_us), static_cast<unsigned long long>(h.p99_us),
+                     static_cast<unsigned long long>(h.max_us));
+    }
+    std::fprintf(f, ",\"clients\":[");
+    for (size_t i = 0; i < s.clients.size(); i++) {
+        const auto& c = *s.clients.at(i);
+        auto h = c.latency.summary();
+        std::fprintf(f, "%s{\"bps\":%llu,\"connected\":%s,\"closed\":%s,\"events\":%llu,\"gaps\":%llu,\"dropped\":%llu,"
+                        "\"p50_us\":%llu,\"p99_us\":%llu,\"max_us\":%llu}",
+                     i ? "," : "", static_cast<unsigned long long>(c.bps), c.connected ? "true" : "false",
+                     c.closed.load() ? "true" : "false",
+                     static_cast<unsigned long long>(c.events.load()),
+                     static_cast<unsigned long long>(c.gaps.load()),
+                     static_cast<unsigned long long>(c.dropped.load()),
+                     static_cast<unsigned long long>(h.p50_us), static_cast<unsigned long long>(h.p99_us),
+                     static_cast<unsigned long long>(h.max_us));
+    }
+    std::fprintf(f, "]}\n");
+    std::fclose(f);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    auto soak = std::make_unique<Soak>();  // the ring is large; keep it off the stack
+    Soak& s = *soak;
+    if (!parse_options(argc, argv, s.opt)) {
+        std::fprintf(stderr, "usage: soak_bus [--seconds S] [--console-fps F] [--motor-fps F] [--jitter-us J]\n"
+                             "                [--noise P] [--line-buf B] [--clients N] [--client-bps B[,B...]]\n"
+                             "                [--report S] [--json results.jsonl]\n");
+        return 2;
+    }
+    s.lines.at(0).name = "console";
+    s.lines.at(0).pin = PIN_CONSOLE;
+    s.lines.at(0).fps = s.opt.console_fps;
+    s.lines.at(1).name = "motor";
+    s.lines.at(1).pin = PIN_MOTOR;
+    s.lines.at(1).fps = s.opt.motor_fps;
+    for (auto& l : s.lines) {
+        l.reader = std::make_unique<SerialReader<MockGpioPort>>(s.port, l.pin);
+        l.reader->open();
+    }
+
+    IpcServer ipc(s.ring);
+    if (!ipc.create()) {
+        std::fprintf(stderr, "Error: can't listen on %s (is treadmill_io running?)\n", SOCK_PATH);
+        return 1;
+    }
+    std::thread ipc_thread([&] {
+        uint64_t next = 0;
+        while (!s.ipc_stop.load(std::memory_order_relaxed)) {
+            ipc.poll(20);
+            if (mono_us() >= next) {
+                collect_server_view(s, ipc);
+                next = mono_us() + 200000;
+            }
+        }
+        collect_server_view(s, ipc);
+    });
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < s.opt.clients; i++) {
+        auto c = std::make_unique<Client>();
+        c->bps = s.opt.client_bps.at(static_cast<size_t>(i) % s.opt.client_bps.size());
+        int fd = connect_client();
+        c->connected = fd >= 0;
+        if (fd >= 0) threads.emplace_back(run_client, std::ref(s), std::ref(*c), fd);
+        s.clients.push_back(std::move(c));
+    }
+    std::printf("soak: %.0f s, console %.0f f/s, motor %.0f f/s, jitter %d us, noise %.3f, line buffer %llu B, "
+                "%d clients\n", s.opt.seconds, s.opt.console_fps, s.opt.motor_fps, s.opt.jitter_us, s.opt.noise,
+                static_cast<unsigned long long>(s.opt.line_buf), s.opt.clients);
+
+    s.start_us = mono_us();
+    for (size_t i = 0; i < s.lines.size(); i++) {
+        threads.emplace_back(read_line, std::ref(s), std::ref(s.lines.at(i)));
+        threads.emplace_back(generate, std::ref(s), std::ref(s.lines.at(i)), static_cast<uint32_t>(i + 1));
+    }
+
+    // Periodic report: rates over the last interval
+    std::array<uint64_t, 2> last_parsed{};
+    uint64_t last_events = 0;
+    uint64_t end_us = s.start_us + static_cast<uint64_t>(s.opt.seconds * 1e6);
+    uint64_t report_us = static_cast<uint64_t>(s.opt.report_sec * 1e6);
+    for (uint64_t t = s.start_us + report_us;; t += report_us) {
+        uint64_t wake = std::min(t, end_us);
+        uint64_t now = mono_us();
+        if (wake > now) std::this_thread::sleep_for(std::chrono::microseconds(wake - now));
+        double dt = static_cast<double>(std::min(report_us, wake - (t - report_us))) / 1e6;
+        std::printf("[%6.1f s]", static_cast<double>(wake - s.start_us) / 1e6);
+        for (size_t i = 0; i < s.lines.size(); i++) {
+            auto& l = s.lines.at(i);
+            uint64_t parsed = l.parsed.load();
+            std::printf(" %s %.0f f/s (overrun %llu)", l.name, static_cast<double>(parsed - last_parsed.at(i)) / dt,
+                        static_cast<unsigned long long>(l.overrun.load()));
+            last_parsed.at(i) = parsed;
+        }
+        uint64_t events = 0;
+        uint64_t dropped = 0;
+        for (const auto& c : s.clients) {
+            events += c->events.load();
+            dropped += c->dropped.load();
+        }
+        std::printf(" | clients %.0f ev/s, dropped %llu\n", static_cast<double>(events - last_events) / dt,
+                    static_cast<unsigned long long>(dropped));
+        last_events = events;
+        std::fflush(stdout);
+        if (wake >= end_us) break;
+    }
+
+    // The IPC thread's last server view first, while no client has hung up
+    s.ipc_stop.store(true);
+    ipc.wake();
+    ipc_thread.join();
+    s.stop.store(true);
+    for (auto& l : s.lines) l.reader->interrupt();
+    for (auto& t : threads) t.join();
+    double secs = static_cast<double>(mono_us() - s.start_us) / 1e6;
+
+    std::printf("\n%-8s %10s %10s %10s %10s %10s %10s %12s\n", "line", "offered", "parsed", "noise",
+                "overrun", "rejected", "overflowB", "latency");
+    for (const auto& l : s.lines) {
+        auto st = l.reader->line_stats();
+        std::printf("%-8s %10llu %10llu %10llu %10llu %10llu %10llu  ", l.name,
+                    static_cast<unsigned long long>(l.offered.load()), static_cast<unsigned long long>(l.parsed.load()),
+                    static_cast<unsigned long long>(l.corrupted.load()),
+                    static_cast<unsigned long long>(l.overrun.load()),
+                    static_cast<unsigned long long>(st.nonprintable + st.bad_length),
+                    static_cast<unsigned long long>(st.overflow_bytes));
+        print_latency(l.latency.summary());
+        std::printf("\n");
+    }
+    std::printf("\n%-8s %10s %10s %10s %10s %10s  %s\n", "client", "bps", "events", "MB", "gaps", "dropped",
+                "latency");
+    for (size_t i = 0; i < s.clients.size(); i++) {
+        const auto& c = *s.clients.at(i);
+        if (!c.connected) {
+            std::printf("%-8zu not connected (MAX_CLIENTS %d)\n", i, MAX_CLIENTS);
+            continue;
+        }
+        std::printf("%-8zu %10llu %10llu %10.1f %10llu %10llu  ", i, static_cast<unsigned long long>(c.bps),
+                    static_cast<unsigned long long>(c.events.load()), static_cast<double>(c.bytes.load()) / 1e6,
+                    static_cast<unsigned long long>(c.gaps.load()), static_cast<unsigned long long>(c.dropped.load()));
+        print_latency(c.latency.summary());
+        std::printf("%s\n", c.closed.load() ? " (closed by server)" : "");
+    }
+    {
+        std::lock_guard<std::mutex> lk(s.metrics_mu);
+        std::printf("\nserver view:");
+        for (const auto& m : s.server_view) {
+            std::printf(" [fd %d lost %llu max_lag %llu]", m.fd, static_cast<unsigned long long>(m.lost_msgs),
+                        static_cast<unsigned long long>(m.max_lag_msgs));
+        }
+        std::printf("\n");
+    }
+    if (s.opt.json) print_json_summary(s, secs);
+    ipc.shutdown();
+    return 0;
+}
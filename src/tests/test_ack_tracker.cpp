@@ -0,0 +1,117 @@
+/*
+ * test_ack_tracker.cpp — Tests for command acks out to the motor
+ *
+ * Drives AckTracker with synthetic mono_us times.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "ack_tracker.h"
+
+constexpr uint64_t MS = 1000;  // us per ms
+
+TEST_CASE("an ack completes when the target is sent and then echoed") {
+    AckTracker acks;
+    AckReport r{};
+    CHECK_FALSE(acks.expect(KvKey::Hmph, 7, 30, 1000 * MS, &r));
+    CHECK(acks.outstanding(KvKey::Hmph));
+    CHECK_FALSE(acks.outstanding(KvKey::Inc));
+
+    // The motor still reporting the target from before doesn't count
+    CHECK_FALSE(acks.echoed(KvKey::Hmph, 30, 1001 * MS, &r));
+    // Nor does a frame on the way there (ramping) or the wrong key
+    acks.sent(KvKey::Hmph, "C8", 1010 * MS);  // 2.0 mph
+    acks.sent(KvKey::Inc, "1E", 1010 * MS);
+    CHECK_FALSE(acks.echoed(KvKey::Hmph, 30, 1011 * MS, &r));
+
+    acks.sent(KvKey::Hmph, "12C", 1040 * MS);  // 3.0 mph
+    acks.sent(KvKey::Hmph, "12C", 1043 * MS);  // a repeat keeps the first time
+    CHECK_FALSE(acks.echoed(KvKey::Hmph, 20, 1044 * MS, &r));
+    CHECK(acks.echoed(KvKey::Hmph, 30, 1046 * MS, &r));
+    CHECK(r.seq == 7);
+    CHECK(r.key == KvKey::Hmph);
+    CHECK(r.stage == AckStage::Motor);
+    CHECK(r.value == 30);
+    CHECK(r.sent_us == 40 * MS);
+    CHECK(r.echo_us == 46 * MS);
+
+    // Once only
+    CHECK_FALSE(acks.outstanding(KvKey::Hmph));
+    CHECK_FALSE(acks.echoed(KvKey::Hmph, 30, 1100 * MS, &r));
+}
+
+TEST_CASE("a newer command supersedes the outstanding ack for its key") {
+    AckTracker acks;
+    AckReport r{};
+    acks.expect(KvKey::Inc, 1, 2, 0, &r);
+    acks.sent(KvKey::Inc, "2", 10 * MS);
+    CHECK(acks.expect(KvKey::Inc, 2, 4, 20 * MS, &r));
+    CHECK(r.seq == 1);
+    CHECK(r.stage == AckStage::Superseded);
+    CHECK(r.value == 2);
+
+    // The superseded value's echo completes nothing; the new one's does
+    CHECK_FALSE(acks.echoed(KvKey::Inc, 2, 25 * MS, &r));
+    acks.sent(KvKey::Inc, "4", 30 * MS);
+    CHECK(acks.echoed(KvKey::Inc, 4, 35 * MS, &r));
+    CHECK(r.seq == 2);
+    CHECK(r.sent_us == 10 * MS);
+    CHECK(r.echo_us == 15 * MS);
+
+    // Speed and incline are tracked apart
+    CHECK_FALSE(acks.expect(KvKey::Hmph, 3, 10, 40 * MS, &r));
+    CHECK_FALSE(acks.expect(KvKey::Inc, 3, 0, 40 * MS, &r));
+}
+
+TEST_CASE("acks the motor never gives time out once") {
+    AckTracker acks;
+    AckReport r{};
+    acks.expect(KvKey::Hmph, 5, 12, 100 * MS, &r);
+    acks.expect(KvKey::Inc, 6, 1, 200 * MS, &r);
+    acks.sent(KvKey::Inc, "1", 210 * MS);
+
+    std::array<AckReport, 2> out{};
+    CHECK(acks.check(100 * MS + ACK_TIMEOUT_MS * MS - 1, out) == 0);
+    CHECK(acks.check(100 * MS + ACK_TIMEOUT_MS * MS, out) == 1);
+    CHECK(out.at(0).seq == 5);
+    CHECK(out.at(0).stage == AckStage::Timeout);
+    CHECK(out.at(0).key == KvKey::Hmph);
+
+    CHECK(acks.check(300 * MS + ACK_TIMEOUT_MS * MS, out) == 1);
+    CHECK(out.at(0).seq == 6);  // sent, never echoed
+    CHECK(acks.check(900 * MS + ACK_TIMEOUT_MS * MS, out) == 0);
+    CHECK_FALSE(acks.echoed(KvKey::Inc, 1, 900 * MS + ACK_TIMEOUT_MS * MS, &r));
+}
+
+TEST_CASE("keys other than hmph and inc are ignored") {
+    AckTracker acks;
+    AckReport r{};
+    CHECK_FALSE(acks.expect(KvKey::Belt, 1, 1, 0, &r));
+    CHECK_FALSE(acks.outstanding(KvKey::Belt));
+    acks.sent(KvKey::Belt, "1", 1);
+    CHECK_FALSE(acks.echoed(KvKey::Belt, 1, 2, &r));
+}
+
+TEST_CASE("a target sent before its ack is expected still counts, once it's after the command") {
+    AckTracker acks;
+    AckReport r{};
+    CHECK(AckTracker::tracks(KvKey::Hmph));
+    CHECK_FALSE(AckTracker::tracks(KvKey::Belt));
+
+    // Already at 3.0 mph before the command: the old frame doesn't count
+    acks.sent(KvKey::Hmph, "12C", 900 * MS);
+    acks.expect(KvKey::Hmph, 4, 30, 1000 * MS, &r);
+    CHECK_FALSE(acks.echoed(KvKey::Hmph, 30, 1001 * MS, &r));
+    acks.sent(KvKey::Hmph, "12C", 1050 * MS);
+    CHECK(acks.echoed(KvKey::Hmph, 30, 1060 * MS, &r));
+    CHECK(r.sent_us == 50 * MS);
+
+    // The emulate thread got the new target out between apply and expect()
+    acks.sent(KvKey::Hmph, "C8", 2003 * MS);  // 2.0 mph
+    acks.expect(KvKey::Hmph, 5, 20, 2000 * MS, &r);
+    CHECK(acks.echoed(KvKey::Hmph, 20, 2020 * MS, &r));
+    CHECK(r.seq == 5);
+    CHECK(r.sent_us == 3 * MS);
+    CHECK(r.echo_us == 20 * MS);
+}
@@ -0,0 +1,102 @@
+/*
+ * test_bus_analyzer.cpp — Tests for line use and console cycle timing
+ *
+ * Drives BusAnalyzer with synthetic mono_us times and byte counts.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "bus_analyzer.h"
+
+constexpr uint64_t MS = 1000;  // us per ms
+
+namespace {
+
+// One console cycle from `t`: every key of each burst, bursts `gap` apart
+uint64_t feed_cycle(BusAnalyzer& a, uint64_t t, const std::array<uint64_t, EMU_BURSTS>& gap) {
+    for (int b = 0; b < EMU_BURSTS; b++) {
+        for (int j = 0; j < 4 && BURSTS[b][j] >= 0; j++) {
+            a.console_frame(kv_key_lookup(KV_CYCLE[BURSTS[b][j]].key), t + static_cast<uint64_t>(j) * 1100);
+        }
+        t += gap.at(static_cast<size_t>((b + 1) % EMU_BURSTS));
+    }
+    return t;
+}
+
+}  // namespace
+
+TEST_CASE("idle percent and bytes per second per direction") {
+    BusAnalyzer a(9600);
+    a.begin(1000 * MS, 100, 4000);
+    // 480 bytes in one second is 4800 bits of 9600: half the line idle
+    auto u = a.take(2000 * MS, 580, 4000);
+    CHECK(u.window_ms == 1000);
+    CHECK(u.console.bytes_per_sec == doctest::Approx(480.0));
+    CHECK(u.console.idle_pct == doctest::Approx(50.0));
+    CHECK(u.motor.bytes_per_sec == doctest::Approx(0.0));
+    CHECK(u.motor.idle_pct == doctest::Approx(100.0));
+
+    // Counts more than the line can carry clamp to 0 idle; counters wrap
+    u = a.take(2500 * MS, 580 + 1000, 4000);
+    CHECK(u.console.idle_pct == doctest::Approx(0.0));
+    a.begin(3000 * MS, 0xFFFFFF00u, 0);
+    u = a.take(4000 * MS, 0x40u, 0);
+    CHECK(u.console.bytes_per_sec == doctest::Approx(320.0));
+}
+
+TEST_CASE("the console's cycle period and the gap before each burst") {
+    BusAnalyzer a(9600);
+    a.begin(0, 0, 0);
+    // A console that leaves 120 ms before burst 0 and 95 ms between the rest
+    std::array<uint64_t, EMU_BURSTS> gap = {120 * MS, 95 * MS, 95 * MS, 95 * MS, 95 * MS};
+    uint64_t t = 10 * MS;
+    for (int c = 0; c < 4; c++) t = feed_cycle(a, t, gap);
+    a.console_frame(KvKey::Inc, t);  // closes the fourth cycle
+
+    auto u = a.take(t, 0, 0);
+    CHECK(u.cycle.count == 4);
+    CHECK(u.cycle.mean_us == 500 * MS);
+    CHECK(u.cycle.min_us == 500 * MS);
+    CHECK(u.cycle.max_us == 500 * MS);
+    CHECK(u.gaps.at(0).count == 4);
+    CHECK(u.gaps.at(0).mean_us == 120 * MS);
+    CHECK(u.gaps.at(1).count == 4);
+    CHECK(u.gaps.at(3).mean_us == 95 * MS);
+
+    // The next window starts empty
+    u = a.take(t + 1000 * MS, 0, 0);
+    CHECK(u.cycle.count == 0);
+    CHECK(u.gaps.at(0).count == 0);
+}
+
+TEST_CASE("a lost burst start or a long pause restarts the sequence") {
+    BusAnalyzer a(9600);
+    a.begin(0, 0, 0);
+    std::array<uint64_t, EMU_BURSTS> gap = {100 * MS, 100 * MS, 100 * MS, 100 * MS, 100 * MS};
+    uint64_t t = feed_cycle(a, 0, gap);
+
+    // Burst 2 lost: no gap into burst 3, and no cycle at the next burst 0
+    a.console_frame(KvKey::Inc, t);
+    a.console_frame(KvKey::Amps, t + 100 * MS);
+    a.console_frame(KvKey::Part, t + 300 * MS);
+    a.console_frame(KvKey::Diag, t + 400 * MS);
+    a.console_frame(KvKey::Inc, t + 500 * MS);
+    auto u = a.take(t + 500 * MS, 0, 0);
+    CHECK(u.cycle.count == 1);  // the first, complete cycle
+    CHECK(u.gaps.at(3).count == 1);
+    CHECK(u.gaps.at(4).count == 2);
+
+    // Emulate stopped the traffic for a while: the gap isn't counted
+    a.console_frame(KvKey::Amps, t + 5000 * MS);
+    u = a.take(t + 5000 * MS, 0, 0);
+    CHECK(u.gaps.at(1).count == 0);
+
+    // Keys that start no burst are ignored
+    a.console_frame(KvKey::Hmph, t + 5010 * MS);
+    a.console_frame(KvKey::Unknown, t + 5020 * MS);
+    a.console_frame(KvKey::Vbus, t + 5100 * MS);
+    u = a.take(t + 5100 * MS, 0, 0);
+    CHECK(u.gaps.at(2).count == 1);
+    CHECK(u.gaps.at(2).mean_us == 100 * MS);
+}
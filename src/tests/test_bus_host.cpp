@@ -0,0 +1,214 @@
+/*
+ * test_bus_host.cpp — Tests for BusHost (several buses, one IPC server)
+ *
+ * Two TreadmillControllers on one MockGpioPort: command routing by the
+ * "bus" field, bus tags on events and the buses subscribe filter, both
+ * motor writers sharing the wave engine, quit, a restart handoff
+ * from one host to the next, and both buses on the IPC thread (reactor).
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "gpio_mock.h"
+#include "bus_host.h"
+#include "ipc_test_util.h"
+
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <array>
+#include <vector>
+
+// Bus 0 on the usual pins, bus 1 on a second set
+static std::array<GpioConfig, 2> two_buses() {
+    std::array<GpioConfig, 2> buses{};
+    buses.at(0).console_read = 27;
+    buses.at(0).motor_write = 22;
+    buses.at(0).motor_read = 17;
+    buses.at(1).console_read = 5;
+    buses.at(1).motor_write = 6;
+    buses.at(1).motor_read = 13;
+    return buses;
+}
+
+TEST_CASE("commands route by bus and events name the bus") {
+    MockGpioPort port;
+    port.initialise();
+    auto cfg = two_buses();
+    BusHost<MockGpioPort> host(port, cfg);
+    CHECK(host.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    read_available(fd, 80);
+
+    send_json(fd, "{\"cmd\":\"speed\",\"value\":3.0,\"bus\":1}");
+    std::string data = read_available(fd, 150);
+    CHECK(host.bus(1).mode().snapshot().emulate_enabled);
+    CHECK(host.bus(1).mode().snapshot().speed_tenths == 30);
+    CHECK_FALSE(host.bus(0).mode().snapshot().emulate_enabled);
+    CHECK(data.find("{\"type\":\"status\",\"bus\":1,\"proxy\":") != std::string::npos);
+
+    // Bus 0 is the default and its events are untagged
+    send_json(fd, "{\"cmd\":\"status\"}");
+    data = read_available(fd, 150);
+    CHECK(data.find("{\"type\":\"status\",\"proxy\":") != std::string::npos);
+
+    send_json(fd, "{\"cmd\":\"status\",\"bus\":2}");
+    data = read_available(fd, 150);
+    CHECK(data.find("unknown bus 2") != std::string::npos);
+
+    close(fd);
+    host.stop();
+}
+
+TEST_CASE("motor frames carry their bus and subscribe filters by bus") {
+    MockGpioPort port;
+    port.initialise();
+    auto cfg = two_buses();
+    BusHost<MockGpioPort> host(port, cfg);
+    CHECK(host.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    read_available(fd, 80);
+
+    port.inject_serial_data_pin(17, "[belt:1]");
+    port.inject_serial_data_pin(13, "[belt:2]");
+    std::string data = read_available(fd, 150);
+    CHECK(data.find("{\"type\":\"kv\",\"ts\":") != std::string::npos);
+    CHECK(data.find("\"value\":\"1\"") != std::string::npos);
+    CHECK(data.find("{\"type\":\"kv\",\"bus\":1,\"ts\":") != std::string::npos);
+    CHECK(data.find("\"value\":\"2\"") != std::string::npos);
+
+    send_json(fd, "{\"cmd\":\"subscribe\",\"buses\":[1]}");
+    read_available(fd, 80);
+    port.inject_serial_data_pin(17, "[belt:3]");
+    port.inject_serial_data_pin(13, "[belt:4]");
+    data = read_available(fd, 150);
+    CHECK(data.find("\"value\":\"3\"") == std::string::npos);
+    CHECK(data.find("\"value\":\"4\"") != std::string::npos);
+
+    close(fd);
+    host.stop();
+}
+
+TEST_CASE("both buses emulate on their own pins through one wave engine") {
+    MockGpioPort port;
+    port.initialise();
+    auto cfg = two_buses();
+    BusHost<MockGpioPort> host(port, cfg);
+    CHECK(host.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    read_available(fd, 80);
+    send_json(fd, "{\"cmd\":\"speed\",\"value\":2.0,\"bus\":0}");
+    send_json(fd, "{\"cmd\":\"incline\",\"value\":3,\"bus\":1}");
+    read_available(fd, 700);  // at least one emulate cycle each
+
+    bool bus0 = false, bus1 = false;
+    {
+        std::lock_guard<std::mutex> lk(port.wave_mu);
+        for (const auto& w : port.wave_writes) {
+            bus0 = bus0 || w.gpio == 22;
+            bus1 = bus1 || w.gpio == 6;
+        }
+    }
+    CHECK(bus0);
+    CHECK(bus1);
+
+    close(fd);
+    host.stop();
+}
+
+TEST_CASE("in reactor mode the IPC thread drives every bus") {
+    MockGpioPort port;
+    port.initialise();
+    auto cfg = two_buses();
+    cfg.at(0).reactor = true;  // bus 0's says, for all of them
+    BusHost<MockGpioPort> host(port, cfg);
+    CHECK(host.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    read_available(fd, 80);
+    port.inject_serial_data_pin(5, "[belt:0]\xff");
+    send_json(fd, "{\"cmd\":\"speed\",\"value\":2.0,\"bus\":0}");
+    std::string data = read_available(fd, 700);
+    CHECK(data.find("{\"type\":\"kv\",\"bus\":1,\"ts\":") != std::string::npos);
+    CHECK(data.find("\"source\":\"console\",\"key\":\"belt\"") != std::string::npos);
+    CHECK(data.find("\"source\":\"emulate\",\"key\":\"hmph\",\"value\":\"C8\"") != std::string::npos);
+    CHECK(host.bus(0).mode().is_emulating());
+    CHECK(host.bus(1).mode().is_proxy());
+
+    close(fd);
+    host.stop();
+}
+
+TEST_CASE("quit on any bus stops the host") {
+    MockGpioPort port;
+    port.initialise();
+    auto cfg = two_buses();
+    BusHost<MockGpioPort> host(port, cfg);
+    CHECK(host.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    read_available(fd, 50);
+    send_json(fd, "{\"cmd\":\"quit\",\"bus\":1}");
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    CHECK_FALSE(host.is_running());
+
+    close(fd);
+    host.stop();
+}
+
+TEST_CASE("a detached host hands its clients and bus state to the next one") {
+    MockGpioPort port;
+    port.initialise();
+    auto cfg = two_buses();
+    std::vector<int> clients;
+    HandoffState st{};
+    int fd = -1;
+    {
+        BusHost<MockGpioPort> host(port, cfg);
+        CHECK(host.start());
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        fd = connect_ipc();
+        read_available(fd, 80);
+        send_json(fd, "{\"cmd\":\"speed\",\"value\":3.5,\"bus\":1}");
+        send_json(fd, "{\"cmd\":\"incline\",\"value\":4,\"bus\":1}");
+        read_available(fd, 150);
+        st = host.stop_detached(&clients);
+    }
+    CHECK(clients.size() == 1);
+    CHECK(st.buses == 2);
+    CHECK(st.bus.at(1).emulate);
+    CHECK(st.bus.at(1).speed_tenths == 35);
+    CHECK_FALSE(st.bus.at(0).emulate);
+
+    // The connection outlived the first host
+    st.bus.at(0).distance = 36000000000ull;  // 1 mile of odometry to carry over
+    Inherited in;
+    in.state = st;
+    in.clients = clients;
+    BusHost<MockGpioPort> next(port, cfg);
+    CHECK(next.start(in));
+    std::string data = read_available(fd, 150);
+    CHECK(next.bus(1).mode().snapshot().emulate_enabled);
+    CHECK(next.bus(1).mode().snapshot().speed_tenths == 35);
+    CHECK(next.bus(1).mode().snapshot().incline == 8);
+    CHECK(data.find("{\"type\":\"status\",\"bus\":1,\"proxy\":") != std::string::npos);
+    CHECK(data.find("\"distance_mi\":1.0") != std::string::npos);
+
+    send_json(fd, "{\"cmd\":\"speed\",\"value\":2.0,\"bus\":1}");
+    read_available(fd, 150);
+    CHECK(next.bus(1).mode().snapshot().speed_tenths == 20);
+
+    close(fd);
+    next.stop();
+}
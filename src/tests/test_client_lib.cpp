@@ -0,0 +1,219 @@
+/*
+ * test_client_lib.cpp — Tests for libtreadmill_ipc, the C ABI client
+ *
+ * Record decoding on its own, then the library against a live
+ * TreadmillController: both framings, commands and acks, reconnect
+ * with the subscription replayed, and the status page.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "treadmill_ipc.h"
+#include "gpio_mock.h"
+#include "treadmill_io.h"
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// Events until one matches or timeout_ms passes
+template <typename Match>
+static bool next_matching(tm_client* c, tm_event& ev, int timeout_ms, Match match) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (tm_next_event(c, &ev, 50) < 0) return false;
+        if (match(ev)) return true;
+    }
+    return false;
+}
+
+static bool is_type(const tm_event& ev, std::string_view type) {
+    return std::string_view(ev.json_type) == type;
+}
+
+TEST_CASE("records decode into the C structs and render as the server's JSON") {
+    CHECK(tm_abi_version() == TM_ABI_VERSION);
+
+    std::array<char, 256> rec;
+    KvEvent kv{ "motor", "hmph", "1F4", 12.5, 2 };
+    size_t n = format_kv_record(rec, kv);
+    tm_event ev;
+    CHECK(tm_decode_record(rec.data(), n, &ev) == 0);
+    CHECK(ev.type == TM_EVENT_KV);
+    CHECK(ev.bus == 2);
+    CHECK(ev.kv.ts == 12.5);
+    CHECK(std::string_view(ev.kv.source) == "motor");
+    CHECK(std::string_view(ev.kv.key) == "hmph");
+    CHECK(std::string_view(ev.kv.value) == "1F4");
+    CHECK(ev.json == nullptr);
+
+    std::array<char, RECORD_JSON_MAX + 1> json;
+    std::array<char, RECORD_JSON_MAX> expect;
+    size_t len = tm_record_to_json(rec.data(), n, json.data(), json.size());
+    CHECK(len > 0);
+    CHECK(std::string_view(json.data(), len) ==
+          std::string_view(expect.data(), ring_message_to_json(expect, { rec.data(), n })));
+    CHECK(tm_record_to_json(rec.data(), n, json.data(), 8) == 0);
+
+    StatusEvent st{ true, false, 30, 4, 29, -1, 100, 200, 1, 2, 0.25, 10.0, 60000, 0, true, 7 };
+    n = format_status_record(rec, st);
+    CHECK(tm_decode_record(rec.data(), n, &ev) == 0);
+    CHECK(ev.type == TM_EVENT_STATUS);
+    CHECK(ev.status.proxy == 1);
+    CHECK(ev.status.overlay == 1);
+    CHECK(ev.status.emu_speed == 30);
+    CHECK(ev.status.bus_incline == -1);
+    CHECK(ev.status.motor_bytes == 200);
+    CHECK(ev.status.distance_mi == 0.25);
+    CHECK(ev.status.generation == 7);
+
+    FtmsEvent f = make_ftms_event(50, 8, 1.0, 60000);
+    n = format_ftms_record(rec, f);
+    CHECK(tm_decode_record(rec.data(), n, &ev) == 0);
+    CHECK(ev.type == TM_EVENT_FTMS);
+    CHECK(ev.ftms.speed == f.speed);
+    CHECK(ev.ftms.incline == f.incline);
+    CHECK(ev.ftms.distance_m == f.distance_m);
+
+    // JSON text in a record: its type, and the text itself
+    std::string jrec = std::string(1, static_cast<char>(EventRecord::Json)) + "{\"type\":\"stall\",\"ms\":5}";
+    CHECK(tm_decode_record(jrec.data(), jrec.size(), &ev) == 0);
+    CHECK(ev.type == TM_EVENT_JSON);
+    CHECK(std::string_view(ev.json_type) == "stall");
+    CHECK(std::string_view(ev.json, ev.json_len) == "{\"type\":\"stall\",\"ms\":5}");
+
+    CHECK(tm_decode_record(rec.data(), 3, &ev) == -1);
+    CHECK(tm_decode_record("\x09", 1, &ev) == -1);
+}
+
+TEST_CASE("a binary connection decodes events and gets acks for its commands") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+
+    tm_client* c = tm_connect(nullptr, TM_FORMAT_BINARY, 0);
+    CHECK(c != nullptr);
+    if (!c) {
+        ctrl.stop();
+        return;
+    }
+    CHECK(tm_fd(c) >= 0);
+    tm_event ev;
+    CHECK(next_matching(c, ev, 2000, [](const tm_event& e) { return is_type(e, "hello"); }));
+    CHECK(ev.type == TM_EVENT_JSON);
+    CHECK(std::string_view(ev.json, ev.json_len).find("\"format\":\"binary\"") != std::string_view::npos);
+
+    CHECK(tm_subscribe(c, TM_TYPE_KV | TM_TYPE_STATUS, TM_SOURCE_MOTOR, TM_SUB_ALL, TM_SUB_ALL, 0) == 0);
+    port.inject_serial_data_pin(17, kv_build("hmph", "1F4"));
+    CHECK(next_matching(c, ev, 2000, [](const tm_event& e) { return e.type == TM_EVENT_KV; }));
+    CHECK(std::string_view(ev.kv.source) == "motor");
+    CHECK(std::string_view(ev.kv.key) == "hmph");
+    CHECK(std::string_view(ev.kv.value) == "1F4");
+    CHECK(ev.json == nullptr);  // came as a record
+
+    CHECK(tm_set_speed(c, 3.5, 7) == 0);
+    CHECK(next_matching(c, ev, 2000, [](const tm_event& e) { return is_type(e, "ack"); }));
+    CHECK(std::string_view(ev.json, ev.json_len).find("\"seq\":7") != std::string_view::npos);
+    CHECK(next_matching(c, ev, 2000, [](const tm_event& e) {
+        return e.type == TM_EVENT_STATUS && e.status.emu_speed == 35;
+    }));
+    CHECK(ev.status.emulate == 1);
+
+    // Any other command as text; the snapshot passes every type filter
+    CHECK(tm_send(c, "{\"cmd\":\"snapshot\"}") == 0);
+    CHECK(next_matching(c, ev, 2000, [](const tm_event& e) { return is_type(e, "snapshot"); }));
+    CHECK(ev.type == TM_EVENT_JSON);
+
+    tm_close(c);
+    ctrl.stop();
+}
+
+TEST_CASE("a JSON connection gives the same structs, with the line alongside") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+
+    tm_client* c = tm_connect(nullptr, TM_FORMAT_JSON, 0);
+    CHECK(c != nullptr);
+    if (!c) {
+        ctrl.stop();
+        return;
+    }
+    CHECK(tm_subscribe(c, TM_TYPE_KV, TM_SUB_ALL, 1u << static_cast<int>(KvKey::Inc), TM_SUB_ALL, 0) == 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    port.inject_serial_data_pin(17, kv_build("hmph", "1F4") + kv_build("inc", "8"));
+
+    tm_event ev;
+    CHECK(next_matching(c, ev, 2000, [](const tm_event& e) { return e.type == TM_EVENT_KV; }));
+    CHECK(std::string_view(ev.kv.key) == "inc");  // hmph filtered out by the keys mask
+    CHECK(std::string_view(ev.kv.value) == "8");
+    CHECK(ev.kv.ts > 0);
+    CHECK(ev.json != nullptr);
+    if (ev.json) CHECK(std::string_view(ev.json).find("\"key\":\"inc\"") != std::string_view::npos);
+
+    tm_close(c);
+    ctrl.stop();
+}
+
+TEST_CASE("reconnect replays the subscription, and the status page reads without a socket") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    auto ctrl = std::make_unique<TreadmillController<MockGpioPort>>(port, cfg);
+    CHECK(ctrl->start());
+
+    tm_status_page* page = tm_status_page_open(0);
+    CHECK(page != nullptr);
+    tm_status_snapshot snap;
+    CHECK(tm_status_page_read(page, &snap) == 0);
+    CHECK(snap.status.proxy == 1);
+    CHECK(snap.status.bus_speed == -1);
+    CHECK(snap.pid == static_cast<uint32_t>(getpid()));
+    tm_status_page_close(page);
+    CHECK(tm_status_page_open(MAX_BUSES) == nullptr);
+
+    tm_client* c = tm_connect(nullptr, TM_FORMAT_BINARY, 0);
+    CHECK(c != nullptr);
+    if (!c) {
+        ctrl->stop();
+        return;
+    }
+    CHECK(tm_subscribe(c, TM_TYPE_STATUS, TM_SUB_ALL, TM_SUB_ALL, TM_SUB_ALL, 0) == 0);
+
+    // The daemon restarts: the client sees the drop, then reconnects
+    ctrl->stop();
+    ctrl.reset();
+    tm_event ev;
+    int rc = 1;
+    for (int i = 0; i < 100 && rc != -1; i++) rc = tm_next_event(c, &ev, 20);
+    CHECK(rc == -1);
+    CHECK(tm_fd(c) == -1);
+    CHECK(tm_heartbeat(c) == -1);
+
+    ctrl = std::make_unique<TreadmillController<MockGpioPort>>(port, cfg);
+    CHECK(ctrl->start());
+    CHECK(tm_reconnect(c) == 0);
+
+    // Status only: the motor's kv events are filtered out on the new connection
+    port.inject_serial_data_pin(17, kv_build("hmph", "1F4"));
+    bool saw_kv = false, saw_speed = false;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(1000);
+    while (std::chrono::steady_clock::now() < deadline && !saw_speed) {
+        if (tm_next_event(c, &ev, 50) < 0) break;
+        saw_kv |= ev.type == TM_EVENT_KV;
+        saw_speed |= ev.type == TM_EVENT_STATUS && ev.status.bus_speed == decode_speed_hex("1F4");
+    }
+    CHECK(saw_speed);
+    CHECK_FALSE(saw_kv);
+
+    tm_close(c);
+    ctrl->stop();
+}
@@ -0,0 +1,203 @@
+/*
+ * test_cmd_mailbox.cpp — Tests for the shared-memory command mailbox
+ *
+ * Slot decoding, then live: an IpcServer handing a mailbox to a socket
+ * client and dispatching what its MailboxWriter sends (order, a full
+ * ring, bad slots, refusals), and a TreadmillController acking mailbox
+ * commands on the socket.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "cmd_mailbox.h"
+#include "ipc_server.h"
+#include "gpio_mock.h"
+#include "treadmill_io.h"
+#include "ipc_test_util.h"
+
+#include <poll.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static MailboxSlot slot(MailboxOp op, int32_t int_value = 0, double float_value = 0, uint8_t flags = 0) {
+    MailboxSlot s{};
+    s.op = static_cast<uint8_t>(op);
+    s.flags = flags;
+    s.int_value = int_value;
+    s.float_value = float_value;
+    return s;
+}
+
+TEST_CASE("slots decode to the commands they name") {
+    auto cmd = mailbox_command(slot(MailboxOp::Speed, 0, 3.5));
+    CHECK(cmd.has_value());
+    if (cmd) {
+        CHECK(cmd->type == CmdType::Speed);
+        CHECK(cmd->float_value == 3.5);
+        CHECK_FALSE(cmd->has_seq);
+    }
+
+    auto s = slot(MailboxOp::Emulate, 0, 0, MAILBOX_FLAG_ON | MAILBOX_FLAG_SEQ);
+    s.seq = 42;
+    s.bus = 2;
+    cmd = mailbox_command(s);
+    CHECK(cmd.has_value());
+    if (cmd) {
+        CHECK(cmd->type == CmdType::Emulate);
+        CHECK(cmd->bool_value);
+        CHECK(cmd->has_seq);
+        CHECK(cmd->seq == 42);
+        CHECK(cmd->bus == 2);
+    }
+
+    cmd = mailbox_command(slot(MailboxOp::Incline, 9));
+    CHECK(cmd.has_value());
+    if (cmd) CHECK(cmd->int_value == 9);
+    CHECK(mailbox_command(slot(MailboxOp::Hr, 140)).has_value());
+
+    // Not commands: unknown ops, out-of-range values, no such bus
+    CHECK_FALSE(mailbox_command(slot(static_cast<MailboxOp>(0))).has_value());
+    CHECK_FALSE(mailbox_command(slot(static_cast<MailboxOp>(99))).has_value());
+    CHECK_FALSE(mailbox_command(slot(MailboxOp::Hr, HR_BPM_MAX + 1)).has_value());
+    CHECK_FALSE(mailbox_command(slot(MailboxOp::Speed, 0, std::nan(""))).has_value());
+    s = slot(MailboxOp::Heartbeat);
+    s.bus = MAX_BUSES;
+    CHECK_FALSE(mailbox_command(s).has_value());
+}
+
+// An IpcServer polled on its own thread, recording the commands it dispatches
+struct ServedIpc {
+    EventRing ring;
+    IpcServer ipc{ring};
+    std::atomic<bool> running{true};
+    std::mutex mu;
+    std::vector<IpcCommand> cmds;
+    std::thread thread;
+
+    explicit ServedIpc(bool mailboxes) {
+        ipc.enable_mailboxes(mailboxes);
+        ipc.on_command([this](const IpcCommand& cmd) {
+            std::lock_guard<std::mutex> lk(mu);
+            cmds.push_back(cmd);
+        });
+        ipc.create();
+        thread = std::thread([this] {
+            while (running.load()) ipc.poll(20);
+        });
+    }
+    ~ServedIpc() {
+        running.store(false);
+        ipc.wake();
+        thread.join();
+        ipc.shutdown();
+    }
+    size_t count() {
+        std::lock_guard<std::mutex> lk(mu);
+        return cmds.size();
+    }
+};
+
+static bool wait_for(ServedIpc& s, size_t n, int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (s.count() < n && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    return s.count() >= n;
+}
+
+TEST_CASE("mailbox commands reach the command callback in order") {
+    ServedIpc s(true);
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    if (fd < 0) return;
+    MailboxWriter w;
+    CHECK(w.open(fd));
+    if (!w.is_open()) {
+        close(fd);
+        return;
+    }
+
+    // More than a ring's worth: a full ring refuses until the IPC thread catches up
+    constexpr uint32_t N = CMD_MAILBOX_SLOTS * 3;
+    for (uint32_t i = 0; i < N; i++) {
+        auto m = slot(MailboxOp::Speed, 0, i / 100.0, MAILBOX_FLAG_SEQ);
+        m.seq = i;
+        while (!w.send(m)) std::this_thread::yield();
+    }
+    CHECK(wait_for(s, N, 2000));
+    {
+        std::lock_guard<std::mutex> lk(s.mu);
+        bool in_order = s.cmds.size() == N;
+        for (uint32_t i = 0; in_order && i < N; i++) in_order = s.cmds.at(i).seq == i;
+        CHECK(in_order);
+    }
+
+    // A bad slot is skipped with an error to this client; the next one still counts
+    CHECK(w.send(slot(static_cast<MailboxOp>(77))));
+    CHECK(w.send(slot(MailboxOp::Heartbeat)));
+    CHECK(wait_for(s, N + 1, 1000));
+    std::string got = read_until(fd, "not a valid command", 1000);
+    CHECK(got.find("{\"type\":\"error\",\"msg\":\"mailbox slot is not a valid command\"}") != std::string::npos);
+
+    // One mailbox per client
+    MailboxWriter again;
+    CHECK_FALSE(again.open(fd, 500));
+
+    // Socket commands still work alongside
+    send(fd, "{\"cmd\":\"status\"}\n", 17, 0);
+    CHECK(wait_for(s, N + 2, 1000));
+    if (s.count() >= N + 2) {
+        std::lock_guard<std::mutex> lk(s.mu);
+        CHECK(s.cmds.at(N).type == CmdType::Heartbeat);
+        CHECK(s.cmds.at(N + 1).type == CmdType::Status);
+    }
+    close(fd);
+}
+
+TEST_CASE("mailboxes are refused unless enabled") {
+    ServedIpc s(false);
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    if (fd < 0) return;
+    MailboxWriter w;
+    auto t0 = std::chrono::steady_clock::now();
+    CHECK_FALSE(w.open(fd, 2000));
+    CHECK(std::chrono::steady_clock::now() - t0 < std::chrono::milliseconds(1000));  // the error, not the timeout
+    CHECK_FALSE(w.send(slot(MailboxOp::Heartbeat)));
+    close(fd);
+}
+
+TEST_CASE("the controller applies and acks mailbox commands") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    cfg.mailbox = true;
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        ctrl.stop();
+        return;
+    }
+    MailboxWriter w;
+    CHECK(w.open(fd));
+
+    CHECK(w.send(slot(MailboxOp::Emulate, 0, 0, MAILBOX_FLAG_ON)));
+    auto speed = slot(MailboxOp::Speed, 0, 3.0, MAILBOX_FLAG_SEQ);
+    speed.seq = 7;
+    CHECK(w.send(speed));
+    std::string got = read_until(fd, "\"seq\":7", 1000);
+    CHECK(got.find("{\"type\":\"ack\",\"seq\":7,\"stage\":\"applied\"}") != std::string::npos);
+    CHECK(got.find("\"emulate\":true") != std::string::npos);
+    CHECK(got.find("\"emu_speed\":30") != std::string::npos);
+
+    close(fd);
+    ctrl.stop();
+}
@@ -11,49 +11,24 @@
 #include <doctest.h>
 #include "gpio_mock.h"
 #include "treadmill_io.h"
+#include "ipc_test_util.h"
 
-#include <sys/socket.h>
-#include <sys/un.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <cstring>
+#include <dirent.h>
 #include <thread>
 #include <chrono>
 #include <string>
 
-// Helper: connect to the IPC socket
-static int connect_ipc() {
-    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (fd < 0) return -1;
-    struct sockaddr_un addr{};
-    addr.sun_family = AF_UNIX;
-    std::strncpy(addr.sun_path, SOCK_PATH, sizeof(addr.sun_path) - 1);
-    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
-        close(fd);
-        return -1;
+// Threads in this process
+static int thread_count() {
+    DIR* d = opendir("/proc/self/task");
+    if (!d) return -1;
+    int n = 0;
+    while (const struct dirent* e = readdir(d)) {
+        if (e->d_name[0] != '.') n++;
     }
-    return fd;
-}
-
-static void send_json(int fd, const char* json) {
-    std::string line = std::string(json) + "\n";
-    (void)write(fd, line.c_str(), line.size());
-}
-
-static std::string read_available(int fd, int wait_ms = 150) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
-    char buf[8192];
-    std::string result;
-    int flags = fcntl(fd, F_GETFL, 0);
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-    while (true) {
-        ssize_t n = read(fd, buf, sizeof(buf) - 1);
-        if (n <= 0) break;
-        buf[n] = '\0';
-        result += buf;
-    }
-    fcntl(fd, F_SETFL, flags);
-    return result;
+    closedir(d);
+    return n;
 }
 
 // ── IPC end-to-end through controller ───────────────────────────────
@@ -316,6 +291,46 @@ TEST_CASE("emulate mode does NOT forward console data") {
     ctrl.stop();
 }
 
+TEST_CASE("overlay forwards the console stream with speed and incline rewritten") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    ctrl.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    send_json(fd, "{\"cmd\":\"overlay\",\"enabled\":true}");
+    std::string events = read_available(fd, 100);
+    CHECK(ctrl.mode().is_overlay());
+    CHECK(events.find("\"emulate\":false,\"overlay\":true,\"emu_speed\":0,") != std::string::npos);
+
+    // Speed and incline keep overlay; no emulate cycle starts
+    send_json(fd, "{\"cmd\":\"speed\",\"value\":3.0}\n{\"cmd\":\"incline\",\"value\":5}");
+    read_available(fd, 100);
+    CHECK(ctrl.mode().is_overlay());
+    CHECK_FALSE(ctrl.mode().is_emulating());
+    port.clear_writes();
+
+    // The console's frames split across reads, its own values unchanged
+    port.inject_serial_data_pin(27, "[inc:0]\xff[hm");
+    port.inject_serial_data_pin(27, "ph:0]\xff[amps]\xff");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(port.get_written_string() == "[inc:A]\xff[hmph:12C]\xff[amps]\xff");
+
+    // The console taking over hands the motor back to it from its next frame
+    port.inject_serial_data_pin(27, "[hmph:78]\xff");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(ctrl.mode().is_proxy());
+    port.inject_serial_data_pin(27, "[hmph:78]\xff");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(port.get_written_string().find("[hmph:78]") != std::string::npos);
+
+    close(fd);
+    ctrl.stop();
+}
+
 // ── Motor reader ────────────────────────────────────────────────────
 
 TEST_CASE("motor reader events appear in IPC stream") {
@@ -345,6 +360,36 @@ TEST_CASE("motor reader events appear in IPC stream") {
     ctrl.stop();
 }
 
+TEST_CASE("a client connecting later gets every key's latest value at once") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    cfg.kv_changes_only = true;  // the values below are never re-sent
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    ctrl.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    port.inject_serial_data_pin(17, "[ver:1.7][type:3][belt:1]");
+    port.inject_serial_data_pin(27, "[amps][hmph:32]");
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+
+    int fd = connect_ipc();
+    std::string data = read_available(fd, 100);
+    CHECK(data.find("{\"type\":\"snapshot\",\"ts\":") == 0);
+    CHECK(data.find("\"console\":{\"hmph\":\"32\"},\"motor\":{\"belt\":\"1\",\"ver\":\"1.7\",\"type\":\"3\"},"
+                    "\"emulate\":{}}\n{\"type\":\"status\",") != std::string::npos);
+
+    // Asked for again: the new value
+    port.inject_serial_data_pin(17, "[belt:0]");
+    read_available(fd, 150);
+    send_json(fd, "{\"cmd\":\"snapshot\"}");
+    data = read_available(fd, 150);
+    CHECK(data.find("\"motor\":{\"belt\":\"0\",") != std::string::npos);
+
+    close(fd);
+    ctrl.stop();
+}
+
 // ── Byte counter tracking ───────────────────────────────────────────
 
 TEST_CASE("byte counters increment with serial data") {
@@ -395,3 +440,1024 @@ TEST_CASE("status command returns current state") {
     close(fd);
     ctrl.stop();
 }
+
+TEST_CASE("metrics command reports proxy latency and client lag") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    ctrl.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    read_available(fd, 80);
+
+    port.inject_serial_data_pin(27, "[hmph:78]\xff");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    read_available(fd, 50);
+
+    send_json(fd, "{\"cmd\":\"metrics\"}");
+    std::string data = read_available(fd, 100);
+
+    CHECK(data.find("\"name\":\"proxy_us\",\"count\":1,") != std::string::npos);
+    CHECK(data.find("\"name\":\"motor_tx_wait_us\",\"count\":1,") != std::string::npos);
+    CHECK(data.find("\"name\":\"client\"") != std::string::npos);
+    CHECK(data.find("\"lost_msgs\":0") != std::string::npos);
+    CHECK(data.find("\"name\":\"bus\",\"source\":\"console\",\"bytes\":10,\"frames\":1,") !=
+          std::string::npos);
+
+    close(fd);
+    ctrl.stop();
+}
+
+TEST_CASE("metrics command reports motor query round trips") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    ctrl.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    read_available(fd, 80);
+
+    // Console asks (proxied), motor answers; the second belt query goes unanswered
+    port.inject_serial_data_pin(27, "[amps]\xff[belt]\xff");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    port.inject_serial_data_pin(17, "[amps:FF]");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    port.inject_serial_data_pin(27, "[belt]\xff");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    read_available(fd, 50);
+
+    send_json(fd, "{\"cmd\":\"metrics\"}");
+    std::string data = read_available(fd, 100);
+    CHECK(data.find("\"name\":\"query\",\"key\":\"amps\",\"count\":1,") != std::string::npos);
+    CHECK(data.find("\"sent\":2,\"missing\":1,\"stalls\":0") != std::string::npos);  // belt
+
+    close(fd);
+    ctrl.stop();
+}
+
+// ── Heartbeat watchdog ──────────────────────────────────────────────
+
+TEST_CASE("heartbeat timeout returns emulate to proxy") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+
+    // Virtual time: the watchdog sees seconds pass in milliseconds
+    VirtualClock clock;
+    TreadmillController<MockGpioPort, VirtualClock> ctrl(port, cfg, clock);
+    ctrl.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    read_available(fd, 80);
+    send_json(fd, "{\"cmd\":\"speed\",\"value\":2.0}");
+    read_available(fd, 100);
+    CHECK(ctrl.mode().is_emulating());
+
+    // Heartbeats keep emulate alive past the timeout
+    for (int i = 0; i < 3; i++) {
+        clock.advance(std::chrono::milliseconds(1500));
+        send_json(fd, "{\"cmd\":\"heartbeat\"}");
+        read_available(fd, 20);
+    }
+    CHECK(ctrl.mode().is_emulating());
+
+    // Silence, a hair short of the timeout
+    clock.advance(std::chrono::milliseconds(HEARTBEAT_TIMEOUT_SEC * 1000 - 100));
+    read_available(fd, 30);
+    CHECK(ctrl.mode().is_emulating());
+
+    // Past it: the timerfd watchdog's next check resets
+    clock.advance(std::chrono::milliseconds(200));
+    read_available(fd, 30);
+    CHECK_FALSE(ctrl.mode().is_emulating());
+    CHECK(ctrl.mode().is_proxy());
+    CHECK(ctrl.mode().speed_tenths() == 0);
+
+    close(fd);
+    ctrl.stop();
+}
+
+TEST_CASE("ring push wakes idle IPC loop promptly") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    ctrl.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    read_available(fd, 80);
+
+    // Push directly into the ring: the blocked IPC thread must wake and
+    // deliver without waiting for a poll timeout.
+    auto t0 = std::chrono::steady_clock::now();
+    ctrl.ring().push("{\"type\":\"probe\"}\n");
+
+    char buf[256];
+    ssize_t n = read(fd, buf, sizeof(buf));  // blocking read
+    auto dt = std::chrono::steady_clock::now() - t0;
+    CHECK(n > 0);
+    CHECK(std::string(buf, n > 0 ? n : 0).find("probe") != std::string::npos);
+    CHECK(std::chrono::duration_cast<std::chrono::milliseconds>(dt).count() < 15);
+
+    close(fd);
+    ctrl.stop();
+}
+
+// ── Change-only KV events ───────────────────────────────────────────
+
+static int count_of(const std::string& s, std::string_view needle) {
+    int n = 0;
+    for (size_t pos = s.find(needle); pos != std::string::npos; pos = s.find(needle, pos + 1)) n++;
+    return n;
+}
+
+TEST_CASE("changes_only suppresses repeats and resyncs on connect and keyframe") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    cfg.kv_changes_only = true;
+    cfg.kv_keyframe_ms = 500;
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    ctrl.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    read_available(fd, 80);
+
+    port.inject_serial_data_pin(27, "[part:6]\xff[part:6]\xff[part:6]\xff[part:7]\xff[part:7]\xff");
+    std::string data = read_available(fd, 150);
+    CHECK(count_of(data, "\"key\":\"part\"") == 2);
+
+    // A new client triggers a resync: the next part frame passes again
+    int fd2 = connect_ipc();
+    read_available(fd2, 80);
+    read_available(fd, 0);
+    port.inject_serial_data_pin(27, "[part:7]\xff[part:7]\xff");
+    data = read_available(fd2, 150);
+    CHECK(count_of(data, "\"key\":\"part\"") == 1);
+    read_available(fd, 0);
+
+    // The keyframe timer resyncs too
+    std::this_thread::sleep_for(std::chrono::milliseconds(550));
+    port.inject_serial_data_pin(27, "[part:7]\xff");
+    data = read_available(fd, 150);
+    CHECK(count_of(data, "\"key\":\"part\"") == 1);
+
+    close(fd2);
+    close(fd);
+    ctrl.stop();
+}
+
+TEST_CASE("config events section") {
+    constexpr std::string_view PINS =
+        R"("console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17})";
+    GpioConfig cfg;
+
+    CHECK(parse_gpio_config("{" + std::string(PINS) + "}", &cfg).ok);
+    CHECK_FALSE(cfg.kv_changes_only);
+
+    CHECK(parse_gpio_config("{" + std::string(PINS) +
+                            R"(,"events":{"changes_only":true,"keyframe_ms":2000}})", &cfg).ok);
+    CHECK(cfg.kv_changes_only);
+    CHECK(cfg.kv_keyframe_ms == 2000);
+
+    CHECK_FALSE(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"changes_only":1}})", &cfg).ok);
+    CHECK_FALSE(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"keyframe_ms":10}})", &cfg).ok);
+
+    CHECK(cfg.status_interval_ms == 1000);
+    CHECK(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"status_interval_ms":0}})", &cfg).ok);
+    CHECK(cfg.status_interval_ms == 0);
+    CHECK(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"status_interval_ms":250}})", &cfg).ok);
+    CHECK(cfg.status_interval_ms == 250);
+    CHECK_FALSE(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"status_interval_ms":50}})", &cfg).ok);
+
+    CHECK(cfg.bus_stats_ms == BUS_STATS_MS);
+    CHECK(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"bus_stats_ms":0}})", &cfg).ok);
+    CHECK(cfg.bus_stats_ms == 0);
+    CHECK_FALSE(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"bus_stats_ms":500}})", &cfg).ok);
+    CHECK_FALSE(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"bus_stats_ms":"1s"}})", &cfg).ok);
+
+    CHECK(cfg.motor_stats_ms == MOTOR_STATS_MS);
+    CHECK(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"motor_stats_ms":0}})", &cfg).ok);
+    CHECK(cfg.motor_stats_ms == 0);
+    CHECK(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"motor_stats_ms":10000}})", &cfg).ok);
+    CHECK(cfg.motor_stats_ms == 10000);
+    CHECK_FALSE(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"motor_stats_ms":999}})", &cfg).ok);
+
+    CHECK_FALSE(cfg.cycle_events);
+    CHECK(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"cycles":true}})", &cfg).ok);
+    CHECK(cfg.cycle_events);
+    CHECK_FALSE(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"cycles":1}})", &cfg).ok);
+
+    CHECK_FALSE(cfg.lazy_console);
+    CHECK(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"lazy_console":true}})", &cfg).ok);
+    CHECK(cfg.lazy_console);
+    CHECK_FALSE(parse_gpio_config("{" + std::string(PINS) + R"(,"events":{"lazy_console":"yes"}})", &cfg).ok);
+}
+
+TEST_CASE("status events go out on change, motor decodes included, plus a heartbeat") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    cfg.status_interval_ms = 300;
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    send_json(fd, "{\"cmd\":\"subscribe\",\"types\":[\"status\"]}");
+    read_available(fd, 30);
+
+    // Repeats change nothing: one event
+    send_json(fd, "{\"cmd\":\"speed\",\"value\":2.0}");
+    send_json(fd, "{\"cmd\":\"speed\",\"value\":2.0}");
+    send_json(fd, "{\"cmd\":\"heartbeat\"}");
+    std::string events = read_available(fd, 100);
+    CHECK(count_of(events, "\"type\":\"status\"") == 1);
+
+    // The status command always answers
+    send_json(fd, "{\"cmd\":\"status\"}");
+    CHECK(count_of(read_available(fd, 50), "\"type\":\"status\"") == 1);
+
+    // A motor speed report is a change
+    port.inject_serial_data_pin(17, "[hmph:C8]\xff");
+    events = read_available(fd, 100);
+    CHECK(count_of(events, "\"type\":\"status\"") == 1);
+    CHECK(events.find("\"bus_speed\":20") != std::string::npos);
+    port.inject_serial_data_pin(17, "[hmph:C8]\xff");
+    CHECK(count_of(read_available(fd, 80), "\"type\":\"status\"") == 0);
+
+    // Quiet: the heartbeat keeps one coming every interval
+    events = read_available(fd, 1000);
+    int beats = count_of(events, "\"type\":\"status\"");
+    CHECK(beats >= 2);
+    CHECK(beats <= 4);
+
+    close(fd);
+    ctrl.mode().request_proxy(true);
+    ctrl.stop();
+}
+
+TEST_CASE("ftms events follow the motor's reports, and only on change") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    send_json(fd, "{\"cmd\":\"subscribe\",\"types\":[\"ftms\"]}");
+    read_available(fd, 30);
+
+    // 2.0 mph from the motor is 3.22 km/h
+    port.inject_serial_data_pin(17, "[hmph:C8]\xff");
+    std::string events = read_available(fd, 100);
+    CHECK(count_of(events, "\"type\":\"ftms\"") == 1);
+    CHECK(events.find("\"speed\":322,\"incline\":0,") != std::string::npos);
+    CHECK(events.find("\"type\":\"status\"") == std::string::npos);
+
+    // Same speed, under a metre and a second later: nothing new
+    port.inject_serial_data_pin(17, "[hmph:C8]\xff");
+    CHECK(count_of(read_available(fd, 80), "\"type\":\"ftms\"") == 0);
+
+    port.inject_serial_data_pin(17, "[inc:A]\xff");
+    events = read_available(fd, 100);
+    CHECK(count_of(events, "\"type\":\"ftms\"") == 1);
+    CHECK(events.find("\"incline\":50,") != std::string::npos);
+
+    // The status command forces one
+    send_json(fd, "{\"cmd\":\"status\"}");
+    CHECK(count_of(read_available(fd, 50), "\"type\":\"ftms\"") == 1);
+
+    close(fd);
+    ctrl.mode().request_proxy(true);
+    ctrl.stop();
+}
+
+TEST_CASE("config emulate rates and pacing") {
+    constexpr std::string_view PINS =
+        R"("console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17})";
+    auto with = [&](std::string_view r) { return "{" + std::string(PINS) + R"(,"emulate":{"rates":)" + std::string(r) + "}}"; };
+    GpioConfig cfg;
+
+    CHECK(parse_gpio_config("{" + std::string(PINS) + "}", &cfg).ok);
+    CHECK(cfg.emu_rates == EMU_DEFAULT_RATES);
+
+    CHECK(parse_gpio_config(with(R"({"inc":"burst","hmph":"burst","ver":10,"type":10,"part":10})"), &cfg).ok);
+    CHECK(cfg.emu_rates.at(0) == EMU_EVERY_BURST);
+    CHECK(cfg.emu_rates.at(1) == EMU_EVERY_BURST);
+    CHECK(cfg.emu_rates.at(9) == 10);
+    CHECK(cfg.emu_rates.at(2) == 1);
+
+    CHECK_FALSE(parse_gpio_config(with(R"({"inc":2})"), &cfg).ok);      // setpoints every cycle at least
+    CHECK_FALSE(parse_gpio_config(with(R"({"ver":0})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with(R"({"ver":101})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with(R"({"ver":"cycle"})"), &cfg).ok);
+    auto bad = parse_gpio_config(with(R"({"speed":1})"), &cfg);
+    CHECK_FALSE(bad.ok);
+    CHECK(bad.error.find("unknown emulate key \"speed\"") != std::string::npos);
+
+    auto emulate = [&](std::string_view e) { return "{" + std::string(PINS) + R"(,"emulate":)" + std::string(e) + "}"; };
+    CHECK_FALSE(cfg.emu_paced);
+    CHECK(parse_gpio_config(emulate(R"({"paced":true,"min_gap_ms":25})"), &cfg).ok);
+    CHECK(cfg.emu_paced);
+    CHECK(cfg.emu_min_gap_ms == 25);
+    CHECK_FALSE(parse_gpio_config(emulate(R"({"paced":1})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(emulate(R"({"min_gap_ms":-1})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(emulate(R"({"paced":true,"burst_gap_ms":50,"min_gap_ms":60})"), &cfg).ok);
+    // No cycle to fit 5 bursts into when paced
+    CHECK_FALSE(parse_gpio_config(emulate(R"({"burst_gap_ms":200})"), &cfg).ok);
+    CHECK(parse_gpio_config(emulate(R"({"paced":true,"burst_gap_ms":200})"), &cfg).ok);
+}
+
+TEST_CASE("config realtime section") {
+    constexpr std::string_view PINS =
+        R"("console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17})";
+    auto with = [&](std::string_view rt) { return "{" + std::string(PINS) + R"(,"realtime":)" + std::string(rt) + "}"; };
+    GpioConfig cfg;
+
+    CHECK(parse_gpio_config("{" + std::string(PINS) + "}", &cfg).ok);
+    CHECK_FALSE(cfg.mlockall);
+    CHECK_FALSE(cfg.console_sched.active());
+
+    auto r = parse_gpio_config(with(R"({"mlockall":true,"console":{"policy":"fifo","priority":80,"cpus":[3]},)"
+                                    R"("motor_write":{"policy":"rr","priority":70,"cpus":[2,3]},)"
+                                    R"("ipc":{"policy":"other"},"emulate":{"cpus":[1]}})"), &cfg);
+    CHECK(r.ok);
+    CHECK(cfg.mlockall);
+    CHECK(cfg.console_sched.policy == SchedPolicy::Fifo);
+    CHECK(cfg.console_sched.priority == 80);
+    CHECK(cfg.console_sched.cpus == 0x8);
+    CHECK(cfg.writer_sched.policy == SchedPolicy::RoundRobin);
+    CHECK(cfg.writer_sched.cpus == 0xC);
+    CHECK(cfg.ipc_sched.policy == SchedPolicy::Other);
+    CHECK(cfg.emulate_sched.policy == SchedPolicy::Inherit);
+    CHECK(cfg.emulate_sched.cpus == 0x2);
+    CHECK_FALSE(cfg.motor_sched.active());
+    CHECK_FALSE(cfg.reactor);
+    CHECK(parse_gpio_config(with(R"({"reactor":true})"), &cfg).ok);
+    CHECK(cfg.reactor);
+    CHECK_FALSE(parse_gpio_config(with(R"({"reactor":"yes"})"), &cfg).ok);
+
+    CHECK_FALSE(parse_gpio_config(with(R"({"mlockall":1})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with(R"({"console":{"policy":"idle"}})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with(R"({"console":{"policy":"fifo"}})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with(R"({"console":{"policy":"fifo","priority":100}})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with(R"({"console":{"policy":"other","priority":5}})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with(R"({"console":{"cpus":[]}})"), &cfg).ok);
+    auto bad = parse_gpio_config(with(R"({"motor":{"cpus":[64]}})"), &cfg);
+    CHECK_FALSE(bad.ok);
+    CHECK(bad.error.find("\"realtime\".\"motor\"") != std::string::npos);
+}
+
+TEST_CASE("config telemetry section") {
+    constexpr std::string_view PINS =
+        R"("console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17})";
+    auto with = [&](std::string_view t) { return "{" + std::string(PINS) + R"(,"telemetry":)" + std::string(t) + "}"; };
+    GpioConfig cfg;
+
+    CHECK(parse_gpio_config("{" + std::string(PINS) + "}", &cfg).ok);
+    CHECK(cfg.telemetry_address.empty());
+
+    CHECK(parse_gpio_config(with(R"({"address":"239.77.0.1","port":6000,"rate_hz":20,"ttl":2})"), &cfg).ok);
+    CHECK(cfg.telemetry_address == "239.77.0.1");
+    CHECK(cfg.telemetry_port == 6000);
+    CHECK(cfg.telemetry_rate_hz == 20);
+    CHECK(cfg.telemetry_ttl == 2);
+
+    CHECK(parse_gpio_config(with(R"({"address":"192.168.1.20"})"), &cfg).ok);
+    CHECK(cfg.telemetry_port == 5005);
+    CHECK(cfg.telemetry_rate_hz == 10);
+
+    CHECK_FALSE(parse_gpio_config(with(R"({"port":5005})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with(R"({"address":"dashboard.local"})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with(R"({"address":"239.77.0.1","rate_hz":0})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with(R"({"address":"239.77.0.1","port":70000})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with(R"("239.77.0.1")"), &cfg).ok);
+}
+
+TEST_CASE("config uart backend") {
+    GpioConfig cfg;
+    CHECK(parse_gpio_config(R"({"console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17}})",
+                            &cfg).ok);
+    CHECK(cfg.backend == PortBackend::Pigpio);
+
+    constexpr std::string_view UART =
+        R"({"backend":"uart","console_read":{"gpio":5,"uart":"/dev/ttyAMA3"},)"
+        R"("motor_write":{"gpio":14,"uart":"/dev/ttyAMA0"},"motor_read":{"gpio":15,"uart":"/dev/ttyAMA0"}})";
+    CHECK(parse_gpio_config(UART, &cfg).ok);
+    CHECK(cfg.backend == PortBackend::Uart);
+    CHECK(cfg.console_uart == "/dev/ttyAMA3");
+    CHECK(cfg.motor_write_uart == "/dev/ttyAMA0");
+    CHECK(cfg.motor_read_uart == "/dev/ttyAMA0");
+
+    // Every pin needs a device, and the two receivers need their own
+    CHECK_FALSE(parse_gpio_config(
+        R"({"backend":"uart","console_read":{"gpio":5,"uart":"/dev/ttyAMA3"},)"
+        R"("motor_write":{"gpio":14},"motor_read":{"gpio":15,"uart":"/dev/ttyAMA0"}})", &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(
+        R"({"backend":"uart","console_read":{"gpio":5,"uart":"/dev/ttyAMA0"},)"
+        R"("motor_write":{"gpio":14,"uart":"/dev/ttyAMA0"},"motor_read":{"gpio":15,"uart":"/dev/ttyAMA0"}})", &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(
+        R"({"backend":"spi","console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17}})", &cfg).ok);
+
+    // Buses agree on the backend and don't share a UART
+    std::vector<GpioConfig> buses;
+    std::string two = "{\"buses\":[" + std::string(UART) +
+        R"(,{"backend":"uart","console_read":{"gpio":6,"uart":"/dev/ttyAMA3"},)"
+        R"("motor_write":{"gpio":0,"uart":"/dev/ttyAMA2"},"motor_read":{"gpio":1,"uart":"/dev/ttyAMA2"}}]})";
+    auto dup = parse_bus_configs(two, &buses);
+    CHECK_FALSE(dup.ok);
+    CHECK(dup.error.find("uart /dev/ttyAMA3 already used") != std::string::npos);
+    buses.clear();
+    std::string mixed = "{\"buses\":[" + std::string(UART) +
+        R"(,{"console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17}}]})";
+    CHECK_FALSE(parse_bus_configs(mixed, &buses).ok);
+}
+
+TEST_CASE("config baud") {
+    GpioConfig cfg;
+    CHECK(parse_gpio_config(R"({"console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17}})",
+                            &cfg).ok);
+    CHECK(cfg.baud == BAUD);
+    CHECK(parse_gpio_config(
+        R"({"baud":4800,"console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17}})", &cfg).ok);
+    CHECK(cfg.baud == 4800);
+    CHECK_FALSE(parse_gpio_config(
+        R"({"baud":300,"console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17}})", &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(
+        R"({"baud":"fast","console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17}})", &cfg).ok);
+    // Kernel UARTs take the standard rates only
+    CHECK_FALSE(parse_gpio_config(
+        R"({"backend":"uart","baud":4800,"console_read":{"gpio":5,"uart":"/dev/ttyAMA3"},)"
+        R"("motor_write":{"gpio":14,"uart":"/dev/ttyAMA0"},"motor_read":{"gpio":15,"uart":"/dev/ttyAMA0"}})", &cfg).ok);
+
+    // The controller's lines run at it
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig fast{27, 22, 17};
+    fast.baud = 19200;
+    TreadmillController<MockGpioPort> ctrl(port, fast);
+    CHECK(ctrl.start());
+    CHECK(port.pins[27].serial_baud == 19200);
+    CHECK(port.pins[17].serial_baud == 19200);
+    ctrl.stop();
+}
+
+TEST_CASE("config trace section") {
+    constexpr std::string_view PINS =
+        R"("console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17})";
+    auto with = [&](std::string_view t) { return "{" + std::string(PINS) + R"(,"trace":)" + std::string(t) + "}"; };
+    GpioConfig cfg;
+
+    CHECK(parse_gpio_config("{" + std::string(PINS) + "}", &cfg).ok);
+    CHECK_FALSE(cfg.trace);
+    CHECK(cfg.trace_path == TRACE_PATH);
+
+    CHECK(parse_gpio_config(with(R"({"enabled":true,"path":"/var/tmp/tio.json"})"), &cfg).ok);
+    CHECK(cfg.trace);
+    CHECK(cfg.trace_path == "/var/tmp/tio.json");
+
+    CHECK_FALSE(parse_gpio_config(with(R"({"enabled":1})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with(R"({"path":""})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with("true"), &cfg).ok);
+}
+
+TEST_CASE("config standby section") {
+    constexpr std::string_view PINS =
+        R"("console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17})";
+    auto with = [&](std::string_view t) { return "{" + std::string(PINS) + R"(,"standby":)" + std::string(t) + "}"; };
+    GpioConfig cfg;
+
+    CHECK(parse_gpio_config("{" + std::string(PINS) + "}", &cfg).ok);
+    CHECK(cfg.standby_idle_s == STANDBY_IDLE_S);
+    CHECK(cfg.sample_us == 5);
+
+    CHECK(parse_gpio_config(with(R"({"idle_s":300,"sample_us":10})"), &cfg).ok);
+    CHECK(cfg.standby_idle_s == 300);
+    CHECK(cfg.sample_us == 10);
+    CHECK(parse_gpio_config(with(R"({"idle_s":0})"), &cfg).ok);
+    CHECK(cfg.standby_idle_s == 0);
+
+    CHECK_FALSE(parse_gpio_config(with(R"({"idle_s":5})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with(R"({"sample_us":3})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with("60"), &cfg).ok);
+    // Four samples per bit at least: 10 us is too slow for 38400 baud
+    CHECK_FALSE(parse_gpio_config("{" + std::string(PINS) + R"(,"baud":38400,"standby":{"sample_us":10}})", &cfg).ok);
+    // pigpio's clock: not for the uart backend, and one per process
+    CHECK_FALSE(parse_gpio_config(
+        R"({"backend":"uart","standby":{"sample_us":10},"console_read":{"gpio":5,"uart":"/dev/ttyAMA3"},)"
+        R"("motor_write":{"gpio":14,"uart":"/dev/ttyAMA0"},"motor_read":{"gpio":15,"uart":"/dev/ttyAMA0"}})", &cfg).ok);
+    std::vector<GpioConfig> buses;
+    CHECK_FALSE(parse_bus_configs(
+        R"({"buses":[{"console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17}},)"
+        R"({"standby":{"sample_us":10},"console_read":{"gpio":5},"motor_write":{"gpio":6},"motor_read":{"gpio":13}}]})",
+        &buses).ok);
+}
+
+TEST_CASE("config mailbox section") {
+    constexpr std::string_view PINS =
+        R"("console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17})";
+    auto with = [&](std::string_view t) { return "{" + std::string(PINS) + R"(,"mailbox":)" + std::string(t) + "}"; };
+    GpioConfig cfg;
+
+    CHECK(parse_gpio_config("{" + std::string(PINS) + "}", &cfg).ok);
+    CHECK_FALSE(cfg.mailbox);
+    CHECK(parse_gpio_config(with(R"({"enabled":true})"), &cfg).ok);
+    CHECK(cfg.mailbox);
+
+    CHECK_FALSE(parse_gpio_config(with(R"({"enabled":"yes"})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with("true"), &cfg).ok);
+}
+
+TEST_CASE("config tap section") {
+    constexpr std::string_view PINS =
+        R"("console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17})";
+    auto with = [&](std::string_view t) { return "{" + std::string(PINS) + R"(,"tap":)" + std::string(t) + "}"; };
+    GpioConfig cfg;
+
+    CHECK(parse_gpio_config("{" + std::string(PINS) + "}", &cfg).ok);
+    CHECK_FALSE(cfg.event_tap);
+    CHECK_FALSE(cfg.event_tap_group);
+    CHECK(parse_gpio_config(with(R"({"enabled":true})"), &cfg).ok);
+    CHECK(cfg.event_tap);
+    CHECK_FALSE(cfg.event_tap_group);
+    CHECK(parse_gpio_config(with(R"({"enabled":true,"group":true})"), &cfg).ok);
+    CHECK(cfg.event_tap_group);
+
+    CHECK_FALSE(parse_gpio_config(with(R"({"group":1})"), &cfg).ok);
+    CHECK_FALSE(parse_gpio_config(with("true"), &cfg).ok);
+}
+
+TEST_CASE("trace command records thread spans and dumps them to the configured path") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    cfg.trace_path = "/tmp/test_controller_trace_" + std::to_string(getpid()) + ".json";
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    ctrl.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    read_available(fd, 80);
+
+    send_json(fd, "{\"cmd\":\"trace\",\"action\":\"start\"}");
+    CHECK(read_available(fd, 100).find("{\"type\":\"trace\",\"recording\":true}") != std::string::npos);
+
+    port.inject_serial_data_pin(27, "[hmph:78]\xff");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    read_available(fd, 50);
+
+    send_json(fd, "{\"cmd\":\"trace\",\"action\":\"stop\"}");
+    read_available(fd, 100);
+    send_json(fd, "{\"cmd\":\"trace\",\"action\":\"dump\"}");
+    std::string data = read_available(fd, 100);
+    CHECK(data.find("\"recording\":false,\"spans\":") != std::string::npos);
+    CHECK(data.find(cfg.trace_path) != std::string::npos);
+
+    std::string json;
+    if (FILE* f = std::fopen(cfg.trace_path.c_str(), "r")) {
+        char buf[4096];
+        size_t n;
+        while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) json.append(buf, n);
+        std::fclose(f);
+    }
+    CHECK(json.find("\"name\":\"console\"") != std::string::npos);
+    CHECK(json.find("\"name\":\"serial_read\"") != std::string::npos);
+    CHECK(json.find("\"name\":\"ipc_poll\"") != std::string::npos);
+
+    std::remove(cfg.trace_path.c_str());
+    close(fd);
+    ctrl.stop();
+}
+
+TEST_CASE("config buses array") {
+    constexpr std::string_view BUS0 =
+        R"({"console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17}})";
+    constexpr std::string_view BUS1 =
+        R"({"console_read":{"gpio":5},"motor_write":{"gpio":6},"motor_read":{"gpio":13},)"
+        R"("journal":{"dir":"/tmp/bus1"}})";
+    std::vector<GpioConfig> buses;
+
+    // A single-bus file is one bus
+    CHECK(parse_bus_configs(BUS0, &buses).ok);
+    CHECK(buses.size() == 1);
+
+    auto r = parse_bus_configs(R"({"buses":[)" + std::string(BUS0) + "," + std::string(BUS1) + "]}", &buses);
+    CHECK(r.ok);
+    if (buses.size() == 2) {
+        CHECK(buses.at(0).motor_write == 22);
+        CHECK(buses.at(1).console_read == 5);
+        CHECK(buses.at(1).journal_dir == "/tmp/bus1");
+    }
+    CHECK(buses.size() == 2);
+
+    CHECK_FALSE(parse_bus_configs(R"({"buses":[]})", &buses).ok);
+    CHECK_FALSE(parse_bus_configs(R"({"buses":[)" + std::string(BUS0) + ",1]}", &buses).ok);
+    auto clash = parse_bus_configs(R"({"buses":[)" + std::string(BUS0) + "," + std::string(BUS0) + "]}", &buses);
+    CHECK_FALSE(clash.ok);
+    CHECK(clash.error == "bus 1: gpio 27 already used by another bus");
+    auto bad = parse_bus_configs(R"({"buses":[)" + std::string(BUS0) + R"(,{"console_read":{"gpio":5}}]})", &buses);
+    CHECK_FALSE(bad.ok);
+    CHECK(bad.error.rfind("bus 1: ", 0) == 0);
+}
+
+TEST_CASE("thread scheduling applies affinity and starts the controller") {
+    cpu_set_t before;
+    CHECK(pthread_getaffinity_np(pthread_self(), sizeof(before), &before) == 0);
+
+    ThreadSched pin{SchedPolicy::Other, 0, 0x1};
+    CHECK(apply_thread_sched(pthread_self(), pin, "test"));
+    cpu_set_t now;
+    CHECK(pthread_getaffinity_np(pthread_self(), sizeof(now), &now) == 0);
+    CHECK(CPU_COUNT(&now) == 1);
+    CHECK(CPU_ISSET(0, &now));
+    CHECK(pthread_setaffinity_np(pthread_self(), sizeof(before), &before) == 0);
+
+    // Every thread the controller spawns goes through the same path
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    cfg.console_sched = pin;
+    cfg.motor_sched = pin;
+    cfg.writer_sched = pin;
+    cfg.ipc_sched = pin;
+    cfg.emulate_sched = pin;
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    ctrl.mode().request_emulate(true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(ctrl.mode().is_emulating());
+    ctrl.mode().request_proxy(true);
+    ctrl.stop();
+}
+
+TEST_CASE("uploaded program runs on the emulate thread and finishes at zero") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    cfg.emu_cycle_ms = 200;
+    cfg.emu_burst_gap_ms = 40;
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    send_json(fd, "{\"cmd\":\"subscribe\",\"types\":[\"program\"]}");
+    read_available(fd, 50);
+
+    send_json(fd, "{\"cmd\":\"program\",\"segments\":[[0.3,2.0,1],[0.3,4.5,2]]}");
+    std::string events = read_available(fd, 150);
+    CHECK(ctrl.mode().is_emulating());
+    CHECK(ctrl.mode().speed_tenths() == 20);
+    CHECK(ctrl.mode().incline() == 2);
+
+    events += read_available(fd, 300);
+    CHECK(ctrl.mode().speed_tenths() == 45);
+    CHECK(ctrl.mode().incline() == 4);
+
+    events += read_available(fd, 400);
+    CHECK(events.find("\"state\":\"running\",\"segment\":0,\"segments\":2") != std::string::npos);
+    CHECK(events.find("\"state\":\"running\",\"segment\":1") != std::string::npos);
+    CHECK(events.find("\"state\":\"finished\"") != std::string::npos);
+    CHECK(ctrl.mode().is_emulating());
+    CHECK(ctrl.mode().speed_tenths() == 0);
+    CHECK(port.get_written_string().find("[hmph:1C2]\xff") != std::string::npos);  // 4.5 mph
+
+    close(fd);
+    ctrl.stop();
+}
+
+TEST_CASE("hr_zone steps the speed on the emulate thread and stops with emulate") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    cfg.emu_cycle_ms = 200;
+    cfg.emu_burst_gap_ms = 40;
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    send_json(fd, "{\"cmd\":\"subscribe\",\"types\":[\"hr_zone\"]}");
+    read_available(fd, 50);
+
+    // Heart rate under the band: into the bounds first, a step after the interval
+    send_json(fd, "{\"cmd\":\"hr\",\"bpm\":100}");
+    send_json(fd, "{\"cmd\":\"hr_zone\",\"low\":120,\"high\":140,\"min\":2.0,\"max\":3.0,"
+                  "\"step\":0.5,\"interval\":2}");
+    std::string events = read_available(fd, 300);
+    CHECK(ctrl.mode().is_emulating());
+    CHECK(ctrl.mode().speed_tenths() == 20);
+    CHECK(events.find("\"state\":\"running\",\"control\":\"speed\",\"hr\":100") != std::string::npos);
+
+    send_json(fd, "{\"cmd\":\"hr\",\"bpm\":100}");
+    read_available(fd, 1200);
+    send_json(fd, "{\"cmd\":\"hr\",\"bpm\":105}");
+    events = read_available(fd, 1000);
+    CHECK(ctrl.mode().speed_tenths() == 25);
+    CHECK(events.find("\"target\":25,\"steps\":2}") != std::string::npos);
+
+    send_json(fd, "{\"cmd\":\"proxy\",\"enabled\":true}");
+    events = read_available(fd, 150);
+    CHECK(events.find("\"state\":\"stopped\"") != std::string::npos);
+    CHECK_FALSE(ctrl.mode().is_emulating());
+
+    close(fd);
+    ctrl.stop();
+}
+
+TEST_CASE("a batch applies together and answers with one status event") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    send_json(fd, "{\"cmd\":\"subscribe\",\"types\":[\"status\"]}");
+    read_available(fd, 50);
+
+    send_json(fd, "{\"cmd\":\"batch\",\"commands\":[{\"cmd\":\"emulate\",\"enabled\":true},"
+                  "{\"cmd\":\"speed\",\"value\":3.0},{\"cmd\":\"incline\",\"value\":2}]}");
+    std::string events = read_available(fd, 150);
+    CHECK(count_of(events, "\"type\":\"status\"") == 1);
+    CHECK(events.find("\"emu_speed\":30") != std::string::npos);
+    CHECK(events.find("\"emu_incline\":4") != std::string::npos);
+    CHECK(ctrl.mode().is_emulating());
+    CHECK(ctrl.mode().speed_tenths() == 30);
+    CHECK(ctrl.mode().incline() == 4);
+    // The first burst already carries both targets
+    std::string wire = port.get_written_string();
+    CHECK(wire.find("[inc:4]\xff[hmph:12C]\xff") != std::string::npos);
+    CHECK(wire.find("[hmph:0]") == std::string::npos);
+
+    // A malformed batch changes nothing
+    send_json(fd, "{\"cmd\":\"batch\",\"commands\":[{\"cmd\":\"speed\",\"value\":5},{\"cmd\":\"quit\"}]}");
+    read_available(fd, 100);
+    CHECK(ctrl.mode().speed_tenths() == 30);
+
+    close(fd);
+    ctrl.mode().request_proxy(true);
+    ctrl.stop();
+}
+
+TEST_CASE("a command's seq is acked when applied and again when the motor echoes it") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    send_json(fd, "{\"cmd\":\"subscribe\",\"types\":[]}");
+    send_json(fd, "{\"cmd\":\"emulate\",\"enabled\":true}");
+    read_available(fd, 80);
+
+    send_json(fd, "{\"cmd\":\"speed\",\"value\":3.0,\"seq\":7}");
+    std::string events = read_available(fd, 150);
+    CHECK(events.find("{\"type\":\"ack\",\"seq\":7,\"stage\":\"applied\"}") != std::string::npos);
+    CHECK(events.find("\"stage\":\"motor\"") == std::string::npos);
+    CHECK(port.get_written_string().find("[hmph:12C]\xff") != std::string::npos);
+
+    // The motor's report of the new speed completes the second ack
+    port.inject_serial_data_pin(17, "[hmph:12C]\xff");
+    events = read_available(fd, 100);
+    CHECK(events.find("{\"type\":\"ack\",\"seq\":7,\"stage\":\"motor\",\"key\":\"hmph\",\"value\":30,") !=
+          std::string::npos);
+    CHECK(events.find("\"echo_us\":") != std::string::npos);
+
+    // Two incline commands before any echo: the first is superseded
+    send_json(fd, "{\"cmd\":\"incline\",\"value\":1,\"seq\":8}\n{\"cmd\":\"incline\",\"value\":2,\"seq\":9}");
+    events = read_available(fd, 150);
+    CHECK(events.find("{\"type\":\"ack\",\"seq\":8,\"stage\":\"superseded\",\"key\":\"inc\",\"value\":2}") !=
+          std::string::npos);
+    port.inject_serial_data_pin(17, "[inc:4]\xff");
+    events = read_available(fd, 100);
+    CHECK(events.find("{\"type\":\"ack\",\"seq\":9,\"stage\":\"motor\",\"key\":\"inc\",\"value\":4,") !=
+          std::string::npos);
+
+    // Out of emulate only the applied ack comes
+    send_json(fd, "{\"cmd\":\"proxy\",\"enabled\":true,\"seq\":10}");
+    events = read_available(fd, 100);
+    CHECK(events.find("{\"type\":\"ack\",\"seq\":10,\"stage\":\"applied\"}") != std::string::npos);
+
+    close(fd);
+    ctrl.stop();
+}
+
+TEST_CASE("bus_stats events time the proxied console's cycle") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    cfg.bus_stats_ms = 1000;
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    send_json(fd, "{\"cmd\":\"subscribe\",\"types\":[\"bus_stats\"]}");
+    read_available(fd, 50);
+
+    // Two quick console cycles, one burst start every 20 ms
+    constexpr std::array<const char*, EMU_BURSTS> starts = {"[inc:0]\xff", "[amps]\xff", "[vbus]\xff",
+                                                            "[part:6]\xff", "[diag:0]\xff"};
+    for (int c = 0; c < 2; c++) {
+        for (const char* frame : starts) {
+            port.inject_serial_data_pin(27, frame);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+    port.inject_serial_data_pin(27, "[inc:0]\xff");
+
+    std::string events = read_available(fd, 1100);
+    CHECK(events.find("\"type\":\"bus_stats\"") != std::string::npos);
+    CHECK(events.find("\"cycles\":2") != std::string::npos);
+    CHECK(events.find("\"gap_us\":[") != std::string::npos);
+    CHECK(events.find("\"console_idle_pct\":") != std::string::npos);
+
+    close(fd);
+    ctrl.stop();
+}
+
+TEST_CASE("cycles mode sends each source's bus cycle as one cycle event") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    cfg.cycle_events = true;
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    send_json(fd, "{\"cmd\":\"subscribe\",\"types\":[\"cycle\"]}");
+    read_available(fd, 50);
+
+    // A console cycle goes out when the next one starts
+    port.inject_serial_data_pin(27, "[inc:0]\xff[hmph:0]\xff");
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    port.inject_serial_data_pin(27, "[amps]\xff[err]\xff[belt]\xff");
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    port.inject_serial_data_pin(27, "[inc:0]\xff");
+    std::string events = read_available(fd, 200);
+    CHECK(events.find("\"source\":\"console\",\"count\":5,\"keys\":[\"inc\",\"hmph\",\"amps\",\"err\",\"belt\"],"
+                      "\"values\":[\"0\",\"0\",\"\",\"\",\"\"],\"dt_us\":[0,") != std::string::npos);
+
+    // Emulate: one event per cycle, all 14 keys, and no kv events
+    send_json(fd, "{\"cmd\":\"speed\",\"value\":2.0}");
+    events = read_available(fd, 1500);
+    CHECK(events.find("\"source\":\"emulate\",\"count\":14,\"keys\":[\"inc\",\"hmph\",\"amps\"") !=
+          std::string::npos);
+    CHECK(events.find("\"values\":[\"0\",\"C8\",") != std::string::npos);
+    CHECK(events.find("\"type\":\"kv\"") == std::string::npos);
+
+    close(fd);
+    ctrl.stop();
+}
+
+TEST_CASE("lazy_console parses only what subscribers need, and still auto-proxies") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    cfg.lazy_console = true;
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // Nobody wants console kv events: bare queries go unparsed
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    send_json(fd, "{\"cmd\":\"subscribe\",\"types\":[\"status\",\"metrics\"]}");
+    read_available(fd, 50);
+    port.inject_serial_data_pin(27, "[amps]\xff[belt]\xff[inc:0]\xff");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    send_json(fd, "{\"cmd\":\"metrics\"}");
+    std::string data = read_available(fd, 100);
+    CHECK(data.find("\"source\":\"console\",\"bytes\":22,\"frames\":1,") != std::string::npos);
+    CHECK(data.find("\"skipped\":2}") != std::string::npos);
+
+    // The physical buttons still win over emulate
+    send_json(fd, "{\"cmd\":\"speed\",\"value\":3.0}");
+    read_available(fd, 100);
+    CHECK(ctrl.mode().is_emulating());
+    port.inject_serial_data_pin(27, "[hmph:78]\xff");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    port.inject_serial_data_pin(27, "[hmph:96]\xff");
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    CHECK_FALSE(ctrl.mode().is_emulating());
+
+    // A client wanting everything brings full parsing back
+    int all = connect_ipc();
+    CHECK(all >= 0);
+    read_available(all, 80);
+    port.inject_serial_data_pin(27, "[amps]\xff");
+    std::string events = read_available(all, 150);
+    CHECK(events.find("\"source\":\"console\",\"key\":\"amps\"") != std::string::npos);
+
+    close(all);
+    close(fd);
+    ctrl.stop();
+}
+
+TEST_CASE("reactor mode proxies, emulates and serves IPC on one thread") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    cfg.reactor = true;
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    int before = thread_count();
+    CHECK(ctrl.start());
+    CHECK(thread_count() == before + 2);  // the loop and the motor writer
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    read_available(fd, 80);
+
+    // Console bytes are forwarded and published
+    port.inject_serial_data_pin(27, "[hmph:78]\xff");
+    std::string data = read_available(fd, 100);
+    CHECK(port.get_written_string().find("[hmph:78]") != std::string::npos);
+    CHECK(data.find("\"source\":\"console\",\"key\":\"hmph\"") != std::string::npos);
+
+    // Emulate bursts come from the same loop
+    send_json(fd, "{\"cmd\":\"speed\",\"value\":2.0}");
+    data = read_available(fd, 700);
+    CHECK(ctrl.mode().is_emulating());
+    CHECK(data.find("\"source\":\"emulate\",\"key\":\"hmph\",\"value\":\"C8\"") != std::string::npos);
+    CHECK(data.find("\"source\":\"emulate\",\"key\":\"loop\"") != std::string::npos);
+    send_json(fd, "{\"cmd\":\"stats\"}");
+    data = read_available(fd, 100);
+    CHECK(data.find("\"type\":\"emu_stats\",\"cycles\":") != std::string::npos);
+    CHECK(data.find("\"cycles\":0,") == std::string::npos);
+
+    // The physical buttons still take over
+    port.inject_serial_data_pin(27, "[hmph:96]\xff");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK_FALSE(ctrl.mode().is_emulating());
+
+    close(fd);
+    ctrl.stop();
+}
+
+TEST_CASE("reactor mode keeps the heartbeat watchdog") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    cfg.reactor = true;
+
+    VirtualClock clock;
+    TreadmillController<MockGpioPort, VirtualClock> ctrl(port, cfg, clock);
+    CHECK(ctrl.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    read_available(fd, 80);
+    send_json(fd, "{\"cmd\":\"speed\",\"value\":2.0}");
+    read_available(fd, 100);
+    CHECK(ctrl.mode().is_emulating());
+
+    clock.advance(std::chrono::milliseconds(HEARTBEAT_TIMEOUT_SEC * 1000 - 100));
+    read_available(fd, 30);
+    CHECK(ctrl.mode().is_emulating());
+
+    clock.advance(std::chrono::milliseconds(200));
+    read_available(fd, 30);
+    CHECK_FALSE(ctrl.mode().is_emulating());
+    CHECK(ctrl.mode().speed_tenths() == 0);
+
+    close(fd);
+    ctrl.stop();
+}
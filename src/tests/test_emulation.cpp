@@ -11,6 +11,8 @@
 #include <thread>
 #include <chrono>
 #include <vector>
+#include <mutex>
+#include <atomic>
 #include <string>
 
 TEST_CASE("emulation engine sends 14-key cycle") {
@@ -178,3 +180,397 @@ TEST_CASE("emulation engine start/stop lifecycle") {
 
     // Destructor should also handle stop gracefully
 }
+
+TEST_CASE("emulation engine chains each burst and reuses cached waves") {
+    MockGpioPort port;
+    port.initialise();
+
+    ModeStateMachine mode;
+    mode.set_emulate_callback([](bool) {});
+    mode.request_emulate(true);
+
+    SerialWriter<MockGpioPort> writer(port, 22);
+    EmulationEngine<MockGpioPort> engine(writer, mode);
+
+    engine.start();
+    // Two full cycles (5 bursts * 100ms each)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1150));
+    engine.stop();
+
+    CHECK(port.chain_sends >= 10);
+    CHECK(port.chain_sends == static_cast<int>(port.wave_writes.size()));
+    // Speed/incline are constant, so the second cycle builds no waves
+    CHECK(port.waves_created == 14);
+
+    std::string out = port.get_written_string();
+    CHECK(out.rfind("[inc:0]\xff[hmph:0]\xff", 0) == 0);
+    CHECK(out.find("[vbus]\xff[lift]\xff[lfts]\xff[lftg]\xff") != std::string::npos);
+}
+
+TEST_CASE("emulation engine paces cycles on absolute deadlines") {
+    MockGpioPort port;
+    port.initialise();
+
+    ModeStateMachine mode;
+    mode.set_emulate_callback([](bool) {});
+    mode.request_emulate(true);
+
+    SerialWriter<MockGpioPort> writer(port, 22);
+    EmulationEngine<MockGpioPort> engine(writer, mode, EmuTiming{200, 30});
+    CHECK(engine.stats().cycles == 0);
+
+    // Slow writes eat into each gap but must not stretch the period
+    std::vector<int64_t> burst_ms;
+    auto t0 = std::chrono::steady_clock::now();
+    engine.on_kv_event([&](std::string_view key, std::string_view) {
+        if (key == "inc" || key == "amps" || key == "vbus" || key == "part" || key == "diag") {
+            burst_ms.push_back(std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - t0).count());
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+
+    engine.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1050));
+    engine.stop();
+
+    auto st = engine.stats();
+    CHECK(st.cycles >= 5);
+    CHECK(st.target_us == 200000);
+    CHECK(st.mean_us == doctest::Approx(200000).epsilon(0.05));
+    CHECK(st.max_us >= st.p99_us);
+    CHECK(st.p99_us >= 190000);
+
+    // Bursts start on the 30 ms grid within each cycle
+    CHECK(burst_ms.size() >= 5);
+    if (burst_ms.size() >= 5) {
+        for (size_t i = 1; i < 5; i++) {
+            CHECK(burst_ms.at(i) - burst_ms.at(0) == doctest::Approx(30.0 * i).epsilon(0.2));
+        }
+    }
+}
+
+TEST_CASE("a speed change goes out at once, between scheduled bursts") {
+    MockGpioPort port;
+    port.initialise();
+
+    ModeStateMachine mode;
+    mode.set_emulate_callback([](bool) {});
+    mode.request_emulate(true);
+
+    SerialWriter<MockGpioPort> writer(port, 22);
+    EmulationEngine<MockGpioPort> engine(writer, mode, EmuTiming{2000, 400});
+
+    std::mutex mu;
+    std::vector<std::string> sent;
+    std::chrono::steady_clock::time_point hmph_at{};
+    engine.on_kv_event([&](std::string_view key, std::string_view value) {
+        std::lock_guard<std::mutex> lk(mu);
+        sent.push_back(std::string(key) + ":" + std::string(value));
+        if (key == "hmph" && value == "1F4") hmph_at = std::chrono::steady_clock::now();
+    });
+
+    engine.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));  // after burst 0
+    auto t0 = std::chrono::steady_clock::now();
+    mode.set_speed(50);  // 5.0 mph = 0x1F4 hundredths
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));  // bursts 1 (400 ms) only
+    engine.stop();
+
+    std::lock_guard<std::mutex> lk(mu);
+    CHECK(hmph_at != std::chrono::steady_clock::time_point{});
+    CHECK(hmph_at - t0 < std::chrono::milliseconds(50));
+    CHECK(engine.stats().injected == 1);
+
+    // Burst 0, the injected hmph alone (incline unchanged), then burst 1
+    std::vector<std::string> want = { "inc:0", "hmph:0", "hmph:1F4", "amps", "err", "belt" };
+    CHECK(sent.size() >= want.size());
+    for (size_t i = 0; i < want.size() && i < sent.size(); i++) {
+        CHECK(sent.at(i).substr(0, want.at(i).size()) == want.at(i));
+    }
+}
+
+TEST_CASE("rates send setpoints every burst and identity keys every Nth cycle") {
+    MockGpioPort port;
+    port.initialise();
+
+    ModeStateMachine mode;
+    mode.set_emulate_callback([](bool) {});
+    mode.request_emulate(true);
+
+    EmuRates rates = EMU_DEFAULT_RATES;
+    rates.at(0) = rates.at(1) = EMU_EVERY_BURST;                        // inc, hmph
+    rates.at(9) = rates.at(10) = rates.at(11) = 3;                      // part, ver, type
+    SerialWriter<MockGpioPort> writer(port, 22);
+    EmulationEngine<MockGpioPort> engine(writer, mode, EmuTiming{100, 15, rates});
+
+    std::mutex mu;
+    std::vector<std::string> keys;
+    engine.on_kv_event([&](std::string_view key, std::string_view) {
+        std::lock_guard<std::mutex> lk(mu);
+        keys.emplace_back(key);
+    });
+
+    engine.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(350));
+    engine.stop();
+
+    std::lock_guard<std::mutex> lk(mu);
+    std::vector<std::string> want = {
+        // cycle 0: identity due
+        "inc", "hmph",  "inc", "hmph", "amps", "err", "belt",  "inc", "hmph", "vbus", "lift", "lfts", "lftg",
+        "inc", "hmph", "part", "ver", "type",  "inc", "hmph", "diag", "loop",
+        // cycle 1: burst 3 is only the setpoints
+        "inc", "hmph",  "inc", "hmph", "amps", "err", "belt",  "inc", "hmph", "vbus", "lift", "lfts", "lftg",
+        "inc", "hmph",  "inc", "hmph", "diag", "loop",
+    };
+    CHECK(keys.size() >= want.size());
+    for (size_t i = 0; i < want.size() && i < keys.size(); i++) CHECK(keys.at(i) == want.at(i));
+
+    // Setpoints already go out every burst: nothing to inject
+    CHECK(engine.stats().injected == 0);
+}
+
+// ── Virtual time ────────────────────────────────────────────────────
+
+// Poll `done` for up to `ms` of real time
+template <typename Pred>
+static bool eventually(Pred done, int ms = 1000) {
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > until) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+TEST_CASE("bursts follow the virtual clock, not real time") {
+    MockGpioPort port;
+    port.initialise();
+
+    ModeStateMachine mode;
+    mode.set_emulate_callback([](bool) {});
+    mode.request_emulate(true);
+
+    VirtualClock clock;
+    SerialWriter<MockGpioPort> writer(port, 22);
+    EmulationEngine<MockGpioPort, SerialWriter<MockGpioPort>, VirtualClock> engine(writer, mode, {}, clock);
+
+    std::atomic<int> keys{0};
+    engine.on_kv_event([&](std::string_view, std::string_view) { keys++; });
+
+    engine.start();
+    CHECK(eventually([&] { return keys == 2; }));  // burst 0: inc, hmph
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    CHECK(keys == 2);  // frozen clock: burst 1 never comes due
+
+    clock.advance(std::chrono::milliseconds(400));  // bursts 1-4, not the next cycle
+    CHECK(eventually([&] { return keys == 14; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(keys == 14);
+
+    clock.advance(std::chrono::milliseconds(100));
+    CHECK(eventually([&] { return keys == 16; }));
+    engine.stop();
+    CHECK(engine.stats().cycles == 2);
+    CHECK(engine.stats().mean_us == doctest::Approx(500000));
+}
+
+TEST_CASE("3-hour safety timeout resets speed and incline") {
+    MockGpioPort port;
+    port.initialise();
+
+    ModeStateMachine mode;
+    mode.set_emulate_callback([](bool) {});
+    mode.request_emulate(true);
+    mode.set_speed(30);
+    mode.set_incline(4);
+
+    VirtualClock clock;
+    SerialWriter<MockGpioPort> writer(port, 22);
+    EmulationEngine<MockGpioPort, SerialWriter<MockGpioPort>, VirtualClock> engine(writer, mode, {}, clock);
+
+    std::mutex mu;
+    std::string last_hmph;
+    engine.on_kv_event([&](std::string_view key, std::string_view value) {
+        std::lock_guard<std::mutex> lk(mu);
+        if (key == "hmph") last_hmph = value;
+    });
+    auto hmph = [&] {
+        std::lock_guard<std::mutex> lk(mu);
+        return last_hmph;
+    };
+
+    engine.start();
+    CHECK(eventually([&] { return hmph() == "12C"; }));  // 3.0 mph
+
+    // A second short of the limit, nothing happens
+    clock.advance(std::chrono::seconds(EMU_TIMEOUT_SEC - 1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    CHECK(mode.speed_tenths() == 30);
+
+    // A change restarts the countdown
+    mode.set_speed(35);
+    clock.advance(std::chrono::seconds(2));
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    CHECK(mode.speed_tenths() == 35);
+
+    clock.advance(std::chrono::seconds(EMU_TIMEOUT_SEC));
+    CHECK(eventually([&] { return mode.speed_tenths() == 0 && mode.incline() == 0; }));
+    CHECK(mode.is_emulating());
+    CHECK(eventually([&] { return hmph() == "0"; }));
+    engine.stop();
+}
+
+TEST_CASE("an external engine sends what is due each time its owner calls") {
+    MockGpioPort port;
+    port.initialise();
+
+    ModeStateMachine mode;
+    mode.set_emulate_callback([](bool) {});
+    mode.request_emulate(true);
+
+    VirtualClock clock;
+    SerialWriter<MockGpioPort> writer(port, 22);
+    EmulationEngine<MockGpioPort, SerialWriter<MockGpioPort>, VirtualClock> engine(writer, mode, {}, clock);
+    engine.set_external(true);
+
+    std::vector<std::string> keys;
+    int cycle_ends = 0;
+    engine.on_kv_event([&](std::string_view key, std::string_view) { keys.emplace_back(key); });
+    engine.on_cycle_end([&] { cycle_ends++; });
+
+    engine.start();
+    CHECK(engine.is_running());
+    CHECK(keys.empty());  // no thread: nothing until run_due()
+
+    int64_t due = engine.run_due();
+    CHECK(keys.size() == 2);  // burst 0: inc, hmph
+    CHECK(due == clock.now_ns() + 100000000LL);
+    CHECK(engine.run_due() == due);  // burst 1 isn't due yet
+    CHECK(keys.size() == 2);
+
+    // A change goes out on the next call, between the scheduled bursts
+    mode.set_speed(30);
+    CHECK(engine.run_due() == due);
+    CHECK(keys.size() == 3);
+    if (keys.size() == 3) CHECK(keys.back() == "hmph");
+
+    // Bursts 1-4, one a call while each is overdue, then the next cycle's wait
+    clock.advance(std::chrono::milliseconds(400));
+    int calls = 0;
+    while (engine.run_due() <= clock.now_ns() && calls < 10) calls++;
+    CHECK(calls == 3);
+    CHECK(keys.size() == 15);
+    CHECK(cycle_ends == 1);
+    CHECK(engine.stats().cycles == 1);
+
+    engine.stop();
+    CHECK(cycle_ends == 2);
+    CHECK_FALSE(engine.is_running());
+    CHECK(engine.run_due() == -1);
+
+    // Leaving emulate ends the run at the next call
+    engine.start();
+    engine.run_due();
+    mode.request_emulate(false);
+    CHECK(engine.run_due() == -1);
+    CHECK_FALSE(engine.is_running());
+    CHECK(cycle_ends == 3);
+}
+
+TEST_CASE("a paced engine sends the next burst once the motor has answered") {
+    MockGpioPort port;
+    port.initialise();
+
+    ModeStateMachine mode;
+    mode.set_emulate_callback([](bool) {});
+    mode.request_emulate(true);
+
+    VirtualClock clock;
+    SerialWriter<MockGpioPort> writer(port, 22);
+    EmuTiming timing;
+    timing.paced = true;
+    timing.min_gap_ms = 20;
+    EmulationEngine<MockGpioPort, SerialWriter<MockGpioPort>, VirtualClock> engine(writer, mode, timing, clock);
+    engine.set_external(true);
+
+    std::vector<std::string> keys;
+    engine.on_kv_event([&](std::string_view key, std::string_view) { keys.emplace_back(key); });
+    auto ms = [](int n) { return n * 1000000LL; };
+
+    engine.start();
+    int64_t t0 = clock.now_ns();
+    CHECK(engine.run_due() == t0 + ms(100));  // burst 0 out; burst_gap_ms at the latest
+    CHECK(keys.size() == 2);
+    CHECK(engine.stats().target_us == 0);  // no fixed cycle
+
+    // Half answered: still waiting
+    clock.advance(std::chrono::milliseconds(10));
+    engine.motor_reported(KvKey::Hmph);
+    engine.motor_reported(KvKey::Amps);  // not asked
+    CHECK(engine.run_due() == t0 + ms(100));
+    CHECK(keys.size() == 2);
+
+    // All answered within the minimum gap: due at the gap
+    engine.motor_reported(KvKey::Inc);
+    CHECK(engine.run_due() == t0 + ms(20));
+    clock.advance(std::chrono::milliseconds(10));
+    engine.run_due();
+    CHECK(keys.size() == 5);  // burst 1: amps, err, belt
+
+    // No answers: burst_gap_ms later anyway, counted as a timeout
+    clock.advance(std::chrono::milliseconds(99));
+    engine.run_due();
+    CHECK(keys.size() == 5);
+    clock.advance(std::chrono::milliseconds(1));
+    engine.run_due();
+    CHECK(keys.size() == 9);  // burst 2: vbus, lift, lfts, lftg
+    CHECK(engine.stats().timeouts == 1);
+
+    // Answered after the minimum gap: the next burst goes at once
+    clock.advance(std::chrono::milliseconds(30));
+    for (KvKey k : {KvKey::Vbus, KvKey::Lift, KvKey::Lfts, KvKey::Lftg}) engine.motor_reported(k);
+    engine.run_due();
+    CHECK(keys.size() == 12);  // burst 3: part, ver, type
+    CHECK(engine.stats().timeouts == 1);
+    engine.stop();
+}
+
+TEST_CASE("the motor's last answer wakes a paced emulate thread") {
+    MockGpioPort port;
+    port.initialise();
+
+    ModeStateMachine mode;
+    mode.set_emulate_callback([](bool) {});
+    mode.request_emulate(true);
+
+    SerialWriter<MockGpioPort> writer(port, 22);
+    EmuTiming timing;
+    timing.paced = true;
+    timing.burst_gap_ms = 1000;
+    timing.min_gap_ms = 0;
+    EmulationEngine<MockGpioPort> engine(writer, mode, timing);
+
+    std::atomic<int> keys{0};
+    engine.on_kv_event([&](std::string_view, std::string_view) { keys.fetch_add(1); });
+    auto wait_keys = [&](int n) {
+        auto t0 = std::chrono::steady_clock::now();
+        while (keys.load() < n && std::chrono::steady_clock::now() - t0 < std::chrono::seconds(2)) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        return std::chrono::steady_clock::now() - t0;
+    };
+
+    engine.start();
+    wait_keys(2);  // burst 0: inc, hmph
+    CHECK(keys.load() == 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));  // the thread is asleep again
+    engine.motor_reported(KvKey::Inc);
+    engine.motor_reported(KvKey::Hmph);
+    // Well inside the 100 ms stop() slice the thread would otherwise sleep
+    auto took = wait_keys(5);
+    CHECK(keys.load() == 5);
+    CHECK(took < std::chrono::milliseconds(50));
+    engine.stop();
+}
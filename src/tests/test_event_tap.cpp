@@ -0,0 +1,222 @@
+/*
+ * test_event_tap.cpp — Tests for the shared-memory event ring
+ *
+ * Uses its own shm name so a running treadmill_io is left alone, except
+ * for the host tests, which check the real tap name.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "event_tap.h"
+#include "gpio_mock.h"
+#include "bus_host.h"
+#include <array>
+#include <chrono>
+#include <csignal>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+constexpr const char* TEST_TAP = "/treadmill_io.test_events";
+
+static std::string read_at(const EventTapReader& r, uint64_t seq) {
+    std::array<char, EventRing::msg_size()> buf;
+    auto res = r.ring().read(seq, buf);
+    if (res.status != RingRead::Ok) return {};
+    return std::string(buf.data(), res.len);
+}
+
+TEST_CASE("a reader maps the writer's ring and sees its messages") {
+    EventTapReader none;
+    CHECK_FALSE(none.open(TEST_TAP));
+
+    EventTap tap(TEST_TAP);
+    CHECK(tap.shared());
+    tap.ring().push("before");
+
+    EventTapReader reader;
+    CHECK(reader.open(TEST_TAP));
+    CHECK(reader.pid() == static_cast<uint32_t>(getpid()));
+    CHECK_FALSE(reader.closed());
+    CHECK(reader.ring().snapshot().count == 1);
+    CHECK(read_at(reader, 0) == "before");
+
+    // Nothing new: wait gives up at the timeout
+    auto t0 = std::chrono::steady_clock::now();
+    CHECK_FALSE(reader.wait(1, 30));
+    CHECK(std::chrono::steady_clock::now() - t0 >= std::chrono::milliseconds(25));
+
+    // A push from another thread wakes it; the reader is counted while it waits
+    CHECK(tap.waiters() == 0);
+    std::thread producer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK(tap.waiters() == 1);
+        tap.ring().push("after");
+    });
+    CHECK(reader.wait(1, 2000));
+    producer.join();
+    CHECK(read_at(reader, 1) == "after");
+    CHECK(tap.waiters() == 0);
+}
+
+TEST_CASE("the object is the owner's, or its group's too") {
+    struct stat st{};
+    {
+        EventTap tap(TEST_TAP);
+        int fd = shm_open(TEST_TAP, O_RDONLY, 0);
+        CHECK(fd >= 0);
+        if (fd >= 0 && fstat(fd, &st) == 0) CHECK((st.st_mode & 0777) == 0600);
+        if (fd >= 0) close(fd);
+    }
+    {
+        EventTap tap(TEST_TAP, true);
+        int fd = shm_open(TEST_TAP, O_RDONLY, 0);
+        CHECK(fd >= 0);
+        if (fd >= 0 && fstat(fd, &st) == 0) CHECK((st.st_mode & 0777) == 0660);
+        if (fd >= 0) close(fd);
+    }
+
+    // No name: a heap ring, nothing for a reader
+    EventTap heap(nullptr);
+    CHECK_FALSE(heap.shared());
+    heap.ring().push("private");
+    CHECK(heap.ring().snapshot().count == 1);
+    EventTapReader reader;
+    CHECK_FALSE(reader.open(TEST_TAP));
+}
+
+TEST_CASE("another process blocked on the futex wakes on a commit") {
+    EventTap tap(TEST_TAP);
+    CHECK(tap.shared());
+    pid_t child = fork();
+    if (child == 0) {
+        EventTapReader reader;
+        bool ok = reader.open(TEST_TAP) && reader.wait(0, 2000) && read_at(reader, 0) == "hello";
+        _exit(ok ? 0 : 1);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    tap.ring().push("hello");
+    int status = 0;
+    CHECK(waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status));
+    if (WIFEXITED(status)) CHECK(WEXITSTATUS(status) == 0);
+}
+
+TEST_CASE("a reader killed while blocked is reaped once its lease runs out") {
+    EventTap tap(TEST_TAP);
+    CHECK(tap.shared());
+    pid_t child = fork();
+    if (child == 0) {
+        EventTapReader reader;
+        if (reader.open(TEST_TAP)) reader.wait(0, -1);
+        _exit(1);
+    }
+    for (int i = 0; i < 200 && tap.waiters() == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    CHECK(tap.waiters() == 1);
+    kill(child, SIGKILL);
+    int status = 0;
+    CHECK(waitpid(child, &status, 0) == child);
+    CHECK(tap.waiters() == 1);
+
+    // Not before the lease ends
+    CHECK(tap.reap_waiters(mono_us()) == 0);
+    CHECK(tap.waiters() == 1);
+    CHECK(tap.reap_waiters(mono_us() + EVENT_TAP_LEASE_MS * 1000ULL) == 1);
+    CHECK(tap.waiters() == 0);
+}
+
+TEST_CASE("a live reader whose lease was reaped counts itself again") {
+    EventTap tap(TEST_TAP);
+    EventTapReader reader;
+    CHECK(reader.open(TEST_TAP));
+    bool woke = false;
+    std::thread waiter([&] { woke = reader.wait(0, 5000); });
+    for (int i = 0; i < 200 && tap.waiters() == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    CHECK(tap.reap_waiters(mono_us() + EVENT_TAP_LEASE_MS * 1000ULL) == 1);
+    CHECK(tap.waiters() == 0);
+    // Back at its next slice
+    for (int i = 0; i < 300 && tap.waiters() == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    CHECK(tap.waiters() == 1);
+    tap.ring().push("late");
+    waiter.join();
+    CHECK(woke);
+    CHECK(tap.waiters() == 0);
+}
+
+TEST_CASE("a successor takes the name; the predecessor closes without unlinking it") {
+    EventTapReader old_reader;
+    auto first = std::make_unique<EventTap>(TEST_TAP);
+    CHECK(old_reader.open(TEST_TAP));
+    first->ring().push("old");
+
+    EventTap second(TEST_TAP);
+    second.ring().push("new");
+    std::thread closer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        first.reset();
+    });
+    // A waiting reader of the old ring is released when it closes
+    CHECK_FALSE(old_reader.wait(1, 2000));
+    closer.join();
+    CHECK(old_reader.closed());
+    CHECK(read_at(old_reader, 0) == "old");  // still mapped
+
+    EventTapReader reader;
+    CHECK(reader.open(TEST_TAP));
+    CHECK_FALSE(reader.closed());
+    CHECK(read_at(reader, 0) == "new");
+}
+
+TEST_CASE("a bus host's events reach a tap reader") {
+    MockGpioPort port;
+    port.initialise();
+    std::array<GpioConfig, 1> cfg{};
+    cfg.at(0).console_read = 27;
+    cfg.at(0).motor_write = 22;
+    cfg.at(0).motor_read = 17;
+    {
+        // Off by default: the ring stays on the heap
+        BusHost<MockGpioPort> host(port, cfg);
+        CHECK(host.start());
+        EventTapReader reader;
+        CHECK_FALSE(reader.open());
+        host.stop();
+    }
+
+    cfg.at(0).event_tap = true;
+    BusHost<MockGpioPort> host(port, cfg);
+    CHECK(host.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    EventTapReader reader;
+    CHECK(reader.open());
+    uint64_t from = reader.ring().snapshot().count;
+    port.inject_serial_data_pin(17, "[belt:7]");
+    CHECK(reader.wait(from, 2000));
+
+    // Records expand to the JSON a socket client would get
+    bool seen = false;
+    std::array<char, RECORD_JSON_MAX> json;
+    for (uint64_t seq = from; seq < reader.ring().snapshot().count; seq++) {
+        std::string msg = read_at(reader, seq);
+        size_t n = ring_message_to_json(json, msg);
+        std::string_view line(json.data(), n);
+        if (line.find("{\"type\":\"kv\",\"ts\":") == 0 && line.find("\"value\":\"7\"") != std::string_view::npos) {
+            seen = true;
+        }
+    }
+    CHECK(seen);
+
+    host.stop();
+}
@@ -0,0 +1,195 @@
+/*
+ * test_handoff.cpp — Tests for restart handoff (handoff.h)
+ *
+ * LISTEN_* parsing, the state blob, FDSTORE messages sent to a fake
+ * service manager socket, and sorting inherited fds into a listener,
+ * state and clients.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "handoff.h"
+#include "metrics.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static HandoffState sample_state(uint64_t saved_us) {
+    HandoffState st{};
+    st.saved_us = saved_us;
+    st.buses = 2;
+    st.bus.at(1) = HandoffBus{false, true, 35, 8, 1000, 2000, 3000};
+    return st;
+}
+
+// Datagram socket standing in for systemd's $NOTIFY_SOCKET
+struct FakeManager {
+    int fd = -1;
+    std::string path = "/tmp/test_handoff_notify." + std::to_string(getpid());
+
+    FakeManager() {
+        unlink(path.c_str());
+        fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        struct sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        setenv("NOTIFY_SOCKET", path.c_str(), 1);
+    }
+    ~FakeManager() {
+        unsetenv("NOTIFY_SOCKET");
+        close(fd);
+        unlink(path.c_str());
+    }
+
+    // One message: its text, and the fds it carried
+    std::string receive(std::vector<int>* fds) {
+        std::array<char, 256> text{};
+        std::array<char, CMSG_SPACE(sizeof(int) * 8)> control{};
+        struct iovec iov{text.data(), text.size()};
+        struct msghdr mh{};
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = control.data();
+        mh.msg_controllen = control.size();
+        ssize_t n = recvmsg(fd, &mh, MSG_DONTWAIT);
+        if (n < 0) return {};
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+            if (cm->cmsg_type != SCM_RIGHTS) continue;
+            size_t count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; i++) {
+                int got;
+                std::memcpy(&got, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+                fds->push_back(got);
+            }
+        }
+        return std::string(text.data(), static_cast<size_t>(n));
+    }
+};
+
+TEST_CASE("listen fds are ours only when LISTEN_PID matches") {
+    auto fds = parse_listen_fds("42", "3", "ipc:handoff:client", 42);
+    CHECK(fds.size() == 3);
+    if (fds.size() == 3) {
+        CHECK(fds[0].fd == SD_LISTEN_FDS_START);
+        CHECK(fds[0].name == "ipc");
+        CHECK(fds[2].fd == SD_LISTEN_FDS_START + 2);
+        CHECK(fds[2].name == "client");
+    }
+
+    CHECK(parse_listen_fds("41", "3", "ipc:handoff:client", 42).empty());
+    CHECK(parse_listen_fds(nullptr, "1", nullptr, 42).empty());
+    CHECK(parse_listen_fds("42", "x", nullptr, 42).empty());
+    CHECK(parse_listen_fds("42", "0", nullptr, 42).empty());
+
+    auto unnamed = parse_listen_fds("42", "1", nullptr, 42);
+    CHECK(unnamed.size() == 1);
+    if (unnamed.size() == 1) CHECK(unnamed[0].name == "unknown");
+}
+
+TEST_CASE("state blob round-trips and goes stale") {
+    std::array<char, 2048> blob{};
+    auto st = sample_state(1000000);
+    size_t n = encode_handoff(blob, st);
+    CHECK(n > sizeof(HandoffState));
+
+    auto back = decode_handoff(std::span<const char>(blob.data(), n), 1000000 + 100000);
+    CHECK(back.has_value());
+    if (back) {
+        CHECK(back->buses == 2);
+        CHECK(back->bus.at(1).emulate);
+        CHECK(back->bus.at(1).speed_tenths == 35);
+        CHECK(back->bus.at(1).belt_on_us == 3000);
+    }
+
+    CHECK_FALSE(decode_handoff(std::span<const char>(blob.data(), n), 1000000 + HANDOFF_MAX_AGE_MS * 1000 + 1));
+    CHECK_FALSE(decode_handoff(std::span<const char>(blob.data(), n - 1), 1000000));
+    blob[0] = 'X';
+    CHECK_FALSE(decode_handoff(std::span<const char>(blob.data(), n), 1000000));
+    CHECK(encode_handoff(std::span<char>(blob.data(), 8), st) == 0);
+}
+
+TEST_CASE("clients are matched to their entries by socket identity") {
+    int pair[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    HandoffState st{};
+    IpcSubscription sub;
+    sub.types = 2;
+    auto entry = handoff_client({pair[0], sub, true});
+    CHECK(entry.has_value());
+    if (!entry) return;
+    st.client.at(0) = *entry;
+    st.clients = 1;
+
+    int dup_fd = dup(pair[0]);  // as systemd hands it back: another fd, same socket
+    CHECK(find_handoff_client(st, dup_fd) == 0);
+    CHECK(find_handoff_client(st, pair[1]) == -1);
+    close(dup_fd);
+    close(pair[0]);
+    close(pair[1]);
+}
+
+TEST_CASE("parking sends clients then the state blob to the fd store") {
+    FakeManager mgr;
+    CHECK(has_service_manager());
+    int pair[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+
+    uint64_t now = mono_us();
+    CHECK(park_for_successor(sample_state(now), std::span<const int>(&pair[0], 1)));
+
+    std::vector<int> fds;
+    CHECK(mgr.receive(&fds) == "FDSTORE=1\nFDNAME=client");
+    CHECK(fds.size() == 1);
+    std::vector<int> blob_fds;
+    CHECK(mgr.receive(&blob_fds) == "FDSTORE=1\nFDNAME=handoff");
+    CHECK(blob_fds.size() == 1);
+    if (blob_fds.size() == 1) {
+        auto st = read_handoff_fd(blob_fds[0], now);
+        CHECK(st.has_value());
+        if (st) CHECK(st->bus.at(1).incline == 8);
+    }
+
+    // The successor takes both and clears them from the store
+    std::vector<InheritedFd> inherited = {{-1, "ipc"}};
+    for (int fd : fds) inherited.push_back({fd, "client"});
+    for (int fd : blob_fds) inherited.push_back({fd, "handoff"});
+    auto in = collect_inherited(inherited, now);
+    CHECK(in.listen_fd == -1);
+    CHECK(in.state.has_value());
+    CHECK(in.clients == fds);
+    std::vector<int> none;
+    CHECK(mgr.receive(&none) == "FDSTOREREMOVE=1\nFDNAME=handoff");
+    CHECK(mgr.receive(&none) == "FDSTOREREMOVE=1\nFDNAME=client");
+
+    for (int fd : in.clients) close(fd);
+    close(pair[0]);
+    close(pair[1]);
+}
+
+TEST_CASE("clients without usable state are closed") {
+    int pair[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    HandoffState stale = sample_state(1);
+    int blob = handoff_memfd(stale);
+    CHECK(blob >= 0);
+
+    std::vector<InheritedFd> inherited = {{pair[0], "client"}, {blob, "handoff"}};
+    auto in = collect_inherited(inherited, mono_us());
+    CHECK_FALSE(in.state.has_value());
+    CHECK(in.clients.empty());
+
+    // Our end of the pair sees the hangup
+    char c;
+    CHECK(read(pair[1], &c, 1) == 0);
+    close(pair[1]);
+
+    CHECK_FALSE(has_service_manager());
+    CHECK_FALSE(park_for_successor(sample_state(mono_us()), {}));
+}
@@ -0,0 +1,131 @@
+/*
+ * test_history.cpp — Tests for the bus history and the history command
+ *
+ * BusHistory on explicit time (step means, unknown values, the point
+ * cap, the coarse tier once the fine one has wrapped), then a live
+ * TreadmillController answering `history` to the asking client only.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "history.h"
+#include "gpio_mock.h"
+#include "treadmill_io.h"
+#include "ipc_test_util.h"
+
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+using Column = std::array<int16_t, HISTORY_MAX_POINTS>;
+
+TEST_CASE("queries average each step and skip unknown values") {
+    BusHistory h;
+    Column speed, incline, amps;
+    auto r = h.query(0, 10, 1, speed, incline, amps);
+    CHECK(r.count == 10);
+    CHECK(speed.at(0) == -1);
+
+    for (uint32_t t = 0; t < 10; t++) {
+        h.sample(t, { static_cast<int16_t>(10 * t), 4, static_cast<int16_t>(t % 2 ? -1 : 20) });
+    }
+    h.sample(9, { 999, 999, 999 });  // not later: ignored
+    CHECK(h.fine_count() == 10);
+
+    r = h.query(0, 10, 1, speed, incline, amps);
+    CHECK(r.step == 1);
+    CHECK(r.count == 10);
+    CHECK(speed.at(3) == 30);
+    CHECK(speed.at(9) == 90);
+    CHECK(amps.at(1) == -1);
+
+    r = h.query(2, 10, 4, speed, incline, amps);
+    CHECK(r.from == 2);
+    CHECK(r.count == 2);
+    CHECK(speed.at(0) == 35);   // 20, 30, 40, 50
+    CHECK(incline.at(1) == 4);
+    CHECK(amps.at(0) == 20);    // the -1s left out
+
+    // Past the newest sample: -1, and an empty range is empty
+    r = h.query(8, 13, 1, speed, incline, amps);
+    CHECK(r.count == 5);
+    CHECK(speed.at(1) == 90);
+    CHECK(speed.at(2) == -1);
+    CHECK(h.query(5, 5, 1, speed, incline, amps).count == 0);
+}
+
+TEST_CASE("a step too fine for the range is widened to the point cap") {
+    BusHistory h;
+    for (uint32_t t = 0; t < 3600; t++) h.sample(t, { 50, 0, -1 });
+    Column speed, incline, amps;
+    auto r = h.query(0, 3600, 1, speed, incline, amps);
+    CHECK(r.step == 5);
+    CHECK(r.count == 720);
+    CHECK(speed.at(719) == 50);
+
+    // Smaller output columns cap it too
+    std::array<int16_t, 10> s10, i10, a10;
+    r = h.query(0, 100, 1, s10, i10, a10);
+    CHECK(r.step == 10);
+    CHECK(r.count == 10);
+}
+
+TEST_CASE("ranges older than the fine tier come from minute means") {
+    BusHistory h;
+    // Four hours: speed = the minute number, so each minute mean is exact
+    constexpr uint32_t END = 4 * 3600;
+    for (uint32_t t = 0; t < END; t++) h.sample(t, { static_cast<int16_t>(t / 60), 0, -1 });
+    CHECK(h.fine_count() == HISTORY_FINE_POINTS);
+    CHECK(h.coarse_count() == END / 60 - 1);  // the last minute still filling
+
+    Column speed, incline, amps;
+    auto r = h.query(0, 3600, 1, speed, incline, amps);
+    CHECK(r.step == 60);        // coarse resolution
+    CHECK(r.count == 60);
+    CHECK(speed.at(0) == 0);
+    CHECK(speed.at(30) == 30);
+    CHECK(speed.at(59) == 59);
+
+    // Within the last three hours: one-second samples again
+    r = h.query(END - 10, END, 1, speed, incline, amps);
+    CHECK(r.step == 1);
+    CHECK(speed.at(9) == static_cast<int16_t>((END - 1) / 60));
+}
+
+TEST_CASE("history answers the asking client with the sampled bus values") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    int fd = connect_ipc();
+    int other = connect_ipc();
+    CHECK(fd >= 0);
+    CHECK(other >= 0);
+    if (fd < 0 || other < 0) {
+        ctrl.stop();
+        return;
+    }
+
+    port.inject_serial_data_pin(17, kv_build("hmph", "1F4") + kv_build("inc", "6"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(2300));
+
+    send_json(fd, "{\"cmd\":\"history\",\"step\":1}");
+    std::string got = read_until(fd, "\"type\":\"history\"", 1000);
+    got = got.substr(got.find("{\"type\":\"history\""));
+    got = got.substr(0, got.find('\n'));
+    CHECK(got.starts_with("{\"type\":\"history\",\"from\":0,\"step\":1,\"count\":"));
+    CHECK(got.find(",50],\"incline\":[") != std::string::npos);  // newest second
+    CHECK(got.find(",6],\"amps\":[") != std::string::npos);
+    CHECK(got.ends_with(",-1]}"));   // no amps reported
+
+    // Not for anyone else
+    CHECK(read_until(other, "\"type\":\"history\"", 300).find("\"type\":\"history\"") == std::string::npos);
+
+    CHECK_FALSE(parse_command("{\"cmd\":\"history\",\"step\":0}").has_value());
+    close(fd);
+    close(other);
+    ctrl.stop();
+}
@@ -0,0 +1,142 @@
+/*
+ * test_hr_zone.cpp — Tests for HrZoneController steps, bounds and holds
+ *
+ * Drives the controller with synthetic CLOCK_MONOTONIC times (ns), applying
+ * each target the way the emulate thread does.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "hr_zone.h"
+
+constexpr int64_t MS = 1000000;  // ns per ms
+
+static HrZoneSpec speed_zone() {
+    HrZoneSpec z;
+    z.low = 130;
+    z.high = 145;
+    z.min = 20;   // 2.0 mph
+    z.max = 60;   // 6.0 mph
+    z.step = 2;
+    z.interval_ms = 10000;
+    return z;
+}
+
+// Tick at `now`, applying any target to `current`
+static HrZoneTick step(HrZoneController& c, int64_t now, int& current) {
+    auto t = c.tick(now, current);
+    if (t.apply) {
+        current = t.target;
+        c.applied(t, now);
+    }
+    return t;
+}
+
+TEST_CASE("below the band the target climbs one step per interval, up to max") {
+    HrZoneController c;
+    c.load(speed_zone(), 0);
+    CHECK(c.active());
+    int speed = 0;
+
+    // Outside the bounds: straight to min, whatever the heart rate says
+    auto t = step(c, 0, speed);
+    CHECK(t.apply);
+    CHECK(t.report);
+    CHECK(speed == 20);
+
+    c.sample(110, 100 * MS);
+    t = step(c, 100 * MS, speed);
+    CHECK_FALSE(t.apply);  // the clamp started the interval
+    CHECK(speed == 20);
+
+    for (int64_t s = 10; s <= 300; s += 10) {
+        c.sample(110, s * 1000 * MS);
+        step(c, s * 1000 * MS, speed);
+        step(c, s * 1000 * MS + 500 * MS, speed);  // a burst later: no extra step
+    }
+    CHECK(speed == 60);
+    CHECK(c.progress().steps == 21);
+    CHECK(c.progress().target == 60);
+}
+
+TEST_CASE("inside the band nothing moves; above it the target comes down") {
+    HrZoneController c;
+    c.load(speed_zone(), 0);
+    int speed = 40;
+    c.sample(138, 0);
+    auto t = step(c, 0, speed);
+    CHECK_FALSE(t.apply);
+    CHECK(t.report);
+    CHECK(c.progress().state == "running");
+
+    c.sample(150, 20000 * MS);
+    t = step(c, 20000 * MS, speed);
+    CHECK(t.apply);
+    CHECK(speed == 38);
+    c.sample(150, 25000 * MS);
+    CHECK_FALSE(step(c, 25000 * MS, speed).apply);  // within the interval
+    c.sample(150, 30000 * MS);
+    CHECK(step(c, 30000 * MS, speed).apply);
+    CHECK(speed == 36);
+
+    // A manual change moves the starting point
+    speed = 50;
+    c.sample(150, 40000 * MS);
+    step(c, 40000 * MS, speed);
+    CHECK(speed == 48);
+}
+
+TEST_CASE("stale samples hold the target; hr_max drops it to min at once") {
+    HrZoneSpec z = speed_zone();
+    z.hr_max = 175;
+    HrZoneController c;
+    c.load(z, 0);
+    int speed = 40;
+
+    // No sample yet, then one that goes stale
+    auto t = step(c, 0, speed);
+    CHECK_FALSE(t.apply);
+    CHECK(c.progress().state == "no_hr");
+    c.sample(100, 1000 * MS);
+    t = step(c, 1000 * MS, speed);
+    CHECK(t.report);  // no_hr -> running
+    CHECK(speed == 42);
+    t = step(c, 20000 * MS, speed);
+    CHECK_FALSE(t.apply);
+    CHECK(t.report);
+    CHECK(c.progress().state == "no_hr");
+    CHECK(speed == 42);
+
+    c.sample(180, 21000 * MS);
+    t = step(c, 21000 * MS, speed);
+    CHECK(t.apply);
+    CHECK(speed == 20);
+    CHECK(c.progress().state == "limit");
+    CHECK(c.progress().hr == 180);
+}
+
+TEST_CASE("incline control, stop, and the progress cadence") {
+    HrZoneSpec z = speed_zone();
+    z.control = HrControl::Incline;
+    z.min = 0;
+    z.max = 10;
+    z.step = 1;
+    HrZoneController c;
+    c.load(z, 0);
+    CHECK(c.control() == HrControl::Incline);
+    int incline = 4;
+    c.sample(120, 0);
+    CHECK(step(c, 0, incline).report);
+    CHECK(incline == 5);
+    c.sample(120, 400 * MS);
+    CHECK_FALSE(step(c, 400 * MS, incline).report);
+    CHECK(step(c, 1000 * MS, incline).report);  // once a second
+    CHECK(c.progress().control == "incline");
+
+    CHECK(c.stop());
+    CHECK_FALSE(c.active());
+    CHECK_FALSE(c.stop());
+    CHECK_FALSE(step(c, 30000 * MS, incline).apply);
+    CHECK(c.progress().state == "stopped");
+}
@@ -6,7 +6,30 @@
 #define DOCTEST_CONFIG_NO_EXCEPTIONS
 #include <doctest.h>
 #include "ipc_protocol.h"
+#include "kv_protocol.h"
+#include "mode_state.h"
+#include "kv_latest.h"
+#include "kv_cycle_buffer.h"
 #include <string>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Heap allocations, for the allocation-free parse checks
+static std::atomic<uint64_t> g_allocs{0};
+
+void* operator new(size_t size) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+    std::abort();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
 
 // ── Command parsing tests ───────────────────────────────────────────
 
@@ -73,6 +96,21 @@ TEST_CASE("parse proxy disable") {
     CHECK(cmd->bool_value == false);
 }
 
+TEST_CASE("parse overlay enable and disable") {
+    auto cmd = parse_command("{\"cmd\":\"overlay\",\"enabled\":true}");
+    CHECK(cmd.has_value());
+    if (cmd) {
+        CHECK(cmd->type == CmdType::Overlay);
+        CHECK(cmd->bool_value == true);
+    }
+    cmd = parse_command("{\"cmd\":\"overlay\",\"enabled\":false}");
+    CHECK(cmd.has_value());
+    if (cmd) CHECK(cmd->bool_value == false);
+    cmd = parse_command("{\"cmd\":\"batch\",\"commands\":[{\"cmd\":\"overlay\",\"enabled\":true}]}");
+    CHECK(cmd.has_value());
+    if (cmd) CHECK(cmd->batch.at(0).kind == ModeStep::Kind::Overlay);
+}
+
 TEST_CASE("parse status command") {
     auto cmd = parse_command("{\"cmd\":\"status\"}");
     CHECK(cmd.has_value());
@@ -85,6 +123,278 @@ TEST_CASE("parse heartbeat command") {
     CHECK(cmd->type == CmdType::Heartbeat);
 }
 
+TEST_CASE("parse stats command") {
+    auto cmd = parse_command("{\"cmd\":\"stats\"}");
+    CHECK(cmd.has_value());
+    CHECK(cmd->type == CmdType::Stats);
+}
+
+TEST_CASE("parse metrics command") {
+    auto cmd = parse_command("{\"cmd\":\"metrics\"}");
+    CHECK(cmd.has_value());
+    CHECK(cmd->type == CmdType::Metrics);
+}
+
+TEST_CASE("parse subscribe command") {
+    auto all = parse_command("{\"cmd\":\"subscribe\"}");
+    CHECK(all.has_value());
+    if (!all) return;
+    CHECK(all->type == CmdType::Subscribe);
+    CHECK(all->sub.all());
+
+    auto cmd = parse_command(
+        "{\"cmd\":\"subscribe\",\"types\":[\"status\",\"kv\"],\"sources\":[\"motor\"],"
+        "\"keys\":[\"hmph\",\"inc\"]}");
+    CHECK(cmd.has_value());
+    if (!cmd) return;
+    CHECK(cmd->sub.types == 0b0011u);
+    CHECK(cmd->sub.sources == 0b010u);
+    CHECK(cmd->sub.keys == ((1u << static_cast<int>(KvKey::Hmph)) | (1u << static_cast<int>(KvKey::Inc))));
+
+    auto none = parse_command("{\"cmd\":\"subscribe\",\"types\":[]}");
+    CHECK(none.has_value());
+    if (none) CHECK(none->sub.types == 0u);
+
+    CHECK(all->sub.kv_rate == 0);
+    auto rated = parse_command("{\"cmd\":\"subscribe\",\"kv_rate\":10}");
+    CHECK(rated.has_value());
+    if (rated) {
+        CHECK(rated->sub.kv_rate == 10);
+        CHECK(rated->sub.all());  // a rate filters nothing out
+    }
+}
+
+TEST_CASE("parse subscribe rejects unknown names and non-arrays") {
+    CHECK_FALSE(parse_command("{\"cmd\":\"subscribe\",\"types\":[\"bogus\"]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"subscribe\",\"sources\":\"motor\"}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"subscribe\",\"keys\":[\"\"]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"subscribe\",\"keys\":[1]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"subscribe\",\"kv_rate\":101}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"subscribe\",\"kv_rate\":2.5}").has_value());
+}
+
+TEST_CASE("subscription filters formatted events by type, source and key") {
+    auto kv = [](const char* src, const char* key) {
+        return build_kv_event(KvEvent{ src, key, "1", 1.5 });
+    };
+    std::string status = build_status_event(StatusEvent{ true, false, 0, 0, -1, -1, 0, 0, 0, 0, 0.0, 0.0, 0 });
+    std::string error = build_error_event("bad");
+
+    IpcSubscription all;
+    CHECK(subscription_matches(all, kv("console", "hmph")));
+
+    IpcSubscription status_only;
+    status_only.types = 1u << 1;
+    CHECK(subscription_matches(status_only, status));
+    CHECK_FALSE(subscription_matches(status_only, kv("motor", "hmph")));
+    CHECK(subscription_matches(status_only, error));  // errors always pass
+
+    IpcSubscription motor_speed;
+    motor_speed.sources = 1u << 1;
+    motor_speed.keys = 1u << static_cast<int>(KvKey::Hmph);
+    CHECK(subscription_matches(motor_speed, kv("motor", "hmph")));
+    CHECK_FALSE(subscription_matches(motor_speed, kv("console", "hmph")));
+    CHECK_FALSE(subscription_matches(motor_speed, kv("motor", "belt")));
+    CHECK_FALSE(subscription_matches(motor_speed, kv("motor", "zz")));
+    CHECK(subscription_matches(motor_speed, status));  // key/source filters are kv-only
+
+    IpcSubscription unknown_keys;
+    unknown_keys.keys = 1u;
+    CHECK(subscription_matches(unknown_keys, kv("console", "zz")));
+    CHECK_FALSE(subscription_matches(unknown_keys, kv("console", "inc")));
+}
+
+TEST_CASE("parse hello command") {
+    auto json = parse_command("{\"cmd\":\"hello\"}");
+    CHECK(json.has_value());
+    if (json) {
+        CHECK(json->type == CmdType::Hello);
+        CHECK_FALSE(json->bool_value);
+    }
+    auto bin = parse_command("{\"cmd\":\"hello\",\"format\":\"binary\"}");
+    CHECK(bin.has_value());
+    if (bin) CHECK(bin->bool_value);
+    CHECK_FALSE(parse_command("{\"cmd\":\"hello\",\"format\":\"xml\"}").has_value());
+}
+
+TEST_CASE("parse program command") {
+    auto cmd = parse_command("{\"cmd\":\"program\",\"segments\":[[60,3.0,1],[120,6.5,2.5,true]]}");
+    CHECK(cmd.has_value());
+    if (cmd) {
+        CHECK(cmd->type == CmdType::Program);
+        CHECK(cmd->program.action == ProgramAction::Start);
+        CHECK(cmd->program.count == 2);
+        const auto& s0 = cmd->program.segments.at(0);
+        CHECK(s0.duration_ms == 60000);
+        CHECK(s0.speed_tenths == 30);
+        CHECK(s0.incline == 2);
+        CHECK_FALSE(s0.ramp);
+        const auto& s1 = cmd->program.segments.at(1);
+        CHECK(s1.speed_tenths == 65);
+        CHECK(s1.incline == 5);
+        CHECK(s1.ramp);
+    }
+    auto pause = parse_command("{\"cmd\":\"program\",\"action\":\"pause\"}");
+    CHECK(pause.has_value());
+    if (pause) CHECK(pause->program.action == ProgramAction::Pause);
+    auto stop = parse_command("{\"cmd\":\"program\",\"action\":\"stop\"}");
+    CHECK(stop.has_value());
+    if (stop) CHECK(stop->program.action == ProgramAction::Stop);
+}
+
+TEST_CASE("parse trace command") {
+    auto start = parse_command("{\"cmd\":\"trace\",\"action\":\"start\"}");
+    CHECK(start.has_value());
+    if (start) {
+        CHECK(start->type == CmdType::Trace);
+        CHECK(start->trace == TraceAction::Start);
+    }
+    auto dump = parse_command("{\"cmd\":\"trace\",\"action\":\"dump\"}");
+    CHECK(dump.has_value());
+    if (dump) CHECK(dump->trace == TraceAction::Dump);
+    CHECK_FALSE(parse_command("{\"cmd\":\"trace\"}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"trace\",\"action\":\"save\"}").has_value());
+    // The dump path comes from gpio.json, never from a client
+    auto with_path = parse_command("{\"cmd\":\"trace\",\"action\":\"dump\",\"path\":\"/etc/x\"}");
+    CHECK(with_path.has_value());
+}
+
+TEST_CASE("parse program rejects bad segments and actions") {
+    CHECK_FALSE(parse_command("{\"cmd\":\"program\"}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"program\",\"segments\":[]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"program\",\"segments\":[[0,3,1]]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"program\",\"segments\":[[60,-1,1]]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"program\",\"segments\":[[60,12.5,1]]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"program\",\"segments\":[[60,3,100]]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"program\",\"segments\":[[60,3]]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"program\",\"segments\":[[60,3,1,true,5]]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"program\",\"segments\":[[\"60\",3,1]]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"program\",\"action\":\"rewind\"}").has_value());
+
+    std::string many = "{\"cmd\":\"program\",\"segments\":[";
+    for (int i = 0; i <= PROGRAM_MAX_SEGMENTS; i++) many += i ? ",[1,2,0]" : "[1,2,0]";
+    many += "]}";
+    CHECK(many.size() <= MAX_IPC_COMMAND_LEN);
+    CHECK_FALSE(parse_command(many).has_value());
+}
+
+TEST_CASE("parse batch command") {
+    auto cmd = parse_command("{\"cmd\":\"batch\",\"bus\":1,\"commands\":[{\"cmd\":\"emulate\",\"enabled\":true},"
+                             "{\"cmd\":\"speed\",\"value\":3.5},{\"cmd\":\"incline\",\"value\":2.5},"
+                             "{\"cmd\":\"proxy\",\"enabled\":false}]}");
+    CHECK(cmd.has_value());
+    if (!cmd) return;
+    CHECK(cmd->type == CmdType::Batch);
+    CHECK(cmd->bus == 1);
+    CHECK(cmd->batch_count == 4);
+    CHECK(cmd->batch.at(0).kind == ModeStep::Kind::Emulate);
+    CHECK(cmd->batch.at(0).value == 1);
+    CHECK(cmd->batch.at(1).kind == ModeStep::Kind::Speed);
+    CHECK(cmd->batch.at(1).value == 35);  // tenths
+    CHECK(cmd->batch.at(2).kind == ModeStep::Kind::Incline);
+    CHECK(cmd->batch.at(2).value == 5);   // half-pct
+    CHECK(cmd->batch.at(3).kind == ModeStep::Kind::Proxy);
+    CHECK(cmd->batch.at(3).value == 0);
+}
+
+TEST_CASE("parse batch rejects empty, oversized and non-mode batches") {
+    CHECK_FALSE(parse_command("{\"cmd\":\"batch\"}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"batch\",\"commands\":[]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"batch\",\"commands\":{}}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"batch\",\"commands\":[{\"cmd\":\"status\"}]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"batch\",\"commands\":[{\"value\":3}]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"batch\",\"commands\":[\"speed\"]}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"batch\",\"commands\":[{\"cmd\":\"speed\",\"value\":3,\"bus\":1}]}").has_value());
+
+    std::string many = "{\"cmd\":\"batch\",\"commands\":[";
+    for (int i = 0; i <= IPC_BATCH_MAX; i++) many += i ? ",{\"cmd\":\"speed\"}" : "{\"cmd\":\"speed\"}";
+    many += "]}";
+    CHECK_FALSE(parse_command(many).has_value());
+}
+
+TEST_CASE("the compact fast path agrees with the full parse") {
+    // A leading space skips the fast path
+    const char* forms[] = {
+        "{\"cmd\":\"heartbeat\"}", "{\"cmd\":\"heartbeat\",\"bus\":2}",
+        "{\"cmd\":\"speed\",\"value\":3.5}", "{\"cmd\":\"speed\",\"value\":-1}",
+        "{\"cmd\":\"speed\",\"value\":0.25,\"bus\":1}", "{\"cmd\":\"speed\",\"value\":1E1}",
+        "{\"cmd\":\"incline\",\"value\":5.5}", "{\"cmd\":\"incline\",\"value\":0}",
+        "{\"cmd\":\"incline\",\"value\":2.25e0,\"bus\":3}",
+        "{\"cmd\":\"speed\",\"value\":3,\"seq\":0}", "{\"cmd\":\"incline\",\"value\":4,\"seq\":4294967295,\"bus\":1}",
+    };
+    for (const char* f : forms) {
+        CAPTURE(f);
+        auto fast = parse_command(f);
+        auto full = parse_command(std::string(" ") + f);
+        CHECK(fast.has_value());
+        CHECK(full.has_value());
+        if (!fast || !full) continue;
+        CHECK(fast->type == full->type);
+        CHECK(fast->float_value == full->float_value);
+        CHECK(fast->int_value == full->int_value);
+        CHECK(fast->bus == full->bus);
+        CHECK(fast->seq == full->seq);
+        CHECK(fast->has_seq == full->has_seq);
+    }
+
+    // Near misses fall through to the full parse and fail there too
+    CHECK_FALSE(parse_command("{\"cmd\":\"speed\",\"value\":01}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"speed\",\"value\":3.}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"speed\",\"value\":3.5}x").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"heartbeat\",\"bus\":9}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"heartbeat\"").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"speed\",\"value\":1,\"seq\":07}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"speed\",\"value\":1,\"seq\":-1}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"speed\",\"value\":1,\"seq\":4294967296}").has_value());
+
+    // Other spellings of the same command still parse, via the full path
+    auto spaced = parse_command("{\"cmd\": \"speed\", \"value\": 2}");
+    CHECK(spaced.has_value());
+    if (spaced) CHECK(spaced->float_value == doctest::Approx(2.0));
+    auto hb = parse_command("{\"cmd\":\"heartbeat\",\"id\":7}");
+    CHECK(hb.has_value());
+    if (hb) CHECK(hb->type == CmdType::Heartbeat);
+}
+
+TEST_CASE("parse_command_insitu parses a line inside its receive buffer") {
+    std::string buf = "{\"cmd\":\"emulate\",\"enabled\":true}\n{\"cmd\":\"status\"}\n";
+    size_t nl = buf.find('\n');
+    auto cmd = parse_command_insitu(std::span<char>(buf.data(), nl + 1));
+    CHECK(cmd.has_value());
+    if (cmd) CHECK(cmd->type == CmdType::Emulate);
+    CHECK(buf.at(nl) == '\0');  // the spare byte
+    CHECK(buf.substr(nl + 1) == "{\"cmd\":\"status\"}\n");
+
+    std::string hb = "{\"cmd\":\"heartbeat\"}\n";
+    cmd = parse_command_insitu(std::span<char>(hb.data(), hb.size()));
+    CHECK(cmd.has_value());
+    CHECK_FALSE(parse_command_insitu(std::span<char>(hb.data(), 1)).has_value());
+}
+
+TEST_CASE("parsing commands makes no heap allocation") {
+    std::string program = "{\"cmd\":\"program\",\"segments\":[";
+    for (int i = 0; i < PROGRAM_MAX_SEGMENTS; i++) program += i ? ",[60,3.5,2.5,1]" : "[60,3.5,2.5,1]";
+    program += "]}";
+    CHECK(program.size() <= MAX_IPC_COMMAND_LEN);
+    std::string_view commands[] = {
+        "{\"cmd\":\"heartbeat\"}",
+        "{\"cmd\":\"speed\",\"value\":3.5}",
+        "{\"cmd\":\"incline\",\"value\":4.5,\"bus\":1}",
+        "{\"cmd\":\"emulate\",\"enabled\":true}",
+        "{\"cmd\":\"subscribe\",\"types\":[\"kv\",\"status\"],\"keys\":[\"hmph\"]}",
+        "{\"cmd\":\"batch\",\"commands\":[{\"cmd\":\"speed\",\"value\":3},{\"cmd\":\"incline\",\"value\":1}]}",
+        program,
+    };
+    for (auto c : commands) {
+        CAPTURE(c);
+        uint64_t before = g_allocs.load();
+        auto cmd = parse_command(c);
+        uint64_t allocs = g_allocs.load() - before;
+        CHECK(cmd.has_value());
+        CHECK(allocs == 0);
+    }
+}
+
 TEST_CASE("parse quit command") {
     auto cmd = parse_command("{\"cmd\":\"quit\"}");
     CHECK(cmd.has_value());
@@ -135,7 +445,7 @@ TEST_CASE("build KV event") {
 
 TEST_CASE("build status event") {
     // emu_incline and bus_incline are in half-pct units
-    StatusEvent ev{true, false, 12, 10, 42, 14, 1234, 567};
+    StatusEvent ev{true, false, 12, 10, 42, 14, 1234, 567, 89, 0, 0.5, 13.2, 600000};
     auto result = build_status_event(ev);
 
     CHECK(!result.empty());
@@ -148,9 +458,24 @@ TEST_CASE("build status event") {
     CHECK(result.find("\"bus_incline\":14") != std::string::npos);
     CHECK(result.find("\"console_bytes\":1234") != std::string::npos);
     CHECK(result.find("\"motor_bytes\":567") != std::string::npos);
+    CHECK(result.find("\"console_dropped\":89") != std::string::npos);
+    CHECK(result.find("\"motor_dropped\":0") != std::string::npos);
+    CHECK(result.find("\"distance_mi\":0.5,\"vert_ft\":13.2,\"belt_on_ms\":600000,\"generation\":0}") !=
+          std::string::npos);
     CHECK(result.back() == '\n');
 }
 
+TEST_CASE("largest status event fits the record JSON buffer") {
+    StatusEvent ev{false, false, 120, 198, 120, 198, 4000000000u, 4000000000u,
+                   UINT64_MAX, UINT64_MAX, -1.2345678901234567e-300, -1.2345678901234567e-300,
+                   UINT64_MAX, MAX_BUSES - 1, true, UINT32_MAX};
+    std::array<char, RECORD_JSON_MAX> buf{};
+    size_t n = format_status_event(buf, ev);
+    CHECK(n > 0);
+    CHECK(std::string_view(buf.data(), n).find("\"belt_on_ms\":18446744073709551615,\"generation\":4294967295}") !=
+          std::string_view::npos);
+}
+
 TEST_CASE("build error event") {
     auto result = build_error_event("too many clients");
 
@@ -159,3 +484,579 @@ TEST_CASE("build error event") {
     CHECK(result.find("\"msg\":\"too many clients\"") != std::string::npos);
     CHECK(result.back() == '\n');
 }
+
+// ── Fixed-buffer event formatting ───────────────────────────────────
+
+TEST_CASE("format KV event matches expected JSON") {
+    KvEvent ev{"motor", "belt", "0", 1.5};
+    std::array<char, 256> buf{};
+    size_t n = format_kv_event(buf, ev);
+    CHECK(std::string_view(buf.data(), n) ==
+          "{\"type\":\"kv\",\"ts\":1.5,\"source\":\"motor\",\"key\":\"belt\",\"value\":\"0\"}\n");
+    CHECK(build_kv_event(ev) == std::string(buf.data(), n));
+}
+
+TEST_CASE("format status event matches build_status_event") {
+    StatusEvent ev{false, true, 50, 14, -1, -1, 4000000000u, 0, 0, 0, 0.0, 0.0, 0};
+    std::array<char, 256> buf{};
+    size_t n = format_status_event(buf, ev);
+    std::string_view out(buf.data(), n);
+    CHECK(out.find("\"console_bytes\":4000000000") != std::string_view::npos);
+    CHECK(out.find("\"bus_speed\":-1") != std::string_view::npos);
+    CHECK(out.back() == '\n');
+    CHECK(build_status_event(ev) == std::string(out));
+}
+
+TEST_CASE("format KV event escapes like a JSON writer") {
+    KvEvent ev{"console", "k\"\\", "a\tb\x01", 0.0};
+    std::array<char, 256> buf{};
+    size_t n = format_kv_event(buf, ev);
+    std::string_view out(buf.data(), n);
+    CHECK(out.find("\"key\":\"k\\\"\\\\\"") != std::string_view::npos);
+    CHECK(out.find("\"value\":\"a\\tb\\u0001\"") != std::string_view::npos);
+    CHECK(out.find("\"ts\":0.0") != std::string_view::npos);
+}
+
+TEST_CASE("format KV event returns 0 when it does not fit") {
+    KvEvent ev{"console", "hmph", "78", 1.23};
+    std::array<char, 32> small{};
+    CHECK(format_kv_event(small, ev) == 0);
+
+    std::array<char, 256> buf{};
+    size_t n = format_kv_event(buf, ev);
+    CHECK(n > 32);
+    // Exactly-sized buffer fits
+    CHECK(format_kv_event(std::span<char>(buf.data(), n), ev) == n);
+}
+
+TEST_CASE("format emu_stats event") {
+    EmuStatsEvent ev{10000000000ull, 3, 500000, 500012.5, 501200, 503000, 7, 2};
+    std::array<char, 256> buf{};
+    size_t n = format_emu_stats_event(buf, ev);
+    CHECK(std::string_view(buf.data(), n) ==
+          "{\"type\":\"emu_stats\",\"cycles\":10000000000,\"overruns\":3,"
+          "\"target_us\":500000,\"mean_us\":500012.5,\"p99_us\":501200,\"max_us\":503000,"
+          "\"injected\":7,\"timeouts\":2}\n");
+}
+
+TEST_CASE("format program event") {
+    ProgramEvent ev{"running", 1, 3, 61500, 58500, 300000, 65, 5};
+    std::array<char, 256> buf{};
+    size_t n = format_program_event(buf, ev);
+    CHECK(std::string_view(buf.data(), n) ==
+          "{\"type\":\"program\",\"state\":\"running\",\"segment\":1,\"segments\":3,"
+          "\"elapsed_ms\":61500,\"segment_remaining_ms\":58500,\"total_ms\":300000,"
+          "\"speed\":65,\"incline\":5}\n");
+}
+
+TEST_CASE("format query metrics and stall events") {
+    QueryMetricsEvent m{"amps", 40, 31250.5, 32767, 65535, 41000, 42, 2, 1};
+    std::array<char, 256> buf{};
+    size_t n = format_query_metrics_event(buf, m);
+    CHECK(std::string_view(buf.data(), n) ==
+          "{\"type\":\"metrics\",\"name\":\"query\",\"key\":\"amps\",\"count\":40,"
+          "\"mean_us\":31250.5,\"p50_us\":32767,\"p99_us\":65535,\"max_us\":41000,"
+          "\"sent\":42,\"missing\":2,\"stalls\":1}\n");
+
+    QueryStallEvent s{"belt", true, 2000, 4};
+    n = format_query_stall_event(buf, s);
+    CHECK(std::string_view(buf.data(), n) ==
+          "{\"type\":\"stall\",\"key\":\"belt\",\"stalled\":true,\"waited_ms\":2000,"
+          "\"missing\":4}\n");
+
+    BusMetricsEvent b{"console", 91230, 7011, 2, 1, 14, 0, 0};
+    n = format_bus_metrics_event(buf, b);
+    CHECK(std::string_view(buf.data(), n) ==
+          "{\"type\":\"metrics\",\"name\":\"bus\",\"source\":\"console\",\"bytes\":91230,"
+          "\"frames\":7011,\"nonprintable\":2,\"bad_length\":1,\"stray_bytes\":14,"
+          "\"overflow_bytes\":0,\"skipped\":0}\n");
+}
+
+TEST_CASE("format bus_stats events") {
+    std::array<uint64_t, 5> gaps = {120000, 95000, 95000, 95000, 95000};
+    std::array<uint64_t, 5> gap_max = {121000, 96000, 95500, 95000, 95200};
+    BusStatsEvent ev{5000, 268.4, 72.0, 101.2, 89.5, 10, 500010, 499000, 501200, gaps, gap_max};
+    std::array<char, 512> buf{};
+    size_t n = format_bus_stats_event(buf, ev);
+    std::string_view msg(buf.data(), n);
+    CHECK(msg == "{\"type\":\"bus_stats\",\"window_ms\":5000,\"console_bps\":268.4,\"console_idle_pct\":72.0,"
+                 "\"motor_bps\":101.2,\"motor_idle_pct\":89.5,\"cycles\":10,\"cycle_us\":500010,"
+                 "\"cycle_min_us\":499000,\"cycle_max_us\":501200,"
+                 "\"gap_us\":[120000,95000,95000,95000,95000],\"gap_max_us\":[121000,96000,95500,95000,95200]}\n");
+
+    IpcSubscription sub;
+    sub.types = 1u << 1;  // status only
+    CHECK_FALSE(subscription_matches(sub, msg));
+    sub.types |= 1u << 6;
+    CHECK(subscription_matches(sub, msg));
+}
+
+TEST_CASE("format stats events with flat per-window fields") {
+    std::array<StatsWindowEvent, 3> windows = {{ {1, 4, 12, 14, 13.0}, {10, 40, 8, 20, 12.5}, {60, 0, 0, 0, 0} }};
+    StatsEvent ev{"amps", windows};
+    std::array<char, 512> buf{};
+    size_t n = format_stats_event(buf, ev);
+    std::string_view msg(buf.data(), n);
+    CHECK(msg == "{\"type\":\"stats\",\"key\":\"amps\",\"count_1s\":4,\"min_1s\":12,\"max_1s\":14,"
+                 "\"mean_1s\":13.0,\"count_10s\":40,\"min_10s\":8,\"max_10s\":20,\"mean_10s\":12.5,"
+                 "\"count_60s\":0,\"min_60s\":0,\"max_60s\":0,\"mean_60s\":0.0}\n");
+
+    IpcSubscription sub;
+    sub.types = 1u << 6;  // bus_stats only
+    CHECK_FALSE(subscription_matches(sub, msg));
+    sub.types |= 1u << 9;
+    CHECK(subscription_matches(sub, msg));
+
+    std::array<char, 64> small{};
+    CHECK(format_stats_event(small, ev) == 0);
+}
+
+TEST_CASE("a cycle buffer formats as one cycle event, filtered by source") {
+    KvCycleBuffer cycle;
+    CHECK(cycle.empty());
+    CHECK(cycle.add("inc", "0", 2.5));
+    CHECK(cycle.add("hmph", "C8", 2.5012));
+    CHECK(cycle.add("amps", "", 2.6));
+    CHECK(cycle.size() == 3);
+
+    std::array<char, 512> buf{};
+    size_t n = format_cycle_event(buf, cycle.event("emulate"));
+    std::string_view msg(buf.data(), n);
+    CHECK(msg == "{\"type\":\"cycle\",\"ts\":2.5,\"source\":\"emulate\",\"count\":3,"
+                 "\"keys\":[\"inc\",\"hmph\",\"amps\"],\"values\":[\"0\",\"C8\",\"\"],"
+                 "\"dt_us\":[0,1200,100000]}\n");
+
+    IpcSubscription sub;
+    sub.types = 1u;  // kv only
+    CHECK_FALSE(subscription_matches(sub, msg));
+    sub.types |= 1u << 10;
+    CHECK(subscription_matches(sub, msg));
+    sub.sources = 1u;  // console only
+    CHECK_FALSE(subscription_matches(sub, msg));
+    sub.sources |= 1u << 2;
+    CHECK(subscription_matches(sub, msg));
+
+    // Full: the caller sends what there is and starts over
+    cycle.clear();
+    CHECK(cycle.empty());
+    size_t added = 0;
+    while (cycle.add("hmph", "C8", 0)) added++;
+    CHECK(added == CYCLE_MAX_FRAMES);
+    std::string long_value(CYCLE_TEXT_BYTES, 'x');
+    cycle.clear();
+    CHECK_FALSE(cycle.add("diag", long_value, 0));
+}
+
+TEST_CASE("history commands parse their range, and the reply is columnar") {
+    auto all = parse_command("{\"cmd\":\"history\"}");
+    CHECK(all.has_value());
+    if (all) {
+        CHECK(all->type == CmdType::History);
+        CHECK(all->history.from == 0);
+        CHECK(all->history.to == UINT32_MAX);
+        CHECK(all->history.step == 1);
+    }
+    auto q = parse_command("{\"cmd\":\"history\",\"from\":60,\"to\":600,\"step\":10,\"bus\":1}");
+    CHECK(q.has_value());
+    if (q) {
+        CHECK(q->history.from == 60);
+        CHECK(q->history.to == 600);
+        CHECK(q->history.step == 10);
+        CHECK(q->bus == 1);
+    }
+    CHECK_FALSE(parse_command("{\"cmd\":\"history\",\"step\":0}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"history\",\"from\":-5}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"history\",\"to\":\"now\"}").has_value());
+
+    std::array<int16_t, 3> speed = {-1, 50, 52};
+    std::array<int16_t, 3> incline = {-1, 4, 4};
+    std::array<int16_t, 3> amps = {-1, -1, 31};
+    HistoryEvent ev{60, 10, speed, incline, amps, 2};
+    std::array<char, 256> buf{};
+    size_t n = format_history_event(buf, ev);
+    CHECK(std::string_view(buf.data(), n) ==
+          "{\"type\":\"history\",\"bus\":2,\"from\":60,\"step\":10,\"count\":3,\"speed\":[-1,50,52],"
+          "\"incline\":[-1,4,4],\"amps\":[-1,-1,31]}\n");
+}
+
+TEST_CASE("format metrics histogram and client events") {
+    HistogramEvent h{"proxy_us", 12, 850.5, 1023, 2047, 1900};
+    std::array<char, 256> buf{};
+    size_t n = format_histogram_event(buf, h);
+    CHECK(std::string_view(buf.data(), n) ==
+          "{\"type\":\"metrics\",\"name\":\"proxy_us\",\"count\":12,\"mean_us\":850.5,"
+          "\"p50_us\":1023,\"p99_us\":2047,\"max_us\":1900}\n");
+
+    ClientLagEvent c{7, 3, 40, 512, 0, 0, 9000};
+    n = format_client_lag_event(buf, c);
+    CHECK(std::string_view(buf.data(), n) ==
+          "{\"type\":\"metrics\",\"name\":\"client\",\"fd\":7,\"lag_msgs\":3,"
+          "\"max_lag_msgs\":40,\"queued_bytes\":512,\"lost_msgs\":0,\"gaps\":0,"
+          "\"sent_bytes\":9000}\n");
+
+    n = format_gap_event(buf, 952);
+    CHECK(std::string_view(buf.data(), n) == "{\"type\":\"gap\",\"dropped\":952}\n");
+
+    n = format_trace_event(buf, TraceEvent{true, false, 0, {}});
+    CHECK(std::string_view(buf.data(), n) == "{\"type\":\"trace\",\"recording\":true}\n");
+    n = format_trace_event(buf, TraceEvent{false, true, 812, "/tmp/t.json"});
+    CHECK(std::string_view(buf.data(), n) ==
+          "{\"type\":\"trace\",\"recording\":false,\"spans\":812,\"path\":\"/tmp/t.json\"}\n");
+
+    // Worst case still fits a ring slot
+    HistogramEvent big{"motor_tx_wait_us", UINT64_MAX, 1.0e18, UINT64_MAX, UINT64_MAX, UINT64_MAX};
+    std::array<char, 255> slot{};
+    CHECK(format_histogram_event(slot, big) > 0);
+}
+
+TEST_CASE("commands name their bus; bus 0 is the default") {
+    auto cmd = parse_command("{\"cmd\":\"speed\",\"value\":2,\"bus\":1}");
+    CHECK(cmd.has_value());
+    if (cmd) CHECK(cmd->bus == 1);
+    auto def = parse_command("{\"cmd\":\"status\"}");
+    CHECK(def.has_value());
+    if (def) CHECK(def->bus == 0);
+
+    CHECK_FALSE(parse_command("{\"cmd\":\"status\",\"bus\":-1}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"status\",\"bus\":4}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"status\",\"bus\":\"1\"}").has_value());
+
+    auto sub = parse_command("{\"cmd\":\"subscribe\",\"buses\":[0,2]}");
+    CHECK(sub.has_value());
+    if (sub) CHECK(sub->sub.buses == 0b101u);
+    CHECK_FALSE(parse_command("{\"cmd\":\"subscribe\",\"buses\":[9]}").has_value());
+}
+
+TEST_CASE("any command may carry a seq to be acked") {
+    auto sp = parse_command("{\"cmd\":\"speed\",\"value\":2,\"seq\":41}");
+    CHECK(sp.has_value());
+    if (sp) {
+        CHECK(sp->has_seq);
+        CHECK(sp->seq == 41);
+    }
+    auto st = parse_command("{\"seq\":3,\"cmd\":\"status\"}");
+    CHECK(st.has_value());
+    if (st) CHECK(st->seq == 3);
+    auto none = parse_command("{\"cmd\":\"speed\",\"value\":2}");
+    CHECK(none.has_value());
+    if (none) CHECK_FALSE(none->has_seq);
+
+    CHECK_FALSE(parse_command("{\"cmd\":\"status\",\"seq\":1.5}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"status\",\"seq\":\"1\"}").has_value());
+    // The batch has one seq; its entries can't carry their own
+    auto batch = parse_command("{\"cmd\":\"batch\",\"seq\":9,\"commands\":[{\"cmd\":\"speed\",\"value\":1}]}");
+    CHECK(batch.has_value());
+    if (batch) CHECK(batch->seq == 9);
+    CHECK_FALSE(parse_command("{\"cmd\":\"batch\",\"commands\":[{\"cmd\":\"speed\",\"value\":1,\"seq\":2}]}")
+                    .has_value());
+}
+
+TEST_CASE("format ack events") {
+    std::array<char, 256> buf{};
+    auto applied = std::string_view(buf.data(), format_ack_event(buf, AckEvent{7, "applied", {}}));
+    CHECK(applied == "{\"type\":\"ack\",\"seq\":7,\"stage\":\"applied\"}\n");
+
+    auto motor = std::string_view(buf.data(), format_ack_event(buf, AckEvent{7, "motor", "hmph", 30, 41200, 46850}));
+    CHECK(motor == "{\"type\":\"ack\",\"seq\":7,\"stage\":\"motor\",\"key\":\"hmph\",\"value\":30,"
+                   "\"sent_us\":41200,\"echo_us\":46850}\n");
+
+    auto late = std::string_view(buf.data(), format_ack_event(buf, AckEvent{8, "timeout", "inc", 4}));
+    CHECK(late == "{\"type\":\"ack\",\"seq\":8,\"stage\":\"timeout\",\"key\":\"inc\",\"value\":4}\n");
+    // Always delivered, whatever the subscription
+    IpcSubscription sub;
+    sub.types = 0;
+    CHECK(subscription_matches(sub, late));
+}
+
+TEST_CASE("snapshot event holds each source's latest values; the table skips queries") {
+    KvLatest latest;
+    latest.record(KV_SOURCE_MOTOR, KvKey::Ver, "1.7");
+    latest.record(KV_SOURCE_MOTOR, KvKey::Belt, "0");
+    latest.record(KV_SOURCE_MOTOR, KvKey::Belt, "1");
+    latest.record(KV_SOURCE_CONSOLE, KvKey::Hmph, "78");
+    latest.record(KV_SOURCE_CONSOLE, KvKey::Amps, "");          // bare query
+    latest.record(KV_SOURCE_CONSOLE, KvKey::Unknown, "x");      // not interned
+    latest.record(KV_SOURCE_EMULATE + 1, KvKey::Inc, "4");      // no such source
+
+    KvLatest::Table table;
+    latest.copy(table);
+    CHECK(table.at(KV_SOURCE_MOTOR).at(static_cast<size_t>(KvKey::Belt)).view() == "1");
+    CHECK(table.at(KV_SOURCE_CONSOLE).at(static_cast<size_t>(KvKey::Amps)).view().empty());
+
+    SnapshotEvent ev;
+    for (size_t s = 0; s < table.size(); s++) {
+        for (size_t k = 0; k < table.at(s).size(); k++) ev.values.at(s).at(k) = table.at(s).at(k).view();
+    }
+    ev.ts = 2.5;
+    std::array<char, SNAPSHOT_EVENT_MAX> buf{};
+    auto json = std::string_view(buf.data(), format_snapshot_event(buf, ev));
+    CHECK(json == "{\"type\":\"snapshot\",\"ts\":2.5,\"console\":{\"hmph\":\"78\"},"
+                  "\"motor\":{\"belt\":\"1\",\"ver\":\"1.7\"},\"emulate\":{}}\n");
+
+    ev.bus = 2;
+    json = std::string_view(buf.data(), format_snapshot_event(buf, ev));
+    CHECK(json.starts_with("{\"type\":\"snapshot\",\"bus\":2,\"ts\":"));
+    CHECK(format_snapshot_event(std::span<char>(buf.data(), 40), ev) == 0);
+
+    // The command, and delivery whatever the subscription
+    auto cmd = parse_command("{\"cmd\":\"snapshot\"}");
+    CHECK(cmd.has_value());
+    if (cmd) CHECK(cmd->type == CmdType::Snapshot);
+    IpcSubscription sub;
+    sub.types = 0;
+    CHECK(subscription_matches(sub, json));
+}
+
+TEST_CASE("events from bus N carry it after the type; bus 0 is untagged") {
+    auto kv0 = build_kv_event(KvEvent{ "motor", "belt", "1", 1.5 });
+    auto kv2 = build_kv_event(KvEvent{ "motor", "belt", "1", 1.5, 2 });
+    CHECK(kv0 == "{\"type\":\"kv\",\"ts\":1.5,\"source\":\"motor\",\"key\":\"belt\",\"value\":\"1\"}\n");
+    CHECK(kv2 == "{\"type\":\"kv\",\"bus\":2,\"ts\":1.5,\"source\":\"motor\",\"key\":\"belt\",\"value\":\"1\"}\n");
+
+    std::array<char, 256> buf{};
+    size_t n = format_emu_stats_event(buf, EmuStatsEvent{ 1, 0, 500000, 1.0, 2, 3, 0, 0 });
+    std::string plain(buf.data(), n);
+    CHECK(tag_event_bus(buf, n, 0) == n);
+    size_t tagged = tag_event_bus(buf, n, 3);
+    CHECK(tagged == n + 8);
+    CHECK(std::string_view(buf.data(), tagged) ==
+          "{\"type\":\"emu_stats\",\"bus\":3" + plain.substr(std::string_view("{\"type\":\"emu_stats\"").size()));
+    std::array<char, 256> small{};
+    plain.copy(small.data(), n);
+    CHECK(tag_event_bus(std::span<char>(small.data(), n + 4), n, 1) == 0);  // no room
+
+    IpcSubscription bus2;
+    bus2.buses = 1u << 2;
+    CHECK(subscription_matches(bus2, kv2));
+    CHECK_FALSE(subscription_matches(bus2, kv0));
+    CHECK(subscription_matches(bus2, build_error_event("x")));  // errors always pass
+    IpcSubscription bus0;
+    bus0.buses = 1u;
+    CHECK(subscription_matches(bus0, kv0));
+    CHECK_FALSE(subscription_matches(bus0, std::string(buf.data(), tagged)));
+}
+
+// ── Binary records ──────────────────────────────────────────────────
+
+TEST_CASE("kv record round-trips and formats to the same JSON") {
+    std::array<char, 256> rec;
+    KvEvent ev{ "motor", "hmph", "1F4", 12.5 };
+    size_t n = format_kv_record(rec, ev);
+    CHECK(n == KV_RECORD_HEADER_SIZE + 3);  // interned key: no key text
+    CHECK(rec.at(0) == static_cast<char>(EventRecord::Kv));
+    CHECK(rec.at(1) == 1);  // motor
+    CHECK(rec.at(2) == static_cast<char>(KvKey::Hmph));
+
+    auto back = parse_kv_record(std::string_view(rec.data(), n));
+    CHECK(back.has_value());
+    if (back) {
+        CHECK(back->source == "motor");
+        CHECK(back->key == "hmph");
+        CHECK(back->value == "1F4");
+        CHECK(back->ts == 12.5);
+    }
+
+    std::array<char, 256> json;
+    size_t len = ring_message_to_json(json, std::string_view(rec.data(), n));
+    CHECK(std::string(json.data(), len) == build_kv_event(ev));
+
+    // Unknown keys carry their text
+    KvEvent odd{ "console", "zz", "", 1.0 };
+    n = format_kv_record(rec, odd);
+    CHECK(n == KV_RECORD_HEADER_SIZE + 2);
+    len = ring_message_to_json(json, std::string_view(rec.data(), n));
+    CHECK(std::string(json.data(), len) == build_kv_event(odd));
+
+    CHECK(format_kv_record(rec, KvEvent{ "bogus", "inc", "1", 0 }) == 0);
+    CHECK_FALSE(parse_kv_record(std::string_view(rec.data(), 3)).has_value());
+
+    // The bus rides in header byte 5
+    KvEvent tagged{ "motor", "belt", "2", 3.0, 1 };
+    n = format_kv_record(rec, tagged);
+    CHECK(rec.at(5) == 1);
+    back = parse_kv_record(std::string_view(rec.data(), n));
+    CHECK(back.has_value());
+    if (back) CHECK(back->bus == 1);
+    len = ring_message_to_json(json, std::string_view(rec.data(), n));
+    CHECK(std::string(json.data(), len) == build_kv_event(tagged));
+}
+
+TEST_CASE("status record round-trips and formats to the same JSON") {
+    std::array<char, 128> rec;
+    StatusEvent ev{ false, true, 50, 9, 48, -1, 1000, 2000, 7, 8, 1.25, 33.0, 900000 };
+    ev.generation = 0x12345678;
+    size_t n = format_status_record(rec, ev);
+    CHECK(n == STATUS_RECORD_SIZE);
+    auto back = parse_status_record(std::string_view(rec.data(), n));
+    CHECK(back.has_value());
+    if (back) {
+        CHECK(back->emulate);
+        CHECK(back->bus_incline == -1);
+        CHECK(back->motor_dropped == 8);
+        CHECK(back->distance_mi == 1.25);
+        CHECK(back->belt_on_ms == 900000);
+        CHECK(back->generation == 0x12345678);
+    }
+    std::array<char, RECORD_JSON_MAX> json;
+    size_t len = ring_message_to_json(json, std::string_view(rec.data(), n));
+    CHECK(std::string(json.data(), len) == build_status_event(ev));
+
+    ev.bus = 2;
+    n = format_status_record(rec, ev);
+    CHECK(rec.at(3) == 2);
+    len = ring_message_to_json(json, std::string_view(rec.data(), n));
+    CHECK(std::string(json.data(), len) == build_status_event(ev));
+
+    // overlay appears only while on, after emulate
+    ev.overlay = true;
+    n = format_status_record(rec, ev);
+    len = ring_message_to_json(json, std::string_view(rec.data(), n));
+    CHECK(std::string_view(json.data(), len).find("\"emulate\":true,\"overlay\":true,") != std::string_view::npos);
+}
+
+TEST_CASE("binary frames are length-prefixed; JSON is wrapped without its newline") {
+    std::array<char, 256> rec;
+    size_t n = format_kv_record(rec, KvEvent{ "console", "inc", "5", 1.0 });
+    std::array<char, 300> frame;
+    size_t len = ring_message_to_frame(frame, std::string_view(rec.data(), n));
+    CHECK(len == n + 2);
+    CHECK(static_cast<uint8_t>(frame.at(0)) == n);
+    CHECK(frame.at(1) == 0);
+    CHECK(std::string_view(frame.data() + 2, n) == std::string_view(rec.data(), n));
+
+    std::string err = build_error_event("bad");
+    len = ring_message_to_frame(frame, err);
+    CHECK(len == 2 + 1 + err.size() - 1);
+    CHECK(frame.at(2) == static_cast<char>(EventRecord::Json));
+    CHECK(std::string_view(frame.data() + 3, len - 3) == std::string_view(err).substr(0, err.size() - 1));
+
+    // JSON passes through ring_message_to_json untouched
+    std::array<char, 64> json;
+    len = ring_message_to_json(json, err);
+    CHECK(std::string_view(json.data(), len) == err);
+}
+
+TEST_CASE("subscription filters binary records") {
+    std::array<char, 256> rec;
+    size_t n = format_kv_record(rec, KvEvent{ "motor", "belt", "0", 1.0 });
+    std::string_view kv(rec.data(), n);
+    IpcSubscription sub;
+    sub.sources = 1u << 1;
+    sub.keys = 1u << static_cast<int>(KvKey::Belt);
+    CHECK(subscription_matches(sub, kv));
+    sub.keys = 1u << static_cast<int>(KvKey::Hmph);
+    CHECK_FALSE(subscription_matches(sub, kv));
+
+    std::array<char, 128> st;
+    std::string_view status(st.data(), format_status_record(st, StatusEvent{}));
+    IpcSubscription kv_only;
+    kv_only.types = 1u;
+    CHECK_FALSE(subscription_matches(kv_only, status));
+    CHECK(subscription_matches(kv_only, kv));
+
+    IpcSubscription bus1;
+    bus1.buses = 1u << 1;
+    CHECK_FALSE(subscription_matches(bus1, kv));
+    CHECK_FALSE(subscription_matches(bus1, status));
+    StatusEvent on_bus1{};
+    on_bus1.bus = 1;
+    CHECK(subscription_matches(bus1, std::string_view(st.data(), format_status_record(st, on_bus1))));
+}
+
+TEST_CASE("ftms record carries FTMS units and reaches only clients that name it") {
+    // 3.5 mph, 5%, 1 mi, 10 min of belt time
+    FtmsEvent ev = make_ftms_event(35, 10, 1.0, 600400);
+    CHECK(ev.speed == 563);
+    CHECK(ev.incline == 50);
+    CHECK(ev.distance_m == 1609);
+    CHECK(ev.elapsed_s == 600);
+    // Unknown bus values read as stopped and flat; elapsed saturates
+    FtmsEvent idle = make_ftms_event(-1, -1, 0.0, 100000000);
+    CHECK(idle.speed == 0);
+    CHECK(idle.incline == 0);
+    CHECK(idle.elapsed_s == UINT16_MAX);
+
+    ev.ts = 2.5;
+    ev.bus = 1;
+    std::array<char, 64> rec;
+    size_t n = format_ftms_record(rec, ev);
+    CHECK(n == FTMS_RECORD_SIZE);
+    std::string_view msg(rec.data(), n);
+    auto back = parse_ftms_record(msg);
+    CHECK(back.has_value());
+    if (back) {
+        CHECK(back->same_data(ev));
+        CHECK(back->bus == 1);
+        CHECK(back->ts == 2.5);
+    }
+    std::array<char, RECORD_JSON_MAX> json;
+    size_t len = ring_message_to_json(json, msg);
+    CHECK(std::string_view(json.data(), len) ==
+          "{\"type\":\"ftms\",\"bus\":1,\"ts\":2.5,\"speed\":563,\"incline\":50,\"distance_m\":1609,\"elapsed_s\":600}\n");
+    std::array<char, 64> frame;
+    CHECK(ring_message_to_frame(frame, msg) == BINARY_FRAME_HEADER_SIZE + FTMS_RECORD_SIZE);
+
+    // Opt-in: the default subscription and lists without it don't get it
+    IpcSubscription sub;
+    CHECK_FALSE(subscription_matches(sub, msg));
+    auto cmd = parse_command("{\"cmd\":\"subscribe\",\"types\":[\"status\",\"ftms\"]}");
+    CHECK(cmd.has_value());
+    if (cmd) {
+        CHECK(subscription_matches(cmd->sub, msg));
+        cmd->sub.buses = 1u;
+        CHECK_FALSE(subscription_matches(cmd->sub, msg));
+    }
+    sub.types = 1u << 1;
+    CHECK_FALSE(subscription_matches(sub, msg));
+}
+
+TEST_CASE("hr and hr_zone commands parse into wire units and reject bad bands") {
+    auto hr = parse_command("{\"cmd\":\"hr\",\"bpm\":142}");
+    CHECK(hr.has_value());
+    if (hr) {
+        CHECK(hr->type == CmdType::Hr);
+        CHECK(hr->int_value == 142);
+    }
+    CHECK_FALSE(parse_command("{\"cmd\":\"hr\",\"bpm\":12}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"hr\"}").has_value());
+
+    auto zone = parse_command("{\"cmd\":\"hr_zone\",\"low\":130,\"high\":145,\"min\":2.0,\"max\":6.0,"
+                              "\"step\":0.2,\"hr_max\":175}");
+    CHECK(zone.has_value());
+    if (zone) {
+        CHECK(zone->type == CmdType::HrZone);
+        CHECK(zone->hr_zone.control == HrControl::Speed);
+        CHECK(zone->hr_zone.min == 20);
+        CHECK(zone->hr_zone.max == 60);
+        CHECK(zone->hr_zone.step == 2);
+        CHECK(zone->hr_zone.interval_ms == HR_ZONE_INTERVAL_MS);
+        CHECK(zone->hr_zone.hr_max == 175);
+    }
+    auto incline = parse_command("{\"cmd\":\"hr_zone\",\"low\":120,\"high\":150,\"control\":\"incline\","
+                                 "\"interval\":30}");
+    CHECK(incline.has_value());
+    if (incline) {
+        CHECK(incline->hr_zone.control == HrControl::Incline);
+        CHECK(incline->hr_zone.min == 0);
+        CHECK(incline->hr_zone.max == MAX_INCLINE);
+        CHECK(incline->hr_zone.step == 1);
+        CHECK(incline->hr_zone.interval_ms == 30000);
+    }
+    auto stop = parse_command("{\"cmd\":\"hr_zone\",\"action\":\"stop\"}");
+    CHECK(stop.has_value());
+    if (stop) CHECK(stop->hr_zone.stop);
+
+    // No band, an inverted band, bounds past the mode limits, a ceiling
+    // inside the band, too short an interval
+    CHECK_FALSE(parse_command("{\"cmd\":\"hr_zone\"}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"hr_zone\",\"low\":150,\"high\":140}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"hr_zone\",\"low\":130,\"high\":140,\"max\":15}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"hr_zone\",\"low\":130,\"high\":140,\"hr_max\":135}").has_value());
+    CHECK_FALSE(parse_command("{\"cmd\":\"hr_zone\",\"low\":130,\"high\":140,\"interval\":0.5}").has_value());
+
+    std::array<char, 256> buf;
+    size_t n = format_hr_zone_event(buf, HrZoneEvent{ "running", "speed", 138, 130, 145, 42, 3 });
+    CHECK(std::string_view(buf.data(), n) ==
+          "{\"type\":\"hr_zone\",\"state\":\"running\",\"control\":\"speed\",\"hr\":138,\"low\":130,"
+          "\"high\":145,\"target\":42,\"steps\":3}\n");
+}
@@ -1,6 +1,7 @@
 /*
  * test_ipc_server.cpp — Tests for IPC server: socket connect, command
- * dispatch, ring buffer flush, client disconnect, max clients.
+ * dispatch, ring buffer flush, client disconnect, max clients, restart
+ * handoff (released/adopted clients, inherited listener).
  *
  * These are "live" socket tests — they create a real Unix socket,
  * connect real clients, and verify end-to-end JSON command/event flow.
@@ -11,7 +12,7 @@
 #include <doctest.h>
 #include "ipc_server.h"
 #include "ipc_protocol.h"
-#include "ring_buffer.h"
+#include "byte_ring.h"
 
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -23,6 +24,8 @@
 #include <chrono>
 #include <vector>
 #include <string>
+#include <atomic>
+#include <algorithm>
 
 // Helper: connect a client socket to the IPC server
 static int connect_client() {
@@ -58,7 +61,7 @@ static std::string read_all(int fd, int wait_ms = 100) {
         ssize_t n = read(fd, buf, sizeof(buf) - 1);
         if (n <= 0) break;
         buf[n] = '\0';
-        result += buf;
+        result.append(buf, static_cast<size_t>(n));
     }
     fcntl(fd, F_SETFL, flags);  // restore
     return result;
@@ -75,7 +78,7 @@ static void poll_for(IpcServer& ipc, int ms) {
 // ── Basic server lifecycle ──────────────────────────────────────────
 
 TEST_CASE("server creates and shuts down cleanly") {
-    RingBuffer<> ring;
+    EventRing ring;
     IpcServer ipc(ring);
 
     CHECK(ipc.create());
@@ -83,12 +86,12 @@ TEST_CASE("server creates and shuts down cleanly") {
 }
 
 TEST_CASE("client connects and receives initial status") {
-    RingBuffer<> ring;
+    EventRing ring;
     IpcServer ipc(ring);
     CHECK(ipc.create());
 
     // Push a status message before client connects
-    StatusEvent ev{true, false, 0, 0, -1, -1, 0, 0};
+    StatusEvent ev{true, false, 0, 0, -1, -1, 0, 0, 0, 0, 0.0, 0.0, 0};
     auto status = build_status_event(ev);
     ring.push(status);
 
@@ -108,7 +111,7 @@ TEST_CASE("client connects and receives initial status") {
 // ── Command dispatch ────────────────────────────────────────────────
 
 TEST_CASE("server dispatches speed command to callback") {
-    RingBuffer<> ring;
+    EventRing ring;
     IpcServer ipc(ring);
     CHECK(ipc.create());
 
@@ -134,7 +137,7 @@ TEST_CASE("server dispatches speed command to callback") {
 }
 
 TEST_CASE("server dispatches incline command (half-pct conversion)") {
-    RingBuffer<> ring;
+    EventRing ring;
     IpcServer ipc(ring);
     CHECK(ipc.create());
 
@@ -157,7 +160,7 @@ TEST_CASE("server dispatches incline command (half-pct conversion)") {
 }
 
 TEST_CASE("server dispatches emulate and proxy commands") {
-    RingBuffer<> ring;
+    EventRing ring;
     IpcServer ipc(ring);
     CHECK(ipc.create());
 
@@ -186,7 +189,7 @@ TEST_CASE("server dispatches emulate and proxy commands") {
 }
 
 TEST_CASE("server handles multiple commands in one send") {
-    RingBuffer<> ring;
+    EventRing ring;
     IpcServer ipc(ring);
     CHECK(ipc.create());
 
@@ -213,7 +216,7 @@ TEST_CASE("server handles multiple commands in one send") {
 // ── Ring buffer flush to clients ────────────────────────────────────
 
 TEST_CASE("server flushes ring buffer events to connected client") {
-    RingBuffer<> ring;
+    EventRing ring;
     IpcServer ipc(ring);
     CHECK(ipc.create());
 
@@ -240,7 +243,7 @@ TEST_CASE("server flushes ring buffer events to connected client") {
 }
 
 TEST_CASE("multiple clients each receive ring events") {
-    RingBuffer<> ring;
+    EventRing ring;
     IpcServer ipc(ring);
     CHECK(ipc.create());
 
@@ -264,10 +267,220 @@ TEST_CASE("multiple clients each receive ring events") {
     ipc.shutdown();
 }
 
+TEST_CASE("subscribed client receives only matching ring events") {
+    EventRing ring;
+    IpcServer ipc(ring);
+    CHECK(ipc.create());
+
+    int dispatched = 0;
+    ipc.on_command([&](const IpcCommand&) { dispatched++; });
+
+    int fd1 = connect_client();
+    int fd2 = connect_client();
+    poll_for(ipc, 30);
+    send_cmd(fd2, "{\"cmd\":\"subscribe\",\"types\":[\"status\",\"kv\"],"
+                  "\"sources\":[\"motor\"],\"keys\":[\"hmph\"]}");
+    poll_for(ipc, 30);
+    CHECK(dispatched == 0);  // subscribe is handled by the server
+
+    ring.push(build_kv_event(KvEvent{"console", "hmph", "32", 1.0}));
+    ring.push(build_kv_event(KvEvent{"motor", "belt", "0", 1.1}));
+    ring.push(build_kv_event(KvEvent{"motor", "hmph", "32", 1.2}));
+    ring.push(build_status_event(StatusEvent{true, false, 0, 0, 50, 0, 0, 0, 0, 0, 0.0, 0.0, 0}));
+    ring.push("{\"type\":\"emu_stats\",\"cycles\":1}\n");
+    poll_for(ipc, 50);
+
+    std::string all = read_all(fd1, 30);
+    std::string sub = read_all(fd2, 30);
+    CHECK(std::count(all.begin(), all.end(), '\n') == 5);
+    CHECK(std::count(sub.begin(), sub.end(), '\n') == 2);
+    CHECK(sub.find("\"source\":\"motor\",\"key\":\"hmph\"") != std::string::npos);
+    CHECK(sub.find("\"type\":\"status\"") != std::string::npos);
+
+    // Plain subscribe resets to everything
+    send_cmd(fd2, "{\"cmd\":\"subscribe\"}");
+    poll_for(ipc, 30);
+    ring.push(build_kv_event(KvEvent{"console", "belt", "0", 1.3}));
+    poll_for(ipc, 50);
+    CHECK(read_all(fd2, 30).find("\"key\":\"belt\"") != std::string::npos);
+
+    close(fd1);
+    close(fd2);
+    ipc.shutdown();
+}
+
+// A kv record as the controller pushes it
+static void push_kv_record(EventRing& ring, const KvEvent& ev) {
+    std::array<char, 128> rec;
+    ring.push(std::string_view(rec.data(), format_kv_record(rec, ev)));
+}
+
+TEST_CASE("kv_rate conflates each key to its latest value at a bounded rate") {
+    EventRing ring;
+    IpcServer ipc(ring);
+    CHECK(ipc.create());
+
+    int fast = connect_client();
+    int slow = connect_client();
+    poll_for(ipc, 30);
+    send_cmd(slow, "{\"cmd\":\"subscribe\",\"kv_rate\":10}");
+    poll_for(ipc, 30);
+
+    // A burst of one key: the first goes out, the rest collapse to the last
+    for (int i = 0; i < 5; i++) {
+        std::string v = std::to_string(i);
+        push_kv_record(ring, KvEvent{"motor", "hmph", v, 1.0 + i});
+    }
+    push_kv_record(ring, KvEvent{"motor", "inc", "4", 2.0});  // its own slot
+    push_kv_record(ring, KvEvent{"console", "hmph", "9", 2.0});
+    ring.push(build_status_event(StatusEvent{true, false, 0, 0, 50, 0, 0, 0, 0, 0, 0.0, 0.0, 0}));
+    poll_for(ipc, 20);
+
+    std::string all = read_all(fast, 10);
+    std::string got = read_all(slow, 10);
+    CHECK(std::count(all.begin(), all.end(), '\n') == 8);
+    CHECK(std::count(got.begin(), got.end(), '\n') == 4);
+    CHECK(got.find("\"source\":\"motor\",\"key\":\"hmph\",\"value\":\"0\"") != std::string::npos);
+    CHECK(got.find("\"key\":\"inc\",\"value\":\"4\"") != std::string::npos);
+    CHECK(got.find("\"key\":\"hmph\",\"value\":\"4\"") == std::string::npos);  // held
+
+    // A blocking poll wakes for the held value when its interval is up
+    std::atomic<bool> done{false};
+    std::thread guard([&]() {  // unblocks the test if the wakeup is missing
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        while (!done.load()) {
+            ipc.wake();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < 5 && got.find("\"key\":\"hmph\",\"value\":\"4\"") == std::string::npos; i++) {
+        ipc.poll(-1);
+        got += read_all(slow, 5);
+    }
+    auto waited = std::chrono::steady_clock::now() - t0;
+    done.store(true);
+    guard.join();
+    CHECK(waited < std::chrono::milliseconds(500));
+    CHECK(got.find("\"key\":\"hmph\",\"value\":\"4\"") != std::string::npos);
+    CHECK(got.find("\"value\":\"2\"") == std::string::npos);
+
+    // Bad rates are rejected; a plain subscribe turns conflation off
+    CHECK_FALSE(parse_command("{\"cmd\":\"subscribe\",\"kv_rate\":0}").has_value());
+    send_cmd(slow, "{\"cmd\":\"subscribe\"}");
+    poll_for(ipc, 30);
+    push_kv_record(ring, KvEvent{"motor", "hmph", "5", 6.0});
+    push_kv_record(ring, KvEvent{"motor", "hmph", "6", 6.1});
+    poll_for(ipc, 30);
+    got = read_all(slow, 10);
+    CHECK(std::count(got.begin(), got.end(), '\n') == 2);
+
+    close(fast);
+    close(slow);
+    ipc.shutdown();
+}
+
+TEST_CASE("hello switches a client to binary frames") {
+    EventRing ring;
+    IpcServer ipc(ring);
+    CHECK(ipc.create());
+
+    int json_fd = connect_client();
+    int bin_fd = connect_client();
+    poll_for(ipc, 30);
+    send_cmd(bin_fd, "{\"cmd\":\"hello\",\"format\":\"binary\"}");
+    poll_for(ipc, 30);
+    std::string ack = read_all(bin_fd, 30);
+    CHECK(ack == "{\"type\":\"hello\",\"format\":\"binary\",\"version\":1}\n");
+
+    std::array<char, 256> rec;
+    KvEvent ev{"console", "hmph", "32", 1.5};
+    size_t n = format_kv_record(rec, ev);
+    auto slot = ring.reserve();
+    std::copy_n(rec.data(), n, slot.buf.data());
+    ring.commit(slot, n);
+    ring.push("{\"type\":\"probe\"}\n");
+    poll_for(ipc, 50);
+
+    // JSON client: the record is formatted as the same JSON as before
+    CHECK(read_all(json_fd, 30) == build_kv_event(ev) + "{\"type\":\"probe\"}\n");
+
+    // Binary client: [u16 len][kv record], then [u16 len][tag 3][json]
+    std::string bin = read_all(bin_fd, 30);
+    CHECK(bin.size() == 2 + n + 2 + 1 + 16);
+    if (bin.size() == 2 + n + 2 + 1 + 16) {
+        CHECK(static_cast<uint8_t>(bin.at(0)) == n);
+        CHECK(bin.substr(2, n) == std::string(rec.data(), n));
+        CHECK(bin.at(2 + n + 2) == static_cast<char>(EventRecord::Json));
+        CHECK(bin.substr(2 + n + 3) == "{\"type\":\"probe\"}");
+    }
+
+    // Back to JSON: the ack arrives framed, then plain lines again
+    send_cmd(bin_fd, "{\"cmd\":\"hello\",\"format\":\"json\"}");
+    poll_for(ipc, 30);
+    ack = read_all(bin_fd, 30);
+    CHECK(ack.size() > 3);
+    if (ack.size() > 3) CHECK(ack.at(2) == static_cast<char>(EventRecord::Json));
+    ring.push("{\"type\":\"probe\"}\n");
+    poll_for(ipc, 50);
+    CHECK(read_all(bin_fd, 30) == "{\"type\":\"probe\"}\n");
+
+    close(json_fd);
+    close(bin_fd);
+    ipc.shutdown();
+}
+
+TEST_CASE("the snapshot goes to a new client, and to one asking, in its framing") {
+    EventRing ring;
+    IpcServer ipc(ring);
+    CHECK(ipc.create());
+    int calls = 0;
+    ipc.on_snapshot([&](const IpcServer::SnapshotEmit& emit) {
+        calls++;
+        emit("{\"type\":\"snapshot\",\"ts\":1}\n");
+        std::array<char, STATUS_RECORD_SIZE> rec{};
+        StatusEvent st{};
+        st.proxy = true;
+        emit(std::string_view(rec.data(), format_status_record(rec, st)));
+    });
+
+    int a = connect_client();
+    poll_for(ipc, 30);
+    CHECK(calls == 1);
+    StatusEvent st{};
+    st.proxy = true;
+    CHECK(read_all(a, 30) == "{\"type\":\"snapshot\",\"ts\":1}\n" + build_status_event(st));
+
+    // Nobody else is sent another client's snapshot
+    int b = connect_client();
+    poll_for(ipc, 30);
+    CHECK(calls == 2);
+    read_all(b, 30);
+    CHECK(read_all(a, 30).empty());
+
+    // On request, in binary frames: [len][tag 3][json], then [len][status record]
+    send_cmd(b, "{\"cmd\":\"hello\",\"format\":\"binary\"}");
+    poll_for(ipc, 30);
+    read_all(b, 30);
+    send_cmd(b, "{\"cmd\":\"snapshot\"}");
+    poll_for(ipc, 30);
+    std::string bin = read_all(b, 30);
+    CHECK(bin.size() == 2 + 1 + 26 + 2 + STATUS_RECORD_SIZE);
+    if (bin.size() == 2 + 1 + 26 + 2 + STATUS_RECORD_SIZE) {
+        CHECK(bin.at(2) == static_cast<char>(EventRecord::Json));
+        CHECK(bin.at(2 + 1 + 26 + 2) == static_cast<char>(EventRecord::Status));
+    }
+    CHECK(read_all(a, 30).empty());
+
+    close(a);
+    close(b);
+    ipc.shutdown();
+}
+
 // ── Client disconnect ───────────────────────────────────────────────
 
 TEST_CASE("server handles client disconnect gracefully") {
-    RingBuffer<> ring;
+    EventRing ring;
     IpcServer ipc(ring);
     CHECK(ipc.create());
 
@@ -303,7 +516,7 @@ TEST_CASE("server handles client disconnect gracefully") {
 // ── Max clients ─────────────────────────────────────────────────────
 
 TEST_CASE("server rejects connection beyond MAX_CLIENTS") {
-    RingBuffer<> ring;
+    EventRing ring;
     IpcServer ipc(ring);
     CHECK(ipc.create());
 
@@ -314,7 +527,7 @@ TEST_CASE("server rejects connection beyond MAX_CLIENTS") {
         poll_for(ipc, 20);
     }
 
-    // 5th connection should be accepted at TCP level but get error JSON
+    // One past the limit should be accepted at socket level but get error JSON
     fds[MAX_CLIENTS] = connect_client();
     poll_for(ipc, 50);
 
@@ -334,7 +547,7 @@ TEST_CASE("server rejects connection beyond MAX_CLIENTS") {
 // ── Malformed input ─────────────────────────────────────────────────
 
 TEST_CASE("server ignores malformed JSON") {
-    RingBuffer<> ring;
+    EventRing ring;
     IpcServer ipc(ring);
     CHECK(ipc.create());
 
@@ -356,7 +569,7 @@ TEST_CASE("server ignores malformed JSON") {
 }
 
 TEST_CASE("disconnect callback fires with remaining count") {
-    RingBuffer<> ring;
+    EventRing ring;
     IpcServer ipc(ring);
     CHECK(ipc.create());
 
@@ -389,7 +602,7 @@ TEST_CASE("disconnect callback fires with remaining count") {
 }
 
 TEST_CASE("heartbeat command dispatches to callback") {
-    RingBuffer<> ring;
+    EventRing ring;
     IpcServer ipc(ring);
     CHECK(ipc.create());
 
@@ -411,7 +624,7 @@ TEST_CASE("heartbeat command dispatches to callback") {
 }
 
 TEST_CASE("server handles empty lines") {
-    RingBuffer<> ring;
+    EventRing ring;
     IpcServer ipc(ring);
     CHECK(ipc.create());
 
@@ -431,3 +644,208 @@ TEST_CASE("server handles empty lines") {
     close(fd);
     ipc.shutdown();
 }
+
+// ── Slow clients / partial writes ───────────────────────────────────
+
+TEST_CASE("slow client receives every line intact and in order") {
+    EventRing ring;
+    IpcServer ipc(ring);
+    CHECK(ipc.create());
+
+    int fd = connect_client();
+    CHECK(fd >= 0);
+    struct timeval tv{2, 0};  // fail instead of hanging if lines go missing
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    poll_for(ipc, 30);  // accept
+    CHECK(ipc.num_clients() == 1);
+
+    std::atomic<bool> stop{false};
+    std::thread server([&]() { while (!stop) ipc.poll(5); });
+
+    // ~400 KB of events: far more than the socket buffer plus the
+    // client's outbound queue, so sends go partial and must resume.
+    constexpr int N = 2000;
+    for (int i = 0; i < N; i++) {
+        std::string msg = "{\"seq\":" + std::to_string(i) + ",\"pad\":\"" +
+                          std::string(180, 'x') + "\"}\n";
+        ring.push(msg);
+    }
+
+    // Let the socket fill before reading anything, then read slowly
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::string data;
+    char buf[1024];
+    long lines = 0;
+    while (lines < N) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) break;
+        lines += std::count(buf, buf + n, '\n');
+        data.append(buf, n);
+    }
+    stop = true;
+    server.join();
+
+    int expected = 0;
+    bool intact = true;
+    size_t start = 0;
+    for (size_t nl; (nl = data.find('\n', start)) != std::string::npos; start = nl + 1) {
+        std::string line = data.substr(start, nl - start);
+        std::string want = "{\"seq\":" + std::to_string(expected) + ",\"pad\":\"" +
+                           std::string(180, 'x') + "\"}";
+        if (line != want) { intact = false; break; }
+        expected++;
+    }
+    CHECK(intact);
+    CHECK(expected == N);
+
+    close(fd);
+    ipc.shutdown();
+}
+
+TEST_CASE("a client that falls a ring behind gets a gap event") {
+    EventRing ring;
+    IpcServer ipc(ring);
+    CHECK(ipc.create());
+
+    int fd = connect_client();
+    CHECK(fd >= 0);
+    poll_for(ipc, 30);  // accept
+    CHECK(ipc.num_clients() == 1);
+
+    // Overrun the ring before the server gets to flush any of it
+    constexpr int EXTRA = 10;
+    for (int i = 0; i < EventRing::size() + EXTRA; i++) {
+        ring.push("{\"seq\":" + std::to_string(i) + "}\n");
+    }
+
+    std::string last = "{\"seq\":" + std::to_string(EventRing::size() + EXTRA - 1) + "}\n";
+    std::string data;
+    for (int i = 0; i < 100 && data.find(last) == std::string::npos; i++) {
+        poll_for(ipc, 10);
+        data += read_all(fd, 0);
+    }
+    CHECK(data.rfind("{\"type\":\"gap\",\"dropped\":10}\n{\"seq\":10}\n", 0) == 0);
+    CHECK(data.find(last) != std::string::npos);
+
+    std::array<IpcServer::ClientMetrics, 1> m{};
+    CHECK(ipc.client_metrics(m) == 1);
+    CHECK(m[0].lost_msgs == EXTRA);
+    CHECK(m[0].gaps == 1);
+    CHECK(m[0].sent_bytes == data.size());
+
+    close(fd);
+    ipc.shutdown();
+}
+
+// ── Timers ──────────────────────────────────────────────────────────
+
+TEST_CASE("timer callback fires from poll") {
+    EventRing ring;
+    IpcServer ipc(ring);
+    CHECK(ipc.create());
+
+    int fired = 0;
+    int id = ipc.add_timer([&]() { fired++; });
+    CHECK(id >= 0);
+
+    poll_for(ipc, 50);
+    CHECK(fired == 0);  // timers start disarmed
+
+    ipc.arm_timer(id, 10, 10);
+    poll_for(ipc, 75);
+    CHECK(fired >= 3);
+
+    ipc.arm_timer(id, 0);
+    int before = fired;
+    poll_for(ipc, 50);
+    CHECK(fired == before);
+
+    ipc.shutdown();
+}
+
+TEST_CASE("wake interrupts a blocking poll") {
+    EventRing ring;
+    IpcServer ipc(ring);
+    CHECK(ipc.create());
+
+    std::thread waker([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        ipc.wake();
+    });
+    auto t0 = std::chrono::steady_clock::now();
+    ipc.poll(5000);
+    auto dt = std::chrono::steady_clock::now() - t0;
+    waker.join();
+    CHECK(std::chrono::duration_cast<std::chrono::milliseconds>(dt).count() < 1000);
+
+    ipc.shutdown();
+}
+
+// ── Restart handoff ─────────────────────────────────────────────────
+
+TEST_CASE("released clients keep their connection and filter in a new server") {
+    EventRing ring1;
+    IpcServer first(ring1);
+    CHECK(first.create());
+    int fd = connect_client();
+    poll_for(first, 30);
+    send_cmd(fd, "{\"cmd\":\"subscribe\",\"types\":[\"kv\"]}");
+    poll_for(first, 30);
+    ring1.push("{\"type\":\"probe\"}\n");
+
+    std::array<IpcServer::ClientHandoff, MAX_CLIENTS> out;
+    int n = first.release_clients(out);
+    CHECK(n == 1);
+    CHECK(first.num_clients() == 0);
+    first.shutdown();
+    if (n != 1) return;
+    CHECK(out.at(0).sub.types == 1u);
+    CHECK(read_all(fd, 30) == "{\"type\":\"probe\"}\n");  // flushed before release
+
+    EventRing ring2;
+    IpcServer second(ring2);
+    int connects = 0;
+    second.on_client_connect([&](int) { connects++; });
+    CHECK(second.create());
+    CHECK(second.adopt_client(out.at(0)));
+    CHECK(connects == 1);
+
+    ring2.push("{\"type\":\"status\",\"proxy\":true}\n");
+    ring2.push(build_kv_event(KvEvent{"motor", "belt", "7", 2.0}));
+    poll_for(second, 50);
+    CHECK(read_all(fd, 30) == build_kv_event(KvEvent{"motor", "belt", "7", 2.0}));
+
+    // Commands on the same connection reach the new server
+    int cmds = 0;
+    second.on_command([&](const IpcCommand&) { cmds++; });
+    send_cmd(fd, "{\"cmd\":\"status\"}");
+    poll_for(second, 50);
+    CHECK(cmds == 1);
+
+    close(fd);
+    second.shutdown();
+}
+
+TEST_CASE("an inherited listener is used as is and its path survives shutdown") {
+    unlink(SOCK_PATH);
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, SOCK_PATH, sizeof(addr.sun_path) - 1);
+    CHECK(bind(lfd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0);
+    CHECK(listen(lfd, 4) == 0);
+
+    EventRing ring;
+    IpcServer ipc(ring);
+    CHECK(ipc.create(lfd));
+    int fd = connect_client();
+    CHECK(fd >= 0);
+    poll_for(ipc, 30);
+    CHECK(ipc.num_clients() == 1);
+
+    close(fd);
+    ipc.shutdown();
+    CHECK(access(SOCK_PATH, F_OK) == 0);  // the socket unit's, not ours to remove
+    unlink(SOCK_PATH);
+}
@@ -0,0 +1,258 @@
+/*
+ * test_journal.cpp — Tests for BusJournal / JournalReader
+ *
+ * Each test writes segments into its own mkdtemp() directory under /tmp.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "journal.h"
+#include "config.h"
+#include "metrics.h"
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+struct TempDir {
+    TempDir() {
+        std::string tmpl = "/tmp/test_journal.XXXXXX";
+        if (mkdtemp(tmpl.data())) path = tmpl;
+    }
+    ~TempDir() {
+        for (int slot = 0; slot < 64; slot++) unlink(BusJournal::segment_path(path, slot).c_str());
+        rmdir(path.c_str());
+    }
+    std::string path;
+};
+
+static KvPair make_pair(std::string_view key, std::string_view value) {
+    KvPair kv{};
+    kv.id = kv_key_lookup(key);
+    kv.key_len = static_cast<uint8_t>(key.size());
+    kv.len = static_cast<uint8_t>(key.size() + 1 + value.size());  // key:value
+    std::copy(key.begin(), key.end(), kv.text.begin());
+    kv.text.at(key.size()) = ':';
+    std::copy(value.begin(), value.end(), kv.text.begin() + key.size() + 1);
+    return kv;
+}
+
+static std::vector<std::string> read_all(const std::string& path) {
+    std::vector<std::string> out;
+    JournalReader r;
+    if (!r.open(path)) return out;
+    JournalRecord rec;
+    while (r.next(rec)) {
+        out.push_back(std::to_string(static_cast<int>(rec.src)) + " " +
+                      std::string(rec.key) + "=" + std::string(rec.data));
+    }
+    return out;
+}
+
+static std::streamoff file_size(const std::string& path) {
+    struct stat st{};
+    return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+TEST_CASE("kv frames round-trip with timestamps") {
+    TempDir dir;
+    BusJournal j(JournalConfig{dir.path, 64 * 1024, 2});
+    CHECK(j.open());
+    CHECK(j.segment_seq() == 0);
+
+    uint64_t t = mono_us() + 1000;  // explicit stamps after the segment start
+    j.record_kv(JournalSource::Console, make_pair("hmph", "4B0"), t);
+    j.record_kv(JournalSource::Motor, "inc", "A", t + 250);
+    j.record_kv(JournalSource::Emulate, "amps", "", t + 250);
+    CHECK(j.records() == 3);
+    j.close();
+
+    JournalReader r;
+    CHECK(r.open(BusJournal::segment_path(dir.path, 0)));
+    CHECK(r.header().seq == 0);
+    JournalRecord rec;
+    CHECK(r.next(rec));
+    CHECK(rec.src == JournalSource::Console);
+    CHECK(rec.kind == JournalKind::Kv);
+    CHECK(rec.id == KvKey::Hmph);
+    CHECK(rec.key == "hmph");
+    CHECK(rec.data == "4B0");
+    CHECK(rec.t_us == t);
+    uint64_t t0 = rec.t_us;
+    CHECK(r.next(rec));
+    CHECK(rec.src == JournalSource::Motor);
+    CHECK(rec.key == "inc");
+    CHECK(rec.data == "A");
+    CHECK(rec.t_us - t0 == 250);
+    CHECK(r.next(rec));
+    CHECK(rec.src == JournalSource::Emulate);
+    CHECK(rec.key == "amps");
+    CHECK(rec.data.empty());
+    CHECK(rec.t_us - t0 == 250);
+    CHECK_FALSE(r.next(rec));
+}
+
+TEST_CASE("unchanged values are stored as repeats per source") {
+    TempDir dir;
+    BusJournal j(JournalConfig{dir.path, 64 * 1024, 2});
+    CHECK(j.open());
+    j.record_kv(JournalSource::Console, "hmph", "4B0");
+    j.record_kv(JournalSource::Console, "hmph", "4B0");
+    j.record_kv(JournalSource::Motor, "hmph", "4B0");   // other source: full record
+    j.record_kv(JournalSource::Console, "hmph", "4B1");
+    j.record_kv(JournalSource::Console, "hmph", "4B1");
+    j.close();
+
+    JournalReader r;
+    CHECK(r.open(BusJournal::segment_path(dir.path, 0)));
+    std::vector<JournalKind> kinds;
+    std::vector<std::string> values;
+    JournalRecord rec;
+    while (r.next(rec)) {
+        kinds.push_back(rec.kind);
+        values.emplace_back(rec.data);
+    }
+    CHECK(kinds == std::vector<JournalKind>{ JournalKind::Kv, JournalKind::Repeat, JournalKind::Kv,
+                                             JournalKind::Kv, JournalKind::Repeat });
+    CHECK(values == std::vector<std::string>{ "4B0", "4B0", "4B0", "4B1", "4B1" });
+}
+
+TEST_CASE("unknown keys carry their text and never repeat") {
+    TempDir dir;
+    BusJournal j(JournalConfig{dir.path, 64 * 1024, 2});
+    CHECK(j.open());
+    j.record_kv(JournalSource::Console, "xyz", "1");
+    j.record_kv(JournalSource::Console, "xyz", "1");
+    j.close();
+
+    JournalReader r;
+    CHECK(r.open(BusJournal::segment_path(dir.path, 0)));
+    JournalRecord rec;
+    for (int i = 0; i < 2; i++) {
+        CHECK(r.next(rec));
+        CHECK(rec.kind == JournalKind::Kv);
+        CHECK(rec.id == KvKey::Unknown);
+        CHECK(rec.key == "xyz");
+        CHECK(rec.data == "1");
+    }
+    CHECK_FALSE(r.next(rec));
+}
+
+TEST_CASE("raw bytes are split into bounded chunks") {
+    TempDir dir;
+    BusJournal j(JournalConfig{dir.path, 64 * 1024, 2});
+    CHECK(j.open());
+    std::vector<uint8_t> bytes(JOURNAL_RAW_MAX * 2 + 10);
+    for (size_t i = 0; i < bytes.size(); i++) bytes.at(i) = static_cast<uint8_t>(i);
+    j.record_raw(JournalSource::Motor, bytes);
+    CHECK(j.records() == 3);
+    j.close();
+
+    JournalReader r;
+    CHECK(r.open(BusJournal::segment_path(dir.path, 0)));
+    std::string joined;
+    JournalRecord rec;
+    while (r.next(rec)) {
+        CHECK(rec.kind == JournalKind::Raw);
+        CHECK(rec.data.size() <= JOURNAL_RAW_MAX);
+        joined += rec.data;
+    }
+    CHECK(joined.size() == bytes.size());
+    CHECK(std::equal(joined.begin(), joined.end(), bytes.begin(),
+                     [](char c, uint8_t b) { return static_cast<uint8_t>(c) == b; }));
+}
+
+TEST_CASE("full segments rotate through the slots and restart repeats") {
+    TempDir dir;
+    BusJournal j(JournalConfig{dir.path, 4096, 3});
+    CHECK(j.open());
+    // ~6 bytes per record: 3000 records fill four 4 KB segments
+    for (int i = 0; i < 3000; i++) {
+        j.record_kv(JournalSource::Console, "belt", std::to_string(i % 1000));
+    }
+    uint64_t seq = j.segment_seq();
+    CHECK(seq >= 3);
+    j.close();
+
+    for (int slot = 0; slot < 3; slot++) {
+        CHECK(file_size(BusJournal::segment_path(dir.path, slot)) == 4096);
+    }
+
+    // Current segment is self-contained: first record is a full Kv
+    JournalReader r;
+    CHECK(r.open(BusJournal::segment_path(dir.path, static_cast<int>(seq % 3))));
+    CHECK(r.header().seq == seq);
+    JournalRecord rec;
+    CHECK(r.next(rec));
+    CHECK(rec.kind == JournalKind::Kv);
+    CHECK(rec.key == "belt");
+}
+
+TEST_CASE("reopening continues after the newest segment") {
+    TempDir dir;
+    {
+        BusJournal j(JournalConfig{dir.path, 4096, 4});
+        CHECK(j.open());
+        j.record_kv(JournalSource::Console, "inc", "5");
+    }
+    BusJournal j(JournalConfig{dir.path, 4096, 4});
+    CHECK(j.open());
+    CHECK(j.segment_seq() == 1);
+    j.record_kv(JournalSource::Console, "inc", "6");
+    j.close();
+
+    CHECK(read_all(BusJournal::segment_path(dir.path, 0)) == std::vector<std::string>{ "1 inc=5" });
+    CHECK(read_all(BusJournal::segment_path(dir.path, 1)) == std::vector<std::string>{ "1 inc=6" });
+}
+
+TEST_CASE("disabled or unwritable journal stays closed") {
+    BusJournal off(JournalConfig{});
+    CHECK_FALSE(off.open());
+    off.record_kv(JournalSource::Console, "inc", "5");  // no-op
+    CHECK(off.records() == 0);
+
+    BusJournal bad(JournalConfig{"/proc/no_such_dir/journal", 4096, 2});
+    CHECK_FALSE(bad.open());
+    CHECK_FALSE(bad.is_open());
+
+    JournalReader r;
+    CHECK_FALSE(r.open("/proc/no_such_dir/journal-0.tmj"));
+}
+
+TEST_CASE("reader rejects files without the journal magic") {
+    TempDir dir;
+    std::string path = dir.path + "/journal-0.tmj";
+    FILE* f = std::fopen(path.c_str(), "w");
+    CHECK(f != nullptr);
+    if (!f) return;
+    std::string junk(128, 'x');
+    std::fwrite(junk.data(), 1, junk.size(), f);
+    std::fclose(f);
+
+    JournalReader r;
+    CHECK_FALSE(r.open(path));
+}
+
+TEST_CASE("config journal section") {
+    constexpr std::string_view PINS =
+        R"("console_read":{"gpio":27},"motor_write":{"gpio":22},"motor_read":{"gpio":17})";
+    GpioConfig cfg;
+
+    CHECK(parse_gpio_config("{" + std::string(PINS) + "}", &cfg).ok);
+    CHECK(cfg.journal_dir.empty());
+
+    CHECK(parse_gpio_config("{" + std::string(PINS) +
+                            R"(,"journal":{"dir":"/var/log/tm","segment_kb":64,"segments":3}})", &cfg).ok);
+    CHECK(cfg.journal_dir == "/var/log/tm");
+    CHECK(cfg.journal_segment_kb == 64);
+    CHECK(cfg.journal_segments == 3);
+
+    CHECK_FALSE(parse_gpio_config("{" + std::string(PINS) + R"(,"journal":{}})", &cfg).ok);
+    CHECK_FALSE(parse_gpio_config("{" + std::string(PINS) + R"(,"journal":{"dir":"/x","segments":0}})", &cfg).ok);
+    auto res = parse_gpio_config("{" + std::string(PINS) + R"(,"journal":{"dir":"/x","segment_kb":1}})", &cfg);
+    CHECK_FALSE(res.ok);
+    CHECK(res.error.find("segment_kb") != std::string::npos);
+}
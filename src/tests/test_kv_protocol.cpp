@@ -1,12 +1,17 @@
 /*
- * test_kv_protocol.cpp — Tests for KV parser/builder and hex encoding
+ * test_kv_protocol.cpp — Tests for KV parser/builder, hex encoding and change filter
  */
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #define DOCTEST_CONFIG_NO_EXCEPTIONS
 #include <doctest.h>
 #include "kv_protocol.h"
+#include "kv_filter.h"
 #include <span>
+#include <array>
+#include <string_view>
+#include <string>
+#include <algorithm>
 
 // ── kv_parse tests ──────────────────────────────────────────────────
 
@@ -223,3 +228,259 @@ TEST_CASE("encode/decode incline round-trip (half-pct)") {
         CHECK(decoded == hp);
     }
 }
+
+// ── Allocation-free encoders / constexpr frames ─────────────────────
+
+TEST_CASE("span encoders match the string encoders") {
+    std::array<char, 8> buf{};
+    for (int t = 0; t <= 120; t++) {
+        size_t n = encode_speed_hex(buf, t);
+        CHECK(std::string_view(buf.data(), n) == encode_speed_hex(t));
+    }
+    for (int hp = 0; hp <= 198; hp++) {
+        size_t n = encode_incline_hex(buf, hp);
+        CHECK(std::string_view(buf.data(), n) == encode_incline_hex(hp));
+    }
+}
+
+TEST_CASE("span kv_build writes the frame or nothing") {
+    std::array<char, 16> buf{};
+    size_t n = kv_build(buf, "hmph", "78");
+    CHECK(std::string_view(buf.data(), n) == "[hmph:78]\xff");
+
+    n = kv_build(buf, "amps");
+    CHECK(std::string_view(buf.data(), n) == "[amps]\xff");
+
+    std::array<char, 6> small{};
+    CHECK(kv_build(small, "hmph", "78") == 0);
+}
+
+static_assert(make_kv_frame("inc", "A").wire() == "[inc:A]\xff");
+static_assert(make_kv_frame("amps").value().empty());
+
+TEST_CASE("make_kv_frame_table covers every value") {
+    static constexpr auto table = make_kv_frame_table<120>("hmph", encode_speed_hex);
+    CHECK(table.size() == 121);
+    CHECK(table.at(0).wire() == "[hmph:0]\xff");
+    CHECK(table.at(12).key() == "hmph");
+    CHECK(table.at(12).value() == "78");
+    CHECK(table.at(120).wire() == kv_build("hmph", encode_speed_hex(120)));
+}
+
+// ── KvStreamParser ──────────────────────────────────────────────────
+
+// Feed `data` through the parser's write_space/commit, then parse
+static int stream_feed(KvStreamParser& p, std::string_view data, std::span<KvPair> out) {
+    while (!data.empty()) {
+        auto space = p.write_space();
+        size_t n = std::min(space.size(), data.size());
+        std::copy_n(data.data(), n, space.data());
+        p.commit(n);
+        data.remove_prefix(n);
+    }
+    return p.parse(out);
+}
+
+TEST_CASE("a stamped stream parser dates each pair by its ']'") {
+    KvStreamParser parser;
+    std::array<KvPair, 4> out{};
+    CHECK(stream_feed(parser, "[amps]\xff", out) == 1);
+    CHECK(out.at(0).t_ns == 0);  // never stamped
+
+    // "[inc:5]" ends 4 bytes before the last byte of this commit
+    auto space = parser.write_space();
+    std::string_view data = "[inc:5][hm";
+    std::copy_n(data.data(), data.size(), space.data());
+    parser.commit(data.size());
+    parser.stamp(1000000, 1000);
+    CHECK(parser.parse(out) == 1);
+    CHECK(out.at(0).t_ns == 1000000 - 3 * 1000);
+
+    // The rest of "[hmph:..]" comes in a later read
+    space = parser.write_space();
+    data = "ph:78]\xff";
+    std::copy_n(data.data(), data.size(), space.data());
+    parser.commit(data.size());
+    parser.stamp(5000000, 1000);
+    CHECK(parser.parse(out) == 1);
+    CHECK(out.at(0).key_view() == "hmph");
+    CHECK(out.at(0).t_ns == 5000000 - 1000);
+}
+
+TEST_CASE("stream parser matches kv_parse on a complete buffer") {
+    using namespace std::string_view_literals;
+    auto data = "\xff[inc:5]\x00[amps]\xff[bad\x01]garbage[hmph:78]\xff"sv;
+    std::array<KvPair, 8> a{}, b{};
+    int consumed = 0;
+    // reinterpret_cast: char -> uint8_t aliasing (standard-allowed)
+    int na = kv_parse(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(data.data()),
+                                               data.size()), a.data(), 8, &consumed);
+    KvStreamParser parser;
+    int nb = stream_feed(parser, data, b);
+
+    CHECK(na == 3);
+    CHECK(nb == na);
+    for (int i = 0; i < std::min(na, nb); i++) {
+        CHECK(a.at(i).key_view() == b.at(i).key_view());
+        CHECK(a.at(i).value_view() == b.at(i).value_view());
+    }
+    CHECK(parser.pending() == 0);
+}
+
+TEST_CASE("parsers count accepted frames, rejects and stray bytes alike") {
+    using namespace std::string_view_literals;
+    std::string oversize = "[" + std::string(KV_FIELD_SIZE, 'k') + "]";
+    std::string data = std::string("\xff[inc:5]\x00[amps]\xff[bad\x01]garbage[]"sv) + oversize + "[hmph:78]\xff";
+    std::array<KvPair, 8> out{};
+    int consumed = 0;
+    KvParseStats a{};
+    // reinterpret_cast: char -> uint8_t aliasing (standard-allowed)
+    kv_parse(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(data.data()), data.size()),
+             out.data(), 8, &consumed, &a);
+    KvStreamParser parser;
+    stream_feed(parser, data, out);
+    const auto& b = parser.stats();
+
+    for (const KvParseStats* s : std::array<const KvParseStats*, 2>{&a, &b}) {
+        CHECK(s->bytes == data.size());
+        CHECK(s->frames == 3);
+        CHECK(s->nonprintable == 1);
+        CHECK(s->bad_length == 2);     // [] and the oversize frame
+        CHECK(s->stray_bytes == 7);    // "garbage"; \xff and \x00 are delimiters
+        CHECK(s->overflow_bytes == 0);
+    }
+}
+
+TEST_CASE("stream parser resumes a frame split across reads") {
+    KvStreamParser parser;
+    std::array<KvPair, 4> out{};
+    CHECK(stream_feed(parser, "[hm", out) == 0);
+    CHECK(stream_feed(parser, "ph:7", out) == 0);
+    CHECK(stream_feed(parser, "8]\xff[belt]", out) == 2);
+    CHECK(out.at(0).key_view() == "hmph");
+    CHECK(out.at(0).value_view() == "78");
+    CHECK(out.at(1).key_view() == "belt");
+    CHECK(parser.pending() == 0);
+}
+
+TEST_CASE("stream parser handles frames wrapping the ring") {
+    KvStreamParser parser;
+    std::array<KvPair, 4> out{};
+    std::string fill(KV_STREAM_BUF_SIZE - 3, '\xff');
+    CHECK(stream_feed(parser, fill, out) == 0);
+    CHECK(stream_feed(parser, "[inc:1E]", out) == 1);
+    CHECK(out.at(0).key_view() == "inc");
+    CHECK(out.at(0).value_view() == "1E");
+    CHECK(parser.dropped_bytes() == 0);
+}
+
+TEST_CASE("stream parser returns at most out.size() pairs and keeps the rest") {
+    KvStreamParser parser;
+    std::array<KvPair, 2> out{};
+    CHECK(stream_feed(parser, "[a][b][c]", out) == 2);
+    CHECK(parser.parse(out) == 1);
+    CHECK(out.at(0).key_view() == "c");
+}
+
+TEST_CASE("stream parser drops an unterminated frame that fills the ring") {
+    KvStreamParser parser;
+    std::array<KvPair, 4> out{};
+    std::string junk = "[" + std::string(KV_STREAM_BUF_SIZE - 1, 'x');
+    CHECK(stream_feed(parser, junk, out) == 0);
+    CHECK(parser.pending() == KV_STREAM_BUF_SIZE);
+
+    CHECK(stream_feed(parser, "[belt:0]", out) == 1);
+    CHECK(parser.dropped_bytes() == KV_STREAM_BUF_SIZE);
+    CHECK(parser.stats().overflow_bytes == KV_STREAM_BUF_SIZE);
+    CHECK(parser.stats().stray_bytes == 0);
+    CHECK(out.at(0).key_view() == "belt");
+}
+
+TEST_CASE("a stream parser set to some keys skips the other frames") {
+    KvStreamParser parser;
+    parser.set_keys(kv_key_bit(KvKey::Inc) | kv_key_bit(KvKey::Hmph));
+    std::array<KvPair, 8> out{};
+    CHECK(stream_feed(parser, "[inc:5]\xff[amps]\xff[hmph:78]\xff[belt:0][zzzzzzzzzz:1][bad\x01]", out) == 2);
+    CHECK(out.at(0).key_view() == "inc");
+    CHECK(out.at(1).key_view() == "hmph");
+    CHECK(parser.stats().frames == 2);
+    CHECK(parser.stats().skipped == 4);      // amps, belt, the unknown key and the unchecked bad frame
+    CHECK(parser.stats().nonprintable == 0);
+
+    // A key wrapping the ring end is still read whole
+    std::string fill(KV_STREAM_BUF_SIZE - parser.stats().bytes % KV_STREAM_BUF_SIZE - 2, '\xff');
+    CHECK(stream_feed(parser, fill, out) == 0);
+    CHECK(stream_feed(parser, "[hmph:1][amps]", out) == 1);
+    CHECK(out.at(0).key_view() == "hmph");
+
+    parser.set_keys(KV_PARSE_ALL);
+    CHECK(stream_feed(parser, "[amps][qq]", out) == 2);
+    CHECK(parser.stats().skipped == 5);
+}
+
+// ── Interned keys / compact KvPair ──────────────────────────────────
+
+static_assert(kv_key_lookup("hmph") == KvKey::Hmph);
+static_assert(kv_key_lookup("lftg") == KvKey::Lftg);
+static_assert(sizeof(KvPair) <= 80);
+
+TEST_CASE("kv_key_lookup maps every protocol key and rejects others") {
+    for (size_t i = 1; i < KV_KEY_NAMES.size(); i++) {
+        CHECK(kv_key_lookup(KV_KEY_NAMES.at(i)) == static_cast<KvKey>(i));
+        CHECK(kv_key_name(static_cast<KvKey>(i)) == KV_KEY_NAMES.at(i));
+    }
+    CHECK(kv_key_lookup("") == KvKey::Unknown);
+    CHECK(kv_key_lookup("hmp") == KvKey::Unknown);
+    CHECK(kv_key_lookup("hmphx") == KvKey::Unknown);
+    CHECK(kv_key_lookup("foo") == KvKey::Unknown);
+}
+
+TEST_CASE("parsed pairs carry the interned key and keep unknown key text") {
+    uint8_t data[] = "[hmph:78][amps][zz:9][inc:]";
+    std::array<KvPair, 4> pairs{};
+    int consumed = 0;
+    int n = kv_parse(std::span<const uint8_t>(data, sizeof(data) - 1), pairs.data(), 4, &consumed);
+
+    CHECK(n == 4);
+    CHECK(pairs.at(0).id == KvKey::Hmph);
+    CHECK(pairs.at(0).value_view() == "78");
+    CHECK(pairs.at(1).id == KvKey::Amps);
+    CHECK(pairs.at(1).value_view().empty());
+    CHECK(pairs.at(2).id == KvKey::Unknown);
+    CHECK(pairs.at(2).key_view() == "zz");
+    CHECK(pairs.at(2).value_view() == "9");
+    CHECK(pairs.at(3).id == KvKey::Inc);
+    CHECK(pairs.at(3).value_view().empty());
+}
+
+// ── KvChangeFilter ──────────────────────────────────────────────────
+
+TEST_CASE("change filter passes first sight and changes, drops repeats") {
+    KvChangeFilter f;
+    CHECK(f.should_emit(KvKey::Belt, "0"));
+    CHECK_FALSE(f.should_emit(KvKey::Belt, "0"));
+    CHECK(f.should_emit(KvKey::Vbus, "0"));    // keys are independent
+    CHECK(f.should_emit(KvKey::Belt, "1"));
+    CHECK_FALSE(f.should_emit(KvKey::Belt, "1"));
+    CHECK(f.should_emit(KvKey::Belt, ""));     // empty is a value too
+    CHECK_FALSE(f.should_emit(KvKey::Belt, ""));
+    CHECK(f.suppressed() == 3);
+}
+
+TEST_CASE("change filter always passes unknown keys") {
+    KvChangeFilter f;
+    CHECK(f.should_emit(KvKey::Unknown, "x"));
+    CHECK(f.should_emit(KvKey::Unknown, "x"));
+    CHECK(f.suppressed() == 0);
+}
+
+TEST_CASE("change filter resync re-emits each key once") {
+    KvChangeFilter f;
+    CHECK(f.should_emit(KvKey::Part, "6"));
+    CHECK(f.should_emit(KvKey::Diag, "0"));
+    f.resync();
+    CHECK(f.should_emit(KvKey::Part, "6"));
+    CHECK_FALSE(f.should_emit(KvKey::Part, "6"));
+    CHECK(f.should_emit(KvKey::Diag, "0"));
+    CHECK_FALSE(f.should_emit(KvKey::Diag, "0"));
+}
@@ -0,0 +1,64 @@
+/*
+ * test_metrics.cpp — Tests for LatencyHistogram
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "metrics.h"
+#include <thread>
+#include <vector>
+
+static_assert(LatencyHistogram::bucket_for(0) == 0);
+static_assert(LatencyHistogram::bucket_for(1) == 1);
+static_assert(LatencyHistogram::bucket_for(1023) == 10);
+static_assert(LatencyHistogram::bucket_for(1024) == 11);
+static_assert(LatencyHistogram::bucket_for(UINT64_MAX) == HIST_BUCKETS - 1);
+static_assert(LatencyHistogram::bucket_upper(10) == 1023);
+
+TEST_CASE("empty histogram summarizes to zeros") {
+    LatencyHistogram h;
+    auto s = h.summary();
+    CHECK(s.count == 0);
+    CHECK(s.mean_us == 0.0);
+    CHECK(s.max_us == 0);
+}
+
+TEST_CASE("percentiles are bucket upper bounds clamped to max") {
+    LatencyHistogram h;
+    for (int i = 0; i < 99; i++) h.record(100);   // bucket [64, 128)
+    h.record(5000);                               // bucket [4096, 8192)
+    auto s = h.summary();
+
+    CHECK(s.count == 100);
+    CHECK(s.mean_us == doctest::Approx(149.0));
+    CHECK(s.p50_us == 127);
+    CHECK(s.p99_us == 127);
+    CHECK(s.max_us == 5000);
+
+    h.record(5000);
+    CHECK(h.summary().p99_us == 5000);  // top bucket clamps to max
+}
+
+TEST_CASE("reset clears all samples") {
+    LatencyHistogram h;
+    h.record(42);
+    h.reset();
+    CHECK(h.summary().count == 0);
+    CHECK(h.summary().max_us == 0);
+}
+
+TEST_CASE("concurrent record() loses no samples") {
+    LatencyHistogram h;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&h, t]() {
+            for (int i = 0; i < 10000; i++) h.record(static_cast<uint64_t>(t * 1000 + i % 7));
+        });
+    }
+    for (auto& th : threads) th.join();
+
+    auto s = h.summary();
+    CHECK(s.count == 40000);
+    CHECK(s.max_us == 3006);
+}
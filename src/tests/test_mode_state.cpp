@@ -10,6 +10,12 @@
 #include <doctest.h>
 #include "mode_state.h"
 #include <cstring>
+#include <ctime>
+#include <array>
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <chrono>
 
 // ── Initial state ───────────────────────────────────────────────────
 
@@ -379,3 +385,172 @@ TEST_CASE("byte counters") {
     mode.add_console_bytes(200);
     CHECK(mode.console_bytes() == 300);
 }
+
+// ── Batches ─────────────────────────────────────────────────────────
+
+TEST_CASE("apply runs steps in order and publishes once") {
+    ModeStateMachine mode;
+    std::vector<bool> calls;
+    mode.set_emulate_callback([&](bool start) { calls.push_back(start); });
+
+    uint32_t gen = mode.generation();
+    std::array<ModeStep, 3> steps = {{
+        {ModeStep::Kind::Emulate, 1},
+        {ModeStep::Kind::Speed, 150},   // clamped
+        {ModeStep::Kind::Incline, 6},
+    }};
+    auto r = mode.apply(steps);
+    CHECK(r.emulate_started);
+    CHECK(mode.generation() == gen + 1);
+    CHECK(calls == std::vector<bool>{true});
+    auto snap = mode.snapshot();
+    CHECK(snap.emulate_enabled);
+    CHECK(snap.speed_tenths == MAX_SPEED_TENTHS);
+    CHECK(snap.incline == 6);
+
+    // Emulate on while emulating keeps the values, as request_emulate does
+    std::array<ModeStep, 2> again = {{{ModeStep::Kind::Emulate, 1}, {ModeStep::Kind::Speed, 40}}};
+    mode.apply(again);
+    CHECK(mode.speed_tenths() == 40);
+    CHECK(mode.incline() == 6);
+
+    // A stop and restart inside one batch is no transition at all
+    gen = mode.generation();
+    std::array<ModeStep, 3> bounce = {{
+        {ModeStep::Kind::Proxy, 1}, {ModeStep::Kind::Emulate, 1}, {ModeStep::Kind::Speed, 20},
+    }};
+    r = mode.apply(bounce);
+    CHECK_FALSE(r.changed);
+    CHECK(calls.size() == 1);
+    CHECK(mode.generation() == gen + 1);
+    CHECK(mode.speed_tenths() == 20);
+    CHECK(mode.incline() == 0);  // zeroed by the restart
+
+    // Nothing changes: nothing published
+    gen = mode.generation();
+    std::array<ModeStep, 1> same = {{{ModeStep::Kind::Speed, 20}}};
+    mode.apply(same);
+    CHECK(mode.generation() == gen);
+
+    std::array<ModeStep, 2> off = {{{ModeStep::Kind::Emulate, 0}, {ModeStep::Kind::Proxy, 1}}};
+    r = mode.apply(off);
+    CHECK(r.emulate_stopped);
+    CHECK(calls == std::vector<bool>{true, false});
+    CHECK(mode.is_proxy());
+}
+
+TEST_CASE("overlay starts at zero, keeps speed/incline, and leaves to proxy") {
+    ModeStateMachine mode;
+    std::vector<bool> calls;
+    mode.set_emulate_callback([&](bool start) { calls.push_back(start); });
+    mode.set_speed(50);  // emulating at 5.0 mph
+
+    auto r = mode.request_overlay(true);
+    CHECK(r.changed);
+    CHECK(r.emulate_stopped);
+    CHECK(calls == std::vector<bool>{true, false});
+    CHECK(mode.is_overlay());
+    CHECK(mode.is_controlling());
+    CHECK_FALSE(mode.is_proxy());
+    CHECK(mode.speed_tenths() == 0);
+    CHECK(mode.snapshot().mode == Mode::Overlay);
+
+    // Targets set in overlay don't start emulate
+    r = mode.set_speed(30);
+    CHECK_FALSE(r.emulate_started);
+    mode.set_incline(4);
+    std::array<ModeStep, 1> step = {{{ModeStep::Kind::Speed, 35}}};
+    mode.apply(step);
+    CHECK(mode.is_overlay());
+    CHECK(mode.speed_tenths() == 35);
+    CHECK(mode.incline() == 4);
+    CHECK(calls.size() == 2);
+
+    // A console change hands back to proxy without an emulate stop
+    mode.auto_proxy_on_console_change("hmph", "0", "78");
+    CHECK(mode.is_proxy());
+    CHECK(calls.size() == 2);
+
+    mode.request_overlay(true);
+    CHECK(mode.request_overlay(false).changed);
+    CHECK(mode.is_proxy());
+    CHECK_FALSE(mode.request_overlay(false).changed);
+
+    // The watchdog leaves overlay too
+    mode.request_overlay(true);
+    mode.set_speed(20);
+    mode.watchdog_reset_to_proxy();
+    CHECK(mode.is_proxy());
+    CHECK_FALSE(mode.is_controlling());
+    CHECK(mode.speed_tenths() == 0);
+}
+
+// ── Change notification ─────────────────────────────────────────────
+
+static int64_t mono_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+TEST_CASE("snapshots never mix two states while one is published") {
+    ModeStateMachine mode;
+    std::atomic<bool> done{false};
+    // Every batch sets speed and incline to the same value
+    std::thread writer([&]() {
+        for (int i = 0; i < 20000; i++) {
+            int v = i % 100;
+            std::array<ModeStep, 2> steps = {{{ModeStep::Kind::Speed, v}, {ModeStep::Kind::Incline, v}}};
+            mode.apply(steps);
+        }
+        done.store(true);
+    });
+    int torn = 0;
+    uint32_t last_gen = 0;
+    bool gen_backwards = false;
+    while (!done.load()) {
+        auto s = mode.snapshot();
+        if (s.speed_tenths != s.incline || s.speed_raw != s.speed_tenths * 10) torn++;
+        if (s.speed_tenths > 0 && !s.emulate_enabled) torn++;
+        gen_backwards |= s.generation < last_gen;
+        last_gen = s.generation;
+    }
+    writer.join();
+    CHECK(torn == 0);
+    CHECK_FALSE(gen_backwards);
+    CHECK(mode.snapshot().generation == mode.generation());
+    CHECK(mode.generation() > 0);
+}
+
+TEST_CASE("wait_change wakes on a speed change and times out otherwise") {
+    ModeStateMachine mode;
+    uint32_t gen = mode.wake_seq();
+    CHECK_FALSE(mode.wait_change(gen, mono_ns() + 20000000LL));  // 20 ms, nothing happens
+
+    std::thread setter([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        mode.set_speed(30);
+    });
+    int64_t t0 = mono_ns();
+    CHECK(mode.wait_change(gen, t0 + 2000000000LL));
+    CHECK(mono_ns() - t0 < 500000000LL);  // woken, not timed out
+    setter.join();
+    CHECK(mode.wake_seq() != gen);
+    CHECK(mode.wait_change(gen, 0));  // already changed: returns at once
+}
+
+TEST_CASE("notify_waiters wakes wait_change without changing the generation") {
+    ModeStateMachine mode;
+    uint32_t gen = mode.generation();
+    uint32_t seen = mode.wake_seq();
+    std::thread notifier([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        mode.notify_waiters();
+    });
+    int64_t t0 = mono_ns();
+    CHECK(mode.wait_change(seen, t0 + 2000000000LL));
+    CHECK(mono_ns() - t0 < 500000000LL);
+    notifier.join();
+    CHECK(mode.generation() == gen);
+    CHECK(mode.wake_seq() != seen);
+}
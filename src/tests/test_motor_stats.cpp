@@ -0,0 +1,118 @@
+/*
+ * test_motor_stats.cpp — Tests for the rolling motor aggregates
+ *
+ * MotorStats windows on explicit time (bucket boundaries, ring reuse,
+ * values that aren't hex), then stats events from a live
+ * TreadmillController fed motor amps/belt reports.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "motor_stats.h"
+#include "gpio_mock.h"
+#include "treadmill_io.h"
+#include "ipc_test_util.h"
+
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+static constexpr uint64_t S = 1000000;
+static constexpr size_t AMPS = 0;
+static constexpr size_t BELT = 2;
+
+TEST_CASE("windows are the last 1, 10 and 60 whole seconds") {
+    MotorStats st;
+    MotorStatWindows w;
+    CHECK_FALSE(st.summary(AMPS, 100 * S, w));
+
+    // 50 s ago, 5 s ago, and twice in the last whole second
+    CHECK(st.record(KvKey::Amps, "1E", 50 * S + 200000));
+    CHECK(st.record(KvKey::Amps, "A", 95 * S));
+    CHECK(st.record(KvKey::Amps, "C", 99 * S + 100000));
+    CHECK(st.record(KvKey::Amps, "E", 99 * S + 900000));
+    CHECK(st.record(KvKey::Amps, "FF", 100 * S + 1000));  // the current second: not yet
+
+    CHECK(st.summary(AMPS, 100 * S + 500000, w));
+    CHECK(w.at(0).count == 2);
+    CHECK(w.at(0).min == 12);
+    CHECK(w.at(0).max == 14);
+    CHECK(w.at(0).mean == 13.0);
+    CHECK(w.at(1).count == 3);
+    CHECK(w.at(1).min == 10);
+    CHECK(w.at(1).mean == 12.0);
+    CHECK(w.at(2).count == 4);
+    CHECK(w.at(2).max == 30);
+    CHECK(w.at(2).mean == 16.5);
+
+    // A second later the 0xFF report is in, and the last second has only it
+    CHECK(st.summary(AMPS, 101 * S, w));
+    CHECK(w.at(0).count == 1);
+    CHECK(w.at(0).min == 255);
+    CHECK(w.at(2).count == 5);
+
+    // Other keys are separate, and empty
+    CHECK_FALSE(st.summary(BELT, 101 * S, w));
+    CHECK(w.at(0).count == 0);
+    CHECK(w.at(0).mean == 0);
+}
+
+TEST_CASE("old buckets age out and are reused in place") {
+    MotorStats st;
+    MotorStatWindows w;
+    CHECK(st.record(KvKey::Belt, "64", 10 * S));
+    CHECK(st.summary(BELT, 70 * S, w));       // exactly 60 s: still in
+    CHECK(w.at(2).count == 1);
+    CHECK(w.at(1).count == 0);
+    CHECK_FALSE(st.summary(BELT, 71 * S, w));
+
+    // Second 70 shares second 10's bucket: it starts over rather than adding
+    CHECK(st.record(KvKey::Belt, "32", 70 * S + 1));
+    CHECK(st.summary(BELT, 71 * S, w));
+    CHECK(w.at(2).count == 1);
+    CHECK(w.at(2).max == 50);
+}
+
+TEST_CASE("only amps, vbus and belt are aggregated, and only hex values") {
+    MotorStats st;
+    CHECK_FALSE(st.record(KvKey::Hmph, "1F4", S));
+    CHECK_FALSE(st.record(KvKey::Err, "", S));
+    CHECK_FALSE(st.record(KvKey::Amps, "", S));
+    CHECK_FALSE(st.record(KvKey::Amps, "1G", S));
+    CHECK(st.record(KvKey::Vbus, "7d0", S));
+    MotorStatWindows w;
+    CHECK(st.summary(1, 2 * S, w));
+    CHECK(w.at(0).max == 2000);
+    CHECK_FALSE(st.summary(AMPS, 2 * S, w));
+}
+
+TEST_CASE("motor reports come out as periodic stats events") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        ctrl.stop();
+        return;
+    }
+    send_json(fd, "{\"cmd\":\"subscribe\",\"types\":[\"stats\"]}");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    port.inject_serial_data_pin(17, kv_build("amps", "14") + kv_build("belt", "2C") + kv_build("amps", "18"));
+
+    // Once the reports' second is over, each key once per period; vbus never reported
+    std::string got = read_until(fd, "\"key\":\"belt\"", 3500);
+    CHECK(got.find("{\"type\":\"stats\",\"key\":\"amps\",\"count_1s\":2,\"min_1s\":20,\"max_1s\":24,"
+                   "\"mean_1s\":22.0,") != std::string::npos);
+    CHECK(got.find("\"key\":\"belt\",\"count_1s\":1,\"min_1s\":44,") != std::string::npos);
+    CHECK(got.find("\"key\":\"vbus\"") == std::string::npos);
+    CHECK(got.find("\"type\":\"kv\"") == std::string::npos);  // filtered
+
+    close(fd);
+    ctrl.stop();
+}
@@ -0,0 +1,96 @@
+/*
+ * test_motor_writer.cpp — Tests for the MotorWriter thread and its lanes
+ *
+ * Uses MockGpioPort with tx_timing so transmissions take their real
+ * pulse time and queued traffic can be observed being preempted.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "gpio_mock.h"
+#include "motor_writer.h"
+#include <thread>
+#include <chrono>
+#include <string>
+#include <array>
+
+static std::span<const uint8_t> bytes_of(std::string_view s) {
+    // reinterpret_cast: char -> uint8_t aliasing (standard-allowed)
+    return std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+}
+
+// Wait until the port has recorded `n` transmissions or `limit_ms` passes
+static bool wait_writes(MockGpioPort& port, size_t n, int limit_ms = 500) {
+    for (int i = 0; i < limit_ms && port.wave_write_count() < n; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return port.wave_write_count() >= n;
+}
+
+TEST_CASE("raw bytes and bursts go out in order from the writer thread") {
+    MockGpioPort port;
+    MotorWriter<MockGpioPort> writer(port, 22);
+    CHECK(writer.start());
+
+    std::string big(600, 'x');  // more than one lane message
+    writer.write_bytes(bytes_of("[amps]\xff"));
+    std::array<std::string_view, 2> wires = {{ "[inc:5]\xff", "[hmph:32]\xff" }};
+    writer.write_burst(wires);
+    writer.write_bytes(bytes_of(big));
+
+    CHECK(wait_writes(port, 5));  // raw + chained burst + 3 chunks
+    CHECK(port.get_written_string() == "[amps]\xff[inc:5]\xff[hmph:32]\xff" + big);
+    CHECK(port.chain_sends == 1);
+    CHECK(port.wave_writes.at(1).gpio == 22);
+    CHECK(writer.raw_latency().summary().count == 4);
+    CHECK(writer.dropped() == 0);
+    writer.stop();
+}
+
+TEST_CASE("a priority frame goes next and discards queued traffic") {
+    MockGpioPort port;
+    port.tx_timing = true;
+    MotorWriter<MockGpioPort> writer(port, 22);
+    CHECK(writer.start());
+
+    // Each burst takes ~46 ms on the wire
+    std::array<std::string_view, 4> burst = {{ "[hmph:4B0]\xff", "[inc:C6]\xff",
+                                               "[hmph:4B0]\xff", "[inc:C6]\xff" }};
+    for (int i = 0; i < 5; i++) writer.write_burst(burst);
+    CHECK(wait_writes(port, 1));  // first burst in flight
+
+    writer.write_priority("[hmph:0]\xff");
+    auto t0 = std::chrono::steady_clock::now();
+    CHECK(wait_writes(port, 2));
+    auto dt = std::chrono::steady_clock::now() - t0;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    CHECK(port.wave_write_count() == 2);
+    if (port.wave_write_count() == 2) {
+        std::string stop(port.wave_writes.at(1).bytes.begin(), port.wave_writes.at(1).bytes.end());
+        CHECK(stop == "[hmph:0]\xff");
+    }
+    CHECK(dt < std::chrono::milliseconds(60));  // at most the burst in flight
+    CHECK(writer.preempted() == 4);
+    CHECK(writer.priority_latency().summary().count == 1);
+
+    // Traffic queued after the stop flows normally
+    writer.write_bytes(bytes_of("[belt]\xff"));
+    CHECK(wait_writes(port, 3));
+    writer.stop();
+}
+
+TEST_CASE("messages beyond the lane depth are dropped and counted") {
+    MockGpioPort port;
+    MotorWriter<MockGpioPort> writer(port, 22);
+
+    // Queue before the thread runs: the oldest overflow messages are lost
+    int total = MOTOR_LANE_SIZE + 44;
+    for (int i = 0; i < total; i++) writer.write_bytes(bytes_of("[amps]\xff"));
+    CHECK(writer.start());
+    CHECK(wait_writes(port, MOTOR_LANE_SIZE));
+    CHECK(writer.dropped() == 44);
+    CHECK(port.wave_write_count() == static_cast<size_t>(MOTOR_LANE_SIZE));
+    writer.stop();
+}
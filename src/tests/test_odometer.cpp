@@ -0,0 +1,53 @@
+/*
+ * test_odometer.cpp — Tests for bus-rate distance / vertical integration
+ *
+ * Drives Odometer with synthetic mono_us times.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "odometer.h"
+
+constexpr uint64_t SEC = 1000000;  // us per second
+
+TEST_CASE("speed held between samples integrates to distance and belt time") {
+    Odometer odo;
+    CHECK_FALSE(odo.sample(1 * SEC, 60, 0));  // first sample only sets the baseline
+    // 6.0 mph for one hour, reported twice a second
+    uint64_t t = 1 * SEC;
+    for (int i = 0; i < 7200; i++) {
+        t += SEC / 2;
+        CHECK(odo.sample(t, 60, 0));
+    }
+    CHECK(odo.distance_mi() == doctest::Approx(6.0));
+    CHECK(odo.vert_ft() == 0.0);
+    CHECK(odo.belt_on_ms() == 3600 * 1000);
+}
+
+TEST_CASE("vertical gain follows incline in half-pct units") {
+    Odometer odo;
+    odo.sample(1 * SEC, 30, 20);               // 3.0 mph at 10%
+    odo.sample(1 * SEC + 1200 * 1000, 30, 20);  // 1.2 s later
+    // 3 mph × 1.2 s = 0.001 mi; × 10% × 5280 ft
+    CHECK(odo.distance_mi() == doctest::Approx(0.001));
+    CHECK(odo.vert_ft() == doctest::Approx(0.528));
+}
+
+TEST_CASE("stopped, unknown and out-of-order samples add nothing") {
+    Odometer odo;
+    odo.sample(1 * SEC, 0, 10);
+    CHECK_FALSE(odo.sample(2 * SEC, -1, -1));  // was stopped
+    CHECK_FALSE(odo.sample(3 * SEC, 50, 0));   // unknown counts as stopped
+    CHECK_FALSE(odo.sample(2 * SEC, 50, 0));   // clock went backwards
+    CHECK(odo.belt_on_ms() == 0);
+    CHECK(odo.sample(3 * SEC, 50, 0));
+    CHECK(odo.belt_on_ms() == 1000);
+}
+
+TEST_CASE("a long gap counts only up to the cap") {
+    Odometer odo;
+    odo.sample(1 * SEC, 100, 0);
+    odo.sample(61 * SEC, 100, 0);  // a minute with no motor reports
+    CHECK(odo.belt_on_ms() == ODO_MAX_GAP_MS);
+}
@@ -0,0 +1,78 @@
+/*
+ * test_overlay.cpp — Tests for the overlay stream rewriter
+ *
+ * Feeds OverlayRewriter console bytes in chunks and checks what reaches
+ * the motor side.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include <string>
+#include "overlay.h"
+
+namespace {
+
+// Feed `in` split at `chunks` bytes; the motor side's bytes
+std::string feed(OverlayRewriter& r, std::string_view in, size_t chunks, int speed, int incline) {
+    std::string out;
+    auto emit = [&](std::span<const uint8_t> b) { out.append(b.begin(), b.end()); };
+    for (size_t i = 0; i < in.size(); i += chunks) {
+        auto part = in.substr(i, chunks);
+        // reinterpret_cast: char -> uint8_t aliasing (standard-allowed)
+        r.feed({reinterpret_cast<const uint8_t*>(part.data()), part.size()}, speed, incline, emit);
+    }
+    return out;
+}
+
+}  // namespace
+
+TEST_CASE("inc and hmph values are replaced, everything else passes through") {
+    OverlayRewriter r;
+    // 3.0 mph is hex 12C, 5% incline is 10 half-pct, hex A
+    std::string_view console = "[inc:0][hmph:0][amps][belt:1]\xff[hmph:78]";
+    CHECK(feed(r, console, console.size(), 30, 10) == "[inc:A][hmph:12C][amps][belt:1]\xff[hmph:12C]");
+    CHECK(r.pending() == 0);
+    CHECK(r.rewritten(KvKey::Inc) == 1);
+    CHECK(r.rewritten(KvKey::Hmph) == 2);
+}
+
+TEST_CASE("frames split across chunks anywhere come out the same") {
+    std::string_view console = "[diag:0][inc:14][lift][hmph:3E8][part:6]";
+    for (size_t chunks = 1; chunks <= 8; chunks++) {
+        OverlayRewriter r;
+        CHECK(feed(r, console, chunks, 0, 0) == "[diag:0][inc:0][lift][hmph:0][part:6]");
+        CHECK(r.pending() == 0);
+    }
+}
+
+TEST_CASE("a frame is held only until it can't be inc or hmph") {
+    OverlayRewriter r;
+    CHECK(feed(r, "[hm", 3, 30, 10).empty());
+    CHECK(r.pending() == 3);
+    // "[hmx" spells neither: released as it was
+    CHECK(feed(r, "x:1]", 4, 30, 10) == "[hmx:1]");
+
+    // A prefix of "[inc:" that is another key ("[i" then "d")
+    CHECK(feed(r, "[id:5]", 6, 30, 10) == "[id:5]");
+    // No ':' after the key name
+    CHECK(feed(r, "[inc]", 5, 30, 10) == "[inc]");
+    CHECK(r.pending() == 0);
+}
+
+TEST_CASE("a runaway value or a new frame releases the held bytes unchanged") {
+    OverlayRewriter r;
+    CHECK(feed(r, "[inc:123456789]", 15, 30, 10) == "[inc:123456789]");
+    CHECK(r.pending() == 0);
+
+    // A lost ']': the next frame starts over, and is itself rewritten
+    CHECK(feed(r, "[hmph:12[inc:3]", 15, 30, 10) == "[hmph:12[inc:A]");
+    CHECK(r.rewritten(KvKey::Hmph) == 0);
+
+    // Overlay ending mid-frame: flush() gives the held bytes back as they were
+    std::string out;
+    feed(r, "[hmph:1", 7, 30, 10);
+    r.flush([&](std::span<const uint8_t> b) { out.append(b.begin(), b.end()); });
+    CHECK(out == "[hmph:1");
+    CHECK(r.pending() == 0);
+}
@@ -0,0 +1,107 @@
+/*
+ * test_program_runner.cpp — Tests for ProgramRunner timing and targets
+ *
+ * Drives the runner with synthetic CLOCK_MONOTONIC times (ns).
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "program_runner.h"
+
+constexpr int64_t MS = 1000000;  // ns per ms
+
+static ProgramSpec make_program(std::initializer_list<ProgramSegment> segs) {
+    ProgramSpec p;
+    for (const auto& s : segs) p.segments.at(p.count++) = s;
+    return p;
+}
+
+TEST_CASE("segments switch at their boundaries and the program finishes at zero") {
+    ProgramRunner r;
+    r.load(make_program({ { 1000, 30, 2, false }, { 2000, 60, 4, false } }), 0, 0, 0);
+    CHECK(r.active());
+
+    auto t = r.tick(0);
+    CHECK(t.apply);
+    CHECK(t.report);
+    CHECK(t.speed_tenths == 30);
+    CHECK(t.incline == 2);
+    r.applied(t);
+
+    t = r.tick(500 * MS);
+    CHECK_FALSE(t.apply);    // unchanged target
+    CHECK_FALSE(t.report);   // within the first second, same segment
+
+    t = r.tick(1000 * MS);
+    CHECK(t.apply);
+    CHECK(t.report);
+    CHECK(t.speed_tenths == 60);
+    r.applied(t);
+    auto ev = r.progress();
+    CHECK(ev.state == "running");
+    CHECK(ev.segment == 1);
+    CHECK(ev.segments == 2);
+    CHECK(ev.segment_remaining_ms == 2000);
+    CHECK(ev.total_ms == 3000);
+
+    t = r.tick(3000 * MS);
+    CHECK(t.apply);
+    CHECK(t.report);
+    CHECK(t.speed_tenths == 0);
+    CHECK(r.progress().state == "finished");
+    CHECK_FALSE(r.active());
+
+    // A final 0/0 that didn't land is retried; once applied, nothing more
+    CHECK(r.tick(3100 * MS).apply);
+    r.applied(t);
+    CHECK_FALSE(r.tick(3200 * MS).apply);
+}
+
+TEST_CASE("a ramp interpolates from the previous target") {
+    ProgramRunner r;
+    r.load(make_program({ { 1000, 20, 0, false }, { 1000, 60, 10, true } }), 0, 0, 0);
+    CHECK(r.tick(0).speed_tenths == 20);
+
+    auto t = r.tick(1500 * MS);  // halfway through the ramp
+    CHECK(t.speed_tenths == 40);
+    CHECK(t.incline == 5);
+    t = r.tick(1999 * MS);
+    CHECK(t.speed_tenths == 60);
+
+    // First-segment ramp starts from the speed in force at load
+    ProgramRunner first;
+    first.load(make_program({ { 1000, 80, 0, true } }), 0, 40, 0);
+    CHECK(first.tick(250 * MS).speed_tenths == 50);
+}
+
+TEST_CASE("pause freezes program time; resume re-applies the target") {
+    ProgramRunner r;
+    r.load(make_program({ { 1000, 30, 0, false }, { 1000, 50, 0, false } }), 0, 0, 0);
+    r.applied(r.tick(0));
+
+    CHECK(r.pause(800 * MS));
+    CHECK_FALSE(r.tick(5000 * MS).apply);
+    CHECK(r.progress().state == "paused");
+    CHECK(r.progress().elapsed_ms == 800);
+
+    CHECK(r.resume(5000 * MS));
+    auto t = r.tick(5100 * MS);  // 900 ms of program time
+    CHECK(t.apply);              // re-applied after the pause
+    CHECK(t.speed_tenths == 30);
+    CHECK(r.tick(5200 * MS).speed_tenths == 50);
+
+    CHECK(r.stop());
+    CHECK(r.progress().state == "stopped");
+    CHECK_FALSE(r.stop());
+}
+
+TEST_CASE("progress reports once per second within a segment") {
+    ProgramRunner r;
+    r.load(make_program({ { 10000, 30, 0, false } }), 0, 0, 0);
+    int reports = 0;
+    for (int64_t t = 0; t < 3000; t += 100) {
+        if (r.tick(t * MS).report) reports++;
+    }
+    CHECK(reports == 3);  // 0 s, 1 s, 2 s
+}
@@ -0,0 +1,93 @@
+/*
+ * test_proxy_selftest.cpp — Tests for the proxy forwarding latency self-test
+ *
+ * ProxyLatencyAnalyzer on made-up edges (percentiles, frames that don't
+ * match), then the full loop: a BusHost proxying bus 0 on MockGpioPort,
+ * its console input and motor output wired back to the test.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "gpio_mock.h"
+#include "bus_host.h"
+#include "proxy_selftest.h"
+
+#include <array>
+#include <string_view>
+
+// `frame`'s ideal edges starting at `t0_ns`
+static size_t edges_at(std::string_view frame, int64_t t0_ns, std::span<PortEdge> out) {
+    // reinterpret_cast: char -> uint8_t aliasing (standard-allowed)
+    size_t n = tx_ideal_edges(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(frame.data()), frame.size()),
+                              9600, out);
+    for (size_t i = 0; i < n; i++) out[i].t_ns += t0_ns;
+    return n;
+}
+
+TEST_CASE("latencies are first start bit to first start bit, nearest-rank percentiles") {
+    std::string_view frame = "[amps]\xff";
+    // reinterpret_cast: char -> uint8_t aliasing (standard-allowed)
+    std::span<const uint8_t> bytes(reinterpret_cast<const uint8_t*>(frame.data()), frame.size());
+    std::array<PortEdge, 256> in, out;
+    ProxyLatencyAnalyzer a(9600);
+    CHECK(a.report().frames == 0);
+
+    // 100 frames forwarded 1..100 ms after they started
+    for (int f = 1; f <= 100; f++) {
+        int64_t t0 = f * 1'000'000'000LL;
+        size_t n = edges_at(frame, t0, in);
+        edges_at(frame, t0 + f * 1'000'000LL, out);
+        CHECK(a.add_frame(bytes, std::span<const PortEdge>(in.data(), n), std::span<const PortEdge>(out.data(), n)));
+    }
+    auto r = a.report();
+    CHECK(r.frames == 100);
+    CHECK(r.bad_frames == 0);
+    CHECK(r.min_us == 1000.0);
+    CHECK(r.p50_us == 50000.0);
+    CHECK(r.p99_us == 99000.0);
+    CHECK(r.max_us == 100000.0);
+
+    // Not forwarded, cut short, or out before it went in: bad, not timed
+    size_t n = edges_at(frame, 0, in);
+    edges_at(frame, 5'000'000, out);
+    CHECK_FALSE(a.add_frame(bytes, std::span<const PortEdge>(in.data(), n), {}));
+    CHECK_FALSE(a.add_frame(bytes, std::span<const PortEdge>(in.data(), n), std::span<const PortEdge>(out.data(), n - 1)));
+    CHECK_FALSE(a.add_frame(bytes, std::span<const PortEdge>(out.data(), n), std::span<const PortEdge>(in.data(), n)));
+    r = a.report();
+    CHECK(r.frames == 100);
+    CHECK(r.bad_frames == 3);
+}
+
+TEST_CASE("frames driven into the console come back timed from the motor pin") {
+    constexpr int DRIVE = 5;
+    constexpr int LOOP = 6;
+    MockGpioPort port;
+    port.initialise();
+    port.wires[DRIVE] = 27;  // drive -> console read
+    port.wires[22] = LOOP;   // motor write -> loop
+    GpioConfig cfg{27, 22, 17};
+    BusHost<MockGpioPort> host(port, std::span<const GpioConfig>(&cfg, 1));
+    CHECK(host.start());
+    if (!host.is_running()) return;
+
+    SerialWriter<MockGpioPort> drive(port, DRIVE, host.wave_engine());
+    auto r = run_proxy_selftest(port, drive, 27, LOOP, 5);
+    CHECK(r.has_value());
+    if (r) {
+        CHECK(r->frames == 5);
+        CHECK(r->bad_frames == 0);
+        CHECK(r->min_us > 0);
+        CHECK(r->min_us <= r->p50_us);
+        CHECK(r->p50_us <= r->p99_us);
+        CHECK(r->p99_us <= r->max_us);
+        CHECK(r->max_us < PROXY_SELFTEST_GAP_MS * 1000);
+    }
+
+    // Motor output not wired back: every frame is bad
+    port.wires.erase(22);
+    r = run_proxy_selftest(port, drive, 27, LOOP, 2);
+    CHECK(r.has_value());
+    if (r) CHECK(r->bad_frames == 2);
+    host.stop();
+}
@@ -0,0 +1,83 @@
+/*
+ * test_query_tracker.cpp — Tests for motor query round-trip tracking
+ *
+ * Drives QueryTracker with synthetic mono_us times.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "query_tracker.h"
+
+constexpr uint64_t MS = 1000;  // us per ms
+
+TEST_CASE("answer is paired with the latest query for its key") {
+    QueryTracker q;
+    q.sent(KvKey::Amps, 1000 * MS);
+    QueryStall st{};
+    CHECK_FALSE(q.answered(KvKey::Amps, 1000 * MS + 1500, &st));
+
+    auto h = q.round_trip(KvKey::Amps).summary();
+    CHECK(h.count == 1);
+    CHECK(h.max_us == 1500);
+    auto c = q.counters(KvKey::Amps);
+    CHECK(c.sent == 1);
+    CHECK(c.answered == 1);
+    CHECK(c.missing == 0);
+
+    // Duplicate or unsolicited answers are not round trips
+    q.answered(KvKey::Amps, 1001 * MS, &st);
+    q.answered(KvKey::Belt, 1001 * MS, &st);
+    CHECK(q.round_trip(KvKey::Amps).summary().count == 1);
+    CHECK(q.counters(KvKey::Belt).answered == 0);
+}
+
+TEST_CASE("a query superseded before its answer counts as missing") {
+    QueryTracker q;
+    q.sent(KvKey::Belt, 1);
+    q.sent(KvKey::Belt, 500 * MS);
+    QueryStall st{};
+    q.answered(KvKey::Belt, 500 * MS + 2000, &st);
+    auto c = q.counters(KvKey::Belt);
+    CHECK(c.sent == 2);
+    CHECK(c.missing == 1);
+    CHECK(q.round_trip(KvKey::Belt).summary().max_us == 2000);  // from the latest query
+}
+
+TEST_CASE("non-query keys are ignored") {
+    QueryTracker q;
+    q.sent(KvKey::Hmph, 1);
+    q.sent(KvKey::Part, 1);
+    q.sent(KvKey::Unknown, 1);
+    CHECK(q.counters(KvKey::Hmph).sent == 0);
+    CHECK(q.counters(KvKey::Part).sent == 0);
+    std::array<QueryStall, 4> out{};
+    CHECK(q.check(10000 * MS, out) == 0);
+}
+
+TEST_CASE("stall is reported once and its end is reported as recovery") {
+    QueryTracker q;
+    uint64_t t0 = 1000 * MS;
+    for (int i = 0; i < 5; i++) q.sent(KvKey::Vbus, t0 + i * 500 * MS);
+
+    std::array<QueryStall, 4> out{};
+    CHECK(q.check(t0 + QUERY_STALL_MS * MS - 1, out) == 0);
+    CHECK(q.check(t0 + QUERY_STALL_MS * MS, out) == 1);
+    CHECK(out.at(0).key == KvKey::Vbus);
+    CHECK(out.at(0).stalled);
+    CHECK(out.at(0).waited_ms == QUERY_STALL_MS);
+    CHECK(out.at(0).missing == 4);
+    CHECK(q.check(t0 + 5000 * MS, out) == 0);  // still stalled: not repeated
+    CHECK(q.counters(KvKey::Vbus).stalls == 1);
+
+    QueryStall st{};
+    CHECK(q.answered(KvKey::Vbus, t0 + 6000 * MS, &st));
+    CHECK(st.key == KvKey::Vbus);
+    CHECK_FALSE(st.stalled);
+    CHECK(st.waited_ms == 6000);
+
+    // Answered promptly from now on: no new stall
+    q.sent(KvKey::Vbus, t0 + 6500 * MS);
+    q.answered(KvKey::Vbus, t0 + 6501 * MS, &st);
+    CHECK(q.check(t0 + 20000 * MS, out) == 0);
+}
@@ -0,0 +1,212 @@
+/*
+ * test_replay.cpp — Tests for ReplayPort and capture decoding
+ *
+ * Includes a full-controller replay of captures/try6.csv at 100x speed:
+ * in proxy mode every recorded console byte must reach the motor pin.
+ * Run from src/ (as make test does) so the capture path resolves.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "gpio_replay.h"
+#include "treadmill_io.h"
+#include <thread>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include <unistd.h>
+
+constexpr const char* CAPTURE = "captures/try6.csv";
+
+TEST_CASE("replayed bytes become readable at their scaled timestamps") {
+    ReplayPort port(10.0);
+    port.add_stream(27, { { 5.0, 'a' }, { 5.5, 'b' }, { 6.0, 'c' } });  // rebased to 0
+    std::array<uint8_t, 8> buf{};
+
+    CHECK(port.serial_read(27, buf.data(), 8) == 0);  // clock not started
+    port.start_replay();
+    CHECK(port.serial_read(27, buf.data(), 8) == 1);
+    CHECK(buf.at(0) == 'a');
+    CHECK(port.replay_duration() == doctest::Approx(0.1));
+
+    // 'b' is due 50 ms in (0.5 s at 10x)
+    auto t0 = std::chrono::steady_clock::now();
+    while (port.wait_edge(27, 100) == 0) {}
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - t0).count();
+    CHECK(ms >= 45);
+    CHECK(ms < 100);
+    CHECK(port.serial_read(27, buf.data(), 8) == 1);
+    CHECK(buf.at(0) == 'b');
+    CHECK_FALSE(port.replay_done());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    CHECK(port.serial_read(27, buf.data(), 8) == 1);
+    CHECK(port.replay_done());
+}
+
+TEST_CASE("unreplayed pins fall back to MockGpioPort inject") {
+    ReplayPort port;
+    port.inject_serial_data_pin(17, "[belt]");
+    std::array<uint8_t, 8> buf{};
+    CHECK(port.serial_read(17, buf.data(), 8) == 6);
+    CHECK(port.replay_done());  // no streams bound
+}
+
+TEST_CASE("capture decodes to framed console and motor traffic") {
+    auto console = log_bytes(load_capture_channel(CAPTURE, CAPTURE_CH_CONSOLE));
+    auto motor = log_bytes(load_capture_channel(CAPTURE, CAPTURE_CH_MOTOR));
+
+    // Matches captures/decode_inverted.py on the same file
+    CHECK(console.size() == 10950);
+    CHECK(motor.size() == 10484);
+    CHECK(std::count(console.begin(), console.end(), '[') == 1414);
+    CHECK(std::count(motor.begin(), motor.end(), '[') == 1414);
+    CHECK(console.find("[hmph") != std::string::npos);
+}
+
+namespace {
+
+// Capture rows for `bytes` sent on channel 0, inverted 9600 8N1, one
+// byte every 2 ms from t = 1 s
+std::string synth_capture(std::string_view bytes) {
+    std::string csv = "Time[s], Channel 0, Channel 1\n";
+    int level = 0;
+    auto row = [&](double t, int l) {
+        if (l == level) return;
+        level = l;
+        std::array<char, 64> line;
+        int n = std::snprintf(line.data(), line.size(), "%.15f, %d, 1\n", t, l);
+        csv.append(line.data(), static_cast<size_t>(n));
+    };
+    csv += "0.000000000000000, 0, 1\n";
+    for (size_t i = 0; i < bytes.size(); i++) {
+        double start = 1.0 + 0.002 * static_cast<double>(i);
+        row(start, 1);  // start bit
+        for (int b = 0; b < 8; b++) row(start + (b + 1) / 9600.0, 1 - ((bytes[i] >> b) & 1));
+        row(start + 9 / 9600.0, 0);  // stop bit
+    }
+    return csv;
+}
+
+}  // namespace
+
+TEST_CASE("capture times scan to nanoseconds") {
+    auto scan = [](std::string_view s) {
+        const char* p = s.data();
+        int64_t ns = -1;
+        bool ok = capture_parse_time(p, s.data() + s.size(), ns);
+        return ok ? ns : -1;
+    };
+    CHECK(scan("0.018048000000000, 1") == 18048000);
+    CHECK(scan("12.5") == 12500000000);
+    CHECK(scan("3, 0") == 3000000000);
+    CHECK(scan("0.123456789987") == 123456789);
+    CHECK(scan("7.0000001") == 7000000100);  // too short for the 8-digit word
+    CHECK(scan("Time[s]") == -1);
+}
+
+TEST_CASE("the streaming decoder recovers bytes and start times, skipping glitches") {
+    std::string csv = synth_capture("[inc:5]\xff");
+    std::string got;
+    std::vector<int64_t> starts;
+    decode_capture(csv, 1, 9600, [&](int ch, int64_t t_ns, uint8_t b) {
+        CHECK(ch == 0);
+        got.push_back(static_cast<char>(b));
+        starts.push_back(t_ns);
+    });
+    CHECK(got == "[inc:5]\xff");
+    if (starts.size() == 8) {
+        CHECK(starts.at(0) == 1000000000);
+        CHECK(starts.at(7) == 1014000000);
+    }
+
+    // A pulse shorter than half a bit is no start bit
+    std::string glitch = "Time[s], Channel 0\n0.0, 0\n0.5, 1\n0.500010, 0\n";
+    int n = 0;
+    decode_capture(glitch, 1, 9600, [&](int, int64_t, uint8_t) { n++; });
+    CHECK(n == 0);
+
+    // Frames through kv_parse(), stamped with their '['
+    CaptureFramer framer;
+    std::vector<std::pair<int64_t, std::string>> frames;
+    decode_capture(csv, 1, 9600, [&](int, int64_t t_ns, uint8_t b) {
+        framer.feed(t_ns, b, [&](int64_t at, const KvPair& kv) {
+            frames.emplace_back(at, std::string(kv.key_view()) + "=" + std::string(kv.value_view()));
+        });
+    });
+    CHECK(frames.size() == 1);
+    if (frames.size() == 1) {
+        CHECK(frames.at(0).first == 1000000000);
+        CHECK(frames.at(0).second == "inc=5");
+    }
+}
+
+TEST_CASE("a byte log written from a capture loads back for replay") {
+    std::string path = "/tmp/test_replay_" + std::to_string(getpid()) + ".tmb";
+    FILE* f = std::fopen(path.c_str(), "wb");
+    CHECK(f != nullptr);
+    if (!f) return;
+    std::fwrite(CAPTURE_LOG_MAGIC.data(), 1, CAPTURE_LOG_MAGIC.size(), f);
+    MappedFile csv;
+    CHECK(csv.open(CAPTURE));
+    CaptureFramer framer;
+    int console_frames = 0;
+    decode_capture(csv.view(), (1u << CAPTURE_CH_CONSOLE) | (1u << CAPTURE_CH_MOTOR), 9600,
+                   [&](int ch, int64_t t_ns, uint8_t b) {
+        std::array<uint8_t, CAPTURE_LOG_RECORD_SIZE> rec;
+        capture_log_record(rec, t_ns, ch, b);
+        std::fwrite(rec.data(), 1, rec.size(), f);
+        if (ch == CAPTURE_CH_CONSOLE) framer.feed(t_ns, b, [&](int64_t, const KvPair&) { console_frames++; });
+    });
+    std::fclose(f);
+    CHECK(console_frames == 1414);
+
+    for (int ch : {CAPTURE_CH_CONSOLE, CAPTURE_CH_MOTOR}) {
+        auto from_csv = load_capture_channel(CAPTURE, ch);
+        auto from_log = load_byte_log(path.c_str(), ch);
+        CHECK(from_log.size() == from_csv.size());
+        CHECK(log_bytes(from_log) == log_bytes(from_csv));
+        if (!from_log.empty() && from_log.size() == from_csv.size()) {
+            CHECK(from_log.back().t == from_csv.back().t);
+        }
+    }
+    std::remove(path.c_str());
+    CHECK(load_byte_log(CAPTURE, CAPTURE_CH_CONSOLE).empty());  // not a byte log
+}
+
+TEST_CASE("controller proxies a replayed session byte-for-byte") {
+    auto console = load_capture_channel(CAPTURE, CAPTURE_CH_CONSOLE);
+    auto motor = load_capture_channel(CAPTURE, CAPTURE_CH_MOTOR);
+    CHECK(!console.empty());
+    if (console.empty()) return;
+    std::string expected = log_bytes(console);
+    size_t motor_len = motor.size();
+
+    ReplayPort port(100.0);
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    port.add_stream(cfg.console_read, std::move(console));
+    port.add_stream(cfg.motor_read, std::move(motor));
+
+    TreadmillController<ReplayPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    port.start_replay();
+
+    auto limit = std::chrono::steady_clock::now() +
+                 std::chrono::milliseconds(static_cast<int>(port.replay_duration() * 1000) + 3000);
+    while (!port.replay_done() && std::chrono::steady_clock::now() < limit) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));  // last proxy write
+    ctrl.stop();
+
+    CHECK(port.replay_done());
+    CHECK(ctrl.mode().is_proxy());
+    CHECK(ctrl.mode().console_bytes() == expected.size());
+    CHECK(ctrl.mode().motor_bytes() == motor_len);
+    CHECK(port.get_written_string() == expected);
+}
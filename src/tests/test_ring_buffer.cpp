@@ -1,14 +1,28 @@
 /*
- * test_ring_buffer.cpp — Tests for RingBuffer template
+ * test_ring_buffer.cpp — Tests for RingBuffer and ByteRing (the
+ * fixed-slot and variable-length rings)
  */
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #define DOCTEST_CONFIG_NO_EXCEPTIONS
 #include <doctest.h>
 #include "ring_buffer.h"
+#include "byte_ring.h"
 #include <thread>
 #include <cstdio>
 #include <string>
+#include <vector>
+#include <atomic>
+#include <array>
+
+// Helper: read message `seq` as a string ("" if not readable)
+template <int S, int M>
+static std::string read_msg(const RingBuffer<S, M>& ring, uint64_t seq) {
+    std::array<char, M> buf{};
+    auto r = ring.read(seq, buf);
+    if (r.status != RingRead::Ok) return {};
+    return std::string(buf.data(), r.len);
+}
 
 TEST_CASE("empty ring buffer") {
     RingBuffer<> ring;
@@ -24,7 +38,7 @@ TEST_CASE("push and snapshot") {
     auto snap = ring.snapshot();
     CHECK(snap.head == 1);
     CHECK(snap.count == 1);
-    CHECK(ring.at(0) == "hello\n");
+    CHECK(read_msg(ring, 0) == "hello\n");
 }
 
 TEST_CASE("multiple pushes") {
@@ -36,9 +50,9 @@ TEST_CASE("multiple pushes") {
     auto snap = ring.snapshot();
     CHECK(snap.head == 3);
     CHECK(snap.count == 3);
-    CHECK(ring.at(0) == "msg1\n");
-    CHECK(ring.at(1) == "msg2\n");
-    CHECK(ring.at(2) == "msg3\n");
+    CHECK(read_msg(ring, 0) == "msg1\n");
+    CHECK(read_msg(ring, 1) == "msg2\n");
+    CHECK(read_msg(ring, 2) == "msg3\n");
 }
 
 TEST_CASE("wrap-around") {
@@ -52,16 +66,20 @@ TEST_CASE("wrap-around") {
     auto snap = ring.snapshot();
     CHECK(snap.head == 1);  // wrapped around to index 1
     CHECK(snap.count == 5);
-    CHECK(ring.at(0) == "e\n");  // index 0 was overwritten
-    CHECK(ring.at(1) == "b\n");
+    CHECK(read_msg(ring, 4) == "e\n");  // slot 0 now holds seq 4
+    CHECK(read_msg(ring, 1) == "b\n");
+
+    // seq 0 ("a") was overwritten — reported, not returned as "e"
+    std::array<char, 64> buf{};
+    CHECK(ring.read(0, buf).status == RingRead::Overwritten);
 }
 
 TEST_CASE("message truncation") {
     RingBuffer<4, 8> ring;
     ring.push("this is a very long message that exceeds the buffer");
 
-    // Should be truncated to 7 chars + null
-    auto msg = ring.at(0);
+    // Should be truncated to 7 chars
+    auto msg = read_msg(ring, 0);
     CHECK(msg.size() <= 7);
 }
 
@@ -84,9 +102,9 @@ TEST_CASE("concurrent push and snapshot") {
         if (static_cast<int>(snap.count) > max_count) {
             max_count = snap.count;
         }
-        // Accessing at() while writing — should not crash
+        // Reading while writing — should not crash
         if (snap.count > 0) {
-            (void)ring.at(0);
+            (void)read_msg(ring, snap.count - 1);
         }
     }
 
@@ -95,3 +113,193 @@ TEST_CASE("concurrent push and snapshot") {
     auto final_snap = ring.snapshot();
     CHECK(final_snap.count == N);
 }
+
+TEST_CASE("unwritten sequence is not ready") {
+    RingBuffer<4, 64> ring;
+    std::array<char, 64> buf{};
+    CHECK(ring.read(0, buf).status == RingRead::NotReady);
+    ring.push("x");
+    CHECK(ring.read(0, buf).status == RingRead::Ok);
+    CHECK(ring.read(1, buf).status == RingRead::NotReady);
+}
+
+TEST_CASE("concurrent producers never produce torn reads") {
+    // Tiny ring so the consumer is constantly lapped while producers write
+    RingBuffer<8, 64> ring;
+    constexpr int PRODUCERS = 3;
+    constexpr int N = 20000;
+    std::atomic<int> done{0};
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&ring, &done, p]() {
+            // Each message is one repeated character: any mix is a torn read
+            std::string msg(40, static_cast<char>('a' + p));
+            for (int i = 0; i < N; i++) {
+                ring.push(msg);
+                if (i % 64 == 0) std::this_thread::yield();  // interleave on one core
+            }
+            done.fetch_add(1);
+        });
+    }
+
+    int torn = 0, ok = 0;
+    uint64_t cursor = 0;
+    std::array<char, 64> buf{};
+    bool finished = false;
+    while (!finished) {
+        finished = done.load() == PRODUCERS;  // one final drain after producers exit
+        auto snap = ring.snapshot();
+        if (snap.count - cursor > 8) cursor = snap.count - 8;
+        while (cursor < snap.count) {
+            auto r = ring.read(cursor, buf);
+            if (r.status == RingRead::NotReady) break;
+            if (r.status == RingRead::Ok) {
+                ok++;
+                for (size_t i = 1; i < r.len; i++) {
+                    if (buf.at(i) != buf.at(0)) { torn++; break; }
+                }
+                if (r.len != 40) torn++;
+            }
+            cursor++;
+        }
+    }
+    for (auto& t : producers) t.join();
+
+    CHECK(torn == 0);
+    CHECK(ok > 0);
+    CHECK(ring.snapshot().count == static_cast<uint64_t>(PRODUCERS) * N);
+}
+
+TEST_CASE("reserve and commit write in place") {
+    RingBuffer<4, 64> ring;
+    auto r = ring.reserve();
+    CHECK(r.seq == 0);
+    CHECK(r.buf.size() == 63);
+
+    // Reserved but uncommitted: consumers must wait, not read garbage
+    std::array<char, 64> buf{};
+    CHECK(ring.read(0, buf).status == RingRead::NotReady);
+
+    std::string_view msg("in-place\n");
+    msg.copy(r.buf.data(), msg.size());
+    ring.commit(r, msg.size());
+    CHECK(read_msg(ring, 0) == "in-place\n");
+}
+
+TEST_CASE("empty commit leaves readable empty message") {
+    RingBuffer<4, 64> ring;
+    auto r = ring.reserve();
+    ring.commit(r, 0);
+    std::array<char, 64> buf{};
+    auto res = ring.read(0, buf);
+    CHECK(res.status == RingRead::Ok);
+    CHECK(res.len == 0);
+}
+
+// ── ByteRing ────────────────────────────────────────────────────────
+
+template <size_t B, int I, int M>
+static std::string read_msg(const ByteRing<B, I, M>& ring, uint64_t seq) {
+    std::array<char, M> buf{};
+    auto r = ring.read(seq, buf);
+    if (r.status != RingRead::Ok) return {};
+    return std::string(buf.data(), r.len);
+}
+
+TEST_CASE("byte ring packs messages by length") {
+    ByteRing<1024, 16, 128> ring;
+    auto r = ring.reserve();
+    CHECK(r.buf.size() == 128);
+    std::string_view msg("first\n");
+    msg.copy(r.buf.data(), msg.size());
+    ring.commit(r, msg.size());
+
+    // The unused tail of the reservation was handed back
+    auto next = ring.reserve();
+    CHECK(next.pos == msg.size());
+    ring.commit(next, 0);
+    ring.push("third\n");
+
+    CHECK(read_msg(ring, 0) == "first\n");
+    CHECK(read_msg(ring, 1).empty());
+    CHECK(read_msg(ring, 2) == "third\n");
+
+    // A longer message than a RingBuffer<>::msg_size() slot stays whole
+    EventRing big;
+    std::string line(600, 'x');
+    big.push(line);
+    CHECK(read_msg(big, 0) == line);
+}
+
+TEST_CASE("byte ring reports messages whose bytes were reused") {
+    ByteRing<256, 64, 64> ring;  // the arena laps long before the index
+    std::string msg(40, 'a');
+    for (int i = 0; i < 8; i++) {
+        msg.front() = static_cast<char>('0' + i);
+        ring.push(msg);
+    }
+
+    // 320 bytes pushed into 256: the oldest are gone, the newest intact
+    std::array<char, 64> buf{};
+    CHECK(ring.read(0, buf).status == RingRead::Overwritten);
+    CHECK(ring.read(1, buf).status == RingRead::Overwritten);
+    auto last = read_msg(ring, 7);
+    CHECK(last.size() == 40);
+    if (!last.empty()) CHECK(last.front() == '7');
+
+    // Messages never straddle the arena's end
+    auto r = ring.reserve();
+    CHECK(r.pos % 256 + r.buf.size() <= 256);
+    ring.commit(r, 1);
+}
+
+TEST_CASE("byte ring concurrent producers never produce torn reads") {
+    // Tiny arena, mixed lengths and part-used reservations
+    ByteRing<1024, 16, 128> ring;
+    constexpr int PRODUCERS = 3;
+    constexpr int N = 20000;
+    std::atomic<int> done{0};
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&ring, &done, p]() {
+            size_t len = 10 + static_cast<size_t>(p) * 23;
+            for (int i = 0; i < N; i++) {
+                auto r = ring.reserve();
+                std::fill_n(r.buf.data(), len, static_cast<char>('a' + p));
+                ring.commit(r, len);
+                if (i % 64 == 0) std::this_thread::yield();
+            }
+            done.fetch_add(1);
+        });
+    }
+
+    int torn = 0, ok = 0;
+    uint64_t cursor = 0;
+    std::array<char, 128> buf{};
+    bool finished = false;
+    while (!finished) {
+        finished = done.load() == PRODUCERS;
+        auto snap = ring.snapshot();
+        if (snap.count - cursor > 16) cursor = snap.count - 16;
+        while (cursor < snap.count) {
+            auto r = ring.read(cursor, buf);
+            if (r.status == RingRead::NotReady) break;
+            if (r.status == RingRead::Ok) {
+                ok++;
+                size_t p = static_cast<size_t>(buf.at(0) - 'a');
+                if (p >= PRODUCERS || r.len != 10 + p * 23) torn++;
+                for (size_t i = 1; i < r.len; i++) {
+                    if (buf.at(i) != buf.at(0)) { torn++; break; }
+                }
+            }
+            cursor++;
+        }
+    }
+    for (auto& t : producers) t.join();
+
+    CHECK(torn == 0);
+    CHECK(ok > 0);
+    CHECK(ring.snapshot().count == static_cast<uint64_t>(PRODUCERS) * N);
+}
@@ -0,0 +1,417 @@
+/*
+ * test_serial_io.cpp — Tests for SerialReader/SerialWriter with MockGpioPort
+ *
+ * Covers edge-driven reader wakeups, the polling fallback, interrupting
+ * a blocked reader, the writer's wave cache and burst chaining, its
+ * transmit-time wait and bit timing, and the loopback transmit self-test.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "gpio_mock.h"
+#include "serial_io.h"
+#include "tx_selftest.h"
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <string>
+#include <array>
+#include <vector>
+
+static_assert(PortHasEdgeWait<MockGpioPort>);
+static_assert(PortHasEdgeTime<MockGpioPort>);
+static_assert(PortHasEdgeLog<MockGpioPort>);
+
+static long ms_since(std::chrono::steady_clock::time_point t0) {
+    return static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - t0).count());
+}
+
+// Poll until `reader` has produced `want` KV pairs or `limit_ms` passes
+template <typename Reader>
+static void read_until(Reader& reader, const std::atomic<int>& got, int want, int limit_ms) {
+    auto t0 = std::chrono::steady_clock::now();
+    while (got < want && ms_since(t0) < limit_ms) {
+        if (reader.poll() == 0) reader.wait_for_data();
+    }
+}
+
+// ── Edge wakeups ────────────────────────────────────────────────────
+
+TEST_CASE("mock wait_edge times out when idle and fires on inject") {
+    MockGpioPort port;
+    CHECK(port.wait_edge(27, 20) == 0);
+
+    port.inject_serial_data_pin(27, "[inc:5]\xff");
+    CHECK(port.wait_edge(27, 20) == 1);
+    CHECK(port.wait_edge(27, 20) == 0);  // edge consumed
+
+    port.edge_alerts = false;
+    CHECK(port.wait_edge(27, 20) == -1);
+}
+
+TEST_CASE("idle reader wakes on an edge instead of sleeping out its wait") {
+    MockGpioPort port;
+    SerialReader<MockGpioPort> reader(port, 27);
+    CHECK(reader.open());
+
+    std::atomic<int> got{0};
+    reader.on_kv([&](const KvPair&) { got++; });
+
+    // Go idle, so the next wait blocks on the edge
+    for (int i = 0; i < 4; i++) CHECK(reader.poll() == 0);
+
+    std::thread injector([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        port.inject_serial_data_pin(27, "[hmph:78]\xff");
+    });
+    auto t0 = std::chrono::steady_clock::now();
+    read_until(reader, got, 1, 1000);
+    long dt = ms_since(t0);
+    injector.join();
+
+    CHECK(got == 1);
+    CHECK(dt < EDGE_WAIT_MAX_MS);
+}
+
+TEST_CASE("reader falls back to polling without edge alerts") {
+    MockGpioPort port;
+    port.edge_alerts = false;
+    SerialReader<MockGpioPort> reader(port, 27);
+    CHECK(reader.open());
+
+    std::atomic<int> got{0};
+    reader.on_kv([&](const KvPair&) { got++; });
+
+    for (int i = 0; i < 8; i++) {
+        CHECK(reader.poll() == 0);
+        reader.wait_for_data();
+    }
+    port.inject_serial_data_pin(27, "[belt:0]\xff");
+    auto t0 = std::chrono::steady_clock::now();
+    read_until(reader, got, 1, 1000);
+
+    CHECK(got == 1);
+    CHECK(ms_since(t0) <= IDLE_POLL_MAX_US / 1000 + 20);
+}
+
+TEST_CASE("interrupt unblocks a reader waiting for an edge") {
+    MockGpioPort port;
+    SerialReader<MockGpioPort> reader(port, 27);
+    CHECK(reader.open());
+    for (int i = 0; i < 4; i++) reader.poll();
+
+    std::thread stopper([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        reader.interrupt();
+    });
+    auto t0 = std::chrono::steady_clock::now();
+    reader.wait_for_data();
+    long dt = ms_since(t0);
+    stopper.join();
+
+    CHECK(dt < EDGE_WAIT_MAX_MS);
+}
+
+// ── Arrival stamps ──────────────────────────────────────────────────
+
+TEST_CASE("pairs carry their arrival time, not the poll's") {
+    MockGpioPort port;
+    SerialReader<MockGpioPort> reader(port, 27);
+    CHECK(reader.open());
+    std::vector<int64_t> stamps;
+    reader.on_kv([&](const KvPair& kv) { stamps.push_back(kv.t_ns); });
+
+    // With edge times: the inject (the "edge") dates the whole read
+    int64_t before = wire_now_ns();
+    port.inject_serial_data_pin(27, "[inc:5]\xff[amps]\xff");
+    int64_t injected = wire_now_ns();
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    CHECK(reader.poll() == 15);
+    CHECK(stamps.size() == 2);
+    if (stamps.size() == 2) {
+        // The last ']' is one byte before the read's last byte
+        CHECK(stamps.at(1) + BYTE_NS >= before);
+        CHECK(stamps.at(1) + BYTE_NS <= injected);
+        CHECK(stamps.at(1) - stamps.at(0) == 7 * BYTE_NS);  // "\xff[amps]" after the first
+    }
+
+    // Without them: the read time
+    port.edge_alerts = false;
+    stamps.clear();
+    port.inject_serial_data_pin(27, "[belt]\xff");
+    int64_t read_from = wire_now_ns();
+    CHECK(reader.poll() == 7);
+    CHECK(stamps.size() == 1);
+    if (!stamps.empty()) {
+        CHECK(stamps.at(0) + BYTE_NS >= read_from);
+        CHECK(stamps.at(0) <= wire_now_ns());
+    }
+}
+
+TEST_CASE("wire clock moves forward") {
+    int64_t a = wire_now_ns();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    int64_t b = wire_now_ns();
+    CHECK(b - a >= 2000000);
+    CHECK(b - a < 1000000000);
+}
+
+// ── Wave cache / chaining ───────────────────────────────────────────
+
+TEST_CASE("write_kv builds a wave once and re-sends it from the cache") {
+    MockGpioPort port;
+    SerialWriter<MockGpioPort> writer(port, 22);
+
+    writer.write_kv("amps");
+    writer.write_kv("amps");
+    writer.write_kv("inc", "A");
+
+    CHECK(port.waves_created == 2);
+    CHECK(port.get_written_string() == "[amps]\xff[amps]\xff[inc:A]\xff");
+    CHECK(port.wave_writes.at(0).gpio == 22);
+}
+
+TEST_CASE("write_kv_burst sends all frames in one chain") {
+    MockGpioPort port;
+    SerialWriter<MockGpioPort> writer(port, 22);
+
+    std::array<KvFrame, 3> burst = {{ { "part", "6" }, { "ver", {} }, { "type", {} } }};
+    writer.write_kv_burst(burst);
+    writer.write_kv_burst(burst);
+
+    CHECK(port.chain_sends == 2);
+    CHECK(port.wave_writes.size() == 2);
+    CHECK(port.waves_created == 3);
+    CHECK(port.get_written_string() ==
+          "[part:6]\xff[ver]\xff[type]\xff[part:6]\xff[ver]\xff[type]\xff");
+}
+
+TEST_CASE("write_bytes leaves cached waves intact") {
+    MockGpioPort port;
+    SerialWriter<MockGpioPort> writer(port, 22);
+
+    writer.write_kv("belt");
+    std::string raw = "[hmph:78]\xff";
+    // reinterpret_cast: char -> uint8_t aliasing (standard-allowed)
+    writer.write_bytes(std::span<const uint8_t>(
+        reinterpret_cast<const uint8_t*>(raw.data()), raw.size()));
+    writer.write_kv("belt");
+
+    CHECK(port.waves_created == 2);  // cached belt + transient raw
+    CHECK(port.waves.size() == 1);   // transient deleted
+    CHECK(port.get_written_string() == "[belt]\xff[hmph:78]\xff[belt]\xff");
+}
+
+TEST_CASE("wave cache evicts and rebuilds when DMA waves run out") {
+    MockGpioPort port;
+    port.max_waves = 3;
+    SerialWriter<MockGpioPort> writer(port, 22);
+
+    std::string expected;
+    for (int i = 0; i < 10; i++) {
+        std::string v = std::to_string(i);
+        writer.write_kv("inc", v);
+        expected += "[inc:" + v + "]\xff";
+    }
+    std::array<KvFrame, 2> burst = {{ { "diag", "0" }, { "loop", "5550" } }};
+    writer.write_kv_burst(burst);
+    expected += "[diag:0]\xff[loop:5550]\xff";
+
+    CHECK(port.get_written_string() == expected);
+    CHECK(static_cast<int>(port.waves.size()) <= 3);
+}
+
+TEST_CASE("write_frame and write_burst send prebuilt frames from the cache") {
+    MockGpioPort port;
+    SerialWriter<MockGpioPort> writer(port, 22);
+
+    writer.write_frame("[belt]\xff");
+    std::array<std::string_view, 2> wires = {{ "[belt]\xff", "[inc:A]\xff" }};
+    writer.write_burst(wires);
+
+    CHECK(port.waves_created == 2);
+    CHECK(port.chain_sends == 1);
+    CHECK(port.get_written_string() == "[belt]\xff[belt]\xff[inc:A]\xff");
+}
+
+TEST_CASE("writer sleeps out the computed transmit time instead of polling") {
+    MockGpioPort port;
+    port.tx_timing = true;
+    SerialWriter<MockGpioPort> writer(port, 22);
+
+    std::array<std::string_view, 4> wires = {{ "[hmph:4B0]\xff", "[inc:C6]\xff",
+                                               "[belt]\xff", "[loop:5550]\xff" }};
+    size_t bytes = 0;
+    for (auto w : wires) bytes += w.size();
+
+    auto t0 = std::chrono::steady_clock::now();
+    writer.write_burst(wires);
+    long dt = ms_since(t0);
+    CHECK(dt >= static_cast<long>(bytes * BYTE_US / 1000));
+    // One busy check before and after the computed sleep, plus a few for
+    // the tail — not one per millisecond of transmission
+    CHECK(port.tx_busy_calls.load() < 10);
+    CHECK(port.get_written_string() == "[hmph:4B0]\xff[inc:C6]\xff[belt]\xff[loop:5550]\xff");
+}
+
+TEST_CASE("wave pulses follow the exact bit period, not a truncated one") {
+    MockGpioPort port;
+    SerialWriter<MockGpioPort> writer(port, 22);
+    writer.write_kv("hmph", "12C");  // 11 bytes: 110 bits of 104.17 us
+    CHECK(port.waves.size() == 1);
+    if (port.waves.empty()) return;
+    const auto& pulses = port.waves.begin()->second.pulses;
+    CHECK(pulses.size() == 110);
+    for (const auto& p : pulses) CHECK((p.usDelay == 104 || p.usDelay == 105));
+    CHECK(MockGpioPort::pulse_time_us(pulses) == 11458);  // 11458.3, where 104 us bits made 11440
+    CHECK(port.get_written_string() == "[hmph:12C]\xff");
+
+    // Another baud rate, reader included
+    MockGpioPort fast;
+    SerialWriter<MockGpioPort> w19200(fast, 22, 19200);
+    w19200.write_kv("belt");
+    CHECK(fast.waves.size() == 1);
+    if (!fast.waves.empty()) CHECK(MockGpioPort::pulse_time_us(fast.waves.begin()->second.pulses) == 3646);
+    SerialReader<MockGpioPort> reader(fast, 27, 19200);
+    CHECK(reader.open());
+    CHECK(fast.pins[27].serial_baud == 19200);
+}
+
+TEST_CASE("the loopback self-test measures what the writer sent") {
+    MockGpioPort port;
+    port.loopback_write = 22;
+    SerialWriter<MockGpioPort> writer(port, 22);
+
+    auto r = run_tx_selftest(port, writer, 5, 4);
+    CHECK(r.has_value());
+    if (!r) return;
+    CHECK(r->bursts == 4);
+    CHECK(r->bad_bursts == 0);
+    CHECK(r->edges > 100);
+    CHECK(std::abs(r->rate_error_ppm) < 100);  // half-microsecond rounding only
+    CHECK(r->max_error_ns <= 2000);  // each chained wave rounds on its own
+    CHECK(r->jitter_rms_ns < 500);
+
+    // Edges off by up to +-3 us: uniform, so about 1.7 us rms
+    port.loopback_jitter_ns = 3000;
+    r = run_tx_selftest(port, writer, 5, 4);
+    CHECK(r.has_value());
+    if (!r) return;
+    CHECK(r->bad_bursts == 0);
+    CHECK(r->jitter_rms_ns > 1000);
+    CHECK(r->jitter_rms_ns < 2500);
+    CHECK(r->max_error_ns <= 8000);  // the first edge is off too
+
+    // Nothing looped back: every burst is bad
+    port.loopback_write = -1;
+    r = run_tx_selftest(port, writer, 5, 2);
+    CHECK(r.has_value());
+    if (r) CHECK(r->bad_bursts == 2);
+}
+
+TEST_CASE("the timing analysis sees truncated bits as a rate error") {
+    std::array<uint8_t, 11> bytes;
+    std::string_view frame = "[hmph:12C]\xff";
+    std::copy(frame.begin(), frame.end(), bytes.begin());
+    std::array<PortEdge, 256> ideal;
+    size_t n = tx_ideal_edges(bytes, 9600, ideal);
+    CHECK(n > 20);
+
+    // The same edges on 104 us bits, logged from some arbitrary time base
+    std::array<PortEdge, 256> logged;
+    for (size_t i = 0; i < n; i++) {
+        logged.at(i) = { 5'000'000 + ideal.at(i).t_ns * 104 * 9600 / 1'000'000, ideal.at(i).level };
+    }
+    TxTimingAnalyzer a(9600);
+    CHECK(a.add_burst(bytes, std::span<const PortEdge>(logged.data(), n)));
+    auto r = a.report();
+    CHECK(r.rate_error_ppm == doctest::Approx(-1600).epsilon(0.01));
+    CHECK(r.jitter_rms_ns < 100);
+
+    // A missing edge doesn't match
+    CHECK_FALSE(a.add_burst(bytes, std::span<const PortEdge>(logged.data(), n - 1)));
+    CHECK(a.report().bad_bursts == 1);
+}
+
+TEST_CASE("writers sharing a WaveEngine rebuild waves another bus cleared") {
+    MockGpioPort port;
+    WaveEngine engine;
+    SerialWriter<MockGpioPort> bus0(port, 22, engine);
+    SerialWriter<MockGpioPort> bus1(port, 6, engine);
+
+    bus0.write_kv("belt");
+    bus1.write_kv("amps");
+    bus1.clear_wave_cache();  // wave_clear() takes bus0's cached wave too
+    bus0.write_kv("belt");
+
+    CHECK(port.waves_created == 3);
+    CHECK(port.get_written_string() == "[belt]\xff[amps]\xff[belt]\xff");
+    CHECK(port.wave_writes.at(1).gpio == 6);
+    CHECK(port.wave_writes.at(2).gpio == 22);
+}
+
+// ── Parse ring ──────────────────────────────────────────────────────
+
+TEST_CASE("reader parses frames split across polls and reports overflow drops") {
+    MockGpioPort port;
+    port.edge_alerts = false;
+    SerialReader<MockGpioPort> reader(port, 27);
+    CHECK(reader.open());
+
+    std::vector<std::string> keys;
+    size_t raw = 0;
+    reader.on_kv([&](const KvPair& kv) { keys.emplace_back(kv.key_view()); });
+    reader.on_raw([&](std::span<const uint8_t> data) { raw += data.size(); });
+
+    port.inject_serial_data_pin(27, "[hm");
+    reader.poll();
+    port.inject_serial_data_pin(27, "ph:78]\xff");
+    reader.poll();
+    CHECK(keys.size() == 1);
+
+    // An unterminated frame longer than the ring is dropped, not wedged
+    std::string junk = "[" + std::string(KV_STREAM_BUF_SIZE + 100, 'x');
+    port.inject_serial_data_pin(27, junk);
+    while (reader.poll() > 0) {}
+    port.inject_serial_data_pin(27, "]\xff[belt:0]\xff");
+    while (reader.poll() > 0) {}
+
+    CHECK(reader.dropped_bytes() == KV_STREAM_BUF_SIZE);
+    CHECK(raw == 3 + 7 + junk.size() + 11);
+    auto st = reader.line_stats();
+    CHECK(st.bytes == raw);
+    CHECK(st.frames == 2);
+    CHECK(st.overflow_bytes == KV_STREAM_BUF_SIZE);
+    CHECK(st.stray_bytes == 101 + 1);  // the junk past the ring and its late ']'
+    CHECK(keys.size() == 2);
+    if (keys.size() == 2) CHECK(keys.at(1) == "belt");
+}
+
+// A compile-time sink, as the controller wires its readers
+struct RecordingSink {
+    std::vector<std::string>* keys;
+    size_t* raw_bytes;
+    void kv(const KvPair& kv) { keys->emplace_back(kv.key_view()); }
+    void raw(std::span<const uint8_t> data) { *raw_bytes += data.size(); }
+};
+static_assert(SerialSink<RecordingSink> && SerialSink<SerialCallbacks>);
+
+TEST_CASE("a sink type gets the pairs and raw bytes the callbacks would") {
+    MockGpioPort port;
+    port.edge_alerts = false;
+    std::vector<std::string> keys;
+    size_t raw = 0;
+    SerialReader<MockGpioPort, RecordingSink> reader(port, 27, BAUD, RecordingSink{&keys, &raw});
+    CHECK(reader.open());
+
+    port.inject_serial_data_pin(27, "[inc:5]\xff[hm");
+    reader.poll();
+    port.inject_serial_data_pin(27, "ph:78]\xff");
+    reader.poll();
+    CHECK(raw == 18);
+    CHECK(keys.size() == 2);
+    if (keys.size() == 2) CHECK(keys.at(1) == "hmph");
+    CHECK(reader.line_stats().frames == 2);
+}
@@ -0,0 +1,146 @@
+/*
+ * test_sim_motor.cpp — Tests for the simulated motor controller
+ *
+ * The SimMotor model on explicit time, then SimMotorPort answering a
+ * live TreadmillController in emulate mode.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "gpio_sim.h"
+#include "treadmill_io.h"
+#include "ipc_test_util.h"
+
+#include <unistd.h>
+#include <array>
+#include <chrono>
+#include <string>
+#include <thread>
+
+static std::string reply(SimMotor& m, std::string_view key, std::string_view value, uint64_t t) {
+    std::array<char, KV_WIRE_FRAME_MAX> out;
+    return std::string(out.data(), m.frame(key, value, t, out));
+}
+
+TEST_CASE("the model ramps the belt and the lift toward their targets") {
+    SimMotorConfig cfg;
+    cfg.accel_mph_s = 2.0;
+    cfg.decel_mph_s = 4.0;
+    cfg.lift_pct_s = 1.0;
+    SimMotor m(cfg);
+
+    CHECK(reply(m, "hmph", "12C", 1'000'000) == "[hmph:0]");  // 3.0 mph: starts from rest
+    CHECK(m.sim_amps() > 40);                                  // accelerating draws more
+    CHECK(reply(m, "hmph", "12C", 1'500'000) == "[hmph:64]");  // 1.0 mph after 0.5 s
+    CHECK(reply(m, "belt", "", 1'500'000) == "[belt:E]");      // 100 / 7
+    CHECK(reply(m, "hmph", "12C", 3'000'000) == "[hmph:12C]");
+    CHECK(m.settled());
+    CHECK(m.sim_amps() < 40);
+
+    // Down is faster: 4 mph/s takes 3.0 mph to 1.0 in 0.5 s
+    CHECK(reply(m, "hmph", "64", 3'000'000) == "[hmph:12C]");
+    CHECK(reply(m, "hmph", "64", 3'500'000) == "[hmph:64]");
+    CHECK(reply(m, "hmph", "0", 3'500'000) == "[hmph:64]");
+    CHECK(reply(m, "belt", "", 4'000'000) == "[belt:0]");
+
+    // The lift: 1 %/s is 2 half-pct per second
+    CHECK(reply(m, "inc", "4", 5'000'000) == "[inc:0]");
+    CHECK(reply(m, "lfts", "", 5'000'000) == "[lfts:0]");
+    CHECK(reply(m, "inc", "4", 6'000'000) == "[inc:2]");
+    CHECK(reply(m, "lift", "", 7'000'000) == "[lift:3D]");  // 0x28 + 4 * 16 / 3
+    CHECK(reply(m, "lfts", "", 7'000'000) == "[lfts:1]");
+
+    auto s = m.state(7'000'000);
+    CHECK(s.speed == 0);
+    CHECK(s.incline == 4);
+    CHECK(s.target_incline == 4);
+}
+
+TEST_CASE("the model answers queries like the captured motor board") {
+    SimMotor m(SimMotorConfig{});
+    CHECK(reply(m, "ver", "", 1) == "[ver:19A]");
+    CHECK(reply(m, "type", "", 1) == "[type:20]");
+    CHECK(reply(m, "loop", "5550", 1) == "[loop:4C57]");
+    CHECK(reply(m, "part", "6", 1) == "[part:6]");
+    CHECK(reply(m, "err", "", 1) == "[err]");
+    CHECK(reply(m, "lftg", "", 1) == "[lftg:0]");
+    CHECK(reply(m, "lift", "", 1) == "[lift:28]");
+    CHECK(reply(m, "vbus", "", 1).empty());
+    CHECK(reply(m, "diag", "0", 1).empty());
+    CHECK(reply(m, "nope", "", 1).empty());
+}
+
+TEST_CASE("the port answers each frame on the read pin after the reply delay") {
+    SimMotorConfig cfg;
+    cfg.reply_us = 20000;
+    SimMotorPort port(cfg);
+    port.initialise();
+
+    std::array<char, KV_WIRE_FRAME_MAX> frame;
+    size_t n = kv_build(frame, "ver");
+    std::array<gpioPulse_t, 10 * KV_WIRE_FRAME_MAX> pulses;
+    // Build the wave the way SerialWriter does: 10 pulses per byte, inverted
+    size_t np = 0;
+    for (size_t i = 0; i < n; i++) {
+        auto b = static_cast<uint8_t>(frame.at(i));
+        auto bit = [&](bool one) {
+            pulses.at(np++) = one ? gpioPulse_t{ 0, 1u << 22, 104 } : gpioPulse_t{ 1u << 22, 0, 104 };
+        };
+        bit(false);
+        for (int k = 0; k < 8; k++) bit((b >> k) & 1);
+        bit(true);
+    }
+    port.wave_add_new();
+    port.wave_add_generic(static_cast<int>(np), pulses.data());
+    int wid = port.wave_create();
+    CHECK(wid >= 0);
+    port.wave_tx_send(wid, 0);
+    CHECK(port.frames_received() == 1);
+    CHECK(port.frames_answered() == 1);
+
+    // Nothing before the delay; the whole reply once it has gone out
+    std::array<uint8_t, 64> buf;
+    CHECK(port.serial_read(17, buf.data(), static_cast<int>(buf.size())) == 0);
+    // The queued reply signals the pin; wait_edge reports 1 once it's due
+    int woke = 0;
+    for (int i = 0; i < 10 && woke != 1; i++) woke = port.wait_edge(17, 200);
+    CHECK(woke == 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    int got = port.serial_read(17, buf.data(), static_cast<int>(buf.size()));
+    CHECK(std::string(buf.begin(), buf.begin() + std::max(got, 0)) == "[ver:19A]");
+    CHECK(port.last_edge_ns(17) > 0);
+    CHECK(port.get_written_string() == std::string(frame.data(), n));
+}
+
+TEST_CASE("emulate commands converge on the simulated motor and ack when it gets there") {
+    SimMotorConfig sim;
+    sim.accel_mph_s = 10.0;
+    SimMotorPort port(sim);
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+
+    TreadmillController<SimMotorPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        ctrl.stop();
+        return;
+    }
+    send_json(fd, "{\"cmd\":\"subscribe\",\"types\":[\"status\"]}");
+    send_json(fd, "{\"cmd\":\"speed\",\"value\":3.0,\"seq\":1}");
+
+    // 3 mph at 10 mph/s: the motor reports 3.0 after ~0.3 s
+    std::string events = read_until(fd, "\"stage\":\"motor\"", 3000);
+    CHECK(events.find("{\"type\":\"ack\",\"seq\":1,\"stage\":\"motor\",\"key\":\"hmph\",\"value\":30,") !=
+          std::string::npos);
+    CHECK(events.find("\"bus_speed\":30") != std::string::npos);
+    CHECK(port.motor_state().speed == 300);
+    CHECK(port.frames_answered() > 0);
+
+    close(fd);
+    ctrl.stop();
+}
@@ -0,0 +1,90 @@
+/*
+ * test_standby.cpp — Tests for the idle standby
+ *
+ * StandbyMonitor on explicit time, then a live TreadmillController going
+ * into standby on a silent bus and back to full rate on the first byte
+ * or a client taking control.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "standby.h"
+#include "gpio_mock.h"
+#include "treadmill_io.h"
+#include "ipc_test_util.h"
+
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+template <typename Pred>
+static bool wait_for(Pred pred, int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!pred()) {
+        if (std::chrono::steady_clock::now() >= deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+TEST_CASE("standby after idle_s without a byte, and only once until woken") {
+    StandbyMonitor m(10);
+    constexpr uint64_t S = 1'000'000;
+    CHECK_FALSE(m.check(100, false, 1 * S));   // first look: the baseline
+    CHECK_FALSE(m.check(100, false, 10 * S));  // 9 s idle
+    CHECK_FALSE(m.check(150, false, 11 * S));  // a byte: the clock restarts
+    CHECK_FALSE(m.check(150, false, 20 * S));
+    CHECK(m.check(150, false, 21 * S));
+    CHECK(m.standby());
+    CHECK_FALSE(m.check(150, false, 30 * S));  // already in standby
+    CHECK(m.entries() == 1);
+
+    CHECK(m.wake());
+    CHECK_FALSE(m.wake());                     // only the first caller leaves it
+    CHECK_FALSE(m.standby());
+    CHECK_FALSE(m.check(200, false, 31 * S));
+
+    // Driving the motor is never idle, however quiet the bus
+    CHECK_FALSE(m.check(200, true, 50 * S));
+    CHECK_FALSE(m.check(200, false, 59 * S));
+    CHECK(m.check(200, false, 60 * S));
+    CHECK(m.entries() == 2);
+
+    StandbyMonitor off(0);
+    CHECK_FALSE(off.check(0, false, 1 * S));
+    CHECK_FALSE(off.check(0, false, 100000 * S));
+    CHECK_FALSE(off.standby());
+}
+
+TEST_CASE("a silent bus goes into standby; a byte or a client taking control wakes it") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+    cfg.standby_idle_s = 1;
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    CHECK_FALSE(ctrl.in_standby());
+
+    CHECK(wait_for([&] { return ctrl.in_standby(); }, 4000));
+
+    // The first console byte brings it back
+    port.inject_serial_data_pin(27, kv_build("hmph", "78"));
+    CHECK(wait_for([&] { return !ctrl.in_standby(); }, 500));
+
+    CHECK(wait_for([&] { return ctrl.in_standby(); }, 4000));
+    int fd = connect_ipc();
+    CHECK(fd >= 0);
+    if (fd >= 0) {
+        send_json(fd, "{\"cmd\":\"emulate\",\"enabled\":true}");
+        CHECK(wait_for([&] { return !ctrl.in_standby(); }, 2500));
+        CHECK(ctrl.mode().is_emulating());
+
+        // Emulating never idles, though the mock motor never answers
+        std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+        CHECK_FALSE(ctrl.in_standby());
+        close(fd);
+    }
+    ctrl.stop();
+}
@@ -0,0 +1,168 @@
+/*
+ * test_status_page.cpp — Tests for the shared-memory status page
+ *
+ * Uses its own shm name so a running treadmill_io is left alone, except
+ * for the controller test, which checks the real page name.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "status_page.h"
+#include "gpio_mock.h"
+#include "treadmill_io.h"
+#include <atomic>
+#include <optional>
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+
+constexpr const char* TEST_PAGE = "/treadmill_io.test_status";
+
+TEST_CASE("published status reads back intact") {
+    StatusPage page;
+    CHECK(page.open(TEST_PAGE));
+
+    StatusPageReader reader;
+    CHECK(reader.open(TEST_PAGE));
+    CHECK_FALSE(reader.read().has_value());  // mapped, nothing published yet
+
+    page.publish(StatusEvent{ false, true, 52, 9, 50, 8, 1200, 900, 3, 4, 2.5, 120.75, 1800000 });
+    auto snap = reader.read();
+    CHECK(snap.has_value());
+    if (!snap) return;
+    CHECK_FALSE(snap->status.proxy);
+    CHECK(snap->status.emulate);
+    CHECK(snap->status.emu_speed == 52);
+    CHECK(snap->status.emu_incline == 9);
+    CHECK(snap->status.bus_speed == 50);
+    CHECK(snap->status.bus_incline == 8);
+    CHECK(snap->status.console_bytes == 1200);
+    CHECK(snap->status.motor_bytes == 900);
+    CHECK(snap->status.console_dropped == 3);
+    CHECK(snap->status.motor_dropped == 4);
+    CHECK(snap->status.distance_mi == 2.5);
+    CHECK(snap->status.vert_ft == 120.75);
+    CHECK(snap->status.belt_on_ms == 1800000);
+    CHECK(snap->pid == static_cast<uint32_t>(getpid()));
+    CHECK(snap->updated_us > 0);
+    CHECK(snap->seq % 2 == 0);
+
+    uint64_t seq = snap->seq;
+    page.publish(StatusEvent{ true, false, 0, 0, -1, -1, 0, 0, 0, 0, 0.0, 0.0, 0 });
+    snap = reader.read();
+    CHECK(snap.has_value());
+    if (snap) {
+        CHECK(snap->seq == seq + 2);
+        CHECK(snap->status.bus_speed == -1);
+    }
+}
+
+TEST_CASE("close unlinks the page") {
+    {
+        StatusPage page;
+        CHECK(page.open(TEST_PAGE));
+    }
+    StatusPageReader reader;
+    CHECK_FALSE(reader.open(TEST_PAGE));
+    CHECK_FALSE(reader.read().has_value());
+}
+
+TEST_CASE("reader never sees a torn snapshot under concurrent writes") {
+    StatusPage page;
+    CHECK(page.open(TEST_PAGE));
+    page.publish(StatusEvent{ true, false, 0, 0, 0, 0, 0, 0, 0, 0, 0.0, 0.0, 0 });
+
+    // Writer keeps every field equal to one counter
+    std::atomic<bool> stop{false};
+    std::thread writer([&]() {
+        for (int i = 1; !stop.load(std::memory_order_relaxed); i++) {
+            auto u = static_cast<uint32_t>(i);
+            page.publish(StatusEvent{ true, false, i, i, i, i, u, u, u, u, 0.0, 0.0, 0 });
+        }
+    });
+
+    StatusPageReader reader;
+    CHECK(reader.open(TEST_PAGE));
+    int reads = 0, torn = 0;
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(200);
+    while (std::chrono::steady_clock::now() < end) {
+        auto snap = reader.read();
+        if (!snap) continue;
+        reads++;
+        const auto& s = snap->status;
+        int v = s.emu_speed;
+        if (s.emu_incline != v || s.bus_speed != v || s.bus_incline != v ||
+            s.console_bytes != static_cast<uint32_t>(v) || s.motor_dropped != static_cast<uint64_t>(v)) {
+            torn++;
+        }
+    }
+    stop.store(true);
+    writer.join();
+    CHECK(reads > 1000);
+    CHECK(torn == 0);
+}
+
+TEST_CASE("controller publishes status and motor speed to the page") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+
+    StatusPageReader reader;
+    CHECK(reader.open());
+    auto snap = reader.read();  // start() pushes an initial status
+    CHECK(snap.has_value());
+    if (snap) {
+        CHECK(snap->status.proxy);
+        CHECK(snap->status.bus_speed == -1);
+    }
+
+    // Motor speed is hex hundredths of a mph: 0x1F4 = 5.0 mph
+    port.inject_serial_data_pin(17, kv_build("hmph", "1F4"));
+    bool seen = false;
+    for (int i = 0; i < 50 && !seen; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        snap = reader.read();
+        seen = snap && snap->status.bus_speed == decode_speed_hex("1F4");
+    }
+    CHECK(seen);
+
+    ctrl.stop();
+    CHECK_FALSE(reader.open());
+}
+
+TEST_CASE("controller integrates motor speed reports into odometry") {
+    MockGpioPort port;
+    port.initialise();
+    GpioConfig cfg{27, 22, 17};
+
+    TreadmillController<MockGpioPort> ctrl(port, cfg);
+    CHECK(ctrl.start());
+    StatusPageReader reader;
+    CHECK(reader.open());
+
+    // 5.0 mph at 4% (inc is half-pct hex: 0x8), reported 300 ms apart
+    port.inject_serial_data_pin(17, kv_build("inc", "8") + kv_build("hmph", "1F4"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    port.inject_serial_data_pin(17, kv_build("hmph", "1F4"));
+
+    std::optional<StatusPageReader::Snapshot> snap;
+    for (int i = 0; i < 50; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        snap = reader.read();
+        if (snap && snap->status.belt_on_ms > 0) break;
+    }
+    CHECK(snap.has_value());
+    if (snap) {
+        CHECK(snap->status.belt_on_ms >= 250);
+        CHECK(snap->status.belt_on_ms <= 450);
+        double hours = static_cast<double>(snap->status.belt_on_ms) / 3600000.0;
+        CHECK(snap->status.distance_mi == doctest::Approx(5.0 * hours).epsilon(0.01));
+        CHECK(snap->status.vert_ft == doctest::Approx(5.0 * hours * 0.04 * 5280).epsilon(0.01));
+    }
+
+    ctrl.stop();
+}
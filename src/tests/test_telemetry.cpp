@@ -0,0 +1,199 @@
+/*
+ * test_telemetry.cpp — Tests for TelemetryPublisher (UDP datagrams)
+ *
+ * The publisher sends to a unicast 127.0.0.1 port the test listens on:
+ * coalescing to the latest record per slot, status before kv, datagram
+ * splitting at TELEMETRY_DATAGRAM_MAX, and ring overruns counted as lost.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "telemetry.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Nonblocking UDP socket on an ephemeral loopback port
+struct Receiver {
+    int fd = -1;
+    int port = 0;
+
+    Receiver() {
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        struct sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+        port = ntohs(addr.sin_port);
+    }
+    ~Receiver() { close(fd); }
+
+    std::vector<std::string> datagrams() {
+        std::vector<std::string> out;
+        char buf[2048];
+        ssize_t n;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) out.emplace_back(buf, static_cast<size_t>(n));
+        return out;
+    }
+};
+
+// The records of one datagram, header checked
+static std::vector<std::string> records_of(const std::string& dg) {
+    std::vector<std::string> recs;
+    if (dg.size() < TELEMETRY_HEADER_SIZE || dg.compare(0, 4, TELEMETRY_MAGIC) != 0) return recs;
+    size_t pos = TELEMETRY_HEADER_SIZE;
+    while (pos + BINARY_FRAME_HEADER_SIZE <= dg.size()) {
+        uint16_t len;
+        std::memcpy(&len, dg.data() + pos, sizeof(len));
+        pos += BINARY_FRAME_HEADER_SIZE;
+        if (pos + len > dg.size()) break;
+        recs.push_back(dg.substr(pos, len));
+        pos += len;
+    }
+    return recs;
+}
+
+static void push_kv(EventRing& ring, std::string_view source, std::string_view key,
+                    std::string_view value, uint8_t bus = 0) {
+    auto r = ring.reserve();
+    ring.commit(r, format_kv_record(r.buf, KvEvent{source, key, value, 1.0, bus}));
+}
+
+static void push_status(EventRing& ring, int speed, uint8_t bus = 0) {
+    StatusEvent ev{};
+    ev.emu_speed = speed;
+    ev.bus = bus;
+    auto r = ring.reserve();
+    ring.commit(r, format_status_record(r.buf, ev));
+}
+
+static std::string kv_value(const std::string& rec) {
+    return rec.substr(KV_RECORD_HEADER_SIZE + static_cast<uint8_t>(rec[3]));
+}
+
+TEST_CASE("publish coalesces to the latest record per key, status first") {
+    Receiver rx;
+    EventRing ring;
+    TelemetryPublisher pub(ring, TelemetryConfig{"127.0.0.1", rx.port, 10, 1});
+    push_kv(ring, "motor", "belt", "0");  // before open(): not published
+    CHECK(pub.open());
+
+    push_kv(ring, "motor", "belt", "1");
+    push_kv(ring, "motor", "belt", "2");
+    push_kv(ring, "console", "belt", "3");
+    push_status(ring, 10);
+    push_status(ring, 20);
+    ring.push("{\"type\":\"error\",\"msg\":\"x\"}");
+    CHECK(pub.publish() == 1);
+
+    auto dgs = rx.datagrams();
+    CHECK(dgs.size() == 1);
+    if (dgs.size() != 1) return;
+    auto recs = records_of(dgs[0]);
+    CHECK(recs.size() == 3);
+    if (recs.size() != 3) return;
+    CHECK(recs[0].size() == STATUS_RECORD_SIZE);
+    int32_t speed;
+    std::memcpy(&speed, recs[0].data() + 4, sizeof(speed));
+    CHECK(speed == 20);
+    CHECK(kv_value(recs[1]) == "3");  // console sorts before motor
+    CHECK(kv_value(recs[2]) == "2");
+    CHECK(pub.stats().records == 3);
+    CHECK(pub.stats().coalesced == 2);
+
+    // Nothing new: nothing sent
+    CHECK(pub.publish() == 0);
+    CHECK(rx.datagrams().empty());
+}
+
+TEST_CASE("datagram header counts up and buses keep separate slots") {
+    Receiver rx;
+    EventRing ring;
+    TelemetryPublisher pub(ring, TelemetryConfig{"127.0.0.1", rx.port, 10, 1});
+    CHECK(pub.open());
+
+    push_kv(ring, "motor", "inc", "4", 0);
+    push_kv(ring, "motor", "inc", "6", 1);
+    pub.publish();
+    push_kv(ring, "motor", "inc", "8", 1);
+    pub.publish();
+
+    auto dgs = rx.datagrams();
+    CHECK(dgs.size() == 2);
+    if (dgs.size() != 2) return;
+    uint32_t seq0, seq1;
+    std::memcpy(&seq0, dgs[0].data() + 4, sizeof(seq0));
+    std::memcpy(&seq1, dgs[1].data() + 4, sizeof(seq1));
+    CHECK(seq1 == seq0 + 1);
+    CHECK(records_of(dgs[0]).size() == 2);
+    auto second = records_of(dgs[1]);
+    CHECK(second.size() == 1);
+    if (second.size() == 1) {
+        CHECK(second[0][5] == 1);
+        CHECK(kv_value(second[0]) == "8");
+    }
+}
+
+TEST_CASE("a full tick splits across datagrams that fit the MTU") {
+    Receiver rx;
+    EventRing ring;
+    TelemetryPublisher pub(ring, TelemetryConfig{"127.0.0.1", rx.port, 10, 1});
+    CHECK(pub.open());
+
+    std::string value(40, 'v');
+    size_t pushed = 0;
+    for (uint8_t bus = 0; bus < MAX_BUSES; bus++) {
+        for (size_t k = 1; k < KV_KEY_NAMES.size(); k++) {
+            push_kv(ring, "motor", KV_KEY_NAMES.at(k), value, bus);
+            pushed++;
+        }
+    }
+    int sent = pub.publish();
+    CHECK(sent > 1);
+
+    auto dgs = rx.datagrams();
+    CHECK(dgs.size() == static_cast<size_t>(sent));
+    size_t records = 0;
+    for (const auto& dg : dgs) {
+        CHECK(dg.size() <= TELEMETRY_DATAGRAM_MAX);
+        records += records_of(dg).size();
+    }
+    CHECK(records == pushed);
+}
+
+TEST_CASE("ring overruns between ticks count as lost") {
+    Receiver rx;
+    EventRing ring;
+    TelemetryPublisher pub(ring, TelemetryConfig{"127.0.0.1", rx.port, 10, 1});
+    CHECK(pub.open());
+
+    int over = 10;
+    for (int i = 0; i < EventRing::size() + over; i++) push_kv(ring, "motor", "belt", std::to_string(i));
+    pub.publish();
+    CHECK(pub.stats().lost == static_cast<uint64_t>(over));
+
+    auto dgs = rx.datagrams();
+    CHECK(dgs.size() == 1);
+    if (dgs.size() != 1) return;
+    auto recs = records_of(dgs[0]);
+    CHECK(recs.size() == 1);
+    if (recs.size() == 1) CHECK(kv_value(recs[0]) == std::to_string(EventRing::size() + over - 1));
+}
+
+TEST_CASE("open rejects a bad address and interval follows rate") {
+    EventRing ring;
+    TelemetryPublisher bad(ring, TelemetryConfig{"not-an-ip", 5005, 10, 1});
+    CHECK_FALSE(bad.open());
+    CHECK(bad.publish() == 0);
+
+    TelemetryPublisher group(ring, TelemetryConfig{"239.77.0.1", 5005, 20, 1});
+    CHECK(group.open());
+    CHECK(group.interval_ms() == 50);
+}
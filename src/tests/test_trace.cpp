@@ -0,0 +1,172 @@
+/*
+ * test_trace.cpp — Tests for the thread timeline recorder
+ *
+ * Records spans on named threads, dumps to a temp file and checks the
+ * Chrome trace JSON. The recorder is process-wide, so each case uses
+ * its own thread names and looks only at those tracks.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "trace.h"
+
+#define RAPIDJSON_ASSERT(x) ((void)(x))
+#define RAPIDJSON_HAS_CXX11_NOEXCEPT 1
+#include <rapidjson/document.h>
+
+namespace {
+
+std::string temp_path() {
+    return "/tmp/test_trace_" + std::to_string(getpid()) + ".json";
+}
+
+std::string read_file(const std::string& path) {
+    std::string out;
+    FILE* f = std::fopen(path.c_str(), "r");
+    if (!f) return out;
+    char buf[4096];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+    std::fclose(f);
+    return out;
+}
+
+struct DumpedEvent {
+    std::string name;
+    std::string ph;
+    double ts;
+    double dur;
+};
+
+// Events on the track named `thread` in the dump at `path`
+std::vector<DumpedEvent> events_of(const std::string& path, std::string_view thread) {
+    std::vector<DumpedEvent> out;
+    std::string json = read_file(path);
+    rapidjson::Document doc;
+    doc.Parse(json.data(), json.size());
+    if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("traceEvents")) return out;
+    const auto& evs = doc["traceEvents"];
+
+    int tid = -1;
+    for (const auto& e : evs.GetArray()) {
+        if (std::string_view(e["ph"].GetString()) == "M" &&
+            std::string_view(e["args"]["name"].GetString()) == thread) {
+            tid = e["tid"].GetInt();
+        }
+    }
+    for (const auto& e : evs.GetArray()) {
+        if (e["tid"].GetInt() != tid || std::string_view(e["ph"].GetString()) == "M") continue;
+        out.push_back({e["name"].GetString(), e["ph"].GetString(), e["ts"].GetDouble(),
+                       e.HasMember("dur") ? e["dur"].GetDouble() : -1.0});
+    }
+    return out;
+}
+
+void on_thread(const char* name, void (*fn)()) {
+    std::thread t([name, fn] {
+        trace_thread(name);
+        fn();
+    });
+    t.join();
+}
+
+}  // namespace
+
+TEST_CASE("spans and instants dump as Chrome trace events on the thread's track") {
+    auto path = temp_path();
+    trace_start();
+    on_thread("t_spans", [] {
+        {
+            TraceSpan outer("outer");
+            TraceSpan inner("inner");
+        }
+        trace_instant("mark");
+    });
+    trace_stop();
+
+    auto spans = trace_dump(path.c_str());
+    CHECK(spans.has_value());
+    auto evs = events_of(path, "t_spans");
+    CHECK(evs.size() == 3);
+    if (evs.size() == 3) {
+        // Inner ends first, so it is recorded first
+        CHECK(evs[0].name == "inner");
+        CHECK(evs[1].name == "outer");
+        CHECK(evs[0].ph == "X");
+        CHECK(evs[1].ts <= evs[0].ts);
+        CHECK(evs[1].dur >= evs[0].dur);
+        CHECK(evs[2].name == "mark");
+        CHECK(evs[2].ph == "i");
+    }
+    std::remove(path.c_str());
+}
+
+TEST_CASE("nothing is recorded while stopped, or for a cancelled span") {
+    auto path = temp_path();
+    trace_stop();
+    on_thread("t_quiet", [] {
+        TraceSpan idle("idle");
+        trace_instant("idle_mark");
+        trace_start();
+        TraceSpan none("none");
+        none.cancel();
+        TraceSpan kept("kept");
+        kept.end();
+        trace_stop();
+    });
+
+    CHECK(trace_dump(path.c_str()).has_value());
+    auto evs = events_of(path, "t_quiet");
+    CHECK(evs.size() == 1);
+    if (evs.size() == 1) CHECK(evs[0].name == "kept");
+    std::remove(path.c_str());
+}
+
+TEST_CASE("a wrapped ring keeps the most recent spans") {
+    auto path = temp_path();
+    trace_start();
+    on_thread("t_wrap", [] {
+        for (size_t i = 0; i < TRACE_SPANS_PER_THREAD + 100; i++) trace_record("old", 1000, 2000);
+        trace_record("newest", 5000, 6000);
+    });
+    trace_stop();
+
+    CHECK(trace_dump(path.c_str()).has_value());
+    auto evs = events_of(path, "t_wrap");
+    // Less the oldest slot, which an append in flight could be rewriting
+    CHECK(evs.size() == TRACE_SPANS_PER_THREAD - 1);
+    if (!evs.empty()) {
+        CHECK(evs.back().name == "newest");
+        CHECK(evs.back().ts == doctest::Approx(5.0));  // µs
+        CHECK(evs.back().dur == doctest::Approx(1.0));
+    }
+    std::remove(path.c_str());
+}
+
+TEST_CASE("a restarted thread with the same name continues its track") {
+    auto path = temp_path();
+    trace_start();
+    on_thread("t_again", [] { trace_instant("first"); });
+    on_thread("t_again", [] { trace_instant("second"); });
+    trace_stop();
+
+    CHECK(trace_dump(path.c_str()).has_value());
+    auto evs = events_of(path, "t_again");
+    CHECK(evs.size() == 2);
+    if (evs.size() == 2) {
+        CHECK(evs[0].name == "first");
+        CHECK(evs[1].name == "second");
+    }
+    std::remove(path.c_str());
+}
+
+TEST_CASE("a dump to an unwritable path fails without leaving a file") {
+    CHECK_FALSE(trace_dump("/nonexistent_dir/trace.json").has_value());
+}
@@ -0,0 +1,178 @@
+/*
+ * test_uart_port.cpp — Tests for UartPort on pseudo-terminals
+ *
+ * A pty stands in for each UART: the test holds the master side and
+ * UartPort opens the slave as its device. Covers reads and edge waits,
+ * SerialWriter's wave calls decoded back into the exact bytes, chained
+ * bursts, and the SerialReader/SerialWriter pair running unchanged.
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#define DOCTEST_CONFIG_NO_EXCEPTIONS
+#include <doctest.h>
+#include "gpio_uart.h"
+#include "serial_io.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+static_assert(PortHasEdgeWait<UartPort>);
+
+namespace {
+
+// Master side of a pty; slave() is the device path for UartPort
+struct Pty {
+    int master = -1;
+
+    Pty() {
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master >= 0 && (grantpt(master) != 0 || unlockpt(master) != 0)) {
+            ::close(master);
+            master = -1;
+        }
+        if (master >= 0) fcntl(master, F_SETFL, O_NONBLOCK);
+    }
+    ~Pty() {
+        if (master >= 0) ::close(master);
+    }
+
+    std::string slave() const { return master >= 0 ? ptsname(master) : ""; }
+
+    void send(std::string_view bytes) const {
+        ssize_t n = ::write(master, bytes.data(), bytes.size());
+        (void)n;
+    }
+
+    // Read whatever arrives within `ms`
+    std::string drain(int ms) const {
+        std::string out;
+        auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+        while (std::chrono::steady_clock::now() < until) {
+            char buf[256];
+            ssize_t n = ::read(master, buf, sizeof(buf));
+            if (n > 0) out.append(buf, static_cast<size_t>(n));
+            else std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return out;
+    }
+};
+
+// Collects the master side on a thread, so a writer's wait for its
+// queue to empty can finish
+struct Receiver {
+    const Pty& pty;
+    std::string got;
+    std::atomic<bool> stop{false};
+    std::thread t;
+
+    explicit Receiver(const Pty& p) : pty(p), t([this] {
+        while (!stop) got += pty.drain(5);
+    }) {}
+
+    std::string finish() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        stop = true;
+        t.join();
+        return got;
+    }
+};
+
+}  // namespace
+
+TEST_CASE("reads reach the mapped pin and wake its edge wait") {
+    Pty pty;
+    CHECK(pty.master >= 0);
+    if (pty.master < 0) return;
+
+    UartPort port;
+    CHECK(port.assign(27, pty.slave()));
+    CHECK(port.initialise() == 0);
+    CHECK(port.serial_read_open(27, 9600, 8) == 0);
+    CHECK(port.serial_read_open(17, 9600, 8) == -1);  // not routed
+    CHECK(port.serial_read_open(27, 19200, 8) == -1);
+
+    char buf[64];
+    CHECK(port.serial_read(27, buf, sizeof(buf)) == 0);
+    CHECK(port.wait_edge(27, 20) == 0);
+
+    pty.send("[inc:5]\xff");
+    CHECK(port.wait_edge(27, 500) == 1);
+    int n = port.serial_read(27, buf, sizeof(buf));
+    CHECK(std::string_view(buf, static_cast<size_t>(std::max(n, 0))) == "[inc:5]\xff");
+
+    // wake_edge() ends a wait early
+    auto t0 = std::chrono::steady_clock::now();
+    std::thread waker([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        port.wake_edge(27);
+    });
+    CHECK(port.wait_edge(27, 2000) == 0);
+    waker.join();
+    CHECK(std::chrono::steady_clock::now() - t0 < std::chrono::milliseconds(1000));
+}
+
+TEST_CASE("an unopenable device fails initialise") {
+    UartPort port;
+    CHECK(port.assign(27, "/nonexistent/ttyAMA9"));
+    CHECK(port.initialise() == -1);
+    CHECK_FALSE(port.assign(99, "/dev/null"));
+}
+
+TEST_CASE("SerialWriter's inverted waves come out as the original bytes") {
+    Pty pty;
+    if (pty.master < 0) return;
+    UartPort port;
+    port.assign(22, pty.slave());
+    CHECK(port.initialise() == 0);
+
+    SerialWriter<UartPort> writer(port, 22);
+    Receiver rx(pty);
+    std::string all;
+    for (int i = 0; i < 256; i++) all.push_back(static_cast<char>(i));
+    // reinterpret_cast: char -> uint8_t aliasing (standard-allowed)
+    writer.write_bytes(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(all.data()), all.size()));
+    writer.write_kv("hmph", "78");
+    writer.write_kv("hmph", "78");  // from the wave cache
+    CHECK(rx.finish() == all + "[hmph:78]\xff[hmph:78]\xff");
+}
+
+TEST_CASE("a chained burst is written back to back") {
+    Pty pty;
+    if (pty.master < 0) return;
+    UartPort port;
+    port.assign(22, pty.slave());
+    CHECK(port.initialise() == 0);
+
+    SerialWriter<UartPort> writer(port, 22);
+    Receiver rx(pty);
+    std::array<std::string_view, 3> burst = {"[inc:5]\xff", "[hmph:78]\xff", "[amps]\xff"};
+    writer.write_burst(burst);
+    CHECK(rx.finish() == "[inc:5]\xff[hmph:78]\xff[amps]\xff");
+}
+
+TEST_CASE("SerialReader parses frames from a UART unchanged") {
+    Pty pty;
+    if (pty.master < 0) return;
+    UartPort port;
+    port.assign(27, pty.slave());
+    CHECK(port.initialise() == 0);
+
+    SerialReader<UartPort> reader(port, 27);
+    CHECK(reader.open());
+    std::vector<std::string> keys;
+    reader.on_kv([&](const KvPair& kv) { keys.emplace_back(kv.key_view()); });
+
+    pty.send("[inc:5]\xff[hm");
+    pty.send("ph:78]\xff");
+    auto t0 = std::chrono::steady_clock::now();
+    while (keys.size() < 2 && std::chrono::steady_clock::now() - t0 < std::chrono::seconds(1)) {
+        if (reader.poll() == 0) reader.wait_for_data();
+    }
+    CHECK(keys == std::vector<std::string>{"inc", "hmph"});
+    reader.close();
+}
@@ -0,0 +1,79 @@
+/*
+ * thread_sched.h — Per-thread scheduling policy / CPU affinity, mlockall
+ *
+ * Set from the optional "realtime" section of gpio.json (see config.h)
+ * and applied by whoever spawns the thread, right after std::thread
+ * starts it: TreadmillController (console, motor, ipc), MotorWriter and
+ * EmulationEngine. The defaults leave every thread as spawned.
+ *
+ * Failures (e.g. SCHED_FIFO without CAP_SYS_NICE) are logged and the
+ * thread keeps running with its old settings: real-time scheduling is a
+ * latency improvement, not a requirement.
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+enum class SchedPolicy : uint8_t { Inherit, Other, Fifo, RoundRobin };
+
+struct ThreadSched {
+    SchedPolicy policy = SchedPolicy::Inherit;  // Inherit = leave as spawned
+    int priority = 0;    // 1-99 for Fifo/RoundRobin, 0 otherwise
+    uint64_t cpus = 0;   // affinity mask, bit i = CPU i; 0 = inherit
+
+    bool active() const { return policy != SchedPolicy::Inherit || cpus != 0; }
+};
+
+constexpr int SCHED_MAX_CPUS = 64;  // width of ThreadSched::cpus
+
+// Apply `s` to thread `t`. True if everything requested took effect.
+inline bool apply_thread_sched(pthread_t t, const ThreadSched& s, const char* name) {
+    bool ok = true;
+    if (s.policy != SchedPolicy::Inherit) {
+        int policy = s.policy == SchedPolicy::Fifo       ? SCHED_FIFO
+                   : s.policy == SchedPolicy::RoundRobin ? SCHED_RR
+                                                         : SCHED_OTHER;
+        struct sched_param param{};
+        param.sched_priority = s.priority;
+        int err = pthread_setschedparam(t, policy, &param);
+        if (err != 0) {
+            std::fprintf(stderr, "[sched] %s: cannot set policy %d priority %d (%s)\n",
+                         name, policy, s.priority, std::strerror(err));
+            ok = false;
+        }
+    }
+    if (s.cpus != 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < SCHED_MAX_CPUS; cpu++) {
+            if (s.cpus & (uint64_t{1} << cpu)) CPU_SET(cpu, &set);
+        }
+        int err = pthread_setaffinity_np(t, sizeof(set), &set);
+        if (err != 0) {
+            std::fprintf(stderr, "[sched] %s: cannot set CPU mask 0x%llx (%s)\n",
+                         name, static_cast<unsigned long long>(s.cpus), std::strerror(err));
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Lock current and future pages so the I/O threads never take a major
+// fault. MCL_ONFAULT (where available) locks pages as they are touched
+// instead of populating every thread stack up front.
+inline bool lock_process_memory() {
+    int flags = MCL_CURRENT | MCL_FUTURE;
+#ifdef MCL_ONFAULT
+    flags |= MCL_ONFAULT;
+#endif
+    if (mlockall(flags) == 0) return true;
+    std::fprintf(stderr, "[sched] mlockall failed (%s)\n", std::strerror(errno));
+    return false;
+}
@@ -0,0 +1,181 @@
+/*
+ * trace.cpp — Per-thread span rings and the Chrome trace JSON dump
+ */
+
+#include "trace.h"
+#include <cstdio>
+#include <cstring>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace {
+
+constexpr int64_t INSTANT = -1;  // end_ns of an instant marker
+
+struct TraceEntry {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<int64_t> begin_ns{0};
+    std::atomic<int64_t> end_ns{0};
+};
+
+// One track. A single thread writes it at a time; dumps read it
+// concurrently and keep only entries the writer can't have touched.
+struct ThreadTrace {
+    std::array<TraceEntry, TRACE_SPANS_PER_THREAD> entries{};
+    std::atomic<uint64_t> head{0};  // entries ever written
+    std::atomic<const char*> name{nullptr};
+    std::atomic<bool> in_use{false};
+};
+
+std::mutex tracks_mu;  // registry only; recording never takes it
+std::array<std::unique_ptr<ThreadTrace>, TRACE_MAX_THREADS> tracks;
+int track_count = 0;
+
+thread_local const char* t_name = nullptr;
+thread_local bool t_no_track = false;  // every track taken: don't retry per span
+
+// Hands the thread's track back when the thread exits
+struct TrackOwner {
+    ThreadTrace* track = nullptr;
+    ~TrackOwner() {
+        if (track) track->in_use.store(false, std::memory_order_release);
+    }
+};
+thread_local TrackOwner t_owner;
+
+// A free track last used by a thread of the same name, else a new one,
+// else any free one
+ThreadTrace* take_track(const char* name) {
+    std::lock_guard<std::mutex> lk(tracks_mu);
+    ThreadTrace* spare = nullptr;
+    for (int i = 0; i < track_count; i++) {
+        auto& t = *tracks.at(static_cast<size_t>(i));
+        if (t.in_use.load(std::memory_order_acquire)) continue;
+        const char* had = t.name.load(std::memory_order_relaxed);
+        if (had && std::strcmp(had, name) == 0) {
+            t.in_use.store(true, std::memory_order_relaxed);
+            return &t;
+        }
+        if (!spare) spare = &t;
+    }
+    if (track_count < TRACE_MAX_THREADS) {
+        auto& slot = tracks.at(static_cast<size_t>(track_count++));
+        slot = std::make_unique<ThreadTrace>();
+        spare = slot.get();
+    }
+    if (spare) {
+        spare->name.store(name, std::memory_order_relaxed);
+        spare->in_use.store(true, std::memory_order_relaxed);
+    }
+    return spare;
+}
+
+ThreadTrace* my_track() {
+    if (t_owner.track) return t_owner.track;
+    if (t_no_track) return nullptr;
+    t_owner.track = take_track(t_name ? t_name : "thread");
+    t_no_track = t_owner.track == nullptr;
+    return t_owner.track;
+}
+
+void append(const char* name, int64_t begin_ns, int64_t end_ns) {
+    ThreadTrace* t = my_track();
+    if (!t) return;
+    uint64_t i = t->head.load(std::memory_order_relaxed);
+    // Orders the previous head bump before these stores, so a dump that
+    // sees any of them also sees that entry i - N is being overwritten
+    std::atomic_thread_fence(std::memory_order_release);
+    auto& e = t->entries.at(i % TRACE_SPANS_PER_THREAD);
+    e.name.store(name, std::memory_order_relaxed);
+    e.begin_ns.store(begin_ns, std::memory_order_relaxed);
+    e.end_ns.store(end_ns, std::memory_order_relaxed);
+    t->head.store(i + 1, std::memory_order_release);
+}
+
+struct Copied {
+    const char* name;
+    int64_t begin_ns;
+    int64_t end_ns;
+};
+
+// The entries of `t` not overwritten while they were copied
+std::vector<Copied> copy_track(const ThreadTrace& t) {
+    constexpr uint64_t N = TRACE_SPANS_PER_THREAD;
+    uint64_t head = t.head.load(std::memory_order_acquire);
+    uint64_t from = head > N ? head - N : 0;
+    std::vector<Copied> out;
+    out.reserve(static_cast<size_t>(head - from));
+    for (uint64_t i = from; i < head; i++) {
+        const auto& e = t.entries.at(i % N);
+        out.push_back({e.name.load(std::memory_order_relaxed), e.begin_ns.load(std::memory_order_relaxed),
+                       e.end_ns.load(std::memory_order_relaxed)});
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t after = t.head.load(std::memory_order_relaxed);
+    uint64_t skip = after + 1 > from + N ? after + 1 - N - from : 0;
+    out.erase(out.begin(), out.begin() + static_cast<std::ptrdiff_t>(std::min<uint64_t>(skip, out.size())));
+    return out;
+}
+
+}  // namespace
+
+void trace_start() { TraceState::recording.store(true, std::memory_order_relaxed); }
+
+void trace_stop() { TraceState::recording.store(false, std::memory_order_relaxed); }
+
+void trace_thread(const char* name) {
+    t_name = name;
+    if (t_owner.track) t_owner.track->name.store(name, std::memory_order_relaxed);
+}
+
+void trace_record(const char* name, int64_t begin_ns, int64_t end_ns) {
+    append(name, begin_ns, end_ns);
+}
+
+void trace_instant(const char* name) {
+    if (trace_recording()) append(name, trace_now_ns(), INSTANT);
+}
+
+std::optional<size_t> trace_dump(const char* path) {
+    std::string tmp = std::string(path) + ".tmp";
+    FILE* f = std::fopen(tmp.c_str(), "w");
+    if (!f) return std::nullopt;
+
+    int pid = static_cast<int>(getpid());
+    size_t written = 0;
+    const char* sep = "\n";
+    std::fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    std::lock_guard<std::mutex> lk(tracks_mu);
+    for (int tid = 1; tid <= track_count; tid++) {
+        const auto& t = *tracks.at(static_cast<size_t>(tid - 1));
+        const char* name = t.name.load(std::memory_order_relaxed);
+        std::fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                        "\"args\":{\"name\":\"%s\"}}", sep, pid, tid, name ? name : "thread");
+        sep = ",\n";
+        for (const auto& e : copy_track(t)) {
+            if (!e.name) continue;
+            if (e.end_ns == INSTANT) {
+                std::fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+                             e.name, pid, tid, static_cast<double>(e.begin_ns) / 1000.0);
+            } else {
+                std::fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                             e.name, pid, tid, static_cast<double>(e.begin_ns) / 1000.0,
+                             static_cast<double>(e.end_ns - e.begin_ns) / 1000.0);
+            }
+            written++;
+        }
+    }
+    std::fprintf(f, "\n]}\n");
+
+    bool ok = std::ferror(f) == 0;
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok || std::rename(tmp.c_str(), path) != 0) {
+        std::remove(tmp.c_str());
+        return std::nullopt;
+    }
+    return written;
+}
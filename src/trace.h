@@ -0,0 +1,94 @@
+/*
+ * trace.h — Thread activity timeline, dumped as Chrome trace JSON
+ *
+ * While recording, each thread appends begin/end spans (TraceSpan) and
+ * instant markers (trace_instant) to a ring of its own: a few relaxed
+ * stores, no lock, no allocation after the thread's first span.
+ * Not recording costs one relaxed load per span site.
+ *
+ * Spans: SerialReader::poll that read bytes ("serial_read"), the
+ * SerialWriter entry points ("write_bytes", "write_frame", "write_chain",
+ * each with a nested "tx_wait" for the wave lock and the previous
+ * transmission), emulate bursts ("emu_burst", "emu_inject"), IpcServer
+ * poll iterations that had work ("ipc_poll"), and mode transitions
+ * (instants "mode:proxy", "mode:emulate", "mode:idle").
+ *
+ * trace_dump() writes every thread's ring as Chrome trace JSON (open it
+ * in ui.perfetto.dev or chrome://tracing): one track per named thread,
+ * timestamps in µs of CLOCK_MONOTONIC. Recording starts from gpio.json
+ * ("trace" section, config.h) or the `trace` command; dumps come from the
+ * `trace` command or SIGUSR1.
+ *
+ * Span names must be string literals: the ring stores the pointer.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <atomic>
+#include <optional>
+
+constexpr size_t TRACE_SPANS_PER_THREAD = 8192;  // per-thread ring (power of 2)
+constexpr int TRACE_MAX_THREADS = 16;            // tracks; threads past this go unrecorded
+constexpr const char* TRACE_PATH = "/tmp/treadmill_io.trace.json";
+
+static_assert((TRACE_SPANS_PER_THREAD & (TRACE_SPANS_PER_THREAD - 1)) == 0);
+
+struct TraceState {
+    static inline std::atomic<bool> recording{false};
+};
+
+inline bool trace_recording() {
+    return TraceState::recording.load(std::memory_order_relaxed);
+}
+
+inline int64_t trace_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+// Start or stop recording, process-wide. Spans already recorded stay
+// until their ring wraps.
+void trace_start();
+void trace_stop();
+
+// Name the calling thread's track (a literal). Call at thread start; a
+// restarted thread with the same name continues the same track.
+void trace_thread(const char* name);
+
+// Append one span [begin_ns, end_ns] to the calling thread's ring
+void trace_record(const char* name, int64_t begin_ns, int64_t end_ns);
+
+// A point-in-time marker on the calling thread's track
+void trace_instant(const char* name);
+
+// Write every track as Chrome trace JSON to `path` (via a temporary file
+// renamed into place). Returns the number of spans and instants written,
+// or nullopt if the file could not be written.
+std::optional<size_t> trace_dump(const char* path);
+
+// Records its scope as one span, if recording when constructed
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name)
+        : name_(trace_recording() ? name : nullptr), begin_ns_(name_ ? trace_now_ns() : 0) {}
+    ~TraceSpan() { end(); }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    // Record now instead of at scope exit
+    void end() {
+        if (name_) trace_record(name_, begin_ns_, trace_now_ns());
+        name_ = nullptr;
+    }
+
+    // Record nothing (e.g. a poll that found no work)
+    void cancel() { name_ = nullptr; }
+
+private:
+    const char* name_;
+    int64_t begin_ns_;
+};
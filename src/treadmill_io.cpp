@@ -1,8 +1,17 @@
 /*
  * treadmill_io.cpp — main() + gpio.json loader
  *
- * Production binary instantiates TreadmillController<PigpioPort>.
- * Links libpigpio. Must run as root.
+ * Production binary instantiates BusHost<PigpioPort>, or BusHost<UartPort>
+ * with "backend": "uart": one TreadmillController per bus in gpio.json,
+ * one port session.
+ * Under systemd it listens on the socket unit's fd and, on SIGTERM,
+ * parks its clients and state for the next start (handoff.h).
+ * SIGUSR1 dumps the trace timeline (trace.h) to the configured path.
+ * `--tx-selftest GPIO [BURSTS]` instead times bus 0's motor output read
+ * back on a spare GPIO (tx_selftest.h), prints the result and exits.
+ * `--proxy-selftest DRIVE LOOP [FRAMES]` times bus 0's forwarding, console
+ * in to motor out, over two jumpers (proxy_selftest.h).
+ * Links libpigpio. Must run as root for the pigpio backend.
  */
 
 #include <cstdio>
@@ -11,73 +20,243 @@
 #include <csignal>
 #include <unistd.h>
 #include <ctime>
+#include <algorithm>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <vector>
 
 #include "gpio_pigpio.h"
-#include "treadmill_io.h"
+#include "gpio_uart.h"
+#include "bus_host.h"
 #include "config.h"
+#include "handoff.h"
+#include "proxy_selftest.h"
+#include "tx_selftest.h"
 
 static volatile sig_atomic_t g_running = 1;
+static volatile sig_atomic_t g_trace_dump = 0;
 
 static void sig_handler(int /*sig*/) {
     g_running = 0;
 }
 
-int main() {
-    if (geteuid() != 0) {
-        std::fprintf(stderr, "Error: must run as root (sudo ./treadmill_io)\n");
-        return 1;
-    }
-
-    std::fprintf(stderr, "treadmill_io starting...\n");
-
-    GpioConfig cfg;
-    auto conf = load_gpio_config("gpio.json", &cfg);
-    if (!conf.ok) {
-        std::fprintf(stderr, "Error: %s\n", conf.error.c_str());
-        return 1;
-    }
-
-    std::fprintf(stderr, "  Console read: GPIO %d\n", cfg.console_read);
-    std::fprintf(stderr, "  Motor write:  GPIO %d\n", cfg.motor_write);
-    std::fprintf(stderr, "  Motor read:   GPIO %d\n", cfg.motor_read);
-    std::fprintf(stderr, "  Baud:         %d\n", BAUD);
+static void sig_trace_handler(int /*sig*/) {
+    g_trace_dump = 1;
+}
 
-    PigpioPort port;
+// Everything after the config: bring up `port`, run the buses until a
+// signal or `quit`, then hand off or shut down
+template <typename Port>
+static int run(Port& port, const std::vector<GpioConfig>& buses) {
     if (port.initialise() < 0) {
-        std::fprintf(stderr, "Failed to initialize pigpio (is pigpiod running? kill it first)\n");
+        if constexpr (std::is_same_v<Port, PigpioPort>) {
+            std::fprintf(stderr, "Failed to initialize pigpio (is pigpiod running? kill it first)\n");
+        } else {
+            std::fprintf(stderr, "Failed to open the UARTs\n");
+        }
         return 1;
     }
 
-    // Motor write pin: output, idle LOW (inverted RS-485)
-    port.set_mode(cfg.motor_write, PORT_OUTPUT);
-    port.write(cfg.motor_write, 0);
+    // Motor write pins: output, idle LOW (inverted RS-485)
+    for (const auto& cfg : buses) {
+        port.set_mode(cfg.motor_write, PORT_OUTPUT);
+        port.write(cfg.motor_write, 0);
+    }
 
     std::signal(SIGINT, sig_handler);
     std::signal(SIGTERM, sig_handler);
     std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGUSR1, sig_trace_handler);
+
+    auto inherited = collect_inherited(take_listen_fds(), mono_us());
+    if (inherited.state) {
+        std::fprintf(stderr, "[handoff] resuming %d buses, %zu clients\n", inherited.state->buses,
+                     inherited.clients.size());
+    }
 
-    TreadmillController<PigpioPort> controller(port, cfg);
+    BusHost<Port> host(port, buses);
 
-    if (!controller.start()) {
+    if (!host.start(inherited)) {
         port.terminate();
         return 1;
     }
 
     std::fprintf(stderr, "treadmill_io ready (proxy=on)\n");
 
-    while (g_running && controller.is_running()) {
+    while (g_running && host.is_running()) {
         struct timespec ts = { 0, 200000000L };  // 200ms
         nanosleep(&ts, nullptr);
+        if (g_trace_dump) {
+            g_trace_dump = 0;
+            const auto& path = buses.front().trace_path;
+            if (auto spans = trace_dump(path.c_str())) {
+                std::fprintf(stderr, "[trace] wrote %zu spans to %s\n", *spans, path.c_str());
+            } else {
+                std::fprintf(stderr, "[trace] failed to write %s\n", path.c_str());
+            }
+        }
     }
 
     std::fprintf(stderr, "\nShutting down...\n");
 
-    controller.stop();
+    // A signal (not `quit`) under systemd may be a restart: leave the
+    // clients connected for the successor. On a plain stop systemd
+    // closes them when it empties the fd store.
+    if (!g_running && has_service_manager()) {
+        std::vector<int> clients;
+        auto st = host.stop_detached(&clients);
+        if (park_for_successor(st, clients)) {
+            std::fprintf(stderr, "[handoff] parked %zu clients for the next start\n", clients.size());
+        } else {
+            std::fprintf(stderr, "[handoff] fd store unavailable, clients will reconnect\n");
+        }
+        for (int fd : clients) close(fd);
+    } else {
+        host.stop();
+    }
 
-    port.write(cfg.motor_write, 0);
-    port.set_mode(cfg.motor_write, PORT_INPUT);
+    for (const auto& cfg : buses) {
+        port.write(cfg.motor_write, 0);
+        port.set_mode(cfg.motor_write, PORT_INPUT);
+    }
     port.terminate();
 
     std::fprintf(stderr, "treadmill_io stopped.\n");
     return 0;
 }
+
+// Bring up `port` for bus 0's motor writer alone, time it on `loop_pin`
+template <typename Port>
+static int tx_selftest(Port& port, const GpioConfig& cfg, int loop_pin, int bursts) {
+    if (port.initialise() < 0) {
+        std::fprintf(stderr, "Failed to initialize the port\n");
+        return 1;
+    }
+    port.set_mode(cfg.motor_write, PORT_OUTPUT);
+    port.write(cfg.motor_write, 0);
+    SerialWriter<Port> writer(port, cfg.motor_write, cfg.baud);
+    std::fprintf(stderr, "[selftest] %d bursts on GPIO %d, read back on GPIO %d at %d baud\n", bursts,
+                 cfg.motor_write, loop_pin, cfg.baud);
+    auto r = run_tx_selftest(port, writer, loop_pin, bursts);
+    writer.clear_wave_cache();
+    port.set_mode(cfg.motor_write, PORT_INPUT);
+    port.terminate();
+    if (!r) {
+        std::fprintf(stderr, "[selftest] can't log edges on GPIO %d\n", loop_pin);
+        return 1;
+    }
+    std::printf("bursts %d (bad %d), edges %llu\n", r->bursts, r->bad_bursts,
+                static_cast<unsigned long long>(r->edges));
+    std::printf("rate error %+.1f ppm, max edge error %.2f us, jitter %.2f us rms\n", r->rate_error_ppm,
+                r->max_error_ns / 1000.0, r->jitter_rms_ns / 1000.0);
+    return r->bursts > 0 && r->bad_bursts == 0 ? 0 : 1;
+}
+
+// Run bus 0 proxying, drive its console input from `drive_pin` and time
+// the frames coming back out on `loop_pin`
+template <typename Port>
+static int proxy_selftest(Port& port, const GpioConfig& cfg, int drive_pin, int loop_pin, int frames) {
+    if (port.initialise() < 0) {
+        std::fprintf(stderr, "Failed to initialize the port\n");
+        return 1;
+    }
+    port.set_mode(cfg.motor_write, PORT_OUTPUT);
+    port.write(cfg.motor_write, 0);
+    port.set_mode(drive_pin, PORT_OUTPUT);
+    port.write(drive_pin, 0);
+    BusHost<Port> host(port, std::span<const GpioConfig>(&cfg, 1));
+    if (!host.start()) {
+        std::fprintf(stderr, "[selftest] can't start the controller (is treadmill_io running?)\n");
+        port.set_mode(drive_pin, PORT_INPUT);
+        port.terminate();
+        return 1;
+    }
+    SerialWriter<Port> drive(port, drive_pin, host.wave_engine(), cfg.baud);
+    std::fprintf(stderr, "[selftest] %d frames on GPIO %d -> console GPIO %d, motor GPIO %d -> GPIO %d\n",
+                 frames, drive_pin, cfg.console_read, cfg.motor_write, loop_pin);
+    auto r = run_proxy_selftest(port, drive, cfg.console_read, loop_pin, frames);
+    drive.clear_wave_cache();
+    host.stop();
+    port.write(cfg.motor_write, 0);
+    port.set_mode(cfg.motor_write, PORT_INPUT);
+    port.set_mode(drive_pin, PORT_INPUT);
+    port.terminate();
+    if (!r) {
+        std::fprintf(stderr, "[selftest] can't log edges on GPIO %d and %d\n", cfg.console_read, loop_pin);
+        return 1;
+    }
+    std::printf("frames %d (bad %d)\n", r->frames, r->bad_frames);
+    std::printf("forwarding latency min %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n", r->min_us, r->p50_us,
+                r->p99_us, r->max_us);
+    return r->frames > 0 && r->bad_frames == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    int loop_pin = -1;
+    int drive_pin = -1;
+    int bursts = 20;
+    int frames = 200;
+    if (argc >= 3 && std::string_view(argv[1]) == "--tx-selftest") {
+        loop_pin = std::atoi(argv[2]);
+        if (argc >= 4) bursts = std::max(1, std::atoi(argv[3]));
+    } else if (argc >= 4 && std::string_view(argv[1]) == "--proxy-selftest") {
+        drive_pin = std::atoi(argv[2]);
+        loop_pin = std::atoi(argv[3]);
+        if (argc >= 5) frames = std::clamp(std::atoi(argv[4]), 1, PROXY_SELFTEST_MAX_FRAMES);
+    } else if (argc > 1) {
+        std::fprintf(stderr, "usage: treadmill_io [--tx-selftest GPIO [BURSTS] | "
+                             "--proxy-selftest DRIVE_GPIO LOOP_GPIO [FRAMES]]\n");
+        return 2;
+    }
+    std::fprintf(stderr, "treadmill_io starting...\n");
+
+    std::vector<GpioConfig> buses;
+    auto conf = load_bus_configs("gpio.json", &buses);
+    if (!conf.ok) {
+        std::fprintf(stderr, "Error: %s\n", conf.error.c_str());
+        return 1;
+    }
+    bool uart = buses.front().backend == PortBackend::Uart;
+
+    // pigpio maps /dev/mem; UARTs need only access to their devices
+    if (!uart && geteuid() != 0) {
+        std::fprintf(stderr, "Error: must run as root (sudo ./treadmill_io)\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < buses.size(); i++) {
+        const auto& cfg = buses[i];
+        if (buses.size() > 1) std::fprintf(stderr, "  Bus %zu\n", i);
+        std::fprintf(stderr, "  Console read: GPIO %d %s\n", cfg.console_read, cfg.console_uart.c_str());
+        std::fprintf(stderr, "  Motor write:  GPIO %d %s\n", cfg.motor_write, cfg.motor_write_uart.c_str());
+        std::fprintf(stderr, "  Motor read:   GPIO %d %s\n", cfg.motor_read, cfg.motor_read_uart.c_str());
+        std::fprintf(stderr, "  Baud:         %d (%s)\n", cfg.baud, uart ? "kernel UART" : "pigpio");
+        if (cfg.standby_idle_s > 0) std::fprintf(stderr, "  Standby:      after %d s idle\n", cfg.standby_idle_s);
+    }
+    if (!uart) std::fprintf(stderr, "  Sample:       %d us\n", buses.front().sample_us);
+
+    if (loop_pin >= 0) {
+        if (uart) {
+            std::fprintf(stderr, "Error: the self-tests need the pigpio backend (an edge log)\n");
+            return 1;
+        }
+        PigpioPort port;
+        port.sample_us = buses.front().sample_us;
+        if (drive_pin >= 0) return proxy_selftest(port, buses.front(), drive_pin, loop_pin, frames);
+        return tx_selftest(port, buses.front(), loop_pin, bursts);
+    }
+
+    if (uart) {
+        UartPort port(buses.front().baud);
+        for (const auto& cfg : buses) {
+            port.assign(cfg.console_read, cfg.console_uart);
+            port.assign(cfg.motor_write, cfg.motor_write_uart);
+            port.assign(cfg.motor_read, cfg.motor_read_uart);
+        }
+        return run(port, buses);
+    }
+    PigpioPort port;
+    port.sample_us = buses.front().sample_us;
+    return run(port, buses);
+}
@@ -3,7 +3,22 @@
  *
  * Owns all components: readers, writer, emulation engine, IPC server,
  * mode state machine, and ring buffer. Thread functions are methods.
- * Templated on GpioPort for testability.
+ * Templated on GpioPort and a Clock (clock.h) for testability.
+ *
+ * Hosted mode (bus_host.h): several controllers, one per bus, share the
+ * host's ring, IPC server and DMA wave engine. The host's IPC thread
+ * routes commands and client events to handle_command(),
+ * client_connected() and clients_gone(); events are tagged with the bus.
+ *
+ * Reactor mode ("realtime": {"reactor": true}), for single-core boards:
+ * no console, motor or emulate threads. The IPC thread's loop calls
+ * reactor_pass() between waits: both readers polled, then whatever
+ * emulate has due (EmulationEngine::run_due()), then the IPC fds and
+ * timers for as long as the readers' backoff and the next burst allow.
+ * The heartbeat watchdog, the disconnect reset and the 3-hour timeout
+ * run as before, in a fixed order on one thread. Readers poll instead
+ * of waiting on GPIO edges. The motor writer keeps its thread: it waits
+ * out each transmission.
  */
 
 #pragma once
@@ -15,37 +30,89 @@
 #include <span>
 #include <string>
 #include <string_view>
+#include <optional>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <array>
+#include <memory>
+#include <algorithm>
 
-#include "ring_buffer.h"
+#include "byte_ring.h"
 #include "mode_state.h"
 #include "serial_io.h"
 #include "emulation_engine.h"
+#include "clock.h"
+#include "wire_clock.h"
+#include "motor_writer.h"
+#include "program_runner.h"
+#include "hr_zone.h"
+#include "query_tracker.h"
+#include "ack_tracker.h"
+#include "bus_analyzer.h"
+#include "motor_stats.h"
+#include "overlay.h"
+#include "odometer.h"
+#include "history.h"
+#include "standby.h"
 #include "ipc_server.h"
 #include "ipc_protocol.h"
 #include "kv_protocol.h"
 #include "config.h"
+#include "thread_sched.h"
+#include "metrics.h"
+#include "journal.h"
+#include "kv_filter.h"
+#include "kv_latest.h"
+#include "kv_cycle_buffer.h"
+#include "status_page.h"
+#include "telemetry.h"
+#include "handoff.h"
 
 // Heartbeat watchdog timeout: if emulating and no command received
 // for this long, safety-reset and return to proxy.
 constexpr int HEARTBEAT_TIMEOUT_SEC = 4;
 
-template <typename Port>
+// Console keys "lazy_console" parses with nobody wanting console events:
+// inc and hmph for the auto-proxy check, and the valued keys snapshots keep
+constexpr uint32_t CONSOLE_LAZY_KEYS = kv_key_bit(KvKey::Inc) | kv_key_bit(KvKey::Hmph) |
+                                       kv_key_bit(KvKey::Part) | kv_key_bit(KvKey::Diag) |
+                                       kv_key_bit(KvKey::Loop);
+
+// UDP publisher for `ring`, ticked by an `ipc` timer, if `cfg` has a
+// "telemetry" section. Null if disabled or the socket can't be opened.
+// Call after ipc.create().
+inline std::unique_ptr<TelemetryPublisher> start_telemetry(const GpioConfig& cfg, EventRing& ring,
+                                                           IpcServer& ipc) {
+    if (cfg.telemetry_address.empty()) return nullptr;
+    auto pub = std::make_unique<TelemetryPublisher>(
+        ring, TelemetryConfig{cfg.telemetry_address, cfg.telemetry_port, cfg.telemetry_rate_hz,
+                              cfg.telemetry_ttl});
+    if (!pub->open()) {
+        std::fprintf(stderr, "[telemetry] disabled: cannot open UDP socket to %s\n",
+                     cfg.telemetry_address.c_str());
+        return nullptr;
+    }
+    int timer = ipc.add_timer([p = pub.get()]() { p->publish(); });
+    ipc.arm_timer(timer, pub->interval_ms(), pub->interval_ms());
+    std::fprintf(stderr, "[telemetry] publishing to %s:%d at %d Hz\n", cfg.telemetry_address.c_str(),
+                 cfg.telemetry_port, cfg.telemetry_rate_hz);
+    return pub;
+}
+
+// Clock (clock.h) times the session: emulate pacing, programs, the
+// safety timeout, the heartbeat watchdog and event timestamps
+template <typename Port, typename Clock = MonoClock>
 class TreadmillController {
 public:
-    TreadmillController(Port& port, const GpioConfig& cfg)
-        : port_(port)
-        , cfg_(cfg)
-        , console_reader_(port, cfg.console_read)
-        , motor_reader_(port, cfg.motor_read)
-        , motor_writer_(port, cfg.motor_write)
-        , emu_engine_(motor_writer_, mode_)
-        , ipc_(ring_)
-    {
-        clock_gettime(CLOCK_MONOTONIC, &start_ts_);
-        last_cmd_time_ = start_ts_;
-    }
+    // Standalone: owns its ring, IPC server and IPC thread
+    TreadmillController(Port& port, const GpioConfig& cfg, Clock clock = {})
+        : TreadmillController(port, cfg, nullptr, nullptr, nullptr, 0, std::move(clock)) {}
+
+    // Hosted: bus `bus` of a BusHost, which owns `ring`, `ipc` and `engine`
+    TreadmillController(Port& port, const GpioConfig& cfg, EventRing& ring, IpcServer& ipc,
+                        WaveEngine& engine, int bus)
+        : TreadmillController(port, cfg, &ring, &ipc, &engine, bus, Clock{}) {}
 
     // Wire up all callbacks and start threads
     bool start() {
@@ -55,81 +122,64 @@ public:
                 emu_engine_.start();
             } else {
                 emu_engine_.stop();
+                end_program();
+                end_hr_zone();
             }
         });
 
-        // Emulation engine: push KV events to ring
-        emu_engine_.on_kv_event([this](std::string_view key, std::string_view value) {
-            push_kv_event("emulate", key, value);
+        // Programs and the HR zone step on the emulate thread, ahead of each burst
+        emu_engine_.on_burst([this](int64_t now_ns) {
+            program_tick(now_ns);
+            hr_zone_tick(now_ns);
         });
-
-        // Console reader: proxy + parse + auto-detect
-        console_reader_.on_raw([this](std::span<const uint8_t> data) {
-            mode_.add_console_bytes(static_cast<uint32_t>(data.size()));
-            // Proxy: forward raw bytes to motor (low latency)
-            if (mode_.is_proxy() && !mode_.is_emulating()) {
-                motor_writer_.write_bytes(data);
-            }
+        emu_engine_.on_cycle_end([this] {
+            if (cfg_.cycle_events) push_cycle_event(KV_SOURCE_EMULATE);
         });
 
-        console_reader_.on_kv([this](const KvPair& kv) {
-            auto key = kv.key_view();
-            auto value = kv.value_view();
-            push_kv_event("console", key, value);
-
-            // Auto-detect: console change while emulating -> switch to proxy
-            if (key == "hmph") {
-                auto result = mode_.auto_proxy_on_console_change(
-                    key, last_console_hmph_, value);
-                if (result.changed) {
-                    std::fprintf(stderr, "[auto] console hmph changed %s -> %s, switching to proxy\n",
-                                 last_console_hmph_.c_str(), std::string(value).c_str());
-                    push_status();
-                }
-                last_console_hmph_ = value;
-            } else if (key == "inc") {
-                auto result = mode_.auto_proxy_on_console_change(
-                    key, last_console_inc_, value);
-                if (result.changed) {
-                    std::fprintf(stderr, "[auto] console inc changed %s -> %s, switching to proxy\n",
-                                 last_console_inc_.c_str(), std::string(value).c_str());
-                    push_status();
-                }
-                last_console_inc_ = value;
+        // Emulation engine: push KV events to ring
+        emu_engine_.on_kv_event([this](std::string_view key, std::string_view value) {
+            journal_.record_kv(JournalSource::Emulate, key, value);
+            KvKey id = kv_key_lookup(key);
+            if (value.empty()) queries_.sent(id, mono_us());
+            if (AckTracker::tracks(id)) acks_.sent(id, value, mono_us());
+            latest_.record(KV_SOURCE_EMULATE, id, value);
+            cycle_frame(KV_SOURCE_EMULATE, key, value, 0, false);
+            if (emit_kv(emulate_filter_, id, value)) {
+                push_kv_event("emulate", key, value);
             }
         });
 
-        // Motor reader: parse only
-        motor_reader_.on_raw([this](std::span<const uint8_t> data) {
-            mode_.add_motor_bytes(static_cast<uint32_t>(data.size()));
-        });
+        // Console and motor readers call console_*() and motor_*() through
+        // their sinks (ConsoleSink, MotorSink), inlined into the read loop
 
-        motor_reader_.on_kv([this](const KvPair& kv) {
-            auto key = kv.key_view();
-            auto value = kv.value_view();
-            // Decode motor bus values
-            if (key == "hmph") {
-                int decoded = decode_speed_hex(value);
-                if (decoded >= 0) bus_speed_tenths_.store(decoded, std::memory_order_relaxed);
-            } else if (key == "inc") {
-                int decoded = decode_incline_hex(value);
-                if (decoded >= 0) bus_incline_half_pct_.store(decoded, std::memory_order_relaxed);
-            }
-            push_kv_event("motor", key, value);
-        });
+        if (!hosted_) {
+            // IPC: dispatch commands
+            ipc_.on_command([this](const IpcCommand& cmd) {
+                handle_command(cmd);
+            });
+            ipc_.enable_mailboxes(cfg_.mailbox);
 
-        // IPC: dispatch commands
-        ipc_.on_command([this](const IpcCommand& cmd) {
-            handle_command(cmd);
-        });
+            // IPC: a new client gets every key's current value on its next frame
+            ipc_.on_client_connect([this](int) { client_connected(); });
 
-        // IPC: client disconnect watchdog (Layer 1)
-        ipc_.on_client_disconnect([this](int remaining) {
-            if (remaining == 0 && mode_.is_emulating()) {
-                std::fprintf(stderr, "[watchdog] all clients disconnected — exiting emulate, returning to proxy\n");
-                watchdog_reset();
-            }
-        });
+            // IPC: lazy console parsing follows what clients subscribe to
+            ipc_.on_subscriptions([this] { subscriptions_changed(); });
+
+            // IPC: a new client, or one sending `snapshot`, gets every key's latest value at once
+            ipc_.on_snapshot([this](const IpcServer::SnapshotEmit& emit) { emit_snapshot(emit); });
+
+            // IPC: a `history` command gets its range, to that client only
+            ipc_.on_history([this](const IpcCommand& cmd, const IpcServer::SnapshotEmit& emit) {
+                emit_history(cmd, emit);
+            });
+
+            // IPC: client disconnect watchdog (Layer 1)
+            ipc_.on_client_disconnect([this](int remaining) {
+                if (remaining == 0) clients_gone();
+            });
+        }
+
+        subscriptions_changed();  // clients adopted in a handoff, else none yet
 
         // Open serial readers
         if (!console_reader_.open()) {
@@ -141,82 +191,177 @@ public:
             return false;
         }
 
-        // Create IPC socket
-        if (!ipc_.create()) {
-            std::fprintf(stderr, "Failed to create server socket\n");
-            return false;
+        // Journal is optional: keep running without it
+        if (!cfg_.journal_dir.empty()) {
+            if (journal_.open()) {
+                std::fprintf(stderr, "[journal] recording to %s (segment %llu)\n",
+                             cfg_.journal_dir.c_str(),
+                             static_cast<unsigned long long>(journal_.segment_seq()));
+            } else {
+                std::fprintf(stderr, "[journal] disabled: cannot open %s\n", cfg_.journal_dir.c_str());
+            }
+        }
+
+        // Shared-memory status page is optional too
+        if (!status_page_.open(page_name_.data())) {
+            std::fprintf(stderr, "[status] cannot create /dev/shm%s\n", page_name_.data());
+        }
+
+        // Create IPC socket (a host creates it before starting its buses)
+        if (!hosted_) {
+            if (!ipc_.create()) {
+                std::fprintf(stderr, "Failed to create server socket\n");
+                return false;
+            }
+            std::fprintf(stderr, "[ipc] listening on %s\n", SOCK_PATH);
+        }
+
+        // Layer 2 watchdog runs on a timerfd, armed only while emulating
+        watchdog_timer_ = ipc_.add_timer([this]() { check_heartbeat(); });
+
+        // Change-only events: periodic keyframe so every key is re-sent
+        if (cfg_.kv_changes_only) {
+            add_periodic_timer(PeriodicTimer::KvKeyframe, [this]() { resync_kv_filters(); }, cfg_.kv_keyframe_ms);
+        }
+
+        // Motor query stall scan
+        add_periodic_timer(PeriodicTimer::StallScan, [this]() {
+            check_queries();
+            check_acks();
+        }, QUERY_CHECK_MS);
+
+        // Periodic bus analysis
+        if (cfg_.bus_stats_ms > 0) {
+            bus_stats_.begin(mono_us(), mode_.console_bytes(), mode_.motor_bytes());
+            add_periodic_timer(PeriodicTimer::BusStats, [this]() { push_bus_stats(); }, cfg_.bus_stats_ms);
         }
 
-        std::fprintf(stderr, "[ipc] listening on %s\n", SOCK_PATH);
+        // Rolling motor amps/vbus/belt aggregates
+        if (cfg_.motor_stats_ms > 0) {
+            add_periodic_timer(PeriodicTimer::MotorStats, [this]() { push_motor_stats(); }, cfg_.motor_stats_ms);
+        }
+
+        // Chart history, one sample a second
+        add_periodic_timer(PeriodicTimer::History, [this]() { sample_history(); }, HISTORY_SAMPLE_MS);
+
+        // Status heartbeat while nothing changes
+        if (cfg_.status_interval_ms > 0) {
+            add_periodic_timer(PeriodicTimer::Heartbeat, [this]() { status_heartbeat(); }, cfg_.status_interval_ms);
+        }
+
+        // Standby idle check (not stretched: it also notices a client taking control)
+        if (cfg_.standby_idle_s > 0) {
+            int standby_timer = ipc_.add_timer([this]() { check_standby(); });
+            ipc_.arm_timer(standby_timer, STANDBY_CHECK_MS, STANDBY_CHECK_MS);
+        }
+
+        // LAN telemetry (a host runs one for all its buses)
+        if (!hosted_) telemetry_ = start_telemetry(cfg_, ring_, ipc_);
 
         // Push initial status
-        push_status();
+        push_status(true);
+
+        // Before any thread starts: their stacks are locked too
+        if (cfg_.mlockall) lock_process_memory();
+
+        if (cfg_.trace) trace_start();
+
+        // A predecessor's totals, before the motor thread integrates more
+        if (resume_) odometer_.restore({resume_->distance, resume_->vertical, resume_->belt_on_us});
 
         // Start threads
+        if (!motor_writer_.start()) {
+            std::fprintf(stderr, "[motor] failed to start writer thread\n");
+            return false;
+        }
         running_.store(true, std::memory_order_relaxed);
+        if (cfg_.reactor) {
+            if (resume_) resume_mode(*resume_);  // before the loop that drives emulate
+            if (!hosted_) {
+                ipc_thread_ = std::thread(&TreadmillController::reactor_loop, this);
+                apply_sched(ipc_thread_, cfg_.ipc_sched, "reactor");
+            }
+            return true;
+        }
         console_thread_ = std::thread(&TreadmillController::console_read_loop, this);
         motor_thread_ = std::thread(&TreadmillController::motor_read_loop, this);
-        ipc_thread_ = std::thread(&TreadmillController::ipc_loop, this);
+        apply_sched(console_thread_, cfg_.console_sched, "console");
+        apply_sched(motor_thread_, cfg_.motor_sched, "motor");
+        if (!hosted_) {
+            ipc_thread_ = std::thread(&TreadmillController::ipc_loop, this);
+            apply_sched(ipc_thread_, cfg_.ipc_sched, "ipc");
+        }
 
+        if (resume_) resume_mode(*resume_);
         return true;
     }
 
     // Signal shutdown and join all threads
     void stop() {
         running_.store(false, std::memory_order_relaxed);
-        emu_engine_.stop();
+        ipc_.wake();
+        console_reader_.interrupt();
+        motor_reader_.interrupt();
+        if (!cfg_.reactor) emu_engine_.stop();
 
         if (console_thread_.joinable()) console_thread_.join();
         if (motor_thread_.joinable()) motor_thread_.join();
         if (ipc_thread_.joinable()) ipc_thread_.join();
+        if (cfg_.reactor) emu_engine_.stop();  // once the loop driving it is gone
+        motor_writer_.stop();
 
         console_reader_.close();
         motor_reader_.close();
-        ipc_.shutdown();
+        journal_.close();
+        status_page_.close();
+        if (!hosted_) ipc_.shutdown();
+        telemetry_.reset();
     }
 
     bool is_running() const { return running_.load(std::memory_order_relaxed); }
-    void request_shutdown() { running_.store(false, std::memory_order_relaxed); }
-
-    // Expose for testing
-    ModeStateMachine& mode() { return mode_; }
-    RingBuffer<>& ring() { return ring_; }
 
-private:
-    static void sleep_ms(int ms) {
-        struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
-        nanosleep(&ts, nullptr);
+    // Reactor mode: poll both readers and send what emulate has due, from
+    // the IPC thread. Returns how long (ms) the loop may wait on the IPC
+    // fds before the next pass.
+    int reactor_pass() {
+        if (console_reader_.poll() > 0) leave_standby();
+        if (motor_reader_.poll() > 0) leave_standby();
+        int wait_ms = std::max(1, std::min(console_reader_.idle_wait_us(), motor_reader_.idle_wait_us()) / 1000);
+        int64_t due = emu_engine_.run_due();
+        if (due >= 0) {
+            int64_t ahead_ns = due - clock_.now_ns();
+            int ahead_ms = ahead_ns <= 0 ? 0 : clock_.timer_ms(static_cast<int>((ahead_ns + 999999) / 1000000));
+            wait_ms = std::min(wait_ms, ahead_ms);
+        }
+        return wait_ms;
     }
-
-    double elapsed_sec() const {
-        struct timespec now;
-        clock_gettime(CLOCK_MONOTONIC, &now);
-        return (now.tv_sec - start_ts_.tv_sec) +
-               (now.tv_nsec - start_ts_.tv_nsec) / 1e9;
+    void request_shutdown() {
+        running_.store(false, std::memory_order_relaxed);
+        ipc_.wake();
     }
 
-    void push_kv_event(std::string_view source, std::string_view key, std::string_view value) {
-        KvEvent ev{source, key, value, elapsed_sec()};
-        ring_.push(build_kv_event(ev));
-    }
+    // Expose for testing
+    ModeStateMachine& mode() { return mode_; }
+    EventRing& ring() { return ring_; }
+    int bus() const { return bus_; }
+    bool in_standby() const { return standby_.standby(); }
 
-    void push_status() {
+    // Before start(): continue a predecessor's session (handoff.h)
+    void resume_from(const HandoffBus& h) { resume_ = h; }
+
+    // This bus's part of a handoff to a successor
+    HandoffBus handoff_state() const {
         auto snap = mode_.snapshot();
-        StatusEvent ev{};
-        ev.proxy = snap.proxy_enabled;
-        ev.emulate = snap.emulate_enabled;
-        ev.emu_speed = snap.speed_tenths;
-        ev.emu_incline = snap.incline;
-        ev.bus_speed = bus_speed_tenths_.load(std::memory_order_relaxed);
-        ev.bus_incline = bus_incline_half_pct_.load(std::memory_order_relaxed);
-        ev.console_bytes = mode_.console_bytes();
-        ev.motor_bytes = mode_.motor_bytes();
-        ring_.push(build_status_event(ev));
+        auto t = odometer_.totals();
+        return {snap.proxy_enabled, snap.emulate_enabled, snap.speed_tenths, snap.incline,
+                t.distance, t.vertical, t.belt_on_us, snap.overlay_enabled};
     }
 
+    // IPC thread: one command for this bus
     void handle_command(const IpcCommand& cmd) {
         // Every command is an implicit heartbeat
-        clock_gettime(CLOCK_MONOTONIC, &last_cmd_time_);
+        last_cmd_ns_ = clock_.now_ns();
+        uint64_t arrived_us = cmd.has_seq ? mono_us() : 0;
 
         switch (cmd.type) {
             case CmdType::Proxy:
@@ -227,42 +372,826 @@ private:
                 mode_.request_emulate(cmd.bool_value);
                 push_status();
                 break;
-            case CmdType::Speed:
+            case CmdType::Overlay:
+                mode_.request_overlay(cmd.bool_value);
+                push_status();
+                break;
+            case CmdType::Speed: {
+                bool was_moving = mode_.is_controlling() && mode_.snapshot().speed_tenths > 0;
                 mode_.set_speed_mph(cmd.float_value);
+                if (was_moving && mode_.snapshot().speed_tenths == 0) send_stop();
                 push_status();
                 break;
+            }
             case CmdType::Incline:
                 mode_.set_incline(cmd.int_value);
                 push_status();
                 break;
-            case CmdType::Status:
+            case CmdType::Batch: {
+                bool was_moving = mode_.is_controlling() && mode_.snapshot().speed_tenths > 0;
+                mode_.apply(std::span<const ModeStep>(cmd.batch.data(), cmd.batch_count));
+                auto snap = mode_.snapshot();
+                bool controlling = snap.emulate_enabled || snap.overlay_enabled;
+                if (was_moving && controlling && snap.speed_tenths == 0) send_stop();
                 push_status();
                 break;
+            }
+            case CmdType::Status:
+                push_status(true);
+                push_ftms(true);
+                break;
             case CmdType::Heartbeat:
                 // Timestamp already updated above; no further action needed
                 break;
+            case CmdType::Stats:
+                push_emu_stats();
+                break;
+            case CmdType::Metrics:
+                push_metrics();
+                break;
+            case CmdType::Program:
+                handle_program(cmd.program);
+                break;
+            case CmdType::Trace:
+                handle_trace(cmd.trace);
+                break;
+            case CmdType::Hr:
+                hr_zone_.sample(cmd.int_value, clock_.now_ns());
+                break;
+            case CmdType::HrZone:
+                handle_hr_zone(cmd.hr_zone);
+                break;
             case CmdType::Quit:
                 running_.store(false, std::memory_order_relaxed);
                 break;
+            case CmdType::Subscribe:  // per-client, handled inside IpcServer
+            case CmdType::Hello:
+            case CmdType::Snapshot:
+            case CmdType::History:
+            case CmdType::Mailbox:
             case CmdType::Unknown:
                 break;
         }
+        if (cmd.has_seq) ack_command(cmd, arrived_us);
+
+        arm_watchdog(HEARTBEAT_TIMEOUT_SEC * 1000);
+    }
+
+    // IPC thread: every key's latest value and the status, for one client
+    void emit_snapshot(const IpcServer::SnapshotEmit& emit) const {
+        KvLatest::Table table;
+        latest_.copy(table);
+        SnapshotEvent ev;
+        for (size_t s = 0; s < table.size(); s++) {
+            for (size_t k = 0; k < table.at(s).size(); k++) ev.values.at(s).at(k) = table.at(s).at(k).view();
+        }
+        ev.ts = elapsed_sec();
+        ev.bus = static_cast<uint8_t>(bus_);
+        std::array<char, SNAPSHOT_EVENT_MAX> buf;
+        size_t n = format_snapshot_event(buf, ev);
+        if (n > 0) emit({ buf.data(), n });
+        n = format_status_record(buf, status_snapshot());
+        if (n > 0) emit({ buf.data(), n });
+    }
+
+    // IPC thread: the `history` reply
+    void emit_history(const IpcCommand& cmd, const IpcServer::SnapshotEmit& emit) const {
+        const auto& q = cmd.history;
+        auto to = static_cast<uint32_t>(std::min<uint64_t>(q.to, static_cast<uint64_t>(elapsed_sec()) + 1));
+        std::array<int16_t, HISTORY_MAX_POINTS> speed, incline, amps;
+        auto r = history_.query(q.from, to, q.step, speed, incline, amps);
+        HistoryEvent ev{r.from, r.step, {speed.data(), r.count}, {incline.data(), r.count},
+                        {amps.data(), r.count}, static_cast<uint8_t>(bus_)};
+        std::array<char, HISTORY_EVENT_MAX> buf;
+        size_t n = format_history_event(buf, ev);
+        if (n > 0) emit({ buf.data(), n });
+    }
+
+    // IPC thread: a new client gets every key's current value on its next frame
+    void client_connected() {
+        if (cfg_.kv_changes_only) resync_kv_filters();
+    }
+
+    // IPC thread, when clients come, go or subscribe: with "lazy_console"
+    // the console reader parses only the keys someone needs
+    void subscriptions_changed() {
+        if (lazy_console()) console_reader_.set_parse_keys(console_parse_keys());
+    }
+
+    // IPC thread: client disconnect watchdog (Layer 1), last client gone
+    void clients_gone() {
+        if (!mode_.is_controlling()) return;
+        std::fprintf(stderr, "[watchdog] all clients disconnected — exiting emulate, returning to proxy\n");
+        watchdog_reset();
+    }
+
+private:
+    TreadmillController(Port& port, const GpioConfig& cfg, EventRing* ring, IpcServer* ipc,
+                        WaveEngine* engine, int bus, Clock clock)
+        : port_(port)
+        , cfg_(cfg)
+        , clock_(std::move(clock))
+        , own_ring_(ring ? nullptr : std::make_unique<EventRing>())
+        , ring_(ring ? *ring : *own_ring_)
+        , console_reader_(port, cfg.console_read, cfg.baud, ConsoleSink{this})
+        , motor_reader_(port, cfg.motor_read, cfg.baud, MotorSink{this})
+        , motor_writer_(engine ? MotorWriter<Port>(port, cfg.motor_write, *engine, cfg.baud)
+                               : MotorWriter<Port>(port, cfg.motor_write, cfg.baud))
+        , emu_engine_(motor_writer_, mode_,
+                      EmuTiming{cfg.emu_cycle_ms, cfg.emu_burst_gap_ms, cfg.emu_rates, cfg.emu_paced,
+                                cfg.emu_min_gap_ms},
+                      clock_)
+        , own_ipc_(ipc ? nullptr : std::make_unique<IpcServer>(ring_))
+        , ipc_(ipc ? *ipc : *own_ipc_)
+        , journal_(JournalConfig{cfg.journal_dir,
+                                 static_cast<size_t>(cfg.journal_segment_kb) * 1024,
+                                 cfg.journal_segments})
+        , bus_(bus)
+        , hosted_(ipc != nullptr)
+    {
+        start_ns_ = clock_.now_ns();
+        start_wire_ns_ = wire_now_ns();
+        last_cmd_ns_ = start_ns_;
+        motor_writer_.set_sched(cfg.writer_sched);
+        emu_engine_.set_sched(cfg.emulate_sched);
+        emu_engine_.set_external(cfg.reactor);
+        // Bus 0 keeps the single-bus page name; bus N gets a ".N" suffix
+        if (bus_ == 0) std::snprintf(page_name_.data(), page_name_.size(), "%s", STATUS_PAGE_NAME);
+        else std::snprintf(page_name_.data(), page_name_.size(), "%s.%d", STATUS_PAGE_NAME, bus_);
+    }
+
+    double elapsed_sec() const {
+        return static_cast<double>(clock_.now_ns() - start_ns_) / 1e9;
+    }
+
+    // Session time of a frame stamped by a reader (KvPair::t_ns); now if unstamped
+    double arrival_sec(int64_t wire_ns) const {
+        if (wire_ns == 0) return elapsed_sec();
+        return static_cast<double>(wire_ns - start_wire_ns_) / 1e9;
+    }
+
+    static void apply_sched(std::thread& t, const ThreadSched& s, const char* name) {
+        if (s.active()) apply_thread_sched(t.native_handle(), s, name);
+    }
+
+    // JSON events name their bus on a multi-bus host (records carry it inline)
+    void commit_json(const EventRing::Reservation& slot, size_t len) {
+        ring_.commit(slot, tag_event_bus(slot.buf, len, bus_));
+    }
+
+    // Change-only mode: publish a frame only if its value changed
+    bool emit_kv(KvChangeFilter& filter, KvKey id, std::string_view value) {
+        return !cfg_.kv_changes_only || filter.should_emit(id, value);
+    }
+
+    void resync_kv_filters() {
+        console_filter_.resync();
+        motor_filter_.resync();
+        emulate_filter_.resync();
+    }
+
+    // Console reader, raw bytes: proxy or overlay forwarding
+    void console_raw(std::span<const uint8_t> data) {
+        mode_.add_console_bytes(static_cast<uint32_t>(data.size()));
+        if (mode_.is_overlay()) {
+            forward_overlay(data);
+            return;
+        }
+        bool proxy = mode_.is_proxy() && !mode_.is_emulating();
+        // Overlay just ended mid-frame: the held bytes go first, as they were
+        if (overlay_.pending() > 0) {
+            if (proxy) overlay_.flush([this](std::span<const uint8_t> b) { motor_writer_.write_bytes(b); });
+            overlay_.reset();
+        }
+        // Proxy: queue raw bytes for the motor writer thread (never blocks)
+        if (proxy) motor_writer_.write_bytes(data);
+    }
+
+    // Console reader, each frame: parse + auto-detect
+    void console_kv(const KvPair& kv) {
+        auto value = kv.value_view();
+        bool proxied = (mode_.is_proxy() && !mode_.is_emulating()) || mode_.is_overlay();
+        // Bare queries reach the motor only while proxying
+        if (value.empty() && proxied) queries_.sent(kv.id, mono_us());
+        // The console's own cycle timing, from its burst starts
+        if (proxied && cfg_.bus_stats_ms > 0 && bus_burst_started_by(kv.id) >= 0) {
+            bus_stats_.console_frame(kv.id, mono_us());
+        }
+        journal_.record_kv(JournalSource::Console, kv);
+        latest_.record(KV_SOURCE_CONSOLE, kv.id, value);
+        cycle_frame(KV_SOURCE_CONSOLE, kv.key_view(), value, kv.t_ns, bus_burst_started_by(kv.id) == 0);
+        if (emit_kv(console_filter_, kv.id, value)) {
+            push_kv_event("console", kv.key_view(), value, kv.t_ns);
+        }
+
+        // Auto-detect: console change while emulating -> switch to proxy
+        switch (kv.id) {
+            case KvKey::Hmph: auto_proxy_check(kv, last_console_hmph_); break;
+            case KvKey::Inc:  auto_proxy_check(kv, last_console_inc_);  break;
+            default: break;
+        }
+    }
+
+    // Motor reader: parse only
+    void motor_raw(std::span<const uint8_t> data) {
+        mode_.add_motor_bytes(static_cast<uint32_t>(data.size()));
+    }
+
+    void motor_kv(const KvPair& kv) {
+        emu_engine_.motor_reported(kv.id);  // first: a paced burst may be waiting on it
+        auto value = kv.value_view();
+        motor_stats_.record(kv.id, value, mono_us());  // also the history's amps
+        // Decode motor bus values; odometry integrates on every report
+        switch (kv.id) {
+            case KvKey::Hmph: {
+                int decoded = decode_speed_hex(value);
+                bool changed = decoded >= 0 &&
+                    bus_speed_tenths_.exchange(decoded, std::memory_order_relaxed) != decoded;
+                motor_status(changed, kv.t_ns);
+                motor_echo(kv.id, decoded);
+                break;
+            }
+            case KvKey::Inc: {
+                int decoded = decode_incline_hex(value);
+                bool changed = decoded >= 0 &&
+                    bus_incline_half_pct_.exchange(decoded, std::memory_order_relaxed) != decoded;
+                motor_status(changed, kv.t_ns);
+                motor_echo(kv.id, decoded);
+                break;
+            }
+            default: {
+                // Any motor frame for a query key answers it ([err] is empty when OK)
+                QueryStall recovered;
+                if (queries_.answered(kv.id, mono_us(), &recovered)) {
+                    push_query_stall(recovered);
+                }
+                break;
+            }
+        }
+        journal_.record_kv(JournalSource::Motor, kv);
+        latest_.record(KV_SOURCE_MOTOR, kv.id, value);
+        cycle_frame(KV_SOURCE_MOTOR, kv.key_view(), value, kv.t_ns, bus_burst_started_by(kv.id) == 0);
+        if (emit_kv(motor_filter_, kv.id, value)) {
+            push_kv_event("motor", kv.key_view(), value, kv.t_ns);
+        }
+    }
+
+    // The journal and UDP telemetry record every console frame: with
+    // either, parsing stays full. Event tap readers aren't seen here.
+    bool lazy_console() const {
+        return cfg_.lazy_console && cfg_.journal_dir.empty() && cfg_.telemetry_address.empty();
+    }
+
+    // Console keys some client needs: every key for console kv or cycle
+    // events, or for stall events (each bare query is timed); burst
+    // starts for bus_stats; else CONSOLE_LAZY_KEYS only
+    uint32_t console_parse_keys() const {
+        constexpr uint32_t KV = sub_type_bit("kv"), STALL = sub_type_bit("stall"),
+                           BUS_STATS = sub_type_bit("bus_stats"), CYCLE = sub_type_bit("cycle");
+        static_assert(KV != 0 && STALL != 0 && BUS_STATS != 0 && CYCLE != 0);
+        constexpr uint32_t CONSOLE = 1u << KV_SOURCE_CONSOLE;
+        auto bus = static_cast<unsigned>(bus_);
+        if (ipc_.wants(KV | (cfg_.cycle_events ? CYCLE : 0), CONSOLE, bus) || ipc_.wants(STALL, SUB_ALL, bus)) {
+            return KV_PARSE_ALL;
+        }
+        uint32_t keys = CONSOLE_LAZY_KEYS;
+        if (cfg_.bus_stats_ms > 0 && ipc_.wants(BUS_STATS, SUB_ALL, bus)) keys |= BUS_BURST_START_KEYS;
+        return keys;
+    }
+
+    // ts is the frame's arrival for reader frames (wire_ns from KvPair::t_ns)
+    void push_kv_event(std::string_view source, std::string_view key, std::string_view value,
+                       int64_t wire_ns = 0) {
+        KvEvent ev{source, key, value, arrival_sec(wire_ns), static_cast<uint8_t>(bus_)};
+        // Binary record straight into the ring slot; the IPC thread formats
+        // JSON only for clients that want it
+        auto slot = ring_.reserve();
+        ring_.commit(slot, format_kv_record(slot.buf, ev));
+    }
+
+    // "cycles" mode, on the source's thread: add a frame to its cycle. A
+    // frame starting a new cycle sends the one before it first; a cycle
+    // too long for the buffer goes out in parts.
+    void cycle_frame(size_t source, std::string_view key, std::string_view value, int64_t wire_ns,
+                     bool starts_cycle) {
+        if (!cfg_.cycle_events) return;
+        if (starts_cycle) push_cycle_event(source);
+        double ts = arrival_sec(wire_ns);
+        if (cycles_.at(source).add(key, value, ts)) return;
+        push_cycle_event(source);
+        cycles_.at(source).add(key, value, ts);
+    }
+
+    void push_cycle_event(size_t source) {
+        auto& c = cycles_.at(source);
+        if (c.empty()) return;
+        auto slot = ring_.reserve();
+        commit_json(slot, format_cycle_event(slot.buf, c.event(SUB_SOURCE_NAMES.at(source))));
+        c.clear();
+    }
+
+    // Console hmph/inc changed while emulating or overlaying -> hand back to the console
+    void auto_proxy_check(const KvPair& kv, std::string& last) {
+        auto key = kv.key_view();
+        auto value = kv.value_view();
+        auto result = mode_.auto_proxy_on_console_change(key, last, value);
+        if (result.changed) {
+            std::fprintf(stderr, "[auto] console %.*s changed %s -> %.*s, switching to proxy\n",
+                         static_cast<int>(key.size()), key.data(), last.c_str(),
+                         static_cast<int>(value.size()), value.data());
+            push_status();
+        }
+        last = value;
+    }
+
+    StatusEvent status_snapshot() const {
+        auto snap = mode_.snapshot();
+        StatusEvent ev{};
+        ev.proxy = snap.proxy_enabled;
+        ev.emulate = snap.emulate_enabled;
+        ev.overlay = snap.overlay_enabled;
+        ev.generation = snap.generation;
+        ev.emu_speed = snap.speed_tenths;
+        ev.emu_incline = snap.incline;
+        ev.bus_speed = bus_speed_tenths_.load(std::memory_order_relaxed);
+        ev.bus_incline = bus_incline_half_pct_.load(std::memory_order_relaxed);
+        ev.console_bytes = mode_.console_bytes();
+        ev.motor_bytes = mode_.motor_bytes();
+        ev.console_dropped = console_reader_.dropped_bytes();
+        ev.motor_dropped = motor_reader_.dropped_bytes();
+        ev.distance_mi = odometer_.distance_mi();
+        ev.vert_ft = odometer_.vert_ft();
+        ev.belt_on_ms = odometer_.belt_on_ms();
+        ev.bus = static_cast<uint8_t>(bus_);
+        return ev;
+    }
+
+    // Motor thread: integrate the bus speed/incline up to now
+    bool sample_odometer() {
+        return odometer_.sample(mono_us(), bus_speed_tenths_.load(std::memory_order_relaxed),
+                                bus_incline_half_pct_.load(std::memory_order_relaxed));
+    }
+
+    // Status event fields whose change triggers an event; the counters
+    // and odometer ride along
+    struct StatusKey {
+        bool proxy, emulate, overlay;
+        int emu_speed, emu_incline, bus_speed, bus_incline;
+        bool operator==(const StatusKey&) const = default;
+    };
+
+    // A status event if a StatusKey field changed since the last one, or
+    // unconditionally with `force` (the status command, heartbeat). The
+    // status page is refreshed either way.
+    void push_status(bool force = false) {
+        auto ev = status_snapshot();
+        status_page_.publish(ev);
+        StatusKey key{ev.proxy, ev.emulate, ev.overlay, ev.emu_speed, ev.emu_incline, ev.bus_speed, ev.bus_incline};
+        std::lock_guard<std::mutex> lk(status_mu_);  // pushes from several threads stay in order
+        if (!force && last_status_ && *last_status_ == key) return;
+        last_status_ = key;
+        status_sent_.store(true, std::memory_order_relaxed);
+        auto slot = ring_.reserve();
+        ring_.commit(slot, format_status_record(slot.buf, ev));
+    }
+
+    // Motor thread, after a speed/incline report: odometry integrates on
+    // every one; a decoded change is a status change
+    void motor_status(bool changed, int64_t wire_ns) {
+        bool moved = sample_odometer();
+        if (changed) push_status();
+        else if (moved) status_page_.publish(status_snapshot());
+        push_ftms(false, wire_ns);
+    }
+
+    // An ftms record if a field of the FTMS notification changed since the
+    // last one (metres, whole seconds, speed, incline), or unconditionally
+    // with `force` (the status command). Motor values in every mode: the
+    // belt is what the rider is on.
+    void push_ftms(bool force = false, int64_t wire_ns = 0) {
+        auto ev = make_ftms_event(bus_speed_tenths_.load(std::memory_order_relaxed),
+                                  bus_incline_half_pct_.load(std::memory_order_relaxed),
+                                  odometer_.distance_mi(), odometer_.belt_on_ms());
+        ev.bus = static_cast<uint8_t>(bus_);
+        ev.ts = arrival_sec(wire_ns);
+        std::lock_guard<std::mutex> lk(ftms_mu_);
+        if (!force && last_ftms_ && last_ftms_->same_data(ev)) return;
+        last_ftms_ = ev;
+        auto slot = ring_.reserve();
+        ring_.commit(slot, format_ftms_record(slot.buf, ev));
+    }
+
+    // IPC timer, every status_interval_ms: a status event if none went out
+    // during the interval, else one if something changed unannounced
+    // (the emulate thread's safety timeout)
+    void status_heartbeat() {
+        bool sent = status_sent_.exchange(false, std::memory_order_relaxed);
+        push_status(!sent);
+        if (!sent) status_sent_.store(false, std::memory_order_relaxed);
+    }
+
+    void push_emu_stats() {
+        auto st = emu_engine_.stats();
+        EmuStatsEvent ev{st.cycles, st.overruns, st.target_us, st.mean_us, st.p99_us, st.max_us,
+                         st.injected, st.timeouts};
+        auto slot = ring_.reserve();
+        commit_json(slot, format_emu_stats_event(slot.buf, ev));
+    }
+
+    void push_histogram(std::string_view name, const LatencyHistogram& hist) {
+        auto h = hist.summary();
+        HistogramEvent ev{name, h.count, h.mean_us, h.p50_us, h.p99_us, h.max_us};
+        auto slot = ring_.reserve();
+        commit_json(slot, format_histogram_event(slot.buf, ev));
+    }
+
+    // IPC timer: line use and console cycle timing since the last one
+    void push_bus_stats() {
+        auto u = bus_stats_.take(mono_us(), mode_.console_bytes(), mode_.motor_bytes());
+        std::array<uint64_t, EMU_BURSTS> gap_us{};
+        std::array<uint64_t, EMU_BURSTS> gap_max_us{};
+        for (size_t b = 0; b < gap_us.size(); b++) {
+            gap_us.at(b) = u.gaps.at(b).mean_us;
+            gap_max_us.at(b) = u.gaps.at(b).max_us;
+        }
+        BusStatsEvent ev{u.window_ms, u.console.bytes_per_sec, u.console.idle_pct, u.motor.bytes_per_sec,
+                         u.motor.idle_pct, u.cycle.count, u.cycle.mean_us, u.cycle.min_us, u.cycle.max_us,
+                         gap_us, gap_max_us};
+        auto slot = ring_.reserve();
+        commit_json(slot, format_bus_stats_event(slot.buf, ev));
+    }
+
+    // IPC timer: the bus values a chart draws, into the history
+    void sample_history() {
+        auto clamp16 = [](int64_t v) { return static_cast<int16_t>(std::clamp<int64_t>(v, -1, INT16_MAX)); };
+        MotorStatWindows amps;
+        motor_stats_.summary(static_cast<size_t>(motor_stats_index(KvKey::Amps)), mono_us(), amps);
+        HistorySample s{clamp16(bus_speed_tenths_.load(std::memory_order_relaxed)),
+                        clamp16(bus_incline_half_pct_.load(std::memory_order_relaxed)),
+                        amps.at(0).count ? clamp16(std::lround(amps.at(0).mean)) : int16_t{-1}};
+        history_.sample(static_cast<uint32_t>(elapsed_sec()), s);
+    }
+
+    // IPC timer: one stats event per key reported in the last minute
+    void push_motor_stats() {
+        uint64_t now = mono_us();
+        for (size_t k = 0; k < MOTOR_STATS_KEYS.size(); k++) {
+            MotorStatWindows w;
+            if (!motor_stats_.summary(k, now, w)) continue;
+            std::array<StatsWindowEvent, MOTOR_STATS_WINDOWS_S.size()> windows;
+            for (size_t i = 0; i < windows.size(); i++) {
+                const auto& s = w.at(i);
+                windows.at(i) = { MOTOR_STATS_WINDOWS_S.at(i), s.count, s.min, s.max, s.mean };
+            }
+            StatsEvent ev{kv_key_name(MOTOR_STATS_KEYS.at(k)), windows};
+            auto slot = ring_.reserve();
+            commit_json(slot, format_stats_event(slot.buf, ev));
+        }
+    }
+
+    void push_bus_metrics(std::string_view source, const KvParseStats& s) {
+        BusMetricsEvent ev{source, s.bytes, s.frames, s.nonprintable, s.bad_length, s.stray_bytes,
+                           s.overflow_bytes, s.skipped};
+        auto slot = ring_.reserve();
+        commit_json(slot, format_bus_metrics_event(slot.buf, ev));
+    }
+
+    // One event per histogram and per client: a combined report would
+    // not fit a ring slot
+    void push_metrics() {
+        push_histogram("proxy_us", motor_writer_.raw_latency());
+        push_histogram("motor_tx_wait_us", motor_writer_.tx_wait());
+        push_histogram("motor_stop_us", motor_writer_.priority_latency());
+        push_bus_metrics("console", console_reader_.line_stats());
+        push_bus_metrics("motor", motor_reader_.line_stats());
+
+        for (size_t i = 0; i < KV_KEY_NAMES.size(); i++) {
+            auto id = static_cast<KvKey>(i);
+            if (!is_query_key(id)) continue;
+            auto c = queries_.counters(id);
+            if (c.sent == 0) continue;
+            auto h = queries_.round_trip(id).summary();
+            QueryMetricsEvent ev{kv_key_name(id), h.count, h.mean_us, h.p50_us, h.p99_us, h.max_us,
+                                 c.sent, c.missing, c.stalls};
+            auto slot = ring_.reserve();
+            commit_json(slot, format_query_metrics_event(slot.buf, ev));
+        }
+
+        std::array<IpcServer::ClientMetrics, MAX_CLIENTS> clients;
+        int n = ipc_.client_metrics(clients);
+        for (int i = 0; i < n; i++) {
+            const auto& c = clients.at(static_cast<size_t>(i));
+            ClientLagEvent ev{c.fd, c.lag_msgs, c.max_lag_msgs, c.queued_bytes, c.lost_msgs, c.gaps,
+                              c.sent_bytes};
+            auto slot = ring_.reserve();
+            commit_json(slot, format_client_lag_event(slot.buf, ev));
+        }
+    }
+
+    // Mode, speed and incline as the predecessor left them. The heartbeat
+    // watchdog starts over, as if the last command had just arrived.
+    void resume_mode(const HandoffBus& h) {
+        if (h.emulate || h.overlay) {
+            if (h.overlay) mode_.request_overlay(true);
+            else mode_.request_emulate(true);
+            mode_.set_speed(h.speed_tenths);
+            mode_.set_incline(h.incline);
+        } else {
+            mode_.request_proxy(h.proxy);
+        }
+        last_cmd_ns_ = clock_.now_ns();
+        arm_watchdog(HEARTBEAT_TIMEOUT_SEC * 1000);
+        std::fprintf(stderr, "[bus %d] resumed: %s, speed %d, incline %d\n", bus_,
+                     h.emulate ? "emulate" : h.overlay ? "overlay" : h.proxy ? "proxy" : "idle",
+                     h.speed_tenths, h.incline);
+        push_status(true);  // carries the restored odometer
+    }
+
+    // (Re)arm the heartbeat timer while emulating or overlaying; disarm otherwise
+    void arm_watchdog(int delay_ms) {
+        ipc_.arm_timer(watchdog_timer_, mode_.is_controlling() ? clock_.timer_ms(delay_ms) : 0);
     }
 
     void console_read_loop() {
+        trace_thread("console");
         while (running_.load(std::memory_order_relaxed)) {
             if (console_reader_.poll() == 0) {
-                sleep_ms(5);
+                console_reader_.wait_for_data();
+            } else {
+                leave_standby();
             }
         }
     }
 
     void motor_read_loop() {
+        trace_thread("motor");
         while (running_.load(std::memory_order_relaxed)) {
             if (motor_reader_.poll() == 0) {
-                sleep_ms(5);
+                motor_reader_.wait_for_data();
+            } else {
+                leave_standby();
+            }
+        }
+    }
+
+    // The timers standby slows down (see standby.h) that start() may
+    // register, one slot each: a new one needs an entry here, so
+    // periodic_timers_ always has room for it
+    enum class PeriodicTimer : uint8_t { KvKeyframe, StallScan, BusStats, MotorStats, History, Heartbeat, Count };
+    static constexpr size_t PERIODIC_TIMERS = static_cast<size_t>(PeriodicTimer::Count);
+
+    template <typename Callback>
+    void add_periodic_timer(PeriodicTimer which, Callback cb, int interval_ms) {
+        int id = ipc_.add_timer(std::move(cb));
+        ipc_.arm_timer(id, interval_ms, interval_ms);
+        periodic_timers_.at(static_cast<size_t>(which)) = { id, interval_ms };
+    }
+
+    void stretch_timers(int factor) {
+        for (const auto& t : periodic_timers_) {
+            if (t.id >= 0) ipc_.arm_timer(t.id, t.interval_ms * factor, t.interval_ms * factor);
+        }
+    }
+
+    // IPC timer: standby after idle_s without a bus byte
+    void check_standby() {
+        uint64_t bytes = uint64_t{mode_.console_bytes()} + mode_.motor_bytes();
+        bool active = mode_.is_controlling();
+        if (active) {
+            leave_standby();  // a client took control; the motor is about to be written
+        }
+        std::lock_guard<std::mutex> lk(standby_mu_);
+        if (!standby_.check(bytes, active, mono_us())) return;
+        console_reader_.set_standby(true);
+        motor_reader_.set_standby(true);
+        stretch_timers(STANDBY_TIMER_STRETCH);
+        std::fprintf(stderr, "[bus %d] standby: no bus bytes for %d s\n", bus_, cfg_.standby_idle_s);
+    }
+
+    // Reader threads, after each read batch (one relaxed load when awake)
+    void leave_standby() {
+        if (!standby_.standby()) return;
+        std::lock_guard<std::mutex> lk(standby_mu_);
+        if (!standby_.wake()) return;
+        console_reader_.set_standby(false);
+        motor_reader_.set_standby(false);
+        stretch_timers(1);
+        std::fprintf(stderr, "[bus %d] standby: bus active, full rate\n", bus_);
+    }
+
+    // The recorder is process-wide: any bus's `trace` drives it. Dumps go
+    // to the configured path only; a client can't name a file.
+    void handle_trace(TraceAction action) {
+        TraceEvent ev{};
+        switch (action) {
+            case TraceAction::Start: trace_start(); break;
+            case TraceAction::Stop:  trace_stop();  break;
+            case TraceAction::Dump: {
+                auto spans = trace_dump(cfg_.trace_path.c_str());
+                if (!spans) {
+                    ring_.push(build_error_event("trace dump failed: " + cfg_.trace_path));
+                    return;
+                }
+                ev.dumped = true;
+                ev.spans = *spans;
+                ev.path = cfg_.trace_path;
+                break;
             }
         }
+        ev.recording = trace_recording();
+        auto slot = ring_.reserve();
+        commit_json(slot, format_trace_event(slot.buf, ev));
+    }
+
+    // IPC thread: upload/start, stop, pause or resume a program
+    void handle_program(const ProgramSpec& spec) {
+        int64_t now = clock_.now_ns();
+        bool changed = false;
+        switch (spec.action) {
+            case ProgramAction::Start: {
+                auto snap = mode_.snapshot();
+                bool emulating = snap.emulate_enabled;
+                program_.load(spec, now, emulating ? snap.speed_tenths : 0,
+                              emulating ? snap.incline : 0);
+                end_hr_zone();  // one thing drives the targets
+                // The first burst of a fresh emulate session applies segment 0
+                if (!emulating) mode_.request_emulate(true);
+                changed = true;
+                break;
+            }
+            case ProgramAction::Stop:
+                changed = program_.stop();
+                if (changed && mode_.is_emulating()) {
+                    mode_.set_speed(0);
+                    mode_.set_incline(0);
+                    send_stop();
+                }
+                break;
+            case ProgramAction::Pause:
+                changed = program_.pause(now);
+                break;
+            case ProgramAction::Resume:
+                changed = program_.resume(now);
+                break;
+        }
+        if (changed) push_program_event();
+    }
+
+    // Emulate thread, before each burst
+    void program_tick(int64_t now_ns) {
+        ProgramTick t = program_.tick(now_ns);
+        if (t.apply && mode_.try_set_targets(t.speed_tenths, t.incline)) {
+            program_.applied(t);
+            push_status();
+        }
+        if (t.report) push_program_event();
+    }
+
+    // Emulate ended under a running program (proxy, watchdog, auto-detect)
+    void end_program() {
+        if (program_.stop()) push_program_event();
+    }
+
+    void push_program_event() {
+        auto slot = ring_.reserve();
+        commit_json(slot, format_program_event(slot.buf, program_.progress()));
+    }
+
+    void handle_hr_zone(const HrZoneSpec& spec) {
+        if (spec.stop) {
+            end_hr_zone();  // the belt keeps the target in force
+            return;
+        }
+        end_program();
+        hr_zone_.load(spec, clock_.now_ns());
+        // The first burst moves the target inside the bounds
+        if (!mode_.is_emulating()) mode_.request_emulate(true);
+        push_hr_zone_event();
+    }
+
+    // Emulate thread, before each burst
+    void hr_zone_tick(int64_t now_ns) {
+        auto snap = mode_.snapshot();
+        bool speed = hr_zone_.control() == HrControl::Speed;
+        HrZoneTick t = hr_zone_.tick(now_ns, speed ? snap.speed_tenths : snap.incline);
+        if (t.apply && mode_.try_set_targets(speed ? t.target : snap.speed_tenths,
+                                             speed ? snap.incline : t.target)) {
+            hr_zone_.applied(t, now_ns);
+            push_status();
+        }
+        if (t.report) push_hr_zone_event();
+    }
+
+    void end_hr_zone() {
+        if (hr_zone_.stop()) push_hr_zone_event();
+    }
+
+    void push_hr_zone_event() {
+        auto slot = ring_.reserve();
+        commit_json(slot, format_hr_zone_event(slot.buf, hr_zone_.progress()));
+    }
+
+    // IPC timer: report motor query keys that stopped getting answers
+    void check_queries() {
+        std::array<QueryStall, KV_KEY_NAMES.size()> stalls;
+        size_t n = queries_.check(mono_us(), stalls);
+        for (size_t i = 0; i < n; i++) {
+            const auto& st = stalls.at(i);
+            auto key = kv_key_name(st.key);
+            std::fprintf(stderr, "[motor] no %.*s response for %llu ms\n",
+                         static_cast<int>(key.size()), key.data(),
+                         static_cast<unsigned long long>(st.waited_ms));
+            push_query_stall(st);
+        }
+    }
+
+    // A command with a "seq" is applied: ack that, and while emulating or
+    // overlaying follow the speed/incline targets it set out to the motor
+    void ack_command(const IpcCommand& cmd, uint64_t arrived_us) {
+        push_ack({cmd.seq, "applied", {}});
+        if (!mode_.is_controlling()) return;
+        bool speed = cmd.type == CmdType::Speed;
+        bool incline = cmd.type == CmdType::Incline;
+        if (cmd.type == CmdType::Batch) {
+            for (const auto& step : std::span<const ModeStep>(cmd.batch.data(), cmd.batch_count)) {
+                speed |= step.kind == ModeStep::Kind::Speed;
+                incline |= step.kind == ModeStep::Kind::Incline;
+            }
+        }
+        auto snap = mode_.snapshot();
+        AckReport superseded;
+        if (speed && acks_.expect(KvKey::Hmph, cmd.seq, snap.speed_tenths, arrived_us, &superseded)) {
+            push_ack(superseded);
+        }
+        if (incline && acks_.expect(KvKey::Inc, cmd.seq, snap.incline, arrived_us, &superseded)) {
+            push_ack(superseded);
+        }
+    }
+
+    // Motor thread: a decoded hmph/inc report may complete a command's ack
+    void motor_echo(KvKey id, int decoded) {
+        AckReport ack;
+        if (acks_.outstanding(id) && acks_.echoed(id, decoded, mono_us(), &ack)) push_ack(ack);
+    }
+
+    // IPC timer: acks the motor never gave
+    void check_acks() {
+        std::array<AckReport, 2> expired;
+        size_t n = acks_.check(mono_us(), expired);
+        for (size_t i = 0; i < n; i++) push_ack(expired.at(i));
+    }
+
+    void push_ack(const AckReport& r) {
+        static constexpr std::array<std::string_view, 3> stages = {"motor", "superseded", "timeout"};
+        push_ack({r.seq, stages.at(static_cast<size_t>(r.stage)), kv_key_name(r.key), r.value, r.sent_us,
+                  r.echo_us});
+    }
+
+    void push_ack(const AckEvent& ev) {
+        auto slot = ring_.reserve();
+        commit_json(slot, format_ack_event(slot.buf, ev));
+    }
+
+    void push_query_stall(const QueryStall& st) {
+        QueryStallEvent ev{kv_key_name(st.key), st.stalled, st.waited_ms, st.missing};
+        auto slot = ring_.reserve();
+        commit_json(slot, format_query_stall_event(slot.buf, ev));
+    }
+
+    // Console thread, overlay: the console's chunk with the inc/hmph values
+    // replaced, coalesced into as few motor writer messages as fit
+    void forward_overlay(std::span<const uint8_t> data) {
+        std::array<uint8_t, 256> out;
+        size_t n = 0;
+        auto snap = mode_.snapshot();
+        uint64_t inc = overlay_.rewritten(KvKey::Inc), hmph = overlay_.rewritten(KvKey::Hmph);
+        overlay_.feed(data, snap.speed_tenths, snap.incline, [&](std::span<const uint8_t> b) {
+            if (n + b.size() > out.size()) {
+                motor_writer_.write_bytes(std::span<const uint8_t>(out.data(), n));
+                n = 0;
+            }
+            if (b.size() > out.size()) {
+                motor_writer_.write_bytes(b);
+                return;
+            }
+            std::copy(b.begin(), b.end(), out.begin() + static_cast<std::ptrdiff_t>(n));
+            n += b.size();
+        });
+        if (n > 0) motor_writer_.write_bytes(std::span<const uint8_t>(out.data(), n));
+
+        // The targets went out: acks waiting on a frame move on to the echo
+        std::array<char, 8> hex;
+        if (overlay_.rewritten(KvKey::Hmph) != hmph && acks_.outstanding(KvKey::Hmph)) {
+            acks_.sent(KvKey::Hmph, {hex.data(), encode_speed_hex(hex, snap.speed_tenths)}, mono_us());
+        }
+        if (overlay_.rewritten(KvKey::Inc) != inc && acks_.outstanding(KvKey::Inc)) {
+            acks_.sent(KvKey::Inc, {hex.data(), encode_incline_hex(hex, snap.incline)}, mono_us());
+        }
+    }
+
+    // Zero the belt ahead of anything still queued for the motor
+    void send_stop() {
+        motor_writer_.write_priority(HMPH_FRAMES.at(0).wire());
     }
 
     void watchdog_reset() {
@@ -271,41 +1200,104 @@ private:
         // thread from the IPC thread — racing with the main thread's stop()).
         // The emulate thread will exit naturally when it sees is_emulating()==false.
         mode_.watchdog_reset_to_proxy();
+        send_stop();
+        end_program();
+        end_hr_zone();
         push_status();
     }
 
+    // Layer 2: heartbeat timeout watchdog (timerfd callback, IPC thread)
+    void check_heartbeat() {
+        if (!mode_.is_controlling()) return;
+
+        double since_cmd = static_cast<double>(clock_.now_ns() - last_cmd_ns_) / 1e9;
+        if (since_cmd > HEARTBEAT_TIMEOUT_SEC) {
+            std::fprintf(stderr, "[watchdog] heartbeat timeout (%.1fs) — exiting emulate, returning to proxy\n", since_cmd);
+            watchdog_reset();
+        } else {
+            // Not expired yet: re-check when the deadline passes
+            int remaining_ms = static_cast<int>((HEARTBEAT_TIMEOUT_SEC - since_cmd) * 1000) + 1;
+            arm_watchdog(remaining_ms);
+        }
+    }
+
+    void reactor_loop() {
+        trace_thread("reactor");
+        while (running_.load(std::memory_order_relaxed)) {
+            ipc_.poll(reactor_pass());
+        }
+    }
+
     void ipc_loop() {
+        trace_thread("ipc");
         while (running_.load(std::memory_order_relaxed)) {
-            ipc_.poll();
-
-            // Layer 2: heartbeat timeout watchdog
-            if (mode_.is_emulating()) {
-                struct timespec now;
-                clock_gettime(CLOCK_MONOTONIC, &now);
-                double since_cmd = (now.tv_sec - last_cmd_time_.tv_sec) +
-                                   (now.tv_nsec - last_cmd_time_.tv_nsec) / 1e9;
-                if (since_cmd > HEARTBEAT_TIMEOUT_SEC) {
-                    std::fprintf(stderr, "[watchdog] heartbeat timeout (%.1fs) — exiting emulate, returning to proxy\n", since_cmd);
-                    watchdog_reset();
-                }
-            }
+            ipc_.poll(-1);  // sleeps until a client, ring push, timer or stop()
         }
     }
 
     Port& port_;
     GpioConfig cfg_;
-    struct timespec start_ts_{};
-    struct timespec last_cmd_time_{};
+    Clock clock_;
+    int64_t start_ns_ = 0;
+    int64_t start_wire_ns_ = 0;  // wire_now_ns() at start_ns_
+    int64_t last_cmd_ns_ = 0;
 
-    RingBuffer<> ring_;
+    std::unique_ptr<EventRing> own_ring_;  // standalone only
+    EventRing& ring_;
     ModeStateMachine mode_;
-    SerialReader<Port> console_reader_;
-    SerialReader<Port> motor_reader_;
-    SerialWriter<Port> motor_writer_;
-    EmulationEngine<Port> emu_engine_;
-    IpcServer ipc_;
+    // Reader sinks (serial_io.h): the handlers above, called directly
+    struct ConsoleSink {
+        TreadmillController* self;
+        void kv(const KvPair& kv) { self->console_kv(kv); }
+        void raw(std::span<const uint8_t> data) { self->console_raw(data); }
+    };
+    struct MotorSink {
+        TreadmillController* self;
+        void kv(const KvPair& kv) { self->motor_kv(kv); }
+        void raw(std::span<const uint8_t> data) { self->motor_raw(data); }
+    };
+    SerialReader<Port, ConsoleSink> console_reader_;
+    SerialReader<Port, MotorSink> motor_reader_;
+    MotorWriter<Port> motor_writer_;
+    EmulationEngine<Port, MotorWriter<Port>, Clock> emu_engine_;
+    std::unique_ptr<IpcServer> own_ipc_;      // standalone only
+    IpcServer& ipc_;
+    BusJournal journal_;
+    StatusPage status_page_;
+    std::array<char, 48> page_name_{};
+    std::optional<HandoffBus> resume_;
+    std::unique_ptr<TelemetryPublisher> telemetry_;  // standalone only
+    KvChangeFilter console_filter_;
+    KvChangeFilter motor_filter_;
+    KvChangeFilter emulate_filter_;
+    KvLatest latest_;  // every key's last value per source, for snapshots
+    std::array<KvCycleBuffer, SUB_SOURCE_NAMES.size()> cycles_;  // "cycles" mode, one per source thread
+    ProgramRunner program_;
+    HrZoneController hr_zone_;
+    QueryTracker queries_;
+    AckTracker acks_;
+    OverlayRewriter overlay_;  // console thread
+    BusAnalyzer bus_stats_{cfg_.baud};
+    MotorStats motor_stats_;
+    BusHistory history_;  // IPC thread
+    Odometer odometer_;
 
+    int bus_;
+    bool hosted_;
     std::atomic<bool> running_{false};
+    int watchdog_timer_ = -1;
+    struct PeriodicSlot {
+        int id = -1;  // IPC timer, -1 while not registered
+        int interval_ms = 0;
+    };
+    std::array<PeriodicSlot, PERIODIC_TIMERS> periodic_timers_{};  // set up in start(), then read-only
+    StandbyMonitor standby_{cfg_.standby_idle_s};
+    std::mutex standby_mu_;                           // standby transitions
+    std::mutex status_mu_;
+    std::optional<StatusKey> last_status_;     // guarded by status_mu_
+    std::mutex ftms_mu_;
+    std::optional<FtmsEvent> last_ftms_;       // guarded by ftms_mu_
+    std::atomic<bool> status_sent_{false};     // since the last heartbeat tick
     std::atomic<int> bus_speed_tenths_{-1};   // -1 = not yet received
     std::atomic<int> bus_incline_half_pct_{-1};  // half-pct units, -1 = not yet received
     std::thread console_thread_;
@@ -0,0 +1,582 @@
+/*
+ * treadmill_ipc.cpp — libtreadmill_ipc (see treadmill_ipc.h)
+ *
+ * A thin layer over ipc_protocol: records are decoded with the same
+ * parse_*_record() the server's JSON formatting uses, and JSON lines
+ * for the same three events are read back into the same structs, so a
+ * caller sees one event shape whichever framing the connection uses.
+ * After connect the client reads JSON lines until the server's hello
+ * reply switches it to [u16 length][record] frames, as
+ * treadmill_client.py does.
+ */
+
+#include "treadmill_ipc.h"
+#include "ipc_protocol.h"
+#include "kv_protocol.h"
+#include "status_page.h"
+
+#include <rapidjson/document.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static_assert(TM_TYPE_KV == sub_type_bit("kv") && TM_TYPE_STATUS == sub_type_bit("status") &&
+              TM_TYPE_EMU_STATS == sub_type_bit("emu_stats") && TM_TYPE_METRICS == sub_type_bit("metrics") &&
+              TM_TYPE_PROGRAM == sub_type_bit("program") && TM_TYPE_STALL == sub_type_bit("stall") &&
+              TM_TYPE_BUS_STATS == sub_type_bit("bus_stats") && TM_TYPE_FTMS == sub_type_bit("ftms") &&
+              TM_TYPE_HR_ZONE == sub_type_bit("hr_zone") && TM_TYPE_STATS == sub_type_bit("stats") &&
+              TM_TYPE_CYCLE == sub_type_bit("cycle"),
+              "TM_TYPE_* bits follow SUB_TYPE_NAMES");
+static_assert(SUB_TYPE_NAMES.size() == 11, "a new subscription type needs its TM_TYPE_* bit");
+static_assert(SUB_SOURCE_NAMES.at(2) == "emulate", "TM_SOURCE_* bits follow SUB_SOURCE_NAMES");
+static_assert(TM_EVENT_KV == static_cast<int>(EventRecord::Kv) &&
+              TM_EVENT_STATUS == static_cast<int>(EventRecord::Status) &&
+              TM_EVENT_JSON == static_cast<int>(EventRecord::Json) &&
+              TM_EVENT_FTMS == static_cast<int>(EventRecord::Ftms));
+static_assert(sizeof(tm_status) == 72 && sizeof(tm_ftms) == 24, "ABI: struct sizes are fixed");
+
+namespace {
+
+// A u16-framed record or a JSON line always fits: records are at most
+// 65535 bytes, and the server never queues more than CLIENT_OUT_BUF_SIZE
+constexpr size_t RX_BUF_SIZE = 1 << 17;
+constexpr size_t SUB_CMD_MAX = 512;
+constexpr size_t CMD_MAX = 160;
+constexpr size_t JSON_POOL_BYTES = 16384;
+constexpr size_t JSON_STACK_BYTES = 4096;
+
+using PoolAllocator = rapidjson::MemoryPoolAllocator<>;
+using PoolDocument = rapidjson::GenericDocument<rapidjson::UTF8<>, PoolAllocator, PoolAllocator>;
+
+void copy_text(std::span<char> dst, std::string_view s) {
+    size_t n = std::min(s.size(), dst.size() - 1);
+    std::copy_n(s.data(), n, dst.data());
+    dst[n] = '\0';
+}
+
+void clear_event(tm_event* ev) {
+    std::memset(ev, 0, sizeof(*ev));
+}
+
+void fill_status(tm_status& out, const StatusEvent& s) {
+    out.proxy = s.proxy;
+    out.emulate = s.emulate;
+    out.overlay = s.overlay;
+    out.emu_speed = s.emu_speed;
+    out.emu_incline = s.emu_incline;
+    out.bus_speed = s.bus_speed;
+    out.bus_incline = s.bus_incline;
+    out.console_bytes = s.console_bytes;
+    out.motor_bytes = s.motor_bytes;
+    out.generation = s.generation;
+    out.console_dropped = s.console_dropped;
+    out.motor_dropped = s.motor_dropped;
+    out.distance_mi = s.distance_mi;
+    out.vert_ft = s.vert_ft;
+    out.belt_on_ms = s.belt_on_ms;
+}
+
+// A bare record into *ev (json left for the caller). False if invalid.
+bool decode_record(std::string_view rec, tm_event* ev) {
+    clear_event(ev);
+    if (rec.empty()) return false;
+    switch (static_cast<EventRecord>(rec[0])) {
+        case EventRecord::Kv: {
+            auto kv = parse_kv_record(rec);
+            if (!kv) return false;
+            ev->type = TM_EVENT_KV;
+            ev->bus = kv->bus;
+            ev->kv.ts = kv->ts;
+            copy_text(ev->kv.source, kv->source);
+            copy_text(ev->kv.key, kv->key);
+            copy_text(ev->kv.value, kv->value);
+            copy_text(ev->json_type, "kv");
+            return true;
+        }
+        case EventRecord::Status: {
+            auto st = parse_status_record(rec);
+            if (!st) return false;
+            ev->type = TM_EVENT_STATUS;
+            ev->bus = st->bus;
+            fill_status(ev->status, *st);
+            copy_text(ev->json_type, "status");
+            return true;
+        }
+        case EventRecord::Ftms: {
+            auto f = parse_ftms_record(rec);
+            if (!f) return false;
+            ev->type = TM_EVENT_FTMS;
+            ev->bus = f->bus;
+            ev->ftms = { f->ts, f->distance_m, f->speed, f->incline, f->elapsed_s, 0 };
+            copy_text(ev->json_type, "ftms");
+            return true;
+        }
+        case EventRecord::Json:
+            ev->type = TM_EVENT_JSON;
+            return true;
+    }
+    return false;
+}
+
+template <typename T>
+T get_number(const rapidjson::Value& doc, const char* name) {
+    auto it = doc.FindMember(name);
+    if (it == doc.MemberEnd() || !it->value.IsNumber()) return T{};
+    if constexpr (!std::is_floating_point_v<T>) {
+        if (it->value.IsInt64()) return static_cast<T>(it->value.GetInt64());
+        if (it->value.IsUint64()) return static_cast<T>(it->value.GetUint64());
+    }
+    return static_cast<T>(it->value.GetDouble());
+}
+
+bool get_bool(const rapidjson::Value& doc, const char* name) {
+    auto it = doc.FindMember(name);
+    return it != doc.MemberEnd() && it->value.IsBool() && it->value.GetBool();
+}
+
+std::string_view get_string(const rapidjson::Value& doc, const char* name) {
+    auto it = doc.FindMember(name);
+    if (it == doc.MemberEnd() || !it->value.IsString()) return {};
+    return { it->value.GetString(), it->value.GetStringLength() };
+}
+
+// A JSON event line into *ev: kv, status and ftms as their structs,
+// anything else as TM_EVENT_JSON with its type. False if not an object.
+bool decode_json_line(std::string_view line, tm_event* ev) {
+    clear_event(ev);
+    // Nodes and parse stack in fixed buffers, as parse_command() does
+    alignas(8) static thread_local std::array<char, JSON_POOL_BYTES> pool;
+    alignas(8) static thread_local std::array<char, JSON_STACK_BYTES> stack;
+    PoolAllocator pool_alloc(pool.data(), pool.size());
+    PoolAllocator stack_alloc(stack.data(), stack.size());
+    PoolDocument doc(&pool_alloc, stack.size() / 2, &stack_alloc);
+    doc.Parse(line.data(), line.size());
+    if (doc.HasParseError() || !doc.IsObject()) return false;
+
+    std::string_view type = get_string(doc, "type");
+    copy_text(ev->json_type, type);
+    ev->bus = get_number<int32_t>(doc, "bus");
+    if (type == "kv") {
+        ev->type = TM_EVENT_KV;
+        ev->kv.ts = get_number<double>(doc, "ts");
+        copy_text(ev->kv.source, get_string(doc, "source"));
+        copy_text(ev->kv.key, get_string(doc, "key"));
+        copy_text(ev->kv.value, get_string(doc, "value"));
+    } else if (type == "status") {
+        ev->type = TM_EVENT_STATUS;
+        tm_status& s = ev->status;
+        s.proxy = get_bool(doc, "proxy");
+        s.emulate = get_bool(doc, "emulate");
+        s.overlay = get_bool(doc, "overlay");
+        s.emu_speed = get_number<int32_t>(doc, "emu_speed");
+        s.emu_incline = get_number<int32_t>(doc, "emu_incline");
+        s.bus_speed = get_number<int32_t>(doc, "bus_speed");
+        s.bus_incline = get_number<int32_t>(doc, "bus_incline");
+        s.console_bytes = get_number<uint32_t>(doc, "console_bytes");
+        s.motor_bytes = get_number<uint32_t>(doc, "motor_bytes");
+        s.generation = get_number<uint32_t>(doc, "generation");
+        s.console_dropped = get_number<uint64_t>(doc, "console_dropped");
+        s.motor_dropped = get_number<uint64_t>(doc, "motor_dropped");
+        s.distance_mi = get_number<double>(doc, "distance_mi");
+        s.vert_ft = get_number<double>(doc, "vert_ft");
+        s.belt_on_ms = get_number<uint64_t>(doc, "belt_on_ms");
+    } else if (type == "ftms") {
+        ev->type = TM_EVENT_FTMS;
+        ev->ftms = { get_number<double>(doc, "ts"), get_number<uint32_t>(doc, "distance_m"),
+                     get_number<uint16_t>(doc, "speed"), get_number<int16_t>(doc, "incline"),
+                     get_number<uint16_t>(doc, "elapsed_s"), 0 };
+    } else {
+        ev->type = TM_EVENT_JSON;
+    }
+    return true;
+}
+
+// Appends for the command builders; the text always fits CMD_MAX
+struct CmdBuf {
+    std::array<char, CMD_MAX> buf{};
+    size_t len = 0;
+
+    void lit(std::string_view s) {
+        size_t n = std::min(s.size(), buf.size() - len);
+        std::copy_n(s.data(), n, buf.data() + len);
+        len += n;
+    }
+    // to_chars, not printf: the decimal point must not follow the caller's locale
+    template <typename T>
+    void num(T v) {
+        auto [p, ec] = std::to_chars(buf.data() + len, buf.data() + buf.size(), v);
+        if (ec == std::errc{}) len = static_cast<size_t>(p - buf.data());
+    }
+    std::string_view view() const { return { buf.data(), len }; }
+};
+
+}  // namespace
+
+struct tm_client {
+    std::array<char, sizeof(sockaddr_un::sun_path)> path{};
+    int fd = -1;
+    int bus = 0;
+    bool binary = true;   // asked for
+    bool framed = false;  // the server's hello switched the stream to frames
+    std::array<char, SUB_CMD_MAX> sub{};
+    size_t sub_len = 0;
+    std::array<char, RX_BUF_SIZE> rx;
+    size_t rx_pos = 0;
+    size_t rx_len = 0;
+    std::array<char, RX_BUF_SIZE + 1> line;  // the current event's JSON text
+};
+
+struct tm_status_page {
+    StatusPageReader reader;
+};
+
+static void drop_connection(tm_client* c) {
+    if (c->fd >= 0) ::close(c->fd);
+    c->fd = -1;
+    c->framed = false;
+    c->rx_pos = c->rx_len = 0;
+}
+
+// The whole line goes out or the connection is dropped
+static int send_line(tm_client* c, std::string_view cmd) {
+    if (!c || c->fd < 0) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    std::array<char, MAX_IPC_COMMAND_LEN + 1> out;
+    if (cmd.size() >= out.size()) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    std::copy(cmd.begin(), cmd.end(), out.begin());
+    out.at(cmd.size()) = '\n';
+    size_t len = cmd.size() + 1, sent = 0;
+    while (sent < len) {
+        ssize_t n = ::send(c->fd, out.data() + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            int err = errno;
+            drop_connection(c);
+            errno = err;
+            return -1;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return 0;
+}
+
+static int open_socket(tm_client* c) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, c->path.data(), c->path.size());
+    // reinterpret_cast: sockaddr_un -> sockaddr (POSIX socket API)
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        return -1;
+    }
+    c->fd = fd;
+    if (c->binary && send_line(c, "{\"cmd\":\"hello\",\"format\":\"binary\"}") < 0) return -1;
+    if (c->sub_len > 0 && send_line(c, { c->sub.data(), c->sub_len }) < 0) return -1;
+    return 0;
+}
+
+// Commands other than hello/subscribe name the client's bus
+static int send_command(tm_client* c, CmdBuf& cmd) {
+    if (c->bus != 0) {
+        cmd.lit(",\"bus\":");
+        cmd.num(c->bus);
+    }
+    cmd.lit("}");
+    return send_line(c, cmd.view());
+}
+
+static int send_value(tm_client* c, std::string_view name, double value, int64_t seq) {
+    CmdBuf cmd;
+    cmd.lit("{\"cmd\":\"");
+    cmd.lit(name);
+    cmd.lit("\",\"value\":");
+    cmd.num(value);
+    if (seq >= 0) {
+        cmd.lit(",\"seq\":");
+        cmd.num(static_cast<uint32_t>(seq));
+    }
+    return send_command(c, cmd);
+}
+
+static int send_enabled(tm_client* c, std::string_view name, int enabled) {
+    CmdBuf cmd;
+    cmd.lit("{\"cmd\":\"");
+    cmd.lit(name);
+    cmd.lit(enabled ? "\",\"enabled\":true" : "\",\"enabled\":false");
+    return send_command(c, cmd);
+}
+
+// The next complete event already in rx, if any
+static bool take_event(tm_client* c, tm_event* ev) {
+    while (c->rx_pos < c->rx_len) {
+        std::string_view avail(c->rx.data() + c->rx_pos, c->rx_len - c->rx_pos);
+        std::string_view text;
+        if (c->framed) {
+            if (avail.size() < BINARY_FRAME_HEADER_SIZE) return false;
+            size_t n = static_cast<uint8_t>(avail[0]) | (static_cast<size_t>(static_cast<uint8_t>(avail[1])) << 8);
+            if (avail.size() < BINARY_FRAME_HEADER_SIZE + n) return false;
+            c->rx_pos += BINARY_FRAME_HEADER_SIZE + n;
+            std::string_view rec = avail.substr(BINARY_FRAME_HEADER_SIZE, n);
+            if (!decode_record(rec, ev)) continue;
+            if (ev->type != TM_EVENT_JSON) return true;
+            text = rec.substr(1);
+        } else {
+            size_t nl = avail.find('\n');
+            if (nl == std::string_view::npos) return false;
+            c->rx_pos += nl + 1;
+            text = avail.substr(0, nl);
+            if (text.empty()) continue;
+        }
+
+        if (!decode_json_line(text, ev)) continue;
+        std::copy(text.begin(), text.end(), c->line.begin());
+        c->line.at(text.size()) = '\0';
+        ev->json = c->line.data();
+        ev->json_len = text.size();
+        if (!c->framed && std::string_view(ev->json_type) == "hello" &&
+            text.find("\"format\":\"binary\"") != std::string_view::npos) {
+            c->framed = true;
+        }
+        return true;
+    }
+    return false;
+}
+
+extern "C" {
+
+TM_API int tm_abi_version(void) {
+    return TM_ABI_VERSION;
+}
+
+TM_API tm_client* tm_connect(const char* path, int format, int bus) {
+    std::string_view p = path ? path : TM_DEFAULT_SOCKET;
+    if (p.size() >= sizeof(sockaddr_un::sun_path) || bus < 0 || bus >= MAX_BUSES ||
+        (format != TM_FORMAT_BINARY && format != TM_FORMAT_JSON)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    auto* c = new (std::nothrow) tm_client;
+    if (!c) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    std::copy(p.begin(), p.end(), c->path.begin());
+    c->bus = bus;
+    c->binary = format == TM_FORMAT_BINARY;
+    if (open_socket(c) < 0) {
+        int err = errno;
+        drop_connection(c);
+        delete c;
+        errno = err;
+        return nullptr;
+    }
+    return c;
+}
+
+TM_API void tm_close(tm_client* c) {
+    if (!c) return;
+    drop_connection(c);
+    delete c;
+}
+
+TM_API int tm_fd(const tm_client* c) {
+    return c ? c->fd : -1;
+}
+
+TM_API int tm_reconnect(tm_client* c) {
+    drop_connection(c);
+    if (open_socket(c) == 0) return 0;
+    int err = errno;
+    drop_connection(c);
+    errno = err;
+    return -1;
+}
+
+TM_API int tm_send(tm_client* c, const char* json) {
+    return json ? send_line(c, json) : -1;
+}
+
+TM_API int tm_heartbeat(tm_client* c) {
+    CmdBuf cmd;
+    cmd.lit("{\"cmd\":\"heartbeat\"");
+    return send_command(c, cmd);
+}
+
+TM_API int tm_set_speed(tm_client* c, double mph, int64_t seq) {
+    return send_value(c, "speed", mph, seq);
+}
+
+TM_API int tm_set_incline(tm_client* c, double pct, int64_t seq) {
+    return send_value(c, "incline", pct, seq);
+}
+
+TM_API int tm_set_emulate(tm_client* c, int enabled) {
+    return send_enabled(c, "emulate", enabled);
+}
+
+TM_API int tm_set_proxy(tm_client* c, int enabled) {
+    return send_enabled(c, "proxy", enabled);
+}
+
+TM_API int tm_subscribe(tm_client* c, uint32_t types, uint32_t sources, uint32_t keys, uint32_t buses,
+                        uint32_t kv_rate) {
+    std::array<char, SUB_CMD_MAX> buf;
+    size_t len = 0;
+    auto lit = [&](std::string_view s) {
+        std::copy(s.begin(), s.end(), buf.begin() + static_cast<std::ptrdiff_t>(len));
+        len += s.size();
+    };
+    auto names = [&](const char* field, auto& table, size_t first, uint32_t mask) {
+        if (mask == TM_SUB_ALL) return;
+        lit(",\"");
+        lit(field);
+        lit("\":[");
+        bool any = false;
+        for (size_t i = first; i < table.size(); i++) {
+            if (!(mask & (1u << i))) continue;
+            lit(any ? ",\"" : "\"");
+            lit(table.at(i));
+            lit("\"");
+            any = true;
+        }
+        lit("]");
+    };
+    lit("{\"cmd\":\"subscribe\"");
+    names("types", SUB_TYPE_NAMES, 0, types);
+    names("sources", SUB_SOURCE_NAMES, 0, sources);
+    names("keys", KV_KEY_NAMES, 1, keys);
+    if (buses != TM_SUB_ALL) {
+        lit(",\"buses\":[");
+        bool any = false;
+        for (int b = 0; b < MAX_BUSES; b++) {
+            if (!(buses & (1u << b))) continue;
+            if (any) lit(",");
+            buf.at(len++) = static_cast<char>('0' + b);
+            any = true;
+        }
+        lit("]");
+    }
+    if (kv_rate > 0) {
+        lit(",\"kv_rate\":");
+        auto [p, ec] = std::to_chars(buf.data() + len, buf.data() + buf.size(), kv_rate);
+        if (ec == std::errc{}) len = static_cast<size_t>(p - buf.data());
+    }
+    lit("}");
+
+    std::copy_n(buf.begin(), len, c->sub.begin());
+    c->sub_len = len;
+    return send_line(c, { buf.data(), len });
+}
+
+TM_API int tm_next_event(tm_client* c, tm_event* ev, int timeout_ms) {
+    using Clock = std::chrono::steady_clock;
+    auto deadline = Clock::now() + std::chrono::milliseconds(std::max(timeout_ms, 0));
+    for (;;) {
+        if (take_event(c, ev)) return 1;
+        if (c->fd < 0) return -1;
+
+        // Keep the partial event at the front; a line longer than the
+        // whole buffer can't be an event, so it is dropped
+        if (c->rx_pos > 0) {
+            std::copy(c->rx.begin() + static_cast<std::ptrdiff_t>(c->rx_pos),
+                      c->rx.begin() + static_cast<std::ptrdiff_t>(c->rx_len), c->rx.begin());
+            c->rx_len -= c->rx_pos;
+            c->rx_pos = 0;
+        }
+        if (c->rx_len == c->rx.size()) c->rx_len = 0;
+
+        int wait_ms = -1;
+        if (timeout_ms >= 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            wait_ms = static_cast<int>(std::max<int64_t>(left, 0));
+        }
+        pollfd pfd{ c->fd, POLLIN, 0 };
+        int r = poll(&pfd, 1, wait_ms);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return -1;
+        if (r == 0) return 0;
+
+        ssize_t n = ::read(c->fd, c->rx.data() + c->rx_len, c->rx.size() - c->rx_len);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (n <= 0) {
+            drop_connection(c);
+            return -1;
+        }
+        c->rx_len += static_cast<size_t>(n);
+    }
+}
+
+TM_API int tm_decode_record(const void* rec, size_t len, tm_event* ev) {
+    if (!rec || !ev) return -1;
+    std::string_view r(static_cast<const char*>(rec), len);
+    if (!decode_record(r, ev)) return -1;
+    if (ev->type != TM_EVENT_JSON) return 0;
+    // A JSON record: the same decode as a JSON line
+    if (!decode_json_line(r.substr(1), ev)) return -1;
+    ev->json = static_cast<const char*>(rec) + 1;
+    ev->json_len = r.size() - 1;
+    return 0;
+}
+
+TM_API size_t tm_record_to_json(const void* rec, size_t len, char* out, size_t cap) {
+    if (!rec || !out || cap == 0) return 0;
+    size_t n = ring_message_to_json({ out, cap - 1 }, { static_cast<const char*>(rec), len });
+    if (n == 0) return 0;
+    out[n] = '\0';
+    return n;
+}
+
+TM_API tm_status_page* tm_status_page_open(int bus) {
+    if (bus < 0 || bus >= MAX_BUSES) return nullptr;
+    std::array<char, 64> name{};
+    if (bus == 0) std::snprintf(name.data(), name.size(), "%s", STATUS_PAGE_NAME);
+    else std::snprintf(name.data(), name.size(), "%s.%d", STATUS_PAGE_NAME, bus);
+    auto* p = new (std::nothrow) tm_status_page;
+    if (!p) return nullptr;
+    if (!p->reader.open(name.data())) {
+        delete p;
+        return nullptr;
+    }
+    return p;
+}
+
+TM_API void tm_status_page_close(tm_status_page* p) {
+    delete p;
+}
+
+TM_API int tm_status_page_read(const tm_status_page* p, tm_status_snapshot* out) {
+    if (!p || !out) return -1;
+    auto snap = p->reader.read();
+    if (!snap) return -1;
+    std::memset(out, 0, sizeof(*out));
+    fill_status(out->status, snap->status);
+    out->updated_us = snap->updated_us;
+    out->pid = snap->pid;
+    out->seq = snap->seq;
+    return 0;
+}
+
+}  // extern "C"
@@ -0,0 +1,176 @@
+/*
+ * treadmill_ipc.h — C ABI client library for treadmill_io (libtreadmill_ipc)
+ *
+ * One client implementation for everything that isn't C++: Python
+ * (ctypes/cffi), Rust (FFI), shell tools. Built from the same
+ * ipc_protocol.cpp and status_page.cpp the daemon uses, so records,
+ * framing and the status page layout can't drift from the server.
+ *
+ *   tm_connect()        connect to the socket; switches the connection to
+ *                       binary record framing (ipc_protocol.h) unless
+ *                       TM_FORMAT_JSON is asked for
+ *   tm_subscribe()      event filter, remembered for tm_reconnect()
+ *   tm_set_speed() ...  the common commands; tm_send() for any other
+ *   tm_next_event()     the next event: kv, status and ftms decoded into
+ *                       structs from either framing, everything else as
+ *                       its JSON line
+ *   tm_status_page_*    the shared-memory status page, no socket needed
+ *
+ * A tm_client is not thread-safe: one thread reads events, or commands
+ * and reads are serialized by the caller. Strings returned by the library
+ * are NUL-terminated and owned by it. Calls return 0 on success and -1 on
+ * failure (errno as set by the socket call), unless noted.
+ *
+ * The ABI is the functions and structs below, checked by TM_ABI_VERSION;
+ * an added field or function bumps it, nothing is ever reordered.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(TM_BUILD_LIBRARY)
+#define TM_API __attribute__((visibility("default")))
+#else
+#define TM_API
+#endif
+
+#define TM_ABI_VERSION 1
+
+#define TM_DEFAULT_SOCKET "/tmp/treadmill_io.sock"
+
+enum tm_format { TM_FORMAT_BINARY = 0, TM_FORMAT_JSON = 1 };
+
+/* Event types: the record tags of ipc_protocol.h */
+enum tm_event_type { TM_EVENT_KV = 1, TM_EVENT_STATUS = 2, TM_EVENT_JSON = 3, TM_EVENT_FTMS = 4 };
+
+/* tm_subscribe() masks. TM_SUB_ALL = no filter; keys use bit i = KV_KEY_NAMES[i] */
+#define TM_SUB_ALL 0xffffffffu
+#define TM_TYPE_KV (1u << 0)
+#define TM_TYPE_STATUS (1u << 1)
+#define TM_TYPE_EMU_STATS (1u << 2)
+#define TM_TYPE_METRICS (1u << 3)
+#define TM_TYPE_PROGRAM (1u << 4)
+#define TM_TYPE_STALL (1u << 5)
+#define TM_TYPE_BUS_STATS (1u << 6)
+#define TM_TYPE_FTMS (1u << 7)
+#define TM_TYPE_HR_ZONE (1u << 8)
+#define TM_TYPE_STATS (1u << 9)
+#define TM_TYPE_CYCLE (1u << 10)
+#define TM_SOURCE_CONSOLE (1u << 0)
+#define TM_SOURCE_MOTOR (1u << 1)
+#define TM_SOURCE_EMULATE (1u << 2)
+
+#define TM_KV_TEXT_MAX 128
+#define TM_JSON_TYPE_MAX 32
+
+typedef struct tm_kv {
+    double ts;                     /* seconds since the daemon started */
+    char source[8];                /* "console", "motor" or "emulate" */
+    char key[TM_KV_TEXT_MAX];
+    char value[TM_KV_TEXT_MAX];
+} tm_kv;
+
+typedef struct tm_status {
+    uint8_t proxy;
+    uint8_t emulate;
+    uint8_t overlay;
+    uint8_t pad;
+    int32_t emu_speed;             /* tenths of mph */
+    int32_t emu_incline;           /* half-pct */
+    int32_t bus_speed;             /* tenths of mph, -1 unknown */
+    int32_t bus_incline;           /* half-pct, -1 unknown */
+    uint32_t console_bytes;
+    uint32_t motor_bytes;
+    uint32_t generation;
+    uint64_t console_dropped;
+    uint64_t motor_dropped;
+    double distance_mi;
+    double vert_ft;
+    uint64_t belt_on_ms;
+} tm_status;
+
+typedef struct tm_ftms {
+    double ts;
+    uint32_t distance_m;
+    uint16_t speed;                /* 0.01 km/h */
+    int16_t incline;               /* 0.1 % */
+    uint16_t elapsed_s;
+    uint16_t pad;
+} tm_ftms;
+
+typedef struct tm_event {
+    int32_t type;                  /* enum tm_event_type */
+    int32_t bus;
+    tm_kv kv;                      /* TM_EVENT_KV */
+    tm_status status;              /* TM_EVENT_STATUS */
+    tm_ftms ftms;                  /* TM_EVENT_FTMS */
+    char json_type[TM_JSON_TYPE_MAX];  /* the event's "type": "kv", "ack", ... */
+    /* The JSON text when the event came as JSON (always for TM_EVENT_JSON),
+     * else NULL. From tm_next_event: NUL-terminated, valid until the next
+     * call. From tm_decode_record: points into the record, json_len bytes. */
+    const char* json;
+    size_t json_len;
+} tm_event;
+
+typedef struct tm_status_snapshot {
+    tm_status status;
+    uint64_t updated_us;           /* CLOCK_MONOTONIC at publish */
+    uint32_t pid;
+    uint32_t pad;
+    uint64_t seq;
+} tm_status_snapshot;
+
+typedef struct tm_client tm_client;
+typedef struct tm_status_page tm_status_page;
+
+/* TM_ABI_VERSION of the loaded library */
+TM_API int tm_abi_version(void);
+
+/* NULL path = TM_DEFAULT_SOCKET. bus (0-3) is added to every command
+ * except subscribe. NULL on failure. */
+TM_API tm_client* tm_connect(const char* path, int format, int bus);
+TM_API void tm_close(tm_client* c);
+/* The socket, for the caller's own poll/select; -1 while disconnected */
+TM_API int tm_fd(const tm_client* c);
+/* Connect again, then resend the hello and the last subscribe */
+TM_API int tm_reconnect(tm_client* c);
+
+/* One JSON command, without the newline, sent as it is */
+TM_API int tm_send(tm_client* c, const char* json);
+TM_API int tm_heartbeat(tm_client* c);
+/* seq < 0: no "seq" (ack_tracker.h acks commands that carry one) */
+TM_API int tm_set_speed(tm_client* c, double mph, int64_t seq);
+TM_API int tm_set_incline(tm_client* c, double pct, int64_t seq);
+TM_API int tm_set_emulate(tm_client* c, int enabled);
+TM_API int tm_set_proxy(tm_client* c, int enabled);
+/* Masks as above; kv_rate 0 = every kv event */
+TM_API int tm_subscribe(tm_client* c, uint32_t types, uint32_t sources, uint32_t keys, uint32_t buses,
+                        uint32_t kv_rate);
+
+/* Wait up to timeout_ms (-1 = forever) for the next event.
+ * 1 = *ev filled, 0 = timed out, -1 = disconnected (see tm_reconnect). */
+TM_API int tm_next_event(tm_client* c, tm_event* ev, int timeout_ms);
+
+/* Decode one bare record (a frame's payload, e.g. from a telemetry
+ * datagram or the event tap). 0, or -1 if it isn't a valid record. */
+TM_API int tm_decode_record(const void* rec, size_t len, tm_event* ev);
+/* A record as the JSON line a JSON client gets, NUL-terminated.
+ * Returns its length, 0 if invalid or it doesn't fit in cap. */
+TM_API size_t tm_record_to_json(const void* rec, size_t len, char* out, size_t cap);
+
+/* The status page of `bus` (0 = the usual page). NULL if the daemon
+ * isn't running. */
+TM_API tm_status_page* tm_status_page_open(int bus);
+TM_API void tm_status_page_close(tm_status_page* p);
+/* 0 = consistent snapshot, -1 = nothing published yet / writer busy */
+TM_API int tm_status_page_read(const tm_status_page* p, tm_status_snapshot* out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,183 @@
+/*
+ * tx_selftest.h — Transmit timing self-test over a loopback GPIO
+ *
+ * With the motor write pin also wired to a spare input, run_tx_selftest()
+ * sends query bursts through the normal SerialWriter while the port's
+ * edge log (PortHasEdgeLog) records what actually came out. Each burst's
+ * edges are compared with the ideal edges of the bytes it carried,
+ * timed from its first start bit:
+ *
+ *   rate error   least-squares slope of edge error against time, in ppm
+ *                of the bit period (a truncated 104 us bit is -1600 ppm)
+ *   max error    worst single edge against its ideal time
+ *   jitter       RMS edge error once each burst's rate error is removed
+ *
+ * A burst whose edges don't match its bytes (a missed edge, noise, a
+ * wiring fault) counts as bad and is left out. The frames are bare
+ * queries, which a connected motor answers but doesn't act on.
+ * `treadmill_io --tx-selftest GPIO` runs it on bus 0.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <span>
+#include <string_view>
+#include "gpio_port.h"
+#include "serial_io.h"
+
+constexpr size_t TX_SELFTEST_MAX_EDGES = 2048;  // per burst
+constexpr int TX_SELFTEST_GAP_MS = 30;          // after a burst, for the last edges to be logged
+
+// One burst: bare queries, as the emulate cycle sends them
+constexpr std::array<std::string_view, 5> TX_SELFTEST_FRAMES = {
+    "[ver]\xff", "[type]\xff", "[err]\xff", "[amps]\xff", "[belt]\xff",
+};
+
+struct TxTimingReport {
+    int bursts = 0;             // analysed
+    int bad_bursts = 0;         // edges didn't match the bytes
+    uint64_t edges = 0;
+    double rate_error_ppm = 0;  // mean over bursts; negative = bits too short
+    double max_error_ns = 0;
+    double jitter_rms_ns = 0;
+};
+
+// Ideal edges (ns from the first start bit, and the level each goes to)
+// of `bytes` sent inverted at `baud` from an idle-LOW line. Returns the
+// count, 0 if `out` is too small.
+inline size_t tx_ideal_edges(std::span<const uint8_t> bytes, int baud, std::span<PortEdge> out) {
+    size_t n = 0;
+    int level = 0;
+    int64_t k = 0;
+    auto bit = [&](int to) {
+        if (to != level) {
+            if (n < out.size()) out[n] = { k * 1000000000LL / baud, to };
+            n++;
+            level = to;
+        }
+        k++;
+    };
+    for (uint8_t b : bytes) {
+        bit(1);  // start bit: HIGH
+        for (int i = 0; i < 8; i++) bit(((b >> i) & 1) ? 0 : 1);
+        bit(0);  // stop bit: LOW
+    }
+    return n <= out.size() ? n : 0;
+}
+
+class TxTimingAnalyzer {
+public:
+    explicit TxTimingAnalyzer(int baud) : baud_(baud) {}
+
+    // One burst: the bytes sent and the edges logged while they went out.
+    // False (a bad burst) if the edges don't match the bytes.
+    bool add_burst(std::span<const uint8_t> bytes, std::span<const PortEdge> edges) {
+        size_t n = tx_ideal_edges(bytes, baud_, ideal_);
+        if (n < 2 || edges.size() != n) {
+            bad_++;
+            return false;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (edges[i].level != ideal_.at(i).level) {
+                bad_++;
+                return false;
+            }
+        }
+
+        // Edge error e(x) at ideal time x, then its fit e = a + b x
+        auto err = [&](size_t i) {
+            return static_cast<double>(edges[i].t_ns - edges[0].t_ns - ideal_.at(i).t_ns);
+        };
+        double sx = 0, se = 0;
+        for (size_t i = 0; i < n; i++) {
+            sx += static_cast<double>(ideal_.at(i).t_ns);
+            se += err(i);
+        }
+        double mx = sx / static_cast<double>(n);
+        double me = se / static_cast<double>(n);
+        double sxx = 0, sxe = 0;
+        for (size_t i = 0; i < n; i++) {
+            double dx = static_cast<double>(ideal_.at(i).t_ns) - mx;
+            sxx += dx * dx;
+            sxe += dx * (err(i) - me);
+        }
+        double slope = sxx > 0 ? sxe / sxx : 0;
+        for (size_t i = 0; i < n; i++) {
+            double e = err(i);
+            double r = e - (me + slope * (static_cast<double>(ideal_.at(i).t_ns) - mx));
+            sum_sq_ += r * r;
+            max_err_ = std::max(max_err_, std::abs(e));
+        }
+        slope_sum_ += slope;
+        edges_ += n;
+        bursts_++;
+        return true;
+    }
+
+    TxTimingReport report() const {
+        TxTimingReport r;
+        r.bursts = bursts_;
+        r.bad_bursts = bad_;
+        r.edges = edges_;
+        if (bursts_ > 0) r.rate_error_ppm = slope_sum_ / bursts_ * 1e6;
+        r.max_error_ns = max_err_;
+        if (edges_ > 0) r.jitter_rms_ns = std::sqrt(sum_sq_ / static_cast<double>(edges_));
+        return r;
+    }
+
+private:
+    int baud_;
+    std::array<PortEdge, TX_SELFTEST_MAX_EDGES> ideal_{};
+    int bursts_ = 0;
+    int bad_ = 0;
+    uint64_t edges_ = 0;
+    double slope_sum_ = 0;
+    double sum_sq_ = 0;
+    double max_err_ = 0;
+};
+
+// Send `bursts` bursts through `writer` and time them on `loop_pin`.
+// nullopt if the port has no edge log or can't log that pin.
+template <typename Port>
+std::optional<TxTimingReport> run_tx_selftest(Port& port, SerialWriter<Port>& writer, int loop_pin, int bursts) {
+    if constexpr (!PortHasEdgeLog<Port>) {
+        return std::nullopt;
+    } else {
+        if (!port.edge_log_open(loop_pin)) return std::nullopt;
+
+        std::array<uint8_t, 64> sent{};
+        size_t sent_len = 0;
+        for (auto f : TX_SELFTEST_FRAMES) {
+            for (char c : f) sent.at(sent_len++) = static_cast<uint8_t>(c);
+        }
+
+        std::array<PortEdge, TX_SELFTEST_MAX_EDGES> edges;
+        auto drain = [&] {
+            size_t n = 0;
+            int got;
+            while ((got = port.edge_log_read(loop_pin, std::span<PortEdge>(edges).subspan(n))) > 0) {
+                n += static_cast<size_t>(got);
+                if (n == edges.size()) break;
+            }
+            return n;
+        };
+
+        TxTimingAnalyzer analyzer(writer.baud());
+        sleep_us(TX_SELFTEST_GAP_MS * 1000);
+        drain();  // whatever the line did before
+        for (int b = 0; b < bursts; b++) {
+            writer.write_burst(TX_SELFTEST_FRAMES);
+            sleep_us(TX_SELFTEST_GAP_MS * 1000);
+            size_t n = drain();
+            analyzer.add_burst(std::span<const uint8_t>(sent.data(), sent_len),
+                               std::span<const PortEdge>(edges.data(), n));
+        }
+        port.edge_log_close(loop_pin);
+        return analyzer.report();
+    }
+}
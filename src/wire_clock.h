@@ -0,0 +1,49 @@
+/*
+ * wire_clock.h — wire_now_ns(): a cheap raw clock for frame arrival
+ *
+ * SerialReader stamps each read batch with it, once per read rather
+ * than once per event. On aarch64 it reads the generic timer
+ * (cntvct_el0) straight from user space, scaled with a multiply and a
+ * shift: no syscall and no vDSO call. Elsewhere it is CLOCK_MONOTONIC_RAW.
+ *
+ * Neither is slewed by NTP, which is what inter-frame timing wants, but
+ * the zero point is its own: compare wire times with each other (or
+ * with a wire time taken at a known moment), never with CLOCK_MONOTONIC.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+
+#if defined(__aarch64__)
+
+namespace wire_clock_detail {
+
+inline uint64_t counter_freq() {
+    uint64_t f;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(f));
+    return f;
+}
+
+// ns = ticks * MULT >> 32 (54 MHz on a Pi 4: MULT ~ 18.5 * 2^32)
+inline const uint64_t MULT = (uint64_t{1000000000} << 32) / counter_freq();
+
+}  // namespace wire_clock_detail
+
+inline int64_t wire_now_ns() {
+    uint64_t ticks;
+    asm volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(ticks) : : "memory");
+    auto ns = (static_cast<unsigned __int128>(ticks) * wire_clock_detail::MULT) >> 32;
+    return static_cast<int64_t>(ns);
+}
+
+#else
+
+inline int64_t wire_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+#endif
@@ -5,6 +5,10 @@ Python client for treadmill_io C binary.
 Connects to the Unix domain socket, sends JSON commands,
 and receives a stream of JSON event lines.
 
+With binary=True the client sends a hello and the server switches the
+connection to length-prefixed binary records (see src/ipc_protocol.h);
+on_message still receives the same dicts as in JSON mode.
+
 Supports auto-reconnection with backoff when the C binary
 restarts. Provides on_disconnect/on_reconnect callbacks
 for the server to track connection state.
@@ -24,21 +28,155 @@ Usage:
 
 import json
 import logging
+import mmap
 import socket
+import struct
 import threading
 import time
 
 SOCK_PATH = "/tmp/treadmill_io.sock"
+STATUS_PAGE_PATH = "/dev/shm/treadmill_io.status"
 MAX_SPEED_TENTHS = 120  # 12.0 mph max, in tenths
 MAX_INCLINE = 99
 MAX_BUF = 65536
 
 log = logging.getLogger("treadmill_client")
 
+# Status page layout (see src/status_page.h): seq at 8, payload from 16
+_STATUS_PAYLOAD = struct.Struct("<QIBBBxiiiiIIQQddQI")
+_STATUS_FIELDS = (
+    "updated_us", "pid", "proxy", "emulate", "overlay", "emu_speed", "emu_incline",
+    "bus_speed", "bus_incline", "console_bytes", "motor_bytes",
+    "console_dropped", "motor_dropped", "distance_mi", "vert_ft", "belt_on_ms",
+    "generation",
+)
+
+# Binary framing (see src/ipc_protocol.h): [u16 len][record]
+_FRAME_LEN = struct.Struct("<H")
+_KV_HEADER = struct.Struct("<BBBBBB2xd")
+_STATUS_RECORD = struct.Struct("<BBBBiiiiIIQQddQBI")
+_STATUS_RECORD_FIELDS = (
+    "proxy", "emulate", "emu_speed", "emu_incline", "bus_speed", "bus_incline",
+    "console_bytes", "motor_bytes", "console_dropped", "motor_dropped",
+    "distance_mi", "vert_ft", "belt_on_ms", "overlay", "generation",
+)
+_FTMS_RECORD = struct.Struct("<BBHhHId")
+_SOURCES = ("console", "motor", "emulate")
+_KV_KEYS = (
+    "", "inc", "hmph", "amps", "err", "belt", "vbus", "lift", "lfts", "lftg",
+    "part", "ver", "type", "diag", "loop",
+)
+
+
+def decode_record(rec):
+    """Decode one binary record into the dict its JSON event would give."""
+    tag = rec[0]
+    if tag == 1:
+        _, src, key_id, key_len, value_len, bus, ts = _KV_HEADER.unpack_from(rec)
+        pos = _KV_HEADER.size
+        key = _KV_KEYS[key_id] if key_id else rec[pos:pos + key_len].decode(errors="replace")
+        pos += key_len
+        value = rec[pos:pos + value_len].decode(errors="replace")
+        msg = {"type": "kv"}
+        if bus:
+            msg["bus"] = bus
+        msg.update(ts=ts, source=_SOURCES[src], key=key, value=value)
+        return msg
+    if tag == 2:
+        _, proxy, emulate, bus, *values = _STATUS_RECORD.unpack_from(rec)
+        msg = {"type": "status"}
+        if bus:
+            msg["bus"] = bus
+        msg.update(zip(_STATUS_RECORD_FIELDS, [proxy, emulate] + values))
+        msg["proxy"] = bool(msg["proxy"])
+        msg["emulate"] = bool(msg["emulate"])
+        if msg.pop("overlay"):
+            msg["overlay"] = True
+        return msg
+    if tag == 3:
+        return json.loads(rec[1:])
+    if tag == 4:
+        _, bus, speed, incline, elapsed_s, distance_m, ts = _FTMS_RECORD.unpack_from(rec)
+        msg = {"type": "ftms"}
+        if bus:
+            msg["bus"] = bus
+        msg.update(ts=ts, speed=speed, incline=incline, distance_m=distance_m, elapsed_s=elapsed_s)
+        return msg
+    return None
+
+
+# Telemetry datagram header (see src/telemetry.h): magic, seq, sent_us
+_TELEMETRY_HEADER = struct.Struct("<4sIQ")
+
+
+def decode_telemetry(datagram):
+    """Decode one UDP telemetry datagram into (seq, sent_us, [event dicts]).
+
+    Returns None if it isn't a treadmill_io telemetry datagram.
+    """
+    if len(datagram) < _TELEMETRY_HEADER.size:
+        return None
+    magic, seq, sent_us = _TELEMETRY_HEADER.unpack_from(datagram)
+    if magic != b"TMT1":
+        return None
+    events = []
+    pos = _TELEMETRY_HEADER.size
+    while pos + _FRAME_LEN.size <= len(datagram):
+        (n,) = _FRAME_LEN.unpack_from(datagram, pos)
+        pos += _FRAME_LEN.size
+        if pos + n > len(datagram):
+            break
+        msg = decode_record(datagram[pos:pos + n])
+        if msg is not None:
+            events.append(msg)
+        pos += n
+    return seq, sent_us, events
+
+
+def status_page_path(bus=0):
+    """Status page of one bus on a multi-bus host (bus 0 = the usual page)."""
+    return STATUS_PAGE_PATH if bus == 0 else f"{STATUS_PAGE_PATH}.{bus}"
+
+
+def read_status_page(path=STATUS_PAGE_PATH, retries=64):
+    """Snapshot treadmill_io's shared-memory status page without the socket.
+
+    Returns a dict with the status event fields (plus updated_us and pid),
+    or None if treadmill_io isn't running or hasn't published yet.
+    """
+    try:
+        with open(path, "rb") as f:
+            page = mmap.mmap(f.fileno(), 128, access=mmap.ACCESS_READ)
+    except (OSError, ValueError):
+        return None
+    try:
+        if page[0:4] != b"TMS1" or struct.unpack_from("<I", page, 4)[0] != 2:
+            return None
+        for _ in range(retries):
+            (before,) = struct.unpack_from("<Q", page, 8)
+            if before & 1:
+                continue
+            values = _STATUS_PAYLOAD.unpack_from(page, 16)
+            (after,) = struct.unpack_from("<Q", page, 8)
+            if after != before:
+                continue
+            status = dict(zip(_STATUS_FIELDS, values))
+            if status["updated_us"] == 0:
+                return None
+            status["proxy"] = bool(status["proxy"])
+            status["emulate"] = bool(status["emulate"])
+            status["overlay"] = bool(status["overlay"])
+            return status
+        return None
+    finally:
+        page.close()
+
 
 class TreadmillClient:
-    def __init__(self, sock_path=SOCK_PATH):
+    def __init__(self, sock_path=SOCK_PATH, binary=False, bus=0):
         self.sock_path = sock_path
+        self.binary = binary
+        self.bus = bus  # commands go to this bus of a multi-bus treadmill_io
         self._sock = None
         self._lock = threading.Lock()
         self._reader_thread = None
@@ -69,6 +207,8 @@ class TreadmillClient:
             self._connected = True
         self._reader_thread = threading.Thread(target=self._reader_loop, daemon=True)
         self._reader_thread.start()
+        if self.binary:
+            self._send({"cmd": "hello", "format": "binary"})
 
     def start_heartbeat(self, interval=1.0):
         """Start a dedicated OS thread that sends heartbeats via time.sleep.
@@ -125,6 +265,8 @@ class TreadmillClient:
             sock = self._sock
         if not sock:
             raise ConnectionError("Not connected to treadmill_io")
+        if self.bus and msg.get("cmd") not in ("hello", "subscribe"):
+            msg = dict(msg, bus=self.bus)
         try:
             data = json.dumps(msg, separators=(",", ":")) + "\n"
             sock.sendall(data.encode())
@@ -141,23 +283,110 @@ class TreadmillClient:
     def set_emulate(self, enabled):
         self._send({"cmd": "emulate", "enabled": enabled})
 
-    def set_speed(self, mph):
-        """Set emulation speed in mph (float)."""
-        self._send({"cmd": "speed", "value": mph})
+    def set_overlay(self, enabled):
+        """Forward the console's stream with speed/incline rewritten.
+
+        Starts at zero like emulate; set_speed/set_incline then keep overlay.
+        """
+        self._send({"cmd": "overlay", "enabled": enabled})
+
+    @staticmethod
+    def _with_seq(msg, seq):
+        return msg if seq is None else dict(msg, seq=seq)
+
+    def set_speed(self, mph, seq=None):
+        """Set emulation speed in mph (float).
+
+        With seq (0 to 2**32 - 1), treadmill_io answers with ack events
+        carrying it: stage "applied", then while emulating "motor" once
+        the motor echoes the new speed ("superseded"/"timeout" if not).
+        """
+        self._send(self._with_seq({"cmd": "speed", "value": mph}, seq))
+
+    def set_incline(self, value, seq=None):
+        """Set emulation incline (float 0-99, resolution 0.5). seq as for set_speed."""
+        self._send(self._with_seq({"cmd": "incline", "value": value}, seq))
 
-    def set_incline(self, value):
-        """Set emulation incline (float 0-99, resolution 0.5)."""
-        self._send({"cmd": "incline", "value": value})
+    def send_batch(self, commands, seq=None):
+        """Apply several emulate/proxy/speed/incline commands at once.
+
+        commands is a list of command dicts, e.g. {"cmd": "speed", "value": 3.0}.
+        treadmill_io applies them together and answers with one status event.
+        A seq acks the whole batch, with a motor ack per quantity it sets.
+        """
+        self._send(self._with_seq({"cmd": "batch", "commands": list(commands)}, seq))
+
+    def set_targets(self, mph, incline, seq=None):
+        """Set speed and incline together (one batch)."""
+        self.send_batch([{"cmd": "speed", "value": mph}, {"cmd": "incline", "value": incline}], seq)
 
     def request_status(self):
         self._send({"cmd": "status"})
 
+    def request_snapshot(self):
+        """Ask for a snapshot event (every key's latest value) and a status event.
+
+        treadmill_io also sends both on its own to every new connection.
+        """
+        self._send({"cmd": "snapshot"})
+
+    def request_stats(self):
+        """Ask for an emu_stats event (emulate cycle timing)."""
+        self._send({"cmd": "stats"})
+
+    def request_metrics(self):
+        """Ask for metrics events (latency histograms, per-client lag)."""
+        self._send({"cmd": "metrics"})
+
+    def subscribe(self, types=None, sources=None, keys=None, buses=None, kv_rate=None):
+        """Limit the events this connection receives.
+
+        Each argument is a list of names (types: kv/status/emu_stats/metrics/program/stall,
+        sources: console/motor/emulate, keys: wire keys such as "hmph")
+        or bus ids; None means all. Source and key filters apply to kv
+        events only. kv_rate (1-100) sends at most that many kv events per
+        second for each source and key, always the latest value. Call with
+        no arguments to receive everything again.
+        """
+        cmd = {"cmd": "subscribe"}
+        for name, names in (("types", types), ("sources", sources), ("keys", keys), ("buses", buses)):
+            if names is not None:
+                cmd[name] = list(names)
+        if kv_rate is not None:
+            cmd["kv_rate"] = kv_rate
+        self._send(cmd)
+
+    def upload_program(self, segments):
+        """Run an interval program on the device.
+
+        segments is a list of (seconds, mph, incline, ramp) tuples; ramp is
+        optional and moves linearly from the previous target. Progress
+        arrives as "program" events; the program finishes at speed 0.
+        """
+        self._send({"cmd": "program", "segments": [list(s) for s in segments]})
+
+    def stop_program(self):
+        """Abort the running program and zero speed/incline."""
+        self._send({"cmd": "program", "action": "stop"})
+
+    def pause_program(self):
+        self._send({"cmd": "program", "action": "pause"})
+
+    def resume_program(self):
+        self._send({"cmd": "program", "action": "resume"})
+
+    def trace(self, action):
+        """Start, stop or dump the thread timeline recorder; "dump" writes
+        the path set in gpio.json and answers with a trace event."""
+        self._send({"cmd": "trace", "action": action})
+
     def quit_server(self):
         self._send({"cmd": "quit"})
 
     def _reader_loop(self):
-        """Background thread: read JSON lines from socket, dispatch."""
+        """Background thread: read JSON lines (or binary frames), dispatch."""
         buf = b""
+        framed = False  # switches after the server acks a binary hello
         while self._running:
             with self._lock:
                 sock = self._sock
@@ -172,15 +401,34 @@ class TreadmillClient:
                     log.warning("Buffer overflow, discarding")
                     buf = b""
                     continue
-                while b"\n" in buf:
-                    line, buf = buf.split(b"\n", 1)
-                    line = line.strip()
-                    if not line:
-                        continue
-                    try:
-                        msg = json.loads(line)
-                    except json.JSONDecodeError:
+                while buf:
+                    if framed:
+                        if len(buf) < _FRAME_LEN.size:
+                            break
+                        (n,) = _FRAME_LEN.unpack_from(buf)
+                        end = _FRAME_LEN.size + n
+                        if len(buf) < end:
+                            break
+                        rec, buf = buf[_FRAME_LEN.size:end], buf[end:]
+                        try:
+                            msg = decode_record(rec) if rec else None
+                        except (ValueError, IndexError, struct.error):
+                            msg = None
+                    else:
+                        if b"\n" not in buf:
+                            break
+                        line, buf = buf.split(b"\n", 1)
+                        line = line.strip()
+                        if not line:
+                            continue
+                        try:
+                            msg = json.loads(line)
+                        except json.JSONDecodeError:
+                            continue
+                    if not isinstance(msg, dict):
                         continue
+                    if msg.get("type") == "hello":
+                        framed = msg.get("format") == "binary"
                     if self.on_message:
                         try:
                             self.on_message(msg)